@@ -0,0 +1,349 @@
+/*!****************************************************************************
+ * \file    HostAgent.c
+ *
+ * \brief   Gateway agent brought up as a host process
+ *
+ * Brings up the Local Shadow, EnsoComms, Storage and the Test Handler on the
+ * POSIX OSAL, with no cloud connection and no radio. A COMMS_HANDLER queue
+ * stands in for the cloud and counts what the Local Shadow publishes.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "HAL.h"
+#include "ECOM_Api.h"
+#include "ECOM_Messages.h"
+#include "LSD_Api.h"
+#include "SYS_Gateway.h"
+#include "STO_Handler.h"
+#include "THA_Api.h"
+#include "HostAgent.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Queues must stay empty this long to be idle, well past the storage
+// handler's group commit window so a pending flush has been written
+#define HOST_IDLE_CHECK_MS  1000
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static EnsoDeviceId_t gatewayId;
+
+// Messages the cloud side has received, by message id
+static volatile uint32_t cloudMessages[ECOM_MAX_MESSAGES];
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   CloudListener
+ * \brief  Stands in for the comms handler, counting and dropping what the
+ *         Local Shadow would publish to the cloud
+ * \param  mq           The COMMS_HANDLER message queue
+ */
+static void CloudListener(MessageQueue_t mq)
+{
+    for ( ; ; )
+    {
+        char buffer[ECOM_MAX_MESSAGE_SIZE];
+        MessagePriority_e priority;
+
+        int size = OSAL_ReceiveMessage(mq, buffer, sizeof(buffer), &priority);
+        if (size < 1)
+        {
+            LOG_Error("ReceiveMessage() error %d", size);
+            continue;
+        }
+
+        uint8_t messageId = buffer[0];
+        if (messageId == ECOM_DELTA_MSG)
+        {
+            ECOM_ReleaseDeltaMessage((ECOM_DeltaMessage_t*)buffer);
+        }
+        cloudMessages[messageId]++;
+    }
+}
+
+/**
+ * \name   StorageListener
+ * \brief  Stands in for the storage handler, dropping what the Local Shadow
+ *         sends it
+ * \param  mq           The STORAGE_HANDLER message queue
+ */
+static void StorageListener(MessageQueue_t mq)
+{
+    for ( ; ; )
+    {
+        char buffer[ECOM_MAX_MESSAGE_SIZE];
+        MessagePriority_e priority;
+
+        int size = OSAL_ReceiveMessage(mq, buffer, sizeof(buffer), &priority);
+        if (size < 1)
+        {
+            LOG_Error("ReceiveMessage() error %d", size);
+            continue;
+        }
+        if (buffer[0] == ECOM_DELTA_MSG)
+        {
+            ECOM_ReleaseDeltaMessage((ECOM_DeltaMessage_t*)buffer);
+        }
+    }
+}
+
+/**
+ * \name   ListenerInitialise
+ * \brief  Register a queue for a handler, served by a listener thread
+ * \param  handler      The handler the listener stands in for
+ * \param  name         Queue name
+ * \param  listener     Thread function, given the queue
+ * \return EnsoErrorCode_e
+ */
+static EnsoErrorCode_e ListenerInitialise(HandlerId_e handler, const char * name,
+        void (*listener)(MessageQueue_t))
+{
+    MessageQueue_t mq = OSAL_NewMessageQueue(name, ECOM_MAX_MESSAGE_QUEUE_DEPTH,
+            ECOM_MAX_MESSAGE_SIZE);
+    if (mq == NULL)
+    {
+        LOG_Error("OSAL_NewMessageQueue failed for %s", name);
+        return eecInternalError;
+    }
+    if (OSAL_NewThread(listener, mq) == NULL)
+    {
+        LOG_Error("OSAL_NewThread failed for %s", name);
+        return eecInternalError;
+    }
+    return ECOM_RegisterMessageQueue(handler, mq);
+}
+
+/**
+ * \name   QueuesEmpty
+ * \return true if no handler has a message waiting
+ */
+static bool QueuesEmpty(void)
+{
+    for (HandlerId_e handler = COMMS_HANDLER; handler < ENSO_HANDLER_MAX; handler++)
+    {
+        MessageQueue_t mq = ECOM_GetMessageQueue(handler);
+        if (mq != NULL && OSAL_GetMessageQueueNumCurrentMessages(mq) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name   HOST_Initialise
+ * \brief  Initialise the modules in the order APP_Initialise uses
+ * \return EnsoErrorCode_e
+ */
+EnsoErrorCode_e HOST_Initialise(void)
+{
+    EnsoErrorCode_e retVal;
+
+    LOG_Init();
+    HAL_Initialise();
+    ECOM_Init();
+    retVal = ListenerInitialise(COMMS_HANDLER, "/hostCloud", CloudListener);
+    if (eecNoError != retVal)
+    {
+        return retVal;
+    }
+    retVal = LSD_Init();
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Error initialising Local Shadow %s", LSD_EnsoErrorCode_eToString(retVal));
+        return retVal;
+    }
+    retVal = SYS_Initialise();
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Error initialising SYS %s", LSD_EnsoErrorCode_eToString(retVal));
+        return retVal;
+    }
+    retVal = STO_Handler_Init();
+    if (eecNoError != retVal)
+    {
+        LOG_Error("STO_Handler_Init error %s", LSD_EnsoErrorCode_eToString(retVal));
+        return retVal;
+    }
+    retVal = THA_Init();
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Error initialising THA %s", LSD_EnsoErrorCode_eToString(retVal));
+        return retVal;
+    }
+    retVal = THA_Start();
+    if (eecNoError != retVal)
+    {
+        LOG_Error("THA_Start error %s", LSD_EnsoErrorCode_eToString(retVal));
+        return retVal;
+    }
+    SYS_GetDeviceId(&gatewayId);
+    return retVal;
+}
+
+/**
+ * \name   HOST_InitialiseShadow
+ * \brief  Initialise the Local Shadow alone, with stand-ins for the cloud
+ *         and the storage handler it notifies. LOG_Init() is left to the
+ *         caller.
+ * \return EnsoErrorCode_e
+ */
+EnsoErrorCode_e HOST_InitialiseShadow(void)
+{
+    ECOM_Init();
+    EnsoErrorCode_e retVal = ListenerInitialise(COMMS_HANDLER, "/hostCloud", CloudListener);
+    if (eecNoError == retVal)
+    {
+        retVal = ListenerInitialise(STORAGE_HANDLER, "/hostStorage", StorageListener);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = LSD_Init();
+    }
+    return retVal;
+}
+
+/**
+ * \name   HOST_GetGatewayId
+ * \param  deviceId     Set to the device id of the gateway
+ */
+void HOST_GetGatewayId(EnsoDeviceId_t * deviceId)
+{
+    *deviceId = gatewayId;
+}
+
+/**
+ * \name   HOST_SetGatewayBuffer
+ * \brief  Set the desired value of a test handler control property, as the
+ *         cloud would
+ * \param  cloudName    The control property
+ * \param  value        Key value pairs for the test handler
+ * \return EnsoErrorCode_e
+ */
+EnsoErrorCode_e HOST_SetGatewayBuffer(const char * cloudName, const char * value)
+{
+    size_t bytesCopied;
+    EnsoErrorCode_e retVal = LSD_SetPropertyBufferByCloudName(COMMS_HANDLER, &gatewayId,
+            DESIRED_GROUP, cloudName, strlen(value) + 1, value, &bytesCopied);
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Failed to set %s: %s", cloudName, LSD_EnsoErrorCode_eToString(retVal));
+    }
+    return retVal;
+}
+
+/**
+ * \name   HOST_SetDeviceProperty
+ * \brief  Set the desired value of an unsigned property on a device, as the
+ *         cloud would. The line holds the device address in hex, the cloud
+ *         name and the value.
+ * \param  line         The arguments
+ * \return EnsoErrorCode_e
+ */
+EnsoErrorCode_e HOST_SetDeviceProperty(const char * line)
+{
+    EnsoDeviceId_t deviceId = { 0 };
+    uint64_t address;
+    unsigned int technology;
+    unsigned int childDeviceId;
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    EnsoPropertyValue_u value;
+
+    if (sscanf(line, "%" SCNx64 ".%x.%x %11s %" SCNu32, &address, &technology, &childDeviceId,
+               cloudName, &value.uint32Value) != 5)
+    {
+        LOG_Error("Usage: s <address>.<type>.<child> <property> <value>");
+        return eecParameterOutOfRange;
+    }
+    deviceId.deviceAddress = address;
+    deviceId.technology = technology;
+    deviceId.childDeviceId = childDeviceId;
+    deviceId.isChild = false;
+
+    EnsoErrorCode_e retVal = LSD_SetPropertyValueByCloudName(COMMS_HANDLER, &deviceId,
+            DESIRED_GROUP, cloudName, value);
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Failed to set %s: %s", cloudName, LSD_EnsoErrorCode_eToString(retVal));
+    }
+    return retVal;
+}
+
+/**
+ * \name   HOST_GetCloudMessages
+ * \param  messageId    ECOM message id
+ * \return Number of messages of that id the cloud side has received
+ */
+uint32_t HOST_GetCloudMessages(uint8_t messageId)
+{
+    return cloudMessages[messageId];
+}
+
+/**
+ * \name   HOST_WaitForIdle
+ * \brief  Wait until the handlers have nothing left to do, the storage
+ *         handler included
+ * \param  timeoutMs    Longest wait
+ * \return true if the handlers went idle in time
+ */
+bool HOST_WaitForIdle(uint32_t timeoutMs)
+{
+    uint32_t start = OSAL_time_ms();
+    uint32_t idleSince = start;
+    while (OSAL_time_ms() - start < timeoutMs)
+    {
+        OSAL_sleep_ms(10);
+        if (!QueuesEmpty())
+        {
+            idleSince = OSAL_time_ms();
+        }
+        else if (OSAL_time_ms() - idleSince >= HOST_IDLE_CHECK_MS)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \name   HOST_DumpQueues
+ * \brief  Show the use of each handler's message queue and what has been
+ *         published to the cloud
+ */
+void HOST_DumpQueues(void)
+{
+    for (HandlerId_e handler = COMMS_HANDLER; handler < ENSO_HANDLER_MAX; handler++)
+    {
+        MessageQueue_t mq = ECOM_GetMessageQueue(handler);
+        if (mq != NULL)
+        {
+            LOG_Info("Handler %2d: %d waiting, high water %d of %d, %d refused", handler,
+                     OSAL_GetMessageQueueNumCurrentMessages(mq),
+                     OSAL_GetMessageQueueHighWaterMark(mq),
+                     OSAL_GetMessageQueueSize(mq),
+                     OSAL_GetMessageQueueAllocationFailures(mq));
+        }
+    }
+    LOG_Info("Cloud: %" PRIu32 " deltas, %" PRIu32 " thing status", cloudMessages[ECOM_DELTA_MSG],
+             cloudMessages[ECOM_THING_STATUS]);
+}
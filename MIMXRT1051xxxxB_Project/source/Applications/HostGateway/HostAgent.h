@@ -0,0 +1,48 @@
+/*!****************************************************************************
+ * \file    HostAgent.h
+ *
+ * \brief   Gateway agent brought up as a host process, shared by the host
+ *          main and the host tests
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef HOST_AGENT_H
+#define HOST_AGENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "LSD_Types.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Test handler control properties on the gateway, see THA_Api.c
+#define HOST_THA_TEMPLATE   "test_tmplt"
+#define HOST_THA_CONTROL    "test_cntrl"
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+EnsoErrorCode_e HOST_Initialise(void);
+
+EnsoErrorCode_e HOST_InitialiseShadow(void);
+
+void HOST_GetGatewayId(EnsoDeviceId_t * deviceId);
+
+EnsoErrorCode_e HOST_SetGatewayBuffer(const char * cloudName, const char * value);
+
+EnsoErrorCode_e HOST_SetDeviceProperty(const char * line);
+
+uint32_t HOST_GetCloudMessages(uint8_t messageId);
+
+bool HOST_WaitForIdle(uint32_t timeoutMs);
+
+void HOST_DumpQueues(void);
+
+#endif /* HOST_AGENT_H */
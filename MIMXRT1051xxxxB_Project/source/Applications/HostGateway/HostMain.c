@@ -0,0 +1,122 @@
+/*!****************************************************************************
+ * \file    HostMain.c
+ *
+ * \brief   Entry point for the gateway agent running as a host process
+ *
+ * Brings up the Local Shadow, EnsoComms, Storage and the Test Handler on the
+ * POSIX OSAL, with no cloud connection and no radio. Commands read from stdin
+ * stand in for the cloud, so a script can create test devices and drive
+ * desired property changes through ECOM routing and the storage manager.
+ * Stores are kept in OSAL_STORE_DIR, so restarting the process replays them.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "HostAgent.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define HOST_LINE_LENGTH    512
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name   main
+ * \brief  Host gateway main function
+ * \param  argc     - Number of command line arguments
+ * \param  argv     - Argument strings
+ */
+int main(int argc, char* argv[])
+{
+    EnsoErrorCode_e retVal = HOST_Initialise();
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Host Initialisation error %s", LSD_EnsoErrorCode_eToString(retVal));
+        return EXIT_FAILURE;
+    }
+
+    bool interactive = (argc < 2) || (strcmp(argv[1], "-q") != 0);
+    bool keepLooping = true;
+    do
+    {
+        if (interactive)
+        {
+            LOG_Info("Commands:");
+            LOG_Info(" q - Quit application");
+            LOG_Info(" d - Dump object store");
+            LOG_Info(" r - Dump message queue statistics");
+            LOG_Info(" m <kvp> - Set the test handler property template");
+            LOG_Info(" c <kvp> - Create a test device");
+            LOG_Info(" s <address>.<type>.<child> <property> <value> - Set a desired property");
+            LOG_Info(" w <ms> - Wait for the handlers");
+            interactive = false;
+        }
+
+        char buffer[HOST_LINE_LENGTH];
+        if (!OSAL_fgets(buffer, sizeof buffer, stdin))
+        {
+            break; // End of input
+        }
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        char c = buffer[0];
+        bool b = buffer[1] == '1';
+        const char * arg = buffer[1] == ' ' ? &buffer[2] : &buffer[1];
+        switch (c)
+        {
+        case 'c':
+            HOST_SetGatewayBuffer(HOST_THA_CONTROL, arg);
+            break;
+        case 'd':
+            LSD_DumpObjectStore();
+            break;
+        case 'e':
+            LOG_EnableError(b);
+            break;
+        case 'i':
+            LOG_EnableInfo(b);
+            break;
+        case 'm':
+            HOST_SetGatewayBuffer(HOST_THA_TEMPLATE, arg);
+            break;
+        case 'q':
+            keepLooping = false;
+            break;
+        case 'r':
+            HOST_DumpQueues();
+            break;
+        case 's':
+            HOST_SetDeviceProperty(arg);
+            break;
+        case 't':
+            LOG_EnableTrace(b);
+            break;
+        case 'w':
+            OSAL_sleep_ms(strtoul(arg, NULL, 10));
+            break;
+        case '\0':
+        case '#':
+            break;
+        default:
+            LOG_Error("Unknown command %s", buffer);
+            break;
+        }
+    } while (keepLooping);
+
+    // Let the handlers finish with what is already queued
+    OSAL_sleep_ms(500);
+    HOST_DumpQueues();
+    return EXIT_SUCCESS;
+}
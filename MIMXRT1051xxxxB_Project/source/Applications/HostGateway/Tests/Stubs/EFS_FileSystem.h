@@ -0,0 +1,19 @@
+/*!****************************************************************************
+ * \file    EFS_FileSystem.h
+ *
+ * \brief   Stands in for the RT1050 file system header. The host tests have
+ *          no file system to start, EFS_Init is all they need.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef EFS_FILESYSTEM_H
+#define EFS_FILESYSTEM_H
+
+static inline void EFS_Init(void)
+{
+}
+
+#endif /* EFS_FILESYSTEM_H */
@@ -0,0 +1,72 @@
+/*!****************************************************************************
+ * \file    FreeRTOS.h
+ *
+ * \brief   Stands in for the FreeRTOS kernel headers, so code written
+ *          against tasks, queues and semaphores can run in the host tests.
+ *          Only the calls the gateway sources make are here, see
+ *          TST_FreeRTOS.c.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// As the gateway's FreeRTOSConfig.h
+#define configTICK_RATE_HZ          ((TickType_t)200)
+#define configMINIMAL_STACK_SIZE    ((unsigned short)90)
+
+#define portMAX_DELAY               ((TickType_t)0xffffffffUL)
+
+#define pdFALSE                     ((BaseType_t)0)
+#define pdTRUE                      ((BaseType_t)1)
+#define pdFAIL                      pdFALSE
+#define pdPASS                      pdTRUE
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef struct TST_Queue_tag * QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef void * TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t ticksToWait);
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t ticksToWait);
+
+void vQueueDelete(QueueHandle_t queue);
+
+// A binary semaphore is a queue of one empty item, as in FreeRTOS
+#define xSemaphoreCreateBinary()            xQueueCreate(1, 0)
+#define xSemaphoreGive(semaphore)           xQueueSend((semaphore), NULL, 0)
+#define xSemaphoreTake(semaphore, ticks)    xQueueReceive((semaphore), NULL, (ticks))
+#define vSemaphoreDelete(semaphore)         vQueueDelete(semaphore)
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char * name, uint16_t stackDepth,
+                       void * parameters, UBaseType_t priority, TaskHandle_t * createdTask);
+
+void vTaskDelete(TaskHandle_t task);
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+
+#endif /* FREERTOS_H */
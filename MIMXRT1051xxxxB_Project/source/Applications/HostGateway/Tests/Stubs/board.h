@@ -0,0 +1,17 @@
+/*!****************************************************************************
+ * \file    board.h
+ *
+ * \brief   Stands in for the board header, which the WiSafe radio
+ *          sources include but the host tests do not need
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdint.h>
+
+#endif /* BOARD_H */
@@ -0,0 +1,18 @@
+/*!****************************************************************************
+ * \file    fsl_debug_console.h
+ *
+ * \brief   Stands in for the SDK debug console, PRINTF goes to stdout
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef FSL_DEBUG_CONSOLE_H
+#define FSL_DEBUG_CONSOLE_H
+
+#include <stdio.h>
+
+#define PRINTF printf
+
+#endif /* FSL_DEBUG_CONSOLE_H */
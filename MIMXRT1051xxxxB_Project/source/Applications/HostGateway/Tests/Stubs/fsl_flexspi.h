@@ -0,0 +1,25 @@
+/*!****************************************************************************
+ * \file    fsl_flexspi.h
+ *
+ * \brief   Stands in for the SDK FlexSPI driver header, so flash layout
+ *          headers and the code using them can be built for the host tests
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef FSL_FLEXSPI_H
+#define FSL_FLEXSPI_H
+
+#include <stdint.h>
+
+// As fsl_common.h, which the driver header brings in
+typedef int32_t status_t;
+
+enum
+{
+    kStatus_Success = 0,
+};
+
+#endif /* FSL_FLEXSPI_H */
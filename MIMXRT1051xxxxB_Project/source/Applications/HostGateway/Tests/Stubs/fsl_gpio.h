@@ -0,0 +1,17 @@
+/*!****************************************************************************
+ * \file    fsl_gpio.h
+ *
+ * \brief   Stands in for the SDK GPIO driver header, which the WiSafe radio
+ *          sources include but the host tests do not need
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef FSL_GPIO_H
+#define FSL_GPIO_H
+
+#include <stdint.h>
+
+#endif /* FSL_GPIO_H */
@@ -0,0 +1,15 @@
+/*!****************************************************************************
+ * \file    debug.h
+ *
+ * \brief   Stands in for the lwIP debug header, which the host tests do not
+ *          need. See sockets.h.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef LWIP_DEBUG_H
+#define LWIP_DEBUG_H
+
+#endif /* LWIP_DEBUG_H */
@@ -0,0 +1,15 @@
+/*!****************************************************************************
+ * \file    netdb.h
+ *
+ * \brief   Stands in for the lwIP netdb header, which the host tests do not
+ *          need. See sockets.h.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef LWIP_NETDB_H
+#define LWIP_NETDB_H
+
+#endif /* LWIP_NETDB_H */
@@ -0,0 +1,15 @@
+/*!****************************************************************************
+ * \file    opt.h
+ *
+ * \brief   Stands in for the lwIP opt header, which the host tests do not
+ *          need. See sockets.h.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef LWIP_OPT_H
+#define LWIP_OPT_H
+
+#endif /* LWIP_OPT_H */
@@ -0,0 +1,19 @@
+/*!****************************************************************************
+ * \file    sockets.h
+ *
+ * \brief   Stands in for the lwIP sockets header with the host's own sockets
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+#include <sys/socket.h>
+
+#define lwip_send   send
+#define lwip_recv   recv
+
+#endif /* LWIP_SOCKETS_H */
@@ -0,0 +1,15 @@
+/*!****************************************************************************
+ * \file    stats.h
+ *
+ * \brief   Stands in for the lwIP stats header, which the host tests do not
+ *          need. See sockets.h.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef LWIP_STATS_H
+#define LWIP_STATS_H
+
+#endif /* LWIP_STATS_H */
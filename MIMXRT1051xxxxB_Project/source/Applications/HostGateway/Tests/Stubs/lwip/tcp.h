@@ -0,0 +1,15 @@
+/*!****************************************************************************
+ * \file    tcp.h
+ *
+ * \brief   Stands in for the lwIP tcp header, which the host tests do not
+ *          need. See sockets.h.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef LWIP_TCP_H
+#define LWIP_TCP_H
+
+#endif /* LWIP_TCP_H */
@@ -0,0 +1,16 @@
+/*!****************************************************************************
+ * \file    queue.h
+ *
+ * \brief   Stands in for the FreeRTOS queue header, see FreeRTOS.h
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "FreeRTOS.h"
+
+#endif /* QUEUE_H */
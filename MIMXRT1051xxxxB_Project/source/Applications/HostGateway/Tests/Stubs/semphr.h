@@ -0,0 +1,16 @@
+/*!****************************************************************************
+ * \file    semphr.h
+ *
+ * \brief   Stands in for the FreeRTOS semphr header, see FreeRTOS.h
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "FreeRTOS.h"
+
+#endif /* SEMPHR_H */
@@ -0,0 +1,16 @@
+/*!****************************************************************************
+ * \file    task.h
+ *
+ * \brief   Stands in for the FreeRTOS task header, see FreeRTOS.h
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef TASK_H
+#define TASK_H
+
+#include "FreeRTOS.h"
+
+#endif /* TASK_H */
@@ -0,0 +1,134 @@
+/*!****************************************************************************
+ * \file    TST_Api.c
+ *
+ * \brief   Checks and simulated boots for the host tests
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static int failures;
+
+static char storeDir[] = "/tmp/hostStoreXXXXXX";
+
+static char storePath[256];
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name   TST_Check
+ * \brief  Record the result of a check, reporting it if it failed
+ * \param  passed       Result of the check
+ * \param  expression   The check, as written
+ * \param  file         Source file of the check
+ * \param  line         Line of the check
+ * \return passed
+ */
+bool TST_Check(bool passed, const char * expression, const char * file, int line)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+        failures++;
+    }
+    return passed;
+}
+
+/**
+ * \name   TST_UseNewStore
+ * \brief  Point OSAL_STORE_DIR at a new, empty directory, so a test starts
+ *         from a gateway with nothing stored
+ * \return The directory
+ */
+const char * TST_UseNewStore(void)
+{
+    strcpy(storeDir, "/tmp/hostStoreXXXXXX");
+    if (mkdtemp(storeDir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    setenv("OSAL_STORE_DIR", storeDir, 1);
+    return storeDir;
+}
+
+/**
+ * \name   TST_StorePath
+ * \brief  Path of the file the POSIX OSAL keeps a store in
+ * \param  storeName    Name of the store
+ * \return The path, valid until the next call
+ */
+const char * TST_StorePath(const char * storeName)
+{
+    snprintf(storePath, sizeof(storePath), "%s/%s", storeDir, storeName);
+    return storePath;
+}
+
+/**
+ * \name   TST_Boot
+ * \brief  Run one power cycle of the gateway in a child process. The agent
+ *         threads never stop, so the child ends when the boot function
+ *         returns, with whatever it wrote left in the store.
+ * \param  name         Shown in the test log
+ * \param  boot         Runs in the child
+ * \return true if the child exited without failing a check
+ */
+bool TST_Boot(const char * name, void (*boot)(void))
+{
+    printf("--- %s\n", name);
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        boot();
+        fflush(stdout);
+        fflush(stderr);
+        _exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid)
+    {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
+    }
+    bool passed = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    if (!passed)
+    {
+        fprintf(stderr, "%s failed, status 0x%x\n", name, status);
+        failures++;
+    }
+    return passed;
+}
+
+/**
+ * \name   TST_Result
+ * \return Exit status for the test executable
+ */
+int TST_Result(void)
+{
+    printf("%s\n", failures == 0 ? "PASSED" : "FAILED");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
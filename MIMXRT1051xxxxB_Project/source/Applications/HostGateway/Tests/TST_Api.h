@@ -0,0 +1,45 @@
+/*!****************************************************************************
+ * \file    TST_Api.h
+ *
+ * \brief   Checks and simulated boots for the host tests
+ *
+ * Each test is a host executable run by CTest. A test boots the agent in a
+ * forked child, once per simulated power cycle, against a store directory
+ * of its own, and exits non-zero if any check failed.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef TST_API_H
+#define TST_API_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*!****************************************************************************
+ * Macros
+ *****************************************************************************/
+
+#define TST_ASSERT(condition) \
+    TST_Check((condition), #condition, __FILE__, __LINE__)
+
+#define TST_ASSERT_EQUAL(actual, expected) \
+    TST_Check((actual) == (expected), #actual " == " #expected, __FILE__, __LINE__)
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+bool TST_Check(bool passed, const char * expression, const char * file, int line);
+
+const char * TST_UseNewStore(void);
+
+const char * TST_StorePath(const char * storeName);
+
+bool TST_Boot(const char * name, void (*boot)(void));
+
+int TST_Result(void);
+
+#endif /* TST_API_H */
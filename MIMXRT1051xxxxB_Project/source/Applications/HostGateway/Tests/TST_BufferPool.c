@@ -0,0 +1,346 @@
+/*!****************************************************************************
+ * \file    TST_BufferPool.c
+ *
+ * \brief   Stress of the lock-free radio buffer pool and its timed acquire
+ *
+ * Workers keep 100 alarm and fault transactions pending at once, each
+ * holding a radio buffer, against a pool of RADIOCOMMSBUFFER_POOL_SIZE.
+ * When the timed acquire gives up the oldest pending transaction of the
+ * worker expires and releases its buffer, as pending alarms and faults do.
+ *
+ * A buffer must never be handed to two transactions at once, must keep what
+ * its transaction wrote to it, and every buffer must be back on the free
+ * list exactly once at the end: no buffer lost and none freed twice.
+ *
+ * The timed acquire must give up after its timeout on an empty pool, and
+ * must be woken by a buffer released from another thread.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "WiSafe_RadioCommsBuffer.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_POOL_SIZE           RADIOCOMMSBUFFER_POOL_SIZE
+#define TST_WORKERS             10
+#define TST_PER_WORKER          10          // Pending per worker, 100 in all
+#define TST_ROUNDS              20
+#define TST_GET_TIMEOUT_MS      5
+#define TST_EMPTY_TIMEOUT_MS    50
+#define TST_RELEASE_DELAY_MS    20
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+// Every buffer of the pool, and the worker holding it plus one, 0 if free
+static radioCommsBuffer_t * pool[TST_POOL_SIZE];
+static uint32_t owner[TST_POOL_SIZE];
+
+// Counted by the workers, checked once they are done
+static uint32_t doubleAllocations;
+static uint32_t wrongReleases;
+static uint32_t corruptions;
+static uint32_t transactions;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Now
+ * \return Monotonic time in ms
+ */
+static uint64_t Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * \name   PoolIndex
+ * \return Index of a buffer in the pool, -1 if it is not one of them
+ */
+static int PoolIndex(const radioCommsBuffer_t * buffer)
+{
+    for (int i = 0; i < TST_POOL_SIZE; i++)
+    {
+        if (pool[i] == buffer)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * \name   TakeAll
+ * \brief  Empty the pool
+ * \return Buffers taken, into buffers
+ */
+static int TakeAll(radioCommsBuffer_t * buffers[], int size)
+{
+    int taken = 0;
+    radioCommsBuffer_t * buffer;
+    while ((taken < size) && ((buffer = WiSafe_RadioCommsBufferGet()) != NULL))
+    {
+        buffers[taken++] = buffer;
+    }
+    return taken;
+}
+
+/**
+ * \name   Acquired
+ * \brief  Mark a buffer as held by a worker, and fill it in as an alarm
+ *         (0x50) or a fault (0x71) tagged with the transaction
+ */
+static void Acquired(uint32_t worker, uint32_t transaction, radioCommsBuffer_t * buffer)
+{
+    int i = PoolIndex(buffer);
+    uint32_t free = 0;
+    if ((i < 0) || !__atomic_compare_exchange_n(&owner[i], &free, worker + 1, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        __atomic_fetch_add(&doubleAllocations, 1, __ATOMIC_RELAXED);
+    }
+
+    buffer->data[0] = (transaction & 1) ? 0x71 : 0x50;
+    buffer->count = 9;
+    memset(&buffer->data[1], (uint8_t)(worker * TST_PER_WORKER + transaction), buffer->count - 1);
+    buffer->next = NULL;
+}
+
+/**
+ * \name   Complete
+ * \brief  Check a pending transaction's buffer, then release it
+ */
+static void Complete(uint32_t worker, radioCommsBuffer_t * buffer)
+{
+    for (uint32_t k = 2; k < buffer->count; k++)
+    {
+        if (buffer->data[k] != buffer->data[1])
+        {
+            __atomic_fetch_add(&corruptions, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    int i = PoolIndex(buffer);
+    uint32_t held = worker + 1;
+    if ((i < 0) || !__atomic_compare_exchange_n(&owner[i], &held, 0, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        __atomic_fetch_add(&wrongReleases, 1, __ATOMIC_RELAXED);
+    }
+    WiSafe_RadioCommsBufferRelease(buffer);
+    __atomic_fetch_add(&transactions, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * \name   Worker
+ * \brief  Keep TST_PER_WORKER transactions pending, expiring the oldest
+ *         when no buffer comes free in time
+ */
+static void * Worker(void * arg)
+{
+    uint32_t worker = (uint32_t)(uintptr_t)arg;
+    radioCommsBuffer_t * pending = NULL;
+    radioCommsBuffer_t * last = NULL;
+
+    for (int round = 0; round < TST_ROUNDS; round++)
+    {
+        uint32_t started = 0;
+        while (started < TST_PER_WORKER)
+        {
+            radioCommsBuffer_t * buffer = WiSafe_RadioCommsBufferGetTimeout(TST_GET_TIMEOUT_MS);
+            if (buffer == NULL)
+            {
+                if (pending != NULL)
+                {
+                    radioCommsBuffer_t * oldest = pending;
+                    pending = oldest->next;
+                    if (pending == NULL)
+                    {
+                        last = NULL;
+                    }
+                    Complete(worker, oldest);
+                }
+                continue;
+            }
+
+            Acquired(worker, started, buffer);
+            if (last != NULL)
+            {
+                last->next = buffer;
+            }
+            else
+            {
+                pending = buffer;
+            }
+            last = buffer;
+            started++;
+            sched_yield();
+        }
+
+        while (pending != NULL)
+        {
+            radioCommsBuffer_t * next = pending->next;
+            Complete(worker, pending);
+            pending = next;
+        }
+        last = NULL;
+    }
+    return NULL;
+}
+
+/**
+ * \name   Transactions
+ * \brief  Drive 100 concurrent transactions through the pool
+ */
+static void Transactions(void)
+{
+    radioCommsBufferStats_t before;
+    radioCommsBufferStats_t after;
+    radioCommsBuffer_t * left[TST_POOL_SIZE + 1];
+
+    // Learn the buffers of the pool
+    TST_ASSERT_EQUAL(TakeAll(pool, TST_POOL_SIZE), TST_POOL_SIZE);
+    for (int i = 0; i < TST_POOL_SIZE; i++)
+    {
+        WiSafe_RadioCommsBufferRelease(pool[i]);
+    }
+    WiSafe_RadioCommsBufferGetStats(&before);
+
+    pthread_t workers[TST_WORKERS];
+    uint64_t start = Now();
+    for (uint32_t w = 0; w < TST_WORKERS; w++)
+    {
+        TST_ASSERT_EQUAL(pthread_create(&workers[w], NULL, Worker, (void *)(uintptr_t)w), 0);
+    }
+    for (uint32_t w = 0; w < TST_WORKERS; w++)
+    {
+        pthread_join(workers[w], NULL);
+    }
+    uint64_t elapsed = Now() - start;
+
+    WiSafe_RadioCommsBufferGetStats(&after);
+    printf("%d transactions on %d buffers in %llu ms: high water %u, %u waits, %u timed out\n",
+           TST_WORKERS * TST_PER_WORKER * TST_ROUNDS, TST_POOL_SIZE, (unsigned long long)elapsed,
+           after.highWater, after.waits - before.waits, after.failures - before.failures);
+    fflush(stdout);
+
+    TST_ASSERT_EQUAL(doubleAllocations, 0);
+    TST_ASSERT_EQUAL(wrongReleases, 0);
+    TST_ASSERT_EQUAL(corruptions, 0);
+    TST_ASSERT_EQUAL(transactions, TST_WORKERS * TST_PER_WORKER * TST_ROUNDS);
+    TST_ASSERT_EQUAL(after.allocations - before.allocations, transactions);
+    TST_ASSERT_EQUAL(after.inUse, 0);
+    TST_ASSERT(after.highWater <= TST_POOL_SIZE);
+    TST_ASSERT(after.waits > before.waits);
+
+    // Every buffer is free again, once each
+    int taken = TakeAll(left, TST_POOL_SIZE + 1);
+    TST_ASSERT_EQUAL(taken, TST_POOL_SIZE);
+    for (int i = 0; i < taken; i++)
+    {
+        TST_ASSERT(PoolIndex(left[i]) >= 0);
+        for (int j = 0; j < i; j++)
+        {
+            TST_ASSERT(left[i] != left[j]);
+        }
+    }
+}
+
+/**
+ * \name   DelayedRelease
+ * \brief  Release a buffer after a while
+ */
+static void * DelayedRelease(void * buffer)
+{
+    OSAL_sleep_ms(TST_RELEASE_DELAY_MS);
+    WiSafe_RadioCommsBufferRelease(buffer);
+    return NULL;
+}
+
+/**
+ * \name   TimedAcquire
+ * \brief  An empty pool times out, and a release wakes a waiter
+ */
+static void TimedAcquire(void)
+{
+    radioCommsBuffer_t * buffers[TST_POOL_SIZE];
+    TST_ASSERT_EQUAL(TakeAll(buffers, TST_POOL_SIZE), TST_POOL_SIZE);
+
+    uint64_t start = Now();
+    TST_ASSERT(WiSafe_RadioCommsBufferGetTimeout(TST_EMPTY_TIMEOUT_MS) == NULL);
+    TST_ASSERT(Now() - start >= TST_EMPTY_TIMEOUT_MS);
+
+    pthread_t releaser;
+    TST_ASSERT_EQUAL(pthread_create(&releaser, NULL, DelayedRelease, buffers[0]), 0);
+    start = Now();
+    radioCommsBuffer_t * buffer = WiSafe_RadioCommsBufferGetTimeout(10 * TST_RELEASE_DELAY_MS);
+    uint64_t waited = Now() - start;
+    pthread_join(releaser, NULL);
+    TST_ASSERT(buffer == buffers[0]);
+    TST_ASSERT(waited < 10 * TST_RELEASE_DELAY_MS);
+
+    for (int i = 1; i < TST_POOL_SIZE; i++)
+    {
+        WiSafe_RadioCommsBufferRelease(buffers[i]);
+    }
+    WiSafe_RadioCommsBufferRelease(buffer);
+}
+
+/**
+ * \name   Initialise
+ * \brief  Quiet logging
+ */
+static void Initialise(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+}
+
+/**
+ * \name   TransactionsBoot
+ */
+static void TransactionsBoot(void)
+{
+    Initialise();
+    Transactions();
+}
+
+/**
+ * \name   TimedAcquireBoot
+ */
+static void TimedAcquireBoot(void)
+{
+    Initialise();
+    TimedAcquire();
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_Boot("100 concurrent alarm and fault transactions", TransactionsBoot);
+    TST_Boot("Timed acquire", TimedAcquireBoot);
+    return TST_Result();
+}
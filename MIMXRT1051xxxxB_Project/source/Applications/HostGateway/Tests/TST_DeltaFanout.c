@@ -0,0 +1,308 @@
+/*!****************************************************************************
+ * \file    TST_DeltaFanout.c
+ *
+ * \brief   Tests of the shared delta blocks the local shadow fans out
+ *
+ * A delta block is sent to subscribers with different masks, each must
+ * read back exactly its deltas, in place when the mask selects them all.
+ * The local shadow then publishes a set of deltas to the cloud, storage
+ * and a property subscriber, which each get only the deltas meant for
+ * them and none go back to the publisher. Blocks past the pool come from
+ * the heap, and every block must be back in the pool once the last
+ * reference is dropped.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "ECOM_Api.h"
+#include "ECOM_Messages.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_FIRST_PROPERTY      0x400
+#define TST_FIRST_VALUE         500
+
+// Properties of the test device: the first four public, persistent ones
+// and those the automation engine subscribes to
+#define TST_PUBLIC_PROPERTIES   4
+#define TST_PERSISTENT_MASK     0x12
+#define TST_SUBSCRIBED_MASK     0x24
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static MessageQueue_t queues[ENSO_HANDLER_MAX];
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   MakeDeltas
+ * \brief  ECOM_MAX_DELTAS deltas, with values offset by base
+ */
+static void MakeDeltas(EnsoPropertyDelta_t * deltas, uint32_t base)
+{
+    memset(deltas, 0, ECOM_MAX_DELTAS * sizeof(*deltas));
+    for (int i = 0; i < ECOM_MAX_DELTAS; i++)
+    {
+        deltas[i].agentSidePropertyID = TST_FIRST_PROPERTY + i;
+        deltas[i].propertyValue.uint32Value = base + i;
+    }
+}
+
+/**
+ * \name   AddQueue
+ * \brief  Register a queue for a handler, read by the test itself
+ */
+static void AddQueue(HandlerId_e handler)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "/tst%d", handler);
+    queues[handler] = OSAL_NewMessageQueue(name, ECOM_MAX_MESSAGE_QUEUE_DEPTH, ECOM_MAX_MESSAGE_SIZE);
+    if (TST_ASSERT(queues[handler] != NULL))
+    {
+        TST_ASSERT_EQUAL(ECOM_RegisterMessageQueue(handler, queues[handler]), eecNoError);
+    }
+}
+
+/**
+ * \name   ReceiveDeltas
+ * \brief  Read the next message of a handler, which must be a delta
+ *         message, and release it
+ * \param  handler      The subscriber
+ * \param  base         Value of the first delta
+ * \param  blockSize    Number of deltas in the block sent
+ * \return Mask of the test deltas it held with their expected values, or 0
+ *         if there was none
+ */
+static uint8_t ReceiveDeltas(HandlerId_e handler, uint32_t base, uint16_t blockSize)
+{
+    uint8_t buffer[ECOM_MAX_MESSAGE_SIZE];
+    MessagePriority_e priority;
+
+    while (OSAL_GetMessageQueueNumCurrentMessages(queues[handler]) > 0)
+    {
+        int size = OSAL_ReceiveMessage(queues[handler], buffer, sizeof(buffer), &priority);
+        if (!TST_ASSERT(size > 0) || buffer[0] != ECOM_DELTA_MSG)
+        {
+            continue;
+        }
+
+        ECOM_DeltaMessage_t * message = (ECOM_DeltaMessage_t *)buffer;
+        EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+        uint16_t numProperties = 0;
+        const EnsoPropertyDelta_t * deltas = ECOM_GetDeltas(message, scratch, &numProperties);
+        TST_ASSERT_EQUAL(numProperties, message->numProperties);
+
+        uint8_t mask = 0;
+        for (int n = 0; deltas != NULL && n < numProperties; n++)
+        {
+            int i = deltas[n].agentSidePropertyID - TST_FIRST_PROPERTY;
+            if (TST_ASSERT(i >= 0 && i < ECOM_MAX_DELTAS))
+            {
+                TST_ASSERT_EQUAL(deltas[n].propertyValue.uint32Value, base + i);
+                mask |= 1u << i;
+            }
+        }
+        TST_ASSERT_EQUAL(mask, message->deltaMask);
+
+        // The block is read in place when the subscriber gets all of it
+        bool inPlace = (deltas != scratch);
+        TST_ASSERT_EQUAL(inPlace, numProperties == blockSize);
+        ECOM_ReleaseDeltaMessage(message);
+        return mask;
+    }
+    return 0;
+}
+
+/**
+ * \name   Drain
+ * \brief  Drop every message waiting for a handler
+ */
+static void Drain(HandlerId_e handler)
+{
+    uint8_t buffer[ECOM_MAX_MESSAGE_SIZE];
+    MessagePriority_e priority;
+
+    while (queues[handler] != NULL && OSAL_GetMessageQueueNumCurrentMessages(queues[handler]) > 0)
+    {
+        if (OSAL_ReceiveMessage(queues[handler], buffer, sizeof(buffer), &priority) > 0 &&
+            buffer[0] == ECOM_DELTA_MSG)
+        {
+            ECOM_ReleaseDeltaMessage((ECOM_DeltaMessage_t *)buffer);
+        }
+    }
+}
+
+/**
+ * \name   CheckPoolFree
+ * \brief  The whole pool can be taken without touching the heap, so every
+ *         block has been returned
+ */
+static void CheckPoolFree(void)
+{
+    static ECOM_DeltaBlock_t * blocks[ECOM_DELTA_POOL_SIZE + 1];
+    EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+    EnsoDeviceId_t deviceId = { 0 };
+    MakeDeltas(deltas, 0);
+
+    size_t freeHeap = OSAL_GetFreeHeapSize();
+    for (int n = 0; n < ECOM_DELTA_POOL_SIZE; n++)
+    {
+        blocks[n] = ECOM_NewDeltaBlock(deviceId, REPORTED_GROUP, ECOM_MAX_DELTAS, deltas);
+        TST_ASSERT(blocks[n] != NULL);
+    }
+    TST_ASSERT_EQUAL(OSAL_GetFreeHeapSize(), freeHeap);
+
+    // One more comes from the heap
+    blocks[ECOM_DELTA_POOL_SIZE] = ECOM_NewDeltaBlock(deviceId, REPORTED_GROUP, ECOM_MAX_DELTAS, deltas);
+    TST_ASSERT(blocks[ECOM_DELTA_POOL_SIZE] != NULL);
+    TST_ASSERT(OSAL_GetFreeHeapSize() < freeHeap);
+
+    for (int n = 0; n <= ECOM_DELTA_POOL_SIZE; n++)
+    {
+        ECOM_ReleaseDeltaBlock(blocks[n]);
+    }
+    TST_ASSERT_EQUAL(OSAL_GetFreeHeapSize(), freeHeap);
+}
+
+/**
+ * \name   SharedBlockBoot
+ * \brief  One block sent to three subscribers with different masks
+ */
+static void SharedBlockBoot(void)
+{
+    LOG_Init();
+    ECOM_Init();
+    AddQueue(COMMS_HANDLER);
+    AddQueue(STORAGE_HANDLER);
+    AddQueue(AUTOMATION_ENGINE_HANDLER);
+    CheckPoolFree();
+
+    EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+    EnsoDeviceId_t deviceId = { .deviceAddress = 0x1234 };
+    MakeDeltas(deltas, TST_FIRST_VALUE);
+
+    for (int round = 0; round < 4 * ECOM_DELTA_POOL_SIZE; round++)
+    {
+        const uint8_t all = (1u << ECOM_MAX_DELTAS) - 1;
+        const uint8_t odd = 0x2A & all;
+        const uint8_t one = 1u << (round % ECOM_MAX_DELTAS);
+
+        ECOM_DeltaBlock_t * block = ECOM_NewDeltaBlock(deviceId, REPORTED_GROUP, ECOM_MAX_DELTAS, deltas);
+        if (!TST_ASSERT(block != NULL))
+        {
+            return;
+        }
+        TST_ASSERT_EQUAL(ECOM_SendDeltaBlockToSubscriber(COMMS_HANDLER, block, all), eecNoError);
+        TST_ASSERT_EQUAL(ECOM_SendDeltaBlockToSubscriber(STORAGE_HANDLER, block, odd), eecNoError);
+        TST_ASSERT_EQUAL(ECOM_SendDeltaBlockToSubscriber(AUTOMATION_ENGINE_HANDLER, block, one), eecNoError);
+        ECOM_ReleaseDeltaBlock(block);
+
+        // Readers release in any order, the block lives until the last one
+        TST_ASSERT_EQUAL(ReceiveDeltas(STORAGE_HANDLER, TST_FIRST_VALUE, ECOM_MAX_DELTAS), odd);
+        TST_ASSERT_EQUAL(ReceiveDeltas(AUTOMATION_ENGINE_HANDLER, TST_FIRST_VALUE, ECOM_MAX_DELTAS), one);
+        TST_ASSERT_EQUAL(ReceiveDeltas(COMMS_HANDLER, TST_FIRST_VALUE, ECOM_MAX_DELTAS), all);
+    }
+
+    // ECOM_SendUpdateToSubscriber sends every delta through a block
+    TST_ASSERT_EQUAL(ECOM_SendUpdateToSubscriber(COMMS_HANDLER, deviceId, REPORTED_GROUP, 3, deltas), eecNoError);
+    TST_ASSERT_EQUAL(ReceiveDeltas(COMMS_HANDLER, TST_FIRST_VALUE, 3), 0x07);
+
+    CheckPoolFree();
+}
+
+/**
+ * \name   FanOutBoot
+ * \brief  The local shadow sends each subscriber the deltas meant for it
+ */
+static void FanOutBoot(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+    ECOM_Init();
+    AddQueue(COMMS_HANDLER);
+    AddQueue(STORAGE_HANDLER);
+    AddQueue(AUTOMATION_ENGINE_HANDLER);
+    AddQueue(TEST_DEVICE_HANDLER);
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+
+    EnsoDeviceId_t deviceId = { .deviceAddress = 0x4321, .technology = 1 };
+    EnsoObject_t * owner = LSD_CreateEnsoObject(deviceId);
+    if (!TST_ASSERT(owner != NULL))
+    {
+        return;
+    }
+    for (int i = 0; i < ECOM_MAX_DELTAS; i++)
+    {
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u values[PROPERTY_GROUP_MAX] = { { 0 } };
+        snprintf(cloudName, sizeof(cloudName), "fan%d", i);
+        TST_ASSERT_EQUAL(LSD_CreateProperty(owner, TST_FIRST_PROPERTY + i, cloudName, evUnsignedInt32,
+                (i < TST_PUBLIC_PROPERTIES) ? PROPERTY_PUBLIC : PROPERTY_PRIVATE, false,
+                (TST_PERSISTENT_MASK >> i) & 1, values), eecNoError);
+        if ((TST_SUBSCRIBED_MASK >> i) & 1)
+        {
+            TST_ASSERT_EQUAL(LSD_SubscribeToDevicePropertyByAgentSideId(&deviceId, TST_FIRST_PROPERTY + i,
+                    REPORTED_GROUP, AUTOMATION_ENGINE_HANDLER, true), eecNoError);
+        }
+    }
+    TST_ASSERT_EQUAL(LSD_RegisterEnsoObject(owner), eecNoError);
+    for (HandlerId_e handler = COMMS_HANDLER; handler < ENSO_HANDLER_MAX; handler++)
+    {
+        Drain(handler);
+    }
+
+    for (int round = 1; round <= 3 * ECOM_DELTA_POOL_SIZE; round++)
+    {
+        uint32_t base = TST_FIRST_VALUE + round * 10;
+        EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+        MakeDeltas(deltas, base);
+        TST_ASSERT_EQUAL(LSD_SetPropertiesOfDevice(TEST_DEVICE_HANDLER, &deviceId, REPORTED_GROUP,
+                deltas, ECOM_MAX_DELTAS), eecNoError);
+
+        // The local shadow publishes from its own thread
+        uint32_t start = OSAL_time_ms();
+        while (OSAL_GetMessageQueueNumCurrentMessages(queues[AUTOMATION_ENGINE_HANDLER]) == 0 &&
+               OSAL_time_ms() - start < 1000)
+        {
+            OSAL_sleep_ms(1);
+        }
+
+        TST_ASSERT_EQUAL(ReceiveDeltas(AUTOMATION_ENGINE_HANDLER, base, ECOM_MAX_DELTAS), TST_SUBSCRIBED_MASK);
+        TST_ASSERT_EQUAL(ReceiveDeltas(COMMS_HANDLER, base, ECOM_MAX_DELTAS), (1u << TST_PUBLIC_PROPERTIES) - 1);
+        TST_ASSERT_EQUAL(ReceiveDeltas(STORAGE_HANDLER, base, ECOM_MAX_DELTAS), TST_PERSISTENT_MASK);
+        TST_ASSERT_EQUAL(ReceiveDeltas(TEST_DEVICE_HANDLER, base, ECOM_MAX_DELTAS), 0);
+        if (!TST_ASSERT_EQUAL(OSAL_GetMessageQueueNumCurrentMessages(queues[COMMS_HANDLER]), 0))
+        {
+            break;
+        }
+    }
+
+    CheckPoolFree();
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_Boot("Shared delta block", SharedBlockBoot);
+    TST_Boot("Local shadow fan out", FanOutBoot);
+    return TST_Result();
+}
@@ -0,0 +1,584 @@
+/*!****************************************************************************
+ * \file    TST_FaultBroker.c
+ *
+ * \brief   Tests of the fault buffer against a stand-in for the AWS broker
+ *
+ * The broker takes the place of AWS_OnCommsHandler(). It holds each shadow
+ * update it is given until the test accepts or rejects it, which calls back
+ * into the fault buffer with the context the update was sent with, in any
+ * order and as late as the test likes.
+ *
+ * No more than AWS_MAX_MESSAGES_IN_FLIGHT updates may wait at the broker,
+ * every delta must be accepted exactly once whatever order the callbacks
+ * come in, a rejected one is sent again, and a callback for an update
+ * which is no longer in flight must not complete or fail the delta that
+ * has since taken its place in the fault buffer.
+ *
+ * The time to drain 100 and 1000 queued deltas through a broker which
+ * accepts every update at once is measured. Deltas past the fault buffer
+ * go through the spill file, which is built larger here so none of the
+ * 1000 is dropped. Each must be accepted once and in order.
+ *
+ * Deltas spilled to flash must be replayed, in order, by the next boot.
+ * When power fails first, the fault buffer is checkpointed to the spill
+ * file and every delta not yet accepted, in flight or not, is replayed.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "AWS/AWS_CommsHandler.h"
+#include "AWS/AWS_FaultBuffer.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// As AWS_MAX_MESSAGES_IN_FLIGHT in AWS_FaultBuffer.c
+#define TST_WINDOW              8
+#define TST_MAX_WAITING         32
+#define TST_FIRST_PROPERTY      0x500
+#define TST_FIRST_VALUE         1000
+#define TST_MAX_ROUNDS          2000
+#define TST_DRAIN_SMALL         100
+#define TST_DRAIN_LARGE         1000
+
+// As AWS_SPILL_HIGH_WATER in AWS_FaultBuffer.c and the spill file name
+#define TST_HIGH_WATER          64
+#define TST_SPILL_FILE          "AWS_FaultSpill"
+#define TST_SPILL_DELTAS        200
+#define TST_CHECKPOINT_TIMEOUT_MS 1000
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint32_t value;                     // Value of the first property
+    const EnsoPropertyDelta_t * slot;   // Where the delta lies in the fault buffer
+    void * context;
+} TST_Update_t;
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+// Updates waiting at the broker for the test to answer, oldest first
+static TST_Update_t waiting[TST_MAX_WAITING];
+static int numWaiting;
+
+// Times each value has been accepted
+static int accepted[TST_MAX_ROUNDS + TST_FIRST_VALUE];
+
+// Deltas accepted before the restart, which must not be replayed
+static int acceptedBeforeRestart;
+
+/*!****************************************************************************
+ * Stand-ins
+ *****************************************************************************/
+
+/**
+ * \name   AWS_OnCommsHandler
+ * \brief  The broker, it keeps the update until the test answers it
+ */
+EnsoErrorCode_e AWS_OnCommsHandler(
+        const HandlerId_e subscriberId,
+        const EnsoDeviceId_t deviceId,
+        const PropertyGroup_e propertyGroup,
+        const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer,
+        void* context)
+{
+    if (!TST_ASSERT(numWaiting < TST_MAX_WAITING))
+    {
+        return eecInternalError;
+    }
+    waiting[numWaiting].value = deltasBuffer[0].propertyValue.uint32Value;
+    waiting[numWaiting].slot = deltasBuffer;
+    waiting[numWaiting].context = context;
+    numWaiting++;
+    return eecNoError;
+}
+
+/**
+ * \name   AWS_RegisterNewDeltaRequest
+ * \brief  The test sends the waiting deltas itself
+ */
+bool AWS_RegisterNewDeltaRequest(void)
+{
+    return true;
+}
+
+/**
+ * \name   AWS_IsTimeValid
+ * \brief  Keeps the periodic worker from sending or retrying anything
+ */
+bool AWS_IsTimeValid(void)
+{
+    return false;
+}
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Start
+ * \brief  Start the fault buffer, connected, against the store as it is
+ */
+static void Start(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+    TST_ASSERT_EQUAL(AWS_FaultBufferInit(), eecNoError);
+    AWS_ConnectionStateCB(true);
+    numWaiting = 0;
+    memset(accepted, 0, sizeof(accepted));
+}
+
+/**
+ * \name   Init
+ * \brief  Start the fault buffer, connected, against an empty store
+ */
+static void Init(void)
+{
+    TST_UseNewStore();
+    Start();
+}
+
+/**
+ * \name   Add
+ * \brief  Add a delta of one property, its own so no delta waits for
+ *         another, holding value
+ */
+static void Add(uint32_t value)
+{
+    EnsoDeviceId_t deviceId = { 0 };
+    EnsoPropertyDelta_t delta;
+    memset(&delta, 0, sizeof(delta));
+    deviceId.deviceAddress = 0x42;
+    delta.agentSidePropertyID = TST_FIRST_PROPERTY + value;
+    delta.propertyValue.uint32Value = value;
+    TST_ASSERT_EQUAL(AWS_FaultBuffer(COMMS_HANDLER, deviceId, REPORTED_GROUP, 1, &delta), eecNoError);
+}
+
+/**
+ * \name   Take
+ * \brief  Take update n off the broker
+ */
+static TST_Update_t Take(int n)
+{
+    TST_Update_t update = waiting[n];
+    memmove(&waiting[n], &waiting[n + 1], (numWaiting - n - 1) * sizeof(waiting[0]));
+    numWaiting--;
+    return update;
+}
+
+/**
+ * \name   Accept
+ * \brief  The broker accepts update n
+ */
+static void Accept(int n)
+{
+    TST_Update_t update = Take(n);
+    accepted[update.value]++;
+    AWS_FinishedWithFaultBuffer(update.context);
+}
+
+/**
+ * \name   Reject
+ * \brief  The broker rejects update n
+ */
+static void Reject(int n)
+{
+    TST_Update_t update = Take(n);
+    AWS_MessageFailedForFaultBuffer(update.context);
+}
+
+/**
+ * \name   InRam
+ * \return Deltas in the fault buffer
+ */
+static int InRam(void)
+{
+    AWS_FaultBufferStats_t stats;
+    AWS_GetFaultBufferStats(&stats);
+    return stats.inRam;
+}
+
+/**
+ * \name   OutOfOrder
+ * \brief  Callbacks in any order complete each delta once, the window is
+ *         never overrun
+ */
+static void OutOfOrder(void)
+{
+    Init();
+    const int numDeltas = 3 * TST_WINDOW;
+    for (int i = 0; i < numDeltas; i++)
+    {
+        Add(TST_FIRST_VALUE + i);
+    }
+
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, TST_WINDOW);
+    while (numWaiting > 0)
+    {
+        // Newest first, then the oldest, then one from the middle
+        Accept(numWaiting - 1);
+        if (numWaiting > 0)
+        {
+            Accept(0);
+        }
+        if (numWaiting > 0)
+        {
+            Accept(numWaiting / 2);
+        }
+        AWS_SendWaitingDelta();
+        TST_ASSERT(numWaiting <= TST_WINDOW);
+    }
+
+    for (int i = 0; i < numDeltas; i++)
+    {
+        TST_ASSERT_EQUAL(accepted[TST_FIRST_VALUE + i], 1);
+    }
+    TST_ASSERT(AWS_FaultBufferEmpty());
+    TST_ASSERT_EQUAL(InRam(), 0);
+}
+
+/**
+ * \name   Rejected
+ * \brief  A rejected delta is sent again with a new context, the others are
+ *         not
+ */
+static void Rejected(void)
+{
+    Init();
+    for (int i = 0; i < TST_WINDOW; i++)
+    {
+        Add(TST_FIRST_VALUE + i);
+    }
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, TST_WINDOW);
+
+    void * rejectedContext = waiting[3].context;
+    Reject(3);
+    AWS_SendWaitingDelta();
+    if (TST_ASSERT_EQUAL(numWaiting, TST_WINDOW))
+    {
+        TST_ASSERT_EQUAL(waiting[TST_WINDOW - 1].value, TST_FIRST_VALUE + 3);
+        TST_ASSERT(waiting[TST_WINDOW - 1].context != rejectedContext);
+    }
+
+    // The rejection can't be answered a second time
+    AWS_MessageFailedForFaultBuffer(rejectedContext);
+    AWS_FinishedWithFaultBuffer(rejectedContext);
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, TST_WINDOW);
+    TST_ASSERT_EQUAL(InRam(), TST_WINDOW);
+
+    // Nor can updates that don't come from the fault buffer
+    AWS_MessageFailedForFaultBuffer(NULL);
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, TST_WINDOW);
+
+    while (numWaiting > 0)
+    {
+        Accept(0);
+    }
+    for (int i = 0; i < TST_WINDOW; i++)
+    {
+        TST_ASSERT_EQUAL(accepted[TST_FIRST_VALUE + i], 1);
+    }
+    TST_ASSERT_EQUAL(InRam(), 0);
+}
+
+/**
+ * \name   LateCallback
+ * \brief  An update given up on when the connection dropped is answered
+ *         once its place in the fault buffer holds another delta in flight.
+ *         That delta stays in flight until its own update is answered.
+ */
+static void LateCallback(void)
+{
+    Init();
+    Add(TST_FIRST_VALUE);
+    AWS_SendWaitingDelta();
+    if (!TST_ASSERT_EQUAL(numWaiting, 1))
+    {
+        return;
+    }
+    TST_Update_t late = Take(0);
+
+    // Connection lost and back, the delta is sent again and accepted
+    AWS_ConnectionStateCB(false);
+    AWS_ConnectionStateCB(true);
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, 1);
+    Accept(0);
+
+    // Go round the fault buffer until a delta is sent from the same place
+    uint32_t value = TST_FIRST_VALUE + 1;
+    bool reused = false;
+    while (!reused && value < TST_FIRST_VALUE + TST_MAX_ROUNDS - 1)
+    {
+        Add(value++);
+        AWS_SendWaitingDelta();
+        if (!TST_ASSERT_EQUAL(numWaiting, 1))
+        {
+            return;
+        }
+        reused = (waiting[0].slot == late.slot);
+        if (!reused)
+        {
+            Accept(0);
+        }
+    }
+    if (!TST_ASSERT(reused))
+    {
+        return;
+    }
+    uint32_t reusedValue = waiting[0].value;
+
+    // The late answers leave it in flight
+    AWS_FinishedWithFaultBuffer(late.context);
+    TST_ASSERT_EQUAL(InRam(), 1);
+    AWS_MessageFailedForFaultBuffer(late.context);
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, 1);
+
+    // A delta added behind it is sent alongside, not instead
+    Add(value);
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, 2);
+
+    Accept(0);
+    Accept(0);
+    TST_ASSERT_EQUAL(accepted[reusedValue], 1);
+    TST_ASSERT_EQUAL(accepted[value], 1);
+    TST_ASSERT_EQUAL(InRam(), 0);
+}
+
+/**
+ * \name   Drain
+ * \brief  Queue deltas then time how long the broker takes to accept them
+ */
+static void Drain(int numDeltas)
+{
+    Init();
+    struct timespec start, queued, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numDeltas; i++)
+    {
+        Add(TST_FIRST_VALUE + i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &queued);
+
+    uint32_t last = 0;
+    bool inOrder = true;
+    int updates = 0;
+    AWS_SendWaitingDelta();
+    while ((numWaiting > 0) && (updates < 2 * numDeltas))
+    {
+        while (numWaiting > 0)
+        {
+            inOrder = inOrder && (waiting[0].value > last);
+            last = waiting[0].value;
+            Accept(0);
+            updates++;
+        }
+        AWS_SendWaitingDelta();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    AWS_FaultBufferStats_t stats;
+    AWS_GetFaultBufferStats(&stats);
+    long queueUs = (queued.tv_sec - start.tv_sec) * 1000000L + (queued.tv_nsec - start.tv_nsec) / 1000;
+    long drainUs = (end.tv_sec - queued.tv_sec) * 1000000L + (end.tv_nsec - queued.tv_nsec) / 1000;
+    printf("%d deltas queued in %ld us, drained in %ld us: %d accepted, %u spilled\n",
+           numDeltas, queueUs, drainUs, updates, stats.spilled);
+    fflush(stdout);
+
+    TST_ASSERT(inOrder);
+    TST_ASSERT_EQUAL(stats.dropped, 0);
+    TST_ASSERT_EQUAL(updates, numDeltas);
+    TST_ASSERT_EQUAL(stats.sent, (uint32_t)numDeltas);
+    for (int i = 0; i < numDeltas; i++)
+    {
+        TST_ASSERT_EQUAL(accepted[TST_FIRST_VALUE + i], 1);
+    }
+    TST_ASSERT(AWS_FaultBufferEmpty());
+    TST_ASSERT_EQUAL(InRam(), 0);
+}
+
+/**
+ * \name   DrainSmall
+ * \brief  Deltas which all fit in the fault buffer
+ */
+static void DrainSmall(void)
+{
+    Drain(TST_DRAIN_SMALL);
+}
+
+/**
+ * \name   DrainLarge
+ * \brief  Deltas which go through the spill file
+ */
+static void DrainLarge(void)
+{
+    Drain(TST_DRAIN_LARGE);
+}
+
+/**
+ * \name   AcceptAll
+ * \brief  Accept every update until the fault buffer is drained
+ * \return Updates accepted, -1 if they were not in order
+ */
+static int AcceptAll(void)
+{
+    uint32_t last = 0;
+    bool inOrder = true;
+    int updates = 0;
+    AWS_SendWaitingDelta();
+    while ((numWaiting > 0) && (updates < TST_MAX_ROUNDS))
+    {
+        while (numWaiting > 0)
+        {
+            inOrder = inOrder && (waiting[0].value > last);
+            last = waiting[0].value;
+            Accept(0);
+            updates++;
+        }
+        AWS_SendWaitingDelta();
+    }
+    return inOrder ? updates : -1;
+}
+
+/**
+ * \name   SpillBoot
+ * \brief  Queue deltas past the high water, accept the first window and
+ *         leave the next one in flight when the power goes
+ */
+static void SpillBoot(void)
+{
+    Start();
+    for (int i = 0; i < TST_SPILL_DELTAS; i++)
+    {
+        Add(TST_FIRST_VALUE + i);
+    }
+
+    AWS_FaultBufferStats_t stats;
+    AWS_GetFaultBufferStats(&stats);
+    TST_ASSERT_EQUAL(stats.inRam, TST_HIGH_WATER);
+    TST_ASSERT_EQUAL(stats.spilled, TST_SPILL_DELTAS - TST_HIGH_WATER);
+    TST_ASSERT_EQUAL(stats.pending, TST_SPILL_DELTAS - TST_HIGH_WATER);
+    TST_ASSERT_EQUAL(stats.dropped, 0);
+
+    AWS_SendWaitingDelta();
+    while (numWaiting > 0)
+    {
+        Accept(0);
+    }
+    AWS_SendWaitingDelta();
+    TST_ASSERT_EQUAL(numWaiting, TST_WINDOW);
+}
+
+/**
+ * \name   PowerFailBoot
+ * \brief  As SpillBoot, then power fails and the fault buffer is
+ *         checkpointed to the spill file before the restart
+ */
+static void PowerFailBoot(void)
+{
+    SpillBoot();
+    int before = OSAL_StoreSize(TST_SPILL_FILE);
+    OSAL_NotifyPowerEvent(OSAL_POWER_MAINS_LOST);
+
+    uint32_t start = OSAL_time_ms();
+    while ((OSAL_StoreSize(TST_SPILL_FILE) <= before) &&
+           (OSAL_time_ms() - start < TST_CHECKPOINT_TIMEOUT_MS))
+    {
+        OSAL_sleep_ms(1);
+    }
+    TST_ASSERT(OSAL_StoreSize(TST_SPILL_FILE) > before);
+}
+
+/**
+ * \name   ReplayBoot
+ * \brief  The deltas left by the last boot are sent again, oldest first,
+ *         each accepted once
+ */
+static void ReplayBoot(void)
+{
+    Start();
+    AWS_FaultBufferStats_t stats;
+    AWS_GetFaultBufferStats(&stats);
+    TST_ASSERT_EQUAL(stats.damaged, 0);
+    TST_ASSERT_EQUAL(stats.replayed, TST_SPILL_DELTAS - acceptedBeforeRestart);
+
+    TST_ASSERT_EQUAL(AcceptAll(), TST_SPILL_DELTAS - acceptedBeforeRestart);
+    for (int i = 0; i < TST_SPILL_DELTAS; i++)
+    {
+        TST_ASSERT_EQUAL(accepted[TST_FIRST_VALUE + i], (i < acceptedBeforeRestart) ? 0 : 1);
+    }
+    TST_ASSERT(AWS_FaultBufferEmpty());
+    TST_ASSERT(!OSAL_StoreExist(TST_SPILL_FILE));
+}
+
+/**
+ * \name   DoneBoot
+ * \brief  Nothing is replayed once the deltas have been accepted
+ */
+static void DoneBoot(void)
+{
+    Start();
+    AWS_FaultBufferStats_t stats;
+    AWS_GetFaultBufferStats(&stats);
+    TST_ASSERT_EQUAL(stats.replayed, 0);
+    TST_ASSERT(AWS_FaultBufferEmpty());
+}
+
+/**
+ * \name   SpillRestart
+ * \brief  A restart replays the deltas in the spill file. Those in RAM are
+ *         lost without warning of the power failing, and replayed with it.
+ */
+static void SpillRestart(void)
+{
+    TST_UseNewStore();
+    acceptedBeforeRestart = TST_HIGH_WATER;
+    TST_Boot("Spill then restart", SpillBoot);
+    TST_Boot("Replay the spilled deltas", ReplayBoot);
+    TST_Boot("Restart once replayed", DoneBoot);
+
+    TST_UseNewStore();
+    acceptedBeforeRestart = TST_WINDOW;
+    TST_Boot("Spill then power fails", PowerFailBoot);
+    TST_Boot("Replay every delta not accepted", ReplayBoot);
+    TST_Boot("Restart once replayed", DoneBoot);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_Boot("Callbacks out of order", OutOfOrder);
+    TST_Boot("Rejected update", Rejected);
+    TST_Boot("Late callback for a reused delta", LateCallback);
+    TST_Boot("Drain 100 deltas", DrainSmall);
+    TST_Boot("Drain 1000 deltas", DrainLarge);
+    SpillRestart();
+    return TST_Result();
+}
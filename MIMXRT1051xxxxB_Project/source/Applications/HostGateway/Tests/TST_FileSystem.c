@@ -0,0 +1,566 @@
+/*!****************************************************************************
+ * \file    TST_FileSystem.c
+ *
+ * \brief   Tests of the STO flash file system over an in-memory flash
+ *
+ * A store written by the old contiguous layout must be moved into the
+ * sector pool by the first mount, and survive a power cut at any program
+ * or erase of the move.
+ *
+ * The OSAL store functions are wrapped at link time onto the file system,
+ * as the RT1050 OSAL maps them, so the storage manager log is written to
+ * the flash. 10000 records are appended through STO_WriteRecord, the log
+ * consolidated as it fills, and the erases must be spread over the sectors
+ * of the region. A power cut at any program or erase of an append must
+ * leave every record written before it, and the log appendable.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "SPI_Flash.h"
+#include "STO_FileSystem.h"
+#include "STO_Manager.h"
+#include "TST_Api.h"
+#include "TST_Flash.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Old layout, as written by earlier releases: two files, each at the start
+// of its half of the region, a 96 byte header then the content
+#define TST_LEGACY_FILE_SIZE    (STO_FLASH_SIZE / 2)
+#define TST_LEGACY_NAME_LEN     64
+#define TST_LEGACY_HEADER_SIZE  96
+
+#define TST_CURRENT_LOG         "\"\"StoreLog_Current"
+#define TST_CURRENT_LOG_SIZE    30000
+#define TST_ARCHIVE_LOG         "\"\"StoreLog_Archive"
+#define TST_ARCHIVE_LOG_SIZE    5000
+
+#define TST_NEW_FILE            "\"\"StoreSnapshot"
+#define TST_NEW_FILE_SIZE       60000
+
+// Files the pool can hold besides the two migrated ones and the new one
+#define TST_SPARE_FILES         5
+
+#define TST_SECTOR_COUNT        (STO_FLASH_SIZE / FLASH_SECTOR_SIZE)
+
+// Records through the storage manager, on properties of a few devices
+#define TST_BENCH_RECORDS       10000
+#define TST_BENCH_PROPERTIES    64
+#define TST_CUT_RECORDS         48      // Written before the cut appends, which
+                                        // then go into a new sector
+#define TST_CUT_APPENDS         4       // Appended by the boot cut short
+#define TST_RECORD_DEVICES      4
+#define TST_FIRST_ADDRESS       0x3000
+#define TST_FIRST_PROPERTY      0x100
+#define TST_FIRST_VALUE         1000
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static uint8_t * flash;
+
+// Shared with the boots: records an append boot completed
+static uint32_t * appended;
+
+// STO region once the records before the cut appends are written
+static uint8_t region[STO_FLASH_SIZE];
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Pattern
+ * \return Content byte of a test file
+ */
+static uint8_t Pattern(uint32_t offset, uint8_t seed)
+{
+    return (uint8_t)((offset * 7) + (offset >> 8) + seed);
+}
+
+/**
+ * \name   WriteLegacyFile
+ * \brief  Put a file in the old layout straight into flash
+ */
+static void WriteLegacyFile(int index, const char * name, uint32_t size, uint8_t seed)
+{
+    uint8_t * file = flash + STO_FLASH_START + (index * TST_LEGACY_FILE_SIZE);
+
+    memset(file, 0xFF, TST_LEGACY_HEADER_SIZE);
+    memset(file, 0, TST_LEGACY_NAME_LEN);
+    strcpy((char*)file, name);
+    memcpy(file + TST_LEGACY_NAME_LEN, &size, sizeof(size));
+    for (uint32_t i = 0; i < size; i++)
+    {
+        file[TST_LEGACY_HEADER_SIZE + i] = Pattern(i, seed);
+    }
+}
+
+/**
+ * \name   WriteLegacyStore
+ * \brief  Erase the flash and leave the store of an older release on it
+ */
+static void WriteLegacyStore(void)
+{
+    TST_FlashErase();
+    WriteLegacyFile(0, TST_CURRENT_LOG, TST_CURRENT_LOG_SIZE, 1);
+    WriteLegacyFile(1, TST_ARCHIVE_LOG, TST_ARCHIVE_LOG_SIZE, 2);
+}
+
+/**
+ * \name   CheckFile
+ * \brief  Check a file reads back in full with the expected content
+ */
+static void CheckFile(const char * name, uint32_t size, uint8_t seed)
+{
+    if (!TST_ASSERT(STO_FileExist(name)))
+    {
+        return;
+    }
+    TST_ASSERT_EQUAL(STO_FileSize(name), (int32_t)size);
+
+    Handle_t handle = STO_Open(name, READ_ONLY);
+    if (!TST_ASSERT(handle != NULL))
+    {
+        return;
+    }
+
+    uint8_t buffer[777];
+    uint32_t offset = 0;
+    uint32_t mismatches = 0;
+    int32_t n;
+    while ((n = STO_Read(handle, buffer, sizeof(buffer))) > 0)
+    {
+        for (int32_t i = 0; i < n; i++)
+        {
+            mismatches += (buffer[i] != Pattern(offset + i, seed));
+        }
+        offset += n;
+    }
+    STO_Close(handle);
+
+    TST_ASSERT_EQUAL(offset, size);
+    TST_ASSERT_EQUAL(mismatches, 0);
+}
+
+/**
+ * \name   CheckMigrated
+ * \brief  Both old files must be in the pool, and no old header left
+ */
+static void CheckMigrated(void)
+{
+    CheckFile(TST_CURRENT_LOG, TST_CURRENT_LOG_SIZE, 1);
+    CheckFile(TST_ARCHIVE_LOG, TST_ARCHIVE_LOG_SIZE, 2);
+    TST_ASSERT(!STO_FileExist("~migrating"));
+
+    // The old headers are erased, though a cut erase may leave some bits
+    const char * names[] = { TST_CURRENT_LOG, TST_ARCHIVE_LOG };
+    for (int i = 0; i < 2; i++)
+    {
+        const uint8_t * header = flash + STO_FLASH_START + (i * TST_LEGACY_FILE_SIZE);
+        TST_ASSERT(memcmp(header, names[i], strlen(names[i]) + 1) != 0);
+    }
+}
+
+/**
+ * \name   MountBoot
+ * \brief  Mount, migrating what an older release left
+ */
+static void MountBoot(void)
+{
+    STO_Driver_Init();
+}
+
+/**
+ * \name   CheckSpareFiles
+ * \brief  Every file slot not taken by a known file must be free, nothing
+ *         left behind by a migration cut short
+ */
+static void CheckSpareFiles(void)
+{
+    for (int i = 0; i < TST_SPARE_FILES; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "spare%d", i);
+        Handle_t handle = STO_Open(name, WRITE_ONLY);
+        if (TST_ASSERT(handle != NULL))
+        {
+            TST_ASSERT_EQUAL(STO_Write(handle, name, sizeof(name)), (int32_t)sizeof(name));
+            STO_Close(handle);
+        }
+    }
+}
+
+/**
+ * \name   MigratedBoot
+ * \brief  Mount, check the migration, then fill the region so the sectors
+ *         the old files used get reused
+ */
+static void MigratedBoot(void)
+{
+    STO_Driver_Init();
+    CheckMigrated();
+
+    Handle_t handle = STO_Open(TST_NEW_FILE, WRITE_ONLY);
+    if (TST_ASSERT(handle != NULL))
+    {
+        uint8_t buffer[1000];
+        for (uint32_t offset = 0; offset < TST_NEW_FILE_SIZE; offset += sizeof(buffer))
+        {
+            for (uint32_t i = 0; i < sizeof(buffer); i++)
+            {
+                buffer[i] = Pattern(offset + i, 3);
+            }
+            TST_ASSERT_EQUAL(STO_Write(handle, buffer, sizeof(buffer)), (int32_t)sizeof(buffer));
+        }
+        STO_Close(handle);
+    }
+    CheckMigrated();
+    CheckFile(TST_NEW_FILE, TST_NEW_FILE_SIZE, 3);
+    CheckSpareFiles();
+}
+
+/**
+ * \name   RebootBoot
+ * \brief  Everything must still be there on the next boot
+ */
+static void RebootBoot(void)
+{
+    STO_Driver_Init();
+    CheckMigrated();
+    CheckFile(TST_NEW_FILE, TST_NEW_FILE_SIZE, 3);
+}
+
+/**
+ * \name   BlankBoot
+ * \brief  A gateway with nothing stored mounts an empty store
+ */
+static void BlankBoot(void)
+{
+    STO_Driver_Init();
+    TST_ASSERT(!STO_FileExist(TST_CURRENT_LOG));
+    TST_ASSERT(!STO_FileExist(TST_ARCHIVE_LOG));
+}
+
+Handle_t __wrap_OSAL_StoreOpen(const char * storeName, OSAL_AccessMode_e accessMode)
+{
+    return STO_Open(storeName, accessMode);
+}
+
+int __wrap_OSAL_StoreWrite(Handle_t handle, const void * buffer, size_t nBytes)
+{
+    return STO_Write(handle, buffer, nBytes);
+}
+
+int __wrap_OSAL_StoreRead(Handle_t handle, void * buffer, size_t nBytes)
+{
+    return STO_Read(handle, buffer, nBytes);
+}
+
+int __wrap_OSAL_StoreClose(Handle_t handle)
+{
+    return STO_Close(handle);
+}
+
+int __wrap_OSAL_StoreAtomicRename(const char * oldName, const char * newName)
+{
+    return STO_Rename(oldName, newName);
+}
+
+int __wrap_OSAL_StoreRemove(const char * storeName)
+{
+    return STO_Remove(storeName);
+}
+
+int __wrap_OSAL_StoreSize(const char * storeName)
+{
+    return STO_FileSize(storeName);
+}
+
+bool __wrap_OSAL_StoreExist(const char * storeName)
+{
+    return STO_FileExist(storeName);
+}
+
+/**
+ * \name   MakeRecord
+ * \brief  Record i sets a property of one of the test devices
+ */
+static void MakeRecord(uint32_t i, uint32_t properties, EnsoTag_t * tag, char * cloudName, EnsoPropertyValue_u * value)
+{
+    uint32_t property = i % properties;
+    memset(tag, 0, sizeof(*tag));
+    tag->deviceId.deviceAddress = TST_FIRST_ADDRESS + (property % TST_RECORD_DEVICES);
+    tag->propId = TST_FIRST_PROPERTY + property;
+    tag->propType.valueType = evUnsignedInt32;
+    tag->propType.kind = PROPERTY_PUBLIC;
+    tag->propType.persistent = true;
+    tag->propGroup = REPORTED_GROUP;
+
+    memset(cloudName, 0, LSD_PROPERTY_NAME_BUFFER_SIZE);
+    snprintf(cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE, "p%u", property);
+
+    memset(value, 0, sizeof(*value));
+    value->uint32Value = TST_FIRST_VALUE + i;
+}
+
+/**
+ * \name   WriteRecord
+ * \brief  Append record i through the storage manager
+ */
+static EnsoErrorCode_e WriteRecord(uint32_t i, uint32_t properties)
+{
+    EnsoTag_t tag;
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    EnsoPropertyValue_u value;
+    MakeRecord(i, properties, &tag, cloudName, &value);
+    return STO_WriteRecord(&tag, cloudName, sizeof(value), &value);
+}
+
+/**
+ * \name   RestoredRecords
+ * \return Number of records found in the local shadow, which must be the
+ *         first ones written
+ */
+static uint32_t RestoredRecords(uint32_t records)
+{
+    uint32_t restored = 0;
+    for (uint32_t i = 0; i < records; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u expected;
+        MakeRecord(i, records, &tag, cloudName, &expected);
+
+        EnsoPropertyValue_u value;
+        if (LSD_GetPropertyValueByAgentSideId(&tag.deviceId, REPORTED_GROUP, tag.propId, &value) == eecNoError)
+        {
+            TST_ASSERT_EQUAL(value.uint32Value, expected.uint32Value);
+            TST_ASSERT_EQUAL(restored, i);
+            restored++;
+        }
+    }
+    return restored;
+}
+
+/**
+ * \name   StartStore
+ * \brief  Mount, then load the storage manager log, quietly as it runs
+ *         once per power cut
+ */
+static void StartStore(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableError(false);
+    LOG_EnableWarning(false);
+    LOG_EnableTrace(false);
+    STO_Driver_Init();
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+}
+
+/**
+ * \name   BenchmarkBoot
+ * \brief  Append records as the storage handler did one delta at a time,
+ *         consolidating when the log is full
+ */
+static void BenchmarkBoot(void)
+{
+    StartStore();
+
+    uint32_t erasesBefore[TST_SECTOR_COUNT];
+    for (uint32_t i = 0; i < TST_SECTOR_COUNT; i++)
+    {
+        erasesBefore[i] = TST_FlashEraseCount(STO_FLASH_START + (i * FLASH_SECTOR_SIZE));
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < TST_BENCH_RECORDS; i++)
+    {
+        if (!TST_ASSERT_EQUAL(WriteRecord(i, TST_BENCH_PROPERTIES), eecNoError) ||
+            !TST_ASSERT_EQUAL(STO_CheckSizeAndConsolidate(), eecNoError))
+        {
+            return;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    uint32_t total = 0;
+    uint32_t least = UINT32_MAX;
+    uint32_t most = 0;
+    for (uint32_t i = 0; i < TST_SECTOR_COUNT; i++)
+    {
+        uint32_t erases = TST_FlashEraseCount(STO_FLASH_START + (i * FLASH_SECTOR_SIZE)) - erasesBefore[i];
+        total += erases;
+        least = (erases < least) ? erases : least;
+        most = (erases > most) ? erases : most;
+    }
+    printf("%d records in %.3f s, %.0f records/s: %u erases, %u to %u per sector of %d\n",
+           TST_BENCH_RECORDS, seconds, TST_BENCH_RECORDS / seconds, total, least, most, TST_SECTOR_COUNT);
+    fflush(stdout);
+
+    // The log went round the region several times, over every sector
+    TST_ASSERT(total > 2 * TST_SECTOR_COUNT);
+    TST_ASSERT(least > 0);
+    TST_ASSERT(most <= least + 2);
+}
+
+/**
+ * \name   BenchmarkLoadBoot
+ * \brief  The last value of each property is restored
+ */
+static void BenchmarkLoadBoot(void)
+{
+    StartStore();
+    for (uint32_t i = TST_BENCH_RECORDS - TST_BENCH_PROPERTIES; i < TST_BENCH_RECORDS; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u expected;
+        MakeRecord(i, TST_BENCH_PROPERTIES, &tag, cloudName, &expected);
+
+        EnsoPropertyValue_u value;
+        TST_ASSERT_EQUAL(LSD_GetPropertyValueByAgentSideId(&tag.deviceId, REPORTED_GROUP, tag.propId, &value), eecNoError);
+        TST_ASSERT_EQUAL(value.uint32Value, expected.uint32Value);
+    }
+}
+
+/**
+ * \name   FirstRecordsBoot
+ * \brief  Write the records the power cuts must not lose
+ */
+static void FirstRecordsBoot(void)
+{
+    StartStore();
+    for (uint32_t i = 0; i < TST_CUT_RECORDS; i++)
+    {
+        TST_ASSERT_EQUAL(WriteRecord(i, TST_CUT_RECORDS + TST_CUT_APPENDS + 1), eecNoError);
+    }
+}
+
+/**
+ * \name   AppendBoot
+ * \brief  Append more records, telling the test how far it got
+ */
+static void AppendBoot(void)
+{
+    StartStore();
+    TST_ASSERT_EQUAL(RestoredRecords(TST_CUT_RECORDS + TST_CUT_APPENDS + 1), TST_CUT_RECORDS);
+    for (uint32_t i = TST_CUT_RECORDS; i < TST_CUT_RECORDS + TST_CUT_APPENDS; i++)
+    {
+        TST_ASSERT_EQUAL(WriteRecord(i, TST_CUT_RECORDS + TST_CUT_APPENDS + 1), eecNoError);
+        *appended = i + 1;
+    }
+}
+
+/**
+ * \name   RecoverBoot
+ * \brief  Every record appended before the cut is there, the one cut may
+ *         or may not be, and the log takes the next record
+ */
+static void RecoverBoot(void)
+{
+    StartStore();
+    uint32_t records = TST_CUT_RECORDS + TST_CUT_APPENDS + 1;
+    uint32_t restored = RestoredRecords(records);
+    TST_ASSERT(restored >= *appended);
+    TST_ASSERT(restored <= *appended + 1);
+
+    TST_ASSERT_EQUAL(WriteRecord(restored, records), eecNoError);
+    *appended = restored + 1;
+}
+
+/**
+ * \name   RecoveredBoot
+ * \brief  The record appended after the recovery is kept
+ */
+static void RecoveredBoot(void)
+{
+    StartStore();
+    TST_ASSERT_EQUAL(RestoredRecords(TST_CUT_RECORDS + TST_CUT_APPENDS + 1), *appended);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    flash = TST_FlashCreate();
+
+    TST_Boot("Blank flash", BlankBoot);
+
+    WriteLegacyStore();
+    TST_Boot("Migrate the old layout", MigratedBoot);
+    TST_Boot("Reboot after migrating", RebootBoot);
+
+    // Cut the power at every program and erase of the migration in turn,
+    // until a boot gets through it
+    uint32_t cut;
+    for (cut = 1; ; cut++)
+    {
+        WriteLegacyStore();
+        TST_FlashCutPower(cut);
+        TST_Boot("Migrate, power cut", MountBoot);
+        bool finished = TST_FlashOperations() < cut;
+
+        TST_FlashCutPower(0);
+        if (!TST_Boot("Reboot after the power cut", MigratedBoot) || finished)
+        {
+            break;
+        }
+    }
+    printf("Power cut at %u points\n", cut);
+    TST_ASSERT(cut > 10);
+
+    appended = mmap(NULL, sizeof(*appended), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!TST_ASSERT(appended != MAP_FAILED))
+    {
+        return TST_Result();
+    }
+
+    TST_FlashErase();
+    TST_Boot("10000 records through the storage manager", BenchmarkBoot);
+    TST_Boot("Load the records", BenchmarkLoadBoot);
+
+    // Cut the power at every program and erase of the appends in turn
+    TST_FlashErase();
+    TST_Boot("Records before the power cuts", FirstRecordsBoot);
+    memcpy(region, flash + STO_FLASH_START, STO_FLASH_SIZE);
+    for (cut = 1; ; cut++)
+    {
+        memcpy(flash + STO_FLASH_START, region, STO_FLASH_SIZE);
+        *appended = TST_CUT_RECORDS;
+        TST_FlashCutPower(cut);
+        TST_Boot("Append, power cut", AppendBoot);
+        bool finished = TST_FlashOperations() < cut;
+
+        TST_FlashCutPower(0);
+        if (!TST_Boot("Recover after the power cut", RecoverBoot) ||
+            !TST_Boot("Reboot after the recovery", RecoveredBoot) || finished)
+        {
+            break;
+        }
+    }
+    printf("Append cut at %u points\n", cut);
+    TST_ASSERT(cut > 3 * TST_CUT_APPENDS);
+
+    return TST_Result();
+}
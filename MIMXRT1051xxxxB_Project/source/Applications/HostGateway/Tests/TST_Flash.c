@@ -0,0 +1,174 @@
+/*!****************************************************************************
+ * \file    TST_Flash.c
+ *
+ * \brief   SPI flash in memory for the host tests
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "SPI_Flash.h"
+#include "TST_Flash.h"
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static uint8_t * image;
+
+// Shared too, so the test can see how far a boot got
+static struct
+{
+    // Programs and erases so far, and the one the power is cut at
+    uint32_t operations;
+    uint32_t cutAt;
+
+    // Erases of each sector since the image was created
+    uint32_t erases[FLASH_SIZE / FLASH_SECTOR_SIZE];
+} * power;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   CountOperation
+ * \return true if the power goes before this operation completes
+ */
+static bool CountOperation(void)
+{
+    return ++power->operations == power->cutAt;
+}
+
+/**
+ * \name   PowerCut
+ * \brief  End the boot as a power failure would, no clean up
+ */
+static void PowerCut(void)
+{
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name   TST_FlashCreate
+ * \brief  Map an erased flash image, shared with forked children
+ * \return The image
+ */
+uint8_t * TST_FlashCreate(void)
+{
+    image = mmap(NULL, FLASH_SIZE + sizeof(*power), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    power = (void*)(image + FLASH_SIZE);
+    TST_FlashErase();
+    return image;
+}
+
+/**
+ * \name   TST_FlashEraseCount
+ * \return Erases of the sector holding an address
+ */
+uint32_t TST_FlashEraseCount(uint32_t address)
+{
+    return power->erases[address / FLASH_SECTOR_SIZE];
+}
+
+/**
+ * \name   TST_FlashErase
+ * \brief  Erase the whole image
+ */
+void TST_FlashErase(void)
+{
+    memset(image, 0xFF, FLASH_SIZE);
+}
+
+/**
+ * \name   TST_FlashCutPower
+ * \brief  Cut the power during a program or erase of the next boot
+ * \param  operation    Count of the operation, from 1, or 0 for never
+ */
+void TST_FlashCutPower(uint32_t operation)
+{
+    power->operations = 0;
+    power->cutAt = operation;
+}
+
+/**
+ * \name   TST_FlashOperations
+ * \return Programs and erases since TST_FlashCutPower
+ */
+uint32_t TST_FlashOperations(void)
+{
+    return power->operations;
+}
+
+void SPI_Flash_Init(void)
+{
+}
+
+int32_t SPI_Flash_Read(uint32_t address, uint8_t * data, uint32_t dataLen)
+{
+    if (address + dataLen > FLASH_SIZE)
+    {
+        return -1;
+    }
+    memcpy(data, image + address, dataLen);
+    return 0;
+}
+
+int32_t SPI_Flash_Write(uint32_t address, uint8_t * data, uint32_t dataLen)
+{
+    if (address + dataLen > FLASH_SIZE)
+    {
+        return -1;
+    }
+    // A cut program leaves the first half of the bytes in
+    uint32_t length = CountOperation() ? dataLen / 2 : dataLen;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        image[address + i] &= data[i];
+    }
+    if (length != dataLen)
+    {
+        PowerCut();
+    }
+    return 0;
+}
+
+int32_t SPI_Flash_Erase(uint32_t address)
+{
+    if (address + FLASH_SECTOR_SIZE > FLASH_SIZE)
+    {
+        return -1;
+    }
+    address -= address % FLASH_SECTOR_SIZE;
+    power->erases[address / FLASH_SECTOR_SIZE]++;
+    // A cut erase leaves the sector scrambled
+    if (CountOperation())
+    {
+        for (uint32_t i = 0; i < FLASH_SECTOR_SIZE; i += 2)
+        {
+            image[address + i] = 0xFF;
+        }
+        PowerCut();
+    }
+    memset(image + address, 0xFF, FLASH_SECTOR_SIZE);
+    return 0;
+}
@@ -0,0 +1,36 @@
+/*!****************************************************************************
+ * \file    TST_Flash.h
+ *
+ * \brief   SPI flash in memory for the host tests
+ *
+ * The image is shared with the children TST_Boot forks, so what one boot
+ * writes is there for the next. Create it before the first boot. Programming clears bits and erasing sets a
+ * sector to 0xFF, as on NOR flash. A power cut can be injected before any
+ * program or erase, which then only partly happens. Erases are counted per
+ * sector, for the wear.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef TST_FLASH_H
+#define TST_FLASH_H
+
+#include <stdint.h>
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+uint8_t * TST_FlashCreate(void);
+
+void TST_FlashErase(void);
+
+void TST_FlashCutPower(uint32_t operation);
+
+uint32_t TST_FlashOperations(void);
+
+uint32_t TST_FlashEraseCount(uint32_t address);
+
+#endif /* TST_FLASH_H */
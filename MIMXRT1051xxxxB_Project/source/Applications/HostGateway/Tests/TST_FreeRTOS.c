@@ -0,0 +1,205 @@
+/*!****************************************************************************
+ * \file    TST_FreeRTOS.c
+ *
+ * \brief   FreeRTOS tasks, queues and semaphores on POSIX threads for the
+ *          host tests
+ *
+ * Queues copy items in and out as FreeRTOS does. A task is a detached
+ * thread, priorities are ignored and only a task can delete itself.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+struct TST_Queue_tag
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;           // Oldest item
+    UBaseType_t count;
+    uint8_t * items;
+};
+
+typedef struct
+{
+    TaskFunction_t code;
+    void * parameters;
+} TST_Task_t;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Deadline
+ * \brief  Time at which a wait of ticksToWait ends
+ */
+static struct timespec Deadline(TickType_t ticksToWait)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = (uint64_t)ticksToWait * (1000000000ULL / configTICK_RATE_HZ) + deadline.tv_nsec;
+    deadline.tv_sec += ns / 1000000000ULL;
+    deadline.tv_nsec = ns % 1000000000ULL;
+    return deadline;
+}
+
+/**
+ * \name   Wait
+ * \brief  Wait for the queue to change, the mutex held
+ * \return false if the wait timed out
+ */
+static bool Wait(QueueHandle_t queue, TickType_t ticksToWait, const struct timespec * deadline)
+{
+    if (ticksToWait == 0)
+    {
+        return false;
+    }
+    if (ticksToWait == portMAX_DELAY)
+    {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(&queue->changed, &queue->mutex, deadline) != ETIMEDOUT;
+}
+
+/**
+ * \name   TaskThread
+ * \brief  Run a task in its thread
+ */
+static void * TaskThread(void * arg)
+{
+    TST_Task_t task = *(TST_Task_t *)arg;
+    free(arg);
+    task.code(task.parameters);
+    return NULL;
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    QueueHandle_t queue = calloc(1, sizeof(*queue));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    queue->items = malloc(length * itemSize + 1);
+    if (queue->items == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t ticksToWait)
+{
+    struct timespec deadline = Deadline(ticksToWait);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length)
+    {
+        if (!Wait(queue, ticksToWait, &deadline))
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    if (queue->itemSize)
+    {
+        memcpy(&queue->items[tail * queue->itemSize], item, queue->itemSize);
+    }
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t ticksToWait)
+{
+    struct timespec deadline = Deadline(ticksToWait);
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0)
+    {
+        if (!Wait(queue, ticksToWait, &deadline))
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    if (queue->itemSize)
+    {
+        memcpy(item, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char * name, uint16_t stackDepth,
+                       void * parameters, UBaseType_t priority, TaskHandle_t * createdTask)
+{
+    pthread_t thread;
+    TST_Task_t * task = malloc(sizeof(*task));
+    if (task == NULL)
+    {
+        return pdFAIL;
+    }
+    task->code = code;
+    task->parameters = parameters;
+    if (pthread_create(&thread, NULL, TaskThread, task) != 0)
+    {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (createdTask)
+    {
+        // Tasks are not kept track of
+        *createdTask = NULL;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    pthread_exit(NULL);
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return 0;
+}
@@ -0,0 +1,460 @@
+/*!****************************************************************************
+ * \file    TST_GroupCommit.c
+ *
+ * \brief   Store writes made by the storage manager group commit
+ *
+ * The OSAL store functions are wrapped at link time to count the writes to
+ * the current log, and to tell them from the other writes such as those of
+ * a snapshot.
+ *
+ * 1000 records written one at a time through STO_WriteRecord, as each delta
+ * was before, take 1000 writes. The same 1000 updates made through the
+ * local shadow and the storage handler are written when the group commit
+ * buffer fills or when the commit window ends, in far fewer writes, and all
+ * are restored at the next boot.
+ *
+ * A record too large for the buffer is written on its own after the records
+ * queued before it, and queued records are written to the log before a
+ * consolidation writes the snapshot.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "ECOM_Api.h"
+#include "STO_Manager.h"
+#include "STO_Handler.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_CURRENT_LOG         "\"\"StoreLog_Current"
+
+#define TST_COMMIT_BUFFER_SIZE  2048        // As STO_GROUP_COMMIT_BUFFER_SIZE
+#define TST_COMMIT_WINDOW_MS    250         // As STO_GROUP_COMMIT_WINDOW_MS
+#define TST_MAX_STORE_SIZE      100000      // As STO_MAX_STORE_SIZE_IN_BYTES
+
+#define TST_UPDATES             1000
+#define TST_BURST               10          // Updates between pauses
+#define TST_BURST_PAUSE_MS      5
+#define TST_QUEUED_RECORDS      3
+#define TST_BLOB_SIZE           (2 * TST_COMMIT_BUFFER_SIZE)
+
+#define TST_DEVICE_ADDRESS      0x5000
+#define TST_PROPERTY            0x100
+#define TST_BLOB_PROPERTY       0x200
+#define TST_FIRST_VALUE         1000
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint32_t writes;            // All the store writes
+    uint32_t logWrites;         // Those to the current log
+    uint32_t logBytes;
+    uint32_t fullWrites;        // Log writes of a full buffer
+    uint32_t firstLogSize;
+    uint32_t secondLogSize;
+    uint32_t firstLogWrite;     // Order among all the writes, from 1
+    uint32_t firstOtherWrite;
+} TST_Writes_t;
+
+typedef struct
+{
+    TST_Writes_t perRecord;
+    TST_Writes_t grouped;
+    uint32_t recordSize;
+} TST_Results_t;
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+// Shared with the forked boots
+static TST_Results_t * results;
+
+// Counted into by the wrapped functions, NULL when not counting
+static TST_Writes_t * counting;
+
+// Open handle on the current log
+static Handle_t logHandle;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+Handle_t __real_OSAL_StoreOpen(const char * storeName, OSAL_AccessMode_e accessMode);
+int __real_OSAL_StoreWrite(Handle_t handle, const void * buffer, size_t nBytes);
+int __real_OSAL_StoreClose(Handle_t handle);
+
+Handle_t __wrap_OSAL_StoreOpen(const char * storeName, OSAL_AccessMode_e accessMode)
+{
+    Handle_t handle = __real_OSAL_StoreOpen(storeName, accessMode);
+    if (strcmp(storeName, TST_CURRENT_LOG) == 0)
+    {
+        logHandle = handle;
+    }
+    return handle;
+}
+
+int __wrap_OSAL_StoreWrite(Handle_t handle, const void * buffer, size_t nBytes)
+{
+    TST_Writes_t * writes = counting;
+    if (writes != NULL)
+    {
+        uint32_t order = __atomic_add_fetch(&writes->writes, 1, __ATOMIC_RELAXED);
+        if ((handle != NULL) && (handle == logHandle))
+        {
+            uint32_t logWrites = __atomic_add_fetch(&writes->logWrites, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&writes->logBytes, nBytes, __ATOMIC_RELAXED);
+            if ((results->recordSize != 0) && (nBytes > TST_COMMIT_BUFFER_SIZE - results->recordSize))
+            {
+                __atomic_fetch_add(&writes->fullWrites, 1, __ATOMIC_RELAXED);
+            }
+            if (logWrites == 1)
+            {
+                writes->firstLogSize = nBytes;
+                writes->firstLogWrite = order;
+            }
+            else if (logWrites == 2)
+            {
+                writes->secondLogSize = nBytes;
+            }
+        }
+        else if (writes->firstOtherWrite == 0)
+        {
+            writes->firstOtherWrite = order;
+        }
+    }
+    return __real_OSAL_StoreWrite(handle, buffer, nBytes);
+}
+
+// A handle can be reused once closed, for the snapshot say
+int __wrap_OSAL_StoreClose(Handle_t handle)
+{
+    if (handle == logHandle)
+    {
+        logHandle = NULL;
+    }
+    return __real_OSAL_StoreClose(handle);
+}
+
+/**
+ * \name   StartCounting
+ */
+static void StartCounting(TST_Writes_t * writes)
+{
+    memset(writes, 0, sizeof(*writes));
+    __atomic_store_n(&counting, writes, __ATOMIC_RELEASE);
+}
+
+/**
+ * \name   StopCounting
+ */
+static void StopCounting(void)
+{
+    __atomic_store_n(&counting, NULL, __ATOMIC_RELEASE);
+}
+
+/**
+ * \name   MakeTag
+ */
+static void MakeTag(EnsoTag_t * tag, EnsoAgentSidePropertyId_t propId, EnsoValueType_e valueType)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->deviceId.deviceAddress = TST_DEVICE_ADDRESS;
+    tag->propId = propId;
+    tag->propType.valueType = valueType;
+    tag->propType.kind = PROPERTY_PRIVATE;
+    tag->propType.persistent = true;
+    tag->propGroup = REPORTED_GROUP;
+}
+
+/**
+ * \name   QueueValue
+ * \brief  Queue a record of the test property
+ */
+static EnsoErrorCode_e QueueValue(uint32_t value, bool write)
+{
+    EnsoTag_t tag;
+    MakeTag(&tag, TST_PROPERTY, evUnsignedInt32);
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE] = "count";
+    EnsoPropertyValue_u propertyValue = { .uint32Value = value };
+    if (write)
+    {
+        return STO_WriteRecord(&tag, cloudName, sizeof(propertyValue), &propertyValue);
+    }
+    return STO_QueueRecord(&tag, cloudName, sizeof(propertyValue), &propertyValue);
+}
+
+/**
+ * \name   CheckValue
+ * \brief  The test property was restored with a value
+ */
+static void CheckValue(uint32_t expected)
+{
+    EnsoDeviceId_t deviceId = { .deviceAddress = TST_DEVICE_ADDRESS };
+    EnsoPropertyValue_u value;
+    TST_ASSERT_EQUAL(LSD_GetPropertyValueByAgentSideId(&deviceId, REPORTED_GROUP, TST_PROPERTY, &value), eecNoError);
+    TST_ASSERT_EQUAL(value.uint32Value, expected);
+}
+
+/**
+ * \name   Initialise
+ */
+static void Initialise(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+}
+
+/**
+ * \name   PerRecordBoot
+ * \brief  A write for each record, as before the group commit
+ */
+static void PerRecordBoot(void)
+{
+    Initialise();
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+
+    TST_Writes_t * writes = &results->perRecord;
+    StartCounting(writes);
+    for (int i = 0; i < TST_UPDATES; i++)
+    {
+        if (!TST_ASSERT_EQUAL(QueueValue(TST_FIRST_VALUE + i, true), eecNoError))
+        {
+            break;
+        }
+    }
+    StopCounting();
+
+    TST_ASSERT_EQUAL(writes->writes, TST_UPDATES);
+    TST_ASSERT_EQUAL(writes->logWrites, TST_UPDATES);
+    TST_ASSERT_EQUAL(writes->logBytes % TST_UPDATES, 0);
+    results->recordSize = writes->logBytes / TST_UPDATES;
+    TST_ASSERT(results->recordSize < TST_COMMIT_BUFFER_SIZE / 2);
+}
+
+/**
+ * \name   LoadBoot
+ * \brief  The last of the 1000 values is restored
+ */
+static void LoadBoot(void)
+{
+    Initialise();
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+    CheckValue(TST_FIRST_VALUE + TST_UPDATES - 1);
+}
+
+/**
+ * \name   GroupedBoot
+ * \brief  The same updates through the local shadow and the storage
+ *         handler, in bursts paced by the handler queue
+ */
+static void GroupedBoot(void)
+{
+    Initialise();
+    ECOM_Init();
+    TST_ASSERT_EQUAL(STO_Handler_Init(), eecNoError);
+
+    EnsoDeviceId_t deviceId = { .deviceAddress = TST_DEVICE_ADDRESS };
+    EnsoObject_t * owner = LSD_CreateEnsoObject(deviceId);
+    if (!TST_ASSERT(owner != NULL))
+    {
+        return;
+    }
+    EnsoPropertyValue_u values[PROPERTY_GROUP_MAX] = { { 0 } };
+    TST_ASSERT_EQUAL(LSD_CreateProperty(owner, TST_PROPERTY, "count", evUnsignedInt32,
+            PROPERTY_PRIVATE, false, true, values), eecNoError);
+
+    // The records of the new property are written a window later
+    OSAL_sleep_ms(2 * TST_COMMIT_WINDOW_MS);
+    TST_ASSERT(!STO_HasPendingRecords());
+
+    TST_Writes_t * writes = &results->grouped;
+    StartCounting(writes);
+    uint32_t start = OSAL_time_ms();
+    for (int i = 0; i < TST_UPDATES; i++)
+    {
+        while (ECOM_IsDestinationQueueFull(STORAGE_HANDLER))
+        {
+            OSAL_sleep_ms(1);
+        }
+        EnsoPropertyValue_u value = { .uint32Value = TST_FIRST_VALUE + i };
+        if (!TST_ASSERT_EQUAL(LSD_SetPropertyValueByAgentSideId(TEST_DEVICE_HANDLER, &deviceId,
+                REPORTED_GROUP, TST_PROPERTY, value), eecNoError))
+        {
+            break;
+        }
+        if ((i % TST_BURST) == TST_BURST - 1)
+        {
+            OSAL_sleep_ms(TST_BURST_PAUSE_MS);
+        }
+    }
+    uint32_t elapsed = OSAL_time_ms() - start;
+
+    // The last records are written when the window ends
+    OSAL_sleep_ms(2 * TST_COMMIT_WINDOW_MS);
+    StopCounting();
+    TST_ASSERT(!STO_HasPendingRecords());
+
+    printf("%d updates over %u ms: %u log writes, %u of a full buffer\n",
+           TST_UPDATES, elapsed, writes->logWrites, writes->fullWrites);
+    fflush(stdout);
+
+    // Every update was written, once
+    TST_ASSERT_EQUAL(writes->logBytes, TST_UPDATES * results->recordSize);
+    TST_ASSERT_EQUAL(writes->writes, writes->logWrites);
+
+    // Both the full buffer and the end of the window wrote records
+    TST_ASSERT(writes->fullWrites > 0);
+    TST_ASSERT(writes->logWrites > writes->fullWrites);
+    TST_ASSERT(writes->logWrites * 10 < TST_UPDATES);
+}
+
+/**
+ * \name   BypassBoot
+ * \brief  A record too large for the buffer is written on its own, after
+ *         the records queued before it
+ */
+static void BypassBoot(void)
+{
+    Initialise();
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+
+    TST_Writes_t writes;
+    StartCounting(&writes);
+    for (int i = 0; i < TST_QUEUED_RECORDS; i++)
+    {
+        TST_ASSERT_EQUAL(QueueValue(TST_FIRST_VALUE + i, false), eecNoError);
+    }
+    TST_ASSERT_EQUAL(writes.writes, 0);
+
+    MemoryHandle_t blob = OSAL_MemoryRequest(NULL, TST_BLOB_SIZE);
+    if (!TST_ASSERT(blob != NULL))
+    {
+        StopCounting();
+        return;
+    }
+    memset(blob, 'b', TST_BLOB_SIZE - 1);
+    ((char *)blob)[TST_BLOB_SIZE - 1] = '\0';
+
+    EnsoTag_t tag;
+    MakeTag(&tag, TST_BLOB_PROPERTY, evBlobHandle);
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE] = "blob";
+    EnsoPropertyValue_u value = { .memoryHandle = blob };
+    TST_ASSERT_EQUAL(STO_QueueRecord(&tag, cloudName, sizeof(value), &value), eecNoError);
+    OSAL_Free(blob);
+
+    TST_ASSERT_EQUAL(writes.logWrites, 2);
+    TST_ASSERT_EQUAL(writes.firstLogSize, TST_QUEUED_RECORDS * results->recordSize);
+    TST_ASSERT_EQUAL(writes.secondLogSize, results->recordSize + TST_BLOB_SIZE);
+    TST_ASSERT(!STO_HasPendingRecords());
+
+    // Nothing left for the flush
+    TST_ASSERT_EQUAL(STO_Flush(), eecNoError);
+    StopCounting();
+    TST_ASSERT_EQUAL(writes.writes, 2);
+}
+
+/**
+ * \name   BypassLoadBoot
+ */
+static void BypassLoadBoot(void)
+{
+    Initialise();
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+    CheckValue(TST_FIRST_VALUE + TST_QUEUED_RECORDS - 1);
+
+    EnsoDeviceId_t deviceId = { .deviceAddress = TST_DEVICE_ADDRESS };
+    static char blob[TST_BLOB_SIZE];
+    size_t copied = 0;
+    TST_ASSERT_EQUAL(LSD_GetPropertyBufferByAgentSideId(&deviceId, REPORTED_GROUP, TST_BLOB_PROPERTY,
+            sizeof(blob), blob, &copied), eecNoError);
+    TST_ASSERT_EQUAL(copied, TST_BLOB_SIZE);
+    TST_ASSERT_EQUAL(strspn(blob, "b"), TST_BLOB_SIZE - 1);
+}
+
+/**
+ * \name   ConsolidateBoot
+ * \brief  The records queued when the log is consolidated are written to
+ *         it before the snapshot
+ */
+static void ConsolidateBoot(void)
+{
+    Initialise();
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+
+    // Up to the size which consolidates
+    int i = 0;
+    while (OSAL_StoreSize(TST_CURRENT_LOG) + results->recordSize < TST_MAX_STORE_SIZE)
+    {
+        if (!TST_ASSERT_EQUAL(QueueValue(TST_FIRST_VALUE + i++, true), eecNoError))
+        {
+            return;
+        }
+    }
+
+    TST_Writes_t writes;
+    StartCounting(&writes);
+    for (int k = 0; k < TST_QUEUED_RECORDS; k++)
+    {
+        TST_ASSERT_EQUAL(QueueValue(TST_FIRST_VALUE + i++, false), eecNoError);
+    }
+    TST_ASSERT_EQUAL(STO_Flush(), eecNoError);
+    StopCounting();
+
+    TST_ASSERT_EQUAL(writes.logWrites, 1);
+    TST_ASSERT_EQUAL(writes.firstLogSize, TST_QUEUED_RECORDS * results->recordSize);
+    TST_ASSERT_EQUAL(writes.firstLogWrite, 1);
+    TST_ASSERT(writes.firstOtherWrite > writes.firstLogWrite);
+    TST_ASSERT(!STO_HasPendingRecords());
+    TST_ASSERT(OSAL_StoreSize(TST_CURRENT_LOG) < TST_MAX_STORE_SIZE);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    results = mmap(NULL, sizeof(*results), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+    {
+        return 1;
+    }
+    memset(results, 0, sizeof(*results));
+
+    TST_UseNewStore();
+    TST_Boot("1000 records written one at a time", PerRecordBoot);
+    TST_Boot("Load the records written one at a time", LoadBoot);
+
+    TST_UseNewStore();
+    TST_Boot("1000 updates through the storage handler", GroupedBoot);
+    TST_Boot("Load the updates written by the storage handler", LoadBoot);
+
+    printf("%d updates: %u log writes one record at a time, %u grouped\n",
+           TST_UPDATES, results->perRecord.logWrites, results->grouped.logWrites);
+
+    TST_UseNewStore();
+    TST_Boot("A record larger than the buffer bypasses it", BypassBoot);
+    TST_Boot("Load the records around the bypass", BypassLoadBoot);
+
+    TST_UseNewStore();
+    TST_Boot("Queued records are written before a consolidation", ConsolidateBoot);
+    return TST_Result();
+}
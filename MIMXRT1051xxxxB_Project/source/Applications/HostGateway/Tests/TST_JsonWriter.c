@@ -0,0 +1,471 @@
+/*!****************************************************************************
+ * \file    TST_JsonWriter.c
+ *
+ * \brief   Tests of the shadow update JSON writer against the document the
+ *          delta callbacks spliced together before it
+ *
+ * The delta callbacks of AWS_CommsHandler.c need the AWS SDK, so the order
+ * of writer calls they make is repeated here. Reported documents of 6, 32
+ * and 128 properties, half simple and half in nested groups, must be byte
+ * for byte what the old strlen() and rewind splicing built. The cost of a
+ * document both ways is printed.
+ *
+ * The old callbacks took the document envelope from the SDK, whose init and
+ * finalize calls are stubbed out in this tree, so the reference writes the
+ * envelope the writer writes.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "LOG_Api.h"
+#include "LSD_Types.h"
+#include "LSD_Api.h"
+#include "AWS_JsonWriter.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// As AWS_CommsHandler.c
+#define TST_DEPTH_ROOT          1
+#define TST_DEPTH_GROUP         3
+#define TST_UPDATE_BUFFER       1000
+
+// Room for 128 properties, which the update buffer does not have
+#define TST_DOCUMENT_BUFFER     4096
+#define TST_MAX_PROPERTIES      128
+#define TST_GROUP_CHILDREN      4
+
+#define TST_CLIENT_TOKEN        "gw-0"
+#define TST_TIMED_PROPERTIES    (1000 * 1000)
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static EnsoProperty_t _properties[TST_MAX_PROPERTIES];
+static bool _firstNested[TST_MAX_PROPERTIES];
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   CreateProperties
+ * \brief  The first half simple, the second half in nested groups of
+ *         TST_GROUP_CHILDREN, of each value type in turn
+ */
+static void CreateProperties(int count)
+{
+    memset(_properties, 0, sizeof(_properties));
+    for (int i = 0; i < count; i++)
+    {
+        EnsoProperty_t * property = &_properties[i];
+        int nested = i - count / 2;
+        if (nested < 0)
+        {
+            snprintf(property->cloudName, sizeof(property->cloudName), "p%u", (uint8_t)i);
+            _firstNested[i] = false;
+        }
+        else
+        {
+            snprintf(property->cloudName, sizeof(property->cloudName), "g%u_c%u_",
+                     (uint8_t)(nested / TST_GROUP_CHILDREN), (uint8_t)(nested % TST_GROUP_CHILDREN));
+            _firstNested[i] = (nested % TST_GROUP_CHILDREN) == 0;
+        }
+
+        switch (i % 4)
+        {
+            case 0:
+                property->type.valueType = evInt32;
+                property->reportedValue.int32Value = -1000 * i;
+                break;
+            case 1:
+                property->type.valueType = evUnsignedInt32;
+                property->reportedValue.uint32Value = 4000000000u - i;
+                break;
+            case 2:
+                property->type.valueType = evBoolean;
+                property->reportedValue.booleanValue = i & 4;
+                break;
+            default:
+                property->type.valueType = evString;
+                snprintf(property->reportedValue.stringValue,
+                         sizeof(property->reportedValue.stringValue), "v%d", i);
+                break;
+        }
+    }
+}
+
+/**
+ * \name   WriterStart
+ * \brief  As AWS_CommsChannelDeltaStart() for the reported group
+ */
+static EnsoErrorCode_e WriterStart(AWS_JsonWriter_t * writer, char * buffer, size_t size)
+{
+    AWS_JsonInit(writer, buffer, size);
+    EnsoErrorCode_e retVal = AWS_JsonOpenObject(writer, NULL);
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonOpenObject(writer, "state");
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonOpenObject(writer, "reported");
+    }
+    return retVal;
+}
+
+/**
+ * \name   WriterAdd
+ * \brief  As AWS_CommsChannelDeltaAddProperty() for the reported group
+ */
+static EnsoErrorCode_e WriterAdd(AWS_JsonWriter_t * writer, const EnsoProperty_t * property,
+                                 bool firstNestedProperty)
+{
+    char parentName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    char childName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    bool nestedProperty = LSD_IsPropertyNested(property->cloudName, parentName, childName);
+
+    AWS_JsonMark_t mark;
+    AWS_JsonMark(writer, &mark);
+
+    EnsoErrorCode_e retVal = eecNoError;
+    if (!nestedProperty || firstNestedProperty)
+    {
+        retVal = AWS_JsonCloseTo(writer, TST_DEPTH_GROUP);
+    }
+    if ((eecNoError == retVal) && nestedProperty && firstNestedProperty)
+    {
+        retVal = AWS_JsonOpenObject(writer, parentName);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonAddKey(writer, nestedProperty ? childName : property->cloudName);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonAddValue(writer, property->reportedValue, property->type.valueType);
+    }
+    if (eecNoError != retVal)
+    {
+        AWS_JsonRewind(writer, &mark);
+    }
+    return retVal;
+}
+
+/**
+ * \name   WriterSend
+ * \brief  As AWS_CommsChannelDeltaSend() up to sending the document
+ */
+static EnsoErrorCode_e WriterSend(AWS_JsonWriter_t * writer)
+{
+    EnsoErrorCode_e retVal = AWS_JsonCloseTo(writer, TST_DEPTH_ROOT);
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonAddString(writer, "clientToken", TST_CLIENT_TOKEN);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonCloseObject(writer);
+    }
+    return retVal;
+}
+
+/**
+ * \name   WriterDocument
+ * \brief  The reported document of the first count properties
+ */
+static EnsoErrorCode_e WriterDocument(char * buffer, size_t size, int count)
+{
+    AWS_JsonWriter_t writer;
+    EnsoErrorCode_e retVal = WriterStart(&writer, buffer, size);
+    for (int i = 0; (eecNoError == retVal) && (i < count); i++)
+    {
+        retVal = WriterAdd(&writer, &_properties[i], _firstNested[i]);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = WriterSend(&writer);
+    }
+    return retVal;
+}
+
+/**
+ * \name   SplicedAdd
+ * \brief  The property as the delta callback added it before the writer,
+ *         measuring the document with strlen() each time and rewinding
+ *         over "}," to continue a nested group
+ */
+static EnsoErrorCode_e SplicedAdd(char * buffer, int size, int * entries,
+                                  const EnsoProperty_t * property, bool firstNestedProperty)
+{
+    int bufferOffset = strlen(buffer);
+    int bufferRemaining = size - bufferOffset;
+    if (bufferRemaining <= 1)
+    {
+        return eecBufferTooSmall;
+    }
+    if (*entries)
+    {
+        buffer[bufferOffset++] = ',';
+        buffer[bufferOffset] = '\0';
+        bufferRemaining--;
+    }
+
+    char parentName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    char childName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    bool nestedProperty = LSD_IsPropertyNested(property->cloudName, parentName, childName);
+
+    int written;
+    if (nestedProperty && firstNestedProperty)
+    {
+        written = snprintf(buffer + bufferOffset, bufferRemaining, "\"%s\":{\"%s\":", parentName, childName);
+    }
+    else if (nestedProperty)
+    {
+        bufferOffset -= 2;
+        bufferRemaining += 2;
+        written = snprintf(buffer + bufferOffset, bufferRemaining, ",\"%s\":", childName);
+    }
+    else
+    {
+        written = snprintf(buffer + bufferOffset, bufferRemaining, "\"%s\":", property->cloudName);
+    }
+    if (written < 0 || written > bufferRemaining)
+    {
+        return eecBufferTooSmall;
+    }
+
+    int bytesUsed = 0;
+    bufferOffset = strlen(buffer);
+    (*entries)++;
+    EnsoErrorCode_e retVal = LSD_ConvertTypedDataToJsonValue(buffer + bufferOffset, size - bufferOffset,
+            &bytesUsed, property->reportedValue, property->type.valueType);
+    bufferOffset = strlen(buffer);
+    if (nestedProperty)
+    {
+        snprintf(buffer + bufferOffset, size - bufferOffset, "}");
+    }
+    return retVal;
+}
+
+/**
+ * \name   SplicedDocument
+ * \brief  The reported document of the first count properties as the delta
+ *         callbacks built it before the writer
+ */
+static EnsoErrorCode_e SplicedDocument(char * buffer, size_t size, int count)
+{
+    int entries = 0;
+    snprintf(buffer, size, "{\"state\":{");
+    int offset = strlen(buffer);
+    snprintf(buffer + offset, size - offset, "\"reported\":{");
+
+    EnsoErrorCode_e retVal = eecNoError;
+    for (int i = 0; (eecNoError == retVal) && (i < count); i++)
+    {
+        retVal = SplicedAdd(buffer, size, &entries, &_properties[i], _firstNested[i]);
+    }
+
+    offset = strlen(buffer);
+    snprintf(buffer + offset, size - offset, "},");
+    offset = strlen(buffer) - 1;
+    snprintf(buffer + offset, size - offset, "},\"clientToken\":\"%s\"}", TST_CLIENT_TOKEN);
+    return retVal;
+}
+
+/**
+ * \name   Elapsed
+ * \return Nanoseconds since start
+ */
+static double Elapsed(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * \name   Small
+ * \brief  A short document is exactly as the shadow expects it
+ */
+static void Small(void)
+{
+    char buffer[TST_UPDATE_BUFFER];
+    CreateProperties(6);
+    TST_ASSERT_EQUAL(WriterDocument(buffer, sizeof(buffer), 6), eecNoError);
+    TST_ASSERT(strcmp(buffer,
+        "{\"state\":{\"reported\":{\"p0\":0,\"p1\":3999999999,\"p2\":false,"
+        "\"g0\":{\"c0\":\"v3\",\"c1\":-4000,\"c2\":3999999995}}},"
+        "\"clientToken\":\"" TST_CLIENT_TOKEN "\"}") == 0);
+}
+
+/**
+ * \name   SameAsSpliced
+ * \brief  6, 32 and 128 properties give the document the splicing gave
+ */
+static void SameAsSpliced(void)
+{
+    static const int counts[] = { 6, 32, TST_MAX_PROPERTIES };
+    static char written[TST_DOCUMENT_BUFFER];
+    static char spliced[TST_DOCUMENT_BUFFER];
+
+    for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++)
+    {
+        CreateProperties(counts[n]);
+        TST_ASSERT_EQUAL(WriterDocument(written, sizeof(written), counts[n]), eecNoError);
+        TST_ASSERT_EQUAL(SplicedDocument(spliced, sizeof(spliced), counts[n]), eecNoError);
+        TST_ASSERT(strcmp(written, spliced) == 0);
+    }
+}
+
+/**
+ * \name   Interleaved
+ * \brief  A simple property between two nested groups closes the first,
+ *         which the splicing could not do
+ */
+static void Interleaved(void)
+{
+    char buffer[TST_UPDATE_BUFFER];
+    AWS_JsonWriter_t writer;
+    EnsoProperty_t property = { .type.valueType = evInt32 };
+
+    TST_ASSERT_EQUAL(WriterStart(&writer, buffer, sizeof(buffer)), eecNoError);
+    strcpy(property.cloudName, "a_x_");
+    TST_ASSERT_EQUAL(WriterAdd(&writer, &property, true), eecNoError);
+    strcpy(property.cloudName, "p");
+    TST_ASSERT_EQUAL(WriterAdd(&writer, &property, false), eecNoError);
+    strcpy(property.cloudName, "b_y_");
+    TST_ASSERT_EQUAL(WriterAdd(&writer, &property, true), eecNoError);
+    strcpy(property.cloudName, "b_z_");
+    TST_ASSERT_EQUAL(WriterAdd(&writer, &property, false), eecNoError);
+    TST_ASSERT_EQUAL(WriterSend(&writer), eecNoError);
+    TST_ASSERT(strcmp(buffer,
+        "{\"state\":{\"reported\":{\"a\":{\"x\":0},\"p\":0,\"b\":{\"y\":0,\"z\":0}}},"
+        "\"clientToken\":\"" TST_CLIENT_TOKEN "\"}") == 0);
+}
+
+/**
+ * \name   Escaped
+ * \brief  Quotes and backslashes in keys and strings are escaped
+ */
+static void Escaped(void)
+{
+    char buffer[64];
+    AWS_JsonWriter_t writer;
+    AWS_JsonInit(&writer, buffer, sizeof(buffer));
+    TST_ASSERT_EQUAL(AWS_JsonOpenObject(&writer, NULL), eecNoError);
+    TST_ASSERT_EQUAL(AWS_JsonAddString(&writer, "a\"b", "c\\d"), eecNoError);
+    TST_ASSERT_EQUAL(AWS_JsonCloseObject(&writer), eecNoError);
+    TST_ASSERT(strcmp(buffer, "{\"a\\\"b\":\"c\\\\d\"}") == 0);
+    TST_ASSERT_EQUAL(AWS_JsonLength(&writer), strlen(buffer));
+}
+
+/**
+ * \name   Overflow
+ * \brief  In the update buffer, properties that do not fit are dropped
+ *         whole and the rest of the document still closes
+ */
+static void Overflow(void)
+{
+    char buffer[TST_UPDATE_BUFFER];
+    char before[TST_UPDATE_BUFFER];
+    AWS_JsonMark_t marks[TST_MAX_PROPERTIES];
+    AWS_JsonWriter_t writer;
+    int added = 0;
+
+    CreateProperties(TST_MAX_PROPERTIES);
+    TST_ASSERT_EQUAL(WriterStart(&writer, buffer, sizeof(buffer)), eecNoError);
+    for (int i = 0; i < TST_MAX_PROPERTIES; i++)
+    {
+        strcpy(before, buffer);
+        AWS_JsonMark(&writer, &marks[added]);
+        if (WriterAdd(&writer, &_properties[i], _firstNested[i]) == eecNoError)
+        {
+            added++;
+            continue;
+        }
+        // Nothing of a property that does not fit is left behind
+        TST_ASSERT(strcmp(before, buffer) == 0);
+        TST_ASSERT_EQUAL(AWS_JsonLength(&writer), strlen(buffer));
+    }
+    TST_ASSERT(added > 0 && added < TST_MAX_PROPERTIES);
+
+    // Room for the envelope is not kept back, drop properties until it fits
+    AWS_JsonWriter_t closing = writer;
+    while (WriterSend(&closing) != eecNoError)
+    {
+        TST_ASSERT(added > 0);
+        AWS_JsonRewind(&writer, &marks[--added]);
+        closing = writer;
+    }
+    TST_ASSERT(added > 0);
+    TST_ASSERT_EQUAL(AWS_JsonLength(&closing), strlen(buffer));
+    const char * start = "{\"state\":{\"reported\":{";
+    TST_ASSERT(strncmp(buffer, start, strlen(start)) == 0);
+    const char * end = "}},\"clientToken\":\"" TST_CLIENT_TOKEN "\"}";
+    TST_ASSERT(strcmp(buffer + strlen(buffer) - strlen(end), end) == 0);
+}
+
+/**
+ * \name   Measure
+ * \brief  Report the cost of a document with the writer and with splicing
+ */
+static void Measure(void)
+{
+    static const int counts[] = { 6, 32, TST_MAX_PROPERTIES };
+    static char buffer[TST_DOCUMENT_BUFFER];
+    struct timespec start;
+
+    for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++)
+    {
+        int documents = TST_TIMED_PROPERTIES / counts[n];
+        CreateProperties(counts[n]);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int d = 0; d < documents; d++)
+        {
+            WriterDocument(buffer, sizeof(buffer), counts[n]);
+        }
+        double written = Elapsed(&start) / documents;
+        size_t length = strlen(buffer);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int d = 0; d < documents; d++)
+        {
+            SplicedDocument(buffer, sizeof(buffer), counts[n]);
+        }
+        double spliced = Elapsed(&start) / documents;
+
+        printf("%3d properties, %4zu bytes: writer %.2f us, spliced %.2f us\n",
+               counts[n], length, written / 1000, spliced / 1000);
+    }
+    fflush(stdout);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+
+    TST_Boot("Short document", Small);
+    TST_Boot("Same document as splicing", SameAsSpliced);
+    TST_Boot("Simple property between nested groups", Interleaved);
+    TST_Boot("Escaped keys and strings", Escaped);
+    TST_Boot("Properties beyond the buffer", Overflow);
+    TST_Boot("Cost a document", Measure);
+    return TST_Result();
+}
@@ -0,0 +1,158 @@
+/*!****************************************************************************
+ * \file    TST_Load.c
+ *
+ * \brief   Load test of the Local Shadow, EnsoComms and the storage manager
+ *
+ * Creates 80 test devices and drives 4000 desired property changes through
+ * ECOM routing, checking that every delta reaches the cloud with no message
+ * refused by a full queue. A second boot must restore every device from the
+ * store; test handler properties other than the owner are not persistent.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+
+#include "OSAL_Api.h"
+#include "ECOM_Api.h"
+#include "ECOM_Messages.h"
+#include "LSD_Api.h"
+#include "APP_Types.h"
+#include "HostAgent.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_LOAD_DEVICES        80
+#define TST_LOAD_ROUNDS         50
+#define TST_LOAD_FIRST_ADDRESS  0x1000
+#define TST_LOAD_TECHNOLOGY     0x0b
+
+#define TST_LOAD_IDLE_TIMEOUT_MS    30000
+#define TST_LOAD_CREATE_TIMEOUT_MS  5000
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   CheckNothingRefused
+ * \brief  Check no handler's queue turned a message away
+ */
+static void CheckNothingRefused(void)
+{
+    for (HandlerId_e handler = COMMS_HANDLER; handler < ENSO_HANDLER_MAX; handler++)
+    {
+        MessageQueue_t mq = ECOM_GetMessageQueue(handler);
+        if (mq != NULL)
+        {
+            TST_ASSERT_EQUAL(OSAL_GetMessageQueueAllocationFailures(mq), 0);
+        }
+    }
+}
+
+/**
+ * \name   WaitForDevice
+ * \brief  The test handler reads the control property when it gets the
+ *         delta, so each device must exist before the next is asked for
+ * \return true if the device was created in time
+ */
+static bool WaitForDevice(const EnsoDeviceId_t * deviceId)
+{
+    uint32_t start = OSAL_time_ms();
+    while (LSD_FindEnsoObjectByDeviceId(deviceId) == NULL)
+    {
+        if (OSAL_time_ms() - start > TST_LOAD_CREATE_TIMEOUT_MS)
+        {
+            return false;
+        }
+        OSAL_sleep_ms(1);
+    }
+    return true;
+}
+
+/**
+ * \name   LoadBoot
+ * \brief  First boot: create the devices and load them with changes
+ */
+static void LoadBoot(void)
+{
+    TST_ASSERT_EQUAL(HOST_Initialise(), eecNoError);
+    TST_ASSERT_EQUAL(HOST_SetGatewayBuffer(HOST_THA_TEMPLATE, "\"temp\":\"uint\",\"mode\":\"uint\""),
+                     eecNoError);
+    OSAL_sleep_ms(50);
+
+    for (int i = 0; i < TST_LOAD_DEVICES; i++)
+    {
+        char kvp[128];
+        snprintf(kvp, sizeof(kvp),
+                 "\"deviceId\":\"%04x.%02x.00\",\"type\":11,\"mfr\":\"acme\",\"model\":\"t1\",\"temp\":20",
+                 TST_LOAD_FIRST_ADDRESS + i, TST_LOAD_TECHNOLOGY);
+        TST_ASSERT_EQUAL(HOST_SetGatewayBuffer(HOST_THA_CONTROL, kvp), eecNoError);
+
+        EnsoDeviceId_t deviceId = { 0 };
+        deviceId.deviceAddress = TST_LOAD_FIRST_ADDRESS + i;
+        deviceId.technology = TST_LOAD_TECHNOLOGY;
+        TST_ASSERT(WaitForDevice(&deviceId));
+    }
+    TST_ASSERT(HOST_WaitForIdle(TST_LOAD_IDLE_TIMEOUT_MS));
+
+    for (int round = 0; round < TST_LOAD_ROUNDS; round++)
+    {
+        for (int i = 0; i < TST_LOAD_DEVICES; i++)
+        {
+            char line[64];
+            snprintf(line, sizeof(line), "%x.%x.0 temp %d",
+                     TST_LOAD_FIRST_ADDRESS + i, TST_LOAD_TECHNOLOGY, round);
+            TST_ASSERT_EQUAL(HOST_SetDeviceProperty(line), eecNoError);
+        }
+    }
+    TST_ASSERT(HOST_WaitForIdle(TST_LOAD_IDLE_TIMEOUT_MS));
+
+    HOST_DumpQueues();
+    TST_ASSERT_EQUAL(HOST_GetCloudMessages(ECOM_THING_STATUS), TST_LOAD_DEVICES);
+    TST_ASSERT_EQUAL(HOST_GetCloudMessages(ECOM_DELTA_MSG), TST_LOAD_DEVICES * TST_LOAD_ROUNDS);
+    CheckNothingRefused();
+}
+
+/**
+ * \name   ReplayBoot
+ * \brief  Second boot: every device must come back from the store, owned by
+ *         the test handler
+ */
+static void ReplayBoot(void)
+{
+    TST_ASSERT_EQUAL(HOST_Initialise(), eecNoError);
+    TST_ASSERT(HOST_WaitForIdle(TST_LOAD_IDLE_TIMEOUT_MS));
+
+    for (int i = 0; i < TST_LOAD_DEVICES; i++)
+    {
+        EnsoDeviceId_t deviceId = { 0 };
+        deviceId.deviceAddress = TST_LOAD_FIRST_ADDRESS + i;
+        deviceId.technology = TST_LOAD_TECHNOLOGY;
+
+        EnsoPropertyValue_u owner = { 0 };
+        if (TST_ASSERT_EQUAL(LSD_GetPropertyValueByAgentSideId(&deviceId, REPORTED_GROUP,
+                             PROP_OWNER_ID, &owner), eecNoError))
+        {
+            TST_ASSERT_EQUAL(owner.uint32Value, TEST_DEVICE_HANDLER);
+        }
+    }
+    CheckNothingRefused();
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_UseNewStore();
+    TST_Boot("Load 80 devices", LoadBoot);
+    TST_Boot("Replay the store", ReplayBoot);
+    return TST_Result();
+}
@@ -0,0 +1,581 @@
+/*!****************************************************************************
+ * \file    TST_Ota.c
+ *
+ * \brief   Tests of the streaming OTA download against a local HTTP server
+ *          and the flash in memory
+ *
+ * TST_OtaServer.py serves the images from a directory of the test's own.
+ * The TLS layer is stood in for by a plain TCP connection to it, opened for
+ * each request as https_client_tls_init() would, and reads come back in
+ * pieces of random size as records do. The writer task runs on the FreeRTOS
+ * stand-ins in TST_FreeRTOS.c.
+ *
+ * A downloaded image must land in the inactive partition exactly as served
+ * and be made active, while the heap taken stays a small fraction of the
+ * image. The time taken and the peak of the heap are printed.
+ *
+ * The server also cuts responses at random offsets, with and without
+ * honouring the range asked for, and a download cut short by a power
+ * failure must carry on after the reboot from the sectors that survived.
+ *
+ * fwpack also packs the image as a signed SJHF file of two operational
+ * segments. Cut short by a power failure, its download must fetch the
+ * header again after the reboot, replay the sectors in flash through the
+ * verifier and carry on over dropped connections to an image that verifies.
+ *
+ * Usage: TST_Ota <python3> <TST_OtaServer.py> <fwpack> <dev_signing_key.pem>
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ssl.h"
+#include "LOG_Api.h"
+#include "SPI_Flash.h"
+#include "UPG_Firmware.h"
+#include "TST_Api.h"
+#include "TST_Flash.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Not a whole number of sectors, so the last one is part filled
+#define TST_IMAGE_SIZE          (700 * 1024 + 123)
+#define TST_IMAGE_NAME          "image.imx"
+#define TST_SIGNED_NAME         "image.sjhf"
+
+// The signed image's first segment, not a multiple of FIRMWARE_ENC_BLK_BYTES
+// so it is padded in the file but not in flash
+#define TST_SEGMENT_BYTES       (300 * 1024 + 77)
+
+// Largest piece a read returns
+#define TST_MAX_READ            1500
+
+// Heap the download may take, the image would not fit in RAM. The verifier
+// of a signed image holds its header as well.
+#define TST_MAX_HEAP            (64 * 1024)
+#define TST_MAX_SIGNED_HEAP     (TST_MAX_HEAP + FIRMWARE_HEADER_BYTES)
+
+#define TST_FLAG_NONE           0xFF
+#define TST_FLAG_A_ACTIVE       0x0a
+
+// Server responses are cut at the same offsets each run
+#define TST_SERVER_SEED         "24"
+
+// Sector of the partition damaged while the power is off, before the
+// progress record at the power cut
+#define TST_DAMAGED_SECTOR      40
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static const char * python;
+static const char * script;
+static const char * fwpack;
+static const char * keyFile;
+static char imageDir[] = "/tmp/hostOtaXXXXXX";
+static pid_t serverPid;
+static int serverOutput;
+static char serverPort[8];
+
+static uint8_t * flash;
+static uint8_t image[TST_IMAGE_SIZE];
+static char imageHash[2 * 32 + 1];
+
+// Install key and hash of the signed image, as fwpack prints them
+static char signedKey[2 * 32 + 1];
+static char signedHash[2 * 32 + 1];
+static char noKey[] = "";
+
+// Connection of the current request
+static int connection = -1;
+
+// Heap taken through malloc and calloc, tracked while a download runs
+static pthread_mutex_t heapMutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t heapInUse;
+static size_t heapPeak;
+
+/*!****************************************************************************
+ * Stand-ins
+ *****************************************************************************/
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void __real_free(void * block);
+
+/**
+ * \name   Taken
+ * \brief  Count a block taken from the heap
+ */
+static void * Taken(void * block)
+{
+    if (block)
+    {
+        pthread_mutex_lock(&heapMutex);
+        heapInUse += malloc_usable_size(block);
+        if (heapInUse > heapPeak)
+        {
+            heapPeak = heapInUse;
+        }
+        pthread_mutex_unlock(&heapMutex);
+    }
+    return block;
+}
+
+/**
+ * \name   __wrap_malloc
+ * \brief  malloc, counting the heap taken
+ */
+void * __wrap_malloc(size_t size)
+{
+    return Taken(__real_malloc(size));
+}
+
+/**
+ * \name   __wrap_calloc
+ * \brief  calloc, as mbedtls takes its big numbers, counting the heap taken
+ */
+void * __wrap_calloc(size_t count, size_t size)
+{
+    return Taken(__real_calloc(count, size));
+}
+
+/**
+ * \name   __wrap_free
+ * \brief  free, counting the heap given back
+ */
+void __wrap_free(void * block)
+{
+    if (block)
+    {
+        pthread_mutex_lock(&heapMutex);
+        heapInUse -= malloc_usable_size(block);
+        pthread_mutex_unlock(&heapMutex);
+    }
+    __real_free(block);
+}
+
+/**
+ * \name   mbedtls_ssl_write
+ * \brief  Send a request on a new connection to the server
+ */
+int mbedtls_ssl_write(mbedtls_ssl_context * ssl, const unsigned char * buf, size_t len)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(serverPort));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connection >= 0)
+    {
+        close(connection);
+    }
+    connection = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        return MBEDTLS_ERR_NET_CONNECT_FAILED;
+    }
+    ssize_t sent = send(connection, buf, len, MSG_NOSIGNAL);
+    return sent < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : (int)sent;
+}
+
+/**
+ * \name   mbedtls_ssl_read
+ * \brief  Read what the server sent, in pieces of random size
+ * \return Bytes read, 0 once the server has closed the connection
+ */
+int mbedtls_ssl_read(mbedtls_ssl_context * ssl, unsigned char * buf, size_t len)
+{
+    size_t piece = 1 + rand() % TST_MAX_READ;
+    ssize_t received = recv(connection, buf, len < piece ? len : piece, 0);
+    return received < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : (int)received;
+}
+
+/**
+ * \name   UPG_setError
+ * \brief  Only signed images report an upgrade error
+ */
+void UPG_setError(uint32_t error)
+{
+    TST_ASSERT_EQUAL(error, 0);
+}
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+extern int https_update_ota(char * host, char * port, char * resource, char * key, char * hash, bool signedImage);
+
+/**
+ * \name   StartServer
+ * \brief  Write the image for the server and start it
+ */
+static void StartServer(void)
+{
+    int output[2];
+    char path[sizeof(imageDir) + sizeof(TST_IMAGE_NAME) + 1];
+
+    if (mkdtemp(imageDir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, sizeof(path), "%s/%s", imageDir, TST_IMAGE_NAME);
+    FILE * file = fopen(path, "wb");
+    if (file == NULL || fwrite(image, 1, sizeof(image), file) != sizeof(image) || fclose(file) != 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (pipe(output) != 0)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    serverPid = fork();
+    if (serverPid < 0)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (serverPid == 0)
+    {
+        dup2(output[1], STDOUT_FILENO);
+        close(output[0]);
+        close(output[1]);
+        execl(python, python, script, imageDir, TST_SERVER_SEED, (char *)NULL);
+        perror(python);
+        _exit(EXIT_FAILURE);
+    }
+    close(output[1]);
+    serverOutput = output[0];
+
+    // The server writes its port once it is listening
+    ssize_t length = read(serverOutput, serverPort, sizeof(serverPort) - 1);
+    if (length <= 0 || atoi(serverPort) <= 0)
+    {
+        fprintf(stderr, "%s did not start\n", script);
+        exit(EXIT_FAILURE);
+    }
+    serverPort[length] = '\0';
+    serverPort[strcspn(serverPort, "\n")] = '\0';
+}
+
+/**
+ * \name   StopServer
+ * \brief  Stop the server and remove its images
+ */
+static void StopServer(void)
+{
+    char path[sizeof(imageDir) + sizeof(TST_SIGNED_NAME) + 1];
+
+    kill(serverPid, SIGTERM);
+    waitpid(serverPid, NULL, 0);
+    close(serverOutput);
+    snprintf(path, sizeof(path), "%s/%s", imageDir, TST_IMAGE_NAME);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", imageDir, TST_SIGNED_NAME);
+    unlink(path);
+    rmdir(imageDir);
+}
+
+/**
+ * \name   PackSigned
+ * \brief  Have fwpack pack the image, in two segments of its operational
+ *         part, as an encrypted image the server serves, keeping the install
+ *         key and hash it prints
+ */
+static void PackSigned(void)
+{
+    char appl[sizeof(imageDir) + 8];
+    char data[sizeof(imageDir) + 8];
+    char command[1024];
+
+    snprintf(appl, sizeof(appl), "%s/appl", imageDir);
+    snprintf(data, sizeof(data), "%s/data", imageDir);
+    FILE * file = fopen(appl, "wb");
+    if (file == NULL || fwrite(image, 1, TST_SEGMENT_BYTES, file) != TST_SEGMENT_BYTES || fclose(file) != 0)
+    {
+        perror(appl);
+        exit(EXIT_FAILURE);
+    }
+    file = fopen(data, "wb");
+    if (file == NULL ||
+        fwrite(&image[TST_SEGMENT_BYTES], 1, sizeof(image) - TST_SEGMENT_BYTES, file) != sizeof(image) - TST_SEGMENT_BYTES ||
+        fclose(file) != 0)
+    {
+        perror(data);
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(command, sizeof(command), "'%s' pack -k '%s' -e -n TEST -o %s/%s OPER:APPL:%s OPER:DATA:%s",
+             fwpack, keyFile, imageDir, TST_SIGNED_NAME, appl, data);
+    FILE * output = popen(command, "r");
+    char line[128];
+    while (output && fgets(line, sizeof(line), output))
+    {
+        sscanf(line, "key %64s", signedKey);
+        sscanf(line, "hash %64s", signedHash);
+    }
+    if (output == NULL || pclose(output) != 0 || strlen(signedKey) != 64 || strlen(signedHash) != 64)
+    {
+        fprintf(stderr, "%s failed\n", command);
+        exit(EXIT_FAILURE);
+    }
+    unlink(appl);
+    unlink(data);
+}
+
+/**
+ * \name   CreateImage
+ * \brief  Fill the image and work out its hash as the cloud gives it
+ */
+static void CreateImage(void)
+{
+    uint8_t hash[32];
+
+    srand(1);
+    for (size_t i = 0; i < sizeof(image); i++)
+    {
+        image[i] = rand();
+    }
+    mbedtls_sha256(image, sizeof(image), hash, 0);
+    for (size_t i = 0; i < sizeof(hash); i++)
+    {
+        sprintf(&imageHash[2 * i], "%02x", hash[i]);
+    }
+}
+
+/**
+ * \name   Update
+ * \brief  Download an image from the server
+ * \param  mode         How the server serves it, see TST_OtaServer.py
+ * \param  name         TST_IMAGE_NAME or TST_SIGNED_NAME
+ * \param  key          Install key of a signed image, in hex
+ * \param  hash         Expected SHA-256, or the install hash of a signed
+ *                      image, in hex
+ * \return What https_update_ota() returned
+ */
+static int Update(const char * mode, const char * name, char * key, char * hash)
+{
+    char host[] = "127.0.0.1";
+    char resource[16 + sizeof(TST_SIGNED_NAME)];
+    struct timespec start, end;
+
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+    snprintf(resource, sizeof(resource), "%s/%s", mode, name);
+
+    pthread_mutex_lock(&heapMutex);
+    size_t heapBefore = heapInUse;
+    heapPeak = heapInUse;
+    pthread_mutex_unlock(&heapMutex);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool signedImage = strcmp(name, TST_SIGNED_NAME) == 0;
+    int ret = https_update_ota(host, serverPort, resource, key, hash, signedImage);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    size_t peak = heapPeak - heapBefore;
+    printf("%u bytes in %.0f ms, %.0f KB/s, %zu bytes of heap at the peak\n",
+           (unsigned)sizeof(image), ms, sizeof(image) / 1024.0 / (ms / 1e3), peak);
+    TST_ASSERT(peak < (signedImage ? TST_MAX_SIGNED_HEAP : TST_MAX_HEAP));
+    return ret;
+}
+
+/**
+ * \name   Written
+ * \brief  The image must be in partition A and made active
+ */
+static void Written(void)
+{
+    TST_ASSERT(memcmp(&flash[FLASHMAP_IMAGE_A_OFFSET], image, sizeof(image)) == 0);
+    TST_ASSERT_EQUAL(flash[FLASHMAP_IMAGE_A_OFFSET + sizeof(image)], 0xFF);
+    TST_ASSERT_EQUAL(flash[FLASHMAP_IMAGE_FLAG_SECTOR], TST_FLAG_A_ACTIVE);
+}
+
+/**
+ * \name   Downloaded
+ * \brief  Download the image as served by mode, it must be written to
+ *         partition A as served and made active
+ */
+static void Downloaded(const char * mode)
+{
+    if (TST_ASSERT_EQUAL(Update(mode, TST_IMAGE_NAME, noKey, imageHash), 0))
+    {
+        Written();
+    }
+}
+
+/**
+ * \name   SignedDownloaded
+ * \brief  Download the signed image as served by mode, it must verify and
+ *         its operational part be written to partition A and made active
+ */
+static void SignedDownloaded(const char * mode)
+{
+    if (TST_ASSERT_EQUAL(Update(mode, TST_SIGNED_NAME, signedKey, signedHash), 0))
+    {
+        Written();
+    }
+}
+
+/**
+ * \name   Streamed
+ * \brief  Whole responses
+ */
+static void Streamed(void)
+{
+    Downloaded("steady");
+}
+
+/**
+ * \name   Dropped
+ * \brief  Responses cut at random offsets, each attempt asks for the rest
+ */
+static void Dropped(void)
+{
+    Downloaded("drop");
+}
+
+/**
+ * \name   RangeIgnored
+ * \brief  Responses cut at random offsets by a server which sends the whole
+ *         file each time, the bytes already written are skipped
+ */
+static void RangeIgnored(void)
+{
+    Downloaded("norange");
+}
+
+/**
+ * \name   PowerCut
+ * \brief  The power fails part way, TST_FlashCutPower() ends the boot
+ */
+static void PowerCut(void)
+{
+    Update("drop", TST_IMAGE_NAME, noKey, imageHash);
+    TST_ASSERT(false);
+}
+
+/**
+ * \name   SignedStreamed
+ * \brief  Whole responses of the signed image
+ */
+static void SignedStreamed(void)
+{
+    SignedDownloaded("steady");
+}
+
+/**
+ * \name   SignedDropped
+ * \brief  Responses of the signed image cut at random offsets
+ */
+static void SignedDropped(void)
+{
+    SignedDownloaded("drop");
+}
+
+/**
+ * \name   SignedPowerCut
+ * \brief  The power fails part way through the signed image
+ */
+static void SignedPowerCut(void)
+{
+    Update("drop", TST_SIGNED_NAME, signedKey, signedHash);
+    TST_ASSERT(false);
+}
+
+/**
+ * \name   WrongHash
+ * \brief  An image which is not the one expected is not made active
+ */
+static void WrongHash(void)
+{
+    char hash[sizeof(imageHash)];
+    strcpy(hash, imageHash);
+    hash[0] = hash[0] == '0' ? '1' : '0';
+    TST_ASSERT(Update("steady", TST_IMAGE_NAME, noKey, hash) < 0);
+    TST_ASSERT_EQUAL(flash[FLASHMAP_IMAGE_FLAG_SECTOR], TST_FLAG_NONE);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(int argc, char * argv[])
+{
+    if (argc != 5)
+    {
+        fprintf(stderr, "Usage: %s <python3> <TST_OtaServer.py> <fwpack> <dev_signing_key.pem>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    python = argv[1];
+    script = argv[2];
+    fwpack = argv[3];
+    keyFile = argv[4];
+
+    flash = TST_FlashCreate();
+    CreateImage();
+    StartServer();
+    PackSigned();
+
+    TST_FlashCutPower(0);
+    TST_Boot("Streamed download", Streamed);
+    uint32_t operations = TST_FlashOperations();
+    TST_FlashErase();
+    TST_Boot("Dropped connections", Dropped);
+    TST_FlashErase();
+    TST_Boot("Dropped connections, range ignored", RangeIgnored);
+    TST_FlashErase();
+    TST_Boot("Image hash mismatch", WrongHash);
+
+    // Half way, then a sector the progress record covers is damaged. The
+    // next boot must rewrite it and what follows, but not what precedes it.
+    TST_FlashErase();
+    TST_FlashCutPower(operations / 2);
+    TST_Boot("Power cut during download", PowerCut);
+    TST_ASSERT_EQUAL(flash[FLASHMAP_IMAGE_FLAG_SECTOR], TST_FLAG_NONE);
+    flash[FLASHMAP_IMAGE_A_OFFSET + TST_DAMAGED_SECTOR * FLASH_SECTOR_SIZE + 7] ^= 0x10;
+    TST_FlashCutPower(0);
+    TST_Boot("Download resumed after the reboot", Dropped);
+    TST_ASSERT(TST_FlashOperations() < operations - TST_DAMAGED_SECTOR);
+
+    // The signed image, cut half way. The sectors in flash are replayed
+    // through the verifier rather than downloaded again.
+    TST_FlashErase();
+    TST_Boot("Signed download", SignedStreamed);
+    operations = TST_FlashOperations();
+    TST_FlashErase();
+    TST_FlashCutPower(operations / 2);
+    TST_Boot("Power cut during signed download", SignedPowerCut);
+    TST_ASSERT_EQUAL(flash[FLASHMAP_IMAGE_FLAG_SECTOR], TST_FLAG_NONE);
+    TST_FlashCutPower(0);
+    TST_Boot("Signed download resumed after the reboot", SignedDropped);
+    TST_ASSERT(TST_FlashOperations() < operations * 3 / 4);
+
+    StopServer();
+    return TST_Result();
+}
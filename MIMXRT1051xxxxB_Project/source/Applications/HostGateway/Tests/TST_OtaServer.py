@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+#
+# TST_OtaServer.py
+#
+# HTTP file server for the OTA host test, TST_Ota.c. It serves the files of
+# a directory with an entity tag and honours Range and If-Range, as the
+# upgrade server does, and breaks connections the way a poor link would.
+#
+# The first part of the path picks how the file is served:
+#
+#   steady/<file>   the whole response, every time
+#   drop/<file>     responses are cut at a random offset in the first 64 KB
+#                   asked for, a few before the header is sent
+#   norange/<file>  as drop/, but Range is ignored and the whole file is
+#                   sent again
+#
+# The port it listens on is written to standard output once it is ready.
+#
+# Usage: TST_OtaServer.py <directory> [seed]
+#
+# Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+# Unauthorized copying of this file, via any medium is strictly prohibited
+#
+
+import hashlib
+import http.server
+import os
+import random
+import socketserver
+import sys
+
+MAX_CUT = 64 * 1024         # Bytes asked for that a response may carry
+NO_HEADER_CHANCE = 0.1      # Of a response being cut before its header
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, format, *args):
+        pass
+
+    def send_empty(self, status):
+        self.send_response(status)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+
+    def do_GET(self):
+        mode, _, name = self.path.lstrip('/').partition('/')
+        path = os.path.join(self.server.root, os.path.basename(name))
+        if mode not in ('steady', 'drop', 'norange') or not os.path.isfile(path):
+            self.send_empty(404)
+            return
+
+        with open(path, 'rb') as f:
+            data = f.read()
+        etag = '"%s"' % hashlib.md5(data).hexdigest()
+
+        first, last = 0, len(data) - 1
+        wanted = 0
+        requested = self.headers.get('Range')
+        unchanged = self.headers.get('If-Range') in (None, etag)
+        if requested and unchanged:
+            start, _, end = requested.partition('=')[2].partition('-')
+            wanted = int(start)
+            if mode != 'norange':
+                first = wanted
+                last = min(int(end), last) if end else last
+            if wanted > last:
+                self.send_empty(416)
+                return
+
+        body = data[first:last + 1]
+        cut = None
+        if mode != 'steady':
+            if self.server.random.random() < NO_HEADER_CHANCE:
+                self.close_connection = True
+                return
+            cut = wanted - first + self.server.random.randrange(MAX_CUT)
+            if cut >= len(body):
+                cut = None
+
+        if len(body) == len(data):
+            self.send_response(200)
+        else:
+            self.send_response(206)
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (first, last, len(data)))
+        self.send_header('ETag', etag)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+
+        if cut is None:
+            self.wfile.write(body)
+        else:
+            self.wfile.write(body[:cut])
+            self.close_connection = True
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.stderr.write('Usage: %s <directory> [seed]\n' % sys.argv[0])
+        return 1
+
+    server = Server(('127.0.0.1', 0), Handler)
+    server.root = sys.argv[1]
+    server.random = random.Random(int(sys.argv[2]) if len(sys.argv) > 2 else None)
+
+    print(server.server_address[1])
+    sys.stdout.flush()
+    server.serve_forever()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
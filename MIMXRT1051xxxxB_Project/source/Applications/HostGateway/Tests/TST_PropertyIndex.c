@@ -0,0 +1,308 @@
+/*!****************************************************************************
+ * \file    TST_PropertyIndex.c
+ *
+ * \brief   Tests of the local shadow property indices
+ *
+ * Devices are filled with properties, then every property is looked up by
+ * agent side id and by cloud name. Properties are removed both ways and
+ * created again, so the indices shift entries back over removed slots, and
+ * each lookup must still find the right property or none.
+ *
+ * The cost of a lookup is reported for 12, 50 and 127 devices, 127 being
+ * as many as the object store holds beside the gateway.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "EnsoConfig.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "HostAgent.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_DEVICES             50
+#define TST_PROPERTIES          24
+#define TST_FIRST_ADDRESS       0x7000
+#define TST_FIRST_PROPERTY      0x300
+#define TST_LOOKUPS             200000
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+// Devices the next boot creates
+static int numDevices;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   DeviceId
+ * \return Device id of test device d
+ */
+static EnsoDeviceId_t DeviceId(int d)
+{
+    EnsoDeviceId_t deviceId = { 0 };
+    deviceId.deviceAddress = TST_FIRST_ADDRESS + d;
+    deviceId.technology = 1;
+    return deviceId;
+}
+
+/**
+ * \name   CloudName
+ * \brief  Cloud name of property i, shared by all devices
+ */
+static void CloudName(int i, char * cloudName)
+{
+    snprintf(cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE, "prop%02d", i);
+}
+
+/**
+ * \name   Value
+ * \return Value of property i of device d, generation g
+ */
+static uint32_t Value(int d, int i, int g)
+{
+    return g * 100000 + d * 100 + i;
+}
+
+/**
+ * \name   CreateProperty
+ * \brief  Create property i of device d holding its generation g value
+ */
+static void CreateProperty(EnsoObject_t * owner, int d, int i, int g)
+{
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    EnsoPropertyValue_u values[PROPERTY_GROUP_MAX];
+    CloudName(i, cloudName);
+    values[DESIRED_GROUP].uint32Value = Value(d, i, g);
+    values[REPORTED_GROUP].uint32Value = Value(d, i, g);
+    TST_ASSERT_EQUAL(LSD_CreateProperty(owner, TST_FIRST_PROPERTY + i, cloudName, evUnsignedInt32,
+            PROPERTY_PUBLIC, false, false, values), eecNoError);
+}
+
+/**
+ * \name   CheckProperty
+ * \brief  Property i of device d is found both ways with its generation g
+ *         value, or not at all for generation -1
+ */
+static void CheckProperty(int d, int i, int g)
+{
+    EnsoDeviceId_t deviceId = DeviceId(d);
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    EnsoPropertyValue_u byId;
+    EnsoPropertyValue_u byName;
+    CloudName(i, cloudName);
+
+    EnsoErrorCode_e idResult = LSD_GetPropertyValueByAgentSideId(&deviceId, REPORTED_GROUP,
+            TST_FIRST_PROPERTY + i, &byId);
+    EnsoErrorCode_e nameResult = LSD_GetPropertyValueByCloudName(&deviceId, REPORTED_GROUP,
+            cloudName, &byName);
+    if (g < 0)
+    {
+        TST_ASSERT(idResult != eecNoError);
+        TST_ASSERT(nameResult != eecNoError);
+        return;
+    }
+    if (TST_ASSERT_EQUAL(idResult, eecNoError))
+    {
+        TST_ASSERT_EQUAL(byId.uint32Value, Value(d, i, g));
+    }
+    if (TST_ASSERT_EQUAL(nameResult, eecNoError))
+    {
+        TST_ASSERT_EQUAL(byName.uint32Value, Value(d, i, g));
+    }
+}
+
+/**
+ * \name   CreateDevices
+ * \brief  Create the test devices, each with all its properties
+ * \return false if a device could not be created
+ */
+static bool CreateDevices(EnsoObject_t ** owners)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+    TST_ASSERT_EQUAL(HOST_InitialiseShadow(), eecNoError);
+
+    for (int d = 0; d < numDevices; d++)
+    {
+        owners[d] = LSD_CreateEnsoObject(DeviceId(d));
+        if (!TST_ASSERT(owners[d] != NULL))
+        {
+            return false;
+        }
+        for (int i = 0; i < TST_PROPERTIES; i++)
+        {
+            CreateProperty(owners[d], d, i, 0);
+        }
+    }
+    return true;
+}
+
+/**
+ * \name   RemoveAndCreate
+ * \brief  Properties found, removed and created again keep the indices in
+ *         step with the property lists
+ */
+static void RemoveAndCreate(void)
+{
+    static EnsoObject_t * owners[TST_DEVICES];
+    static int generation[TST_DEVICES][TST_PROPERTIES];
+    if (!CreateDevices(owners))
+    {
+        return;
+    }
+
+    for (int d = 0; d < numDevices; d++)
+    {
+        for (int i = 0; i < TST_PROPERTIES; i++)
+        {
+            CheckProperty(d, i, 0);
+        }
+    }
+
+    // Remove every third property, by agent side id and by name in turn
+    for (int d = 0; d < numDevices; d++)
+    {
+        EnsoDeviceId_t deviceId = DeviceId(d);
+        for (int i = d % 3; i < TST_PROPERTIES; i += 3)
+        {
+            char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+            CloudName(i, cloudName);
+            EnsoErrorCode_e retVal = (i & 1) ?
+                    LSD_RemovePropertyByAgentSideId(&deviceId, TST_FIRST_PROPERTY + i) :
+                    LSD_RemovePropertyByCloudSideId(&deviceId, cloudName);
+            TST_ASSERT_EQUAL(retVal, eecNoError);
+            generation[d][i] = -1;
+        }
+    }
+    for (int d = 0; d < numDevices; d++)
+    {
+        for (int i = 0; i < TST_PROPERTIES; i++)
+        {
+            CheckProperty(d, i, generation[d][i]);
+        }
+    }
+
+    // Create them again with new values, in reverse order
+    for (int d = numDevices - 1; d >= 0; d--)
+    {
+        for (int i = TST_PROPERTIES - 1; i >= 0; i--)
+        {
+            if (generation[d][i] < 0)
+            {
+                CreateProperty(owners[d], d, i, 1);
+                generation[d][i] = 1;
+            }
+        }
+    }
+    for (int d = 0; d < numDevices; d++)
+    {
+        for (int i = 0; i < TST_PROPERTIES; i++)
+        {
+            CheckProperty(d, i, generation[d][i]);
+        }
+    }
+
+    // A removed device takes its properties out of the indices
+    TST_ASSERT_EQUAL(LSD_DestroyEnsoDevice(DeviceId(0)), eecNoError);
+    for (int i = 0; i < TST_PROPERTIES; i++)
+    {
+        CheckProperty(0, i, -1);
+        CheckProperty(1, i, generation[1][i]);
+    }
+}
+
+/**
+ * \name   Elapsed
+ * \return Nanoseconds since start
+ */
+static double Elapsed(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * \name   MeasureLookups
+ * \brief  Report the cost of a lookup by agent side id and by cloud name
+ */
+static void MeasureLookups(void)
+{
+    static EnsoObject_t * owners[LSD_MAX_THING_LIMIT];
+    if (!CreateDevices(owners))
+    {
+        return;
+    }
+
+    struct timespec start;
+    uint32_t sum = 0;
+    uint32_t seed = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < TST_LOOKUPS; n++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int d = (seed >> 8) % numDevices;
+        int i = (seed >> 20) % TST_PROPERTIES;
+        EnsoDeviceId_t deviceId = DeviceId(d);
+        EnsoPropertyValue_u value;
+        LSD_GetPropertyValueByAgentSideId(&deviceId, REPORTED_GROUP, TST_FIRST_PROPERTY + i, &value);
+        sum += value.uint32Value;
+    }
+    double byId = Elapsed(&start) / TST_LOOKUPS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < TST_LOOKUPS; n++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int d = (seed >> 8) % numDevices;
+        int i = (seed >> 20) % TST_PROPERTIES;
+        EnsoDeviceId_t deviceId = DeviceId(d);
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u value;
+        CloudName(i, cloudName);
+        LSD_GetPropertyValueByCloudName(&deviceId, REPORTED_GROUP, cloudName, &value);
+        sum += value.uint32Value;
+    }
+    double byName = Elapsed(&start) / TST_LOOKUPS;
+
+    printf("%3d devices, %d properties each: %.0f ns by agent side id, %.0f ns by cloud name (%08x)\n",
+           numDevices, TST_PROPERTIES, byId, byName, sum);
+    fflush(stdout);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    // Room for a full object store, as on the gateway
+    setenv("OSAL_HEAP_SIZE", "16777216", 1);
+
+    numDevices = TST_DEVICES;
+    TST_Boot("Remove and create properties", RemoveAndCreate);
+
+    numDevices = 12;
+    TST_Boot("Lookups, 12 devices", MeasureLookups);
+    numDevices = 50;
+    TST_Boot("Lookups, 50 devices", MeasureLookups);
+    numDevices = LSD_MAX_THING_LIMIT - 1;
+    TST_Boot("Lookups, most devices", MeasureLookups);
+    return TST_Result();
+}
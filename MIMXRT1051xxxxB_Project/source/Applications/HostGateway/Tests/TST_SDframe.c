@@ -0,0 +1,411 @@
+/*!****************************************************************************
+ * \file    TST_SDframe.c
+ *
+ * \brief   Tests of the SD link message decoder against a byte at a time
+ *          reference
+ *
+ * SDframe.c copies runs of ordinary bytes in one go and stops at the end of
+ * each message, so SDcomms.c can take them from the UART ring as they come.
+ * Fixed cases cover escaped, truncated and back to back messages. Random
+ * streams, of well formed messages with some damaged and of plain noise,
+ * are then cut into random pieces, as the ring wraps and the UART delivers
+ * them, and must decode to what the reference decodes from the whole
+ * stream.
+ *
+ * \Copyright (C) 2018 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDframe.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_MAX_STREAM          256
+#define TST_MAX_MESSAGES        TST_MAX_STREAM
+#define TST_STREAMS             300000
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint8_t msg[TST_MAX_MESSAGES][SDFRAME_MAX_BYTES];
+    uint8_t length[TST_MAX_MESSAGES];
+    int count;
+    uint32_t errors;
+} TST_Decoded_t;
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static uint32_t _seed = 25;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Lcg
+ * \return The next of a repeatable sequence
+ */
+static uint32_t Lcg(void)
+{
+    _seed = _seed * 1103515245 + 12345;
+    return _seed >> 16;
+}
+
+/**
+ * \name   Reference
+ * \brief  Decode a whole stream a byte at a time, as the link protocol is
+ *         described in SDframe.h
+ */
+static void Reference(const uint8_t * data, size_t length, TST_Decoded_t * out)
+{
+    uint8_t msg[SDFRAME_MAX_BYTES];
+    size_t msgLength = 0;
+    bool escape = false;
+    bool bad = false;
+
+    out->count = 0;
+    out->errors = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t byte = data[i];
+        if (escape)
+        {
+            escape = false;
+            if (byte != SDFRAME_FLAG)
+            {
+                if (byte != SDFRAME_ESC_FLAG && byte != SDFRAME_ESC_ESC)
+                {
+                    bad = true;
+                }
+                else if (msgLength < SDFRAME_MAX_BYTES)
+                {
+                    msg[msgLength++] = (byte == SDFRAME_ESC_FLAG) ? SDFRAME_FLAG : SDFRAME_ESC;
+                }
+                else
+                {
+                    bad = true;
+                }
+                continue;
+            }
+            bad = true;
+        }
+
+        if (byte == SDFRAME_ESC)
+        {
+            escape = true;
+        }
+        else if (byte == SDFRAME_FLAG)
+        {
+            if (bad)
+            {
+                out->errors++;
+            }
+            else if (msgLength > 0)
+            {
+                memcpy(out->msg[out->count], msg, msgLength);
+                out->length[out->count++] = msgLength;
+            }
+            msgLength = 0;
+            bad = false;
+        }
+        else if (msgLength < SDFRAME_MAX_BYTES)
+        {
+            msg[msgLength++] = byte;
+        }
+        else
+        {
+            bad = true;
+        }
+    }
+}
+
+/**
+ * \name   Decode
+ * \brief  Decode a stream with SDframe_Decode(), handed over in pieces of
+ *         at most maxPiece bytes, 0 for random pieces
+ */
+static void Decode(const uint8_t * data, size_t length, size_t maxPiece, TST_Decoded_t * out)
+{
+    SDframe_t frame;
+    SDframe_Init(&frame);
+    out->count = 0;
+
+    for (size_t done = 0; done < length; )
+    {
+        size_t piece = maxPiece ? maxPiece : 1 + Lcg() % (length - done);
+        if (piece > length - done)
+        {
+            piece = length - done;
+        }
+        for (size_t used = 0; used < piece; )
+        {
+            size_t decoded = SDframe_Decode(&frame, &data[done + used], piece - used);
+            // Progress is always made, and only stops early at a message
+            if (!TST_ASSERT(decoded > 0 && decoded <= piece - used) ||
+                !TST_ASSERT(frame.ready || used + decoded == piece))
+            {
+                exit(EXIT_FAILURE);
+            }
+            used += decoded;
+            if (frame.ready)
+            {
+                TST_ASSERT_EQUAL(data[done + used - 1], SDFRAME_FLAG);
+                memcpy(out->msg[out->count], frame.msg, frame.length);
+                out->length[out->count++] = frame.length;
+            }
+        }
+        done += piece;
+    }
+    TST_ASSERT_EQUAL(frame.messages, (uint32_t)out->count);
+    out->errors = frame.errors;
+}
+
+/**
+ * \name   Same
+ * \return true if both decoded the same messages and dropped as many
+ */
+static bool Same(const TST_Decoded_t * a, const TST_Decoded_t * b)
+{
+    if (a->count != b->count || a->errors != b->errors)
+    {
+        return false;
+    }
+    for (int i = 0; i < a->count; i++)
+    {
+        if (a->length[i] != b->length[i] || memcmp(a->msg[i], b->msg[i], a->length[i]) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \name   Expect
+ * \brief  A stream decodes, whole and a byte at a time, to the given
+ *         messages, each a length then its bytes, and drops errors
+ */
+static void Expect(const uint8_t * data, size_t length, const uint8_t * expected, uint32_t errors)
+{
+    TST_Decoded_t whole;
+    TST_Decoded_t bytes;
+    Decode(data, length, length, &whole);
+    Decode(data, length, 1, &bytes);
+    TST_ASSERT(Same(&whole, &bytes));
+    TST_ASSERT_EQUAL(whole.errors, errors);
+
+    int count = 0;
+    for (const uint8_t * e = expected; *e; e += 1 + *e, count++)
+    {
+        if (!TST_ASSERT(count < whole.count))
+        {
+            return;
+        }
+        TST_ASSERT_EQUAL(whole.length[count], *e);
+        TST_ASSERT(memcmp(whole.msg[count], e + 1, *e) == 0);
+    }
+    TST_ASSERT_EQUAL(whole.count, count);
+}
+
+/**
+ * \name   Encode
+ * \brief  Append a message to a stream, escaped and ended with FLAG
+ * \return The new length of the stream
+ */
+static size_t Encode(uint8_t * stream, size_t length, const uint8_t * msg, size_t msgLength)
+{
+    for (size_t i = 0; i < msgLength; i++)
+    {
+        if (msg[i] == SDFRAME_FLAG || msg[i] == SDFRAME_ESC)
+        {
+            stream[length++] = SDFRAME_ESC;
+            stream[length++] = (msg[i] == SDFRAME_FLAG) ? SDFRAME_ESC_FLAG : SDFRAME_ESC_ESC;
+        }
+        else
+        {
+            stream[length++] = msg[i];
+        }
+    }
+    stream[length++] = SDFRAME_FLAG;
+    return length;
+}
+
+/**
+ * \name   Escaped
+ * \brief  FLAG and ESC inside messages, up to the longest message, and
+ *         bad escapes
+ */
+static void Escaped(void)
+{
+    static const uint8_t stream[] =
+    {
+        0x01, 0x7D, 0x01, 0x7D, 0x02, 0x7E,                     // 01 7E 7D
+        0x7D, 0x01, 0x7E,                                       // 7E alone
+        0x02, 0x7D, 0x03, 0x04, 0x7E,                           // ESC then 3, dropped
+        0x05, 0x7D, 0x7D, 0x02, 0x7E,                           // ESC then ESC, dropped
+        0x06, 0x7E,
+    };
+    static const uint8_t expected[] = { 3, 0x01, 0x7E, 0x7D, 1, 0x7E, 1, 0x06, 0 };
+    Expect(stream, sizeof(stream), expected, 2);
+
+    // The longest message, all escaped, fits; one byte more does not
+    uint8_t msg[SDFRAME_MAX_BYTES + 1];
+    uint8_t longest[2 * sizeof(msg) + 1];
+    TST_Decoded_t out;
+    memset(msg, SDFRAME_FLAG, sizeof(msg));
+    size_t length = Encode(longest, 0, msg, SDFRAME_MAX_BYTES);
+    Decode(longest, length, 1, &out);
+    TST_ASSERT(out.count == 1 && out.length[0] == SDFRAME_MAX_BYTES && memcmp(out.msg[0], msg, SDFRAME_MAX_BYTES) == 0);
+
+    length = Encode(longest, 0, msg, sizeof(msg));
+    Decode(longest, length, 1, &out);
+    TST_ASSERT(out.count == 0 && out.errors == 1);
+}
+
+/**
+ * \name   Truncated
+ * \brief  A message cut short after an ESC, or running on past the longest
+ *         message, is dropped and the next one still decodes
+ */
+static void Truncated(void)
+{
+    static const uint8_t stream[] =
+    {
+        0x05, 0x7D, 0x7E,                                       // cut after ESC
+        0x06, 0x7E,
+        0x7D, 0x7E,                                             // only an ESC
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,         // one too many
+        0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x7E,
+        0x07, 0x08, 0x7E,
+        0x09,                                                   // never ended
+    };
+    static const uint8_t expected[] = { 1, 0x06, 2, 0x07, 0x08, 0 };
+    Expect(stream, sizeof(stream), expected, 3);
+}
+
+/**
+ * \name   BackToBack
+ * \brief  Messages sharing their FLAGs are each returned on their own, and
+ *         empty messages between them are ignored
+ */
+static void BackToBack(void)
+{
+    static const uint8_t stream[] =
+    {
+        0x7E, 0x7E,                                             // idle FLAGs
+        0x11, 0x7E, 0x22, 0x23, 0x7E, 0x7D, 0x02, 0x7E,
+        0x7E,
+        0x33, 0x7E,
+    };
+    static const uint8_t expected[] = { 1, 0x11, 2, 0x22, 0x23, 1, 0x7D, 1, 0x33, 0 };
+    Expect(stream, sizeof(stream), expected, 0);
+
+    // A message stays in the decoder until the next call
+    SDframe_t frame;
+    SDframe_Init(&frame);
+    TST_ASSERT_EQUAL(SDframe_Decode(&frame, &stream[2], 2), 2);
+    TST_ASSERT(frame.ready && frame.length == 1 && frame.msg[0] == 0x11);
+    TST_ASSERT_EQUAL(SDframe_Decode(&frame, &stream[4], 3), 3);
+    TST_ASSERT(frame.ready && frame.length == 2 && frame.msg[1] == 0x23);
+}
+
+/**
+ * \name   Fuzz
+ * \brief  Random streams, in random pieces, decode as the reference
+ *         decodes them whole
+ */
+static void Fuzz(void)
+{
+    static uint8_t stream[TST_MAX_STREAM * 2];
+    static TST_Decoded_t expected;
+    static TST_Decoded_t decoded;
+    int mismatches = 0;
+    uint32_t messages = 0;
+    uint32_t errors = 0;
+
+    for (int n = 0; n < TST_STREAMS; n++)
+    {
+        size_t length = 0;
+        if (n % 2)
+        {
+            // Well formed messages, some damaged by a dropped, changed or
+            // added byte, with ESC, FLAG and the escape codes likely
+            while (length < TST_MAX_STREAM)
+            {
+                uint8_t msg[SDFRAME_MAX_BYTES + 2];
+                size_t msgLength = Lcg() % sizeof(msg);
+                for (size_t i = 0; i < msgLength; i++)
+                {
+                    uint32_t r = Lcg() % 8;
+                    msg[i] = r == 0 ? SDFRAME_FLAG : r == 1 ? SDFRAME_ESC : r == 2 ? Lcg() % 3 : Lcg();
+                }
+                size_t start = length;
+                length = Encode(stream, length, msg, msgLength);
+                if (Lcg() % 8 == 0)
+                {
+                    size_t at = start + Lcg() % (length - start);
+                    switch (Lcg() % 3)
+                    {
+                        case 0:
+                            memmove(&stream[at], &stream[at + 1], --length - at);
+                            break;
+                        case 1:
+                            stream[at] = Lcg();
+                            break;
+                        default:
+                            memmove(&stream[at + 1], &stream[at], length++ - at);
+                            stream[at] = Lcg() % 2 ? SDFRAME_ESC : SDFRAME_FLAG;
+                            break;
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Noise, plain or heavy in FLAG, ESC and the escape codes
+            bool plain = Lcg() % 2;
+            length = Lcg() % TST_MAX_STREAM;
+            for (size_t i = 0; i < length; i++)
+            {
+                uint32_t r = Lcg() % 100;
+                stream[i] = plain ? Lcg() : r < 8 ? SDFRAME_FLAG : r < 14 ? SDFRAME_ESC : r < 20 ? Lcg() % 3 : Lcg();
+            }
+        }
+
+        Reference(stream, length, &expected);
+        Decode(stream, length, 0, &decoded);
+        mismatches += !Same(&expected, &decoded);
+        messages += expected.count;
+        errors += expected.errors;
+    }
+
+    printf("%d streams, %u messages, %u dropped\n", TST_STREAMS, (unsigned)messages, (unsigned)errors);
+    fflush(stdout);
+    TST_ASSERT_EQUAL(mismatches, 0);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_Boot("Escaped messages", Escaped);
+    TST_Boot("Truncated messages", Truncated);
+    TST_Boot("Back to back messages", BackToBack);
+    TST_Boot("Random streams in random pieces", Fuzz);
+    return TST_Result();
+}
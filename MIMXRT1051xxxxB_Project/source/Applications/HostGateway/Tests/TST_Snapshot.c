@@ -0,0 +1,534 @@
+/*!****************************************************************************
+ * \file    TST_Snapshot.c
+ *
+ * \brief   Power failure tests of the storage manager snapshot
+ *
+ * Rounds of values are written through STO_WriteRecord and consolidated
+ * into a snapshot by a boot which finds a torn log. The store is then put
+ * back in each state a power failure during a consolidation leaves, and a
+ * fresh boot must restore the newest round: logs left behind after the
+ * snapshot replaced them must not be replayed over it, and a new snapshot
+ * cut short must leave the previous snapshot and the log in use. A bit
+ * flip anywhere in a snapshot must be caught by its CRC.
+ *
+ * The size and load time of the snapshot and of the log it replaces are
+ * reported for 12 and 50 devices, the best of a few boots each. The
+ * snapshot must load faster than the log.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "STO_Manager.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_CURRENT_LOG         "\"\"StoreLog_Current"
+#define TST_SNAPSHOT            "\"\"StoreSnapshot"
+#define TST_NEW_SNAPSHOT        "\"\"StoreSnapshot_New"
+
+#define TST_DEVICES             4
+#define TST_PROPERTIES          24
+#define TST_BLOB_PROPERTY       5
+#define TST_BLOB_SIZE           40
+#define TST_FIRST_ADDRESS       0x5000
+#define TST_FIRST_PROPERTY      0x200
+
+#define TST_MAX_STORE_SIZE      262144
+
+#define TST_TIMED_BOOTS         5
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint8_t data[TST_MAX_STORE_SIZE];
+    uint32_t size;
+} TST_StoreImage_t;
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+// Value types of the properties other than the blob
+static const EnsoValueType_e valueTypes[] =
+{
+    evInt32, evUnsignedInt32, evFloat32, evBoolean, evString, evTimestamp
+};
+
+// Devices and round of values the next boot writes or must restore, round 0
+// for none
+static int numDevices;
+static int round;
+
+// Load time of the last timed boot in us, shared with the booted process
+static long * loadTime;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   MakeRecord
+ * \brief  The value of property i of a device in a round
+ */
+static void MakeRecord(int device, int i, EnsoTag_t * tag, char * cloudName, EnsoPropertyValue_u * value)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->deviceId.deviceAddress = TST_FIRST_ADDRESS + device;
+    tag->propId = TST_FIRST_PROPERTY + i;
+    tag->propType.valueType = (i == TST_BLOB_PROPERTY) ? evBlobHandle : valueTypes[i % 6];
+    tag->propType.kind = PROPERTY_PUBLIC;
+    tag->propType.persistent = true;
+    tag->propGroup = REPORTED_GROUP;
+
+    memset(cloudName, 0, LSD_PROPERTY_NAME_BUFFER_SIZE);
+    snprintf(cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE, "p%d", i);
+
+    int seed = round * 1000 + device * 100 + i;
+    memset(value, 0, sizeof(*value));
+    switch (tag->propType.valueType)
+    {
+    case evInt32:
+        value->int32Value = -seed;
+        break;
+    case evFloat32:
+        value->float32Value = seed / 4.0f;
+        break;
+    case evBoolean:
+        value->booleanValue = seed & 1;
+        break;
+    case evString:
+        snprintf(value->stringValue, sizeof(value->stringValue), "s%d", seed);
+        break;
+    case evTimestamp:
+        value->timestamp.seconds = seed;
+        value->timestamp.isValid = true;
+        break;
+    default:
+        value->uint32Value = seed;
+        break;
+    }
+}
+
+/**
+ * \name   BlobByte
+ * \return Byte k of the blob of a device in the current round, the local
+ *         shadow holds blobs as null terminated strings
+ */
+static uint8_t BlobByte(int device, int k)
+{
+    return (k == TST_BLOB_SIZE - 1) ? '\0' : 'a' + (round * 7 + device * 3 + k) % 26;
+}
+
+/**
+ * \name   CheckRestored
+ * \brief  Every property holds its value of the current round, or none is
+ *         found for round 0
+ */
+static void CheckRestored(void)
+{
+    for (int device = 0; device < numDevices; device++)
+    {
+        for (int i = 0; i < TST_PROPERTIES; i++)
+        {
+            EnsoTag_t tag;
+            char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+            EnsoPropertyValue_u expected;
+            MakeRecord(device, i, &tag, cloudName, &expected);
+
+            if (tag.propType.valueType == evBlobHandle)
+            {
+                uint8_t blob[TST_BLOB_SIZE];
+                uint8_t expectedBlob[TST_BLOB_SIZE];
+                size_t copied = 0;
+                EnsoErrorCode_e retVal = LSD_GetPropertyBufferByAgentSideId(&tag.deviceId, REPORTED_GROUP,
+                        tag.propId, sizeof(blob), blob, &copied);
+                if (round == 0)
+                {
+                    TST_ASSERT(retVal != eecNoError);
+                    continue;
+                }
+                TST_ASSERT_EQUAL(retVal, eecNoError);
+                TST_ASSERT_EQUAL(copied, TST_BLOB_SIZE);
+                for (int k = 0; k < TST_BLOB_SIZE; k++)
+                {
+                    expectedBlob[k] = BlobByte(device, k);
+                }
+                TST_ASSERT(memcmp(blob, expectedBlob, sizeof(blob)) == 0);
+                continue;
+            }
+
+            EnsoPropertyValue_u value;
+            EnsoErrorCode_e retVal = LSD_GetPropertyValueByAgentSideId(&tag.deviceId, REPORTED_GROUP,
+                    tag.propId, &value);
+            if (round == 0)
+            {
+                TST_ASSERT(retVal != eecNoError);
+                continue;
+            }
+            if (!TST_ASSERT_EQUAL(retVal, eecNoError))
+            {
+                continue;
+            }
+            switch (tag.propType.valueType)
+            {
+            case evString:
+                TST_ASSERT(strcmp(value.stringValue, expected.stringValue) == 0);
+                break;
+            case evTimestamp:
+                TST_ASSERT_EQUAL(value.timestamp.seconds, expected.timestamp.seconds);
+                break;
+            case evBoolean:
+                TST_ASSERT_EQUAL(value.booleanValue, expected.booleanValue);
+                break;
+            default:
+                TST_ASSERT_EQUAL(value.uint32Value, expected.uint32Value);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * \name   Initialise
+ * \brief  Bring up the local shadow, quietly as there is no handler to
+ *         announce devices to
+ */
+static void Initialise(void)
+{
+    LOG_Init();
+    LOG_EnableTrace(false);
+    LOG_EnableInfo(false);
+    LOG_EnableError(false);
+    LOG_EnableWarning(false);
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+}
+
+/**
+ * \name   WriteBoot
+ * \brief  Check the previous round was restored, then write the next one
+ */
+static void WriteBoot(void)
+{
+    Initialise();
+    STO_Init();
+    CheckRestored();
+
+    round++;
+    for (int device = 0; device < numDevices; device++)
+    {
+        for (int i = 0; i < TST_PROPERTIES; i++)
+        {
+            EnsoTag_t tag;
+            char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+            EnsoPropertyValue_u value;
+            MakeRecord(device, i, &tag, cloudName, &value);
+            if (tag.propType.valueType == evBlobHandle)
+            {
+                value.memoryHandle = OSAL_MemoryRequest(NULL, TST_BLOB_SIZE);
+                if (!TST_ASSERT(value.memoryHandle != NULL))
+                {
+                    return;
+                }
+                for (int k = 0; k < TST_BLOB_SIZE; k++)
+                {
+                    ((uint8_t *)value.memoryHandle)[k] = BlobByte(device, k);
+                }
+            }
+            TST_ASSERT_EQUAL(STO_WriteRecord(&tag, cloudName, sizeof(value), &value), eecNoError);
+            if (tag.propType.valueType == evBlobHandle)
+            {
+                OSAL_Free(value.memoryHandle);
+            }
+        }
+    }
+}
+
+/**
+ * \name   LoadBoot
+ * \brief  Load the store and check the current round was restored
+ */
+static void LoadBoot(void)
+{
+    Initialise();
+    STO_Init();
+    CheckRestored();
+}
+
+/**
+ * \name   TimedBoot
+ * \brief  Report how long loading the store takes
+ */
+static void TimedBoot(void)
+{
+    struct timespec start;
+    struct timespec end;
+
+    Initialise();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    STO_Init();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CheckRestored();
+
+    *loadTime = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+/**
+ * \name   BestLoadTime
+ * \return The shortest time in us a few boots took to load the store
+ */
+static long BestLoadTime(const char * name)
+{
+    long best = -1;
+    for (int i = 0; i < TST_TIMED_BOOTS; i++)
+    {
+        *loadTime = -1;
+        TST_Boot(name, TimedBoot);
+        if ((*loadTime >= 0) && ((best < 0) || (*loadTime < best)))
+        {
+            best = *loadTime;
+        }
+    }
+    printf("%2d devices: loaded in %ld us\n", numDevices, best);
+    fflush(stdout);
+    return best;
+}
+
+/**
+ * \name   ReadStore
+ * \brief  Keep a copy of a store, empty if it does not exist
+ */
+static void ReadStore(const char * name, TST_StoreImage_t * image)
+{
+    image->size = 0;
+    FILE * file = fopen(TST_StorePath(name), "rb");
+    if (file != NULL)
+    {
+        image->size = fread(image->data, 1, sizeof(image->data), file);
+        TST_ASSERT(image->size < sizeof(image->data));
+        fclose(file);
+    }
+}
+
+/**
+ * \name   PutStore
+ * \brief  Write the first bytes of an image to a store
+ */
+static void PutStore(const char * name, const TST_StoreImage_t * image, uint32_t size)
+{
+    FILE * file = fopen(TST_StorePath(name), "wb");
+    if (TST_ASSERT(file != NULL))
+    {
+        TST_ASSERT_EQUAL(fwrite(image->data, 1, size, file), size);
+        fclose(file);
+    }
+}
+
+/**
+ * \name   Exists
+ * \return true if a store exists
+ */
+static bool Exists(const char * name)
+{
+    return access(TST_StorePath(name), F_OK) == 0;
+}
+
+/**
+ * \name   Consolidate
+ * \brief  Tear the end of the log, so the next boot rebuilds the store into
+ *         a snapshot
+ */
+static void Consolidate(void)
+{
+    FILE * file = fopen(TST_StorePath(TST_CURRENT_LOG), "ab");
+    if (TST_ASSERT(file != NULL))
+    {
+        fputc(0, file);
+        fclose(file);
+    }
+    TST_Boot("Consolidate", LoadBoot);
+    TST_ASSERT(Exists(TST_SNAPSHOT));
+    TST_ASSERT(!Exists(TST_CURRENT_LOG));
+}
+
+/**
+ * \name   LeftBehindLogs
+ * \brief  Logs which were not removed after the snapshot replaced them are
+ *         not replayed, records written after the snapshot are
+ */
+static void LeftBehindLogs(void)
+{
+    static TST_StoreImage_t staleLog;
+    static TST_StoreImage_t newLog;
+    static TST_StoreImage_t mixedLog;
+
+    TST_Boot("Write round 1", WriteBoot);
+    round++;
+    ReadStore(TST_CURRENT_LOG, &staleLog);
+    TST_Boot("Write round 2", WriteBoot);
+    round++;
+    Consolidate();
+
+    // Cut after the rename, before the log was removed
+    PutStore(TST_CURRENT_LOG, &staleLog, staleLog.size);
+    TST_Boot("Log left behind", LoadBoot);
+    TST_ASSERT(!Exists(TST_CURRENT_LOG));
+
+    // Cut before the rename, completed at boot
+    TST_ASSERT_EQUAL(rename(TST_StorePath(TST_SNAPSHOT), TST_StorePath(TST_NEW_SNAPSHOT)), 0);
+    PutStore(TST_CURRENT_LOG, &staleLog, staleLog.size);
+    TST_Boot("Log left behind a new snapshot", LoadBoot);
+    TST_ASSERT(Exists(TST_SNAPSHOT));
+    TST_ASSERT(!Exists(TST_NEW_SNAPSHOT));
+    TST_ASSERT(!Exists(TST_CURRENT_LOG));
+
+    // Records appended to a log which could not be removed
+    TST_Boot("Write round 3", WriteBoot);
+    round++;
+    ReadStore(TST_CURRENT_LOG, &newLog);
+    memcpy(mixedLog.data, staleLog.data, staleLog.size);
+    memcpy(mixedLog.data + staleLog.size, newLog.data, newLog.size);
+    mixedLog.size = staleLog.size + newLog.size;
+    PutStore(TST_CURRENT_LOG, &mixedLog, mixedLog.size);
+    TST_Boot("Records after a log left behind", LoadBoot);
+}
+
+/**
+ * \name   CutNewSnapshot
+ * \brief  A new snapshot cut at any point leaves the previous snapshot and
+ *         the log, which hold the same values
+ */
+static void CutNewSnapshot(void)
+{
+    static TST_StoreImage_t oldSnapshot;
+    static TST_StoreImage_t log;
+    static TST_StoreImage_t newSnapshot;
+
+    TST_Boot("Write round 4", WriteBoot);
+    round++;
+    ReadStore(TST_SNAPSHOT, &oldSnapshot);
+    ReadStore(TST_CURRENT_LOG, &log);
+    Consolidate();
+    ReadStore(TST_SNAPSHOT, &newSnapshot);
+
+    int failures = 0;
+    for (uint32_t offset = 0; offset <= newSnapshot.size; offset++)
+    {
+        PutStore(TST_SNAPSHOT, &oldSnapshot, oldSnapshot.size);
+        PutStore(TST_CURRENT_LOG, &log, log.size);
+        PutStore(TST_NEW_SNAPSHOT, &newSnapshot, offset);
+        bool passed = TST_Boot("Cut new snapshot", LoadBoot);
+        passed = TST_Check(!Exists(TST_NEW_SNAPSHOT), "new snapshot completed or removed",
+                           __FILE__, __LINE__) && passed;
+        if (!passed && ++failures == 5)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * \name   FlipSnapshot
+ * \brief  A snapshot with a bit flipped anywhere is not loaded
+ */
+static void FlipSnapshot(void)
+{
+    static TST_StoreImage_t snapshot;
+    static TST_StoreImage_t damaged;
+
+    unlink(TST_StorePath(TST_CURRENT_LOG));
+    ReadStore(TST_SNAPSHOT, &snapshot);
+    damaged = snapshot;
+
+    int saved = round;
+    round = 0;
+    int failures = 0;
+    for (uint32_t offset = 0; offset < snapshot.size; offset++)
+    {
+        damaged.data[offset] ^= 1 << (offset % 8);
+        PutStore(TST_SNAPSHOT, &damaged, damaged.size);
+        damaged.data[offset] = snapshot.data[offset];
+        if (!TST_Boot("Bit flipped snapshot", LoadBoot) && ++failures == 5)
+        {
+            break;
+        }
+    }
+    round = saved;
+    PutStore(TST_SNAPSHOT, &snapshot, snapshot.size);
+}
+
+/**
+ * \name   Measure
+ * \brief  Report the size and load time of a log and of the snapshot it is
+ *         consolidated into
+ */
+static void Measure(int devices)
+{
+    TST_StoreImage_t * image = malloc(sizeof(*image));
+    if (!TST_ASSERT(image != NULL))
+    {
+        return;
+    }
+
+    TST_UseNewStore();
+    numDevices = devices;
+    round = 0;
+    TST_Boot("Write the log", WriteBoot);
+    round++;
+    ReadStore(TST_CURRENT_LOG, image);
+    printf("%2d devices: log of %u bytes\n", devices, image->size);
+    fflush(stdout);
+    long logTime = BestLoadTime("Load the log");
+
+    Consolidate();
+    ReadStore(TST_SNAPSHOT, image);
+    printf("%2d devices: snapshot of %u bytes\n", devices, image->size);
+    fflush(stdout);
+    long snapshotTime = BestLoadTime("Load the snapshot");
+    TST_ASSERT((snapshotTime >= 0) && (snapshotTime < logTime));
+    free(image);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    loadTime = mmap(NULL, sizeof(*loadTime), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (loadTime == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    TST_UseNewStore();
+    numDevices = TST_DEVICES;
+    round = 0;
+
+    LeftBehindLogs();
+    CutNewSnapshot();
+    FlipSnapshot();
+    TST_Boot("Load the snapshot", LoadBoot);
+
+    Measure(12);
+    Measure(50);
+    return TST_Result();
+}
@@ -0,0 +1,440 @@
+/*!****************************************************************************
+ * \file    TST_StoreLog.c
+ *
+ * \brief   Fault injection tests of the storage manager log
+ *
+ * A log is written through STO_WriteRecord, then cut short and bit flipped
+ * at every offset. Each damaged log is loaded by a fresh boot, which must
+ * restore every record before the damage and nothing from it onwards, and
+ * rebuild the store from the local shadow when the log cannot be appended
+ * to. A log in the format used before records had a header must load in
+ * full whatever its length.
+ *
+ * A log of about 100 kB, the size which is consolidated, is replayed by a
+ * boot which is timed and must restore every one of its records.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "STO_Manager.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_CURRENT_LOG         "\"\"StoreLog_Current"
+#define TST_SNAPSHOT            "\"\"StoreSnapshot"
+
+#define TST_LOG_RECORDS         24
+#define TST_LOG_DEVICES         4
+#define TST_FIRST_ADDRESS       0x3000
+#define TST_FIRST_PROPERTY      0x100
+#define TST_FIRST_VALUE         1000
+
+// Record header: magic, version, generation, payload length and CRC
+#define TST_RECORD_HEADER_SIZE  12
+#define TST_MAX_LOG_SIZE        4096
+
+// Just under STO_MAX_STORE_SIZE_IN_BYTES, a property of its own each
+#define TST_LARGE_DEVICES       50
+#define TST_LARGE_PROPERTIES    27
+#define TST_LARGE_RECORDS       (TST_LARGE_DEVICES * TST_LARGE_PROPERTIES)
+#define TST_LARGE_ADDRESS       0x4000
+#define TST_LARGE_MIN_SIZE      95000
+#define TST_LARGE_MAX_SIZE      100000
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static uint8_t logImage[TST_MAX_LOG_SIZE];
+static uint32_t logSize;
+
+// End offset of each record in logImage
+static uint32_t recordEnds[TST_LOG_RECORDS];
+
+// Records a boot must restore, set before each boot
+static int expectedRecords;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   MakeRecord
+ * \brief  Record i sets its own property on one of the test devices
+ */
+static void MakeRecord(int i, EnsoTag_t * tag, char * cloudName, EnsoPropertyValue_u * value)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->deviceId.deviceAddress = TST_FIRST_ADDRESS + (i % TST_LOG_DEVICES);
+    tag->propId = TST_FIRST_PROPERTY + i;
+    tag->propType.valueType = evUnsignedInt32;
+    tag->propType.kind = PROPERTY_PUBLIC;
+    tag->propType.persistent = true;
+    tag->propGroup = REPORTED_GROUP;
+
+    memset(cloudName, 0, LSD_PROPERTY_NAME_BUFFER_SIZE);
+    snprintf(cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE, "p%d", i);
+
+    memset(value, 0, sizeof(*value));
+    value->uint32Value = TST_FIRST_VALUE + i;
+}
+
+/**
+ * \name   RestoredRecords
+ * \return Number of records found in the local shadow, which must be the
+ *         first ones written
+ */
+static int RestoredRecords(void)
+{
+    int restored = 0;
+    for (int i = 0; i < TST_LOG_RECORDS; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u expected;
+        MakeRecord(i, &tag, cloudName, &expected);
+
+        EnsoPropertyValue_u value;
+        if (LSD_GetPropertyValueByAgentSideId(&tag.deviceId, REPORTED_GROUP, tag.propId, &value) == eecNoError)
+        {
+            TST_ASSERT_EQUAL(value.uint32Value, expected.uint32Value);
+            TST_ASSERT_EQUAL(restored, i);
+            restored++;
+        }
+    }
+    return restored;
+}
+
+/**
+ * \name   WriteBoot
+ * \brief  Write the test records to a new log
+ */
+static void WriteBoot(void)
+{
+    LOG_Init();
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+
+    for (int i = 0; i < TST_LOG_RECORDS; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u value;
+        MakeRecord(i, &tag, cloudName, &value);
+        TST_ASSERT_EQUAL(STO_WriteRecord(&tag, cloudName, sizeof(value), &value), eecNoError);
+    }
+}
+
+/**
+ * \name   LoadBoot
+ * \brief  Load the store, quietly as it runs once per fault
+ */
+static void LoadBoot(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableError(false);
+    LOG_EnableWarning(false);
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+    STO_Init();
+    TST_ASSERT_EQUAL(RestoredRecords(), expectedRecords);
+}
+
+/**
+ * \name   ReadLog
+ * \brief  Keep a copy of the log and find where its records end
+ */
+static void ReadLog(void)
+{
+    FILE * file = fopen(TST_StorePath(TST_CURRENT_LOG), "rb");
+    if (!TST_ASSERT(file != NULL))
+    {
+        return;
+    }
+    logSize = fread(logImage, 1, sizeof(logImage), file);
+    fclose(file);
+
+    uint32_t offset = 0;
+    for (int i = 0; i < TST_LOG_RECORDS && offset + TST_RECORD_HEADER_SIZE <= logSize; i++)
+    {
+        uint32_t length;
+        memcpy(&length, &logImage[offset + 4], sizeof(length));
+        offset += TST_RECORD_HEADER_SIZE + length;
+        recordEnds[i] = offset;
+    }
+    TST_ASSERT_EQUAL(offset, logSize);
+}
+
+/**
+ * \name   PutLog
+ * \brief  Leave a log, and nothing else, in the store
+ */
+static void PutLog(const uint8_t * data, uint32_t size)
+{
+    unlink(TST_StorePath(TST_SNAPSHOT));
+    FILE * file = fopen(TST_StorePath(TST_CURRENT_LOG), "wb");
+    if (TST_ASSERT(file != NULL))
+    {
+        TST_ASSERT_EQUAL(fwrite(data, 1, size, file), size);
+        fclose(file);
+    }
+}
+
+/**
+ * \name   CompleteRecords
+ * \return Number of records which end at or before an offset
+ */
+static int CompleteRecords(uint32_t offset)
+{
+    int n = 0;
+    while (n < TST_LOG_RECORDS && recordEnds[n] <= offset)
+    {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * \name   Rebuilt
+ * \return true if the last load replaced the log by a snapshot
+ */
+static bool Rebuilt(void)
+{
+    return access(TST_StorePath(TST_SNAPSHOT), F_OK) == 0;
+}
+
+/**
+ * \name   TruncateAtEveryOffset
+ * \brief  A log cut short keeps its whole records, and is rebuilt if the
+ *         cut left part of a record behind
+ */
+static void TruncateAtEveryOffset(void)
+{
+    int failures = 0;
+    for (uint32_t offset = 0; offset <= logSize; offset++)
+    {
+        int complete = CompleteRecords(offset);
+        bool onBoundary = (complete == 0) ? (offset == 0) : (recordEnds[complete - 1] == offset);
+
+        PutLog(logImage, offset);
+        expectedRecords = complete;
+        bool passed = TST_Boot("Truncated log", LoadBoot);
+        passed = TST_Check(Rebuilt() == !onBoundary, "rebuilt unless cut on a record boundary",
+                           __FILE__, __LINE__) && passed;
+        if (!passed && ++failures == 5)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * \name   FlipAtEveryOffset
+ * \brief  A bit flip anywhere in a record loses that record and those after
+ *         it, and the log is rebuilt
+ */
+static void FlipAtEveryOffset(void)
+{
+    static uint8_t damaged[TST_MAX_LOG_SIZE];
+    int failures = 0;
+    for (uint32_t offset = 0; offset < logSize; offset++)
+    {
+        memcpy(damaged, logImage, logSize);
+        damaged[offset] ^= 1 << (offset % 8);
+
+        PutLog(damaged, logSize);
+        expectedRecords = CompleteRecords(offset);
+        bool passed = TST_Boot("Bit flipped log", LoadBoot);
+        passed = TST_Check(Rebuilt(), "rebuilt", __FILE__, __LINE__) && passed;
+        if (!passed && ++failures == 5)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * \name   LegacyLog
+ * \brief  A log of bare payloads, as written before records had a header,
+ *         loads whole records up to any cut and is rewritten
+ */
+static void LegacyLog(void)
+{
+    static uint8_t legacy[TST_MAX_LOG_SIZE];
+    uint32_t size = 0;
+    uint32_t ends[TST_LOG_RECORDS];
+
+    for (int i = 0; i < TST_LOG_RECORDS; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u value;
+        uint16_t length = sizeof(value);
+        MakeRecord(i, &tag, cloudName, &value);
+
+        memcpy(&legacy[size], &tag, sizeof(tag));
+        size += sizeof(tag);
+        memcpy(&legacy[size], cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE);
+        size += LSD_PROPERTY_NAME_BUFFER_SIZE;
+        memcpy(&legacy[size], &length, sizeof(length));
+        size += sizeof(length);
+        memcpy(&legacy[size], &value, sizeof(value));
+        size += sizeof(value);
+        ends[i] = size;
+    }
+
+    int failures = 0;
+    for (uint32_t offset = 0; offset <= size; offset++)
+    {
+        int complete = 0;
+        while (complete < TST_LOG_RECORDS && ends[complete] <= offset)
+        {
+            complete++;
+        }
+
+        PutLog(legacy, offset);
+        expectedRecords = complete;
+        bool passed = TST_Boot("Old format log", LoadBoot);
+        passed = TST_Check(Rebuilt() == (offset > 0), "rewritten in the current format",
+                           __FILE__, __LINE__) && passed;
+        if (!passed && ++failures == 5)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * \name   MakeLargeRecord
+ * \brief  Record i of the large log sets its own property
+ */
+static void MakeLargeRecord(int i, EnsoTag_t * tag, char * cloudName, EnsoPropertyValue_u * value)
+{
+    MakeRecord(i, tag, cloudName, value);
+    tag->deviceId.deviceAddress = TST_LARGE_ADDRESS + (i / TST_LARGE_PROPERTIES);
+    tag->propId = TST_FIRST_PROPERTY + (i % TST_LARGE_PROPERTIES);
+    snprintf(cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE, "p%d", i % TST_LARGE_PROPERTIES);
+}
+
+/**
+ * \name   WriteLargeBoot
+ * \brief  Write the large log to a new store
+ */
+static void WriteLargeBoot(void)
+{
+    LOG_Init();
+    LOG_EnableTrace(false);
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+
+    for (int i = 0; i < TST_LARGE_RECORDS; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u value;
+        MakeLargeRecord(i, &tag, cloudName, &value);
+        if (!TST_ASSERT_EQUAL(STO_WriteRecord(&tag, cloudName, sizeof(value), &value), eecNoError))
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * \name   LoadLargeBoot
+ * \brief  Time the replay of the large log, then check every record
+ */
+static void LoadLargeBoot(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableError(false);
+    LOG_EnableTrace(false);
+    TST_ASSERT_EQUAL(LSD_Init(), eecNoError);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TST_ASSERT_EQUAL(STO_Init(), eecNoError);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+
+    int restored = 0;
+    for (int i = 0; i < TST_LARGE_RECORDS; i++)
+    {
+        EnsoTag_t tag;
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+        EnsoPropertyValue_u expected;
+        MakeLargeRecord(i, &tag, cloudName, &expected);
+
+        EnsoPropertyValue_u value;
+        if (LSD_GetPropertyValueByAgentSideId(&tag.deviceId, REPORTED_GROUP, tag.propId, &value) == eecNoError &&
+            value.uint32Value == expected.uint32Value)
+        {
+            restored++;
+        }
+    }
+    printf("Replayed %d records in %ld us, %d restored\n", TST_LARGE_RECORDS, us, restored);
+    fflush(stdout);
+    TST_ASSERT_EQUAL(restored, TST_LARGE_RECORDS);
+}
+
+/**
+ * \name   LargeLog
+ * \brief  A log of about the size which is consolidated replays in full
+ */
+static void LargeLog(void)
+{
+    TST_UseNewStore();
+    TST_Boot("Write a large log", WriteLargeBoot);
+
+    FILE * file = fopen(TST_StorePath(TST_CURRENT_LOG), "rb");
+    if (!TST_ASSERT(file != NULL))
+    {
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    printf("Large log of %ld bytes in %d records\n", size, TST_LARGE_RECORDS);
+    TST_ASSERT((size >= TST_LARGE_MIN_SIZE) && (size < TST_LARGE_MAX_SIZE));
+
+    TST_Boot("Replay the large log", LoadLargeBoot);
+    TST_ASSERT(!Rebuilt());
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_UseNewStore();
+    TST_Boot("Write the log", WriteBoot);
+    ReadLog();
+
+    expectedRecords = TST_LOG_RECORDS;
+    TST_Boot("Load the log", LoadBoot);
+    TST_ASSERT(!Rebuilt());
+
+    TruncateAtEveryOffset();
+    FlipAtEveryOffset();
+    LegacyLog();
+
+    printf("Log of %u bytes in %d records\n", logSize, TST_LOG_RECORDS);
+
+    LargeLog();
+    return TST_Result();
+}
@@ -0,0 +1,271 @@
+/*!****************************************************************************
+ * \file    TST_WiSafeCrc.c
+ *
+ * \brief   Tests of the WiSafe radio message CRC against the bitwise routine
+ *          it replaced
+ *
+ * messages.c computes the CRC-16 of each radio message, polynomial 0x8005
+ * MSB first, with a table. It must give what the original bit at a time
+ * routine gave for every byte value and for messages of every length the
+ * radio sends, from the keyed initial values CRCInit() loads. The cost of
+ * both is printed in nanoseconds and, where the host has a time stamp
+ * counter, in cycles per byte.
+ *
+ * The radio, logic and SD comms state messages.c builds messages from is
+ * defined here, as each of their headers defines it for its own source.
+ *
+ * \Copyright (C) 2018 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define _LOGIC_C_
+#define _RADIO_C_
+#define _SDCOMMS_C_
+#include "wisafe_main.h"
+#include "logic.h"
+#include "radio.h"
+#include "SDcomms.h"
+#include "messages.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_POLY                0x8005
+
+// Longest radio message, JOIN_REQUEST_MESSAGE_LEN and RUMOR_MESSAGE_LEN
+#define TST_MAX_MESSAGE         21
+
+#define TST_MESSAGES            200000
+#define TST_TIMED_BYTES         (4 * 1000 * 1000)
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   BitwiseCrc
+ * \brief  The CRC a bit at a time, as CRCByte() computed it before the table
+ * \return crc updated with byte
+ */
+static uint16_t BitwiseCrc(uint16_t crc, uint8_t byte)
+{
+    for (uint8_t mask = 0x80; mask; mask >>= 1)
+    {
+        bool feedback = ((crc & 0x8000) != 0) != ((byte & mask) != 0);
+        crc <<= 1;
+        if (feedback)
+        {
+            crc ^= TST_POLY;
+        }
+    }
+    return crc;
+}
+
+/**
+ * \name   Keyed
+ * \brief  Load mesh keys which make CRCInit() start from initial
+ */
+static void Keyed(uint16_t initial)
+{
+    uint8_t keys[3] = { 0x01, initial >> 8, initial & 0xFF };
+    UpdateKeys(keys);
+    CRCInit();
+}
+
+/**
+ * \name   Lcg
+ * \return The next of a repeatable sequence, so as not to use the
+ *         radio's own generator
+ */
+static uint32_t Lcg(uint32_t * seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/**
+ * \name   CheckValue
+ * \brief  The standard check string gives the CRC-16/UMTS check value
+ */
+static void CheckValue(void)
+{
+    static const uint8_t check[] = "123456789";
+    Keyed(0);
+    CRCBlock(check, sizeof(check) - 1);
+    TST_ASSERT_EQUAL(GetCRC(), 0xFEE8);
+}
+
+/**
+ * \name   EveryByte
+ * \brief  Each byte value from each initial value gives what the bitwise
+ *         routine gives, a byte or a block at a time
+ */
+static void EveryByte(void)
+{
+    int mismatches = 0;
+    for (uint32_t initial = 0; initial <= 0xFFFF; initial += 0x0101)
+    {
+        for (int byte = 0; byte < 256; byte++)
+        {
+            uint8_t data = byte;
+            uint16_t expected = BitwiseCrc(initial, byte);
+            Keyed(initial);
+            CRCByte(byte);
+            mismatches += GetCRC() != expected;
+            Keyed(initial);
+            CRCBlock(&data, 1);
+            mismatches += GetCRC() != expected;
+        }
+    }
+    TST_ASSERT_EQUAL(mismatches, 0);
+}
+
+/**
+ * \name   Unkeyed
+ * \brief  Without mesh keys the CRC starts from the unkeyed value
+ */
+static void Unkeyed(void)
+{
+    uint8_t keys[3] = { NULL_MID, 0x12, 0x34 };
+    UpdateKeys(keys);
+    CRCInit();
+#if SCRAMBLED_WISAFE
+    TST_ASSERT_EQUAL(GetCRC(), 0x29);
+#else
+    TST_ASSERT_EQUAL(GetCRC(), 0);
+#endif
+}
+
+/**
+ * \name   Messages
+ * \brief  Random messages of every length the radio sends, from random
+ *         initial values, in one block or split in two
+ */
+static void Messages(void)
+{
+    uint8_t message[TST_MAX_MESSAGE];
+    uint32_t seed = 7;
+    int mismatches = 0;
+
+    for (int n = 0; n < TST_MESSAGES; n++)
+    {
+        uint16_t initial = Lcg(&seed);
+        uint8_t length = 1 + n % TST_MAX_MESSAGE;
+        uint8_t split = Lcg(&seed) % (length + 1);
+        uint16_t expected = initial;
+        for (int i = 0; i < length; i++)
+        {
+            message[i] = Lcg(&seed);
+            expected = BitwiseCrc(expected, message[i]);
+        }
+
+        Keyed(initial);
+        CRCBlock(message, length);
+        mismatches += GetCRC() != expected;
+
+        Keyed(initial);
+        CRCBlock(message, split);
+        CRCBlock(&message[split], length - split);
+        mismatches += GetCRC() != expected;
+    }
+    TST_ASSERT_EQUAL(mismatches, 0);
+}
+
+/**
+ * \name   Elapsed
+ * \return Nanoseconds since start
+ */
+static double Elapsed(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * \name   Cycles
+ * \return Time stamp counter, 0 where there is none
+ */
+static uint64_t Cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * \name   Measure
+ * \brief  Report the cost a byte of the table and of the bitwise routine,
+ *         over messages of the longest length
+ */
+static void Measure(void)
+{
+    static uint8_t data[TST_MAX_MESSAGE * 1024];
+    const int messages = TST_TIMED_BYTES / TST_MAX_MESSAGE;
+    struct timespec start;
+    uint32_t seed = 11;
+    uint16_t sum = 0;
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = Lcg(&seed);
+    }
+
+    // Loaded once, as on the radio, each message starts from them
+    Keyed(0x1234);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t cycles = Cycles();
+    for (int n = 0; n < messages; n++)
+    {
+        CRCInit();
+        CRCBlock(&data[(n % 1024) * TST_MAX_MESSAGE], TST_MAX_MESSAGE);
+        sum += GetCRC();
+    }
+    double tableCycles = (double)(Cycles() - cycles) / (messages * TST_MAX_MESSAGE);
+    double table = Elapsed(&start) / (messages * TST_MAX_MESSAGE);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cycles = Cycles();
+    for (int n = 0; n < messages; n++)
+    {
+        uint16_t crc = 0x1234;
+        const uint8_t * message = &data[(n % 1024) * TST_MAX_MESSAGE];
+        for (int i = 0; i < TST_MAX_MESSAGE; i++)
+        {
+            crc = BitwiseCrc(crc, message[i]);
+        }
+        sum += crc;
+    }
+    double bitwiseCycles = (double)(Cycles() - cycles) / (messages * TST_MAX_MESSAGE);
+    double bitwise = Elapsed(&start) / (messages * TST_MAX_MESSAGE);
+
+    printf("CRC-16 a byte: table %.2f ns, %.1f cycles; bitwise %.2f ns, %.1f cycles (%04x)\n",
+           table, tableCycles, bitwise, bitwiseCycles, sum);
+    fflush(stdout);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    TST_Boot("Check value", CheckValue);
+    TST_Boot("Every byte from every initial value", EveryByte);
+    TST_Boot("Unkeyed initial value", Unkeyed);
+    TST_Boot("Random messages", Messages);
+    TST_Boot("Cost a byte", Measure);
+    return TST_Result();
+}
@@ -0,0 +1,306 @@
+/*!****************************************************************************
+ * \file    TST_WiSafeSoak.c
+ *
+ * \brief   Soak of the local shadow with a full WiSafe network
+ *
+ * A device is registered through the WiSafe DAL for each of the 64 SIDs,
+ * with the properties discovery, the engine and the event handler give it,
+ * a fault and its subscriptions. Every device must then be enumerated,
+ * found by its SID and read back.
+ *
+ * The cost of a property lookup, a SID lookup, a reported property change
+ * and a fault report is reported for the full network.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "LOG_Api.h"
+#include "LSD_Api.h"
+#include "ECOM_Api.h"
+#include "ECOM_Messages.h"
+#include "APP_Types.h"
+#include "HostAgent.h"
+#include "WiSafe_DAL.h"
+#include "WiSafe_Faults.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_DEVICES             64          // One per SID
+#define TST_FIRST_ID            0x00a000
+#define TST_MODEL               41
+#define TST_FAULT               7
+#define TST_LOOKUPS             200000
+#define TST_NOTIFIES            20000
+#define TST_FAULT_REPORTS       2000
+#define TST_IDLE_MS             20000
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   WiSafeId
+ * \return WiSafe id of the device with SID sid
+ */
+static deviceId_t WiSafeId(int sid)
+{
+    return TST_FIRST_ID + sid * 0x111;
+}
+
+/**
+ * \name   SetUint
+ * \brief  Set a reported unsigned property of the device with SID sid
+ */
+static void SetUint(int sid, EnsoAgentSidePropertyId_t agentSideId, propertyName_t name, uint32_t value)
+{
+    EnsoPropertyValue_u newValue = { .uint32Value = value };
+    TST_ASSERT_EQUAL(WiSafe_DALSetReportedProperty(WiSafeId(sid), agentSideId, name, evUnsignedInt32, newValue),
+            eecNoError);
+}
+
+/**
+ * \name   SetString
+ * \brief  Set a reported string property of the device with SID sid
+ */
+static void SetString(int sid, EnsoAgentSidePropertyId_t agentSideId, propertyName_t name, const char * value)
+{
+    EnsoPropertyValue_u newValue;
+    memset(&newValue, 0, sizeof(newValue));
+    strncpy(newValue.stringValue, value, LSD_STRING_PROPERTY_MAX_LENGTH - 1);
+    TST_ASSERT_EQUAL(WiSafe_DALSetReportedProperty(WiSafeId(sid), agentSideId, name, evString, newValue),
+            eecNoError);
+}
+
+/**
+ * \name   RegisterDevice
+ * \brief  Register the device with SID sid as a WiSafe network would
+ */
+static void RegisterDevice(int sid)
+{
+    deviceId_t id = WiSafeId(sid);
+    EnsoPropertyValue_u valueF = { .booleanValue = false };
+    EnsoPropertyValue_u value0 = { .uint32Value = 0 };
+    char model[LSD_STRING_PROPERTY_MAX_LENGTH];
+
+    // Discovery
+    TST_ASSERT_EQUAL(WiSafe_DALRegisterDevice(id, DAL_PROPERTY_DEVICE_TYPE_WISAFE_MASK | TST_MODEL), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALSetReportedProperty(id, DAL_PROPERTY_DEVICE_FAULT_IDX, DAL_PROPERTY_DEVICE_FAULT,
+            evBoolean, valueF), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALCreateProperty(id, DAL_PROPERTY_DEVICE_MUTE_IDX, DAL_PROPERTY_DEVICE_MUTE,
+            evBoolean, valueF), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALSetReportedProperty(id, DAL_COMMAND_DEVICE_FLUSH_IDX, DAL_COMMAND_DEVICE_FLUSH,
+            evBoolean, valueF), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALSetReportedProperty(id, DAL_COMMAND_IDENTIFY_DEVICE_IDX, DAL_COMMAND_IDENTIFY_DEVICE,
+            evUnsignedInt32, value0), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALSubscribeToDesiredProperty(id, DAL_PROPERTY_DEVICE_MUTE_IDX), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALSubscribeToDesiredProperty(id, DAL_COMMAND_DEVICE_FLUSH_IDX), eecNoError);
+    TST_ASSERT_EQUAL(WiSafe_DALSubscribeToDesiredProperty(id, DAL_COMMAND_IDENTIFY_DEVICE_IDX), eecNoError);
+
+    snprintf(model, sizeof(model), "%u", TST_MODEL);
+    SetString(sid, PROP_MANUFACTURER_ID, (propertyName_t)PROP_MANUFACTURER_CLOUD_NAME, "Sprue");
+    SetUint(sid, DAL_PROPERTY_DEVICE_MODEL_IDX, DAL_PROPERTY_DEVICE_MODEL, TST_MODEL);
+    SetString(sid, PROP_MODEL_ID, (propertyName_t)PROP_MODEL_CLOUD_NAME, model);
+    SetUint(sid, PROP_ONLINE_ID, (propertyName_t)PROP_ONLINE_CLOUD_NAME, 1);
+    SetUint(sid, DAL_PROPERTY_DEVICE_SID_IDX, DAL_PROPERTY_DEVICE_SID, sid);
+    SetUint(sid, DAL_PROPERTY_DEVICE_TEST_TIMESTAMP_IDX, DAL_PROPERTY_DEVICE_TEST_TIMESTAMP, 1500000000 + sid);
+
+    // Remote status
+    SetUint(sid, DAL_PROPERTY_DEVICE_BATTERY_VOLTAGE_IDX, DAL_PROPERTY_DEVICE_BATTERY_VOLTAGE, 300 + sid);
+    SetUint(sid, DAL_PROPERTY_DEVICE_TEMPERATURE_IDX, DAL_PROPERTY_DEVICE_TEMPERATURE, 20);
+    SetUint(sid, DAL_PROPERTY_DEVICE_RADIO_RSSI_IDX, DAL_PROPERTY_DEVICE_RADIO_RSSI, 60);
+    SetUint(sid, DAL_PROPERTY_DEVICE_RADIO_FAULT_COUNT_IDX, DAL_PROPERTY_DEVICE_RADIO_FAULT_COUNT, 0);
+    SetUint(sid, DAL_PROPERTY_DEVICE_RM_SD_FAULT_IDX, DAL_PROPERTY_DEVICE_RM_SD_FAULT, 0);
+    SetUint(sid, DAL_PROPERTY_DEVICE_LAST_SEQUENCE_IDX, DAL_PROPERTY_DEVICE_LAST_SEQUENCE, sid);
+    SetUint(sid, DAL_PROPERTY_DEVICE_MISSING_IDX, DAL_PROPERTY_DEVICE_MISSING, 0);
+
+    // An alarm, as the event handler sends it
+    EnsoAgentSidePropertyId_t agentSideId[3] =
+    {
+        DAL_PROPERTY_DEVICE_ALARM_STATE_IDX, DAL_PROPERTY_DEVICE_ALARM_SEQ_IDX, DAL_PROPERTY_DEVICE_ALARM_TIME_IDX
+    };
+    propertyName_t cloudName[3] =
+    {
+        DAL_PROPERTY_DEVICE_ALARM_STATE, DAL_PROPERTY_DEVICE_ALARM_SEQ, DAL_PROPERTY_DEVICE_ALARM_TIME
+    };
+    EnsoValueType_e type[3] = { evUnsignedInt32, evUnsignedInt32, evTimestamp };
+    EnsoPropertyValue_u value[3];
+    value[0].uint32Value = 1;
+    value[1].uint32Value = 0;
+    value[2] = LSD_GetTimeNow();
+    TST_ASSERT_EQUAL(WiSafe_DALSetReportedProperties(id, agentSideId, cloudName, type, value, 3,
+            PROPERTY_PUBLIC, true, true), eecNoError);
+
+    // And a fault
+    TST_ASSERT_EQUAL(WiSafe_FaultsReport(id, TST_FAULT, true, true, 2900), eecNoError);
+}
+
+/**
+ * \name   CreateNetwork
+ * \brief  Start the shadow, the gateway and the WiSafe DAL, then register
+ *         every device
+ */
+static void CreateNetwork(void)
+{
+    LOG_Init();
+    LOG_EnableInfo(false);
+    LOG_EnableTrace(false);
+    TST_UseNewStore();
+    TST_ASSERT_EQUAL(HOST_InitialiseShadow(), eecNoError);
+
+    // The gateway is there before the WiSafe handler starts
+    TST_ASSERT(LSD_CreateEnsoObject(EnsoDeviceFromWiSafeID(GATEWAY_DEVICE_ID)) != NULL);
+    WiSafe_DALInit();
+    WiSafe_FaultsInit();
+
+    for (int sid = 0; sid < TST_DEVICES; sid++)
+    {
+        RegisterDevice(sid);
+    }
+}
+
+/**
+ * \name   FullNetwork
+ * \brief  Every device is enumerated, found by its SID and read back, and
+ *         its properties reach the cloud
+ */
+static void FullNetwork(void)
+{
+    CreateNetwork();
+
+    deviceId_t ids[TST_DEVICES + 1];
+    uint16_t numDevices = 0;
+    TST_ASSERT_EQUAL(WiSafe_DALDevicesEnumerate(ids, TST_DEVICES + 1, &numDevices), eecNoError);
+    TST_ASSERT_EQUAL(numDevices, TST_DEVICES);
+
+    for (int sid = 0; sid < TST_DEVICES; sid++)
+    {
+        deviceId_t id = 0;
+        EnsoErrorCode_e error;
+        TST_ASSERT(WiSafe_DALIsDeviceRegistered(WiSafeId(sid)));
+        if (TST_ASSERT(WiSafe_DALGetDeviceIdForSID(sid, &id)))
+        {
+            TST_ASSERT_EQUAL(id, WiSafeId(sid));
+        }
+
+        EnsoPropertyValue_u value = WiSafe_DALGetReportedProperty(WiSafeId(sid), DAL_PROPERTY_DEVICE_BATTERY_VOLTAGE_IDX, &error);
+        if (TST_ASSERT_EQUAL(error, eecNoError))
+        {
+            TST_ASSERT_EQUAL(value.uint32Value, 300 + sid);
+        }
+        value = WiSafe_DALGetReportedProperty(WiSafeId(sid), DAL_PROPERTY_DEVICE_FAULT_STATE_IDX + TST_FAULT, &error);
+        if (TST_ASSERT_EQUAL(error, eecNoError))
+        {
+            TST_ASSERT(value.booleanValue);
+        }
+        value = WiSafe_DALGetReportedProperty(WiSafeId(sid), DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX + TST_FAULT, &error);
+        if (TST_ASSERT_EQUAL(error, eecNoError))
+        {
+            TST_ASSERT_EQUAL(value.uint32Value, 290);
+        }
+    }
+
+    TST_ASSERT(HOST_WaitForIdle(TST_IDLE_MS));
+    TST_ASSERT(HOST_GetCloudMessages(ECOM_DELTA_MSG) >= TST_DEVICES);
+}
+
+/**
+ * \name   Elapsed
+ * \return Nanoseconds since start
+ */
+static double Elapsed(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * \name   MeasureNetwork
+ * \brief  Report the cost of lookups, notifies and fault reports with every
+ *         device registered
+ */
+static void MeasureNetwork(void)
+{
+    struct timespec start;
+    uint32_t sum = 0;
+    uint32_t seed = 1;
+    CreateNetwork();
+    TST_ASSERT(HOST_WaitForIdle(TST_IDLE_MS));
+
+    static const EnsoAgentSidePropertyId_t readings[] =
+    {
+        DAL_PROPERTY_DEVICE_BATTERY_VOLTAGE_IDX, DAL_PROPERTY_DEVICE_TEMPERATURE_IDX,
+        DAL_PROPERTY_DEVICE_RADIO_RSSI_IDX, DAL_PROPERTY_DEVICE_LAST_SEQUENCE_IDX,
+        DAL_PROPERTY_DEVICE_SID_IDX, DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX + TST_FAULT
+    };
+    const int numReadings = sizeof(readings) / sizeof(readings[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < TST_LOOKUPS; n++)
+    {
+        EnsoErrorCode_e error;
+        seed = seed * 1103515245 + 12345;
+        int sid = (seed >> 8) % TST_DEVICES;
+        int i = (seed >> 20) % numReadings;
+        sum += WiSafe_DALGetReportedProperty(WiSafeId(sid), readings[i], &error).uint32Value;
+    }
+    double lookup = Elapsed(&start) / TST_LOOKUPS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < TST_LOOKUPS; n++)
+    {
+        deviceId_t id = 0;
+        seed = seed * 1103515245 + 12345;
+        WiSafe_DALGetDeviceIdForSID((seed >> 8) % TST_DEVICES, &id);
+        sum += id;
+    }
+    double sidLookup = Elapsed(&start) / TST_LOOKUPS;
+
+    uint32_t deltasBefore = HOST_GetCloudMessages(ECOM_DELTA_MSG);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < TST_NOTIFIES; n++)
+    {
+        SetUint(n % TST_DEVICES, DAL_PROPERTY_DEVICE_TEMPERATURE_IDX, DAL_PROPERTY_DEVICE_TEMPERATURE, 21 + n);
+    }
+    double notify = Elapsed(&start) / TST_NOTIFIES;
+    TST_ASSERT(HOST_WaitForIdle(TST_IDLE_MS));
+    TST_ASSERT(HOST_GetCloudMessages(ECOM_DELTA_MSG) > deltasBefore);
+
+    // Cleared and raised again, saved together once the save window ends
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int n = 0; n < TST_FAULT_REPORTS; n++)
+    {
+        WiSafe_FaultsReport(WiSafeId(n % TST_DEVICES), TST_FAULT, (n / TST_DEVICES) & 1, true, 2900);
+    }
+    double fault = Elapsed(&start) / TST_FAULT_REPORTS;
+    TST_ASSERT(HOST_WaitForIdle(TST_IDLE_MS));
+
+    printf("%d WiSafe devices: %.0f ns a property lookup, %.0f ns a SID lookup, "
+           "%.0f ns a notify, %.0f ns a fault report (%08x)\n",
+           TST_DEVICES, lookup, sidLookup, notify, fault, sum);
+    fflush(stdout);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    // Room for a full object store, as on the gateway
+    setenv("OSAL_HEAP_SIZE", "16777216", 1);
+
+    TST_Boot("Full WiSafe network", FullNetwork);
+    TST_Boot("Latency, full WiSafe network", MeasureNetwork);
+    return TST_Result();
+}
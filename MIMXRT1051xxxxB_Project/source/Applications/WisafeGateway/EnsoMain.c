@@ -18,6 +18,8 @@
 #include "LOG_Api.h"
 #include "WiSafe_Main.h"
 #include "LSD_Api.h"
+#include "AWS_CommsHandler.h"
+#include "AWS_FaultBuffer.h"
 #include "wisafe_drv.h"
 
 // Create the AWS connection and start polling
@@ -86,6 +88,8 @@ int EnsoMain(int argc, char* argv[])
         LOG_Info(" q - Quit application");
         LOG_Info(" w - Send custom WiSafe message");
         LOG_Info(" d - Dump object store");
+        LOG_Info(" f - Dump AWS fault buffer statistics");
+        LOG_Info(" s - Dump AWS sequencer statistics");
 
         char buffer[256];
         if (!OSAL_fgets(buffer, sizeof buffer, stdin))
@@ -102,12 +106,18 @@ int EnsoMain(int argc, char* argv[])
         case 'e':
             LOG_EnableError(b);
             break;
+        case 'f':
+            AWS_DumpFaultBufferStats();
+            break;
         case 'i':
             LOG_EnableInfo(b);
             break;
         case 'q':
             keepLooping = false;
             break;
+        case 's':
+            AWS_DumpSequencerStats();
+            break;
         case 't':
             LOG_EnableTrace(b);
             break;
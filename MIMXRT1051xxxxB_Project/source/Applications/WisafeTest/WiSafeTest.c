@@ -23,6 +23,7 @@
 #include "WiSafe_Protocol.h"
 #include "WiSafe_DAL.h"
 #include "WiSafe_Settings.h"
+#include "WiSafe_RadioCommsBuffer.h"
 #include "LSD_Api.h"
 
 /*!****************************************************************************
@@ -36,6 +37,12 @@
 ////////#endif
 
 #define SID_MAP_BIT_COUNT 64 /* Number of bit positions in SID map. */
+
+#define STRESS_WORKERS          (10)    /* Threads driving buffer pool transactions. */
+#define STRESS_PER_WORKER       (10)    /* Transactions each worker keeps pending, 100 in all. */
+#define STRESS_ROUNDS           (5)     /* Times each worker fills and drains its transactions. */
+#define STRESS_GET_TIMEOUT_MS   (50)    /* Wait for a buffer before expiring a pending one. */
+#define STRESS_TIMEOUT_MS       (60000) /* Whole test. */
 static const EnsoPropertyValue_u valueTrue = { .booleanValue = true };
 static const EnsoPropertyValue_u valueFalse = { .booleanValue = false };
 static const EnsoPropertyValue_u value0 = { .uint32Value = 0 };
@@ -46,6 +53,8 @@ static const EnsoPropertyValue_u value1 = { .uint32Value = 1 };
  *****************************************************************************/
 static uint8_t simulatedSidMap[SID_MAP_BIT_COUNT / 8] = {0,};
 static const uint32_t timeForProcessing = WISAFETEST_TIME_FOR_PROCESSING; // How long in milliseconds to allow the WiSafe core engine to process messages.
+static volatile uint32_t stressWorkersDone = 0;
+static volatile uint32_t stressCorruptions = 0;
 
 /*!****************************************************************************
  * Private Functions
@@ -743,6 +752,139 @@ void TestFaultsAndAlarms(void)
     }
 }
 
+/**
+ * Check a pending transaction's buffer still holds what was written to it,
+ * then release it.
+ */
+static void StressRelease(radioCommsBuffer_t* buffer)
+{
+    uint8_t tag = buffer->data[1];
+    for (uint32_t i = 2; i < buffer->count; i++)
+    {
+        if (buffer->data[i] != tag)
+        {
+            __atomic_fetch_add(&stressCorruptions, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    WiSafe_RadioCommsBufferRelease(buffer);
+}
+
+/**
+ * Worker for TestBufferPoolStress(). Keeps up to STRESS_PER_WORKER alarm or
+ * fault transactions pending, each holding a radio buffer. When the pool is
+ * empty the oldest pending transaction expires, as pending alarms and
+ * faults do, and releases its buffer.
+ */
+static void StressWorker(Handle_t arg)
+{
+    uint32_t worker = (uint32_t)(uintptr_t)arg;
+    radioCommsBuffer_t* pending = NULL;
+    radioCommsBuffer_t* last = NULL;
+
+    for (uint32_t round = 0; round < STRESS_ROUNDS; round++)
+    {
+        uint32_t started = 0;
+        while (started < STRESS_PER_WORKER)
+        {
+            radioCommsBuffer_t* buffer = WiSafe_RadioCommsBufferGetTimeout(STRESS_GET_TIMEOUT_MS);
+            if (buffer == NULL)
+            {
+                if (pending != NULL)
+                {
+                    radioCommsBuffer_t* oldest = pending;
+                    pending = oldest->next;
+                    if (pending == NULL)
+                    {
+                        last = NULL;
+                    }
+                    StressRelease(oldest);
+                }
+                continue;
+            }
+
+            /* Alarm (0x50) or fault (0x71), tagged with the transaction number. */
+            uint8_t tag = (uint8_t)((worker * STRESS_PER_WORKER) + started);
+            buffer->data[0] = (started & 1) ? 0x71 : 0x50;
+            buffer->count = 9;
+            memset(&(buffer->data[1]), tag, buffer->count - 1);
+            buffer->next = NULL;
+            if (last != NULL)
+            {
+                last->next = buffer;
+            }
+            else
+            {
+                pending = buffer;
+            }
+            last = buffer;
+            started++;
+            OSAL_sleep_ms(1);
+        }
+
+        /* Complete everything still pending. */
+        while (pending != NULL)
+        {
+            radioCommsBuffer_t* next = pending->next;
+            StressRelease(pending);
+            pending = next;
+        }
+        last = NULL;
+    }
+
+    __atomic_fetch_add(&stressWorkersDone, 1, __ATOMIC_RELEASE);
+    for (;;)
+    {
+        OSAL_sleep_ms(1000);
+    }
+}
+
+/**
+ * \name   TestBufferPoolStress
+ * \brief  Drive 100 concurrent alarm/fault transactions through the radio buffer pool
+ */
+void TestBufferPoolStress(void)
+{
+    Thread_t workers[STRESS_WORKERS];
+    radioCommsBufferStats_t before;
+    radioCommsBufferStats_t after;
+
+    LOG_InfoC(LOG_GREEN "Testing buffer pool under load.");
+
+    WiSafe_RadioCommsBufferGetStats(&before);
+    stressWorkersDone = 0;
+    stressCorruptions = 0;
+
+    for (uint32_t i = 0; i < STRESS_WORKERS; i++)
+    {
+        workers[i] = OSAL_NewThread(StressWorker, (Handle_t)(uintptr_t)i);
+        CU_ASSERT_FATAL(workers[i] != NULL);
+    }
+
+    uint32_t waited = 0;
+    while ((__atomic_load_n(&stressWorkersDone, __ATOMIC_ACQUIRE) < STRESS_WORKERS) && (waited < STRESS_TIMEOUT_MS))
+    {
+        OSAL_sleep_ms(100);
+        waited += 100;
+    }
+
+    for (uint32_t i = 0; i < STRESS_WORKERS; i++)
+    {
+        OSAL_KillThread(workers[i]);
+    }
+
+    WiSafe_RadioCommsBufferGetStats(&after);
+    LOG_Info("Pool: %d buffers, high water %d, %d allocations, %d waits, %d failures",
+             after.size, after.highWater, after.allocations - before.allocations,
+             after.waits - before.waits, after.failures - before.failures);
+
+    CU_ASSERT(stressWorkersDone == STRESS_WORKERS);
+    CU_ASSERT(stressCorruptions == 0);
+    CU_ASSERT(after.inUse == before.inUse);
+    CU_ASSERT(after.highWater <= after.size);
+    CU_ASSERT((after.allocations - before.allocations) == (STRESS_WORKERS * STRESS_PER_WORKER * STRESS_ROUNDS));
+}
+
 /* The main() function for setting up and running the tests.
  * Returns a CUE_SUCCESS on successful running, another
  * CUnit error code on failure.
@@ -808,6 +950,12 @@ int EnsoMain(int argc, char* argv[])
        return CU_get_error();
    }
 
+   if (NULL == CU_add_test(pSuite, "WiSafe Buffer Pool Stress", TestBufferPoolStress))
+   {
+       CU_cleanup_registry();
+       return CU_get_error();
+   }
+
    /* Run all tests using the CUnit Basic interface */
    CU_basic_set_mode(CU_BRM_VERBOSE);
    CU_basic_run_tests();
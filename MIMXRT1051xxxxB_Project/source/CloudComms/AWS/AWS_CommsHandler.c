@@ -14,6 +14,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_AWS
+
 #include <string.h>
 #include <signal.h>
 #include <sys/time.h>
@@ -37,6 +39,7 @@
 #include "AWS_CommsHandler.h"
 #include "AWS_FaultBuffer.h"
 #include "AWS_Timestamps.h"
+#include "AWS_JsonWriter.h"
 #include "ECOM_Api.h"
 #include "ECOM_Messages.h"
 #include "EnsoConfig.h"
@@ -51,6 +54,10 @@
 
 #define AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER (1000)
 
+// Objects open in an update document: root, "state", group, nested parent
+#define AWS_UPDATE_DEPTH_ROOT               1
+#define AWS_UPDATE_DEPTH_GROUP              3
+
 #define AWS_MAX_LENGTH_OF_LAST_WILL_MESSAGE    80
 
 /* Sequencer Queue Size */
@@ -59,6 +66,15 @@
 /* Maximum allowedPoll Request count in Queue. */
 #define AWS_SEQ_QUEUE_MAX_POLL_COUNT        (AWS_SEQ_QUEUE_CAPACITY / 5)
 
+/*
+ * Higher priority items served in a row while lower priority items wait,
+ * the next one served is then taken from the lower priority queue.
+ */
+#define AWS_SEQ_MAX_PRIORITY_BURST          (8)
+
+/* Longest time the idle sequencer sleeps before checking its queues again */
+#define AWS_SEQ_IDLE_WAIT_MS                (60000)
+
 #define AWS_CONNECTION_INITIAL_CONNECT_TIMEOUT        1        // Timeout for initial(immediate) connect
 #define AWS_CONNECTION_MIN_RECONNECT_WAIT_INTERVAL_MS 1000     // Minimum time before the First reconnect attempt is made as part of the exponential back-off algorithm
 #define AWS_CONNECTION_MAX_RECONNECT_WAIT_INTERVAL_MS 32000    // Minimum time before the First reconnect attempt is made as part of the exponential back-off algorithm
@@ -109,6 +125,7 @@ typedef struct
 //    ShadowInitParameters_t shadowParameters;
   //  AWS_IoT_Client mqttClient;
     char jsonDocumentBuffer[AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER];
+    AWS_JsonWriter_t jsonWriter;
     uint16_t numJsonEntriesInBuffer;
 
     /* Channel (MQTT Connection) Specific Thing Name. */
@@ -167,7 +184,8 @@ typedef enum
     /* Connect channel */
     SeqItem_Connect,
     /*Disconnect channel */
-    SeqItem_Disconnect
+    SeqItem_Disconnect,
+    SeqItem_Count
 } SeqItemType;
 
 /*
@@ -208,6 +226,7 @@ typedef struct
 {
     SeqItemType type;
     SeqItemArgs args;
+    uint32_t queuedMs;  /* OSAL_time_ms() when queued */
 } SeqQueueItem;
 
 /*
@@ -251,6 +270,9 @@ static Mutex_t _timerMutex;
 static Mutex_t _deleteMutex;
 static Mutex_t _seqMutex;
 
+/* Counts the items in the sequencer queues, the sequencer sleeps on it */
+static Semaphore_t _seqSemaphore;
+
 static Semaphore_t _outOfSyncSemaphore;
 
 static char _gatewayThingName[ENSO_OBJECT_NAME_BUFFER_SIZE];
@@ -345,6 +367,17 @@ static SeqCircularQueue _awsSeqQueues[SeqItemPri_Count];
 /* Counter to keep Poll Request count in AWS Sequencer */
 int _awsSeqWaitingPollCount = 0;
 
+/* Items served in a row while a lower priority queue was waiting */
+static uint32_t _awsSeqPriorityBurst = 0;
+
+/* Sequencer statistics, protected by _seqMutex */
+static AWS_SequencerStats_t _awsSeqStats;
+
+static const char* const _awsSeqItemNames[SeqItem_Count] =
+{
+    "Poll", "Delta", "Subscribe", "Connect", "Disconnect"
+};
+
 /*!****************************************************************************
  * Private Function Prototypes
  *****************************************************************************/
@@ -788,6 +821,7 @@ static bool _AWS_QueueSeqItem(SeqQueueItem item, SeqItemPriority priority)
     /* Queue new item */
     if (queue->count < AWS_SEQ_QUEUE_CAPACITY)
     {
+        item.queuedMs = OSAL_time_ms();
         queue->circularBuffer[queue->head] = item;
 
         queue->head = (queue->head + 1) % AWS_SEQ_QUEUE_CAPACITY;
@@ -795,17 +829,71 @@ static bool _AWS_QueueSeqItem(SeqQueueItem item, SeqItemPriority priority)
 
         retVal = true;
     }
+    else
+    {
+        if (item.type == SeqItem_Poll)
+        {
+            _awsSeqWaitingPollCount--;
+        }
+        _awsSeqStats.dropped++;
+    }
 
     OSAL_UnLockMutex(&_seqMutex);
 
+    if (retVal)
+    {
+        /* Wake the sequencer */
+        OSAL_GiveCountingSemaphore(&_seqSemaphore);
+    }
+
     return retVal;
 }
 
+/**
+ * \name _AWS_RecordSeqLatency
+ *
+ * \brief Add the time an item waited in the queue to its histogram
+ *
+ * Must be called with _seqMutex held.
+ *
+ * \param  item the item about to be served
+ */
+static void _AWS_RecordSeqLatency(const SeqQueueItem* item)
+{
+    if (item->type >= SeqItem_Count)
+    {
+        return;
+    }
+
+    AWS_SeqItemStats_t* stats = &_awsSeqStats.item[item->type];
+    uint32_t waitMs = OSAL_time_ms() - item->queuedMs;
+
+    /* Bucket i counts waits shorter than 4^i ms */
+    int bucket = 0;
+    uint32_t limitMs = 1;
+    while ((bucket < AWS_SEQ_LATENCY_BUCKETS - 1) && (waitMs >= limitMs))
+    {
+        bucket++;
+        limitMs <<= 2;
+    }
+
+    stats->latency[bucket]++;
+    stats->served++;
+    if (waitMs > stats->maxLatencyMs)
+    {
+        stats->maxLatencyMs = waitMs;
+    }
+}
+
 /**
  * \name _AWS_EnqueueSeqItem
  *
  * \brief Enqueues item from AWS Sequencer Queue
  *
+ * Items are served highest priority first. After AWS_SEQ_MAX_PRIORITY_BURST
+ * items have been served in a row while a lower priority queue was waiting,
+ * one item is taken from that queue so it cannot starve.
+ *
  * \param[out] enqueued item
  *
  * \return true if able to enqueue new item from sequencer queue otherwise returns false
@@ -817,22 +905,42 @@ static bool _AWS_EnqueueSeqItem(SeqQueueItem* item)
     OSAL_LockMutex(&_seqMutex);
 
     /* Start from high priority queues to low priority */
-    for (int qIndex = 0; qIndex < SeqItemPri_Count; qIndex++)
+    int qIndex = 0;
+    while ((qIndex < SeqItemPri_Count) && (_awsSeqQueues[qIndex].count == 0))
     {
-        SeqCircularQueue* queue = &_awsSeqQueues[qIndex];
+        qIndex++;
+    }
 
-        /* Test queue */
-        if (queue->count > 0)
+    if (qIndex < SeqItemPri_Count)
+    {
+        /* Is anything of lower priority waiting behind it? */
+        int waiting = qIndex + 1;
+        while ((waiting < SeqItemPri_Count) && (_awsSeqQueues[waiting].count == 0))
         {
-            *item = queue->circularBuffer[queue->tail];
+            waiting++;
+        }
+
+        if (waiting >= SeqItemPri_Count)
+        {
+            _awsSeqPriorityBurst = 0;
+        }
+        else if (++_awsSeqPriorityBurst > AWS_SEQ_MAX_PRIORITY_BURST)
+        {
+            qIndex = waiting;
+            _awsSeqPriorityBurst = 0;
+            _awsSeqStats.promoted++;
+        }
 
-            queue->tail = (queue->tail + 1) % AWS_SEQ_QUEUE_CAPACITY;
-            queue->count--;
+        SeqCircularQueue* queue = &_awsSeqQueues[qIndex];
 
-            retVal = true;
+        *item = queue->circularBuffer[queue->tail];
 
-            break;
-        }
+        queue->tail = (queue->tail + 1) % AWS_SEQ_QUEUE_CAPACITY;
+        queue->count--;
+
+        _AWS_RecordSeqLatency(item);
+
+        retVal = true;
     }
 
     OSAL_UnLockMutex(&_seqMutex);
@@ -921,6 +1029,12 @@ static void _AWS_Sequencer(void* args)
 item.args.Poll.channelID = 0;
     while (1)
     {
+        /* Sleep until an item is queued, the semaphore counts them */
+        if (OSAL_TakeCountingSemaphore(&_seqSemaphore, AWS_SEQ_IDLE_WAIT_MS) != 0)
+        {
+            continue;
+        }
+
         /* Enqueue an item from AWS Sequencer Queue  */
         bool bExist = _AWS_EnqueueSeqItem(&item);
 
@@ -974,11 +1088,6 @@ item.args.Poll.channelID = 0;
                     break;
             }
         }
-        else
-        {
-            /* Sleep to reduce CPU utilisation if queue is empty */
-            OSAL_sleep_ms(100);
-        }
     }
 }
 
@@ -1202,6 +1311,42 @@ void _AWS_CheckForUnsubscriptions(bool* finished)
     }
 }
 
+/**
+ * \name AWS_GetSequencerStats
+ *
+ * \brief Copy the sequencer queue statistics
+ *
+ * \param[out] stats  Receives the statistics
+ */
+void AWS_GetSequencerStats(AWS_SequencerStats_t* stats)
+{
+    OSAL_LockMutex(&_seqMutex);
+    *stats = _awsSeqStats;
+    OSAL_UnLockMutex(&_seqMutex);
+}
+
+/**
+ * \name AWS_DumpSequencerStats
+ *
+ * \brief Log the sequencer queue statistics and latency histograms
+ */
+void AWS_DumpSequencerStats(void)
+{
+    AWS_SequencerStats_t stats;
+    AWS_GetSequencerStats(&stats);
+
+    LOG_Info("Sequencer: %u dropped, %u served out of priority order",
+            stats.dropped, stats.promoted);
+    LOG_Info("Wait (ms)   <1    <4   <16   <64  <256   <1k   <4k  more   max");
+    for (int type = 0; type < SeqItem_Count; type++)
+    {
+        const uint32_t* l = stats.item[type].latency;
+        LOG_Info("%-10s %5u %5u %5u %5u %5u %5u %5u %5u %5u", _awsSeqItemNames[type],
+                l[0], l[1], l[2], l[3], l[4], l[5], l[6], l[7],
+                stats.item[type].maxLatencyMs);
+    }
+}
+
 /**
  * Indicate whether we are catching up with comms
  *
@@ -1636,6 +1781,12 @@ EnsoErrorCode_e AWS_Initialise(char * rootCA, char * certs, char * key)
     OSAL_InitMutex(&_timerMutex, NULL);
     OSAL_InitMutex(&_deleteMutex, NULL);
     OSAL_InitMutex(&_seqMutex, NULL);
+    if (OSAL_InitCountingSemaphore(&_seqSemaphore, SeqItemPri_Count * AWS_SEQ_QUEUE_CAPACITY, 0) != 0)
+    {
+        LOG_Error("OSAL_InitCountingSemaphore failed for AWS Comms Sequencer");
+        return eecInternalError;
+    }
+    assert(SeqItem_Count == AWS_SEQ_ITEM_TYPES);
     EnsoErrorCode_e retVal;
     min_ms_between_deltas = atoi(getenvDefault("MIN_MS_BETWEEN_DELTAS", "25"));
     aws_polling_interval_in_ms = atoi(getenvDefault("AWS_POLLING_INTERVAL_IN_MS", "400"));
@@ -2006,40 +2157,38 @@ EnsoErrorCode_e AWS_CommsChannelDeltaStart(CLD_CommsChannel_t* commsChannel, con
     }
 
     AWS_CLD_CommsChannel_t* channel = (AWS_CLD_CommsChannel_t*) commsChannel;
+    AWS_JsonWriter_t* writer = &channel->jsonWriter;
     channel->numJsonEntriesInBuffer = 0;
 
-    EnsoErrorCode_e retVal = eecNoError;
-    //IoT_Error_t rc = aws_iot_shadow_init_json_document(channel->jsonDocumentBuffer, AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-    if ( 1)
+    const char* groupName = NULL;
+    switch (propertyGroup)
     {
-        retVal = eecLocalShadowDocumentFailedToInitialise;
-    }
+        case DESIRED_GROUP:
+            groupName = "desired";
+            break;
 
-    int bufferOffset = strlen(channel->jsonDocumentBuffer);
-    int bufferRemaining = AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER - bufferOffset;
+        case REPORTED_GROUP:
+            groupName = "reported";
+            break;
+        default:
+            assert(0);
+            return eecConversionFailed;
+    }
 
-    if (eecNoError == retVal && bufferRemaining > 1)
+    /* {"state":{"<group>":{ */
+    AWS_JsonInit(writer, channel->jsonDocumentBuffer, sizeof channel->jsonDocumentBuffer);
+    EnsoErrorCode_e retVal = AWS_JsonOpenObject(writer, NULL);
+    if (eecNoError == retVal)
     {
-        int snprintfReturn = -1;
-        switch (propertyGroup)
-        {
-            case DESIRED_GROUP:
-                snprintfReturn = snprintf(channel->jsonDocumentBuffer + bufferOffset, bufferRemaining, "\"desired\":{");
-                break;
-
-            case REPORTED_GROUP:
-                snprintfReturn = snprintf(channel->jsonDocumentBuffer + bufferOffset, bufferRemaining, "\"reported\":{");
-                break;
-            default:
-                assert(0);
-                break;
-        }
-
-        if (snprintfReturn <= 0)
-        {
-            retVal = eecConversionFailed;
-            LOG_Error("snprintf returned %d", snprintfReturn)
-        }
+        retVal = AWS_JsonOpenObject(writer, "state");
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonOpenObject(writer, groupName);
+    }
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Failed to start delta document %d", retVal);
     }
 
     return retVal;
@@ -2097,105 +2246,57 @@ EnsoErrorCode_e AWS_CommsChannelDeltaAddProperty(CLD_CommsChannel_t* commsChanne
         return eecNullPointerSupplied;
     }
 
-    int bufferOffset = strlen(channel->jsonDocumentBuffer);
-    int bufferRemaining = AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER - bufferOffset;
+    AWS_JsonWriter_t* writer = &channel->jsonWriter;
 
     /* Check if property is a string (memory blob) which is too large to be converted
-     * to a JSON due to the limitation of AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER (400 bytes)
+     * to a JSON due to the limitation of AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER
      */
     if ((REPORTED_GROUP == group) &&
         (evBlobHandle == property->type.valueType) &&
         property->reportedValue.memoryHandle &&
-        (strlen((char*)property->reportedValue.memoryHandle) > bufferRemaining)
+        (strlen((char*)property->reportedValue.memoryHandle) > AWS_JsonRemaining(writer))
        )
     {
         LOG_Warning("Property %s too large to be converted to JSON for AWS delta buffer", property->cloudName);
         return eecBufferTooSmall;
     }
 
-    EnsoErrorCode_e retVal = eecNoError;
-    if (bufferRemaining > 1)
-    {
-        // Check if this is the first property in the delta
-        if (channel->numJsonEntriesInBuffer)
-        {
-            channel->jsonDocumentBuffer[bufferOffset++] = ',';
-            channel->jsonDocumentBuffer[bufferOffset] = '\0';
-            bufferRemaining--;
-        }
+    char parentName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    char childName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    bool nestedProperty = LSD_IsPropertyNested(property->cloudName, parentName, childName);
 
-        // Write the key part of the key-value pair
-        char parentName[LSD_PROPERTY_NAME_BUFFER_SIZE];
-        char childName[LSD_PROPERTY_NAME_BUFFER_SIZE];
-        bool nestedProperty = LSD_IsPropertyNested(property->cloudName, parentName, childName);
+    // Undo the whole property if any part of it does not fit
+    AWS_JsonMark_t mark;
+    AWS_JsonMark(writer, &mark);
 
-        int snprintfReturn;
-        if (nestedProperty && firstNestedProperty)
-        {
-            // Only for the first nested property do we create group name using parent
-            snprintfReturn = snprintf(channel->jsonDocumentBuffer + bufferOffset,
-                    bufferRemaining, "\"%s\":{\"%s\":", parentName, childName);
-        }
-        else if (nestedProperty && !firstNestedProperty)
-        {
-            // We know we have already added the first nested property in group,
-            // so we are safe to remove previously closing characters which are '},'
-            bufferOffset -= 2;
-            bufferRemaining += 2;
-            snprintfReturn = snprintf(channel->jsonDocumentBuffer + bufferOffset,
-                    bufferRemaining, ",\"%s\":", childName);
-        }
-        else
-        {
-            snprintfReturn = snprintf(channel->jsonDocumentBuffer + bufferOffset,
-                    bufferRemaining, "\"%s\":", property->cloudName);
-        }
+    // A nested group stays open until a property outside it is added
+    EnsoErrorCode_e retVal = eecNoError;
+    if (!nestedProperty || firstNestedProperty)
+    {
+        retVal = AWS_JsonCloseTo(writer, AWS_UPDATE_DEPTH_GROUP);
+    }
+    if ((eecNoError == retVal) && nestedProperty && firstNestedProperty)
+    {
+        retVal = AWS_JsonOpenObject(writer, parentName);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonAddKey(writer, nestedProperty ? childName : property->cloudName);
+    }
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonAddValue(writer,
+                (group == REPORTED_GROUP) ? property->reportedValue : property->desiredValue,
+                property->type.valueType);
+    }
 
-        if (snprintfReturn < 0)
-        {
-            retVal = eecConversionFailed;
-            LOG_Error("snprintf returned %d", snprintfReturn);
-        }
-        else if (snprintfReturn > bufferRemaining)
-        {
-            retVal = eecBufferTooSmall;
-        }
-        else
-        {
-            // Write the value part of the key-value pair
-            if (retVal == eecNoError)
-            {
-                int bytesUsed = 0;
-                bufferOffset += snprintfReturn;
-                bufferRemaining = AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER - bufferOffset;
-                bufferOffset = strlen(channel->jsonDocumentBuffer);
-
-                channel->numJsonEntriesInBuffer++;
-                retVal = LSD_ConvertTypedDataToJsonValue(
-                        channel->jsonDocumentBuffer + bufferOffset,
-                        bufferRemaining,
-                        &bytesUsed,
-                        (group == REPORTED_GROUP) ? property->reportedValue : property->desiredValue,
-                        property->type.valueType);
-
-                bufferOffset += snprintfReturn;
-                bufferRemaining = AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER - bufferOffset;
-                bufferOffset = strlen(channel->jsonDocumentBuffer);
-
-                if (nestedProperty)
-                {
-                    snprintf(channel->jsonDocumentBuffer + bufferOffset, bufferRemaining, "}");
-                }
-            }
-            else
-            {
-                retVal = eecConversionFailed;
-            }
-        }
+    if (eecNoError == retVal)
+    {
+        channel->numJsonEntriesInBuffer++;
     }
     else
     {
-        retVal = eecBufferTooSmall;
+        AWS_JsonRewind(writer, &mark);
     }
 
     return retVal;
@@ -2235,22 +2336,26 @@ EnsoErrorCode_e AWS_CommsChannelDeltaSend(CLD_CommsChannel_t* commsChannel, cons
     }
     lasttime = now;
     AWS_CLD_CommsChannel_t* channel = (AWS_CLD_CommsChannel_t* ) commsChannel;
+    AWS_JsonWriter_t* writer = &channel->jsonWriter;
     char * buffer = channel->jsonDocumentBuffer;
-    int bufferOffset = strlen(buffer);
-    int bufferRemaining = AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER - bufferOffset;
-    /* Need to close the delta with "}," */
-    if (bufferRemaining < 3)
+
+    /* Close the group and "state", then identify the update as the SDK does */
+    static uint32_t clientTokenCount = 0;
+    char clientToken[MQTT_CLIENT_NAME_BUFFER_SIZE + 12];
+    snprintf(clientToken, sizeof clientToken, "%s-%lu", channel->clientName, (unsigned long)clientTokenCount++);
+
+    EnsoErrorCode_e retVal = AWS_JsonCloseTo(writer, AWS_UPDATE_DEPTH_ROOT);
+    if (eecNoError == retVal)
     {
-       return eecBufferTooSmall;
+        retVal = AWS_JsonAddString(writer, "clientToken", clientToken);
     }
-    snprintf(buffer + bufferOffset, bufferRemaining, "}," );
-    EnsoErrorCode_e retVal = eecNoError;
-    //IoT_Error_t rc;
-  //  rc = aws_iot_finalize_json_document(buffer, AWS_MAX_LENGTH_OF_UPDATE_JSON_BUFFER);
-    if (1 )
+    if (eecNoError == retVal)
+    {
+        retVal = AWS_JsonCloseObject(writer);
+    }
+    if (eecNoError != retVal)
     {
-       // LOG_Error("aws_iot_shadow_finalize_json_document %s", _AWS_Strerror(rc));
-        retVal = eecLocalShadowDocumentFailedToInitialise;
+        LOG_Error("Failed to finalise delta document %d", retVal);
     }
     else
     {
@@ -2258,7 +2363,7 @@ EnsoErrorCode_e AWS_CommsChannelDeltaSend(CLD_CommsChannel_t* commsChannel, cons
         int bufferUsed;
         retVal = LSD_GetThingName(name, sizeof name, &bufferUsed, deviceId, _gatewayId);
         assert(eecNoError == retVal);
-        LOG_Info("--> %d:%s", strlen(buffer), buffer);
+        LOG_Info("--> %d:%s", AWS_JsonLength(writer), buffer);
         OSAL_LockMutex(&_commsMutex);
         _bUpdateInProgress = true;
        // rc = aws_iot_shadow_update(&channel->mqttClient, name, buffer, _AWS_CommsChannelCallback, context, 1, false);
@@ -2266,7 +2371,7 @@ EnsoErrorCode_e AWS_CommsChannelDeltaSend(CLD_CommsChannel_t* commsChannel, cons
         OSAL_UnLockMutex(&_commsMutex);
         if (1)
         {
-            AWS_SendFailedForFaultBuffer(); // Won't get the callback
+            AWS_MessageFailedForFaultBuffer(context); // Won't get the callback
             retVal = eecLocalShadowDocumentFailedToSendDelta;
        //     LOG_Error("aws_iot_shadow_update %s", _AWS_Strerror(rc));
         }
@@ -2605,7 +2710,7 @@ static void _AWS_CommsChannelCallback(
     if (status == SHADOW_ACK_TIMEOUT)
     {
         LOG_Error("Update Timeout thing=%s doc=%s", pThingName, pReceivedJsonDocument);
-        AWS_SendFailedForFaultBuffer();
+        AWS_MessageFailedForFaultBuffer(pContextData);
 
         /* Idea here is that the timeout takes around 20s, this rates our retries
          * so we don't spin here very quickly, but we do keep trying over and over
@@ -2619,7 +2724,7 @@ static void _AWS_CommsChannelCallback(
     else if (status == SHADOW_ACK_REJECTED)
     {
         LOG_Error("Update Rejected thing=%s doc=%s", pThingName, pReceivedJsonDocument);
-        AWS_SendFailedForFaultBuffer();
+        AWS_MessageFailedForFaultBuffer(pContextData);
     }
     else if (status == SHADOW_ACK_ACCEPTED)
     {
@@ -3018,12 +3123,16 @@ static void _AWS_MessageQueueListener(MessageQueue_t mq)
                 else
                 {
                     ECOM_DeltaMessage_t* pDeltaMessage = (ECOM_DeltaMessage_t*)buffer;
+                    EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+                    uint16_t numProperties;
+                    const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(pDeltaMessage, scratch, &numProperties);
                     AWS_FaultBuffer(
                             pDeltaMessage->destinationId,
                             pDeltaMessage->deviceId,
                             pDeltaMessage->propertyGroup,
-                            pDeltaMessage->numProperties,
-                            pDeltaMessage->deltasBuffer);
+                            numProperties,
+                            deltas);
+                    ECOM_ReleaseDeltaMessage(pDeltaMessage);
                 }
                 break;
 
@@ -3134,7 +3243,14 @@ EnsoErrorCode_e AWS_OnCommsHandler(
     // Do all unnested properties first
     for (int i = 0; (eecNoError == retVal) && (i < numProperties); i++)
     {
+        EnsoProperty_t externalProperty;
         EnsoProperty_t* changedProperty = LSD_GetPropertyByAgentSideId( &deviceId, deltasBuffer[i].agentSidePropertyID);
+        if (!changedProperty &&
+            eecNoError == LSD_GetExternalProperty(&deviceId, deltasBuffer[i].agentSidePropertyID, &externalProperty))
+        {
+            // Kept outside the property pool by its device handler
+            changedProperty = &externalProperty;
+        }
         if (changedProperty)
         {
             char parentName[LSD_PROPERTY_NAME_BUFFER_SIZE];
@@ -3175,7 +3291,13 @@ EnsoErrorCode_e AWS_OnCommsHandler(
     // Do nested properties second
     for (int i = 0; (eecNoError == retVal) && (i < numProperties); i++)
     {
+        EnsoProperty_t externalParent;
         EnsoProperty_t* parentProperty = LSD_GetPropertyByAgentSideId(&deviceId, deltasBuffer[i].agentSidePropertyID);
+        if (!parentProperty &&
+            eecNoError == LSD_GetExternalProperty(&deviceId, deltasBuffer[i].agentSidePropertyID, &externalParent))
+        {
+            parentProperty = &externalParent;
+        }
 
         if (parentProperty)
         {
@@ -3218,7 +3340,13 @@ EnsoErrorCode_e AWS_OnCommsHandler(
                 // Loop through all properties and add all that have same parent in one go
                 for (int j = i; (eecNoError == retVal) && (j < numProperties); j++)
                 {
+                    EnsoProperty_t externalProperty;
                     EnsoProperty_t* changedProperty = LSD_GetPropertyByAgentSideId(&deviceId, deltasBuffer[j].agentSidePropertyID);
+                    if (!changedProperty &&
+                        eecNoError == LSD_GetExternalProperty(&deviceId, deltasBuffer[j].agentSidePropertyID, &externalProperty))
+                    {
+                        changedProperty = &externalProperty;
+                    }
                     if (changedProperty)
                     {
                         char parentNameJ[LSD_PROPERTY_NAME_BUFFER_SIZE];
@@ -3902,8 +4030,10 @@ void _AWS_AnnounceAccept(
 
         /*
          * Initial properties of an accepted device are market as out-of-sync
-         * so we need to sync them with cloud
+         * so we need to sync them with cloud, along with those its device
+         * handler keeps outside the property pool
          */
+        LSD_SetExternalPropertiesOutOfSync(&deviceId);
         AWS_StartOutOfSyncTimer();
     }
 }
@@ -4671,7 +4801,7 @@ EnsoErrorCode_e _AWS_VerifyPropertyValue(
     if (retVal == eecNoError)
     {
         // We are in sync, update the property
-        property->type.reportedOutOfSync = false;
+        LSD_SetPropertyOutOfSyncState(&theDevice, propName, REPORTED_GROUP, false);
 
         if (property->type.persistent)
         {
@@ -41,6 +41,31 @@
 
 #define MAX_SUBSCRIPTION_PER_GATEWAY        (MAX_CONNECTION_PER_GATEWAY * MAX_SUBSCRIPTION_PER_MQTT_CHANNEL)
 
+/* Kinds of request served by the sequencer: poll, delta, subscribe, connect, disconnect */
+#define AWS_SEQ_ITEM_TYPES                  5
+
+/* Latency histogram buckets, bucket i counts waits shorter than 4^i ms */
+#define AWS_SEQ_LATENCY_BUCKETS             8
+
+
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint32_t served;
+    uint32_t maxLatencyMs;
+    uint32_t latency[AWS_SEQ_LATENCY_BUCKETS];  // Time from queued to served
+} AWS_SeqItemStats_t;
+
+typedef struct
+{
+    AWS_SeqItemStats_t item[AWS_SEQ_ITEM_TYPES];
+    uint32_t dropped;       // Items refused because their queue was full
+    uint32_t promoted;      // Lower priority items served to avoid starvation
+} AWS_SequencerStats_t;
+
 
 
 /******************************************************************************
@@ -60,6 +85,10 @@ bool AWS_OutOfSyncTimerEnabled();
 
 void AWS_StartOutOfSyncTimer(void);
 
+void AWS_GetSequencerStats(AWS_SequencerStats_t* stats);
+
+void AWS_DumpSequencerStats(void);
+
 EnsoErrorCode_e AWS_CommsChannelOpen(CLD_CommsChannel_t* commsChannel, EnsoDeviceId_t* gatewayId);
 
 EnsoErrorCode_e AWS_CommsChannelDeltaStart( CLD_CommsChannel_t* commsChannel, const PropertyGroup_e propertyGroup);
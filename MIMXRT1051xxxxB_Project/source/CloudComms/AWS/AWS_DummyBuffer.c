@@ -12,6 +12,8 @@
 *
 *****************************************************************************/
 
+#include <string.h>
+
 #include "AWS_CommsHandler.h"
 #include "AWS_FaultBuffer.h"
 
@@ -89,17 +91,27 @@ EnsoErrorCode_e AWS_FaultBuffer(
 /*
  * \brief  Fault buffer made it to the cloud successfully
  *
- * \param  ptr     Pointer to the buffer that contains the fault
+ * \param  ptr     Context the buffer that contains the fault was sent with
  */
 void AWS_FinishedWithFaultBuffer(void* ptr)
 {
 }
 
 
+/*
+ * \brief  One fault buffer did not make it to the cloud successfully
+ *
+ * \param  ptr     Context the buffer that contains the fault was sent with
+ */
+void AWS_MessageFailedForFaultBuffer(void* ptr)
+{
+}
+
+
 /*
  * \brief  Fault buffer did not make it to the cloud successfully
  *
- * \param  ptr     Pointer to the buffer that contains the fault
+ * \param  ptr     Context the buffer that contains the fault was sent with
  */
 void AWS_SendFailedForFaultBuffer(void)
 {
@@ -143,3 +155,16 @@ void AWS_ForceBackoffDuringDiscovery(void)
 void AWS_SendWaitingDelta(void)
 {
 }
+
+
+/*
+ * \brief  Read the fault buffer loss and spill counters, nothing is buffered
+ */
+void AWS_GetFaultBufferStats(AWS_FaultBufferStats_t* stats)
+{
+    memset(stats, 0, sizeof *stats);
+}
+
+void AWS_DumpFaultBufferStats(void)
+{
+}
@@ -12,7 +12,10 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_AWS
+
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "AWS_CommsHandler.h"
@@ -26,6 +29,9 @@
 #include "OSAL_Api.h"
 #include "LSD_Api.h"
 #include "LSD_Types.h"
+#if AWS_FAULT_SPILL
+#include "AWS_FaultSpill.h"
+#endif
 
 
 /*!****************************************************************************
@@ -37,13 +43,24 @@
 // space for a maximum sized buffer of 6 deltas (to cater for the worst case)
 // Strictly speaking we need 99 of size 4 and one of size 6, but just for ease
 // specify 101 buffers
-// 32 is the size of the delta header
+// offsetof(Delta_t, buffer) is the size of the delta header
 // 4 is the number of properties in a fault report
-#define AWS_BUFFER_SIZE (101 * (32 + (4 * sizeof(EnsoPropertyDelta_t))))
+#define AWS_BUFFER_SIZE (101 * (offsetof(Delta_t, buffer) + (4 * sizeof(EnsoPropertyDelta_t))))
 #define AWS_INITIAL_BACKOFF_TIME_IN_SECS 30	//////// [RE:workaround] Increased this from 5
 #define AWS_PAUSE_MS 1000
 #define AWS_MESSAGE_IN_FLIGHT_TIMEOUT_S 30
 
+// Shadow updates that may be waiting for their callback at the same time
+#define AWS_MAX_MESSAGES_IN_FLIGHT 8
+
+// With AWS_FAULT_SPILL, deltas go to the spill file in flash once the fault
+// buffer holds AWS_SPILL_HIGH_WATER of them, and for as long as the file
+// holds any, so they stay in order. They are read back when the fault buffer
+// is down to AWS_SPILL_LOW_WATER. High water leaves room for the largest
+// deltas, the fault buffer holds at least 70 of six properties.
+#define AWS_SPILL_HIGH_WATER 64
+#define AWS_SPILL_LOW_WATER 32
+
 /******************************************************************************
  * Type Definitions
  *****************************************************************************/
@@ -57,9 +74,13 @@ static Delta_t* _startBuffer; // First delta in list
 static Delta_t* _endBuffer;  // Next unused position at end of the buffer
 static int _bufferCount;   // Needed as when start == end buffer can be full or empty
 
-// Have we sent a message for sending
-static bool _messageInFlight;
-static int _messageInFlightTimeout;
+// Number of buffers sent and waiting for their callback
+static int _messagesInFlight;
+
+// Sequence number given to the next buffer sent. It is the callback context,
+// a late callback for a buffer that was thrown away finds no buffer in
+// flight with its number even if another delta now lies at the same address.
+static uint32_t _nextSequence = 1;
 
 // Time to wait before retrying
 static uint32_t _propertyBackOffTimeInSeconds;
@@ -82,6 +103,20 @@ static Thread_t periodicWorkerThread;
 
 static Semaphore_t _periodicWorkerSemaphore;
 
+static AWS_FaultBufferStats_t _stats;
+
+#if AWS_FAULT_SPILL
+// Set from the power monitor thread when power fails or comes back
+static volatile bool _powerFailing = false;
+
+// The fault buffer has been checkpointed to the spill file, deltas read back
+// from it are kept for replay
+static bool _spillProtecting = false;
+
+// Delta being spilled, kept off the stack of the calling thread
+static Delta_t _spillDelta;
+#endif
+
 /*!****************************************************************************
  * Private Function Prototypes
  *****************************************************************************/
@@ -92,6 +127,29 @@ static void _PeriodicWorkerCB(void* p);
 static void _PeriodicWorker(void* p);
 static Delta_t* _NextBuffer(Delta_t* current, int properties);
 static void _returnBuffer(Delta_t* buffer);
+static bool _DeltasOverlap(const Delta_t* a, const Delta_t* b);
+static bool _ReadyForSending(Delta_t* buffer);
+static Delta_t* _FirstReadyForSending(void);
+static Delta_t* _FindInFlight(void* context);
+static void _RetryTimedOutMessages(void);
+static void _BackOff(void);
+static LSD_Coalesce_e _CoalesceKind(EnsoAgentSidePropertyId_t agentSideId);
+static bool _IsCoalesceBarrier(const Delta_t* buffer);
+static Delta_t* _CoalesceTarget(const HandlerId_e subscriberId,
+        const EnsoDeviceId_t* deviceId, const PropertyGroup_e propertyGroup,
+        const EnsoPropertyDelta_t* delta, int* index);
+static bool _Coalesce(const HandlerId_e subscriberId, const EnsoDeviceId_t deviceId,
+        const PropertyGroup_e propertyGroup, const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer);
+#if AWS_FAULT_SPILL
+static void _AWS_LoadDelta(const Delta_t* delta);
+static void _AWS_Refill(void);
+static bool _AWS_Spill(const HandlerId_e subscriberId, const EnsoDeviceId_t deviceId,
+        const PropertyGroup_e propertyGroup, const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer);
+static void _AWS_CheckPower(void);
+static void _AWS_PowerEventCB(OSAL_PowerEvent_e event);
+#endif
 void _CircularBufferInit(void);
 bool _AWS_SendOutOfSyncProperties(void);
 extern bool AWS_RegisterNewDeltaRequest(void);
@@ -115,8 +173,7 @@ EnsoErrorCode_e AWS_FaultBufferInit(void)
     _propertyBackOffTimeInSeconds = 0;
     _discoveryBackOffTimeInSeconds = 0;
 
-    _messageInFlight = false;
-    _messageInFlightTimeout = 0;
+    _messagesInFlight = 0;
 
     if (OSAL_InitBinarySemaphore(&_periodicWorkerSemaphore) != 0)
     {
@@ -130,6 +187,32 @@ EnsoErrorCode_e AWS_FaultBufferInit(void)
         return eecInternalError;
     }
 
+#if AWS_FAULT_SPILL
+    // Deltas left in flash by the previous run go before any new ones
+    bool damaged;
+    if (eecNoError != AWS_SpillInit(&damaged))
+    {
+        LOG_Error("AWS_SpillInit failed, deltas in flash are not replayed");
+    }
+    if (damaged)
+    {
+        _stats.damaged++;
+    }
+    _stats.replayed += AWS_SpillPending();
+
+    OSAL_LockMutex(&_bufferMutex);
+    AWS_SpillTake(AWS_SPILL_HIGH_WATER, false, _AWS_LoadDelta);
+    OSAL_UnLockMutex(&_bufferMutex);
+
+    // Called straight away if power has failed already
+    OSAL_RegisterPowerEventCallback(_AWS_PowerEventCB);
+
+    if ((_bufferCount > 0) || _powerFailing)
+    {
+        AWS_SetTimerForPeriodicWorker();
+    }
+#endif
+
     return eecNoError;
 }
 
@@ -170,6 +253,18 @@ EnsoErrorCode_e AWS_FaultBuffer(
 {
     EnsoErrorCode_e result = eecNoError;
 
+    if (_Coalesce(subscriberId, deviceId, propertyGroup, numProperties, deltasBuffer))
+    {
+        return eecNoError;
+    }
+
+#if AWS_FAULT_SPILL
+    if (_AWS_Spill(subscriberId, deviceId, propertyGroup, numProperties, deltasBuffer))
+    {
+        return eecNoError;
+    }
+#endif
+
     // Get free fault buffer
     Delta_t* buffer = _FindFreeBuffer(numProperties);
 
@@ -201,41 +296,85 @@ EnsoErrorCode_e AWS_FaultBuffer(
 
 /*
  * \brief  Fault buffer made it to the cloud successfully
- * \param  ptr     Pointer to the buffer that contains the fault
+ * \param  ptr     Context the buffer that contains the fault was sent with
  */
 void AWS_FinishedWithFaultBuffer(void* ptr)
 {
-    _messageInFlight = false;
+    bool moreToSend = false;
 
-    // All is well
-    _propertyBackOffTimeInSeconds = 0;
-    _discoveryBackOffTimeInSeconds = 0;
+    OSAL_LockMutex(&_bufferMutex);
 
-    _returnBuffer(ptr);
-}
+    Delta_t* buffer = _FindInFlight(ptr);
+    if (buffer)
+    {
+        buffer->inFlight = false;
+        _messagesInFlight--;
+
+        // All is well
+        _propertyBackOffTimeInSeconds = 0;
+        _discoveryBackOffTimeInSeconds = 0;
+
+        // Callbacks may arrive in any order, _returnBuffer() copes with that
+        _returnBuffer(buffer);
+#if AWS_FAULT_SPILL
+        _AWS_Refill();
+#endif
+        moreToSend = (_FirstReadyForSending() != NULL);
+    }
+    else
+    {
+        // It was thrown away or timed out and will be sent again
+        LOG_Warning("Callback for a delta that is no longer in flight");
+    }
 
+    OSAL_UnLockMutex(&_bufferMutex);
 
+    if (moreToSend)
+    {
+        // Refill the window now rather than on the next periodic tick
+        AWS_RegisterNewDeltaRequest();
+    }
+}
 
 /*
- * \brief  Fault buffer did not make it to the cloud successfully
+ * \brief  One fault buffer did not make it to the cloud, it is sent again
+ *         once the back off time has passed
+ * \param  ptr     Context the buffer that contains the fault was sent with,
+ *                 may be NULL for updates that don't come from the fault buffer
  */
-void AWS_SendFailedForFaultBuffer(void)
+void AWS_MessageFailedForFaultBuffer(void* ptr)
 {
-    _messageInFlight = false;
+    OSAL_LockMutex(&_bufferMutex);
 
-    if (_propertyBackOffTimeInSeconds == 0)
+    Delta_t* buffer = _FindInFlight(ptr);
+    if (buffer)
     {
-        // On first failure back off for a preset amount
-        _propertyBackOffTimeInSeconds = AWS_INITIAL_BACKOFF_TIME_IN_SECS;
+        buffer->inFlight = false;
+        _messagesInFlight--;
     }
-    else
+    _BackOff();
+
+    OSAL_UnLockMutex(&_bufferMutex);
+}
+
+/*
+ * \brief  Fault buffers did not make it to the cloud successfully, all those
+ *         in flight are sent again once the back off time has passed
+ */
+void AWS_SendFailedForFaultBuffer(void)
+{
+    OSAL_LockMutex(&_bufferMutex);
+
+    Delta_t* buffer = _startBuffer;
+    for (int i = 0; i < _bufferCount; i++)
     {
-        // Then increase increase back off time, up to a limit
-        if (_propertyBackOffTimeInSeconds < 60)
-        {
-            _propertyBackOffTimeInSeconds++;
-        }
+        buffer->inFlight = false;
+        buffer = _NextBuffer(buffer, buffer->numProperties);
     }
+    _messagesInFlight = 0;
+    _BackOff();
+
+    OSAL_UnLockMutex(&_bufferMutex);
 }
 
 /*
@@ -290,28 +429,49 @@ void AWS_ForceBackoffDuringDiscovery(void)
 }
 
 /*
- * \brief This function sends waiting delta in Fault Buffer Queue.
+ * \brief This function sends the waiting deltas in Fault Buffer Queue, oldest
+ *        first, until AWS_MAX_MESSAGES_IN_FLIGHT are waiting for callbacks.
  *
  */
 void AWS_SendWaitingDelta(void)
 {
     OSAL_LockMutex(&_bufferMutex);
 
-    if (_bufferCount > 0)
+    Delta_t* buffer = _startBuffer;
+    for (int i = 0; (i < _bufferCount) && (_messagesInFlight < AWS_MAX_MESSAGES_IN_FLIGHT); i++)
     {
-        _messageInFlight = true;
-        _messageInFlightTimeout = 0;
+        Delta_t* next = _NextBuffer(buffer, buffer->numProperties);
 
-        LOG_Trace("subscriberId %d Start buffer = %X, count = %i, num properties = %i",
-                  _startBuffer->subscriberId, _startBuffer, _bufferCount, _startBuffer->numProperties);
-        // Try again with first item in the FIFO
-        AWS_OnCommsHandler(
-            _startBuffer->subscriberId,
-            _startBuffer->deviceId,
-            _startBuffer->propertyGroup,
-            _startBuffer->numProperties,
-            _startBuffer->buffer,
-            (void*)_startBuffer);
+        if (_ReadyForSending(buffer))
+        {
+            buffer->inFlight = true;
+            buffer->sentMs = OSAL_time_ms();
+            buffer->sequence = _nextSequence++;
+            if (_nextSequence == 0)
+            {
+                // 0 is the NULL context
+                _nextSequence = 1;
+            }
+            _messagesInFlight++;
+            _stats.sent++;
+
+            LOG_Trace("subscriberId %d buffer = %X, count = %i, in flight = %i, num properties = %i",
+                      buffer->subscriberId, buffer, _bufferCount, _messagesInFlight, buffer->numProperties);
+            AWS_OnCommsHandler(
+                buffer->subscriberId,
+                buffer->deviceId,
+                buffer->propertyGroup,
+                buffer->numProperties,
+                buffer->buffer,
+                (void*)(uintptr_t)buffer->sequence);
+
+            if (!buffer->inFlight)
+            {
+                // Failed straight away, leave the rest for after the back off
+                break;
+            }
+        }
+        buffer = next;
     }
 
     OSAL_UnLockMutex(&_bufferMutex);
@@ -360,6 +520,15 @@ Delta_t* _FindFreeBuffer(int forNumProperties)
         _bufferCount--;
 
         // Buffer is now full. Throw away oldest one and try again
+        if (_startBuffer->inUse)
+        {
+            _stats.discarded++;
+        }
+        if (_startBuffer->inFlight)
+        {
+            _startBuffer->inFlight = false;
+            _messagesInFlight--;
+        }
         _startBuffer->inUse = false;
         _startBuffer = _NextBuffer(_startBuffer, _startBuffer->numProperties);
     }
@@ -369,6 +538,7 @@ Delta_t* _FindFreeBuffer(int forNumProperties)
     // Move endBuffer on
     _endBuffer->inUse = true;
     _endBuffer->readyToSend = false;
+    _endBuffer->inFlight = false;
     _endBuffer->numProperties = forNumProperties;
     _endBuffer = _NextBuffer(_endBuffer, forNumProperties);
     _bufferCount++;
@@ -432,6 +602,479 @@ static Delta_t* _NextBuffer(Delta_t* current, int numProperties)
     return next;
 }
 
+/**
+ * \name   _DeltasOverlap
+ * \brief  Do two deltas update a property in common?
+ */
+static bool _DeltasOverlap(const Delta_t* a, const Delta_t* b)
+{
+    if ((a->propertyGroup != b->propertyGroup) ||
+        (LSD_DeviceIdCompare(&a->deviceId, &b->deviceId) != 0))
+    {
+        return false;
+    }
+    for (int i = 0; i < a->numProperties; i++)
+    {
+        for (int j = 0; j < b->numProperties; j++)
+        {
+            if (a->buffer[i].agentSidePropertyID == b->buffer[j].agentSidePropertyID)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * \name   _ReadyForSending
+ * \brief  Can this buffer be sent now? It must not update a property that
+ *         an older buffer still waiting for its callback also updates, so a
+ *         retry never overtakes a newer value in the shadow.
+ *         Call with _bufferMutex held.
+ * \param  buffer  a buffer between _startBuffer and _endBuffer
+ */
+static bool _ReadyForSending(Delta_t* buffer)
+{
+    if (!buffer->inUse || !buffer->readyToSend || buffer->inFlight)
+    {
+        return false;
+    }
+
+    for (Delta_t* older = _startBuffer; older != buffer;
+         older = _NextBuffer(older, older->numProperties))
+    {
+        if (older->inUse && _DeltasOverlap(older, buffer))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \name   _FirstReadyForSending
+ * \brief  Oldest buffer that can be sent now, if the window has room.
+ *         Call with _bufferMutex held.
+ * \return the buffer or NULL
+ */
+static Delta_t* _FirstReadyForSending(void)
+{
+    if (_messagesInFlight >= AWS_MAX_MESSAGES_IN_FLIGHT)
+    {
+        return NULL;
+    }
+
+    Delta_t* buffer = _startBuffer;
+    for (int i = 0; i < _bufferCount; i++)
+    {
+        if (_ReadyForSending(buffer))
+        {
+            return buffer;
+        }
+        buffer = _NextBuffer(buffer, buffer->numProperties);
+    }
+    return NULL;
+}
+
+/**
+ * \name   _FindInFlight
+ * \brief  Buffer in flight that was sent with a callback context.
+ *         Call with _bufferMutex held.
+ * \param  context  the context passed to AWS_OnCommsHandler()
+ * \return the buffer or NULL if it is no longer in flight
+ */
+static Delta_t* _FindInFlight(void* context)
+{
+    uint32_t sequence = (uint32_t)(uintptr_t)context;
+    if (sequence == 0)
+    {
+        return NULL;
+    }
+
+    Delta_t* buffer = _startBuffer;
+    for (int i = 0; (i < _bufferCount) && (_messagesInFlight > 0); i++)
+    {
+        if (buffer->inFlight && (buffer->sequence == sequence))
+        {
+            return buffer;
+        }
+        buffer = _NextBuffer(buffer, buffer->numProperties);
+    }
+    return NULL;
+}
+
+/**
+ * \name   _RetryTimedOutMessages
+ * \brief  The callback for message status is often not received if an
+ *         unexpected network event has occurred. Buffers that waited too
+ *         long are sent again after the back off time.
+ *         Call with _bufferMutex held.
+ */
+static void _RetryTimedOutMessages(void)
+{
+    uint32_t now = OSAL_time_ms();
+    bool timedOut = false;
+
+    Delta_t* buffer = _startBuffer;
+    for (int i = 0; (i < _bufferCount) && (_messagesInFlight > 0); i++)
+    {
+        if (buffer->inFlight)
+        {
+            uint32_t waitingTimeInSecs = (now - buffer->sentMs) / 1000;
+            if (waitingTimeInSecs >= AWS_MESSAGE_IN_FLIGHT_TIMEOUT_S)
+            {
+                LOG_Error("We have timed out waiting for callback for message in flight");
+                buffer->inFlight = false;
+                _messagesInFlight--;
+                timedOut = true;
+            }
+            else if (waitingTimeInSecs > 2)
+            {
+                LOG_Info("Message is in flight, waited for %i secs", waitingTimeInSecs);
+            }
+        }
+        buffer = _NextBuffer(buffer, buffer->numProperties);
+    }
+
+    if (timedOut)
+    {
+        _BackOff();
+    }
+}
+
+/**
+ * \name   _CoalesceKind
+ * \brief  How a property may be merged into a waiting delta
+ */
+static LSD_Coalesce_e _CoalesceKind(EnsoAgentSidePropertyId_t agentSideId)
+{
+    return LSD_GetCoalesceKind(agentSideId);
+}
+
+/**
+ * \name   _IsCoalesceBarrier
+ * \brief  Does this buffer hold a change other than a measurement? Later
+ *         changes to the same device must not be merged into older buffers
+ *         past it, the cloud would see them before the state changed.
+ */
+static bool _IsCoalesceBarrier(const Delta_t* buffer)
+{
+    for (int i = 0; i < buffer->numProperties; i++)
+    {
+        if (_CoalesceKind(buffer->buffer[i].agentSidePropertyID) != LSD_COALESCE_LATEST)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * \name   _CoalesceTarget
+ * \brief  Find the waiting buffer a property change can be merged into.
+ *         That is the newest buffer with the same property of the same
+ *         device, if it has not been sent and no barrier follows it.
+ *         Call with _bufferMutex held.
+ * \param  index   Set to the position of the property in the buffer
+ * \return the buffer or NULL
+ */
+static Delta_t* _CoalesceTarget(
+        const HandlerId_e subscriberId,
+        const EnsoDeviceId_t* deviceId,
+        const PropertyGroup_e propertyGroup,
+        const EnsoPropertyDelta_t* delta,
+        int* index)
+{
+    LSD_Coalesce_e kind = _CoalesceKind(delta->agentSidePropertyID);
+    if (kind == LSD_COALESCE_NEVER)
+    {
+        return NULL;
+    }
+
+    Delta_t* target = NULL;
+    Delta_t* buffer = _startBuffer;
+    for (int i = 0; i < _bufferCount; i++)
+    {
+        if (buffer->inUse &&
+            (buffer->propertyGroup == propertyGroup) &&
+            (LSD_DeviceIdCompare(&buffer->deviceId, deviceId) == 0))
+        {
+            int j = 0;
+            while ((j < buffer->numProperties) &&
+                   (buffer->buffer[j].agentSidePropertyID != delta->agentSidePropertyID))
+            {
+                j++;
+            }
+
+            if (j < buffer->numProperties)
+            {
+                target = buffer;
+                *index = j;
+            }
+            else if (_IsCoalesceBarrier(buffer))
+            {
+                target = NULL;
+            }
+        }
+        buffer = _NextBuffer(buffer, buffer->numProperties);
+    }
+
+    if ((target == NULL) || !target->readyToSend || target->inFlight ||
+        (target->subscriberId != subscriberId))
+    {
+        return NULL;
+    }
+
+    // A state is only merged with a repeat of itself, never a change.
+    // States are integer or boolean properties, comparing all 32 bits can
+    // only miss a repeat, it never merges a change.
+    if ((kind == LSD_COALESCE_SAME_STATE) &&
+        (target->buffer[*index].propertyValue.uint32Value != delta->propertyValue.uint32Value))
+    {
+        return NULL;
+    }
+
+    return target;
+}
+
+/**
+ * \name   _Coalesce
+ * \brief  Merge a delta into those still waiting to be sent, overwriting the
+ *         old values of its properties. A delta is merged whole or not at
+ *         all, so the properties of a fault report stay together.
+ * \return true if it was merged and need not be buffered
+ */
+static bool _Coalesce(
+        const HandlerId_e subscriberId,
+        const EnsoDeviceId_t deviceId,
+        const PropertyGroup_e propertyGroup,
+        const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer)
+{
+    Delta_t* targets[ECOM_MAX_DELTAS];
+    int indexes[ECOM_MAX_DELTAS];
+    bool merged = false;
+
+    if ((numProperties == 0) || (numProperties > ECOM_MAX_DELTAS))
+    {
+        return false;
+    }
+
+    OSAL_LockMutex(&_bufferMutex);
+
+#if AWS_FAULT_SPILL
+    // Deltas in the spill file are older than those in RAM, a merged value
+    // would overtake them. A checkpoint would not see the merge.
+    if (_powerFailing || _spillProtecting || (AWS_SpillPending() > 0))
+    {
+        OSAL_UnLockMutex(&_bufferMutex);
+        return false;
+    }
+#endif
+
+    int i = 0;
+    while ((i < numProperties) &&
+           ((targets[i] = _CoalesceTarget(subscriberId, &deviceId, propertyGroup,
+                                          &deltasBuffer[i], &indexes[i])) != NULL))
+    {
+        i++;
+    }
+
+    if (i == numProperties)
+    {
+        for (i = 0; i < numProperties; i++)
+        {
+            targets[i]->buffer[indexes[i]].propertyValue = deltasBuffer[i].propertyValue;
+        }
+        _stats.merged++;
+        merged = true;
+    }
+
+    OSAL_UnLockMutex(&_bufferMutex);
+
+    return merged;
+}
+
+/**
+ * \name   _BackOff
+ * \brief  Pause sending after a failure, longer each time it happens again
+ */
+static void _BackOff(void)
+{
+    if (_propertyBackOffTimeInSeconds == 0)
+    {
+        // On first failure back off for a preset amount
+        _propertyBackOffTimeInSeconds = AWS_INITIAL_BACKOFF_TIME_IN_SECS;
+    }
+    else
+    {
+        // Then increase increase back off time, up to a limit
+        if (_propertyBackOffTimeInSeconds < 60)
+        {
+            _propertyBackOffTimeInSeconds++;
+        }
+    }
+}
+
+#if AWS_FAULT_SPILL
+/**
+ * \name   _AWS_LoadDelta
+ * \brief  Put a delta read back from the spill file at the end of the fault
+ *         buffer. Call with _bufferMutex held.
+ */
+static void _AWS_LoadDelta(const Delta_t* delta)
+{
+    Delta_t* buffer = _FindFreeBuffer(delta->numProperties);
+
+    buffer->subscriberId = delta->subscriberId;
+    buffer->deviceId = delta->deviceId;
+    buffer->propertyGroup = delta->propertyGroup;
+    memcpy(buffer->buffer, delta->buffer, delta->numProperties * sizeof(EnsoPropertyDelta_t));
+    buffer->readyToSend = true;
+}
+
+/**
+ * \name   _AWS_Refill
+ * \brief  Read deltas back from the spill file once the fault buffer has
+ *         drained to the low water mark. Call with _bufferMutex held.
+ */
+static void _AWS_Refill(void)
+{
+    if ((AWS_SpillPending() > 0) && (_bufferCount <= AWS_SPILL_LOW_WATER))
+    {
+        AWS_SpillTake(AWS_SPILL_HIGH_WATER - _bufferCount, _spillProtecting, _AWS_LoadDelta);
+    }
+}
+
+/**
+ * \name   _AWS_Spill
+ * \brief  Append a delta to the spill file rather than the fault buffer if
+ *         the fault buffer is above high water, the file is not empty or
+ *         power is failing
+ * \return false if the delta should go in the fault buffer
+ */
+static bool _AWS_Spill(
+        const HandlerId_e subscriberId,
+        const EnsoDeviceId_t deviceId,
+        const PropertyGroup_e propertyGroup,
+        const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer)
+{
+    bool spilled = true;
+
+    OSAL_LockMutex(&_bufferMutex);
+
+    bool wasEmpty = (_bufferCount == 0);
+    bool mustSpill = (AWS_SpillPending() > 0) || _spillProtecting || _powerFailing;
+
+    if (mustSpill || (_bufferCount >= AWS_SPILL_HIGH_WATER))
+    {
+        _spillDelta.subscriberId = subscriberId;
+        _spillDelta.deviceId = deviceId;
+        _spillDelta.propertyGroup = propertyGroup;
+        _spillDelta.numProperties = numProperties;
+        memcpy(_spillDelta.buffer, deltasBuffer, numProperties * sizeof(EnsoPropertyDelta_t));
+
+        if (eecNoError == AWS_SpillAppend(&_spillDelta))
+        {
+            _stats.spilled++;
+            _AWS_Refill();
+        }
+        else if (mustSpill)
+        {
+            // Going in the fault buffer would overtake the deltas in flash
+            LOG_Warning("Spill file full, throwing away a set of deltas of size %i", numProperties);
+            _stats.dropped++;
+        }
+        else
+        {
+            spilled = false;
+        }
+    }
+    else
+    {
+        spilled = false;
+    }
+
+    OSAL_UnLockMutex(&_bufferMutex);
+
+    if (spilled && wasEmpty && (_bufferCount > 0))
+    {
+        AWS_SetTimerForPeriodicWorker();
+    }
+
+    return spilled;
+}
+
+/**
+ * \name   _AWS_CheckPower
+ * \brief  When power fails write the fault buffer to the spill file in front
+ *         of the deltas there, so every delta not acknowledged yet is
+ *         replayed if the restart comes before power. Deltas read back stay
+ *         in the file until power is back.
+ */
+static void _AWS_CheckPower(void)
+{
+    bool powerFailing = _powerFailing;
+
+    if (powerFailing == _spillProtecting)
+    {
+        return;
+    }
+
+    OSAL_LockMutex(&_bufferMutex);
+
+    if (powerFailing)
+    {
+        EnsoErrorCode_e retVal = AWS_SpillCheckpointBegin();
+
+        Delta_t* buffer = _startBuffer;
+        for (int i = 0; (i < _bufferCount) && (eecNoError == retVal); i++)
+        {
+            if (buffer->inUse)
+            {
+                retVal = AWS_SpillCheckpointAdd(buffer);
+            }
+            buffer = _NextBuffer(buffer, buffer->numProperties);
+        }
+        if (eecNoError == retVal)
+        {
+            retVal = AWS_SpillCheckpointEnd();
+        }
+
+        if (eecNoError == retVal)
+        {
+            LOG_Info("Power failing, %i deltas checkpointed to flash", _bufferCount);
+            _spillProtecting = true;
+        }
+        else
+        {
+            // Try again on the next tick
+            LOG_Error("Fault buffer checkpoint failed");
+        }
+    }
+    else
+    {
+        LOG_Info("Power back, fault buffer checkpoint released");
+        AWS_SpillRelease();
+        _spillProtecting = false;
+    }
+
+    OSAL_UnLockMutex(&_bufferMutex);
+}
+
+/**
+ * \name   _AWS_PowerEventCB
+ * \brief  Called from the power monitor and battery manager threads
+ */
+static void _AWS_PowerEventCB(OSAL_PowerEvent_e event)
+{
+    _powerFailing = (event != OSAL_POWER_MAINS_RESTORED);
+    OSAL_GiveBinarySemaphore(&_periodicWorkerSemaphore);
+}
+#endif
+
 /**
  * \name   _PeriodicCallback
  * \brief  Called to do fault buffer processing
@@ -451,7 +1094,6 @@ static void _PeriodicWorker(void* p)
 {
     static int counter = 0;
     bool finished = false;
-    EnsoDeviceId_t unused;
 
     // For ever loop
     for ( ; ; )
@@ -459,6 +1101,10 @@ static void _PeriodicWorker(void* p)
         OSAL_TakeBinarySemaphore(&_periodicWorkerSemaphore);
         finished = false;
 
+#if AWS_FAULT_SPILL
+        _AWS_CheckPower();
+#endif
+
         if (!_bAWSConnected)
         {
             // No connection! Do not do anything
@@ -489,12 +1135,17 @@ static void _PeriodicWorker(void* p)
                     (_propertyBackOffTimeInSeconds - counter));
             }
         }
-        else if (!_messageInFlight)
+        else
         {
             counter = 0;
 
             OSAL_LockMutex(&_bufferMutex);
 
+            _RetryTimedOutMessages();
+#if AWS_FAULT_SPILL
+            _AWS_Refill();
+#endif
+
             // _startBuffer is moved on in callback when send succeeds
             if (_bufferCount == 0)
             {
@@ -511,17 +1162,17 @@ static void _PeriodicWorker(void* p)
                     finished = true;
                 }
             }
-            else
+            else if (_messagesInFlight < AWS_MAX_MESSAGES_IN_FLIGHT)
             {
                 // Check if comms handler is busy
                 if (!AWS_OutOfSyncTimerEnabled())
                 {
-                    if (_startBuffer->readyToSend)
+                    if (_FirstReadyForSending())
                     {
                         /* Just inform AWS about new delta */
                         AWS_RegisterNewDeltaRequest();
                     }
-                    else
+                    else if (_messagesInFlight == 0)
                     {
                         // It will be ready next time
                         LOG_Info("Fault buffer not ready to send")
@@ -534,26 +1185,6 @@ static void _PeriodicWorker(void* p)
             }
             OSAL_UnLockMutex(&_bufferMutex);
         }
-        else
-        {
-            // Called every AWS_PAUSE_MS
-            _messageInFlightTimeout++;
-            int waitingTimeInSecs = (AWS_PAUSE_MS * _messageInFlightTimeout) / 1000;
-            if (waitingTimeInSecs > 2)
-            {
-                LOG_Info("Message is in flight, waited for %i secs", waitingTimeInSecs);
-            }
-
-            /* The callback for message status is often not received if an unexpected network
-             * event has occurred and so we need to timeout and try again. If we are executing
-             * this code then comms handler is up and reporting that it is healthy
-             */
-            if (waitingTimeInSecs >= AWS_MESSAGE_IN_FLIGHT_TIMEOUT_S)
-            {
-                LOG_Error("We have timed out waiting for callback for message in flight");
-                AWS_SendFailedForFaultBuffer();
-            }
-        }
 
         if (!finished)
         {
@@ -569,7 +1200,42 @@ static void _PeriodicWorker(void* p)
  */
 bool AWS_FaultBufferEmpty(void)
 {
+#if AWS_FAULT_SPILL
+    return (_bufferCount == 0) && (AWS_SpillPending() == 0);
+#else
     return _bufferCount == 0;
+#endif
+}
+
+/*
+ * \brief  Read the fault buffer loss and spill counters
+ *
+ * \param  stats   Filled in with the counters since boot
+ */
+void AWS_GetFaultBufferStats(AWS_FaultBufferStats_t* stats)
+{
+    OSAL_LockMutex(&_bufferMutex);
+    *stats = _stats;
+    stats->inRam = _bufferCount;
+#if AWS_FAULT_SPILL
+    stats->pending = AWS_SpillPending();
+#endif
+    OSAL_UnLockMutex(&_bufferMutex);
+}
+
+/*
+ * \brief  Log the fault buffer loss and spill counters
+ */
+void AWS_DumpFaultBufferStats(void)
+{
+    AWS_FaultBufferStats_t stats;
+    AWS_GetFaultBufferStats(&stats);
+
+    LOG_Info("Fault buffer: %u in RAM, %u in flash", stats.inRam, stats.pending);
+    LOG_Info("Sent: %u deltas, %u merged into waiting ones", stats.sent, stats.merged);
+    LOG_Info("Lost: %u discarded, %u dropped, %u damaged spill files",
+            stats.discarded, stats.dropped, stats.damaged);
+    LOG_Info("Spilled: %u to flash, %u replayed at boot", stats.spilled, stats.replayed);
 }
 
 
@@ -584,6 +1250,13 @@ bool _AWS_SendOutOfSyncProperties(void)
     bool propertiesOutOfSync = true;
     uint16_t sentMessages;
 
+    // Skip the queue checks and the object walk when everything is in sync
+    if ((0 == LSD_GetNumberOfOutOfSyncProperties(REPORTED_GROUP)) &&
+        (0 == LSD_GetNumberOfOutOfSyncProperties(DESIRED_GROUP)))
+    {
+        return false;
+    }
+
     // Get the message queue for this thing
     MessageQueue_t destQueue = ECOM_GetMessageQueue(COMMS_HANDLER);
 
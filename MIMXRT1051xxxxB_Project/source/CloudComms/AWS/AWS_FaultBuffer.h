@@ -21,6 +21,29 @@
  * Constants
  *****************************************************************************/
 
+// Keep deltas which do not fit in RAM, or are not acknowledged when power
+// fails, in a spill file in flash (see AWS_FaultSpill.h)
+#ifndef AWS_FAULT_SPILL
+#define AWS_FAULT_SPILL 1
+#endif
+
+
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint32_t merged;        // Deltas merged into one still waiting to be sent
+    uint32_t sent;          // Deltas sent to AWS, including retries
+    uint32_t discarded;     // Oldest deltas thrown away to make room in RAM
+    uint32_t dropped;       // Deltas not kept, the spill file was full or failing
+    uint32_t damaged;       // Spill files found damaged at boot, deltas are lost
+    uint32_t spilled;       // Deltas written to the spill file
+    uint32_t replayed;      // Deltas found in the spill file at boot
+    uint16_t inRam;         // Deltas in the fault buffer now
+    uint16_t pending;       // Deltas in the spill file now
+} AWS_FaultBufferStats_t;
 
 
 /******************************************************************************
@@ -36,6 +59,8 @@ EnsoErrorCode_e AWS_FaultBuffer(
 
 void AWS_FinishedWithFaultBuffer(void* ptr);
 
+void AWS_MessageFailedForFaultBuffer(void* ptr);
+
 void AWS_SendFailedForFaultBuffer(void);
 
 EnsoErrorCode_e AWS_FaultBufferInit(void);
@@ -52,4 +77,8 @@ void AWS_ForceBackoffDuringDiscovery(void);
 
 void AWS_ConnectionStateCB(bool connected);
 
+void AWS_GetFaultBufferStats(AWS_FaultBufferStats_t* stats);
+
+void AWS_DumpFaultBufferStats(void);
+
 #endif
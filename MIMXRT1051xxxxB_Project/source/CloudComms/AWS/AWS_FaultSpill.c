@@ -0,0 +1,750 @@
+/*!****************************************************************************
+*
+* \file AWS_FaultSpill.c
+*
+* \brief Flash backed queue behind the RAM fault buffer
+*
+* The spill file is a list of records, each one a AWS_SpillHeader_t followed
+* by its payload:
+*
+*   delta: AWS_SpillDelta_t then numProperties EnsoPropertyDelta_t
+*   mark:  AWS_SpillMark_t
+*
+* Records are only ever appended, reading a delta back does not remove it.
+* Instead a mark records two offsets: the first delta not yet read back, and
+* the first delta to replay after a restart. Only the last mark counts.
+* Deltas before the replay offset are done with, those between the two are
+* in the RAM fault buffer and are kept for replay while power is failing.
+*
+* The file is removed once every delta in it is done with. When it is full
+* and enough of it is done with or marks, the live records are copied to a new
+* file which replaces it. The same copy puts a checkpoint of the RAM fault
+* buffer in front of the live records. Deltas are only appended below
+* AWS_SPILL_MAX_BYTES, marks always are, so the file stays within a quarter of
+* it over the limit plus the size of a checkpoint.
+*
+* The new file is complete before the old one is removed, a new file found
+* alongside the old one at boot was cut short and is dropped.
+*
+* Loading stops at the first record which fails its checks, as with the
+* storage log. The records before it are kept and the file is rewritten.
+*
+* \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#define LOG_MODULE LOG_MODULE_AWS
+
+#include <stddef.h>
+#include <string.h>
+
+#include "AWS_FaultSpill.h"
+#include "ECOM_Api.h"
+#include "LOG_Api.h"
+#include "OSAL_Api.h"
+
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define AWS_SPILL_MAGIC         0x5346      // "FS"
+#define AWS_SPILL_VERSION       1
+
+// Record types
+#define AWS_SPILL_DELTA         1
+#define AWS_SPILL_MARK          2
+
+#define AWS_SPILL_MAX_PAYLOAD   (sizeof(AWS_SpillDelta_t) + (ECOM_MAX_DELTAS * sizeof(EnsoPropertyDelta_t)))
+#define AWS_SPILL_CRC_SPAN      offsetof(AWS_SpillHeader_t, crc)
+
+
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint16_t magic;             // AWS_SPILL_MAGIC
+    uint8_t  version;           // AWS_SPILL_VERSION
+    uint8_t  type;              // AWS_SPILL_DELTA or AWS_SPILL_MARK
+    uint32_t length;            // Payload size
+    uint32_t crc;               // CRC32 of the header up to here and the payload
+} AWS_SpillHeader_t;
+
+typedef struct
+{
+    EnsoDeviceId_t deviceId;
+    uint8_t  subscriberId;
+    uint8_t  propertyGroup;
+    uint16_t numProperties;
+} AWS_SpillDelta_t;
+
+typedef struct
+{
+    uint32_t replayOffset;      // First record to replay after a restart
+    uint32_t readOffset;        // First record not yet read back
+} AWS_SpillMark_t;
+
+
+/******************************************************************************
+ * Private variables
+ *****************************************************************************/
+
+static const char AWS_SpillFile[]    = "AWS_FaultSpill";
+static const char AWS_SpillNewFile[] = "AWS_FaultSpill_New";
+
+static uint32_t _spillSize;         // Bytes of good records in the file
+static uint32_t _replayOffset;
+static uint32_t _readOffset;
+static uint16_t _spillPending;      // Deltas from _readOffset on
+static uint16_t _spillMarks;        // Mark records in the file
+
+// New file being written by a checkpoint
+static Handle_t _newFile;
+static uint32_t _newSize;
+
+// One record, kept off the stack of the calling threads
+static uint8_t _record[sizeof(AWS_SpillHeader_t) + AWS_SPILL_MAX_PAYLOAD];
+
+
+/******************************************************************************
+ * Private functions
+ *****************************************************************************/
+
+static uint32_t _AWS_SpillEncode(uint8_t type, const void* payload, uint32_t length);
+
+static uint32_t _AWS_SpillEncodeDelta(const Delta_t* delta);
+
+static void _AWS_SpillDecodeDelta(Delta_t* delta);
+
+static int _AWS_SpillReadRecord(Handle_t handle, AWS_SpillHeader_t* header);
+
+static EnsoErrorCode_e _AWS_SpillAppendRecord(uint32_t size);
+
+static void _AWS_SpillMark(void);
+
+static bool _AWS_SpillWorthReplacing(void);
+
+static EnsoErrorCode_e _AWS_SpillReplace(uint32_t from);
+
+static void _AWS_SpillReset(void);
+
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name   AWS_SpillInit
+ * \brief  Find the deltas left in the spill file by the previous run, they
+ *         are all read back again, from the replay offset
+ * \param  damaged  Set if records were lost to a damaged file
+ * \return Error code
+ */
+EnsoErrorCode_e AWS_SpillInit(bool* damaged)
+{
+    *damaged = false;
+    _AWS_SpillReset();
+    _newFile = NULL;
+
+    // A replacement cut short leaves the new file behind, the old one is only
+    // removed once the new one is complete
+    if (OSAL_StoreExist(AWS_SpillNewFile))
+    {
+        if (OSAL_StoreExist(AWS_SpillFile))
+        {
+            OSAL_StoreRemove(AWS_SpillNewFile);
+        }
+        else if (0 != OSAL_StoreAtomicRename(AWS_SpillNewFile, AWS_SpillFile))
+        {
+            LOG_Error("OSAL_StoreAtomicRename failed");
+            OSAL_StoreRemove(AWS_SpillNewFile);
+        }
+    }
+
+    if (!OSAL_StoreExist(AWS_SpillFile))
+    {
+        return eecNoError;
+    }
+
+    Handle_t handle = OSAL_StoreOpen(AWS_SpillFile, READ_ONLY);
+    if (NULL == handle)
+    {
+        LOG_Error("Failed to open %s", AWS_SpillFile);
+        return eecOpenFailed;
+    }
+
+    // Find the good records and the last mark, then count the deltas
+    // still to replay
+    AWS_SpillHeader_t header;
+    uint32_t deltaOffsets = 0;
+    uint16_t deltas = 0;
+    int result;
+    while ((result = _AWS_SpillReadRecord(handle, &header)) > 0)
+    {
+        if (AWS_SPILL_MARK == header.type)
+        {
+            AWS_SpillMark_t mark;
+            memcpy(&mark, _record + sizeof header, sizeof mark);
+            if ((mark.replayOffset <= mark.readOffset) && (mark.readOffset <= _spillSize))
+            {
+                _replayOffset = mark.replayOffset;
+                deltas = 0;
+                deltaOffsets = _spillSize;
+            }
+            _spillMarks++;
+        }
+        else
+        {
+            deltas++;
+        }
+        _spillSize += sizeof header + header.length;
+    }
+    OSAL_StoreClose(handle);
+
+    if (result < 0)
+    {
+        LOG_Error("Damaged %s, %u bytes kept", AWS_SpillFile, _spillSize);
+        *damaged = true;
+    }
+
+    // Deltas after the last mark are counted above, those between the replay
+    // offset and the mark need a second pass
+    if (_replayOffset < deltaOffsets)
+    {
+        handle = OSAL_StoreOpen(AWS_SpillFile, READ_ONLY);
+        if (NULL == handle)
+        {
+            _AWS_SpillReset();
+            return eecOpenFailed;
+        }
+        uint32_t offset = 0;
+        while ((offset < deltaOffsets) && (_AWS_SpillReadRecord(handle, &header) > 0))
+        {
+            if ((offset >= _replayOffset) && (AWS_SPILL_DELTA == header.type))
+            {
+                deltas++;
+            }
+            offset += sizeof header + header.length;
+        }
+        OSAL_StoreClose(handle);
+    }
+
+    // Everything from the replay offset is read back again
+    _readOffset = _replayOffset;
+    _spillPending = deltas;
+
+    LOG_Info("%s holds %u deltas to replay", AWS_SpillFile, _spillPending);
+
+    EnsoErrorCode_e retVal = eecNoError;
+    if (*damaged)
+    {
+        // Anything appended after the bad record would not be read back
+        retVal = _AWS_SpillReplace(_replayOffset);
+    }
+    if (0 == _spillPending)
+    {
+        // Nothing left, remove the file
+        _AWS_SpillMark();
+    }
+    return retVal;
+}
+
+/**
+ * \name   AWS_SpillPending
+ * \return Number of deltas in the spill file not yet read back
+ */
+uint16_t AWS_SpillPending(void)
+{
+    return _spillPending;
+}
+
+/**
+ * \name   AWS_SpillAppend
+ * \brief  Add a delta at the end of the spill file
+ * \param  delta    The delta, from the fault buffer or not
+ * \return eecPoolFull if the file has no room left, or error code
+ */
+EnsoErrorCode_e AWS_SpillAppend(const Delta_t* delta)
+{
+    uint32_t size = _AWS_SpillEncodeDelta(delta);
+
+    if ((_spillSize + size > AWS_SPILL_MAX_BYTES) && _AWS_SpillWorthReplacing())
+    {
+        // Drop the records done with to make room
+        _AWS_SpillReplace(_replayOffset);
+        size = _AWS_SpillEncodeDelta(delta);
+    }
+    if (_spillSize + size > AWS_SPILL_MAX_BYTES)
+    {
+        return eecPoolFull;
+    }
+
+    EnsoErrorCode_e retVal = _AWS_SpillAppendRecord(size);
+    if (eecNoError == retVal)
+    {
+        _spillPending++;
+    }
+    return retVal;
+}
+
+/**
+ * \name   AWS_SpillTake
+ * \brief  Read deltas back from the spill file, oldest first
+ * \param  max             Most deltas to read back
+ * \param  keepForReplay   Keep them in the file to be sent again after a
+ *                         restart, until AWS_SpillRelease()
+ * \param  load            Called with each delta
+ * \return Number of deltas read back
+ */
+uint16_t AWS_SpillTake(uint16_t max, bool keepForReplay, AWS_SpillLoad_t load)
+{
+    uint16_t taken = 0;
+
+    if ((0 == _spillPending) || (0 == max))
+    {
+        return 0;
+    }
+
+    Handle_t handle = OSAL_StoreOpen(AWS_SpillFile, READ_ONLY);
+    if (NULL == handle)
+    {
+        LOG_Error("Failed to open %s", AWS_SpillFile);
+        return 0;
+    }
+
+    AWS_SpillHeader_t header;
+    uint32_t offset = 0;
+    while ((taken < max) && (_spillPending > 0))
+    {
+        if (_AWS_SpillReadRecord(handle, &header) <= 0)
+        {
+            // Checked at boot so the flash itself is failing, give up on
+            // the rest rather than trying again and again
+            LOG_Error("Failed to read %s at %u, %u deltas lost", AWS_SpillFile, offset, _spillPending);
+            _spillPending = 0;
+            _readOffset = _spillSize;
+            break;
+        }
+
+        uint32_t next = offset + sizeof header + header.length;
+        if (offset >= _readOffset)
+        {
+            if (AWS_SPILL_DELTA == header.type)
+            {
+                Delta_t delta;
+                _AWS_SpillDecodeDelta(&delta);
+                load(&delta);
+                taken++;
+                _spillPending--;
+            }
+            _readOffset = next;
+        }
+        offset = next;
+    }
+    OSAL_StoreClose(handle);
+
+    if (!keepForReplay)
+    {
+        _replayOffset = _readOffset;
+    }
+    _AWS_SpillMark();
+
+    return taken;
+}
+
+/**
+ * \name   AWS_SpillCheckpointBegin
+ * \brief  Start a new spill file, the deltas added with
+ *         AWS_SpillCheckpointAdd() are put in front of those not yet read
+ *         back and all are replayed after a restart
+ * \return Error code
+ */
+EnsoErrorCode_e AWS_SpillCheckpointBegin(void)
+{
+    if (OSAL_StoreExist(AWS_SpillNewFile))
+    {
+        OSAL_StoreRemove(AWS_SpillNewFile);
+    }
+
+    _newSize = 0;
+    _newFile = OSAL_StoreOpen(AWS_SpillNewFile, WRITE_ONLY);
+    if (NULL == _newFile)
+    {
+        LOG_Error("Failed to open %s", AWS_SpillNewFile);
+        return eecOpenFailed;
+    }
+    return eecNoError;
+}
+
+/**
+ * \name   AWS_SpillCheckpointAdd
+ * \brief  Add a delta of the RAM fault buffer, oldest first
+ * \return Error code
+ */
+EnsoErrorCode_e AWS_SpillCheckpointAdd(const Delta_t* delta)
+{
+    if (NULL == _newFile)
+    {
+        return eecWriteFailed;
+    }
+
+    uint32_t size = _AWS_SpillEncodeDelta(delta);
+    if (OSAL_StoreWrite(_newFile, _record, size) != (int)size)
+    {
+        LOG_Error("Failed to write %s", AWS_SpillNewFile);
+        OSAL_StoreClose(_newFile);
+        OSAL_StoreRemove(AWS_SpillNewFile);
+        _newFile = NULL;
+        return eecWriteFailed;
+    }
+    _newSize += size;
+    return eecNoError;
+}
+
+/**
+ * \name   AWS_SpillCheckpointEnd
+ * \brief  Add the deltas not yet read back and replace the spill file
+ * \return Error code
+ */
+EnsoErrorCode_e AWS_SpillCheckpointEnd(void)
+{
+    if (NULL == _newFile)
+    {
+        return eecWriteFailed;
+    }
+
+    // Deltas read back before are either in the checkpoint or done with
+    return _AWS_SpillReplace(_readOffset);
+}
+
+/**
+ * \name   AWS_SpillRelease
+ * \brief  Stop keeping the deltas read back for replay after a restart
+ */
+void AWS_SpillRelease(void)
+{
+    if (_replayOffset != _readOffset)
+    {
+        _replayOffset = _readOffset;
+        _AWS_SpillMark();
+    }
+}
+
+
+/******************************************************************************
+ * Private functions
+ *****************************************************************************/
+
+/**
+ * \name   _AWS_SpillEncode
+ * \brief  Build a record in _record
+ * \return Size of the record
+ */
+static uint32_t _AWS_SpillEncode(uint8_t type, const void* payload, uint32_t length)
+{
+    AWS_SpillHeader_t header =
+    {
+        .magic = AWS_SPILL_MAGIC,
+        .version = AWS_SPILL_VERSION,
+        .type = type,
+        .length = length
+    };
+
+    if (payload != _record + sizeof header)
+    {
+        memmove(_record + sizeof header, payload, length);
+    }
+    header.crc = OSAL_Crc32(OSAL_Crc32(0, &header, AWS_SPILL_CRC_SPAN), _record + sizeof header, length);
+    memcpy(_record, &header, sizeof header);
+
+    return sizeof header + length;
+}
+
+/**
+ * \name   _AWS_SpillEncodeDelta
+ * \brief  Build a delta record in _record
+ * \return Size of the record
+ */
+static uint32_t _AWS_SpillEncodeDelta(const Delta_t* delta)
+{
+    uint8_t* payload = _record + sizeof(AWS_SpillHeader_t);
+    AWS_SpillDelta_t fixed =
+    {
+        .deviceId = delta->deviceId,
+        .subscriberId = delta->subscriberId,
+        .propertyGroup = delta->propertyGroup,
+        .numProperties = delta->numProperties
+    };
+
+    memcpy(payload, &fixed, sizeof fixed);
+    memcpy(payload + sizeof fixed, delta->buffer, delta->numProperties * sizeof(EnsoPropertyDelta_t));
+
+    return _AWS_SpillEncode(AWS_SPILL_DELTA, payload,
+            sizeof fixed + (delta->numProperties * sizeof(EnsoPropertyDelta_t)));
+}
+
+/**
+ * \name   _AWS_SpillDecodeDelta
+ * \brief  Unpack the delta record in _record
+ */
+static void _AWS_SpillDecodeDelta(Delta_t* delta)
+{
+    const uint8_t* payload = _record + sizeof(AWS_SpillHeader_t);
+    AWS_SpillDelta_t fixed;
+
+    memcpy(&fixed, payload, sizeof fixed);
+    memset(delta, 0, offsetof(Delta_t, buffer));
+    delta->deviceId = fixed.deviceId;
+    delta->subscriberId = (HandlerId_e)fixed.subscriberId;
+    delta->propertyGroup = (PropertyGroup_e)fixed.propertyGroup;
+    delta->numProperties = fixed.numProperties;
+    memcpy(delta->buffer, payload + sizeof fixed, fixed.numProperties * sizeof(EnsoPropertyDelta_t));
+}
+
+/**
+ * \name   _AWS_SpillReadRecord
+ * \brief  Read the next record into _record and check it
+ * \return 1 for a good record, 0 at the end of the file, -1 for a bad one
+ */
+static int _AWS_SpillReadRecord(Handle_t handle, AWS_SpillHeader_t* header)
+{
+    int n = OSAL_StoreRead(handle, header, sizeof *header);
+    if (0 == n)
+    {
+        return 0;
+    }
+    if ((n != sizeof *header) ||
+        (header->magic != AWS_SPILL_MAGIC) ||
+        (header->version != AWS_SPILL_VERSION) ||
+        (header->length > AWS_SPILL_MAX_PAYLOAD))
+    {
+        return -1;
+    }
+
+    uint8_t* payload = _record + sizeof *header;
+    if (OSAL_StoreRead(handle, payload, header->length) != (int)header->length)
+    {
+        return -1;
+    }
+    if (OSAL_Crc32(OSAL_Crc32(0, header, AWS_SPILL_CRC_SPAN), payload, header->length) != header->crc)
+    {
+        return -1;
+    }
+
+    if (AWS_SPILL_DELTA == header->type)
+    {
+        AWS_SpillDelta_t fixed;
+        memcpy(&fixed, payload, sizeof fixed);
+        if ((header->length < sizeof fixed) || (fixed.numProperties > ECOM_MAX_DELTAS) ||
+            (header->length != sizeof fixed + (fixed.numProperties * sizeof(EnsoPropertyDelta_t))))
+        {
+            return -1;
+        }
+    }
+    else if ((AWS_SPILL_MARK != header->type) || (header->length != sizeof(AWS_SpillMark_t)))
+    {
+        return -1;
+    }
+
+    memcpy(_record, header, sizeof *header);
+    return 1;
+}
+
+/**
+ * \name   _AWS_SpillAppendRecord
+ * \brief  Append the record in _record to the spill file
+ * \param  size     Size of the record
+ * \return Error code
+ */
+static EnsoErrorCode_e _AWS_SpillAppendRecord(uint32_t size)
+{
+    Handle_t handle = OSAL_StoreOpen(AWS_SpillFile, WRITE_APPEND);
+    if (NULL == handle)
+    {
+        LOG_Error("Failed to open %s", AWS_SpillFile);
+        return eecOpenFailed;
+    }
+
+    EnsoErrorCode_e retVal = eecNoError;
+    if (OSAL_StoreWrite(handle, _record, size) != (int)size)
+    {
+        LOG_Error("Failed to write %s", AWS_SpillFile);
+        retVal = eecWriteFailed;
+    }
+    else
+    {
+        _spillSize += size;
+    }
+    OSAL_StoreClose(handle);
+
+    return retVal;
+}
+
+/**
+ * \name   _AWS_SpillMark
+ * \brief  Save the replay and read offsets, or remove the file once every
+ *         delta in it is done with
+ */
+static void _AWS_SpillMark(void)
+{
+    if ((0 == _spillPending) && (_replayOffset == _readOffset))
+    {
+        if (OSAL_StoreExist(AWS_SpillFile) && (0 != OSAL_StoreRemove(AWS_SpillFile)))
+        {
+            LOG_Error("OSAL_StoreRemove of %s failed", AWS_SpillFile);
+        }
+        _AWS_SpillReset();
+        return;
+    }
+
+    AWS_SpillMark_t mark = { .replayOffset = _replayOffset, .readOffset = _readOffset };
+    uint32_t size = _AWS_SpillEncode(AWS_SPILL_MARK, &mark, sizeof mark);
+
+    if ((_spillSize + size > AWS_SPILL_MAX_BYTES) && _AWS_SpillWorthReplacing())
+    {
+        // The copy ends with a mark of its own
+        _AWS_SpillReplace(_replayOffset);
+    }
+    else if (eecNoError == _AWS_SpillAppendRecord(size))
+    {
+        _spillMarks++;
+    }
+}
+
+/**
+ * \name   _AWS_SpillWorthReplacing
+ * \brief  Would copying the live records free a useful amount of the file?
+ *         A full file of live deltas is not copied for every append.
+ */
+static bool _AWS_SpillWorthReplacing(void)
+{
+    uint32_t reclaimable = _replayOffset +
+            (_spillMarks * (sizeof(AWS_SpillHeader_t) + sizeof(AWS_SpillMark_t)));
+
+    return reclaimable >= (AWS_SPILL_MAX_BYTES / 4);
+}
+
+/**
+ * \name   _AWS_SpillReplace
+ * \brief  Copy the deltas from an offset of the spill file to the end of
+ *         the new file, opened first if need be, then make it the spill file
+ * \param  from     Offset of the first record to copy
+ * \return Error code
+ */
+static EnsoErrorCode_e _AWS_SpillReplace(uint32_t from)
+{
+    EnsoErrorCode_e retVal = eecNoError;
+
+    if (NULL == _newFile)
+    {
+        retVal = AWS_SpillCheckpointBegin();
+        if (eecNoError != retVal)
+        {
+            return retVal;
+        }
+    }
+
+    // The read offset moves to where the first delta not yet read back lands
+    uint32_t newRead = _newSize;
+    bool readFound = false;
+
+    Handle_t handle = NULL;
+    if (_spillSize > from)
+    {
+        handle = OSAL_StoreOpen(AWS_SpillFile, READ_ONLY);
+        if (NULL == handle)
+        {
+            retVal = eecOpenFailed;
+        }
+    }
+
+    if (handle)
+    {
+        AWS_SpillHeader_t header;
+        uint32_t offset = 0;
+        while ((eecNoError == retVal) && (offset < _spillSize) && (_AWS_SpillReadRecord(handle, &header) > 0))
+        {
+            uint32_t size = sizeof header + header.length;
+            if ((offset >= _readOffset) && !readFound)
+            {
+                newRead = _newSize;
+                readFound = true;
+            }
+            if ((offset >= from) && (AWS_SPILL_DELTA == header.type))
+            {
+                if (OSAL_StoreWrite(_newFile, _record, size) != (int)size)
+                {
+                    retVal = eecWriteFailed;
+                }
+                _newSize += size;
+            }
+            offset += size;
+        }
+        OSAL_StoreClose(handle);
+    }
+    if (!readFound)
+    {
+        newRead = _newSize;
+    }
+
+    if (eecNoError == retVal)
+    {
+        AWS_SpillMark_t mark = { .replayOffset = 0, .readOffset = newRead };
+        uint32_t size = _AWS_SpillEncode(AWS_SPILL_MARK, &mark, sizeof mark);
+        if (OSAL_StoreWrite(_newFile, _record, size) != (int)size)
+        {
+            retVal = eecWriteFailed;
+        }
+        _newSize += size;
+    }
+
+    if (0 != OSAL_StoreClose(_newFile))
+    {
+        retVal = eecCloseFailed;
+    }
+    _newFile = NULL;
+
+    if (eecNoError != retVal)
+    {
+        // Keep the old file, it is still good
+        LOG_Error("Failed to write %s", AWS_SpillNewFile);
+        OSAL_StoreRemove(AWS_SpillNewFile);
+        return retVal;
+    }
+
+    if (OSAL_StoreExist(AWS_SpillFile) && (0 != OSAL_StoreRemove(AWS_SpillFile)))
+    {
+        LOG_Error("OSAL_StoreRemove of %s failed", AWS_SpillFile);
+        OSAL_StoreRemove(AWS_SpillNewFile);
+        return eecRemoveFailed;
+    }
+    if (0 != OSAL_StoreAtomicRename(AWS_SpillNewFile, AWS_SpillFile))
+    {
+        // Picked up at the next boot
+        LOG_Error("OSAL_StoreAtomicRename failed");
+        return eecRenameFailed;
+    }
+
+    _spillSize = _newSize;
+    _replayOffset = 0;
+    _readOffset = newRead;
+    _spillMarks = 1;
+
+    return eecNoError;
+}
+
+/**
+ * \name   _AWS_SpillReset
+ * \brief  No spill file
+ */
+static void _AWS_SpillReset(void)
+{
+    _spillSize = 0;
+    _replayOffset = 0;
+    _readOffset = 0;
+    _spillPending = 0;
+    _spillMarks = 0;
+}
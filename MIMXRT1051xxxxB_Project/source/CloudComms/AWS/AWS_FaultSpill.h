@@ -0,0 +1,69 @@
+#ifndef _AWS_FAULT_SPILL_H_
+#define _AWS_FAULT_SPILL_H_
+
+/*!****************************************************************************
+*
+* \file AWS_FaultSpill.h
+*
+* \brief Flash backed queue behind the RAM fault buffer
+*
+* Deltas which do not fit in the fault buffer are appended to a file in the
+* store and read back in order as the fault buffer drains. While power is
+* failing the deltas read back are kept for replay, together with a
+* checkpoint of the fault buffer, so those not yet acknowledged by AWS are
+* sent again after the restart.
+*
+* None of these functions are thread safe, the fault buffer calls them with
+* its mutex held.
+*
+* \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "LSD_Types.h"
+#include "AWS_FaultTypes.h"
+
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Largest size of the spill file. A four property fault report takes about
+// 140 bytes, so this holds over a hundred of them.
+#ifndef AWS_SPILL_MAX_BYTES
+#define AWS_SPILL_MAX_BYTES     (16 * 1024)
+#endif
+
+
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+// Called for each delta read back from the spill file
+typedef void (*AWS_SpillLoad_t)(const Delta_t* delta);
+
+
+/******************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+EnsoErrorCode_e AWS_SpillInit(bool* damaged);
+
+uint16_t AWS_SpillPending(void);
+
+EnsoErrorCode_e AWS_SpillAppend(const Delta_t* delta);
+
+uint16_t AWS_SpillTake(uint16_t max, bool keepForReplay, AWS_SpillLoad_t load);
+
+EnsoErrorCode_e AWS_SpillCheckpointBegin(void);
+
+EnsoErrorCode_e AWS_SpillCheckpointAdd(const Delta_t* delta);
+
+EnsoErrorCode_e AWS_SpillCheckpointEnd(void);
+
+void AWS_SpillRelease(void);
+
+#endif
@@ -26,10 +26,13 @@ typedef struct
 {
     bool inUse;
     bool readyToSend;
+    bool inFlight;              // Sent, waiting for the shadow update callback
     HandlerId_e subscriberId;
     EnsoDeviceId_t deviceId;
     PropertyGroup_e propertyGroup;
     uint16_t numProperties;
+    uint32_t sentMs;            // OSAL_time_ms() when last sent
+    uint32_t sequence;          // Context of the callback of the last send, never 0
     EnsoPropertyDelta_t buffer[ECOM_MAX_DELTAS];
 } Delta_t;
 
@@ -0,0 +1,313 @@
+/*!****************************************************************************
+*
+* \file AWS_JsonWriter.c
+*
+* \brief Streaming JSON writer used to build shadow update documents
+*
+* \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#define LOG_MODULE LOG_MODULE_AWS
+
+#include <string.h>
+#include "AWS_JsonWriter.h"
+#include "LOG_Api.h"
+
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+static bool _AWS_JsonPutChar(AWS_JsonWriter_t* writer, char c)
+{
+    if (writer->overflow || writer->length + 1 >= writer->size)
+    {
+        writer->overflow = true;
+        return false;
+    }
+    writer->buffer[writer->length++] = c;
+    writer->buffer[writer->length] = '\0';
+    return true;
+}
+
+/**
+ * \brief   Write a quoted string, escaping the characters JSON requires
+ */
+static bool _AWS_JsonPutString(AWS_JsonWriter_t* writer, const char* string)
+{
+    if (!_AWS_JsonPutChar(writer, '"'))
+    {
+        return false;
+    }
+    for (const char* c = string; *c != '\0'; c++)
+    {
+        if ((*c == '"') || (*c == '\\'))
+        {
+            if (!_AWS_JsonPutChar(writer, '\\'))
+            {
+                return false;
+            }
+        }
+        if (!_AWS_JsonPutChar(writer, *c))
+        {
+            return false;
+        }
+    }
+    return _AWS_JsonPutChar(writer, '"');
+}
+
+/**
+ * \brief   Write the separator and the key of a new member of the current
+ *          object, key may be NULL for the root object only
+ */
+static bool _AWS_JsonPutKey(AWS_JsonWriter_t* writer, const char* key)
+{
+    if (writer->hasMembers[writer->depth])
+    {
+        if (!_AWS_JsonPutChar(writer, ','))
+        {
+            return false;
+        }
+    }
+    writer->hasMembers[writer->depth] = true;
+    if (key == NULL)
+    {
+        return true;
+    }
+    return _AWS_JsonPutString(writer, key) && _AWS_JsonPutChar(writer, ':');
+}
+
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name AWS_JsonInit
+ *
+ * \brief Start a new document in the given buffer
+ *
+ * \param  writer    The writer
+ *
+ * \param  buffer    Buffer receiving the NUL terminated document
+ *
+ * \param  size      Size of the buffer
+ */
+void AWS_JsonInit(AWS_JsonWriter_t* writer, char* buffer, size_t size)
+{
+    memset(writer, 0, sizeof *writer);
+    writer->buffer = buffer;
+    writer->size = size;
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+    else
+    {
+        writer->overflow = true;
+    }
+}
+
+/**
+ * \name AWS_JsonOpenObject
+ *
+ * \brief Open an object as a member of the current object
+ *
+ * \param  writer    The writer
+ *
+ * \param  key       Member name, NULL for the document root
+ *
+ * \return           Error code
+ */
+EnsoErrorCode_e AWS_JsonOpenObject(AWS_JsonWriter_t* writer, const char* key)
+{
+    if (writer->depth >= AWS_JSON_MAX_DEPTH)
+    {
+        LOG_Error("JSON nesting too deep");
+        return eecInternalError;
+    }
+    if (!_AWS_JsonPutKey(writer, key) || !_AWS_JsonPutChar(writer, '{'))
+    {
+        return eecBufferTooSmall;
+    }
+    writer->depth++;
+    writer->hasMembers[writer->depth] = false;
+    return eecNoError;
+}
+
+/**
+ * \name AWS_JsonCloseObject
+ *
+ * \brief Close the innermost open object
+ *
+ * \param  writer    The writer
+ *
+ * \return           Error code
+ */
+EnsoErrorCode_e AWS_JsonCloseObject(AWS_JsonWriter_t* writer)
+{
+    if (writer->depth == 0)
+    {
+        return eecInternalError;
+    }
+    if (!_AWS_JsonPutChar(writer, '}'))
+    {
+        return eecBufferTooSmall;
+    }
+    writer->depth--;
+    return eecNoError;
+}
+
+/**
+ * \name AWS_JsonCloseTo
+ *
+ * \brief Close objects until the given number remain open
+ *
+ * \param  writer    The writer
+ *
+ * \param  depth     Number of objects to leave open
+ *
+ * \return           Error code
+ */
+EnsoErrorCode_e AWS_JsonCloseTo(AWS_JsonWriter_t* writer, uint8_t depth)
+{
+    EnsoErrorCode_e retVal = eecNoError;
+    while ((eecNoError == retVal) && (writer->depth > depth))
+    {
+        retVal = AWS_JsonCloseObject(writer);
+    }
+    return retVal;
+}
+
+/**
+ * \name AWS_JsonAddKey
+ *
+ * \brief Start a member of the current object, its value must follow
+ *
+ * \param  writer    The writer
+ *
+ * \param  key       Member name
+ *
+ * \return           Error code
+ */
+EnsoErrorCode_e AWS_JsonAddKey(AWS_JsonWriter_t* writer, const char* key)
+{
+    return _AWS_JsonPutKey(writer, key) ? eecNoError : eecBufferTooSmall;
+}
+
+/**
+ * \name AWS_JsonAddValue
+ *
+ * \brief Write a property value after AWS_JsonAddKey()
+ *
+ * \param  writer    The writer
+ *
+ * \param  value     The value
+ *
+ * \param  type      Its type
+ *
+ * \return           Error code
+ */
+EnsoErrorCode_e AWS_JsonAddValue(AWS_JsonWriter_t* writer,
+        const EnsoPropertyValue_u value, const EnsoValueType_e type)
+{
+    if (writer->overflow)
+    {
+        return eecBufferTooSmall;
+    }
+
+    int remaining = writer->size - writer->length;
+    int bytesUsed = 0;
+    EnsoErrorCode_e retVal = LSD_ConvertTypedDataToJsonValue(
+            writer->buffer + writer->length, remaining, &bytesUsed, value, type);
+
+    if ((eecNoError != retVal) || (bytesUsed >= remaining))
+    {
+        // Numbers are truncated by snprintf, strings report -1
+        writer->overflow = (eecBufferTooSmall == retVal) || (bytesUsed >= remaining) || (bytesUsed < 0);
+        writer->buffer[writer->length] = '\0';
+        return writer->overflow ? eecBufferTooSmall : retVal;
+    }
+
+    // Only the new value is scanned, strings report the terminator in bytesUsed
+    writer->length += strlen(writer->buffer + writer->length);
+    return eecNoError;
+}
+
+/**
+ * \name AWS_JsonAddString
+ *
+ * \brief Add a member with a string value to the current object
+ *
+ * \param  writer    The writer
+ *
+ * \param  key       Member name
+ *
+ * \param  value     The value, escaped as needed
+ *
+ * \return           Error code
+ */
+EnsoErrorCode_e AWS_JsonAddString(AWS_JsonWriter_t* writer, const char* key, const char* value)
+{
+    if (!_AWS_JsonPutKey(writer, key) || !_AWS_JsonPutString(writer, value))
+    {
+        return eecBufferTooSmall;
+    }
+    return eecNoError;
+}
+
+/**
+ * \name AWS_JsonMark
+ *
+ * \brief Remember the current position, see AWS_JsonRewind()
+ *
+ * \param  writer    The writer
+ *
+ * \param  mark      Receives the position
+ */
+void AWS_JsonMark(const AWS_JsonWriter_t* writer, AWS_JsonMark_t* mark)
+{
+    mark->length = writer->length;
+    mark->depth = writer->depth;
+    mark->hasMembers = writer->hasMembers[writer->depth];
+}
+
+/**
+ * \name AWS_JsonRewind
+ *
+ * \brief Drop everything written since the mark, including an overflow
+ *
+ * \param  writer    The writer
+ *
+ * \param  mark      Position from AWS_JsonMark()
+ */
+void AWS_JsonRewind(AWS_JsonWriter_t* writer, const AWS_JsonMark_t* mark)
+{
+    writer->length = mark->length;
+    writer->depth = mark->depth;
+    writer->hasMembers[writer->depth] = mark->hasMembers;
+    writer->buffer[writer->length] = '\0';
+    writer->overflow = false;
+}
+
+/**
+ * \name AWS_JsonLength
+ *
+ * \return  Length of the document so far, excluding the terminator
+ */
+size_t AWS_JsonLength(const AWS_JsonWriter_t* writer)
+{
+    return writer->length;
+}
+
+/**
+ * \name AWS_JsonRemaining
+ *
+ * \return  Space left in the buffer, including the terminator
+ */
+size_t AWS_JsonRemaining(const AWS_JsonWriter_t* writer)
+{
+    return writer->size - writer->length;
+}
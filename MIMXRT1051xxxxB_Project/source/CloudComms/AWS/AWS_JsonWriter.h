@@ -0,0 +1,87 @@
+#ifndef _AWS_JSON_WRITER_H_
+#define _AWS_JSON_WRITER_H_
+
+/*!****************************************************************************
+*
+* \file AWS_JsonWriter.h
+*
+* \brief Streaming JSON writer used to build shadow update documents
+*
+* The writer keeps its cursor and a small nesting stack so a document is
+* built in one pass, each property costs only the bytes it adds. Once the
+* buffer overflows every further call fails, the caller only needs to check
+* the result where convenient.
+*
+* \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "LSD_Types.h"
+
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Root, "state", group and nested property parent
+#define AWS_JSON_MAX_DEPTH  4
+
+
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    char*    buffer;
+    size_t   size;
+    size_t   length;                            // Always NUL terminated here
+    uint8_t  depth;                             // Number of open objects
+    bool     hasMembers[AWS_JSON_MAX_DEPTH + 1];// Member written at each depth
+    bool     overflow;
+} AWS_JsonWriter_t;
+
+/**
+ * Position saved by AWS_JsonMark() so a partly written member can be undone
+ */
+typedef struct
+{
+    size_t   length;
+    uint8_t  depth;
+    bool     hasMembers;
+} AWS_JsonMark_t;
+
+
+/******************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+void AWS_JsonInit(AWS_JsonWriter_t* writer, char* buffer, size_t size);
+
+EnsoErrorCode_e AWS_JsonOpenObject(AWS_JsonWriter_t* writer, const char* key);
+
+EnsoErrorCode_e AWS_JsonCloseObject(AWS_JsonWriter_t* writer);
+
+EnsoErrorCode_e AWS_JsonCloseTo(AWS_JsonWriter_t* writer, uint8_t depth);
+
+EnsoErrorCode_e AWS_JsonAddKey(AWS_JsonWriter_t* writer, const char* key);
+
+EnsoErrorCode_e AWS_JsonAddValue(AWS_JsonWriter_t* writer,
+        const EnsoPropertyValue_u value, const EnsoValueType_e type);
+
+EnsoErrorCode_e AWS_JsonAddString(AWS_JsonWriter_t* writer, const char* key, const char* value);
+
+void AWS_JsonMark(const AWS_JsonWriter_t* writer, AWS_JsonMark_t* mark);
+
+void AWS_JsonRewind(AWS_JsonWriter_t* writer, const AWS_JsonMark_t* mark);
+
+size_t AWS_JsonLength(const AWS_JsonWriter_t* writer);
+
+size_t AWS_JsonRemaining(const AWS_JsonWriter_t* writer);
+
+
+#endif
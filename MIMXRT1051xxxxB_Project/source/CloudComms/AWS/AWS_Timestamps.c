@@ -12,6 +12,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_AWS
+
 #include "AWS_Timestamps.h"
 #include "ECOM_Api.h"
 #include "LSD_Types.h"
@@ -166,12 +168,16 @@ static void _TimestampCorrectionQueueListener(MessageQueue_t mq)
                 else
                 {
                     ECOM_DeltaMessage_t* pDeltaMessage = (ECOM_DeltaMessage_t*)buffer;
+                    EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+                    uint16_t numProperties;
+                    const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(pDeltaMessage, scratch, &numProperties);
                     _TimestampCheck(
                             pDeltaMessage->destinationId,
                             pDeltaMessage->deviceId,
                             pDeltaMessage->propertyGroup,
-                            pDeltaMessage->numProperties,
-                            pDeltaMessage->deltasBuffer);
+                            numProperties,
+                            deltas);
+                    ECOM_ReleaseDeltaMessage(pDeltaMessage);
                 }
                 break;
 
@@ -14,8 +14,21 @@
  *
  *****************************************************************************/
 
+// Properties available at start up. The pool grows in chunks of
+// LSD_PROPERTY_CHUNK_SIZE up to LSD_PROPERTY_POOL_MAX_SIZE.
 #define LSD_PROPERTY_POOL_SIZE (256)
+#define LSD_PROPERTY_CHUNK_SIZE (64)
+#define LSD_PROPERTY_POOL_MAX_SIZE (4096)
 
+// The object table is sized at start up from free heap. It always has room
+// for at least LSD_MAX_THING things plus the gateway, and never more than
+// LSD_MAX_THING_LIMIT objects.
 #define LSD_MAX_THING (12)
+#define LSD_MAX_THING_LIMIT (128)
+
+// Share of free heap the object table may claim, and the number of
+// properties assumed per thing when working out how many things fit.
+#define LSD_OBJECT_STORE_HEAP_PERCENT (25)
+#define LSD_PROPERTIES_PER_THING (32)
 
 #endif
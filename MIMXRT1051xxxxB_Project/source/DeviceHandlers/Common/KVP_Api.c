@@ -11,6 +11,7 @@
  *
  *****************************************************************************/
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
@@ -351,7 +352,7 @@ bool KVP_GetInt(const char* key, const char* kvp, int32_t* value)
         temp[length] = 0;
 
         ////////if (sscanf(temp, "%8d", value) == 1)	//////// [RE:format]
-        if (sscanf(temp, "%8ld", value) == 1)
+        if (sscanf(temp, "%8" SCNd32, value) == 1)
         {
             result = true;
         }
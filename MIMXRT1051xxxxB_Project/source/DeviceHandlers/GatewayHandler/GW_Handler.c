@@ -39,7 +39,7 @@ static EnsoDeviceId_t _gatewayDeviceId = { 0 };
  * \return Success or Error code
  *
  */
-static EnsoErrorCode_e _ResetDevice(EnsoPropertyDelta_t* delta)
+static EnsoErrorCode_e _ResetDevice(const EnsoPropertyDelta_t* delta)
 {
     /* Delta reports reset time (timestamp) */
     uint32_t timestamp = delta->propertyValue.uint32Value;
@@ -191,18 +191,23 @@ void GW_Handler(MessageQueue_t mq)
         else if (DESIRED_GROUP != dm->propertyGroup)
         {
             LOG_Error("Expected DESIRED_GROUP(%d), got %d", DESIRED_GROUP, dm->propertyGroup);
+            ECOM_ReleaseDeltaMessage(dm);
         }
         else if (GW_HANDLER != dm->destinationId)
         {
             LOG_Error("Expected Destination ID(%d), got %d", GW_HANDLER, dm->destinationId);
+            ECOM_ReleaseDeltaMessage(dm);
         }
         else
         {
             EnsoErrorCode_e retVal;
+            EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+            uint16_t numProperties;
+            const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(dm, scratch, &numProperties);
 
-            for (int i = 0; i < dm->numProperties; i++)
+            for (int i = 0; i < numProperties; i++)
             {
-                EnsoPropertyDelta_t* delta = &dm->deltasBuffer[i];
+                const EnsoPropertyDelta_t* delta = &deltas[i];
 
                 switch (delta->agentSidePropertyID)
                 {
@@ -280,6 +285,7 @@ void GW_Handler(MessageQueue_t mq)
                         break;
                 }
             }
+            ECOM_ReleaseDeltaMessage(dm);
         }
     }
 }
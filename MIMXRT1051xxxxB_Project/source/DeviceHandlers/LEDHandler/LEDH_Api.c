@@ -233,12 +233,16 @@ static void _LEDH_MessageQueueListener(MessageQueue_t mq)
                 else
                 {
                     ECOM_DeltaMessage_t* pDeltaMessage = (ECOM_DeltaMessage_t*)buffer;
+                    EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+                    uint16_t numProperties;
+                    const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(pDeltaMessage, scratch, &numProperties);
                     _LEDH_OnLEDHandler(
                             pDeltaMessage->destinationId,
                             pDeltaMessage->deviceId,
                             pDeltaMessage->propertyGroup,
-                            pDeltaMessage->numProperties,
-                            pDeltaMessage->deltasBuffer);
+                            numProperties,
+                            deltas);
+                    ECOM_ReleaseDeltaMessage(pDeltaMessage);
                 }
                 break;
 
@@ -67,6 +67,13 @@ const char KEY_MODEL [6] = "model";
  * Type Definitions
  *****************************************************************************/
 
+// A single desired property change, held until the simulated device responds
+typedef struct
+{
+    EnsoDeviceId_t deviceId;
+    EnsoPropertyDelta_t delta;
+} _DelayedUpdate_t;
+
 /*!****************************************************************************
  * Private Variables
  *****************************************************************************/
@@ -233,8 +240,10 @@ static EnsoErrorCode_e _CreateBlobProperty(EnsoObject_t* owningObject,
     defaultValues[REPORTED_GROUP].memoryHandle = "";
     */
     //////// [RE:workaround] Something is wrong with the above. memoryHandle == void*. Also not sure incoming from AWS supports memoryHandle type.
-    defaultValues[DESIRED_GROUP].int32Value = 0;
-    defaultValues[REPORTED_GROUP].int32Value = 0;
+    // A NULL handle creates an empty blob, zeroing int32Value leaves half of
+    // the handle unset where pointers are 64 bits
+    defaultValues[DESIRED_GROUP].memoryHandle = NULL;
+    defaultValues[REPORTED_GROUP].memoryHandle = NULL;
 
     EnsoErrorCode_e result = LSD_CreateProperty(owningObject, agentPropertyId,
             cloudPropertyName, evBlobHandle, PROPERTY_PUBLIC, false, false, defaultValues);
@@ -555,12 +564,15 @@ static void _MessageQueueListener(MessageQueue_t mq)
                 {
                     ECOM_DeltaMessage_t* pDeltaMessage =
                             (ECOM_DeltaMessage_t*) buffer;
+                    EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+                    uint16_t numProperties;
+                    const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(pDeltaMessage, scratch, &numProperties);
 
                     // Call PropertyUpdate function so that we work with message
                     // queue and when function is called directly
                     _PropertyUpdate(pDeltaMessage->destinationId, pDeltaMessage->deviceId,
-                            pDeltaMessage-> propertyGroup, pDeltaMessage->numProperties,
-                            pDeltaMessage->deltasBuffer);
+                            pDeltaMessage-> propertyGroup, numProperties, deltas);
+                    ECOM_ReleaseDeltaMessage(pDeltaMessage);
                 }
                 break;
 
@@ -778,14 +790,12 @@ static EnsoErrorCode_e _DeviceUpdate(const EnsoDeviceId_t* publishedDeviceId,
                  else
                  {
                      // Respond value is the time in seconds in takes us to respond to the desired message
-                     ECOM_DeltaMessage_t* message = malloc(sizeof(ECOM_DeltaMessage_t));
+                     _DelayedUpdate_t* message = malloc(sizeof(_DelayedUpdate_t));
 
                      if (message)
                      {
-                         message->numProperties = 1;
                          message->deviceId = *publishedDeviceId;
-                         message->propertyGroup = DESIRED_GROUP;
-                         message->deltasBuffer[0] = delta;
+                         message->delta = delta;
 
                          // Optimise this path if respond is zero
                          if (respondValue == 0)
@@ -1590,7 +1600,7 @@ static bool _GetOfflineValueForDevice(const EnsoDeviceId_t* deviceId)
 /**
  * \name   _TimerCallBackUpdateProperty
  * \brief  When timer expires update reported value for the property
- * \param  p     pointer to copy of delta message block
+ * \param  p     pointer to copy of the delayed update
  */
 static void _TimerCallbackUpdateProperty(void* p)
 {
@@ -1600,16 +1610,11 @@ static void _TimerCallbackUpdateProperty(void* p)
         return;
     }
 
-    ECOM_DeltaMessage_t* message = (ECOM_DeltaMessage_t*) p;
-
-    if (message->numProperties != 1)
-    {
-        LOG_Warning("We are only expecting 1 property value in callback?");
-    }
+    _DelayedUpdate_t* message = (_DelayedUpdate_t*) p;
 
     // Is this update simple?
     EnsoProperty_t* property =
-            LSD_GetPropertyByAgentSideId(&message->deviceId, message->deltasBuffer[0].agentSidePropertyID);
+            LSD_GetPropertyByAgentSideId(&message->deviceId, message->delta.agentSidePropertyID);
 
     if (property)
     {
@@ -1623,8 +1628,8 @@ static void _TimerCallbackUpdateProperty(void* p)
             {
                 // Simple update, we have the value in the delta
                 if (LSD_SetPropertyValueByAgentSideId(TEST_DEVICE_HANDLER, &message->deviceId,
-                    REPORTED_GROUP, message->deltasBuffer[0].agentSidePropertyID,
-                    message->deltasBuffer[0].propertyValue) != eecNoError)
+                    REPORTED_GROUP, message->delta.agentSidePropertyID,
+                    message->delta.propertyValue) != eecNoError)
                 {
                     LOG_Error("Failed to set REPORTED_GROUP for value in %s", property->cloudName);
                 }
@@ -1638,12 +1643,12 @@ static void _TimerCallbackUpdateProperty(void* p)
                 size_t bytesCopied;
 
                 if (LSD_GetPropertyBufferByAgentSideId(&message->deviceId, DESIRED_GROUP,
-                    message->deltasBuffer[0].agentSidePropertyID, MAX_TEMPLATE_SIZE, desiredValue, &bytesCopied)
+                    message->delta.agentSidePropertyID, MAX_TEMPLATE_SIZE, desiredValue, &bytesCopied)
                     == eecNoError)
                 {
                     // Copy the desired value to the reported value
                     if (LSD_SetPropertyBufferByAgentSideId(TEST_DEVICE_HANDLER, &message->deviceId,
-                            REPORTED_GROUP, message->deltasBuffer[0].agentSidePropertyID, MAX_TEMPLATE_SIZE,
+                            REPORTED_GROUP, message->delta.agentSidePropertyID, MAX_TEMPLATE_SIZE,
                             desiredValue, &bytesCopied) != eecNoError)
                     {
                         LOG_Error("Failed to set REPORTED_GROUP for string in %s", property->cloudName);
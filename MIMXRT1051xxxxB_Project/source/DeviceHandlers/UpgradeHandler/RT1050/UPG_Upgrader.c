@@ -16,13 +16,26 @@
 #include "UPG_Upgrader.h"
 #include "LOG_Api.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
 /************************* DEFINES & MACROS ***********************************/
-#define ENCRYPTED_OTA                   0
+/*
+ * 1: the cloud serves signed SJHF images, built by fwpack, and upgrd_key and
+ *    upgrd_hash are the install key and header hash. The build also needs
+ *    UPG_SIGNING_KEY, see UPG_SigningKey.h.
+ * 0: the cloud serves the raw image and upgrd_hash is its SHA-256
+ */
+#ifndef SIGNED_OTA
+#define SIGNED_OTA                      0
+#endif
 
-#define HTTPS_PORT                      443
+#if SIGNED_OTA
+#include "UPG_SigningKey.h"
+#endif
+
+#define HTTPS_PORT                      "443"
 
 
 /************************* FUNCTION PROTOTYPE *********************************/
@@ -30,13 +43,7 @@
 extern void AWS_Stop(void);
 extern void HAL_Reboot(void);
 
-extern int https_update_ota(char *host, int port, char *resource);
-extern int https_ram_update_ota(char *host, int port, char *resource, char* destBuffer, int destBufferSize);
-
-/************************** GLOBAL VARIABLES **********************************/
-#if ENCRYPTED_OTA == 1
-char upgradeBuffer[1024 * 1024];
-#endif
+extern int https_update_ota(char *host, char *port, char *resource, char *key, char *hash, bool signedImage);
 
 
 /****************************** FUNCTIONS *************************************/
@@ -91,24 +98,7 @@ int UPG_Upgrader(char * url, char * key, char * hash)
     /* Divide url string into two different string (Host and Resource Path) */
     *seperatorPtr = '\0';
 
-#if ENCRYPTED_OTA == 0
-    int ret = https_update_ota(url, HTTPS_PORT, resourceName);
-#else
-    #error "Not fully implemented! Works without image verification!"
-    /*
-     * https_update_encrpted_ota_on_ram() function is implemented for encrypted
-     * OTA updates.
-     * It
-     *  1 - Collects Encrypted data in RAM (upgradeBuffer) first using HTTPS (Secure)
-     *  2 - Checks checksum
-     *
-     *  3 - [MISSING Implementation!!!] It needs to verify image and encrypt image.
-     *
-     *  4 - Writes image to flash.
-     *  5 - Modifies A/B images to run jump to latest image.
-     */
-    int ret = https_update_encrpted_ota_on_ram(url, HTTPS_PORT, resourceName, upgradeBuffer, sizeof(upgradeBuffer));
-#endif
+    int ret = https_update_ota(url, HTTPS_PORT, resourceName, key, hash, SIGNED_OTA);
 
     if (ret != 0)
     {
@@ -190,16 +190,21 @@ void UPG_Handler(MessageQueue_t mq)
         else if (DESIRED_GROUP != dm->propertyGroup)
         {
             LOG_Error("Expected DESIRED_GROUP(%d), got %d", DESIRED_GROUP, dm->propertyGroup);
+            ECOM_ReleaseDeltaMessage(dm);
         }
         else if (UPGRADE_HANDLER != dm->destinationId)
         {
             LOG_Error("Expected UPGRADE_HANDLER(%d), got %d", UPGRADE_HANDLER, dm->destinationId);
+            ECOM_ReleaseDeltaMessage(dm);
         }
         else
         {
-            for (int i = 0; i < dm->numProperties; i++)
+            EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+            uint16_t numProperties;
+            const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(dm, scratch, &numProperties);
+            for (int i = 0; i < numProperties; i++)
             {   
-                EnsoPropertyDelta_t    delta = dm->deltasBuffer[i];
+                EnsoPropertyDelta_t    delta = deltas[i];
                 EnsoAgentSidePropertyId_t id = delta.agentSidePropertyID;
                 EnsoProperty_t * prop = LSD_GetPropertyByAgentSideId(&gwid, delta.agentSidePropertyID);
                 char name[LSD_PROPERTY_NAME_BUFFER_SIZE] = "";
@@ -247,6 +252,7 @@ void UPG_Handler(MessageQueue_t mq)
                     }
                 }
             }
+            ECOM_ReleaseDeltaMessage(dm);
             LOG_Trace("url:%s key:%s hash:%s fwnam:%s trgrd:%u",
                       url  ? url  : "", key   ? key   : "",
                       hash ? hash : "", fwnam ? fwnam : "", trgrd);
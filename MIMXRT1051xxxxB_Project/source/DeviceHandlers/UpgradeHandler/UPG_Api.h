@@ -22,7 +22,8 @@ typedef enum
     UPGRADE_ERR_DOWNLOAD_FAILED     = 2,
     UPGRADE_ERR_DECRYPTION_FAILED   = 3,
     UPGRADE_ERR_HASH_CHECK_FAILED   = 4,
-    UPGRADE_ERR_FILE_CONTENTS_ERROR = 5
+    UPGRADE_ERR_FILE_CONTENTS_ERROR = 5,
+    UPGRADE_ERR_SIGNATURE_FAILED    = 6
 } UPG_Error_t;
 
 typedef enum 
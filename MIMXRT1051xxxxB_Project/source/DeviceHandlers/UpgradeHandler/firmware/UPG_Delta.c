@@ -0,0 +1,377 @@
+/*!****************************************************************************
+ *
+ * \file UPG_Delta.c
+ *
+ * \brief Streaming applier for delta firmware patches
+ *
+ * The patch is parsed a byte at a time where it holds varints and a chunk
+ * at a time where it holds data, so it can be fed in pieces of any size.
+ * Target bytes go to the sink as soon as they are known; like segment data
+ * in UPG_Verify.c they are only trusted once UPG_DeltaFinish has checked
+ * the target hash.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <string.h>
+
+#include "UPG_Delta.h"
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+static UPG_Error_t Fail(UPG_Delta_t * delta, UPG_Error_t error, const char * reason)
+{
+    delta->state = UPG_DELTA_FAILED;
+    delta->error = error;
+    delta->reason = reason;
+    return error;
+}
+
+static uint32_t ReadLE32(const uint8_t * bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/* Hash the target and pass it on */
+static UPG_Error_t Emit(UPG_Delta_t * delta, const uint8_t * data, size_t length)
+{
+    mbedtls_sha256_update(&delta->sha, data, length);
+    if (delta->sink && delta->sink(delta->context, data, length) != 0)
+    {
+        return Fail(delta, UPGRADE_ERR_DOWNLOAD_FAILED, "write failed");
+    }
+    delta->targetDone += length;
+    return UPGRADE_ERR_NONE;
+}
+
+static UPG_Error_t ReadSource(UPG_Delta_t * delta, size_t length)
+{
+    if (delta->read(delta->context, delta->sourceCursor, delta->buffer, length) != 0)
+    {
+        return Fail(delta, UPGRADE_ERR_DOWNLOAD_FAILED, "source read failed");
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+/* Copy source bytes at the cursor to the target */
+static UPG_Error_t CopySource(UPG_Delta_t * delta, uint32_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk = length < sizeof delta->buffer ? length : sizeof delta->buffer;
+        if (ReadSource(delta, chunk) != UPGRADE_ERR_NONE ||
+            Emit(delta, delta->buffer, chunk) != UPGRADE_ERR_NONE)
+        {
+            return delta->error;
+        }
+        delta->sourceCursor += chunk;
+        length -= chunk;
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+/* Whole header received: check the patch is for the image we have */
+static UPG_Error_t ProcessHeader(UPG_Delta_t * delta)
+{
+    const uint8_t * header = delta->header;
+
+    if (memcmp(header, UPG_DELTA_MAGIC, 4) != 0)
+    {
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "not a delta patch");
+    }
+    if (ReadLE32(&header[4]) != UPG_DELTA_VERSION)
+    {
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "unsupported patch version");
+    }
+    delta->sourceBytes = ReadLE32(&header[8]);
+    delta->targetBytes = ReadLE32(&header[12]);
+    if (delta->targetBytes == 0)
+    {
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "empty target");
+    }
+
+    uint8_t computed[FIRMWARE_HASH_BYTES];
+    mbedtls_sha256_starts(&delta->sha, 0);
+    for (delta->sourceCursor = 0; delta->sourceCursor < delta->sourceBytes; )
+    {
+        uint32_t chunk = delta->sourceBytes - delta->sourceCursor;
+        if (chunk > sizeof delta->buffer)
+        {
+            chunk = sizeof delta->buffer;
+        }
+        if (ReadSource(delta, chunk) != UPGRADE_ERR_NONE)
+        {
+            return delta->error;
+        }
+        mbedtls_sha256_update(&delta->sha, delta->buffer, chunk);
+        delta->sourceCursor += chunk;
+    }
+    mbedtls_sha256_finish(&delta->sha, computed);
+    if (memcmp(computed, &header[16], FIRMWARE_HASH_BYTES) != 0)
+    {
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "patch is for another image");
+    }
+
+    mbedtls_sha256_starts(&delta->sha, 0);
+    delta->sourceCursor = 0;
+    delta->state = UPG_DELTA_DIFF_BYTES;
+    return UPGRADE_ERR_NONE;
+}
+
+/* Diff and extra data of a record done: seek and start the next one */
+static UPG_Error_t EndRecord(UPG_Delta_t * delta)
+{
+    int64_t cursor = (int64_t)delta->sourceCursor + delta->seek;
+    if (cursor < 0 || cursor > delta->sourceBytes)
+    {
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "seek out of the source");
+    }
+    delta->sourceCursor = cursor;
+    delta->state = delta->targetDone == delta->targetBytes ? UPG_DELTA_DONE : UPG_DELTA_DIFF_BYTES;
+    return UPGRADE_ERR_NONE;
+}
+
+/* Diff pair done: another pair, the extra data or the next record */
+static UPG_Error_t EndPair(UPG_Delta_t * delta)
+{
+    if (delta->diffLeft > 0)
+    {
+        delta->state = UPG_DELTA_SAME;
+        return UPGRADE_ERR_NONE;
+    }
+    if (delta->extraLeft > 0)
+    {
+        delta->state = UPG_DELTA_EXTRA_DATA;
+        return UPGRADE_ERR_NONE;
+    }
+    return EndRecord(delta);
+}
+
+/* A varint of the record header or of a diff pair is complete */
+static UPG_Error_t ProcessVarint(UPG_Delta_t * delta, uint32_t value)
+{
+    switch (delta->state)
+    {
+    case UPG_DELTA_DIFF_BYTES:
+        if (value > delta->targetBytes - delta->targetDone ||
+            value > delta->sourceBytes - delta->sourceCursor)
+        {
+            return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "diff out of range");
+        }
+        delta->diffLeft = value;
+        delta->state = UPG_DELTA_EXTRA_BYTES;
+        return UPGRADE_ERR_NONE;
+
+    case UPG_DELTA_EXTRA_BYTES:
+        if (value > delta->targetBytes - delta->targetDone - delta->diffLeft)
+        {
+            return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "extra out of range");
+        }
+        delta->extraLeft = value;
+        delta->state = UPG_DELTA_SEEK;
+        return UPGRADE_ERR_NONE;
+
+    case UPG_DELTA_SEEK:
+        // Seeks are applied once the diff has moved the cursor past it
+        delta->seek = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+        return EndPair(delta);
+
+    case UPG_DELTA_SAME:
+        if (value > delta->diffLeft)
+        {
+            return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "diff overrun");
+        }
+        delta->diffLeft -= value;
+        delta->state = UPG_DELTA_CHANGED;
+        return CopySource(delta, value);
+
+    case UPG_DELTA_CHANGED:
+        if (value > delta->diffLeft)
+        {
+            return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "diff overrun");
+        }
+        delta->runLeft = value;
+        if (value > 0)
+        {
+            delta->state = UPG_DELTA_CHANGED_DATA;
+            return UPGRADE_ERR_NONE;
+        }
+        return EndPair(delta);
+
+    default:
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "bad state");
+    }
+}
+
+/* Add changed bytes to the source at the cursor */
+static UPG_Error_t ApplyChanged(UPG_Delta_t * delta, const uint8_t * data, size_t length)
+{
+    if (ReadSource(delta, length) != UPGRADE_ERR_NONE)
+    {
+        return delta->error;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        delta->buffer[i] += data[i];
+    }
+    if (Emit(delta, delta->buffer, length) != UPGRADE_ERR_NONE)
+    {
+        return delta->error;
+    }
+    delta->sourceCursor += length;
+    delta->diffLeft -= length;
+    delta->runLeft -= length;
+    return delta->runLeft == 0 ? EndPair(delta) : UPGRADE_ERR_NONE;
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \brief   Start applying a patch
+ *
+ * \param   delta       State, owned by the caller
+ * \param   read        Reads the source image
+ * \param   sink        Where the target image goes, may be NULL
+ * \param   context     Passed to read and sink
+ */
+void UPG_DeltaInit(UPG_Delta_t * delta, UPG_DeltaRead_t read, UPG_DeltaSink_t sink, void * context)
+{
+    memset(delta, 0, sizeof *delta);
+    delta->state = UPG_DELTA_HEADER;
+    delta->read = read;
+    delta->sink = sink;
+    delta->context = context;
+    mbedtls_sha256_init(&delta->sha);
+}
+
+/**
+ * \brief   Feed the next bytes of the patch, in any size of piece
+ *
+ * \return  UPGRADE_ERR_NONE while the patch is good so far. Once an error
+ *          is returned every later call returns it too.
+ */
+UPG_Error_t UPG_DeltaWrite(UPG_Delta_t * delta, const uint8_t * data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t chunk;
+
+        switch (delta->state)
+        {
+        case UPG_DELTA_FAILED:
+            return delta->error;
+
+        case UPG_DELTA_DONE:
+            return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "data after the end of the patch");
+
+        case UPG_DELTA_HEADER:
+            chunk = UPG_DELTA_HEADER_BYTES - delta->headerBytes;
+            if (chunk > length)
+            {
+                chunk = length;
+            }
+            memcpy(&delta->header[delta->headerBytes], data, chunk);
+            delta->headerBytes += chunk;
+            if (delta->headerBytes == UPG_DELTA_HEADER_BYTES && ProcessHeader(delta) != UPGRADE_ERR_NONE)
+            {
+                return delta->error;
+            }
+            break;
+
+        case UPG_DELTA_CHANGED_DATA:
+            chunk = length;
+            if (chunk > delta->runLeft)
+            {
+                chunk = delta->runLeft;
+            }
+            if (chunk > sizeof delta->buffer)
+            {
+                chunk = sizeof delta->buffer;
+            }
+            if (ApplyChanged(delta, data, chunk) != UPGRADE_ERR_NONE)
+            {
+                return delta->error;
+            }
+            break;
+
+        case UPG_DELTA_EXTRA_DATA:
+            chunk = length;
+            if (chunk > delta->extraLeft)
+            {
+                chunk = delta->extraLeft;
+            }
+            if (Emit(delta, data, chunk) != UPGRADE_ERR_NONE)
+            {
+                return delta->error;
+            }
+            delta->extraLeft -= chunk;
+            if (delta->extraLeft == 0 && EndRecord(delta) != UPGRADE_ERR_NONE)
+            {
+                return delta->error;
+            }
+            break;
+
+        default:
+            // One byte of a varint
+            chunk = 1;
+            if (delta->varintShift == 28 && (*data & 0x70) != 0)
+            {
+                return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "varint too big");
+            }
+            delta->varint |= (uint32_t)(*data & 0x7f) << delta->varintShift;
+            delta->varintShift += 7;
+            if ((*data & 0x80) == 0)
+            {
+                uint32_t value = delta->varint;
+                delta->varint = 0;
+                delta->varintShift = 0;
+                if (ProcessVarint(delta, value) != UPGRADE_ERR_NONE)
+                {
+                    return delta->error;
+                }
+            }
+            break;
+        }
+
+        data += chunk;
+        length -= chunk;
+    }
+    return delta->state == UPG_DELTA_FAILED ? delta->error : UPGRADE_ERR_NONE;
+}
+
+/**
+ * \brief   End of the patch
+ *
+ * \return  UPGRADE_ERR_NONE only if the whole target was written and its
+ *          hash matches
+ */
+UPG_Error_t UPG_DeltaFinish(UPG_Delta_t * delta)
+{
+    if (delta->state == UPG_DELTA_FAILED)
+    {
+        return delta->error;
+    }
+    if (delta->state != UPG_DELTA_DONE)
+    {
+        return Fail(delta, UPGRADE_ERR_FILE_CONTENTS_ERROR, "patch truncated");
+    }
+
+    uint8_t computed[FIRMWARE_HASH_BYTES];
+    mbedtls_sha256_finish(&delta->sha, computed);
+    if (memcmp(computed, &delta->header[16 + FIRMWARE_HASH_BYTES], FIRMWARE_HASH_BYTES) != 0)
+    {
+        return Fail(delta, UPGRADE_ERR_HASH_CHECK_FAILED, "target hash mismatch");
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+void UPG_DeltaFree(UPG_Delta_t * delta)
+{
+    mbedtls_sha256_free(&delta->sha);
+}
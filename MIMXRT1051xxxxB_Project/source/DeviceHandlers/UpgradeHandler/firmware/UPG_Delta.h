@@ -0,0 +1,113 @@
+/*!****************************************************************************
+ *
+ * \file UPG_Delta.h
+ *
+ * \brief Streaming applier for delta firmware patches
+ *
+ * A patch rebuilds a new image from the one already in flash, so only the
+ * differences are downloaded. It is applied from the active partition into
+ * the inactive one as it arrives, with a few hundred bytes of RAM.
+ *
+ * Patch layout, as built by "fwpack diff":
+ *
+ *  header  UPG_DELTA_HEADER_BYTES, little endian
+ *          "SJDP", version, source bytes, target bytes,
+ *          SHA-256 of the source, SHA-256 of the target
+ *  records until the target is complete, each
+ *          varint diff bytes, varint extra bytes, zigzag varint seek
+ *          diff:  pairs of varint same bytes, varint changed bytes and the
+ *                 changed bytes, adding up to diff bytes. Target bytes are
+ *                 the source bytes at the source cursor plus the changed
+ *                 bytes, mod 256; same bytes are copied unchanged.
+ *          extra: extra bytes, copied to the target as they are
+ *          then the source cursor moves on by seek
+ *
+ * The source is hashed and checked before anything is written, and the
+ * target hash is checked by UPG_DeltaFinish.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef UPG_DELTA_H
+#define UPG_DELTA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/sha256.h"
+
+#include "UPG_Api.h"
+#include "UPG_Firmware.h"
+
+#define UPG_DELTA_MAGIC         "SJDP"
+#define UPG_DELTA_VERSION       1
+#define UPG_DELTA_HEADER_BYTES  (16 + 2 * FIRMWARE_HASH_BYTES)
+
+/* Source and output bytes handled at a time */
+#define UPG_DELTA_CHUNK_BYTES   256
+
+/**
+ * \brief Reads the source image
+ *
+ * \return 0 on success
+ */
+typedef int (*UPG_DeltaRead_t)(void * context, uint32_t offset, uint8_t * data, size_t length);
+
+/**
+ * \brief Receives the target image, in order
+ *
+ * \return 0 to carry on, anything else stops the patch
+ */
+typedef int (*UPG_DeltaSink_t)(void * context, const uint8_t * data, size_t length);
+
+typedef enum
+{
+    UPG_DELTA_HEADER,
+    UPG_DELTA_DIFF_BYTES,           // Varints of the record header
+    UPG_DELTA_EXTRA_BYTES,
+    UPG_DELTA_SEEK,
+    UPG_DELTA_SAME,                 // Varints of a diff pair
+    UPG_DELTA_CHANGED,
+    UPG_DELTA_CHANGED_DATA,
+    UPG_DELTA_EXTRA_DATA,
+    UPG_DELTA_DONE,
+    UPG_DELTA_FAILED
+} UPG_DeltaState_t;
+
+typedef struct
+{
+    UPG_DeltaState_t state;
+    UPG_Error_t error;
+    const char * reason;            // Why it failed, for the log
+
+    uint8_t header[UPG_DELTA_HEADER_BYTES];
+    uint32_t headerBytes;
+    uint32_t sourceBytes;
+    uint32_t targetBytes;
+
+    uint32_t varint;                // Varint being read
+    int varintShift;
+    uint32_t diffLeft;              // Bytes of the record's diff still to come
+    uint32_t extraLeft;
+    uint32_t runLeft;               // Bytes of the changed run still to come
+    int32_t seek;                   // Applied at the end of the record
+    uint32_t sourceCursor;
+    uint32_t targetDone;
+
+    mbedtls_sha256_context sha;
+    uint8_t buffer[UPG_DELTA_CHUNK_BYTES];
+
+    UPG_DeltaRead_t read;
+    UPG_DeltaSink_t sink;
+    void * context;
+} UPG_Delta_t;
+
+extern void UPG_DeltaInit(UPG_Delta_t * delta, UPG_DeltaRead_t read, UPG_DeltaSink_t sink, void * context);
+extern UPG_Error_t UPG_DeltaWrite(UPG_Delta_t * delta, const uint8_t * data, size_t length);
+extern UPG_Error_t UPG_DeltaFinish(UPG_Delta_t * delta);
+extern void UPG_DeltaFree(UPG_Delta_t * delta);
+
+#endif /* UPG_DELTA_H */
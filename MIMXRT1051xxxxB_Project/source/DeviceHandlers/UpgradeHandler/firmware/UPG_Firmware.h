@@ -89,6 +89,8 @@
 #define FIRMWARE_FOURCC_KERNEL  "KRNL"
 #define FIRMWARE_FOURCC_ROOTFS  "RTFS"
 #define FIRMWARE_FOURCC_DTB     "DTB "
+/* Patch against the active image, see UPG_Delta.h */
+#define FIRMWARE_FOURCC_DELTA   "DLTA"
 
 /* Asset file */
 #define FIRMWARE_FOURCC_ASSET_PART     "ASST"
@@ -0,0 +1,35 @@
+/*!****************************************************************************
+ *
+ * \file UPG_SigningKey.h
+ *
+ * \brief Public key firmware images must be signed with
+ *
+ * Builds with SIGNED_OTA define UPG_SIGNING_KEY to the release key, printed
+ * by "fwpack pubkey", on the compiler command line. Without it they must opt
+ * in to the development key below with UPG_DEV_SIGNING_KEY=1. Its private
+ * half is fwpack/dev_signing_key.pem, so anyone can sign images for it.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef UPG_SIGNING_KEY_H
+#define UPG_SIGNING_KEY_H
+
+#ifndef UPG_SIGNING_KEY
+#if SIGNED_OTA && !UPG_DEV_SIGNING_KEY
+#error "SIGNED_OTA needs UPG_SIGNING_KEY, or UPG_DEV_SIGNING_KEY=1 to accept images signed with the development key"
+#endif
+#define UPG_SIGNING_KEY \
+{ \
+    0x04, 0x87, 0xe2, 0x79, 0x73, 0x58, 0x90, 0xeb, 0x7e, 0xd1, 0x17, 0x6c, \
+    0x49, 0xb3, 0xc3, 0x67, 0xc4, 0xa0, 0xfe, 0x2b, 0x0f, 0x5b, 0xb4, 0x96, \
+    0x99, 0x3b, 0xe5, 0x1b, 0xe4, 0xe7, 0x63, 0xf5, 0x85, 0x67, 0xb8, 0x69, \
+    0xa2, 0xde, 0xfa, 0xa6, 0x46, 0x2f, 0xa0, 0x08, 0x56, 0xa3, 0x93, 0x3a, \
+    0x9c, 0xba, 0x9d, 0xbd, 0x8b, 0x14, 0x17, 0xa3, 0x97, 0xd1, 0xa2, 0x68, \
+    0xfe, 0xc9, 0xe9, 0x28, 0x11 \
+}
+#endif
+
+#endif /* UPG_SIGNING_KEY_H */
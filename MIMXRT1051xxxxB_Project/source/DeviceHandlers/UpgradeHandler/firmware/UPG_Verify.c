@@ -0,0 +1,532 @@
+/*!****************************************************************************
+ *
+ * \file UPG_Verify.c
+ *
+ * \brief Streaming verifier and decryptor for SJHF firmware images
+ *
+ * Nothing reaches the sink until the header hash and signature have been
+ * checked. Segment data does reach it before the segment hash can be
+ * checked, so a failure after the header means the partition written so far
+ * must not be booted - the caller simply does not swap the active image.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbedtls/ecdsa.h"
+
+#include "UPG_Verify.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+/* Bytes decrypted at a time */
+#define UPG_VERIFY_CHUNK_BYTES  256
+
+_Static_assert(sizeof(firmware_intro_t) <= FIRMWARE_INTRO_BYTES, "intro does not fit");
+_Static_assert(sizeof(firmware_part_t) <= FIRMWARE_PART_BYTES, "part does not fit");
+_Static_assert(sizeof(firmware_hash_t) == FIRMWARE_HASH_BYTES, "hash size");
+_Static_assert(sizeof(firmware_key_t) == FIRMWARE_KEY_BYTES, "key size");
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+static UPG_Error_t Fail(UPG_Verify_t * verify, UPG_Error_t error, const char * reason)
+{
+    verify->state = UPG_VERIFY_FAILED;
+    verify->error = error;
+    verify->reason = reason;
+    return error;
+}
+
+/**
+ * \brief   Decode a hex string
+ *
+ * \return  1 if bytes were decoded, 0 if the string is empty, -1 if it is
+ *          not 2 * length hex digits
+ */
+static int HexToBytes(const char * hex, uint8_t * bytes, size_t length)
+{
+    if (hex == NULL || *hex == '\0')
+    {
+        return 0;
+    }
+    if (strlen(hex) != 2 * length)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < 2 * length; i++)
+    {
+        char c = hex[i];
+        int nibble;
+        if (c >= '0' && c <= '9')
+            nibble = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            nibble = c - 'A' + 10;
+        else
+            return -1;
+        bytes[i / 2] = (i & 1) ? (bytes[i / 2] | nibble) : (nibble << 4);
+    }
+    return 1;
+}
+
+static uint32_t Padded(uint32_t bytes)
+{
+    return (bytes + FIRMWARE_ENC_BLK_BYTES - 1) & ~(uint32_t)(FIRMWARE_ENC_BLK_BYTES - 1);
+}
+
+static bool IsUnused(const char fourcc[4])
+{
+    static const char unused[4] = { '\xff', '\xff', '\xff', '\xff' };
+    return memcmp(fourcc, unused, sizeof unused) == 0;
+}
+
+static bool IsKnownPart(const char fourcc[4])
+{
+    static const char * const known[] =
+    {
+        FIRMWARE_FOURCC_UPGRADE,
+        FIRMWARE_FOURCC_OPERATIONAL,
+        FIRMWARE_FOURCC_RECOVERY,
+        FIRMWARE_FOURCC_BOOTLOADER,
+        FIRMWARE_FOURCC_ASSET_PART,
+    };
+    for (size_t i = 0; i < sizeof known / sizeof known[0]; i++)
+    {
+        if (memcmp(fourcc, known[i], 4) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool IsZeroKey(const firmware_key_t * key)
+{
+    for (size_t i = 0; i < sizeof key->key_data; i++)
+    {
+        if (key->key_data[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ReadPart(const UPG_Verify_t * verify, int index, firmware_part_t * part)
+{
+    memcpy(part, &verify->header[FIRMWARE_INTRO_BYTES + index * FIRMWARE_PART_BYTES], sizeof *part);
+}
+
+static int CountSegments(const firmware_part_t * part)
+{
+    int count = 0;
+    while (count < FIRMWARE_NR_SEGS && !IsUnused(part->segs[count].fourcc))
+    {
+        count++;
+    }
+    return count;
+}
+
+/* Check the signature over the header as stored */
+static bool SignatureVerifies(const UPG_Verify_t * verify)
+{
+    const uint8_t * sig = &verify->header[FIRMWARE_PUBKEY_OFFSET];
+    size_t sigBytes = sig[0] | (sig[1] << 8);
+    if (sigBytes == 0 || sigBytes > FIRMWARE_PUBKEY_BYTES)
+    {
+        return false;
+    }
+
+    uint8_t digest[FIRMWARE_HASH_BYTES];
+    mbedtls_sha256(verify->header, FIRMWARE_PUBKEY_OFFSET, digest, 0);
+
+    mbedtls_ecdsa_context ecdsa;
+    mbedtls_ecdsa_init(&ecdsa);
+    bool verifies =
+        mbedtls_ecp_group_load(&ecdsa.grp, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+        mbedtls_ecp_point_read_binary(&ecdsa.grp, &ecdsa.Q, verify->publicKey,
+                                      UPG_VERIFY_PUBLIC_KEY_BYTES) == 0 &&
+        mbedtls_ecdsa_read_signature(&ecdsa, digest, sizeof digest, &sig[2], sigBytes) == 0;
+    mbedtls_ecdsa_free(&ecdsa);
+    return verifies;
+}
+
+/* Check the layout is one contiguous run of parts and padded segments */
+static UPG_Error_t CheckLayout(UPG_Verify_t * verify)
+{
+    uint32_t expected = FIRMWARE_HEADER_BYTES;
+
+    for (int p = 0; p < verify->intro.nr_parts; p++)
+    {
+        firmware_part_t part;
+        ReadPart(verify, p, &part);
+        if (!IsKnownPart(part.fourcc))
+        {
+            // The fourcc is under the header encryption, so garbage here
+            // most likely means the wrong install key
+            return verify->haveKey ?
+                Fail(verify, UPGRADE_ERR_DECRYPTION_FAILED, "unknown part, wrong key?") :
+                Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "unknown part");
+        }
+        if (part.offset != expected)
+        {
+            return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "parts are not contiguous");
+        }
+
+        int count = CountSegments(&part);
+        if (count == 0)
+        {
+            return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "part has no segments");
+        }
+        uint32_t cursor = 0;
+        for (int s = 0; s < count; s++)
+        {
+            const firmware_segment_t * seg = &part.segs[s];
+            if (seg->offset != cursor || seg->bytes == 0 || seg->bytes > UPG_VERIFY_MAX_IMAGE_BYTES)
+            {
+                return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "bad segment");
+            }
+            cursor += Padded(seg->bytes);
+            if (cursor > UPG_VERIFY_MAX_IMAGE_BYTES)
+            {
+                return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "image too big");
+            }
+        }
+        if (part.bytes != cursor)
+        {
+            return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "part length mismatch");
+        }
+        expected += part.bytes;
+        if (expected > UPG_VERIFY_MAX_IMAGE_BYTES)
+        {
+            return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "image too big");
+        }
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+static void StartSegment(UPG_Verify_t * verify)
+{
+    verify->segmentDone = 0;
+    mbedtls_sha256_starts(&verify->segmentSha, 0);
+    memcpy(verify->counter, verify->part.segs[verify->segmentIndex].hash.hash_data, sizeof verify->counter);
+    verify->counterOffset = 0;
+}
+
+static void StartPart(UPG_Verify_t * verify)
+{
+    ReadPart(verify, verify->partIndex, &verify->part);
+    verify->segmentCount = CountSegments(&verify->part);
+    verify->segmentIndex = 0;
+    verify->encrypted = !IsZeroKey(&verify->part.key);
+    if (verify->encrypted)
+    {
+        mbedtls_aes_setkey_enc(&verify->aes, verify->part.key.key_data, 8 * FIRMWARE_KEY_BYTES);
+    }
+    mbedtls_sha256_starts(&verify->partSha, 0);
+    StartSegment(verify);
+}
+
+/* Whole header received: authenticate it, then decrypt and check it */
+static UPG_Error_t ProcessHeader(UPG_Verify_t * verify)
+{
+    uint8_t * header = verify->header;
+
+    if (verify->haveHash)
+    {
+        firmware_hash_t computed;
+        mbedtls_sha256(header, FIRMWARE_HEADER_BYTES, computed.hash_data, 0);
+        if (memcmp(&computed, &verify->hash, sizeof computed) != 0)
+        {
+            return Fail(verify, UPGRADE_ERR_HASH_CHECK_FAILED, "header hash mismatch");
+        }
+    }
+
+    if (memcmp(&header[offsetof(firmware_intro_t, fourcc)], FIRMWARE_FOURCC_HDR, 4) != 0)
+    {
+        return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "not an SJHF image");
+    }
+
+    if (!SignatureVerifies(verify))
+    {
+        return Fail(verify, UPGRADE_ERR_SIGNATURE_FAILED, "header signature");
+    }
+
+    if (verify->haveKey)
+    {
+        mbedtls_aes_context aes;
+        uint8_t counter[16];
+        uint8_t keyStream[16];
+        size_t counterOffset = 0;
+
+        memcpy(counter, header, sizeof counter);
+        mbedtls_aes_init(&aes);
+        mbedtls_aes_setkey_enc(&aes, verify->key.key_data, 8 * FIRMWARE_KEY_BYTES);
+        mbedtls_aes_crypt_ctr(&aes, FIRMWARE_PUBKEY_OFFSET - FIRMWARE_PLAINTEXT_BYTES,
+                              &counterOffset, counter, keyStream,
+                              &header[FIRMWARE_PLAINTEXT_BYTES], &header[FIRMWARE_PLAINTEXT_BYTES]);
+        mbedtls_aes_free(&aes);
+    }
+
+    memcpy(&verify->intro, header, sizeof verify->intro);
+    if (verify->intro.major != FIRMWARE_MAJOR)
+    {
+        return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "unsupported version");
+    }
+    if (verify->intro.nr_parts < 1 || verify->intro.nr_parts > UPG_VERIFY_MAX_PARTS)
+    {
+        return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "bad number of parts");
+    }
+    if (CheckLayout(verify) != UPGRADE_ERR_NONE)
+    {
+        return verify->error;
+    }
+
+    verify->state = UPG_VERIFY_DATA;
+    verify->partIndex = 0;
+    StartPart(verify);
+    return UPGRADE_ERR_NONE;
+}
+
+/* Last byte of a segment received: check it and move on */
+static UPG_Error_t EndSegment(UPG_Verify_t * verify)
+{
+    firmware_hash_t computed;
+
+    mbedtls_sha256_finish(&verify->segmentSha, computed.hash_data);
+    if (memcmp(&computed, &verify->part.segs[verify->segmentIndex].hash, sizeof computed) != 0)
+    {
+        return Fail(verify, UPGRADE_ERR_HASH_CHECK_FAILED, "segment hash mismatch");
+    }
+    mbedtls_sha256_update(&verify->partSha, computed.hash_data, sizeof computed.hash_data);
+
+    if (++verify->segmentIndex < verify->segmentCount)
+    {
+        StartSegment(verify);
+        return UPGRADE_ERR_NONE;
+    }
+
+    mbedtls_sha256_finish(&verify->partSha, computed.hash_data);
+    if (memcmp(&computed, &verify->part.hash, sizeof computed) != 0)
+    {
+        return Fail(verify, UPGRADE_ERR_HASH_CHECK_FAILED, "part hash mismatch");
+    }
+
+    if (++verify->partIndex < verify->intro.nr_parts)
+    {
+        StartPart(verify);
+    }
+    else
+    {
+        verify->state = UPG_VERIFY_DONE;
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+/*
+ * Decrypt, hash and pass on segment data. A replay is plaintext that has
+ * already been through the sink: it is hashed and the key stream is moved
+ * past it, but it is not decrypted or passed on again.
+ */
+static UPG_Error_t ProcessData(UPG_Verify_t * verify, const uint8_t * data, size_t length, bool replay)
+{
+    uint8_t buffer[UPG_VERIFY_CHUNK_BYTES];
+
+    while (length > 0 && verify->state == UPG_VERIFY_DATA)
+    {
+        const firmware_segment_t * seg = &verify->part.segs[verify->segmentIndex];
+        uint32_t left = Padded(seg->bytes) - verify->segmentDone;
+        size_t chunk = length < left ? length : left;
+        if (chunk > sizeof buffer)
+        {
+            chunk = sizeof buffer;
+        }
+
+        const uint8_t * plain = data;
+        if (verify->encrypted)
+        {
+            mbedtls_aes_crypt_ctr(&verify->aes, chunk, &verify->counterOffset,
+                                  verify->counter, verify->keyStream, data, buffer);
+            plain = replay ? data : buffer;
+        }
+
+        if (verify->segmentDone < seg->bytes)
+        {
+            size_t raw = seg->bytes - verify->segmentDone;
+            if (raw > chunk)
+            {
+                raw = chunk;
+            }
+            mbedtls_sha256_update(&verify->segmentSha, plain, raw);
+            if (!replay && verify->sink && verify->sink(verify->context, &verify->part, seg, plain, raw) != 0)
+            {
+                return Fail(verify, UPGRADE_ERR_DOWNLOAD_FAILED, "write failed");
+            }
+        }
+
+        verify->segmentDone += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (verify->segmentDone == Padded(seg->bytes) && EndSegment(verify) != UPGRADE_ERR_NONE)
+        {
+            return verify->error;
+        }
+    }
+
+    if (length > 0)
+    {
+        return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "data after the last part");
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \brief   Start verifying an image
+ *
+ * \param   verify      State, owned by the caller
+ * \param   publicKey   Key the header signature must verify under
+ * \param   keyHex      64 hex digit install key, NULL or empty if the
+ *                      header is not encrypted
+ * \param   hashHex     64 hex digit install hash of the header, NULL or
+ *                      empty to rely on the signature alone
+ * \param   sink        Where the plaintext goes, may be NULL
+ * \param   context     Passed to the sink
+ *
+ * \return  UPGRADE_ERR_NONE, or why the request is not usable
+ */
+UPG_Error_t UPG_VerifyInit(UPG_Verify_t * verify,
+                           const uint8_t publicKey[UPG_VERIFY_PUBLIC_KEY_BYTES],
+                           const char * keyHex,
+                           const char * hashHex,
+                           UPG_VerifySink_t sink,
+                           void * context)
+{
+    memset(verify, 0, sizeof *verify);
+    verify->state = UPG_VERIFY_HEADER;
+    verify->publicKey = publicKey;
+    verify->sink = sink;
+    verify->context = context;
+    mbedtls_sha256_init(&verify->segmentSha);
+    mbedtls_sha256_init(&verify->partSha);
+    mbedtls_aes_init(&verify->aes);
+
+    int haveKey = HexToBytes(keyHex, verify->key.key_data, FIRMWARE_KEY_BYTES);
+    int haveHash = HexToBytes(hashHex, verify->hash.hash_data, FIRMWARE_HASH_BYTES);
+    if (haveKey < 0 || haveHash < 0)
+    {
+        return Fail(verify, UPGRADE_ERR_INVALID_REQUEST, "bad key or hash");
+    }
+    verify->haveKey = haveKey;
+    verify->haveHash = haveHash;
+
+    verify->header = malloc(FIRMWARE_HEADER_BYTES);
+    if (verify->header == NULL)
+    {
+        return Fail(verify, UPGRADE_ERR_DOWNLOAD_FAILED, "no memory for header");
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+/**
+ * \brief   Feed the next bytes of the image, in any size of piece
+ *
+ * \return  UPGRADE_ERR_NONE while the image is good so far. Once an error
+ *          is returned every later call returns it too.
+ */
+UPG_Error_t UPG_VerifyWrite(UPG_Verify_t * verify, const uint8_t * data, size_t length)
+{
+    if (verify->state == UPG_VERIFY_FAILED)
+    {
+        return verify->error;
+    }
+
+    if (verify->state == UPG_VERIFY_HEADER)
+    {
+        size_t chunk = FIRMWARE_HEADER_BYTES - verify->headerBytes;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+        memcpy(&verify->header[verify->headerBytes], data, chunk);
+        verify->headerBytes += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (verify->headerBytes == FIRMWARE_HEADER_BYTES && ProcessHeader(verify) != UPGRADE_ERR_NONE)
+        {
+            return verify->error;
+        }
+    }
+
+    if (length > 0)
+    {
+        return ProcessData(verify, data, length, false);
+    }
+    return UPGRADE_ERR_NONE;
+}
+
+/**
+ * \brief   Bring a verifier that has had the header back to where an
+ *          earlier download stopped, from the plaintext that download
+ *          passed to the sink. Padding may be any bytes.
+ *
+ * \return  UPGRADE_ERR_NONE if the plaintext checks out so far
+ */
+UPG_Error_t UPG_VerifyReplay(UPG_Verify_t * verify, const uint8_t * plaintext, size_t length)
+{
+    if (verify->state == UPG_VERIFY_FAILED)
+    {
+        return verify->error;
+    }
+    if (verify->state != UPG_VERIFY_DATA)
+    {
+        return Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "replay outside the data");
+    }
+    return ProcessData(verify, plaintext, length, true);
+}
+
+/**
+ * \brief   End of the download
+ *
+ * \return  UPGRADE_ERR_NONE only if every part arrived and checked out
+ */
+UPG_Error_t UPG_VerifyFinish(UPG_Verify_t * verify)
+{
+    if (verify->state == UPG_VERIFY_HEADER || verify->state == UPG_VERIFY_DATA)
+    {
+        Fail(verify, UPGRADE_ERR_FILE_CONTENTS_ERROR, "image truncated");
+    }
+    return verify->state == UPG_VERIFY_DONE ? UPGRADE_ERR_NONE : verify->error;
+}
+
+/**
+ * \brief   Release the header buffer and wipe the keys
+ */
+void UPG_VerifyFree(UPG_Verify_t * verify)
+{
+    if (verify->header)
+    {
+        memset(verify->header, 0, FIRMWARE_HEADER_BYTES);
+        free(verify->header);
+        verify->header = NULL;
+    }
+    mbedtls_sha256_free(&verify->segmentSha);
+    mbedtls_sha256_free(&verify->partSha);
+    mbedtls_aes_free(&verify->aes);
+    memset(&verify->key, 0, sizeof verify->key);
+    memset(&verify->part.key, 0, sizeof verify->part.key);
+}
@@ -0,0 +1,132 @@
+/*!****************************************************************************
+ *
+ * \file UPG_Verify.h
+ *
+ * \brief Streaming verifier and decryptor for SJHF firmware images
+ *
+ * The image is fed in as it downloads. The 32K header is collected first and
+ * checked against the install hash and the ECDSA P-256 signature before any
+ * of it is trusted. Segment data is then decrypted, hashed and handed to a
+ * sink, normally the flash writer, and each segment hash is checked as soon
+ * as its last byte has been written.
+ *
+ * Layout, as built by fwpack:
+ *
+ *  [0, FIRMWARE_PLAINTEXT_BYTES)          intro, plaintext
+ *  [FIRMWARE_PLAINTEXT_BYTES,
+ *   FIRMWARE_PUBKEY_OFFSET)               rest of the intro, then the parts at
+ *                                         FIRMWARE_INTRO_BYTES + n * FIRMWARE_PART_BYTES.
+ *                                         AES-256-CTR under the install key,
+ *                                         counter block from the salt, when a
+ *                                         key is given.
+ *  [FIRMWARE_PUBKEY_OFFSET, HEADER_BYTES) LE16 length and DER ECDSA signature
+ *                                         of the SHA-256 of the bytes above,
+ *                                         as stored.
+ *  then the parts, in order, each one its segments in order. Segments are
+ *  padded with 0xFF to FIRMWARE_ENC_BLK_BYTES and, when the part key is not
+ *  all zero, AES-256-CTR encrypted under it with the segment hash as the
+ *  counter block.
+ *
+ * Segment hashes are SHA-256 of the raw segment bytes, the part hash is the
+ * SHA-256 of its segment hashes and the install hash is the SHA-256 of the
+ * whole header as stored. Unused segment slots are 0xFF.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef UPG_VERIFY_H
+#define UPG_VERIFY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/aes.h"
+#include "mbedtls/sha256.h"
+
+#include "UPG_Api.h"
+#include "UPG_Firmware.h"
+
+/* Parts that fit between the intro and the signature */
+#define UPG_VERIFY_MAX_PARTS \
+    ((FIRMWARE_PUBKEY_OFFSET - FIRMWARE_INTRO_BYTES) / FIRMWARE_PART_BYTES)
+
+/* Bound on the file size, well above any flash partition */
+#define UPG_VERIFY_MAX_IMAGE_BYTES  (16u << 20)
+
+/* Uncompressed P-256 public key, 0x04 then X and Y */
+#define UPG_VERIFY_PUBLIC_KEY_BYTES 65
+
+/**
+ * \brief Receives the plaintext of each segment, in file order
+ *
+ * \param context   As given to UPG_VerifyInit
+ * \param part      The part the data belongs to
+ * \param segment   The segment the data belongs to
+ * \param data      Plaintext, padding removed
+ * \param length    Number of bytes
+ *
+ * \return 0 to carry on, anything else stops the stream
+ */
+typedef int (*UPG_VerifySink_t)(void * context,
+                                const firmware_part_t * part,
+                                const firmware_segment_t * segment,
+                                const uint8_t * data,
+                                size_t length);
+
+typedef enum
+{
+    UPG_VERIFY_HEADER,
+    UPG_VERIFY_DATA,
+    UPG_VERIFY_DONE,
+    UPG_VERIFY_FAILED
+} UPG_VerifyState_t;
+
+typedef struct
+{
+    UPG_VerifyState_t state;
+    UPG_Error_t error;
+    const char * reason;            // Why it failed, for the log
+
+    const uint8_t * publicKey;
+    bool haveKey;
+    bool haveHash;
+    firmware_key_t key;             // Install key from the cloud
+    firmware_hash_t hash;           // Install hash from the cloud
+
+    uint8_t * header;               // FIRMWARE_HEADER_BYTES, decrypted in place
+    uint32_t headerBytes;
+    firmware_intro_t intro;
+
+    int partIndex;
+    int segmentIndex;
+    int segmentCount;
+    firmware_part_t part;           // Part being received
+    uint32_t segmentDone;           // Bytes of the padded segment received
+    bool encrypted;
+
+    mbedtls_sha256_context segmentSha;
+    mbedtls_sha256_context partSha;
+    mbedtls_aes_context aes;
+    size_t counterOffset;
+    uint8_t counter[16];
+    uint8_t keyStream[16];
+
+    UPG_VerifySink_t sink;
+    void * context;
+} UPG_Verify_t;
+
+extern UPG_Error_t UPG_VerifyInit(UPG_Verify_t * verify,
+                                  const uint8_t publicKey[UPG_VERIFY_PUBLIC_KEY_BYTES],
+                                  const char * keyHex,
+                                  const char * hashHex,
+                                  UPG_VerifySink_t sink,
+                                  void * context);
+extern UPG_Error_t UPG_VerifyWrite(UPG_Verify_t * verify, const uint8_t * data, size_t length);
+extern UPG_Error_t UPG_VerifyReplay(UPG_Verify_t * verify, const uint8_t * plaintext, size_t length);
+extern UPG_Error_t UPG_VerifyFinish(UPG_Verify_t * verify);
+extern void UPG_VerifyFree(UPG_Verify_t * verify);
+
+#endif /* UPG_VERIFY_H */
@@ -0,0 +1,353 @@
+/*!****************************************************************************
+ * \file    TST_Delta.c
+ *
+ * \brief   Tests of the delta patch applier on patches made by fwdiff
+ *
+ * The flash is a file, with the running image in the active partition. A
+ * patch from it to a new image is applied in random pieces, as it
+ * downloads, reading the source from the active partition and writing the
+ * target to the inactive one. The new image must come out exactly, and a
+ * patch for another image, a truncated patch or a patch with any byte
+ * changed must fail.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fwdiff.h"
+#include "UPG_Delta.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define TST_PARTITION_BYTES     (512 << 10)
+#define TST_ACTIVE              0
+#define TST_INACTIVE            TST_PARTITION_BYTES
+
+#define TST_SOURCE_BYTES        200000
+#define TST_CHANGES             200             // Scattered, as addresses shift
+#define TST_INSERT_AT           50000
+#define TST_INSERT_BYTES        1000
+#define TST_DELETE_AT           120000
+#define TST_DELETE_BYTES        500
+#define TST_APPEND_BYTES        3000
+#define TST_TARGET_BYTES        (TST_SOURCE_BYTES + TST_INSERT_BYTES - TST_DELETE_BYTES + TST_APPEND_BYTES)
+
+#define TST_MAX_PIECE           1500
+#define TST_CORRUPTIONS         300
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static FILE * _flash;
+static uint8_t _source[TST_SOURCE_BYTES];
+static uint8_t _target[TST_TARGET_BYTES];
+static uint8_t * _patch;
+static size_t _patchBytes;
+
+static uint32_t _written;               // Bytes the sink put in the inactive partition
+static uint32_t _seed = 23;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Lcg
+ * \return The next of a repeatable sequence
+ */
+static uint32_t Lcg(void)
+{
+    _seed = _seed * 1103515245 + 12345;
+    return _seed >> 16;
+}
+
+/**
+ * \name   FlashWrite
+ * \brief  Program bytes of the flash file
+ */
+static void FlashWrite(uint32_t address, const uint8_t * data, size_t length)
+{
+    if (fseek(_flash, address, SEEK_SET) != 0 || fwrite(data, 1, length, _flash) != length)
+    {
+        perror("flash");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * \name   FlashMatches
+ * \return true if the flash holds data at address
+ */
+static bool FlashMatches(uint32_t address, const uint8_t * data, size_t length)
+{
+    uint8_t buffer[4096];
+    fflush(_flash);
+    for (size_t done = 0; done < length; )
+    {
+        size_t chunk = length - done < sizeof(buffer) ? length - done : sizeof(buffer);
+        if (fseek(_flash, address + done, SEEK_SET) != 0 || fread(buffer, 1, chunk, _flash) != chunk ||
+            memcmp(buffer, &data[done], chunk) != 0)
+        {
+            return false;
+        }
+        done += chunk;
+    }
+    return true;
+}
+
+/**
+ * \name   Erase
+ * \brief  Erase the inactive partition and put the running image in the
+ *         active one
+ */
+static void Erase(const uint8_t * running)
+{
+    static uint8_t erased[TST_PARTITION_BYTES];
+    memset(erased, 0xFF, sizeof(erased));
+    FlashWrite(TST_ACTIVE, erased, sizeof(erased));
+    FlashWrite(TST_INACTIVE, erased, sizeof(erased));
+    FlashWrite(TST_ACTIVE, running, TST_SOURCE_BYTES);
+    _written = 0;
+}
+
+/**
+ * \name   ReadActive
+ * \brief  Source reads, from the active partition
+ */
+static int ReadActive(void * context, uint32_t offset, uint8_t * data, size_t length)
+{
+    if (offset + length > TST_PARTITION_BYTES || fseek(_flash, TST_ACTIVE + offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    return fread(data, 1, length, _flash) == length ? 0 : -1;
+}
+
+/**
+ * \name   WriteInactive
+ * \brief  Target writes, to the inactive partition
+ */
+static int WriteInactive(void * context, const uint8_t * data, size_t length)
+{
+    if (_written + length > TST_PARTITION_BYTES)
+    {
+        return -1;
+    }
+    FlashWrite(TST_INACTIVE + _written, data, length);
+    _written += length;
+    return 0;
+}
+
+/**
+ * \name   Apply
+ * \brief  Apply a patch in random pieces of up to maxPiece bytes
+ * \return The error of the first call that failed
+ */
+static UPG_Error_t Apply(const uint8_t * patch, size_t length, size_t maxPiece)
+{
+    UPG_Delta_t delta;
+    UPG_Error_t error = UPGRADE_ERR_NONE;
+    UPG_DeltaInit(&delta, ReadActive, WriteInactive, NULL);
+    for (size_t done = 0; error == UPGRADE_ERR_NONE && done < length; )
+    {
+        size_t piece = 1 + Lcg() % maxPiece;
+        if (piece > length - done)
+        {
+            piece = length - done;
+        }
+        error = UPG_DeltaWrite(&delta, &patch[done], piece);
+        done += piece;
+    }
+    if (error == UPGRADE_ERR_NONE)
+    {
+        error = UPG_DeltaFinish(&delta);
+    }
+    UPG_DeltaFree(&delta);
+    return error;
+}
+
+/**
+ * \name   Setup
+ * \brief  Make the flash, the running image, the new image and the patch
+ *         between them
+ */
+static void Setup(void)
+{
+    _flash = tmpfile();
+    if (_flash == NULL)
+    {
+        perror("tmpfile");
+        exit(EXIT_FAILURE);
+    }
+
+    // Code compresses poorly, but repeats itself
+    for (size_t i = 0; i < TST_SOURCE_BYTES; i++)
+    {
+        _source[i] = (i % 64 < 16) ? (uint8_t)i : (uint8_t)Lcg();
+    }
+
+    // The new image: a block inserted, one removed, changes and more at the end
+    uint8_t * t = _target;
+    memcpy(t, _source, TST_INSERT_AT);
+    t += TST_INSERT_AT;
+    for (int i = 0; i < TST_INSERT_BYTES; i++)
+    {
+        *t++ = Lcg();
+    }
+    memcpy(t, &_source[TST_INSERT_AT], TST_DELETE_AT - TST_INSERT_AT);
+    t += TST_DELETE_AT - TST_INSERT_AT;
+    memcpy(t, &_source[TST_DELETE_AT + TST_DELETE_BYTES], TST_SOURCE_BYTES - TST_DELETE_AT - TST_DELETE_BYTES);
+    t += TST_SOURCE_BYTES - TST_DELETE_AT - TST_DELETE_BYTES;
+    for (int i = 0; i < TST_APPEND_BYTES; i++)
+    {
+        *t++ = Lcg();
+    }
+    for (int i = 0; i < TST_CHANGES; i++)
+    {
+        _target[Lcg() % TST_TARGET_BYTES] += 1 + Lcg() % 4;
+    }
+
+    if (FWD_Create(_source, TST_SOURCE_BYTES, _target, TST_TARGET_BYTES, &_patch, &_patchBytes) != 0)
+    {
+        fprintf(stderr, "FWD_Create failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * \name   RoundTrip
+ * \brief  The patch rebuilds the new image in the inactive partition,
+ *         whatever the pieces it arrives in, and leaves the active one
+ */
+static void RoundTrip(void)
+{
+    const size_t pieces[] = { 1, UPG_DELTA_CHUNK_BYTES + 1, TST_MAX_PIECE, _patchBytes };
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++)
+    {
+        Erase(_source);
+        TST_ASSERT_EQUAL(Apply(_patch, _patchBytes, pieces[i]), UPGRADE_ERR_NONE);
+        TST_ASSERT_EQUAL(_written, TST_TARGET_BYTES);
+        TST_ASSERT(FlashMatches(TST_INACTIVE, _target, TST_TARGET_BYTES));
+        TST_ASSERT(FlashMatches(TST_ACTIVE, _source, TST_SOURCE_BYTES));
+    }
+
+    // Only the changes are sent
+    printf("%d -> %d bytes, patch %zu bytes\n", TST_SOURCE_BYTES, TST_TARGET_BYTES, _patchBytes);
+    fflush(stdout);
+    TST_ASSERT(_patchBytes < TST_TARGET_BYTES / 10);
+}
+
+/**
+ * \name   Unchanged
+ * \brief  A patch from an image to itself rebuilds it
+ */
+static void Unchanged(void)
+{
+    uint8_t * patch;
+    size_t patchBytes;
+    TST_ASSERT_EQUAL(FWD_Create(_source, TST_SOURCE_BYTES, _source, TST_SOURCE_BYTES, &patch, &patchBytes), 0);
+    Erase(_source);
+    TST_ASSERT_EQUAL(Apply(patch, patchBytes, TST_MAX_PIECE), UPGRADE_ERR_NONE);
+    TST_ASSERT(FlashMatches(TST_INACTIVE, _source, TST_SOURCE_BYTES));
+    free(patch);
+}
+
+/**
+ * \name   WrongSource
+ * \brief  A patch for another image fails before anything is written
+ */
+static void WrongSource(void)
+{
+    static uint8_t other[TST_SOURCE_BYTES];
+    const uint32_t changes[] = { 0, TST_SOURCE_BYTES / 2, TST_SOURCE_BYTES - 1 };
+
+    for (size_t i = 0; i < sizeof(changes) / sizeof(changes[0]); i++)
+    {
+        memcpy(other, _source, sizeof(other));
+        other[changes[i]] ^= 0x01;
+        Erase(other);
+        TST_ASSERT_EQUAL(Apply(_patch, _patchBytes, TST_MAX_PIECE), UPGRADE_ERR_FILE_CONTENTS_ERROR);
+        TST_ASSERT_EQUAL(_written, 0);
+    }
+
+    // The new image is not the source either
+    Erase(_target);
+    TST_ASSERT_EQUAL(Apply(_patch, _patchBytes, TST_MAX_PIECE), UPGRADE_ERR_FILE_CONTENTS_ERROR);
+    TST_ASSERT_EQUAL(_written, 0);
+}
+
+/**
+ * \name   Truncated
+ * \brief  A patch cut short anywhere fails when the download ends
+ */
+static void Truncated(void)
+{
+    const size_t lengths[] =
+    {
+        0,
+        1,
+        UPG_DELTA_HEADER_BYTES - 1,
+        UPG_DELTA_HEADER_BYTES,
+        UPG_DELTA_HEADER_BYTES + 1,
+        _patchBytes / 2,
+        _patchBytes - 1,
+    };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        Erase(_source);
+        TST_ASSERT_EQUAL(Apply(_patch, lengths[i], TST_MAX_PIECE), UPGRADE_ERR_FILE_CONTENTS_ERROR);
+    }
+}
+
+/**
+ * \name   Corrupted
+ * \brief  A byte changed anywhere in the patch fails, by a check of its
+ *         structure or by the target hash
+ */
+static void Corrupted(void)
+{
+    uint8_t * patch = malloc(_patchBytes);
+    int passed = 0;
+    memcpy(patch, _patch, _patchBytes);
+
+    for (int i = 0; i < UPG_DELTA_HEADER_BYTES + TST_CORRUPTIONS; i++)
+    {
+        size_t at = i < UPG_DELTA_HEADER_BYTES ? (size_t)i : Lcg() % _patchBytes;
+        uint8_t flip = 1 << (Lcg() % 8);
+        patch[at] ^= flip;
+        Erase(_source);
+        passed += Apply(patch, _patchBytes, TST_MAX_PIECE) == UPGRADE_ERR_NONE;
+        TST_ASSERT(_written <= TST_PARTITION_BYTES);
+        patch[at] ^= flip;
+    }
+    TST_ASSERT_EQUAL(passed, 0);
+    free(patch);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(void)
+{
+    Setup();
+
+    TST_Boot("Round trip", RoundTrip);
+    TST_Boot("Unchanged image", Unchanged);
+    TST_Boot("Patch for another image", WrongSource);
+    TST_Boot("Truncated patch", Truncated);
+    TST_Boot("Corrupted patch", Corrupted);
+
+    free(_patch);
+    fclose(_flash);
+    return TST_Result();
+}
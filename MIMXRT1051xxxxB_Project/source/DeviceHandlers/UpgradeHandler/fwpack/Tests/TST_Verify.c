@@ -0,0 +1,506 @@
+/*!****************************************************************************
+ * \file    TST_Verify.c
+ *
+ * \brief   Tests of the streaming image verifier against images built by
+ *          fwpack
+ *
+ * fwpack packs an encrypted image of two parts and three segments, signed
+ * with the development key. The image is then fed to UPG_Verify in random
+ * pieces as it is, tampered with, truncated, reordered, with data after it
+ * and signed with another key. Only the image as packed may verify, and
+ * nothing of an image whose header does not check out may reach the sink.
+ *
+ * Usage: TST_Verify <fwpack> <dev_signing_key.pem>
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbedtls/pk.h"
+
+#include "UPG_Verify.h"
+#include "UPG_SigningKey.h"
+#include "TST_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Not a multiple of FIRMWARE_ENC_BLK_BYTES, so the segment is padded
+#define TST_APPL_BYTES          100003
+// The two asset segments are the same size so they can be swapped
+#define TST_FILE_BYTES          8192
+#define TST_PLAIN_BYTES         (TST_APPL_BYTES + 2 * TST_FILE_BYTES)
+
+#define TST_APPL_OFFSET         FIRMWARE_HEADER_BYTES
+#define TST_APPL_PADDED         ((TST_APPL_BYTES + FIRMWARE_ENC_BLK_BYTES - 1) & ~(FIRMWARE_ENC_BLK_BYTES - 1))
+#define TST_FILE_OFFSET         (TST_APPL_OFFSET + TST_APPL_PADDED)
+
+#define TST_MAX_PIECE           4096
+#define TST_HEX_BYTES           65
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint8_t * data;
+    size_t length;
+    char key[TST_HEX_BYTES];            // Install key, as the cloud sends it
+    char hash[TST_HEX_BYTES];           // Install hash
+} TST_Image_t;
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static const uint8_t _devKey[UPG_VERIFY_PUBLIC_KEY_BYTES] = UPG_SIGNING_KEY;
+static uint8_t _otherKey[UPG_VERIFY_PUBLIC_KEY_BYTES];
+
+static const char * _fwpack;
+static const char * _devKeyFile;
+static char _dir[] = "/tmp/fwpackXXXXXX";
+
+static uint8_t _plain[TST_PLAIN_BYTES];     // The segments, in order
+static TST_Image_t _image;                  // Signed with the development key
+static TST_Image_t _otherImage;             // Signed with another key
+
+static uint8_t _sunk[TST_PLAIN_BYTES];
+static size_t _sunkBytes;
+static uint32_t _seed = 22;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+/**
+ * \name   Lcg
+ * \return The next of a repeatable sequence
+ */
+static uint32_t Lcg(void)
+{
+    _seed = _seed * 1103515245 + 12345;
+    return _seed >> 8;
+}
+
+/**
+ * \name   Path
+ * \return name in the test directory, valid until the next call
+ */
+static const char * Path(const char * name)
+{
+    static char path[256];
+    snprintf(path, sizeof(path), "%s/%s", _dir, name);
+    return path;
+}
+
+/**
+ * \name   WriteFile
+ * \brief  Write a file in the test directory
+ */
+static void WriteFile(const char * name, const uint8_t * data, size_t length)
+{
+    FILE * f = fopen(Path(name), "wb");
+    if (f == NULL || fwrite(data, 1, length, f) != length || fclose(f) != 0)
+    {
+        perror(Path(name));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * \name   ReadImage
+ * \brief  Read an image fwpack wrote to the test directory
+ */
+static void ReadImage(const char * name, TST_Image_t * image)
+{
+    FILE * f = fopen(Path(name), "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0)
+    {
+        perror(Path(name));
+        exit(EXIT_FAILURE);
+    }
+    image->length = ftell(f);
+    image->data = malloc(image->length);
+    rewind(f);
+    if (image->data == NULL || fread(image->data, 1, image->length, f) != image->length)
+    {
+        perror(Path(name));
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+}
+
+/**
+ * \name   Pack
+ * \brief  Have fwpack build an encrypted image of the segments, keeping
+ *         the install key and hash it prints
+ */
+static void Pack(const char * keyFile, const char * name, TST_Image_t * image)
+{
+    char command[1024];
+    snprintf(command, sizeof(command),
+             "'%s' pack -k '%s' -e -n TEST -o %s OPER:APPL:%s/appl ASST:FILE:%s/file1 ASST:FILE:%s/file2",
+             _fwpack, keyFile, Path(name), _dir, _dir, _dir);
+
+    FILE * output = popen(command, "r");
+    char line[128];
+    while (output && fgets(line, sizeof(line), output))
+    {
+        sscanf(line, "key %64s", image->key);
+        sscanf(line, "hash %64s", image->hash);
+    }
+    if (output == NULL || pclose(output) != 0 || strlen(image->key) != 64 || strlen(image->hash) != 64)
+    {
+        fprintf(stderr, "%s failed\n", command);
+        exit(EXIT_FAILURE);
+    }
+    ReadImage(name, image);
+}
+
+/**
+ * \name   PublicKey
+ * \brief  The public half of a key file, as UPG_SIGNING_KEY holds it
+ */
+static void PublicKey(const char * keyFile, uint8_t point[UPG_VERIFY_PUBLIC_KEY_BYTES])
+{
+    mbedtls_pk_context pk;
+    size_t length = 0;
+    mbedtls_pk_init(&pk);
+    if (mbedtls_pk_parse_keyfile(&pk, keyFile, NULL) != 0 ||
+        mbedtls_ecp_point_write_binary(&mbedtls_pk_ec(pk)->grp, &mbedtls_pk_ec(pk)->Q,
+                                       MBEDTLS_ECP_PF_UNCOMPRESSED, &length, point,
+                                       UPG_VERIFY_PUBLIC_KEY_BYTES) != 0 ||
+        length != UPG_VERIFY_PUBLIC_KEY_BYTES)
+    {
+        fprintf(stderr, "%s is not a P-256 key\n", keyFile);
+        exit(EXIT_FAILURE);
+    }
+    mbedtls_pk_free(&pk);
+}
+
+/**
+ * \name   Setup
+ * \brief  Make the segments, the images and a second key
+ */
+static void Setup(void)
+{
+    if (mkdtemp(_dir) == NULL)
+    {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < sizeof(_plain); i++)
+    {
+        _plain[i] = Lcg();
+    }
+    WriteFile("appl", _plain, TST_APPL_BYTES);
+    WriteFile("file1", &_plain[TST_APPL_BYTES], TST_FILE_BYTES);
+    WriteFile("file2", &_plain[TST_APPL_BYTES + TST_FILE_BYTES], TST_FILE_BYTES);
+
+    char otherKeyFile[256];
+    char command[1024];
+    snprintf(otherKeyFile, sizeof(otherKeyFile), "%s", Path("other.pem"));
+    snprintf(command, sizeof(command), "'%s' keygen %s > /dev/null", _fwpack, otherKeyFile);
+    if (system(command) != 0)
+    {
+        fprintf(stderr, "%s failed\n", command);
+        exit(EXIT_FAILURE);
+    }
+    PublicKey(otherKeyFile, _otherKey);
+
+    Pack(_devKeyFile, "image", &_image);
+    Pack(otherKeyFile, "other", &_otherImage);
+}
+
+/**
+ * \name   Cleanup
+ * \brief  Remove the test directory
+ */
+static void Cleanup(void)
+{
+    static const char * const names[] = { "appl", "file1", "file2", "other.pem", "image", "other" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        unlink(Path(names[i]));
+    }
+    rmdir(_dir);
+}
+
+/**
+ * \name   Sink
+ * \brief  Keep what the verifier passes on, as the flash writer would
+ */
+static int Sink(void * context, const firmware_part_t * part, const firmware_segment_t * segment,
+                const uint8_t * data, size_t length)
+{
+    if (_sunkBytes + length > sizeof(_sunk))
+    {
+        return -1;
+    }
+    memcpy(&_sunk[_sunkBytes], data, length);
+    _sunkBytes += length;
+    return 0;
+}
+
+/**
+ * \name   Verify
+ * \brief  Feed data to the verifier in random pieces, as TLS records
+ *         arrive, then finish
+ * \return The error of the first call that failed
+ */
+static UPG_Error_t Verify(const uint8_t * data, size_t length, const uint8_t * publicKey,
+                          const char * key, const char * hash)
+{
+    UPG_Verify_t verify;
+    _sunkBytes = 0;
+    UPG_Error_t error = UPG_VerifyInit(&verify, publicKey, key, hash, Sink, NULL);
+    for (size_t done = 0; error == UPGRADE_ERR_NONE && done < length; )
+    {
+        size_t piece = 1 + Lcg() % TST_MAX_PIECE;
+        if (piece > length - done)
+        {
+            piece = length - done;
+        }
+        error = UPG_VerifyWrite(&verify, &data[done], piece);
+        done += piece;
+    }
+    if (error == UPGRADE_ERR_NONE)
+    {
+        error = UPG_VerifyFinish(&verify);
+    }
+    UPG_VerifyFree(&verify);
+    return error;
+}
+
+/**
+ * \name   VerifyImage
+ * \brief  Verify a copy of the development image, with the key and hash
+ *         the cloud would send
+ */
+static UPG_Error_t VerifyImage(const uint8_t * data, size_t length)
+{
+    return Verify(data, length, _devKey, _image.key, _image.hash);
+}
+
+/**
+ * \name   Copy
+ * \return A copy of the development image with room for extra bytes
+ */
+static uint8_t * Copy(size_t extra)
+{
+    uint8_t * copy = malloc(_image.length + extra);
+    if (copy == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, _image.data, _image.length);
+    return copy;
+}
+
+/**
+ * \name   DevKey
+ * \brief  The key the firmware accepts by default is the public half of
+ *         fwpack/dev_signing_key.pem
+ */
+static void DevKey(void)
+{
+    uint8_t point[UPG_VERIFY_PUBLIC_KEY_BYTES];
+    PublicKey(_devKeyFile, point);
+    TST_ASSERT(memcmp(point, _devKey, sizeof(point)) == 0);
+}
+
+/**
+ * \name   Packed
+ * \brief  The image as packed verifies, with or without the install hash,
+ *         and the sink gets the segments
+ */
+static void Packed(void)
+{
+    TST_ASSERT_EQUAL(VerifyImage(_image.data, _image.length), UPGRADE_ERR_NONE);
+    TST_ASSERT_EQUAL(_sunkBytes, TST_PLAIN_BYTES);
+    TST_ASSERT(memcmp(_sunk, _plain, TST_PLAIN_BYTES) == 0);
+
+    TST_ASSERT_EQUAL(Verify(_image.data, _image.length, _devKey, _image.key, NULL), UPGRADE_ERR_NONE);
+    TST_ASSERT(memcmp(_sunk, _plain, TST_PLAIN_BYTES) == 0);
+}
+
+/**
+ * \name   Tampered
+ * \brief  A byte changed anywhere in the header or in a segment fails
+ */
+static void Tampered(void)
+{
+    static const size_t header[] =
+    {
+        offsetof(firmware_intro_t, name),               // Plaintext intro
+        FIRMWARE_INTRO_BYTES + 8,                       // Encrypted part table
+        FIRMWARE_PUBKEY_OFFSET - 1,                     // Last signed byte
+        FIRMWARE_PUBKEY_OFFSET + 20,                    // Signature
+        FIRMWARE_HEADER_BYTES - 1,                      // After the signature
+    };
+    static const size_t data[] =
+    {
+        TST_APPL_OFFSET,
+        TST_APPL_OFFSET + TST_APPL_BYTES / 2,
+        TST_APPL_OFFSET + TST_APPL_BYTES - 1,
+        TST_FILE_OFFSET,
+        TST_FILE_OFFSET + 2 * TST_FILE_BYTES - 1,
+    };
+    uint8_t * copy = Copy(0);
+
+    for (size_t i = 0; i < sizeof(header) / sizeof(header[0]); i++)
+    {
+        copy[header[i]] ^= 0x01;
+        TST_ASSERT_EQUAL(VerifyImage(copy, _image.length), UPGRADE_ERR_HASH_CHECK_FAILED);
+        TST_ASSERT_EQUAL(_sunkBytes, 0);
+        // Without the install hash the signature alone must catch it
+        if (header[i] < FIRMWARE_HEADER_BYTES - 1)
+        {
+            TST_ASSERT(Verify(copy, _image.length, _devKey, _image.key, NULL) != UPGRADE_ERR_NONE);
+            TST_ASSERT_EQUAL(_sunkBytes, 0);
+        }
+        copy[header[i]] ^= 0x01;
+    }
+
+    for (size_t i = 0; i < sizeof(data) / sizeof(data[0]); i++)
+    {
+        copy[data[i]] ^= 0x80;
+        TST_ASSERT_EQUAL(VerifyImage(copy, _image.length), UPGRADE_ERR_HASH_CHECK_FAILED);
+        copy[data[i]] ^= 0x80;
+    }
+    free(copy);
+}
+
+/**
+ * \name   Truncated
+ * \brief  An image cut short anywhere fails when the download ends
+ */
+static void Truncated(void)
+{
+    const size_t lengths[] =
+    {
+        0,
+        1,
+        FIRMWARE_HEADER_BYTES - 1,
+        FIRMWARE_HEADER_BYTES,
+        FIRMWARE_HEADER_BYTES + 1,
+        TST_FILE_OFFSET,
+        _image.length - FIRMWARE_ENC_BLK_BYTES,
+        _image.length - 1,
+    };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        TST_ASSERT_EQUAL(VerifyImage(_image.data, lengths[i]), UPGRADE_ERR_FILE_CONTENTS_ERROR);
+    }
+}
+
+/**
+ * \name   Reordered
+ * \brief  Segments or blocks in another order fail, though each is as
+ *         signed
+ */
+static void Reordered(void)
+{
+    uint8_t * copy = Copy(0);
+    uint8_t * file1 = &copy[TST_FILE_OFFSET];
+    uint8_t * file2 = &copy[TST_FILE_OFFSET + TST_FILE_BYTES];
+    uint8_t block[TST_FILE_BYTES];
+
+    // The two asset segments swapped
+    memcpy(block, file1, TST_FILE_BYTES);
+    memcpy(file1, file2, TST_FILE_BYTES);
+    memcpy(file2, block, TST_FILE_BYTES);
+    TST_ASSERT_EQUAL(VerifyImage(copy, _image.length), UPGRADE_ERR_HASH_CHECK_FAILED);
+
+    // Two blocks of the application swapped
+    memcpy(copy, _image.data, _image.length);
+    uint8_t * first = &copy[TST_APPL_OFFSET];
+    uint8_t * second = &copy[TST_APPL_OFFSET + FIRMWARE_ENC_BLK_BYTES];
+    memcpy(block, first, FIRMWARE_ENC_BLK_BYTES);
+    memcpy(first, second, FIRMWARE_ENC_BLK_BYTES);
+    memcpy(second, block, FIRMWARE_ENC_BLK_BYTES);
+    TST_ASSERT_EQUAL(VerifyImage(copy, _image.length), UPGRADE_ERR_HASH_CHECK_FAILED);
+
+    // The asset part ahead of the application part
+    memcpy(copy, _image.data, FIRMWARE_HEADER_BYTES);
+    memcpy(&copy[FIRMWARE_HEADER_BYTES], &_image.data[TST_FILE_OFFSET], 2 * TST_FILE_BYTES);
+    memcpy(&copy[FIRMWARE_HEADER_BYTES + 2 * TST_FILE_BYTES], &_image.data[TST_APPL_OFFSET], TST_APPL_PADDED);
+    TST_ASSERT_EQUAL(VerifyImage(copy, _image.length), UPGRADE_ERR_HASH_CHECK_FAILED);
+    free(copy);
+}
+
+/**
+ * \name   TrailingData
+ * \brief  Bytes after the last part fail, even another copy of a segment
+ */
+static void TrailingData(void)
+{
+    uint8_t * copy = Copy(TST_FILE_BYTES);
+    copy[_image.length] = 0xFF;
+    TST_ASSERT_EQUAL(VerifyImage(copy, _image.length + 1), UPGRADE_ERR_FILE_CONTENTS_ERROR);
+    TST_ASSERT_EQUAL(_sunkBytes, TST_PLAIN_BYTES);
+
+    memcpy(&copy[_image.length], &_image.data[TST_FILE_OFFSET], TST_FILE_BYTES);
+    TST_ASSERT_EQUAL(VerifyImage(copy, _image.length + TST_FILE_BYTES), UPGRADE_ERR_FILE_CONTENTS_ERROR);
+    free(copy);
+}
+
+/**
+ * \name   WrongKey
+ * \brief  An image signed with another key fails, as does the right image
+ *         under another public key or install key
+ */
+static void WrongKey(void)
+{
+    TST_ASSERT_EQUAL(Verify(_otherImage.data, _otherImage.length, _otherKey, _otherImage.key, _otherImage.hash),
+                     UPGRADE_ERR_NONE);
+
+    TST_ASSERT_EQUAL(Verify(_otherImage.data, _otherImage.length, _devKey, _otherImage.key, _otherImage.hash),
+                     UPGRADE_ERR_SIGNATURE_FAILED);
+    TST_ASSERT_EQUAL(_sunkBytes, 0);
+
+    TST_ASSERT_EQUAL(Verify(_image.data, _image.length, _otherKey, _image.key, _image.hash),
+                     UPGRADE_ERR_SIGNATURE_FAILED);
+    TST_ASSERT_EQUAL(_sunkBytes, 0);
+
+    // Another image's install key decrypts the part table to garbage
+    TST_ASSERT_EQUAL(Verify(_image.data, _image.length, _devKey, _otherImage.key, _image.hash),
+                     UPGRADE_ERR_DECRYPTION_FAILED);
+    TST_ASSERT_EQUAL(_sunkBytes, 0);
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(int argc, char * argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <fwpack> <dev_signing_key.pem>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    _fwpack = argv[1];
+    _devKeyFile = argv[2];
+    Setup();
+
+    TST_Boot("Development key", DevKey);
+    TST_Boot("Image as packed", Packed);
+    TST_Boot("Tampered image", Tampered);
+    TST_Boot("Truncated image", Truncated);
+    TST_Boot("Reordered image", Reordered);
+    TST_Boot("Data after the image", TrailingData);
+    TST_Boot("Wrong key", WrongKey);
+
+    Cleanup();
+    return TST_Result();
+}
@@ -0,0 +1,356 @@
+/*!****************************************************************************
+ *
+ * \file fwdiff.c
+ *
+ * \brief Delta patch generator for fwpack
+ *
+ * Builds the patches UPG_Delta.c applies, in the manner of bsdiff. Matches
+ * are seeded by hashing every FWDIFF_SEED_BYTES run of the source, then
+ * extended forward for as long as at least half the bytes agree, so code
+ * that has only moved, or whose addresses have shifted, becomes a diff of
+ * mostly unchanged bytes. What cannot be matched is sent as extra bytes.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbedtls/sha256.h"
+
+#include "fwdiff.h"
+#include "UPG_Delta.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define FWDIFF_SEED_BYTES   8
+#define FWDIFF_HASH_BITS    20
+#define FWDIFF_CANDIDATES   64
+
+/* Shortest match worth a record rather than extra bytes */
+#define FWDIFF_MIN_MATCH    24
+
+/* A match is not extended past this many bytes without improvement */
+#define FWDIFF_GIVE_UP      256
+
+/* Unchanged bytes shorter than this stay in a changed run */
+#define FWDIFF_MIN_SAME     3
+
+/*!****************************************************************************
+ * Types
+ *****************************************************************************/
+
+typedef struct
+{
+    uint32_t target;
+    uint32_t source;
+    uint32_t length;
+} FwdiffMatch_t;
+
+typedef struct
+{
+    uint8_t * data;
+    size_t length;
+    size_t size;
+} FwdiffBuffer_t;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+static int Put(FwdiffBuffer_t * out, const void * data, size_t length)
+{
+    if (out->length + length > out->size)
+    {
+        size_t size = out->size ? out->size : 4096;
+        while (size < out->length + length)
+        {
+            size *= 2;
+        }
+        uint8_t * grown = realloc(out->data, size);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        out->data = grown;
+        out->size = size;
+    }
+    memcpy(&out->data[out->length], data, length);
+    out->length += length;
+    return 0;
+}
+
+static int PutVarint(FwdiffBuffer_t * out, uint32_t value)
+{
+    uint8_t bytes[5];
+    size_t n = 0;
+    do
+    {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+        if (value)
+        {
+            bytes[n] |= 0x80;
+        }
+        n++;
+    } while (value);
+    return Put(out, bytes, n);
+}
+
+static int PutLE32(FwdiffBuffer_t * out, uint32_t value)
+{
+    uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    return Put(out, bytes, sizeof bytes);
+}
+
+static uint32_t SeedHash(const uint8_t * data)
+{
+    uint64_t v;
+    memcpy(&v, data, sizeof v);
+    return (v * 0x9E3779B97F4A7C15ull) >> (64 - FWDIFF_HASH_BITS);
+}
+
+/*
+ * Extend a match at source s, target t forward. Returns the length with
+ * the best score, two per agreeing byte less one per byte.
+ */
+static uint32_t Extend(const uint8_t * source, size_t sourceBytes,
+                       const uint8_t * target, size_t targetBytes,
+                       size_t s, size_t t, int * score)
+{
+    int agree = 0;
+    int best = 0;
+    uint32_t bestLength = 0;
+
+    for (uint32_t i = 0; s + i < sourceBytes && t + i < targetBytes; i++)
+    {
+        if (source[s + i] == target[t + i])
+        {
+            agree++;
+        }
+        int current = 2 * agree - (int)(i + 1);
+        if (current > best)
+        {
+            best = current;
+            bestLength = i + 1;
+        }
+        else if (i + 1 - bestLength > FWDIFF_GIVE_UP)
+        {
+            break;
+        }
+    }
+    *score = best;
+    return bestLength;
+}
+
+/* Encode target[t, t + length) against source[s, ...) as diff pairs */
+static int PutDiff(FwdiffBuffer_t * out, const uint8_t * source, const uint8_t * target, uint32_t length)
+{
+    uint32_t i = 0;
+    while (i < length)
+    {
+        uint32_t same = 0;
+        while (i + same < length && source[i + same] == target[i + same])
+        {
+            same++;
+        }
+
+        uint32_t changed = 0;
+        uint32_t j = i + same;
+        while (j + changed < length)
+        {
+            // Stop at the first run of unchanged bytes long enough to pay
+            // for its own pair
+            uint32_t run = 0;
+            while (run < FWDIFF_MIN_SAME && j + changed + run < length &&
+                   source[j + changed + run] == target[j + changed + run])
+            {
+                run++;
+            }
+            if (run == FWDIFF_MIN_SAME || (run > 0 && j + changed + run == length))
+            {
+                break;
+            }
+            changed += run ? run : 1;
+        }
+
+        if (PutVarint(out, same) != 0 || PutVarint(out, changed) != 0)
+        {
+            return -1;
+        }
+        for (uint32_t k = 0; k < changed; k++)
+        {
+            uint8_t d = target[j + k] - source[j + k];
+            if (Put(out, &d, 1) != 0)
+            {
+                return -1;
+            }
+        }
+        i = j + changed;
+    }
+    return 0;
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \brief   Make a patch that turns source into target
+ *
+ * \param   patch       Set to the patch, malloc'd
+ * \param   patchBytes  Set to its length
+ *
+ * \return  0 on success, -1 if memory runs out
+ */
+int FWD_Create(const uint8_t * source, size_t sourceBytes,
+               const uint8_t * target, size_t targetBytes,
+               uint8_t ** patch, size_t * patchBytes)
+{
+    FwdiffBuffer_t out = { 0 };
+    FwdiffMatch_t * matches = NULL;
+    size_t nrMatches = 0;
+    size_t maxMatches = 0;
+    int ret = -1;
+
+    int32_t * head = malloc(sizeof(int32_t) << FWDIFF_HASH_BITS);
+    int32_t * next = malloc(sizeof(int32_t) * (sourceBytes + 1));
+    if (head == NULL || next == NULL)
+    {
+        goto done;
+    }
+
+    // Chains of source positions by seed hash, latest first
+    memset(head, 0xff, sizeof(int32_t) << FWDIFF_HASH_BITS);
+    for (size_t s = 0; s + FWDIFF_SEED_BYTES <= sourceBytes; s++)
+    {
+        uint32_t h = SeedHash(&source[s]);
+        next[s] = head[h];
+        head[h] = s;
+    }
+
+    // Greedy matching, trying the previous alignment first
+    int64_t lastOffset = 0;
+    for (size_t t = 0; t + FWDIFF_SEED_BYTES <= targetBytes; )
+    {
+        uint32_t bestLength = 0;
+        uint32_t bestSource = 0;
+        int bestScore = 0;
+        int score;
+
+        int64_t aligned = (int64_t)t + lastOffset;
+        if (aligned >= 0 && aligned < (int64_t)sourceBytes)
+        {
+            bestLength = Extend(source, sourceBytes, target, targetBytes, aligned, t, &bestScore);
+            bestSource = aligned;
+        }
+
+        int32_t s = head[SeedHash(&target[t])];
+        for (int n = 0; s >= 0 && n < FWDIFF_CANDIDATES; n++, s = next[s])
+        {
+            if (memcmp(&source[s], &target[t], FWDIFF_SEED_BYTES) != 0)
+            {
+                continue;
+            }
+            uint32_t length = Extend(source, sourceBytes, target, targetBytes, s, t, &score);
+            if (score > bestScore)
+            {
+                bestScore = score;
+                bestLength = length;
+                bestSource = s;
+            }
+        }
+
+        if (bestLength < FWDIFF_MIN_MATCH)
+        {
+            t++;
+            continue;
+        }
+
+        if (nrMatches == maxMatches)
+        {
+            maxMatches = maxMatches ? 2 * maxMatches : 256;
+            FwdiffMatch_t * grown = realloc(matches, maxMatches * sizeof *matches);
+            if (grown == NULL)
+            {
+                goto done;
+            }
+            matches = grown;
+        }
+        matches[nrMatches++] = (FwdiffMatch_t){ t, bestSource, bestLength };
+        lastOffset = (int64_t)bestSource - (int64_t)t;
+        t += bestLength;
+    }
+
+    // Header
+    uint8_t hash[FIRMWARE_HASH_BYTES];
+    if (Put(&out, UPG_DELTA_MAGIC, 4) != 0 ||
+        PutLE32(&out, UPG_DELTA_VERSION) != 0 ||
+        PutLE32(&out, sourceBytes) != 0 ||
+        PutLE32(&out, targetBytes) != 0)
+    {
+        goto done;
+    }
+    mbedtls_sha256(source, sourceBytes, hash, 0);
+    if (Put(&out, hash, sizeof hash) != 0)
+    {
+        goto done;
+    }
+    mbedtls_sha256(target, targetBytes, hash, 0);
+    if (Put(&out, hash, sizeof hash) != 0)
+    {
+        goto done;
+    }
+
+    // One record per match, with the bytes up to the next match as extra.
+    // Anything before the first match is a record with no diff.
+    uint32_t sourceCursor = 0;
+    uint32_t targetCursor = 0;
+    for (size_t m = 0; m <= nrMatches; m++)
+    {
+        uint32_t diffBytes = 0;
+        uint32_t matchSource = sourceCursor;
+        if (m > 0)
+        {
+            diffBytes = matches[m - 1].length;
+            matchSource = matches[m - 1].source;
+        }
+        uint32_t extraStart = targetCursor + diffBytes;
+        uint32_t extraEnd = m < nrMatches ? matches[m].target : targetBytes;
+        uint32_t nextSource = m < nrMatches ? matches[m].source : matchSource + diffBytes;
+        int32_t seek = (int32_t)(nextSource - (matchSource + diffBytes));
+
+        if (m == 0 && extraEnd == 0 && nextSource == 0)
+        {
+            // The target starts with a match at the start of the source
+            continue;
+        }
+
+        if (PutVarint(&out, diffBytes) != 0 ||
+            PutVarint(&out, extraEnd - extraStart) != 0 ||
+            PutVarint(&out, ((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31)) != 0 ||
+            PutDiff(&out, &source[matchSource], &target[targetCursor], diffBytes) != 0 ||
+            Put(&out, &target[extraStart], extraEnd - extraStart) != 0)
+        {
+            goto done;
+        }
+        sourceCursor = nextSource;
+        targetCursor = extraEnd;
+    }
+
+    *patch = out.data;
+    *patchBytes = out.length;
+    out.data = NULL;
+    ret = 0;
+
+done:
+    free(out.data);
+    free(matches);
+    free(next);
+    free(head);
+    return ret;
+}
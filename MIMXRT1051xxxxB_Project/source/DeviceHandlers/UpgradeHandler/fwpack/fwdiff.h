@@ -0,0 +1,22 @@
+/*!****************************************************************************
+ *
+ * \file fwdiff.h
+ *
+ * \brief Delta patch generator for fwpack
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#ifndef FWDIFF_H
+#define FWDIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern int FWD_Create(const uint8_t * source, size_t sourceBytes,
+                      const uint8_t * target, size_t targetBytes,
+                      uint8_t ** patch, size_t * patchBytes);
+
+#endif /* FWDIFF_H */
@@ -0,0 +1,704 @@
+/*!****************************************************************************
+ *
+ * \file fwpack.c
+ *
+ * \brief Host tool to build, sign and check SJHF firmware images
+ *
+ *  fwpack keygen <key.pem>
+ *      Make a P-256 signing key and print it as UPG_SIGNING_KEY.
+ *
+ *  fwpack pubkey <key.pem>
+ *      Print the public half of a key as UPG_SIGNING_KEY.
+ *
+ *  fwpack pack -k <key.pem> [-e] [-n name] [-d index] [-w hwver] -o <out>
+ *              <PART>:<SEGMENT>:<file> ...
+ *      Build an image, one segment per file. Segments of the same part are
+ *      kept together in the order given. -e encrypts the header and the
+ *      parts with fresh random keys. Prints the install key and hash the
+ *      cloud passes to the gateway as upgrd_key and upgrd_hash.
+ *
+ *  fwpack verify -k <key.pem> [-K key] [-H hash] [-c chunk] [-o out] <in>
+ *      Feed an image through the gateway's streaming verifier, in pieces
+ *      of chunk bytes or random sizes, and write the plaintext it passes
+ *      on. The exit status is the UPG_Error_t.
+ *
+ *  fwpack diff <old> <new> <patch>
+ *      Make a delta patch from the old image to the new one. Pack it as a
+ *      DLTA segment of the OPER part to send it to a gateway running old.
+ *
+ *  fwpack apply [-a address] [-c chunk] <flash> <patch> <out>
+ *      Apply a patch the way the gateway does, reading the old image from
+ *      a flash dump at address and feeding the patch in pieces. The exit
+ *      status is the UPG_Error_t.
+ *
+ * The image layout is described in UPG_Verify.h and the patch layout in
+ * UPG_Delta.h.
+ *
+ * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/ecp.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/pk.h"
+
+#include "fwdiff.h"
+#include "UPG_Delta.h"
+#include "UPG_Verify.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define FWPACK_PEM_BYTES    1024
+#define FWPACK_MAX_CHUNK    4096
+
+/*!****************************************************************************
+ * Types
+ *****************************************************************************/
+
+typedef struct
+{
+    firmware_part_t part;
+    int segments;
+    uint8_t * data;             // Padded, and encrypted if there is a key
+} FwpackPart_t;
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static mbedtls_entropy_context entropy;
+static mbedtls_ctr_drbg_context drbg;
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+static void Usage(void)
+{
+    fprintf(stderr,
+            "usage: fwpack keygen <key.pem>\n"
+            "       fwpack pubkey <key.pem>\n"
+            "       fwpack pack -k <key.pem> [-e] [-n name] [-d index] [-w hwver] -o <out>\n"
+            "                   <PART>:<SEGMENT>:<file> ...\n"
+            "       fwpack verify -k <key.pem> [-K key] [-H hash] [-c chunk] [-o out] <in>\n"
+            "       fwpack diff <old> <new> <patch>\n"
+            "       fwpack apply [-a address] [-c chunk] <flash> <patch> <out>\n");
+    exit(EXIT_FAILURE);
+}
+
+static void Die(const char * what, int ret)
+{
+    fprintf(stderr, "fwpack: %s failed (-0x%04x)\n", what, -ret);
+    exit(EXIT_FAILURE);
+}
+
+static void Random(uint8_t * bytes, size_t length)
+{
+    int ret = mbedtls_ctr_drbg_random(&drbg, bytes, length);
+    if (ret != 0)
+    {
+        Die("random", ret);
+    }
+}
+
+static void PrintHex(const char * label, const uint8_t * bytes, size_t length)
+{
+    printf("%s", label);
+    for (size_t i = 0; i < length; i++)
+    {
+        printf("%02x", bytes[i]);
+    }
+    printf("\n");
+}
+
+static uint8_t * ReadFile(const char * name, size_t * length)
+{
+    FILE * f = fopen(name, "rb");
+    if (f == NULL)
+    {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t * data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size)
+    {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    *length = size;
+    return data;
+}
+
+static void WriteFile(FILE * f, const char * name, const void * data, size_t length)
+{
+    if (fwrite(data, 1, length, f) != length)
+    {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void MakeFourcc(char fourcc[4], const char * text, size_t length)
+{
+    if (length == 0 || length > 4)
+    {
+        fprintf(stderr, "fwpack: bad fourcc %.*s\n", (int)length, text);
+        exit(EXIT_FAILURE);
+    }
+    memset(fourcc, ' ', 4);
+    memcpy(fourcc, text, length);
+}
+
+static uint32_t Padded(uint32_t bytes)
+{
+    return (bytes + FIRMWARE_ENC_BLK_BYTES - 1) & ~(uint32_t)(FIRMWARE_ENC_BLK_BYTES - 1);
+}
+
+static void LoadKey(mbedtls_pk_context * pk, const char * name, bool needPrivate)
+{
+    mbedtls_pk_init(pk);
+    int ret = mbedtls_pk_parse_keyfile(pk, name, NULL);
+    if (ret != 0 && !needPrivate)
+    {
+        mbedtls_pk_free(pk);
+        mbedtls_pk_init(pk);
+        ret = mbedtls_pk_parse_public_keyfile(pk, name);
+    }
+    if (ret != 0)
+    {
+        Die(name, ret);
+    }
+    if (!mbedtls_pk_can_do(pk, MBEDTLS_PK_ECKEY) ||
+        mbedtls_pk_ec(*pk)->grp.id != MBEDTLS_ECP_DP_SECP256R1)
+    {
+        fprintf(stderr, "fwpack: %s is not a P-256 key\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void PublicKey(mbedtls_pk_context * pk, uint8_t point[UPG_VERIFY_PUBLIC_KEY_BYTES])
+{
+    size_t length;
+    mbedtls_ecp_keypair * ec = mbedtls_pk_ec(*pk);
+    int ret = mbedtls_ecp_point_write_binary(&ec->grp, &ec->Q, MBEDTLS_ECP_PF_UNCOMPRESSED,
+                                             &length, point, UPG_VERIFY_PUBLIC_KEY_BYTES);
+    if (ret != 0 || length != UPG_VERIFY_PUBLIC_KEY_BYTES)
+    {
+        Die("public key", ret);
+    }
+}
+
+static void PrintPublicKey(mbedtls_pk_context * pk)
+{
+    uint8_t point[UPG_VERIFY_PUBLIC_KEY_BYTES];
+    PublicKey(pk, point);
+    printf("#define UPG_SIGNING_KEY \\\n{");
+    for (int i = 0; i < UPG_VERIFY_PUBLIC_KEY_BYTES; i++)
+    {
+        printf("%s0x%02x", i % 12 == 0 ? " \\\n    " : " ", point[i]);
+        if (i + 1 < UPG_VERIFY_PUBLIC_KEY_BYTES)
+            printf(",");
+    }
+    printf(" \\\n}\n");
+}
+
+static void Crypt(const firmware_key_t * key, const uint8_t counterStart[16], uint8_t * data, size_t length)
+{
+    mbedtls_aes_context aes;
+    uint8_t counter[16];
+    uint8_t keyStream[16];
+    size_t counterOffset = 0;
+
+    memcpy(counter, counterStart, sizeof counter);
+    mbedtls_aes_init(&aes);
+    mbedtls_aes_setkey_enc(&aes, key->key_data, 8 * FIRMWARE_KEY_BYTES);
+    mbedtls_aes_crypt_ctr(&aes, length, &counterOffset, counter, keyStream, data, data);
+    mbedtls_aes_free(&aes);
+}
+
+static int Keygen(int argc, char * argv[])
+{
+    if (argc != 2)
+        Usage();
+
+    mbedtls_pk_context pk;
+    mbedtls_pk_init(&pk);
+    int ret = mbedtls_pk_setup(&pk, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
+    if (ret == 0)
+        ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(pk),
+                                  mbedtls_ctr_drbg_random, &drbg);
+    if (ret != 0)
+        Die("keygen", ret);
+
+    unsigned char pem[FWPACK_PEM_BYTES];
+    ret = mbedtls_pk_write_key_pem(&pk, pem, sizeof pem);
+    if (ret != 0)
+        Die("write key", ret);
+
+    FILE * f = fopen(argv[1], "wx");
+    if (f == NULL)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    WriteFile(f, argv[1], pem, strlen((char *)pem));
+    fclose(f);
+
+    PrintPublicKey(&pk);
+    mbedtls_pk_free(&pk);
+    return EXIT_SUCCESS;
+}
+
+static int Pubkey(int argc, char * argv[])
+{
+    if (argc != 2)
+        Usage();
+
+    mbedtls_pk_context pk;
+    LoadKey(&pk, argv[1], false);
+    PrintPublicKey(&pk);
+    mbedtls_pk_free(&pk);
+    return EXIT_SUCCESS;
+}
+
+static int Pack(int argc, char * argv[])
+{
+    const char * keyFile = NULL;
+    const char * outFile = NULL;
+    const char * name = "";
+    const char * hwver = "";
+    int di = 0;
+    bool encrypt = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:o:n:d:w:e")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k': keyFile = optarg; break;
+        case 'o': outFile = optarg; break;
+        case 'n': name = optarg; break;
+        case 'd': di = atoi(optarg); break;
+        case 'w': hwver = optarg; break;
+        case 'e': encrypt = true; break;
+        default: Usage();
+        }
+    }
+    if (keyFile == NULL || outFile == NULL || optind == argc)
+        Usage();
+
+    mbedtls_pk_context pk;
+    LoadKey(&pk, keyFile, true);
+
+    // Gather the segments into parts
+    FwpackPart_t parts[UPG_VERIFY_MAX_PARTS];
+    int nrParts = 0;
+    for (int arg = optind; arg < argc; arg++)
+    {
+        char * spec = argv[arg];
+        char * colon1 = strchr(spec, ':');
+        char * colon2 = colon1 ? strchr(colon1 + 1, ':') : NULL;
+        if (colon2 == NULL)
+            Usage();
+
+        char partFourcc[4];
+        MakeFourcc(partFourcc, spec, colon1 - spec);
+        FwpackPart_t * p = NULL;
+        for (int i = 0; i < nrParts; i++)
+        {
+            if (memcmp(parts[i].part.fourcc, partFourcc, 4) == 0)
+                p = &parts[i];
+        }
+        if (p == NULL)
+        {
+            if (nrParts == UPG_VERIFY_MAX_PARTS)
+            {
+                fprintf(stderr, "fwpack: more than %d parts\n", UPG_VERIFY_MAX_PARTS);
+                return EXIT_FAILURE;
+            }
+            p = &parts[nrParts++];
+            memset(p, 0, sizeof *p);
+            memset(p->part.segs, 0xff, sizeof p->part.segs);
+            memcpy(p->part.fourcc, partFourcc, 4);
+            if (encrypt)
+                Random(p->part.key.key_data, FIRMWARE_KEY_BYTES);
+        }
+        if (p->segments == FIRMWARE_NR_SEGS)
+        {
+            fprintf(stderr, "fwpack: more than %d segments in a part\n", FIRMWARE_NR_SEGS);
+            return EXIT_FAILURE;
+        }
+
+        size_t length;
+        uint8_t * raw = ReadFile(colon2 + 1, &length);
+        if (length == 0 || length > UPG_VERIFY_MAX_IMAGE_BYTES)
+        {
+            fprintf(stderr, "fwpack: %s is empty or too big\n", colon2 + 1);
+            return EXIT_FAILURE;
+        }
+
+        firmware_segment_t * seg = &p->part.segs[p->segments++];
+        memset(seg, 0, sizeof *seg);
+        MakeFourcc(seg->fourcc, colon1 + 1, colon2 - colon1 - 1);
+        seg->offset = p->part.bytes;
+        seg->bytes = length;
+        mbedtls_sha256(raw, length, seg->hash.hash_data, 0);
+
+        uint32_t padded = Padded(length);
+        p->data = realloc(p->data, p->part.bytes + padded);
+        if (p->data == NULL)
+            Die("realloc", 0);
+        uint8_t * dest = &p->data[p->part.bytes];
+        memcpy(dest, raw, length);
+        memset(dest + length, 0xff, padded - length);
+        if (encrypt)
+            Crypt(&p->part.key, seg->hash.hash_data, dest, padded);
+        p->part.bytes += padded;
+        free(raw);
+    }
+
+    // Header: intro, then parts
+    uint8_t * header = malloc(FIRMWARE_HEADER_BYTES);
+    if (header == NULL)
+        Die("malloc", 0);
+    memset(header, 0xff, FIRMWARE_HEADER_BYTES);
+
+    firmware_intro_t intro;
+    memset(&intro, 0, sizeof intro);
+    Random(intro.salt, sizeof intro.salt);
+    memcpy(intro.fourcc, FIRMWARE_FOURCC_HDR, 4);
+    strncpy(intro.name, name, sizeof intro.name - 1);
+    intro.major = FIRMWARE_MAJOR;
+    intro.minor = FIRMWARE_MINOR;
+    intro.di = di;
+    strncpy(intro.hwver, hwver, sizeof intro.hwver);
+    intro.nr_parts = nrParts;
+    memcpy(header, &intro, sizeof intro);
+
+    uint32_t offset = FIRMWARE_HEADER_BYTES;
+    for (int i = 0; i < nrParts; i++)
+    {
+        firmware_part_t * part = &parts[i].part;
+        mbedtls_sha256_context sha;
+        mbedtls_sha256_init(&sha);
+        mbedtls_sha256_starts(&sha, 0);
+        for (int s = 0; s < parts[i].segments; s++)
+        {
+            mbedtls_sha256_update(&sha, part->segs[s].hash.hash_data, FIRMWARE_HASH_BYTES);
+        }
+        mbedtls_sha256_finish(&sha, part->hash.hash_data);
+        mbedtls_sha256_free(&sha);
+
+        part->offset = offset;
+        offset += part->bytes;
+        if (offset > UPG_VERIFY_MAX_IMAGE_BYTES)
+        {
+            fprintf(stderr, "fwpack: image too big\n");
+            return EXIT_FAILURE;
+        }
+        memcpy(&header[FIRMWARE_INTRO_BYTES + i * FIRMWARE_PART_BYTES], part, sizeof *part);
+    }
+
+    firmware_key_t installKey;
+    memset(&installKey, 0, sizeof installKey);
+    if (encrypt)
+    {
+        Random(installKey.key_data, FIRMWARE_KEY_BYTES);
+        Crypt(&installKey, intro.salt, &header[FIRMWARE_PLAINTEXT_BYTES],
+              FIRMWARE_PUBKEY_OFFSET - FIRMWARE_PLAINTEXT_BYTES);
+    }
+
+    // Sign the header as stored
+    uint8_t digest[FIRMWARE_HASH_BYTES];
+    uint8_t sig[MBEDTLS_ECDSA_MAX_LEN];
+    size_t sigBytes;
+    mbedtls_sha256(header, FIRMWARE_PUBKEY_OFFSET, digest, 0);
+    int ret = mbedtls_pk_sign(&pk, MBEDTLS_MD_SHA256, digest, sizeof digest, sig, &sigBytes,
+                              mbedtls_ctr_drbg_random, &drbg);
+    if (ret != 0)
+        Die("sign", ret);
+    header[FIRMWARE_PUBKEY_OFFSET] = sigBytes & 0xff;
+    header[FIRMWARE_PUBKEY_OFFSET + 1] = sigBytes >> 8;
+    memcpy(&header[FIRMWARE_PUBKEY_OFFSET + 2], sig, sigBytes);
+
+    firmware_hash_t installHash;
+    mbedtls_sha256(header, FIRMWARE_HEADER_BYTES, installHash.hash_data, 0);
+
+    FILE * f = fopen(outFile, "wb");
+    if (f == NULL)
+    {
+        perror(outFile);
+        return EXIT_FAILURE;
+    }
+    WriteFile(f, outFile, header, FIRMWARE_HEADER_BYTES);
+    for (int i = 0; i < nrParts; i++)
+    {
+        WriteFile(f, outFile, parts[i].data, parts[i].part.bytes);
+        free(parts[i].data);
+    }
+    if (fclose(f) != 0)
+    {
+        perror(outFile);
+        return EXIT_FAILURE;
+    }
+
+    if (encrypt)
+        PrintHex("key  ", installKey.key_data, FIRMWARE_KEY_BYTES);
+    else
+        printf("key  \n");
+    PrintHex("hash ", installHash.hash_data, FIRMWARE_HASH_BYTES);
+
+    free(header);
+    mbedtls_pk_free(&pk);
+    return EXIT_SUCCESS;
+}
+
+static int Sink(void * context, const firmware_part_t * part, const firmware_segment_t * segment,
+                const uint8_t * data, size_t length)
+{
+    FILE * f = context;
+    return f != NULL && fwrite(data, 1, length, f) != length ? -1 : 0;
+}
+
+static int Verify(int argc, char * argv[])
+{
+    const char * keyFile = NULL;
+    const char * outFile = NULL;
+    const char * keyHex = NULL;
+    const char * hashHex = NULL;
+    size_t chunk = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:o:K:H:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k': keyFile = optarg; break;
+        case 'o': outFile = optarg; break;
+        case 'K': keyHex = optarg; break;
+        case 'H': hashHex = optarg; break;
+        case 'c': chunk = strtoul(optarg, NULL, 0); break;
+        default: Usage();
+        }
+    }
+    if (keyFile == NULL || optind + 1 != argc)
+        Usage();
+
+    mbedtls_pk_context pk;
+    uint8_t point[UPG_VERIFY_PUBLIC_KEY_BYTES];
+    LoadKey(&pk, keyFile, false);
+    PublicKey(&pk, point);
+    mbedtls_pk_free(&pk);
+
+    size_t length;
+    uint8_t * image = ReadFile(argv[optind], &length);
+
+    FILE * out = NULL;
+    if (outFile)
+    {
+        out = fopen(outFile, "wb");
+        if (out == NULL)
+        {
+            perror(outFile);
+            return EXIT_FAILURE;
+        }
+    }
+
+    UPG_Verify_t verify;
+    UPG_Error_t error = UPG_VerifyInit(&verify, point, keyHex, hashHex, Sink, out);
+    for (size_t done = 0; error == UPGRADE_ERR_NONE && done < length; )
+    {
+        // Random piece sizes stand in for TLS records of any length
+        uint8_t r[2];
+        Random(r, sizeof r);
+        size_t piece = chunk ? chunk : 1 + ((r[0] << 8 | r[1]) % FWPACK_MAX_CHUNK);
+        if (piece > length - done)
+            piece = length - done;
+        error = UPG_VerifyWrite(&verify, &image[done], piece);
+        done += piece;
+    }
+    if (error == UPGRADE_ERR_NONE)
+        error = UPG_VerifyFinish(&verify);
+
+    if (error == UPGRADE_ERR_NONE)
+        printf("OK %s\n", verify.intro.name);
+    else
+        printf("FAILED %d: %s\n", error, verify.reason);
+
+    UPG_VerifyFree(&verify);
+    if (out)
+        fclose(out);
+    free(image);
+    return error;
+}
+
+static int Diff(int argc, char * argv[])
+{
+    if (argc != 4)
+        Usage();
+
+    size_t sourceBytes;
+    size_t targetBytes;
+    uint8_t * source = ReadFile(argv[1], &sourceBytes);
+    uint8_t * target = ReadFile(argv[2], &targetBytes);
+    if (targetBytes == 0 || targetBytes > UINT32_MAX || sourceBytes > UINT32_MAX)
+    {
+        fprintf(stderr, "fwpack: bad image sizes\n");
+        return EXIT_FAILURE;
+    }
+
+    uint8_t * patch;
+    size_t patchBytes;
+    if (FWD_Create(source, sourceBytes, target, targetBytes, &patch, &patchBytes) != 0)
+        Die("diff", 0);
+
+    FILE * f = fopen(argv[3], "wb");
+    if (f == NULL)
+    {
+        perror(argv[3]);
+        return EXIT_FAILURE;
+    }
+    WriteFile(f, argv[3], patch, patchBytes);
+    if (fclose(f) != 0)
+    {
+        perror(argv[3]);
+        return EXIT_FAILURE;
+    }
+    printf("%zu -> %zu bytes, patch %zu bytes\n", sourceBytes, targetBytes, patchBytes);
+
+    free(patch);
+    free(target);
+    free(source);
+    return EXIT_SUCCESS;
+}
+
+typedef struct
+{
+    FILE * flash;
+    long address;
+    FILE * out;
+} FwpackApply_t;
+
+static int FlashRead(void * context, uint32_t offset, uint8_t * data, size_t length)
+{
+    FwpackApply_t * apply = context;
+    if (fseek(apply->flash, apply->address + offset, SEEK_SET) != 0)
+        return -1;
+    return fread(data, 1, length, apply->flash) == length ? 0 : -1;
+}
+
+static int ApplySink(void * context, const uint8_t * data, size_t length)
+{
+    FwpackApply_t * apply = context;
+    return fwrite(data, 1, length, apply->out) == length ? 0 : -1;
+}
+
+static int Apply(int argc, char * argv[])
+{
+    FwpackApply_t apply = { 0 };
+    size_t chunk = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a': apply.address = strtol(optarg, NULL, 0); break;
+        case 'c': chunk = strtoul(optarg, NULL, 0); break;
+        default: Usage();
+        }
+    }
+    if (optind + 3 != argc)
+        Usage();
+
+    size_t length;
+    uint8_t * patch = ReadFile(argv[optind + 1], &length);
+    apply.flash = fopen(argv[optind], "rb");
+    if (apply.flash == NULL)
+    {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    apply.out = fopen(argv[optind + 2], "wb");
+    if (apply.out == NULL)
+    {
+        perror(argv[optind + 2]);
+        return EXIT_FAILURE;
+    }
+
+    UPG_Delta_t delta;
+    UPG_Error_t error = UPGRADE_ERR_NONE;
+    UPG_DeltaInit(&delta, FlashRead, ApplySink, &apply);
+    for (size_t done = 0; error == UPGRADE_ERR_NONE && done < length; )
+    {
+        uint8_t r[2];
+        Random(r, sizeof r);
+        size_t piece = chunk ? chunk : 1 + ((r[0] << 8 | r[1]) % FWPACK_MAX_CHUNK);
+        if (piece > length - done)
+            piece = length - done;
+        error = UPG_DeltaWrite(&delta, &patch[done], piece);
+        done += piece;
+    }
+    if (error == UPGRADE_ERR_NONE)
+        error = UPG_DeltaFinish(&delta);
+
+    if (error == UPGRADE_ERR_NONE)
+        printf("OK %" PRIu32 " bytes\n", delta.targetBytes);
+    else
+        printf("FAILED %d: %s\n", error, delta.reason);
+
+    UPG_DeltaFree(&delta);
+    fclose(apply.out);
+    fclose(apply.flash);
+    free(patch);
+    return error;
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2)
+        Usage();
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                    (const unsigned char *)"fwpack", 6);
+    if (ret != 0)
+        Die("seed", ret);
+
+    const char * command = argv[1];
+    argc--;
+    argv++;
+    if (strcmp(command, "keygen") == 0)
+        return Keygen(argc, argv);
+    if (strcmp(command, "pubkey") == 0)
+        return Pubkey(argc, argv);
+    if (strcmp(command, "pack") == 0)
+        return Pack(argc, argv);
+    if (strcmp(command, "verify") == 0)
+        return Verify(argc, argv);
+    if (strcmp(command, "diff") == 0)
+        return Diff(argc, argv);
+    if (strcmp(command, "apply") == 0)
+        return Apply(argc, argv);
+    Usage();
+    return EXIT_FAILURE;
+}
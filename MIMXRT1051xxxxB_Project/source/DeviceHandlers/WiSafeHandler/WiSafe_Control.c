@@ -11,6 +11,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include "assert.h"
 
 #include "ECOM_Messages.h"
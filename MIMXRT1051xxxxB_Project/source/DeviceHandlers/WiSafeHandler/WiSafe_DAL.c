@@ -11,6 +11,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
@@ -22,12 +24,23 @@
 #include "LSD_Api.h"
 #include "APP_Types.h"
 #include "HAL.h"
+#include "OSAL_Api.h"
 
 #include "WiSafe_DAL.h"
 #include "WiSafe_Main.h"
+#include "WiSafe_Faults.h"
 
 #define DAL_DBG(x...) LOG_InfoC(x)
 
+/* One entry per SID, the same as the bits of a SID map. */
+#define DAL_SID_INDEX_SIZE 64
+
+/* SID to device table, so a device can be found from its SID without reading
+ * the SID property of every device. It mirrors the reported SID properties. */
+static deviceId_t sidIndex[DAL_SID_INDEX_SIZE];
+static uint64_t sidIndexValid;
+static Mutex_t sidIndexLock;
+
 
 /**
  * Helper to decide whether this property is persistent or not
@@ -72,6 +85,40 @@ static PropertyKind_e WiSafe_DALPropertyKind(EnsoAgentSidePropertyId_t agentSide
             ? PROPERTY_PUBLIC : PROPERTY_PRIVATE;
 }
 
+/**
+ * Helper to decide how changes to a property may be merged while they wait
+ * to be sent to the cloud. Alarm and fault states, and the sequence numbers
+ * and times reported with them, are never merged across a change.
+ *
+ * @param agentSideId Agent side ID.
+ *
+ * @return How the property coalesces.
+ */
+static LSD_Coalesce_e WiSafe_DALCoalesceKind(const EnsoAgentSidePropertyId_t agentSideId)
+{
+    if (DAL_PROPERTY_DEVICE_BATTERY_VOLTAGE_IDX   == agentSideId ||
+        DAL_PROPERTY_DEVICE_TEMPERATURE_IDX       == agentSideId ||
+        DAL_PROPERTY_DEVICE_RADIO_RSSI_IDX        == agentSideId ||
+        DAL_PROPERTY_DEVICE_RADIO_FAULT_COUNT_IDX == agentSideId ||
+        DAL_PROPERTY_DEVICE_LAST_SEQUENCE_IDX     == agentSideId)
+    {
+        return LSD_COALESCE_LATEST;
+    }
+
+    if (DAL_PROPERTY_DEVICE_ALARM_STATE_IDX == agentSideId ||
+        DAL_PROPERTY_DEVICE_MUTE_IDX        == agentSideId ||
+        DAL_PROPERTY_DEVICE_MISSING_IDX     == agentSideId ||
+        DAL_PROPERTY_IN_NETWORK_IDX         == agentSideId ||
+        (agentSideId >= DAL_PROPERTY_DEVICE_FAULT_IDX &&
+         agentSideId < DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX))
+    {
+        // Faults (flt<n>) and fault states (flt<n>_state)
+        return LSD_COALESCE_SAME_STATE;
+    }
+
+    return LSD_COALESCE_NEVER;
+}
+
 /**
  * Helper to convert from a WiSafe device ID to an AWS Thing ID.
  *
@@ -101,6 +148,119 @@ EnsoDeviceId_t EnsoDeviceFromWiSafeID(deviceId_t id)
     return result;
 }
 
+/**
+ * Remove a device from the SID index. Must be called with the lock held.
+ *
+ * @param id The device ID.
+ */
+static void SidIndexRemoveLocked(deviceId_t id)
+{
+    for (int sid = 0; sid < DAL_SID_INDEX_SIZE; sid += 1)
+    {
+        if ((sidIndexValid & (1ULL << sid)) && (sidIndex[sid] == id))
+        {
+            sidIndexValid &= ~(1ULL << sid);
+        }
+    }
+}
+
+/**
+ * Record the SID of a device in the SID index, replacing any SID it had.
+ *
+ * @param id The device ID.
+ * @param sid The SID of the device.
+ */
+static void SidIndexSet(deviceId_t id, uint32_t sid)
+{
+    if (id == GATEWAY_DEVICE_ID)
+    {
+        return;
+    }
+
+    OSAL_LockMutex(&sidIndexLock);
+    SidIndexRemoveLocked(id);
+    if (sid < DAL_SID_INDEX_SIZE)
+    {
+        sidIndex[sid] = id;
+        sidIndexValid |= (1ULL << sid);
+    }
+    OSAL_UnLockMutex(&sidIndexLock);
+}
+
+/**
+ * Remove a device from the SID index.
+ *
+ * @param id The device ID.
+ */
+static void SidIndexRemove(deviceId_t id)
+{
+    OSAL_LockMutex(&sidIndexLock);
+    SidIndexRemoveLocked(id);
+    OSAL_UnLockMutex(&sidIndexLock);
+}
+
+/**
+ * Find the device with the given SID by reading the SID property of
+ * every device in the shadow.
+ *
+ * @param requiredSid The required SID.
+ * @param result Storage for the result.
+ *
+ * @return True if result written, else false.
+ */
+static bool ScanForDeviceIdForSID(uint8_t requiredSid, deviceId_t* result)
+{
+    EnsoDeviceId_t buffer[DAL_MAXIMUM_NUMBER_WISAFE_DEVICES];
+    HandlerId_e handlerId = WISAFE_DEVICE_HANDLER;
+    uint16_t numDevices = 0;
+    EnsoErrorCode_e error = LSD_GetDevicesId(handlerId, buffer, DAL_MAXIMUM_NUMBER_WISAFE_DEVICES, &numDevices);
+
+    if (error == eecNoError)
+    {
+        for (int loop = 0; loop < numDevices; loop += 1)
+        {
+            EnsoPropertyValue_u sid;
+            EnsoErrorCode_e error = LSD_GetPropertyValueByAgentSideId(&(buffer[loop]), REPORTED_GROUP, DAL_PROPERTY_DEVICE_SID_IDX, &sid);
+            if ((error == eecNoError) && (sid.uint32Value == requiredSid))
+            {
+                /* We've found it. So get the device ID. */
+                *result = buffer[loop].deviceAddress;
+                return true;
+            }
+        }
+    }
+
+    /* Not found. */
+    return false;
+}
+
+/**
+ * Rebuild the SID index from the SID properties in the shadow.
+ *
+ */
+static void SidIndexRebuild(void)
+{
+    EnsoDeviceId_t buffer[DAL_MAXIMUM_NUMBER_WISAFE_DEVICES];
+    uint16_t numDevices = 0;
+    EnsoErrorCode_e error = LSD_GetDevicesId(WISAFE_DEVICE_HANDLER, buffer, DAL_MAXIMUM_NUMBER_WISAFE_DEVICES, &numDevices);
+
+    OSAL_LockMutex(&sidIndexLock);
+    sidIndexValid = 0;
+    OSAL_UnLockMutex(&sidIndexLock);
+
+    if (error == eecNoError)
+    {
+        for (int loop = 0; loop < numDevices; loop += 1)
+        {
+            EnsoPropertyValue_u sid;
+            if (LSD_GetPropertyValueByAgentSideId(&(buffer[loop]), REPORTED_GROUP, DAL_PROPERTY_DEVICE_SID_IDX, &sid) == eecNoError)
+            {
+                SidIndexSet((deviceId_t)buffer[loop].deviceAddress, sid.uint32Value);
+            }
+        }
+    }
+}
+
 /**
  * Delete the given device and all its properties, and free all
  * associated memory.
@@ -112,6 +272,8 @@ void WiSafe_DALDeleteDevice(deviceId_t id)
     EnsoDeviceId_t ensoId = EnsoDeviceFromWiSafeID(id);
     DAL_DBG(LOG_BLUE "Deleting device id=%016llx", ensoId.deviceAddress);
     LSD_DestroyEnsoDevice(ensoId);
+    SidIndexRemove(id);
+    WiSafe_FaultsDeleteDevice(id);
     return;
 }
 
@@ -121,6 +283,10 @@ void WiSafe_DALDeleteDevice(deviceId_t id)
  */
 void WiSafe_DALInit(void)
 {
+    OSAL_InitMutex(&sidIndexLock, NULL);
+    SidIndexRebuild();
+
+    LSD_SetCoalesceKindFunction(WiSafe_DALCoalesceKind);
 }
 
 /**
@@ -338,6 +504,10 @@ static EnsoErrorCode_e SetPropertyHelper(const char* logHint, deviceId_t id, Ens
             DAL_DBG(LOG_RED "Unable to create/set group of properties - %s",
                     LSD_EnsoErrorCode_eToString(retVal));
         }
+        else if ((agentSideId == DAL_PROPERTY_DEVICE_SID_IDX) && (group == REPORTED_GROUP))
+        {
+            SidIndexSet(id, newValue.uint32Value);
+        }
     }
 
     return retVal;
@@ -450,6 +620,10 @@ EnsoErrorCode_e WiSafe_DALCreateProperty(deviceId_t id, EnsoAgentSidePropertyId_
         {
             LOG_Error("Failed to create property %s (%x)", name, agentSideId);
         }
+        else if (agentSideId == DAL_PROPERTY_DEVICE_SID_IDX)
+        {
+            SidIndexSet(id, newValue.uint32Value);
+        }
     }
     else
     {
@@ -476,6 +650,11 @@ extern EnsoErrorCode_e WiSafe_DALDeleteProperty(deviceId_t id, EnsoAgentSideProp
 
     EnsoErrorCode_e result = LSD_RemovePropertyByAgentSideId(&ensoId, agentSideId);
 
+    if ((result == eecNoError) && (agentSideId == DAL_PROPERTY_DEVICE_SID_IDX))
+    {
+        SidIndexRemove(id);
+    }
+
     if ((result != eecNoError) && (result != eecPropertyNotFound))
     {
         LOG_Error("Failed to delete property '%s'.", name);
@@ -577,7 +756,8 @@ EnsoPropertyValue_u WiSafe_DALGetDesiredProperty(deviceId_t id, EnsoAgentSidePro
 }
 
 /**
- * Get the device ID (if known) for the device with the given SID.
+ * Get the device ID (if known) for the device with the given SID, from
+ * the SID index.
  *
  * @param requiredSid The required SID.
  * @param result Storage for the result.
@@ -586,28 +766,33 @@ EnsoPropertyValue_u WiSafe_DALGetDesiredProperty(deviceId_t id, EnsoAgentSidePro
  */
 bool WiSafe_DALGetDeviceIdForSID(uint8_t requiredSid, deviceId_t* result)
 {
-    EnsoDeviceId_t buffer[DAL_MAXIMUM_NUMBER_WISAFE_DEVICES];
-    HandlerId_e handlerId = WISAFE_DEVICE_HANDLER;
-    uint16_t numDevices = 0;
-    EnsoErrorCode_e error = LSD_GetDevicesId(handlerId, buffer, DAL_MAXIMUM_NUMBER_WISAFE_DEVICES, &numDevices);
+    if (requiredSid >= DAL_SID_INDEX_SIZE)
+    {
+        return ScanForDeviceIdForSID(requiredSid, result);
+    }
 
-    if (error == eecNoError)
+    OSAL_LockMutex(&sidIndexLock);
+    bool found = (sidIndexValid & (1ULL << requiredSid)) != 0;
+    deviceId_t id = sidIndex[requiredSid];
+    OSAL_UnLockMutex(&sidIndexLock);
+
+#if ENHANCED_DEBUG
+    /* Check the index against the SID properties in the shadow. */
+    deviceId_t shadowId = 0;
+    bool shadowFound = ScanForDeviceIdForSID(requiredSid, &shadowId);
+    if ((shadowFound != found) || (found && (shadowId != id)))
     {
-        for (int loop = 0; loop < numDevices; loop += 1)
-        {
-            EnsoPropertyValue_u sid;
-            EnsoErrorCode_e error = LSD_GetPropertyValueByAgentSideId(&(buffer[loop]), REPORTED_GROUP, DAL_PROPERTY_DEVICE_SID_IDX, &sid);
-            if ((error == eecNoError) && (sid.uint32Value == requiredSid))
-            {
-                /* We've found it. So get the device ID. */
-                *result = buffer[loop].deviceAddress;
-                return true;
-            }
-        }
+        LOG_Error("SID index mismatch for sid=%u: index %s 0x%06x, shadow %s 0x%06x",
+                requiredSid, found ? "has" : "lacks", id, shadowFound ? "has" : "lacks", shadowId);
     }
+#endif
 
-    /* Not found. */
-    return false;
+    if (found)
+    {
+        *result = id;
+    }
+
+    return found;
 }
 
 /**
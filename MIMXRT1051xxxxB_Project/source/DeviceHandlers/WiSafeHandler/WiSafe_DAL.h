@@ -20,7 +20,8 @@
 
 typedef const char* propertyName_t;
 
-#define DAL_MAXIMUM_NUMBER_WISAFE_DEVICES (50)
+// One device per SID, a WiSafe network has 64
+#define DAL_MAXIMUM_NUMBER_WISAFE_DEVICES (64)
 
 #define DAL_PROP_ID(x)                           (PROP_GROUP_WISAFE | x)
 
@@ -13,6 +13,8 @@
 
 //#include <unistd.h>
 //#include <sys/time.h>
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
@@ -1527,7 +1529,6 @@ void WiSafe_DiscoveryInterrogateUnknownDevicesContinue(void)
             /* See if this is an "unknown" device. */
             deviceId_t deviceId;
             bool alreadyExists = WiSafe_DALGetDeviceIdForSID(currentUnknownSid, &deviceId);
-            // G2-556 It is very inefficient to call WiSafe_DALGetDeviceIdForSID in this loop as each call to WiSafe_DALGetDeviceIdForSID requires a call to the local shadow to get a list of devices which is then searched for a matching sid.
             if ((!alreadyExists) && (currentUnknownSid != gateWaySid))  //ABR bug fix
             {
                 //ABR changed
@@ -1666,7 +1667,6 @@ void WiSafe_DiscoveryProcessSIDMap(uint8_t* mapData)
             /* See if this is an "unknown" device. */
             deviceId_t deviceId;
             bool alreadyExists = WiSafe_DALGetDeviceIdForSID((uint8_t)sid, &deviceId);
-            // G2-556 It is very inefficient to call WiSafe_DALGetDeviceIdForSID in this loop as each call to WiSafe_DALGetDeviceIdForSID requires a call to the local shadow to get a list of devices which is then searched for a matching sid.
             if (!alreadyExists)
             {
                 if ((uint8_t)sid != gateWaySid)
@@ -2380,28 +2380,9 @@ static EnsoErrorCode_e WiSafe_CalculateShadowSIDMap(uint8_t* resultMap)
  */
 static EnsoErrorCode_e FindDeviceBySID(uint32_t requiredSid, deviceId_t* device)
 {
-    /* Get all devices. */
-     LOG_Error("NDI FindDeviceBySID ");
-    uint16_t numDevices = 0;
-    deviceId_t buffer[DAL_MAXIMUM_NUMBER_WISAFE_DEVICES];
-    EnsoErrorCode_e result = WiSafe_DALDevicesEnumerate(buffer, DAL_MAXIMUM_NUMBER_WISAFE_DEVICES, &numDevices);
-    if (result == eecNoError)
+    if ((requiredSid <= UINT8_MAX) && WiSafe_DALGetDeviceIdForSID((uint8_t)requiredSid, device))
     {
-        /* Iterate through all devices. */
-        for (uint16_t loop = 0; loop < numDevices; loop += 1)
-        {
-            /* Get the SID for this device, and see if it's what we want? */
-            deviceId_t current = buffer[loop];
-            EnsoPropertyValue_u sid = WiSafe_DALGetReportedProperty(current, DAL_PROPERTY_DEVICE_SID_IDX, &result);
-            if (result == eecNoError)
-            {
-                if (sid.uint32Value == requiredSid)
-                {
-                    *device = current;
-                    return eecNoError;
-                }
-            }
-        }
+        return eecNoError;
     }
 
     return eecEnsoObjectNotFound;
@@ -11,6 +11,8 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <string.h>
 
 #include "LOG_Api.h"
@@ -774,13 +776,13 @@ void WiSafe_EngineProcessControlMessage(controlEntry_t* message)
     }
 }
 
-void WiSafe_EngineProcessGroupDelta(EnsoDeviceId_t* deviceId, EnsoPropertyDelta_t deltas[], int numProperties)
+void WiSafe_EngineProcessGroupDelta(EnsoDeviceId_t* deviceId, const EnsoPropertyDelta_t deltas[], int numProperties)
 {
     /* We need to spot the special case of learn-in. */
     bool isLearnIn = false;
     for (int idx = 0; idx < numProperties; idx += 1)
     {
-        EnsoPropertyDelta_t* delta = &(deltas[idx]);
+        const EnsoPropertyDelta_t* delta = &(deltas[idx]);
         if (delta->agentSidePropertyID == DAL_COMMAND_LEARN_IDX)
         {
             isLearnIn = true;
@@ -791,7 +793,7 @@ void WiSafe_EngineProcessGroupDelta(EnsoDeviceId_t* deviceId, EnsoPropertyDelta_
     /* Iterate over all the properties that have changed, and process them. */
     for (int idx = 0; idx < numProperties; idx += 1)
     {
-        EnsoPropertyDelta_t* delta = &(deltas[idx]);
+        const EnsoPropertyDelta_t* delta = &(deltas[idx]);
 
         /* Get the property name for debugging. */
         char propName[LSD_PROPERTY_NAME_BUFFER_SIZE] = {0,};
@@ -818,7 +820,7 @@ void WiSafe_EngineProcessGroupDelta(EnsoDeviceId_t* deviceId, EnsoPropertyDelta_
  * @param deviceId The device that has the delta.
  * @param delta    The delta.
  */
-void WiSafe_EngineProcessPropertyDelta(EnsoDeviceId_t* deviceId, EnsoPropertyDelta_t* delta)
+void WiSafe_EngineProcessPropertyDelta(EnsoDeviceId_t* deviceId, const EnsoPropertyDelta_t* delta)
 {
     if (delta != NULL || deviceId != NULL)
     {
@@ -25,7 +25,7 @@
 
 extern void WiSafe_EngineProcessRX(radioCommsBuffer_t* buf);
 extern void WiSafe_EngineProcessControlMessage(controlEntry_t* message);
-extern void WiSafe_EngineProcessPropertyDelta(EnsoDeviceId_t* deviceId, EnsoPropertyDelta_t* delta);
-extern void WiSafe_EngineProcessGroupDelta(EnsoDeviceId_t* deviceId, EnsoPropertyDelta_t deltas[], int numProperties);
+extern void WiSafe_EngineProcessPropertyDelta(EnsoDeviceId_t* deviceId, const EnsoPropertyDelta_t* delta);
+extern void WiSafe_EngineProcessGroupDelta(EnsoDeviceId_t* deviceId, const EnsoPropertyDelta_t deltas[], int numProperties);
 
 #endif /* _WISAFEENGINE_H_ */
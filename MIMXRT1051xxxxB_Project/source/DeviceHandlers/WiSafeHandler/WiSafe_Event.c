@@ -11,6 +11,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdio.h>
 #include <string.h>
 //#include <sys/time.h>
@@ -26,6 +28,7 @@
 #include "WiSafe_Discovery.h"
 #include "WiSafe_RadioComms.h"
 #include "WiSafe_Main.h"
+#include "WiSafe_Faults.h"
 
 // Length of the Fault Details bit map
 #define FAULT_MAP_LENGTH 16
@@ -33,16 +36,8 @@
 #define FAULT_FLAGS_LENGTH 8
 
 #define NO_FAULT_CODE 0
-#define MAX_FAULT_CODE 99
 #define NO_FAULT_DETAIL_TYPES 9
 
-// Length of fault property strings plus null terminator
-#define FAULTPROPERTYLENGTH       5 + 1
-#define FAULTSTATEPROPERTYLENGTH 11 + 1     // flt90_state
-#define FAULTSEQPROPERTYLENGTH    9 + 1     // flt90_seq
-#define FAULTTIMEPROPERTYLENGTH  10 + 1     // flt90_time
-#define FAULTBATTVPROPERTYLENGTH 11 + 1     // flt90_battv
-
 enum spruefaultstatusbits
 {
     FAULT_IS_CALIBRATED    = 0x01,
@@ -528,148 +523,15 @@ void SendFaultEvent(const deviceId_t did,
     LOG_Trace("received fault active = %u, code = %u",
               receivedFaultActive, code);
 
-    if (code > NO_FAULT_CODE && code <= MAX_FAULT_CODE)
+    if (code > NO_FAULT_CODE && code <= WISAFE_FAULT_MAX_CODE)
     {
-        char faultName[FAULTPROPERTYLENGTH] = {0};
-        int printcount = snprintf(faultName, FAULTPROPERTYLENGTH, "%s%02u",
-                DAL_PROPERTY_DEVICE_FAULT, code);
-        assert(printcount < FAULTPROPERTYLENGTH);
-        LOG_Trace("faultName = |%s|",faultName);
-
-        // Read the fault state property, if it doesn't exists yet
-        // then it defaults to false (i.e. fault inactive).
-        uint32_t propertyId = DAL_PROPERTY_DEVICE_FAULT_STATE_IDX + code;
-        LOG_Trace("propertyId = %u",propertyId);
-        EnsoErrorCode_e error;
-        EnsoPropertyValue_u stored_state = WiSafe_DALGetReportedProperty(
-                did,
-                propertyId,
-                &error);
-
-        bool updateFaultProperties = true;
-        if (error == eecNoError || error == eecPropertyNotFound)
-        {
-            if (error == eecPropertyNotFound)
-            {
-                // Property doesn't exist yet so default to inactive.
-                stored_state.booleanValue = false;
-            }
-            // We have read the fault state property or the property doesn't
-            // exist yet. i.e. its the first time the fault has been raised.
-            // Check the stored and received flags
-            if ( !stored_state.booleanValue &&
-                 !receivedFaultActive)
-            {
-                // Not a new fault and its not a fault clear. Nothing to do.
-                updateFaultProperties = false;
-            }
-        }
-
-        if (updateFaultProperties)
+        // The fault table keeps the state, sequence number, time and battery
+        // voltage of each fault and notifies the flt<code>_* properties.
+        EnsoErrorCode_e error = WiSafe_FaultsReport(did, code, receivedFaultActive,
+                voltsPresent, mVolts);
+        if (error == eecNoChange)
         {
-            // Read the fault sequence number property, if it doesn't exists yet
-            // then it starts at zero.
-            uint32_t propertyId = DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX + code;
-            LOG_Trace("propertyId = %u",propertyId);
-            EnsoErrorCode_e error;
-            EnsoPropertyValue_u sequenceNo = WiSafe_DALGetReportedProperty(
-                    did,
-                    propertyId,
-                    &error);
-
-            if (error == eecNoError)
-            {
-                // We have read the sequence number property which implies it
-                // already exists. If the stored state was inactive and the new
-                // state is active then increase the sequence number.
-
-                if ( !stored_state.booleanValue &&
-                     receivedFaultActive )
-                {
-                    // New fault has been raised. Increase the sequence number.
-                    sequenceNo.uint32Value++;
-                    LOG_Trace("Increase sequence to %u", sequenceNo.uint32Value);
-                }
-            }
-            else
-            {
-                // Sequence number property doesn't exist so start at zero.
-                sequenceNo.uint32Value = 0;
-            }
-
-            if (error == eecNoError || error == eecPropertyNotFound)
-            {
-                // Either
-                // - we have read the sequence number property or
-                // - the property doesn't exist yet. i.e. its the first time the
-                //   fault has been raised.
-
-                // Create or update the group of properties making this alarm
-
-                // Battery voltage property is optional - do this first
-                if (voltsPresent)
-                {
-                    // The voltage is received in mV and
-                    // we convert it to units of 100mV.
-                    EnsoPropertyValue_u valueV = { .uint32Value = mVolts / 10};
-
-                    char faultNameBattV[FAULTBATTVPROPERTYLENGTH];
-                    printcount = snprintf(faultNameBattV, FAULTBATTVPROPERTYLENGTH,
-                            "%s%s", faultName, DAL_PROPERTY_DEVICE_FAULT_BATTV);
-                    assert(printcount < FAULTBATTVPROPERTYLENGTH);
-                    LOG_Trace("faultNameBattV = |%s|",faultNameBattV);
-                    WiSafe_DALSetReportedProperty(
-                            did,
-                            DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX + code,
-                            faultNameBattV,
-                            evUnsignedInt32,
-                            valueV);
-                }
-
-                // Create or update the group of properties making this fault
-                EnsoAgentSidePropertyId_t agentSideId[3];
-                const char* cloudName[3];
-                EnsoValueType_e type[3];
-                EnsoPropertyValue_u value[3];
-
-                // Fault state property
-                char faultNameState[FAULTSTATEPROPERTYLENGTH];
-                int printcount = snprintf(faultNameState, FAULTSTATEPROPERTYLENGTH,
-                        "%s%s", faultName, DAL_PROPERTY_DEVICE_FAULT_STATE);
-                assert(printcount < FAULTSTATEPROPERTYLENGTH);
-                LOG_Trace("faultNameState = |%s|",faultNameState);
-                EnsoPropertyValue_u faultState = { .booleanValue = receivedFaultActive };
-                agentSideId[0] = DAL_PROPERTY_DEVICE_FAULT_STATE_IDX + code;
-                cloudName[0] = faultNameState;
-                type[0] = evBoolean;
-                value[0] = faultState;
-
-                // Fault sequence property
-                char faultNameSeq[FAULTSEQPROPERTYLENGTH];
-                printcount = snprintf(faultNameSeq, FAULTSEQPROPERTYLENGTH,
-                        "%s%s", faultName, DAL_PROPERTY_DEVICE_FAULT_SEQ);
-                assert(printcount < FAULTSEQPROPERTYLENGTH);
-                LOG_Trace("faultNameSeq = |%s|",faultNameSeq);
-                agentSideId[1] = DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX + code;
-                cloudName[1] = faultNameSeq;
-                type[1] = evUnsignedInt32;
-                value[1] = sequenceNo;
-
-                // Fault time property
-                EnsoPropertyValue_u faultTime = LSD_GetTimeNow();
-                char faultNameTime[FAULTTIMEPROPERTYLENGTH];
-                printcount = snprintf(faultNameTime, FAULTTIMEPROPERTYLENGTH,
-                        "%s%s", faultName, DAL_PROPERTY_DEVICE_FAULT_TIME);
-                assert(printcount < FAULTTIMEPROPERTYLENGTH);
-                LOG_Trace("faultNameTime = |%s|",faultNameTime);
-                agentSideId[2] = DAL_PROPERTY_DEVICE_FAULT_TIME_IDX + code;
-                cloudName[2] = faultNameTime;
-                type[2] = evTimestamp;
-                value[2] = faultTime;
-
-                WiSafe_DALSetReportedProperties(did, agentSideId, cloudName, type, value, 3,
-                        PROPERTY_PUBLIC, true, true);
-            }
+            LOG_Trace("Fault %u of device 0x%06x still inactive", code, did);
         }
     }
 }
@@ -0,0 +1,1007 @@
+/*!****************************************************************************
+*
+* \file WiSafe_Faults.c
+*
+* \brief Compact table of the faults reported by WiSafe devices
+*
+* The records of all devices share one array, threaded into a list per
+* device and a free list. The state of each fault code is a bit in the
+* device's active bitmap, a record only exists once the code has been raised.
+*
+* The table is saved to the store as a whole: a WiSafe_FaultFileHeader_t
+* followed by one WiSafe_FaultFileEntry_t per record. It is written to a new
+* file which then replaces the old one, a new file found alongside the old one
+* at boot was cut short and is dropped.
+*
+* A change only marks the table dirty. The storage handler saves it once
+* WISAFE_FAULTS_SAVE_WINDOW_MS has passed since the first unsaved change, so
+* the thread handling the alarms never waits for the flash and a burst of
+* reports is written once.
+*
+* Faults reported by earlier releases are properties in the pool. At boot they
+* are moved into the table and removed from the pool and from storage, but
+* not from the cloud shadow, which carries on showing the same properties.
+*
+* Lock order is the local shadow, then the table: the table mutex is never
+* held while calling into the local shadow.
+*
+* \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#define LOG_MODULE LOG_MODULE_WISAFE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "LOG_Api.h"
+#include "OSAL_Api.h"
+#include "LSD_Api.h"
+#include "ECOM_Api.h"
+
+#include "STO_Handler.h"
+
+#include "WiSafe_Faults.h"
+#include "WiSafe_DAL.h"
+
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define FAULTS_MAGIC            0x4657      // "WF"
+#define FAULTS_VERSION          1
+
+#define FAULTS_NONE             (-1)
+#define FAULTS_BITMAP_WORDS     ((WISAFE_FAULT_MAX_CODE / 32) + 1)
+
+// One slot per device plus the gateway
+#define FAULTS_MAX_DEVICES      (DAL_MAXIMUM_NUMBER_WISAFE_DEVICES + 1)
+
+// Record flags
+#define FAULT_FLAG_ACTIVE       0x01        // In the file only, the bitmap holds it in RAM
+#define FAULT_FLAG_TIME_VALID   0x02        // The time of the last change is valid
+#define FAULT_FLAG_BATTV        0x04        // A battery voltage has been reported
+
+// Deltas sent for a change: state, sequence, time and optional battery voltage
+#define FAULTS_MAX_DELTAS       4
+
+// Changes made within this time of the first unsaved one are saved together.
+// It is also the most recent history a power failure can lose.
+#ifndef WISAFE_FAULTS_SAVE_WINDOW_MS
+#define WISAFE_FAULTS_SAVE_WINDOW_MS    1000
+#endif
+
+
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint32_t sequence;          // Times the fault has been raised, from 0
+    uint32_t seconds;           // Time of the last change
+    uint16_t battv;             // Battery voltage reported with it, mV / 10
+    uint8_t  code;
+    uint8_t  flags;
+    int16_t  next;              // Next record of the device or of the free list
+} WiSafe_FaultRecord_t;
+
+typedef struct
+{
+    deviceId_t id;
+    int16_t  first;             // First record, FAULTS_NONE for an unused slot
+    uint32_t active[FAULTS_BITMAP_WORDS];
+} WiSafe_FaultDevice_t;
+
+typedef struct
+{
+    uint16_t magic;             // FAULTS_MAGIC
+    uint8_t  version;           // FAULTS_VERSION
+    uint8_t  reserved;
+    uint32_t count;             // Entries following the header
+    uint32_t crc;               // CRC32 of the entries
+} WiSafe_FaultFileHeader_t;
+
+typedef struct
+{
+    deviceId_t id;
+    uint32_t sequence;
+    uint32_t seconds;
+    uint16_t battv;
+    uint8_t  code;
+    uint8_t  flags;
+} WiSafe_FaultFileEntry_t;
+
+
+/******************************************************************************
+ * Private variables
+ *****************************************************************************/
+
+static const char FaultsFile[]    = "WiSafe_Faults";
+static const char FaultsNewFile[] = "WiSafe_Faults_New";
+
+static Mutex_t lock;                // Protects the table
+static Mutex_t saveLock;            // Serialises saves and fileEntries
+
+static WiSafe_FaultDevice_t devices[FAULTS_MAX_DEVICES];
+static WiSafe_FaultRecord_t records[WISAFE_FAULT_MAX_RECORDS];
+static int16_t firstFree;
+
+static bool dirty;                  // Changed since the last save
+static Timer_t saveTimer;           // Running while the table is dirty
+
+// The table as written to the file, kept off the stack
+static WiSafe_FaultFileEntry_t fileEntries[WISAFE_FAULT_MAX_RECORDS];
+
+
+/******************************************************************************
+ * Private functions
+ *****************************************************************************/
+
+/**
+ * Helper to map a local shadow device ID back to the WiSafe device ID.
+ *
+ * @param ensoId The local shadow device ID.
+ * @param id Set to the WiSafe device ID.
+ *
+ * @return true if it is a WiSafe device or the gateway.
+ */
+static bool WiSafeIdFromEnsoDevice(const EnsoDeviceId_t* ensoId, deviceId_t* id)
+{
+    if (ensoId->technology == WISAFE_TECHNOLOGY && ensoId->isChild)
+    {
+        *id = (deviceId_t)ensoId->deviceAddress;
+        return true;
+    }
+    if (ensoId->technology == ETHERNET_TECHNOLOGY && !ensoId->isChild)
+    {
+        *id = GATEWAY_DEVICE_ID;
+        return true;
+    }
+    return false;
+}
+
+static bool IsActive(const WiSafe_FaultDevice_t* device, uint8_t code)
+{
+    return (device->active[code / 32] & (1u << (code % 32))) != 0;
+}
+
+static void SetActive(WiSafe_FaultDevice_t* device, uint8_t code, bool active)
+{
+    if (active)
+    {
+        device->active[code / 32] |= 1u << (code % 32);
+    }
+    else
+    {
+        device->active[code / 32] &= ~(1u << (code % 32));
+    }
+}
+
+/**
+ * Find the slot of a device. Must be called with the lock held.
+ *
+ * @param id The WiSafe device ID.
+ *
+ * @return The slot or NULL if the device has no records.
+ */
+static WiSafe_FaultDevice_t* FindDevice(deviceId_t id)
+{
+    for (int i = 0; i < FAULTS_MAX_DEVICES; i++)
+    {
+        if (devices[i].first != FAULTS_NONE && devices[i].id == id)
+        {
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find a free slot for a device. Must be called with the lock held.
+ *
+ * @param id The WiSafe device ID.
+ *
+ * @return The slot or NULL if there are none. It stays free until a record
+ *         is added to it.
+ */
+static WiSafe_FaultDevice_t* NewDevice(deviceId_t id)
+{
+    for (int i = 0; i < FAULTS_MAX_DEVICES; i++)
+    {
+        if (devices[i].first == FAULTS_NONE)
+        {
+            memset(&devices[i], 0, sizeof(devices[i]));
+            devices[i].first = FAULTS_NONE;
+            devices[i].id = id;
+            return &devices[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Find the record of a fault code. Must be called with the lock held.
+ *
+ * @param device The device.
+ * @param code The fault code.
+ *
+ * @return The record index or FAULTS_NONE.
+ */
+static int16_t FindRecord(const WiSafe_FaultDevice_t* device, uint8_t code)
+{
+    for (int16_t r = device->first; r != FAULTS_NONE; r = records[r].next)
+    {
+        if (records[r].code == code)
+        {
+            return r;
+        }
+    }
+    return FAULTS_NONE;
+}
+
+/**
+ * Unlink a record from its device and put it on the free list. Must be
+ * called with the lock held.
+ *
+ * @param device The device which owns the record.
+ * @param r The record index.
+ */
+static void FreeRecord(WiSafe_FaultDevice_t* device, int16_t r)
+{
+    int16_t* link = &device->first;
+    while (*link != r)
+    {
+        link = &records[*link].next;
+    }
+    *link = records[r].next;
+
+    SetActive(device, records[r].code, false);
+    records[r].next = firstFree;
+    firstFree = r;
+}
+
+/**
+ * Make room for a record by dropping the oldest record of an inactive fault,
+ * from any device. The cloud shadow keeps its values, but the sequence
+ * number starts again from 0 if the fault is raised again. Must be called
+ * with the lock held.
+ *
+ * @return true if a record was freed.
+ */
+static bool EvictOldestRecord(void)
+{
+    WiSafe_FaultDevice_t* oldestDevice = NULL;
+    int16_t oldest = FAULTS_NONE;
+
+    for (int i = 0; i < FAULTS_MAX_DEVICES; i++)
+    {
+        WiSafe_FaultDevice_t* device = &devices[i];
+        for (int16_t r = device->first; r != FAULTS_NONE; r = records[r].next)
+        {
+            if (!IsActive(device, records[r].code) &&
+                (oldest == FAULTS_NONE || records[r].seconds < records[oldest].seconds))
+            {
+                oldestDevice = device;
+                oldest = r;
+            }
+        }
+    }
+
+    if (oldest == FAULTS_NONE)
+    {
+        return false;
+    }
+
+    LOG_Warning("Fault table full, dropping fault %u of device 0x%06x",
+                records[oldest].code, oldestDevice->id);
+    FreeRecord(oldestDevice, oldest);
+    return true;
+}
+
+/**
+ * Add a cleared record for a fault code to a device. Must be called with the
+ * lock held.
+ *
+ * @param device The device.
+ * @param code The fault code.
+ *
+ * @return The record index or FAULTS_NONE if the table is full of active
+ *         faults.
+ */
+static int16_t NewRecord(WiSafe_FaultDevice_t* device, uint8_t code)
+{
+    if (firstFree == FAULTS_NONE && !EvictOldestRecord())
+    {
+        return FAULTS_NONE;
+    }
+
+    int16_t r = firstFree;
+    firstFree = records[r].next;
+
+    memset(&records[r], 0, sizeof(records[r]));
+    records[r].code = code;
+    records[r].next = device->first;
+    device->first = r;
+    return r;
+}
+
+/**
+ * Clear the table. Must be called with the lock held.
+ */
+static void Reset(void)
+{
+    for (int i = 0; i < FAULTS_MAX_DEVICES; i++)
+    {
+        memset(&devices[i], 0, sizeof(devices[i]));
+        devices[i].first = FAULTS_NONE;
+    }
+    for (int r = 0; r < WISAFE_FAULT_MAX_RECORDS; r++)
+    {
+        records[r].next = (r + 1 < WISAFE_FAULT_MAX_RECORDS) ? r + 1 : FAULTS_NONE;
+    }
+    firstFree = 0;
+}
+
+/**
+ * Add a record read back from the file or from the pool. Must be called
+ * with the lock held.
+ *
+ * @param entry The record.
+ */
+static void Restore(const WiSafe_FaultFileEntry_t* entry)
+{
+    if (entry->code < WISAFE_FAULT_MIN_CODE || entry->code > WISAFE_FAULT_MAX_CODE)
+    {
+        return;
+    }
+
+    WiSafe_FaultDevice_t* device = FindDevice(entry->id);
+    if (device == NULL)
+    {
+        device = NewDevice(entry->id);
+    }
+    if (device == NULL || FindRecord(device, entry->code) != FAULTS_NONE)
+    {
+        return;
+    }
+
+    int16_t r = NewRecord(device, entry->code);
+    if (r != FAULTS_NONE)
+    {
+        records[r].sequence = entry->sequence;
+        records[r].seconds = entry->seconds;
+        records[r].battv = entry->battv;
+        records[r].flags = entry->flags & ~FAULT_FLAG_ACTIVE;
+        SetActive(device, entry->code, (entry->flags & FAULT_FLAG_ACTIVE) != 0);
+    }
+}
+
+/**
+ * Write the table to the store, replacing the previous copy.
+ */
+static void Save(void)
+{
+    OSAL_LockMutex(&saveLock);
+
+    WiSafe_FaultFileHeader_t header = { .magic = FAULTS_MAGIC, .version = FAULTS_VERSION };
+
+    OSAL_LockMutex(&lock);
+    for (int i = 0; i < FAULTS_MAX_DEVICES; i++)
+    {
+        const WiSafe_FaultDevice_t* device = &devices[i];
+        for (int16_t r = device->first; r != FAULTS_NONE; r = records[r].next)
+        {
+            WiSafe_FaultFileEntry_t* entry = &fileEntries[header.count++];
+            entry->id = device->id;
+            entry->sequence = records[r].sequence;
+            entry->seconds = records[r].seconds;
+            entry->battv = records[r].battv;
+            entry->code = records[r].code;
+            entry->flags = records[r].flags |
+                    (IsActive(device, records[r].code) ? FAULT_FLAG_ACTIVE : 0);
+        }
+    }
+    OSAL_UnLockMutex(&lock);
+
+    uint32_t size = header.count * sizeof(WiSafe_FaultFileEntry_t);
+    header.crc = OSAL_Crc32(0, fileEntries, size);
+
+    bool ok = false;
+    Handle_t handle = OSAL_StoreOpen(FaultsNewFile, WRITE_ONLY);
+    if (handle != NULL)
+    {
+        ok = OSAL_StoreWrite(handle, &header, sizeof(header)) == (int)sizeof(header) &&
+             OSAL_StoreWrite(handle, fileEntries, size) == (int)size;
+        ok = (0 == OSAL_StoreClose(handle)) && ok;
+    }
+
+    if (!ok)
+    {
+        // Keep the old file, it is only one save behind
+        LOG_Error("Failed to write %s", FaultsNewFile);
+        OSAL_StoreRemove(FaultsNewFile);
+    }
+    else if (OSAL_StoreExist(FaultsFile) && (0 != OSAL_StoreRemove(FaultsFile)))
+    {
+        LOG_Error("OSAL_StoreRemove of %s failed", FaultsFile);
+        OSAL_StoreRemove(FaultsNewFile);
+    }
+    else if (0 != OSAL_StoreAtomicRename(FaultsNewFile, FaultsFile))
+    {
+        // Picked up at the next boot
+        LOG_Error("OSAL_StoreAtomicRename failed");
+    }
+
+    OSAL_UnLockMutex(&saveLock);
+}
+
+/**
+ * Save the table if it changed since the last save. Called on the storage
+ * handler thread once the save window has ended.
+ */
+static void SaveChanges(void)
+{
+    OSAL_LockMutex(&lock);
+    Timer_t timer = saveTimer;
+    bool changed = dirty;
+    saveTimer = NULL;
+    dirty = false;
+    OSAL_UnLockMutex(&lock);
+
+    if (timer != NULL)
+    {
+        OSAL_DestroyTimer(timer);
+    }
+    if (changed)
+    {
+        Save();
+    }
+}
+
+/**
+ * Save window timer callback, the table is saved by the storage handler.
+ *
+ * @param handle Unused.
+ */
+static void SaveTimerCB(void* handle)
+{
+    if (STO_RequestSave(SaveChanges) != eecNoError)
+    {
+        LOG_Error("Failed to request a save, retrying in %d ms", WISAFE_FAULTS_SAVE_WINDOW_MS);
+    }
+}
+
+/**
+ * Mark the table dirty and start the save window if it is not running.
+ */
+static void ScheduleSave(void)
+{
+    OSAL_LockMutex(&lock);
+    dirty = true;
+    bool failed = false;
+    if (saveTimer == NULL)
+    {
+        // Repeating, so a request that cannot be sent is tried again a
+        // window later. SaveChanges() destroys it.
+        saveTimer = OSAL_NewTimer(SaveTimerCB, WISAFE_FAULTS_SAVE_WINDOW_MS, true, NULL);
+        failed = (saveTimer == NULL);
+    }
+    OSAL_UnLockMutex(&lock);
+
+    if (failed)
+    {
+        // Without the timer the change would wait for the next one
+        LOG_Error("OSAL_NewTimer failed, saving now");
+        SaveChanges();
+    }
+}
+
+/**
+ * Read the table back from the store.
+ */
+static void Load(void)
+{
+    if (OSAL_StoreExist(FaultsNewFile))
+    {
+        if (OSAL_StoreExist(FaultsFile))
+        {
+            OSAL_StoreRemove(FaultsNewFile);
+        }
+        else if (0 != OSAL_StoreAtomicRename(FaultsNewFile, FaultsFile))
+        {
+            LOG_Error("OSAL_StoreAtomicRename failed");
+            OSAL_StoreRemove(FaultsNewFile);
+        }
+    }
+
+    if (!OSAL_StoreExist(FaultsFile))
+    {
+        return;
+    }
+
+    Handle_t handle = OSAL_StoreOpen(FaultsFile, READ_ONLY);
+    if (handle == NULL)
+    {
+        LOG_Error("Failed to open %s", FaultsFile);
+        return;
+    }
+
+    WiSafe_FaultFileHeader_t header;
+    uint32_t size = 0;
+    bool ok = OSAL_StoreRead(handle, &header, sizeof(header)) == (int)sizeof(header) &&
+              header.magic == FAULTS_MAGIC &&
+              header.version == FAULTS_VERSION &&
+              header.count <= WISAFE_FAULT_MAX_RECORDS;
+    if (ok)
+    {
+        size = header.count * sizeof(WiSafe_FaultFileEntry_t);
+        ok = OSAL_StoreRead(handle, fileEntries, size) == (int)size &&
+             OSAL_Crc32(0, fileEntries, size) == header.crc;
+    }
+    OSAL_StoreClose(handle);
+
+    if (!ok)
+    {
+        LOG_Error("%s is damaged, fault sequence numbers start again", FaultsFile);
+        return;
+    }
+
+    OSAL_LockMutex(&lock);
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        Restore(&fileEntries[i]);
+    }
+    OSAL_UnLockMutex(&lock);
+
+    LOG_Info("Loaded %u fault records", header.count);
+}
+
+/**
+ * Read a fault property left in the pool by an earlier release, and remove it
+ * from the pool and from storage.
+ *
+ * @param ensoId The device.
+ * @param agentSideId The property.
+ * @param value Set to the reported value.
+ *
+ * @return true if the property was there.
+ */
+static bool ForgetLegacyProperty(const EnsoDeviceId_t* ensoId, EnsoAgentSidePropertyId_t agentSideId, EnsoPropertyValue_u* value)
+{
+    if (eecNoError != LSD_GetPropertyValueByAgentSideId(ensoId, REPORTED_GROUP, agentSideId, value))
+    {
+        return false;
+    }
+
+    EnsoErrorCode_e error = LSD_ForgetPropertyByAgentSideId(ensoId, agentSideId);
+    if (error != eecNoError)
+    {
+        LOG_Error("Failed to remove fault property %08x - %s", agentSideId, LSD_EnsoErrorCode_eToString(error));
+    }
+    return true;
+}
+
+/**
+ * Move the fault properties of earlier releases out of the pool. It runs at
+ * every boot, in case storage missed a removal: a record already in the table
+ * is newer than the property.
+ *
+ * @return true if any were found.
+ */
+static bool MigrateLegacyProperties(void)
+{
+    deviceId_t ids[FAULTS_MAX_DEVICES];
+    uint16_t numDevices = 0;
+    if (eecNoError != WiSafe_DALDevicesEnumerate(ids, DAL_MAXIMUM_NUMBER_WISAFE_DEVICES, &numDevices))
+    {
+        numDevices = 0;
+    }
+    ids[numDevices++] = GATEWAY_DEVICE_ID;
+
+    bool found = false;
+    for (uint16_t d = 0; d < numDevices; d++)
+    {
+        EnsoDeviceId_t ensoId = EnsoDeviceFromWiSafeID(ids[d]);
+        for (uint8_t code = WISAFE_FAULT_MIN_CODE; code <= WISAFE_FAULT_MAX_CODE; code++)
+        {
+            EnsoPropertyValue_u state, sequence, time, battv;
+            bool hasState = ForgetLegacyProperty(&ensoId, DAL_PROPERTY_DEVICE_FAULT_STATE_IDX + code, &state);
+            bool hasSequence = ForgetLegacyProperty(&ensoId, DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX + code, &sequence);
+            bool hasTime = ForgetLegacyProperty(&ensoId, DAL_PROPERTY_DEVICE_FAULT_TIME_IDX + code, &time);
+            bool hasBattv = ForgetLegacyProperty(&ensoId, DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX + code, &battv);
+            if (!hasState && !hasSequence && !hasTime && !hasBattv)
+            {
+                continue;
+            }
+
+            WiSafe_FaultFileEntry_t entry =
+            {
+                .id = ids[d],
+                .code = code,
+                .sequence = hasSequence ? sequence.uint32Value : 0,
+                .seconds = hasTime ? time.timestamp.seconds : 0,
+                .battv = hasBattv ? (uint16_t)battv.uint32Value : 0,
+                .flags = (hasState && state.booleanValue ? FAULT_FLAG_ACTIVE : 0) |
+                         (hasTime && time.timestamp.isValid ? FAULT_FLAG_TIME_VALID : 0) |
+                         (hasBattv ? FAULT_FLAG_BATTV : 0)
+            };
+
+            OSAL_LockMutex(&lock);
+            Restore(&entry);
+            OSAL_UnLockMutex(&lock);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Supplies the fault properties to the local shadow, see
+ * LSD_ExternalPropertyFunction_t.
+ *
+ * @param ensoId The device.
+ * @param agentSideId The property.
+ * @param property Filled in with the property.
+ *
+ * @return true if it is a fault property of a fault in the table.
+ */
+static bool GetFaultProperty(const EnsoDeviceId_t* ensoId, const EnsoAgentSidePropertyId_t agentSideId, EnsoProperty_t* property)
+{
+    EnsoAgentSidePropertyId_t base;
+    propertyName_t suffix;
+    EnsoValueType_e type;
+
+    if (agentSideId >= DAL_PROPERTY_DEVICE_FAULT_STATE_IDX && agentSideId < DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX)
+    {
+        base = DAL_PROPERTY_DEVICE_FAULT_STATE_IDX;
+        suffix = DAL_PROPERTY_DEVICE_FAULT_STATE;
+        type = evBoolean;
+    }
+    else if (agentSideId >= DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX && agentSideId < DAL_PROPERTY_DEVICE_FAULT_TIME_IDX)
+    {
+        base = DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX;
+        suffix = DAL_PROPERTY_DEVICE_FAULT_SEQ;
+        type = evUnsignedInt32;
+    }
+    else if (agentSideId >= DAL_PROPERTY_DEVICE_FAULT_TIME_IDX && agentSideId < DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX)
+    {
+        base = DAL_PROPERTY_DEVICE_FAULT_TIME_IDX;
+        suffix = DAL_PROPERTY_DEVICE_FAULT_TIME;
+        type = evTimestamp;
+    }
+    else if (agentSideId >= DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX && agentSideId <= DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX + WISAFE_FAULT_MAX_CODE)
+    {
+        base = DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX;
+        suffix = DAL_PROPERTY_DEVICE_FAULT_BATTV;
+        type = evUnsignedInt32;
+    }
+    else
+    {
+        return false;
+    }
+
+    uint32_t code = agentSideId - base;
+    deviceId_t id;
+    if (code < WISAFE_FAULT_MIN_CODE || code > WISAFE_FAULT_MAX_CODE ||
+        !WiSafeIdFromEnsoDevice(ensoId, &id))
+    {
+        return false;
+    }
+
+    memset(property, 0, sizeof(*property));
+    bool found = false;
+
+    OSAL_LockMutex(&lock);
+    WiSafe_FaultDevice_t* device = FindDevice(id);
+    int16_t r = device ? FindRecord(device, code) : FAULTS_NONE;
+    if (r != FAULTS_NONE)
+    {
+        found = true;
+        if (base == DAL_PROPERTY_DEVICE_FAULT_STATE_IDX)
+        {
+            property->reportedValue.booleanValue = IsActive(device, code);
+        }
+        else if (base == DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX)
+        {
+            property->reportedValue.uint32Value = records[r].sequence;
+        }
+        else if (base == DAL_PROPERTY_DEVICE_FAULT_TIME_IDX)
+        {
+            property->reportedValue.timestamp.seconds = records[r].seconds;
+            property->reportedValue.timestamp.isValid = (records[r].flags & FAULT_FLAG_TIME_VALID) != 0;
+        }
+        else
+        {
+            property->reportedValue.uint32Value = records[r].battv;
+            found = (records[r].flags & FAULT_FLAG_BATTV) != 0;
+        }
+    }
+    OSAL_UnLockMutex(&lock);
+
+    if (found)
+    {
+        property->agentSidePropertyID = agentSideId;
+        property->type.kind = PROPERTY_PUBLIC;
+        property->type.buffered = true;
+        property->type.valueType = type;
+        property->desiredValue = property->reportedValue;
+        snprintf(property->cloudName, sizeof(property->cloudName), "%s%02u%s",
+                 DAL_PROPERTY_DEVICE_FAULT, (unsigned int)code, suffix);
+    }
+
+    return found;
+}
+
+/**
+ * Fill in the deltas of a fault record: state, sequence, time and the
+ * battery voltage if one has been reported. Must be called with the lock
+ * held.
+ *
+ * @param device The device which owns the record.
+ * @param r The record index.
+ * @param deltas Room for FAULTS_MAX_DELTAS deltas.
+ *
+ * @return The number of deltas filled in.
+ */
+static uint16_t FaultDeltas(const WiSafe_FaultDevice_t* device, int16_t r, EnsoPropertyDelta_t* deltas)
+{
+    uint8_t code = records[r].code;
+    uint16_t numDeltas = 0;
+
+    memset(deltas, 0, FAULTS_MAX_DELTAS * sizeof(EnsoPropertyDelta_t));
+    deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_STATE_IDX + code;
+    deltas[numDeltas++].propertyValue.booleanValue = IsActive(device, code);
+    deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX + code;
+    deltas[numDeltas++].propertyValue.uint32Value = records[r].sequence;
+    deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_TIME_IDX + code;
+    deltas[numDeltas].propertyValue.timestamp.seconds = records[r].seconds;
+    deltas[numDeltas++].propertyValue.timestamp.isValid = (records[r].flags & FAULT_FLAG_TIME_VALID) != 0;
+    if (records[r].flags & FAULT_FLAG_BATTV)
+    {
+        deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX + code;
+        deltas[numDeltas++].propertyValue.uint32Value = records[r].battv;
+    }
+    return numDeltas;
+}
+
+/**
+ * Notify all the fault properties of a device again, see
+ * LSD_ExternalResyncFunction_t. The faults are visited by code so the lock
+ * need not be held while notifying. If a notification fails the device is
+ * left out of sync for the next sync pass.
+ *
+ * @param ensoId The device.
+ *
+ * @return The number of notifications sent.
+ */
+static uint16_t ResendFaults(const EnsoDeviceId_t* ensoId)
+{
+    deviceId_t id;
+    if (!WiSafeIdFromEnsoDevice(ensoId, &id))
+    {
+        return 0;
+    }
+
+    EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+    EnsoPropertyDelta_t faultDeltas[FAULTS_MAX_DELTAS];
+    uint16_t numDeltas = 0;
+    uint16_t numNotifications = 0;
+
+    for (int code = WISAFE_FAULT_MIN_CODE; code <= WISAFE_FAULT_MAX_CODE + 1; code++)
+    {
+        uint16_t numFaultDeltas = 0;
+        if (code <= WISAFE_FAULT_MAX_CODE)
+        {
+            OSAL_LockMutex(&lock);
+            WiSafe_FaultDevice_t* device = FindDevice(id);
+            int16_t r = device ? FindRecord(device, code) : FAULTS_NONE;
+            if (r != FAULTS_NONE)
+            {
+                numFaultDeltas = FaultDeltas(device, r, faultDeltas);
+            }
+            OSAL_UnLockMutex(&lock);
+        }
+
+        // Send what is waiting once the next fault won't fit, or at the end
+        bool last = (code > WISAFE_FAULT_MAX_CODE);
+        if (numDeltas && (last || numDeltas + numFaultDeltas > ECOM_MAX_DELTAS))
+        {
+            EnsoErrorCode_e error = LSD_NotifyExternalProperties(WISAFE_DEVICE_HANDLER, ensoId, REPORTED_GROUP, deltas, numDeltas);
+            if (error != eecNoError)
+            {
+                LOG_Error("Failed to resend faults of device 0x%06x - %s", id, LSD_EnsoErrorCode_eToString(error));
+                LSD_SetExternalPropertiesOutOfSync(ensoId);
+                break;
+            }
+            numNotifications++;
+            numDeltas = 0;
+        }
+
+        memcpy(&deltas[numDeltas], faultDeltas, numFaultDeltas * sizeof(EnsoPropertyDelta_t));
+        numDeltas += numFaultDeltas;
+    }
+
+    return numNotifications;
+}
+
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * Initialise this module: load the table, take over the fault properties of
+ * earlier releases and start supplying the fault properties to the local
+ * shadow. Must be called after the persistent properties have been restored.
+ *
+ */
+void WiSafe_FaultsInit(void)
+{
+    OSAL_InitMutex(&lock, NULL);
+    OSAL_InitMutex(&saveLock, NULL);
+
+    OSAL_LockMutex(&lock);
+    Reset();
+    OSAL_UnLockMutex(&lock);
+
+    Load();
+
+    // Before the table is visible, or the lookups would find it
+    if (MigrateLegacyProperties())
+    {
+        LOG_Info("Moved fault properties out of the property pool");
+        Save();
+    }
+
+    LSD_SetExternalPropertyFunction(GetFaultProperty);
+    LSD_SetExternalResyncFunction(ResendFaults);
+
+    // The cloud may not have seen the last changes before the restart
+    for (int i = 0; i < FAULTS_MAX_DEVICES; i++)
+    {
+        OSAL_LockMutex(&lock);
+        bool hasFaults = (devices[i].first != FAULTS_NONE);
+        deviceId_t id = devices[i].id;
+        OSAL_UnLockMutex(&lock);
+
+        if (hasFaults)
+        {
+            EnsoDeviceId_t ensoId = EnsoDeviceFromWiSafeID(id);
+            LSD_SetExternalPropertiesOutOfSync(&ensoId);
+        }
+    }
+}
+
+/**
+ * Close this module, saving the changes still waiting for the save window.
+ *
+ */
+void WiSafe_FaultsClose(void)
+{
+    LSD_SetExternalResyncFunction(NULL);
+    LSD_SetExternalPropertyFunction(NULL);
+
+    // Changes still waiting for the save window
+    SaveChanges();
+}
+
+/**
+ * Record a fault reported by a device and notify the change.
+ *
+ * Nothing changes if the fault is neither active nor was active. The
+ * sequence number starts at 0 and goes up each time the fault is raised
+ * again after it has cleared.
+ *
+ * @param id The device that sent the fault.
+ * @param code The fault code.
+ * @param active Whether the fault is active.
+ * @param voltsPresent Whether mVolts is being used.
+ * @param mVolts The battery voltage in milliVolts.
+ *
+ * @return eecNoChange if there was nothing to do or a standard error code.
+ */
+EnsoErrorCode_e WiSafe_FaultsReport(deviceId_t id, uint8_t code, bool active, bool voltsPresent, uint32_t mVolts)
+{
+    if (code < WISAFE_FAULT_MIN_CODE || code > WISAFE_FAULT_MAX_CODE)
+    {
+        return eecParameterOutOfRange;
+    }
+
+    EnsoPropertyValue_u now = LSD_GetTimeNow();
+
+    EnsoPropertyDelta_t deltas[FAULTS_MAX_DELTAS];
+    memset(deltas, 0, sizeof(deltas));
+    uint16_t numDeltas = 0;
+
+    OSAL_LockMutex(&lock);
+    WiSafe_FaultDevice_t* device = FindDevice(id);
+    bool wasActive = device && IsActive(device, code);
+    if (!wasActive && !active)
+    {
+        // Not a new fault and its not a fault clear. Nothing to do.
+        OSAL_UnLockMutex(&lock);
+        return eecNoChange;
+    }
+
+    int16_t r = device ? FindRecord(device, code) : FAULTS_NONE;
+    if (r == FAULTS_NONE)
+    {
+        if (device == NULL)
+        {
+            device = NewDevice(id);
+        }
+        r = device ? NewRecord(device, code) : FAULTS_NONE;
+        if (r == FAULTS_NONE)
+        {
+            OSAL_UnLockMutex(&lock);
+            LOG_Error("No room for fault %u of device 0x%06x", code, id);
+            return eecPoolFull;
+        }
+    }
+    else if (!wasActive)
+    {
+        // New fault has been raised. Increase the sequence number.
+        records[r].sequence++;
+        LOG_Trace("Increase sequence to %u", records[r].sequence);
+    }
+
+    SetActive(device, code, active);
+    records[r].seconds = now.timestamp.seconds;
+    records[r].flags &= ~FAULT_FLAG_TIME_VALID;
+    records[r].flags |= now.timestamp.isValid ? FAULT_FLAG_TIME_VALID : 0;
+
+    deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_STATE_IDX + code;
+    deltas[numDeltas++].propertyValue.booleanValue = active;
+    deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_SEQ_IDX + code;
+    deltas[numDeltas++].propertyValue.uint32Value = records[r].sequence;
+    deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_TIME_IDX + code;
+    deltas[numDeltas++].propertyValue = now;
+
+    // Battery voltage is optional, it is received in mV
+    if (voltsPresent)
+    {
+        records[r].battv = (uint16_t)(mVolts / 10);
+        records[r].flags |= FAULT_FLAG_BATTV;
+        deltas[numDeltas].agentSidePropertyID = DAL_PROPERTY_DEVICE_FAULT_BATTV_IDX + code;
+        deltas[numDeltas++].propertyValue.uint32Value = records[r].battv;
+    }
+    OSAL_UnLockMutex(&lock);
+
+    ScheduleSave();
+
+    EnsoDeviceId_t ensoId = EnsoDeviceFromWiSafeID(id);
+    EnsoErrorCode_e error = LSD_NotifyExternalProperties(WISAFE_DEVICE_HANDLER, &ensoId, REPORTED_GROUP, deltas, numDeltas);
+    if (error != eecNoError)
+    {
+        LOG_Error("Failed to notify fault %u of device 0x%06x - %s", code, id, LSD_EnsoErrorCode_eToString(error));
+        // Sent again by the next sync pass
+        LSD_SetExternalPropertiesOutOfSync(&ensoId);
+    }
+    return error;
+}
+
+/**
+ * Drop the faults of a device which is being deleted.
+ *
+ * @param id The device.
+ */
+void WiSafe_FaultsDeleteDevice(deviceId_t id)
+{
+    OSAL_LockMutex(&lock);
+    WiSafe_FaultDevice_t* device = FindDevice(id);
+    bool found = (device != NULL);
+    while (device != NULL && device->first != FAULTS_NONE)
+    {
+        FreeRecord(device, device->first);
+    }
+    OSAL_UnLockMutex(&lock);
+
+    if (found)
+    {
+        ScheduleSave();
+    }
+}
@@ -0,0 +1,53 @@
+/*!****************************************************************************
+*
+* \file WiSafe_Faults.h
+*
+* \brief Compact table of the faults reported by WiSafe devices
+*
+* Each device has a bitmap of its active fault codes and a small record per
+* fault code it has reported, with the sequence number, time and battery
+* voltage of the last change. The records are kept off the property pool and
+* saved to the store, they are exposed to the local shadow as the same
+* flt<code>_state, _seq, _time and _battv properties as before, so pool usage
+* does not grow with the number of fault codes raised.
+*
+* \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#ifndef _WISAFE_FAULTS_H_
+#define _WISAFE_FAULTS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "LSD_Types.h"
+#include "WiSafe_Protocol.h"
+
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Fault codes are SIA codes 1 to 99, 0 is no fault
+#define WISAFE_FAULT_MIN_CODE           1
+#define WISAFE_FAULT_MAX_CODE           99
+
+// Fault records shared by all devices. When they are all used the oldest
+// record of an inactive fault is reused.
+#ifndef WISAFE_FAULT_MAX_RECORDS
+#define WISAFE_FAULT_MAX_RECORDS        100
+#endif
+
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+extern void WiSafe_FaultsInit(void);
+extern void WiSafe_FaultsClose(void);
+
+extern EnsoErrorCode_e WiSafe_FaultsReport(deviceId_t id, uint8_t code, bool active, bool voltsPresent, uint32_t mVolts);
+extern void WiSafe_FaultsDeleteDevice(deviceId_t id);
+
+#endif /* _WISAFE_FAULTS_H_ */
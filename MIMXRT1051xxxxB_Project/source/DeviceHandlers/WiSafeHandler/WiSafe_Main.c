@@ -12,6 +12,8 @@
 *****************************************************************************/
 
 //#include <unistd.h>
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <signal.h>
 #include <ctype.h>
 //#include <sys/time.h>
@@ -28,6 +30,7 @@
 #include "WiSafe_Engine.h"
 #include "WiSafe_Discovery.h"
 #include "WiSafe_DAL.h"
+#include "WiSafe_Faults.h"
 #include "WiSafe_Event.h"
 #include "WiSafe_Timer.h"
 
@@ -151,6 +154,9 @@ static void WiSafe_MessageQueueListener(MessageQueue_t mq)
                 {
                     /* Parse the delta message and extract what we need. */
                     ECOM_DeltaMessage_t* deltaMessage = (ECOM_DeltaMessage_t*)buffer;
+                    EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+                    uint16_t numProperties;
+                    const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(deltaMessage, scratch, &numProperties);
 
                     /* Check this is a change to a desired property. */
                     if (deltaMessage->propertyGroup != DESIRED_GROUP)
@@ -167,19 +173,19 @@ static void WiSafe_MessageQueueListener(MessageQueue_t mq)
                         else
                         {
                             /* Log what we've been given to the console. */
-                            for (int idx = 0; idx < deltaMessage->numProperties; idx += 1)
+                            for (int idx = 0; idx < numProperties; idx += 1)
                             {
-                                EnsoPropertyDelta_t* delta = &deltaMessage->deltasBuffer[idx];
+                                const EnsoPropertyDelta_t* delta = &deltas[idx];
                                 char propName[LSD_PROPERTY_NAME_BUFFER_SIZE] = {0,};
                                 LSD_GetPropertyCloudNameFromAgentSideId(&(deltaMessage->deviceId), delta->agentSidePropertyID, sizeof(propName), propName);
-                                LOG_InfoC(LOG_BLUE "Received property (%d/%d) delta on device %016llx for key '%s' (%x).", (idx + 1), deltaMessage->numProperties, deltaMessage->deviceId.deviceAddress, propName, delta->agentSidePropertyID);
+                                LOG_InfoC(LOG_BLUE "Received property (%d/%d) delta on device %016llx for key '%s' (%x).", (idx + 1), numProperties, deltaMessage->deviceId.deviceAddress, propName, delta->agentSidePropertyID);
                             }
 
                             /* Is it a single property or an atomic group? */
-                            if (deltaMessage->numProperties == 1)
+                            if (numProperties == 1)
                             {
                                 /* Single property change. */
-                                EnsoPropertyDelta_t* delta = &deltaMessage->deltasBuffer[0];
+                                const EnsoPropertyDelta_t* delta = &deltas[0];
 
                                 /* Get the property name for debugging. */
                                 char propName[LSD_PROPERTY_NAME_BUFFER_SIZE] = {0,};
@@ -192,11 +198,13 @@ static void WiSafe_MessageQueueListener(MessageQueue_t mq)
                             else
                             {
                                 /* Atomic group change. */
-                                WiSafe_EngineProcessGroupDelta(&deltaMessage->deviceId, deltaMessage->deltasBuffer, deltaMessage->numProperties);
+                                WiSafe_EngineProcessGroupDelta(&deltaMessage->deviceId, deltas, numProperties);
 
                             }
                         }
                     }
+
+                    ECOM_ReleaseDeltaMessage(deltaMessage);
                 }
                 break;
             }
@@ -289,6 +297,9 @@ EnsoErrorCode_e WiSafe_Start(void)
     /* Initialise the DAL. */
     WiSafe_DALInit();
 
+    /* Load the fault table. */
+    WiSafe_FaultsInit();
+
     /* Initialise the packet receiver. */
     WiSafe_RadioCommsInit();
 
@@ -314,6 +325,7 @@ void WiSafe_End(void)
     /* Tidy. */
     LOG_Info("WiSafe Device Handler stopping.");
     WiSafe_RadioCommsClose();
+    WiSafe_FaultsClose();
     WiSafe_DALClose();
 }
 
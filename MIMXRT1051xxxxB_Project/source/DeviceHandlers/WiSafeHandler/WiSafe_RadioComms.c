@@ -12,6 +12,8 @@
 *****************************************************************************/
 
 //#include <fcntl.h>
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdlib.h>
 #include <stdint.h>
 //#include <unistd.h>
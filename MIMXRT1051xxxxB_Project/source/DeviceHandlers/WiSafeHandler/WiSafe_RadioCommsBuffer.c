@@ -12,6 +12,8 @@
 *****************************************************************************/
 
 //#include <unistd.h>
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
@@ -20,69 +22,160 @@
 #include "WiSafe_RadioCommsBuffer.h"
 #include "WiSafe_Utils.h"
 
-static bool alreadyInitialised = false; // Whether we've already called init() once.
-static radioCommsBuffer_t buffers[10]; // Our pool of buffers.
-static radioCommsBuffer_t* nextFreeBuffer = NULL; // The next free buffer.
-static Mutex_t lock; // Our mutex for concurrent accesses to the pool.
+#define NO_BUFFER       (0xffff)            /* Free list terminator. */
+#define HEAD_INDEX_MASK (0x0000ffff)        /* Index of the first free buffer... */
+#define HEAD_TAG_STEP   (0x00010000)        /* ...and a tag bumped on every change, so a
+                                               stale compare-and-swap can never succeed (ABA). */
+
+#define INIT_NOT_DONE   (0)
+#define INIT_RUNNING    (1)
+#define INIT_DONE       (2)
+
+static radioCommsBuffer_t buffers[RADIOCOMMSBUFFER_POOL_SIZE]; // Our pool of buffers.
+static uint16_t freeNext[RADIOCOMMSBUFFER_POOL_SIZE]; // Free list links, by buffer index.
+static uint32_t freeHead = NO_BUFFER; // Tag and index of the first free buffer.
+static Semaphore_t freeCount; // One count for each buffer on the free list.
+static uint32_t initState = INIT_NOT_DONE;
+static radioCommsBufferStats_t stats = { .size = RADIOCOMMSBUFFER_POOL_SIZE };
 
 /**
  * This initialisation function for this module. Must be called before
- * everything else.
+ * everything else. Safe to call concurrently, the first caller does the
+ * work and any others wait for it.
  *
  */
 static void WiSafe_RadioCommsBufferInit(void)
 {
-    /* Don't init if we've already done it. */
-    if (!alreadyInitialised)
+    uint32_t state = __atomic_load_n(&initState, __ATOMIC_ACQUIRE);
+    if (state == INIT_DONE)
     {
-        alreadyInitialised = true;
+        return;
+    }
 
-        /* Initialise mutex. */
-        OSAL_InitMutex(&lock, NULL);
+    if ((state == INIT_NOT_DONE) &&
+        __atomic_compare_exchange_n(&initState, &state, INIT_RUNNING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        /* Chain every buffer on to the free list. */
+        for (uint32_t loop = 0; loop < (COUNT_OF(buffers) - 1); loop += 1)
+        {
+            freeNext[loop] = (uint16_t)(loop + 1);
+        }
+        freeNext[COUNT_OF(buffers) - 1] = NO_BUFFER;
+        freeHead = 0;
 
-        /* Set our pointer to the first free buffer. */
-        nextFreeBuffer = &(buffers[0]);
+        if (OSAL_InitCountingSemaphore(&freeCount, COUNT_OF(buffers), COUNT_OF(buffers)) != 0)
+        {
+            LOG_Error("Failed to create buffer pool semaphore.");
+        }
 
-        for (uint32_t loop = 0; loop < (COUNT_OF(buffers) - 1); loop += 1)
+        __atomic_store_n(&initState, INIT_DONE, __ATOMIC_RELEASE);
+        return;
+    }
+
+    /* Someone else is initialising. */
+    while (__atomic_load_n(&initState, __ATOMIC_ACQUIRE) != INIT_DONE)
+    {
+        OSAL_sleep_ms(1);
+    }
+}
+
+/**
+ * Take the first buffer off the free list.
+ *
+ * @return The buffer or NULL if the list is empty.
+ */
+static radioCommsBuffer_t* FreeListPop(void)
+{
+    uint32_t head = __atomic_load_n(&freeHead, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        uint32_t index = head & HEAD_INDEX_MASK;
+        if (index == NO_BUFFER)
         {
-            /* Set each buffer's next to the next buffer. */
-            buffers[loop].next = &(buffers[loop + 1]);
+            return NULL;
         }
 
-        /* Set the last buffer's next to NULL. */
-        buffers[COUNT_OF(buffers) - 1].next = NULL;
+        uint32_t next = ((head + HEAD_TAG_STEP) & ~HEAD_INDEX_MASK) |
+                        __atomic_load_n(&freeNext[index], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&freeHead, &head, next, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return &(buffers[index]);
+        }
     }
 }
 
 /**
- * Get the next free buffer. Can return NULL if no buffers are free.
+ * Put a buffer on the front of the free list.
+ *
+ * @param buffer The buffer.
+ */
+static void FreeListPush(radioCommsBuffer_t* buffer)
+{
+    uint32_t index = (uint32_t)(buffer - buffers);
+    uint32_t head = __atomic_load_n(&freeHead, __ATOMIC_RELAXED);
+    uint32_t next;
+    do
+    {
+        __atomic_store_n(&freeNext[index], (uint16_t)(head & HEAD_INDEX_MASK), __ATOMIC_RELAXED);
+        next = ((head + HEAD_TAG_STEP) & ~HEAD_INDEX_MASK) | index;
+    } while (!__atomic_compare_exchange_n(&freeHead, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * Get the next free buffer, waiting up to the given time for one to be
+ * released if the pool is empty.
+ *
+ * @param timeoutMs How long to wait in milliseconds, 0 not to wait.
  *
  * @return The buffer or NULL.
  */
-radioCommsBuffer_t* WiSafe_RadioCommsBufferGet(void)
+radioCommsBuffer_t* WiSafe_RadioCommsBufferGetTimeout(uint32_t timeoutMs)
 {
     /* Init (safe to call repeatedly as it checks to only do it once). */
     WiSafe_RadioCommsBufferInit();
 
-    OSAL_LockMutex(&lock);
-
-    /* Return the next free buffer. */
-    radioCommsBuffer_t* result = nextFreeBuffer;
-    if (result != NULL)
+    /* A count on the semaphore reserves one buffer on the free list. */
+    if (OSAL_TakeCountingSemaphore(&freeCount, 0) != 0)
     {
-        /* Remove from linked list. */
-        nextFreeBuffer = result->next;
-        result->next = NULL;
+        if (timeoutMs > 0)
+        {
+            __atomic_fetch_add(&stats.waits, 1, __ATOMIC_RELAXED);
+        }
+        if ((timeoutMs == 0) || (OSAL_TakeCountingSemaphore(&freeCount, timeoutMs) != 0))
+        {
+            __atomic_fetch_add(&stats.failures, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
     }
 
-    OSAL_UnLockMutex(&lock);
+    radioCommsBuffer_t* result = FreeListPop();
+    assert(result != NULL);
+    result->next = NULL;
+
+    __atomic_fetch_add(&stats.allocations, 1, __ATOMIC_RELAXED);
+    uint32_t inUse = __atomic_add_fetch(&stats.inUse, 1, __ATOMIC_RELAXED);
+    uint32_t highWater = __atomic_load_n(&stats.highWater, __ATOMIC_RELAXED);
+    while ((inUse > highWater) &&
+           !__atomic_compare_exchange_n(&stats.highWater, &highWater, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
 
     return result;
 }
 
+/**
+ * Get the next free buffer. Can return NULL if no buffers are free.
+ *
+ * @return The buffer or NULL.
+ */
+radioCommsBuffer_t* WiSafe_RadioCommsBufferGet(void)
+{
+    return WiSafe_RadioCommsBufferGetTimeout(0);
+}
+
 
 /**
- * Get the next free buffer, busy waiting until one is free.
+ * Get the next free buffer, blocking until one is free.
  * Guarantees not to return NULL.
  *
  * @return The buffer.
@@ -90,21 +183,12 @@ radioCommsBuffer_t* WiSafe_RadioCommsBufferGet(void)
 radioCommsBuffer_t* WiSafe_RadioCommsBufferBusyGet(void)
 {
     radioCommsBuffer_t* result;
-    uint32_t check = 0;
 
-    do
+    while ((result = WiSafe_RadioCommsBufferGetTimeout(RADIOCOMMSBUFFER_MAX_BUSY_WAIT * 1000)) == NULL)
     {
-        result = WiSafe_RadioCommsBufferGet();
-        if (result == NULL)
-        {
-            OSAL_sleep_ms(1000);
-
-            check += 1;
-            if ((check % RADIOCOMMSBUFFER_MAX_BUSY_WAIT) == 0) {
-                LOG_Warning("RadioCommsBuffer_busy_get() has been waiting for %d seconds.", RADIOCOMMSBUFFER_MAX_BUSY_WAIT);
-            }
-        }
-    } while (result == NULL);
+        LOG_Warning("RadioCommsBuffer_busy_get() has been waiting for %d seconds, %d of %d buffers in use.",
+                    RADIOCOMMSBUFFER_MAX_BUSY_WAIT, stats.inUse, stats.size);
+    }
 
     return result;
 }
@@ -119,16 +203,30 @@ void WiSafe_RadioCommsBufferRelease(radioCommsBuffer_t* buffer)
 {
     if (buffer != NULL)
     {
-        OSAL_LockMutex(&lock);
-
-        /* Put this buffer back on the free list. */
-        buffer->next = nextFreeBuffer;
-        nextFreeBuffer = buffer;
+        assert((buffer >= buffers) && (buffer < &(buffers[COUNT_OF(buffers)])));
 
-        OSAL_UnLockMutex(&lock);
+        /* Put this buffer back on the free list, then let a waiter have it. */
+        FreeListPush(buffer);
+        __atomic_fetch_sub(&stats.inUse, 1, __ATOMIC_RELAXED);
+        OSAL_GiveCountingSemaphore(&freeCount);
     }
 }
 
+/**
+ * Get a snapshot of the pool's occupancy statistics.
+ *
+ * @param result Receives the statistics.
+ */
+void WiSafe_RadioCommsBufferGetStats(radioCommsBufferStats_t* result)
+{
+    result->size = stats.size;
+    result->inUse = __atomic_load_n(&stats.inUse, __ATOMIC_RELAXED);
+    result->highWater = __atomic_load_n(&stats.highWater, __ATOMIC_RELAXED);
+    result->allocations = __atomic_load_n(&stats.allocations, __ATOMIC_RELAXED);
+    result->waits = __atomic_load_n(&stats.waits, __ATOMIC_RELAXED);
+    result->failures = __atomic_load_n(&stats.failures, __ATOMIC_RELAXED);
+}
+
 /**
  * Dump a description of the buffer in the log/console.
  *
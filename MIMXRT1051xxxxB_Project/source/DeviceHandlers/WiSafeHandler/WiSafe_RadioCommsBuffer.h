@@ -21,6 +21,12 @@
 
 #define RADIOCOMMSBUFFER_MAX_BUSY_WAIT (10)
 
+/* Number of buffers in the pool. Alarms and faults can hold a buffer for
+   tens of seconds while they are pending, so allow for bursts. */
+#ifndef RADIOCOMMSBUFFER_POOL_SIZE
+#define RADIOCOMMSBUFFER_POOL_SIZE (32)
+#endif
+
 #define SPRUERM_TERMINATING_FLAG 0x7e
 #define SPRUERM_ESCAPE_BYTE      0x7d
 #define SPRUERM_ESCAPED_FLAG     0x01
@@ -39,9 +45,21 @@ typedef struct radioCommsBuffer
     struct radioCommsBuffer* next;
 } radioCommsBuffer_t;
 
+typedef struct
+{
+    uint32_t size;          /* Buffers in the pool. */
+    uint32_t inUse;         /* Buffers currently allocated. */
+    uint32_t highWater;     /* Most buffers ever allocated at once. */
+    uint32_t allocations;   /* Successful gets. */
+    uint32_t waits;         /* Gets that found the pool empty and blocked. */
+    uint32_t failures;      /* Gets that returned NULL. */
+} radioCommsBufferStats_t;
+
 extern radioCommsBuffer_t* WiSafe_RadioCommsBufferGet(void);
 extern void WiSafe_RadioCommsBufferRelease(radioCommsBuffer_t* buffer);
 extern radioCommsBuffer_t* WiSafe_RadioCommsBufferBusyGet(void);
+extern radioCommsBuffer_t* WiSafe_RadioCommsBufferGetTimeout(uint32_t timeoutMs);
+extern void WiSafe_RadioCommsBufferGetStats(radioCommsBufferStats_t* stats);
 extern void WiSafe_RadioCommsBufferDump(const char* logMsgPrefix, radioCommsBuffer_t* buffer);
 extern uint32_t WiSafe_RadioCommsBufferRemainingSpace(radioCommsBuffer_t* buffer);
 extern void WiSafe_RadioCommsBufferRemove(radioCommsBuffer_t** list, radioCommsBuffer_t* bufferToRemove);
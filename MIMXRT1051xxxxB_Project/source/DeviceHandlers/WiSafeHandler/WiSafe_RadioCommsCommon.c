@@ -11,6 +11,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdint.h>
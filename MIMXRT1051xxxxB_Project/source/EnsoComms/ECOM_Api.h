@@ -27,14 +27,33 @@
 // The maximum message queue depth
 #define ECOM_MAX_MESSAGE_QUEUE_DEPTH (20)
 
-// The maximum number of deltas in a DELTA message, will need
-// to be reduced if LSD_STRING_PROPERTY_MAX_LENGTH is increased
+// The maximum number of deltas in a DELTA message. Each subscriber is
+// sent a bit mask of the deltas meant for it, so this must fit in 8 bits.
 #define ECOM_MAX_DELTAS (6)
 
+#if ECOM_MAX_DELTAS > 8
+#error "ECOM_MAX_DELTAS must fit in ECOM_DeltaMessage_t.deltaMask"
+#endif
+
+// Number of preallocated shared delta blocks. If they run out, blocks are
+// taken from the heap instead.
+#define ECOM_DELTA_POOL_SIZE (64)
+
 /*!****************************************************************************
  * Types
  *****************************************************************************/
 
+/**
+ * \name ECOM_DeltaBlock_t
+ *
+ * \brief A set of deltas published once and shared, by reference, between
+ * all the subscribers they are sent to. Opaque outside ECOM.
+ */
+typedef struct ECOM_DeltaBlock_tag ECOM_DeltaBlock_t;
+
+// Forward declaration, see ECOM_Messages.h
+struct ECOM_DeltaMessage_tag;
+
 /**
  * \name ECOM_OnUpdateNotification_t
  *
@@ -83,6 +102,26 @@ EnsoErrorCode_e ECOM_SendUpdateToSubscriber(
         const uint16_t numProperties,
         const EnsoPropertyDelta_t* deltasBuffer);
 
+ECOM_DeltaBlock_t* ECOM_NewDeltaBlock(
+        const EnsoDeviceId_t publishedDeviceId,
+        const PropertyGroup_e propertyGroup,
+        const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer);
+
+EnsoErrorCode_e ECOM_SendDeltaBlockToSubscriber(
+        const HandlerId_e subscriberId,
+        ECOM_DeltaBlock_t* block,
+        const uint8_t deltaMask);
+
+void ECOM_ReleaseDeltaBlock(ECOM_DeltaBlock_t* block);
+
+const EnsoPropertyDelta_t* ECOM_GetDeltas(
+        const struct ECOM_DeltaMessage_tag* message,
+        EnsoPropertyDelta_t* scratch,
+        uint16_t* numProperties);
+
+void ECOM_ReleaseDeltaMessage(const struct ECOM_DeltaMessage_tag* message);
+
 EnsoErrorCode_e ECOM_SendThingStatusToSubscriber(
         const HandlerId_e subscriberId,
         const EnsoDeviceId_t registeringThing,
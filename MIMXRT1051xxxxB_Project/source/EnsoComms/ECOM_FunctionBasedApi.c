@@ -11,12 +11,15 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_ECOM
+
 #include <stdbool.h>
 #include <string.h>
 
 #include "ECOM_Api.h"
 #include "ECOM_Messages.h"
 #include "LOG_Api.h"
+#include "OSAL_Api.h"
 
 
 
@@ -33,6 +36,14 @@
  * Type Definitions
  *****************************************************************************/
 
+// Callbacks are synchronous here, so a block only lives for one notification
+struct ECOM_DeltaBlock_tag
+{
+    EnsoDeviceId_t deviceId;
+    PropertyGroup_e propertyGroup;
+    uint16_t numProperties;
+    EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+};
 
 
 /*!****************************************************************************
@@ -189,6 +200,78 @@ EnsoErrorCode_e ECOM_SendUpdateToSubscriber(
 }
 
 
+/**
+ * \name ECOM_NewDeltaBlock
+ *
+ * \brief Copy a set of deltas so they can be sent to several subscribers.
+ *
+ * \return                   The block, or NULL on error
+ */
+ECOM_DeltaBlock_t* ECOM_NewDeltaBlock(
+        const EnsoDeviceId_t publishedDeviceId,
+        const PropertyGroup_e propertyGroup,
+        const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer)
+{
+    if (propertyGroup >= PROPERTY_GROUP_MAX || numProperties > ECOM_MAX_DELTAS || !deltasBuffer)
+    {
+        return NULL;
+    }
+
+    ECOM_DeltaBlock_t* block = OSAL_MemoryRequest(NULL, sizeof(ECOM_DeltaBlock_t));
+    if (block)
+    {
+        block->deviceId = publishedDeviceId;
+        block->propertyGroup = propertyGroup;
+        block->numProperties = numProperties;
+        memcpy(block->deltas, deltasBuffer, numProperties * sizeof(EnsoPropertyDelta_t));
+    }
+    return block;
+}
+
+
+/**
+ * \name ECOM_SendDeltaBlockToSubscriber
+ *
+ * \brief Call the subscriber with the deltas of the block selected by the mask.
+ *
+ * \return                   EnsoErrorCode_e
+ */
+EnsoErrorCode_e ECOM_SendDeltaBlockToSubscriber(
+        const HandlerId_e subscriberId,
+        ECOM_DeltaBlock_t* block,
+        const uint8_t deltaMask)
+{
+    if (!block)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+    uint16_t numProperties = 0;
+    for (uint16_t i = 0; i < block->numProperties; i++)
+    {
+        if (deltaMask & (1u << i))
+        {
+            deltas[numProperties++] = block->deltas[i];
+        }
+    }
+
+    return ECOM_SendUpdateToSubscriber(subscriberId, block->deviceId, block->propertyGroup, numProperties, deltas);
+}
+
+
+/**
+ * \name ECOM_ReleaseDeltaBlock
+ *
+ * \brief Free a block created by ECOM_NewDeltaBlock.
+ */
+void ECOM_ReleaseDeltaBlock(ECOM_DeltaBlock_t* block)
+{
+    OSAL_Free(block);
+}
+
+
 /**
  * \name ECOM_SendThingStatusToSubscriber
  *
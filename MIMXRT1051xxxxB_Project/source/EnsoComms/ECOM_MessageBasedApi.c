@@ -11,6 +11,8 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_ECOM
+
 #include <stdbool.h>
 #include <string.h>
 
@@ -33,6 +35,16 @@
  * Type Definitions
  *****************************************************************************/
 
+struct ECOM_DeltaBlock_tag
+{
+    struct ECOM_DeltaBlock_tag* next;   // Free list link
+    uint16_t refCount;                  // Publisher plus one per queued message
+    bool fromHeap;                      // Allocated because the pool was empty
+    EnsoDeviceId_t deviceId;            // The thing that changed
+    PropertyGroup_e propertyGroup;      // The group to which the properties belong
+    uint16_t numProperties;
+    EnsoPropertyDelta_t deltas[ECOM_MAX_DELTAS];
+};
 
 
 /*!****************************************************************************
@@ -42,11 +54,45 @@
 // Static arrays to store the clients message queue
 static MessageQueue_t              _clientsMessageQueue[ECOM_MAXIMUM_NUMBER_OF_CLIENTS];
 
+// Shared delta blocks and the free list threaded through them
+static ECOM_DeltaBlock_t           _deltaPool[ECOM_DELTA_POOL_SIZE];
+static ECOM_DeltaBlock_t*          _freeDeltaBlocks;
+static Mutex_t                     _deltaPoolMutex;
+
+// Number of blocks taken from the heap because the pool was empty
+static unsigned int                _deltaPoolOverflows;
+
 
 /******************************************************************************
  * Private Functions
  *****************************************************************************/
 
+/**
+ * \name _ECOM_AllDeltas
+ *
+ * \brief Mask selecting the first numProperties deltas of a block
+ */
+static uint8_t _ECOM_AllDeltas(const uint16_t numProperties)
+{
+    return (uint8_t)((1u << numProperties) - 1);
+}
+
+/**
+ * \name _ECOM_CountDeltas
+ *
+ * \brief Number of deltas selected by a mask
+ */
+static uint16_t _ECOM_CountDeltas(uint8_t deltaMask)
+{
+    uint16_t count = 0;
+    while (deltaMask)
+    {
+        deltaMask &= deltaMask - 1;
+        count++;
+    }
+    return count;
+}
+
 
 /******************************************************************************
  * Public Functions
@@ -60,6 +106,15 @@ static MessageQueue_t              _clientsMessageQueue[ECOM_MAXIMUM_NUMBER_OF_C
 void ECOM_Init(void)
 {
     memset(_clientsMessageQueue, 0, sizeof _clientsMessageQueue);
+
+    OSAL_InitMutex(&_deltaPoolMutex, NULL);
+    _freeDeltaBlocks = NULL;
+    for (int i = 0; i < ECOM_DELTA_POOL_SIZE; i++)
+    {
+        _deltaPool[i].next = _freeDeltaBlocks;
+        _freeDeltaBlocks = &_deltaPool[i];
+    }
+    _deltaPoolOverflows = 0;
 }
 
 /**
@@ -135,6 +190,234 @@ EnsoErrorCode_e ECOM_RegisterMessageQueue(
 }
 
 
+/**
+ * \name ECOM_NewDeltaBlock
+ *
+ * \brief Copies a list of property changes into a shared delta block so that
+ *        it can be sent to any number of subscribers without further copies.
+ *        The caller holds one reference and must drop it with
+ *        ECOM_ReleaseDeltaBlock() once it has finished sending.
+ *
+ * \param  publishedDeviceId  The thing that changed
+ *
+ * \param  propertyGroup     The group to which the properties belong
+ *
+ * \param  numProperties     The number of properties in the delta
+ *
+ * \param  deltasBuffer      The list of properties that have been changed
+ *
+ * \return                   The block, NULL on error
+ */
+ECOM_DeltaBlock_t* ECOM_NewDeltaBlock(
+        const EnsoDeviceId_t publishedDeviceId,
+        const PropertyGroup_e propertyGroup,
+        const uint16_t numProperties,
+        const EnsoPropertyDelta_t* deltasBuffer)
+{
+    /* Sanity check */
+    if (propertyGroup >= PROPERTY_GROUP_MAX)
+    {
+        return NULL;
+    }
+    if (!deltasBuffer)
+    {
+        return NULL;
+    }
+    if (numProperties > ECOM_MAX_DELTAS)
+    {
+        LOG_Error("Too many properties in delta buffer");
+        return NULL;
+    }
+
+    OSAL_LockMutex(&_deltaPoolMutex);
+    ECOM_DeltaBlock_t* block = _freeDeltaBlocks;
+    if (block)
+    {
+        _freeDeltaBlocks = block->next;
+    }
+    else
+    {
+        _deltaPoolOverflows++;
+    }
+    OSAL_UnLockMutex(&_deltaPoolMutex);
+
+    if (block)
+    {
+        block->fromHeap = false;
+    }
+    else
+    {
+        LOG_Warning("Delta pool empty (%u overflows)", _deltaPoolOverflows);
+        block = OSAL_MemoryRequest(NULL, sizeof(ECOM_DeltaBlock_t));
+        if (!block)
+        {
+            LOG_Error("Unable to allocate delta block");
+            return NULL;
+        }
+        block->fromHeap = true;
+    }
+
+    block->next = NULL;
+    block->refCount = 1;
+    block->deviceId = publishedDeviceId;
+    block->propertyGroup = propertyGroup;
+    block->numProperties = numProperties;
+    memcpy(block->deltas, deltasBuffer, numProperties * sizeof(EnsoPropertyDelta_t));
+
+    return block;
+}
+
+/**
+ * \name ECOM_ReleaseDeltaBlock
+ *
+ * \brief Drops one reference to a delta block, returning it to the pool when
+ *        the last reference goes.
+ *
+ * \param  block             The delta block
+ */
+void ECOM_ReleaseDeltaBlock(ECOM_DeltaBlock_t* block)
+{
+    if (!block)
+    {
+        return;
+    }
+
+    OSAL_LockMutex(&_deltaPoolMutex);
+    bool last = (--block->refCount == 0);
+    if (last && !block->fromHeap)
+    {
+        block->next = _freeDeltaBlocks;
+        _freeDeltaBlocks = block;
+    }
+    OSAL_UnLockMutex(&_deltaPoolMutex);
+
+    if (last && block->fromHeap)
+    {
+        OSAL_Free(block);
+    }
+}
+
+/**
+ * \name ECOM_SendDeltaBlockToSubscriber
+ *
+ * \brief Sends a subscriber a reference to some or all of the deltas in a
+ *        shared delta block.
+ *
+ * \param  subscriberId      The subscriber id
+ *
+ * \param  block             The delta block
+ *
+ * \param  deltaMask         Bit n set to send delta n of the block
+ *
+ * \return                   EnsoErrorCode_e
+ */
+EnsoErrorCode_e ECOM_SendDeltaBlockToSubscriber(
+        const HandlerId_e subscriberId,
+        ECOM_DeltaBlock_t* block,
+        const uint8_t deltaMask)
+{
+    if (!block)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    uint8_t mask = deltaMask & _ECOM_AllDeltas(block->numProperties);
+    if (mask == 0)
+    {
+        LOG_Warning("Deltas buffer is empty, nothing to do");
+        // Nothing to do
+        return eecNoError;
+    }
+
+    EnsoErrorCode_e retVal = eecNoError;
+
+    // Get the message queue for this thing
+    MessageQueue_t destQueue = ECOM_GetMessageQueue(subscriberId);
+
+    if (destQueue)
+    {
+        // Prepare the message
+        ECOM_DeltaMessage_t deltaMessage;
+        deltaMessage.messageId = ECOM_DELTA_MSG;
+        deltaMessage.destinationId = subscriberId;
+        deltaMessage.deviceId = block->deviceId;
+        deltaMessage.propertyGroup = block->propertyGroup;
+        deltaMessage.numProperties = _ECOM_CountDeltas(mask);
+        deltaMessage.deltaMask = mask;
+        deltaMessage.block = block;
+
+        // The message holds its own reference until the subscriber releases it
+        OSAL_LockMutex(&_deltaPoolMutex);
+        block->refCount++;
+        OSAL_UnLockMutex(&_deltaPoolMutex);
+
+        if (OSAL_SendMessage(destQueue, &deltaMessage, sizeof(ECOM_DeltaMessage_t), MessagePriority_medium) < 0)
+        {
+            retVal = eecInternalError;
+            LOG_Error("OSAL_SendMessage failed %s", strerror(errno));
+            ECOM_ReleaseDeltaBlock(block);
+        }
+    }
+    else
+    {
+        LOG_Trace("No handler on destination queue, ok at startup though");
+    }
+
+    return retVal;
+}
+
+/**
+ * \name ECOM_GetDeltas
+ *
+ * \brief Gives a subscriber access to the deltas of a delta message. When the
+ *        message selects every delta of the block they are read in place,
+ *        otherwise the selected ones are gathered into scratch.
+ *
+ * \param  message           The received delta message
+ *
+ * \param  scratch           Space for ECOM_MAX_DELTAS deltas
+ *
+ * \param[out] numProperties The number of deltas returned
+ *
+ * \return                   The deltas, valid until the message is released
+ */
+const EnsoPropertyDelta_t* ECOM_GetDeltas(
+        const ECOM_DeltaMessage_t* message,
+        EnsoPropertyDelta_t* scratch,
+        uint16_t* numProperties)
+{
+    const ECOM_DeltaBlock_t* block = message->block;
+
+    if (message->deltaMask == _ECOM_AllDeltas(block->numProperties))
+    {
+        *numProperties = block->numProperties;
+        return block->deltas;
+    }
+
+    uint16_t count = 0;
+    for (uint16_t i = 0; i < block->numProperties; i++)
+    {
+        if (message->deltaMask & (1u << i))
+        {
+            scratch[count++] = block->deltas[i];
+        }
+    }
+    *numProperties = count;
+    return scratch;
+}
+
+/**
+ * \name ECOM_ReleaseDeltaMessage
+ *
+ * \brief Called by a subscriber when it has finished with a delta message.
+ *
+ * \param  message           The received delta message
+ */
+void ECOM_ReleaseDeltaMessage(const ECOM_DeltaMessage_t* message)
+{
+    ECOM_ReleaseDeltaBlock(message->block);
+}
+
 /**
  * \name ECOM_SendUpdateToSubscriber
  *
@@ -184,33 +467,15 @@ EnsoErrorCode_e ECOM_SendUpdateToSubscriber(
         return eecBufferTooBig;
     }
 
-    // Prepare the message
-    ECOM_DeltaMessage_t deltaMessage;
-    deltaMessage.messageId = ECOM_DELTA_MSG;
-    deltaMessage.destinationId = subscriberId;
-    deltaMessage.deviceId = publishedDeviceId;
-    deltaMessage.propertyGroup = propertyGroup;
-    deltaMessage.numProperties = numProperties;
-    memcpy(deltaMessage.deltasBuffer, deltasBuffer, numProperties * sizeof(EnsoPropertyDelta_t));
-
-    EnsoErrorCode_e retVal = eecNoError;
-
-    // Get the message queue for this thing
-    MessageQueue_t destQueue = ECOM_GetMessageQueue(subscriberId);
-
-    if (destQueue)
+    ECOM_DeltaBlock_t* block = ECOM_NewDeltaBlock(publishedDeviceId, propertyGroup, numProperties, deltasBuffer);
+    if (!block)
     {
-        if (OSAL_SendMessage(destQueue, &deltaMessage, sizeof(ECOM_DeltaMessage_t), MessagePriority_medium) < 0)
-        {
-            retVal = eecInternalError;
-            LOG_Error("OSAL_SendMessage failed %s", strerror(errno));
-        }
-    }
-    else
-    {
-        LOG_Trace("No handler on destination queue, ok at startup though");
+        return eecPoolFull;
     }
 
+    EnsoErrorCode_e retVal = ECOM_SendDeltaBlockToSubscriber(subscriberId, block, _ECOM_AllDeltas(numProperties));
+    ECOM_ReleaseDeltaBlock(block);
+
     return retVal;
 }
 
@@ -55,15 +55,20 @@ typedef enum
  *
  * \brief Delta Message sent to a subscriber.
  *
+ * The deltas themselves are not copied into the message. It carries a
+ * reference to a shared delta block and a mask of the deltas in it that are
+ * meant for this subscriber. Read them with ECOM_GetDeltas() and call
+ * ECOM_ReleaseDeltaMessage() once done with them.
  */
-typedef struct
+typedef struct ECOM_DeltaMessage_tag
 {
     uint8_t messageId;
     HandlerId_e destinationId;        // The subscriber id
     EnsoDeviceId_t deviceId;          // The thing that changed
     PropertyGroup_e propertyGroup;    // The group to which the properties belong
-    uint16_t numProperties;           // The number of properties in the delta
-    EnsoPropertyDelta_t deltasBuffer[ECOM_MAX_DELTAS]; // The list of properties that have been changed
+    uint16_t numProperties;           // The number of properties selected by deltaMask
+    uint8_t deltaMask;                // Bit n set if delta n of the block is for this subscriber
+    ECOM_DeltaBlock_t* block;         // Shared, reference counted deltas
 } ECOM_DeltaMessage_t;
 
 /**
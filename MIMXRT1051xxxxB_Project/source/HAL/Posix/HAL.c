@@ -0,0 +1,337 @@
+/*!****************************************************************************
+ *
+ * \file HAL.c
+ *
+ * \brief Hardware Abstraction Layer Implementation for POSIX hosts
+ *
+ * There is no hardware on the host. LEDs are remembered and logged, the MAC
+ * address comes from the environment and the parameter flash is not there.
+ *
+ * \Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ *
+ *****************************************************************************/
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "HAL.h"
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define HAL_MAC_ADDRESS_SIZE    6
+
+// Used when MACADDRESS is not set
+#define HAL_MAC_ADDRESS_DEFAULT "02:00:00:00:00:01"
+
+/*!****************************************************************************
+ * Private Variables
+ *****************************************************************************/
+
+static uint8_t ledState[HAL_NO_LEDS];
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \name HAL_Initialise
+ *
+ * \brief Initialise the HAL - all leds off.
+ */
+void HAL_Initialise(void)
+{
+    for (int led = 0; led < HAL_NO_LEDS; led++)
+    {
+        HAL_SetLed(led, HAL_LEDSTATE_OFF);
+    }
+}
+
+/**
+ * \name HAL_Reboot
+ *
+ * \brief Reboot the gateway, on the host the process exits
+ */
+void HAL_Reboot(void)
+{
+    LOG_Warning("Reboot requested, exiting");
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * \name   HAL_SetLed
+ *
+ * \brief  Set a LED on or off
+ *
+ * \param  led          The LED identifier
+ *
+ * \param  value        HAL_LEDSTATE_OFF or HAL_LEDSTATE_ON
+ *
+ * \return 0 on success, -1 for an unknown LED
+ */
+int16_t HAL_SetLed(uint8_t led, uint8_t value)
+{
+    if (led >= HAL_NO_LEDS)
+    {
+        return -1;
+    }
+    if (ledState[led] != value)
+    {
+        LOG_Trace("LED %d %s", led, value == HAL_LEDSTATE_ON ? "on" : "off");
+    }
+    ledState[led] = value;
+    return 0;
+}
+
+/**
+ * \name   HAL_GetLed
+ *
+ * \brief  Get the state of a LED
+ *
+ * \param  led          The LED identifier
+ *
+ * \param  value        Where to store the state
+ *
+ * \return 0 on success, -1 for an unknown LED
+ */
+int16_t HAL_GetLed(uint8_t led, uint8_t *value)
+{
+    if (led >= HAL_NO_LEDS || value == NULL)
+    {
+        return -1;
+    }
+    *value = ledState[led];
+    return 0;
+}
+
+/**
+ * \name   HAL_GetMACAddressBytes
+ *
+ * \brief  Get the local MAC address
+ *         Mac address is passed in the environment variable MACADDRESS
+ *
+ * \return byte representation of the local MAC address
+ */
+void HAL_GetMACAddressBytes(const uint8_t* mac)
+{
+    unsigned int b[HAL_MAC_ADDRESS_SIZE];
+    const char * s = getenvDefault("MACADDRESS", HAL_MAC_ADDRESS_DEFAULT);
+    if (sscanf(s, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != HAL_MAC_ADDRESS_SIZE)
+    {
+        LOG_Error("Bad MACADDRESS %s, using %s", s, HAL_MAC_ADDRESS_DEFAULT);
+        sscanf(HAL_MAC_ADDRESS_DEFAULT, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]);
+    }
+    for (int i = 0; i < HAL_MAC_ADDRESS_SIZE; i++)
+    {
+        ((uint8_t *)mac)[i] = (uint8_t)b[i];
+    }
+}
+
+/**
+ * \name   HAL_GetMACAddressString
+ *
+ * \brief  Get the local MAC address
+ *         Mac address is passed in the environment variable MACADDRESS
+ *
+ * \return Null-terminated representation of the local MAC address
+ */
+const char *    HAL_GetMACAddressString(void)
+{
+    static char mac_str[17 + 1];
+
+    if (mac_str[0] == '\0')
+    {
+        uint8_t mac[HAL_MAC_ADDRESS_SIZE] = { 0 };
+        HAL_GetMACAddressBytes(mac);
+        snprintf(mac_str, sizeof mac_str, "%02x:%02x:%02x:%02x:%02x:%02x",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    return mac_str;
+}
+
+/**
+ * \name   HAL_GetMACAddress
+ *
+ * \brief  Get the local MAC address
+ *         Mac address is passed in the environment variable MACADDRESS
+ *
+ * \return 64-bit integer representation of the local MAC address
+ */
+const uint64_t  HAL_GetMACAddress(void)
+{
+    uint8_t mac[HAL_MAC_ADDRESS_SIZE] = { 0 };
+    HAL_GetMACAddressBytes(mac);
+
+    return (((uint64_t)mac[0])<<40) |
+           (((uint64_t)mac[1])<<32) |
+           (((uint64_t)mac[2])<<24) |
+           (((uint64_t)mac[3])<<16) |
+           (((uint64_t)mac[4])<<8)  |
+           (((uint64_t)mac[5]));
+}
+
+/**
+ * \name   HAL_GetSerialNumberString
+ *
+ * \brief  Get the serial number, passed in the environment variable
+ *         SERIALNUMBER or made from the MAC address
+ *
+ * \return Null-terminated serial number
+ */
+const char * HAL_GetSerialNumberString(void)
+{
+    static char serial[32];
+
+    if (serial[0] == '\0')
+    {
+        const char * s = getenvDefault("SERIALNUMBER", NULL);
+        if (s != NULL)
+        {
+            snprintf(serial, sizeof serial, "%s", s);
+        }
+        else
+        {
+            snprintf(serial, sizeof serial, "%012" PRIx64, HAL_GetMACAddress());
+        }
+    }
+    return serial;
+}
+
+/**
+ * \name   HAL_GetSerialNumber
+ *
+ * \brief  Get the serial number
+ *
+ * \return ptr to buffer containing the serial number
+ */
+uint8_t * HAL_GetSerialNumber(void)
+{
+    return (uint8_t *)HAL_GetSerialNumberString();
+}
+
+/**
+ * \name   HAL_serialBytes
+ *
+ * \brief  Not used on the host
+ */
+void HAL_serialBytes(const uint8_t* mac)
+{
+    (void)mac;
+}
+
+/*
+ * The parameter flash holding the credentials, calibration and image flag is
+ * not there on the host. Reads find nothing and writes fail.
+ */
+uint8_t * HAL_GetRootCA(void)
+{
+    return NULL;
+}
+
+uint8_t * HAL_GetCertificate(void)
+{
+    return NULL;
+}
+
+uint8_t * HAL_GetKey(void)
+{
+    return NULL;
+}
+
+uint8_t * HAL_GetWisafeCalibration(void)
+{
+    return NULL;
+}
+
+uint8_t HAL_GetActiveImageFlag(void)
+{
+    return 0;
+}
+
+int32_t HAL_SetMacAddress(uint8_t * macAddrValue)
+{
+    return -1;
+}
+
+int32_t HAL_SetRootCA(const uint8_t * rootCaValue)
+{
+    return -1;
+}
+
+int32_t HAL_SetCertificate(const uint8_t * certificateValue)
+{
+    return -1;
+}
+
+int32_t HAL_SetKey(const uint8_t * keyValue)
+{
+    return -1;
+}
+
+int32_t HAL_SetSerialNumber(const uint8_t * serialNum)
+{
+    return -1;
+}
+
+int32_t HAL_SetWisafeCalibration(const uint8_t * wisafeCalValue)
+{
+    return -1;
+}
+
+int32_t HAL_SetActiveImageFlag(uint8_t activeImage)
+{
+    return -1;
+}
+
+/**
+ * \name   HAL_GetRandom
+ *
+ * \brief  Fill a buffer with random bytes
+ *
+ * \param  buf          The buffer
+ *
+ * \param  size         Number of bytes wanted
+ *
+ * \return 0 on success, -1 on failure
+ */
+int HAL_GetRandom(void * buf, const int size)
+{
+    FILE * f = fopen("/dev/urandom", "rb");
+    if (f == NULL)
+    {
+        return -1;
+    }
+    size_t n = fread(buf, 1, size, f);
+    fclose(f);
+    return n == (size_t)size ? 0 : -1;
+}
+
+/**
+ * \name   HAL_GetHubID
+ *
+ * \brief  Get the hub ID, the serial number on the host
+ *
+ * \param  hub_id       Where to store the ID
+ *
+ * \param  size         Size of hub_id
+ *
+ * \return 0 on success, -1 on failure
+ */
+int HAL_GetHubID(uint8_t * hub_id, const int size)
+{
+    if (hub_id == NULL || size < 1)
+    {
+        return -1;
+    }
+    snprintf((char *)hub_id, size, "%s", HAL_GetSerialNumberString());
+    return 0;
+}
@@ -11,6 +11,8 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_LSD
+
 #include <stddef.h>
 #include <string.h>
 
@@ -34,6 +36,10 @@
 
 static Mutex_t lsdMutex;
 
+// Says how each property may be merged into a delta waiting to go to the
+// cloud, NULL if none are
+static LSD_CoalesceKindFunction_t lsdCoalesceKind = NULL;
+
 
 /*!****************************************************************************
  * Private Functions
@@ -522,6 +528,65 @@ EnsoErrorCode_e LSD_RestoreProperty(
 }
 
 
+/**
+ * \name LSD_RestorePropertyValues
+ *
+ * \brief Restore a property with both its values and its out-of-sync state.
+ *        This is called at start-up by Storage Manager to load a snapshot,
+ *        each property is set once without notifying the handlers.
+ *
+ * \param   owner                       The ensoObject that owns the property
+ *
+ * \param agentSideId                   The property ID as seen on the agent
+ *                                      side
+ *
+ * \param cloudSideId                   The cloud name of the property
+ *
+ * \param propType                      The property type and out-of-sync
+ *                                      flags
+ *
+ * \param groupValues                   The desired and reported values, a
+ *                                      blob is handed over to the property
+ *
+ * \return                              A negative number denotes an error
+ *                                      code.
+ *
+ */
+EnsoErrorCode_e LSD_RestorePropertyValues(
+        EnsoObject_t* owner,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        const char* cloudSideId,
+        EnsoPropertyType_t propType,
+        const EnsoPropertyValue_u* groupValues)
+{
+    /* Sanity checks */
+    if (!owner || !groupValues || !cloudSideId)
+    {
+        return eecNullPointerSupplied;
+    }
+    if (0 == agentSideId)
+    {
+        return eecParameterOutOfRange;
+    }
+
+    EnsoProperty_t* property = NULL;
+    OSAL_LockMutex(&lsdMutex);
+    EnsoErrorCode_e retVal = LSD_RestorePropertyDirectly(owner, agentSideId, cloudSideId,
+            propType, groupValues, &property);
+    if (retVal >= 0)
+    {
+        // Subscribe storage handler to the property (we know it is persistent)
+        for (int group = 0; (group < PROPERTY_GROUP_MAX) && (retVal >= 0); group++)
+        {
+            retVal = LSD_SubscribeToPropertyDirectly(property, group, STORAGE_HANDLER, true);
+        }
+    }
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return retVal;
+}
+
+
 /**
  * \name    LSD_RemovePropertyByAgentSideId
  *
@@ -579,6 +644,53 @@ EnsoErrorCode_e LSD_RemovePropertyByCloudSideId(
     return LSD_RemoveProperty_Safe(deviceId, false, 0, cloudName, true);
 }
 
+/**
+ * \name    LSD_ForgetPropertyByAgentSideId
+ *
+ * \brief   This function removes a property of the object and returns it
+ *          to the property store, like LSD_RemovePropertyByAgentSideId(),
+ *          but only the storage handler is told. The property is left in
+ *          the cloud shadow, for when its owner takes it out of the pool
+ *          and goes on reporting it as an external property.
+ *
+ * \param   deviceId        The device that owns the property to be removed
+ *
+ * \param   agentSideId     The internal ID of the property to be removed
+ *
+ * \return  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_ForgetPropertyByAgentSideId(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSideId)
+{
+    if (!deviceId)
+    {
+        return eecNullPointerSupplied;
+    }
+    if (0 == agentSideId)
+    {
+        return eecPropertyNotFound;
+    }
+
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    EnsoErrorCode_e retVal = LSD_GetPropertyCloudNameFromAgentSideId(deviceId, agentSideId, sizeof(cloudName), cloudName);
+    if (eecNoError == retVal)
+    {
+        retVal = LSD_RemoveProperty_Safe(deviceId, false, agentSideId, 0, false);
+    }
+
+    if (eecNoError == retVal)
+    {
+        retVal = ECOM_SendPropertyDeletedToSubscriber(STORAGE_HANDLER, *deviceId, agentSideId, cloudName);
+        if (eecNoError != retVal)
+        {
+            LOG_Error("Error sending ECOM_PROPERTY_DELETED to %d", STORAGE_HANDLER);
+        }
+    }
+
+    return retVal;
+}
+
 
 /**
  * \name LSD_SetDeviceStatus
@@ -629,6 +741,55 @@ EnsoErrorCode_e LSD_SetPropertyOutOfSync(
 }
 
 
+/**
+ *
+ * \brief   Set or clear the out-of-sync flag for a property group of a
+ *          property
+ *
+ * \param   deviceId        The owner that the property belongs to
+ *
+ * \param   propName        The property to modify
+ *
+ * \param   propertyGroup   The property group
+ *
+ * \param   outOfSync       The new state of the flag
+ *
+ * \return                  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_SetPropertyOutOfSyncState(
+        const EnsoDeviceId_t* deviceId,
+        const char* propName,
+        const PropertyGroup_e propertyGroup,
+        const bool outOfSync)
+{
+    OSAL_LockMutex(&lsdMutex);
+    EnsoErrorCode_e retVal =  LSD_SetPropertyOutOfSyncStateDirectly(deviceId, propName, propertyGroup, outOfSync);
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return retVal;
+}
+
+
+/**
+ *
+ * \brief   Number of properties of all objects that are out of sync for a
+ *          property group
+ *
+ * \param   propertyGroup   The property group
+ *
+ * \return                  The number of out-of-sync properties
+ */
+uint32_t LSD_GetNumberOfOutOfSyncProperties(
+        const PropertyGroup_e propertyGroup)
+{
+    OSAL_LockMutex(&lsdMutex);
+    uint32_t numProperties = LSD_GetNumberOfOutOfSyncPropertiesDirectly(propertyGroup);
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return numProperties;
+}
+
+
 /**
  * \name LSD_SetPropertyValueByAgentSideIdForObject
  *
@@ -997,6 +1158,77 @@ EnsoErrorCode_e LSD_GetDevicesId(
     return retVal;
 }
 
+/**
+ * \brief   Get the identifiers of all the devices in the local shadow
+ *
+ * \param[out] buffer       Buffer where the list of device identifiers is written
+
+ * \param   bufferElems     Maximum number of elements of the buffer array
+ *
+ * \param[out] numDevices   Number of device identifiers that have been written
+ *
+ * \return                  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_GetAllDevicesId(
+        EnsoDeviceId_t* buffer,
+        const uint16_t  bufferElems,
+        uint16_t* numDevices)
+{
+    // Sanity check
+    if (!buffer || !numDevices)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    OSAL_LockMutex(&lsdMutex);
+    EnsoErrorCode_e retVal = LSD_GetAllDevicesIdDirectly(buffer, bufferElems, numDevices);
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return retVal;
+}
+
+/**
+ * \brief   Copy the properties of a device which meet the filter condition.
+ *          Blob values are copied, the caller releases them with OSAL_Free().
+ *
+ * \param   deviceId        The device
+ *
+ * \param   filter          Persistent only or all properties
+ *
+ * \param[out] buffer       Buffer receiving the properties
+ *
+ * \param   bufferElems     Maximum number of elements of the buffer array
+ *
+ * \param[out] numProperties Number of properties copied, or needed when the
+ *                          buffer is too small
+ *
+ * \return                  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_GetPropertiesByFilter(
+        const EnsoDeviceId_t* deviceId,
+        const PropertyFilter_e filter,
+        EnsoProperty_t* buffer,
+        const uint16_t bufferElems,
+        uint16_t* numProperties)
+{
+    // Sanity check
+    if (!deviceId || !buffer || !numProperties)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    EnsoErrorCode_e retVal = eecEnsoObjectNotFound;
+    OSAL_LockMutex(&lsdMutex);
+    EnsoObject_t* owner = LSD_FindEnsoObjectByDeviceIdDirectly(deviceId);
+    if (owner)
+    {
+        retVal = LSD_GetPropertiesByFilterDirectly(owner, filter, buffer, bufferElems, numProperties);
+    }
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return retVal;
+}
+
 /**
  * \name LSD_GetPropertyCloudNameFromAgentSideId
  *
@@ -1270,7 +1502,18 @@ EnsoErrorCode_e LSD_GetPropertyValueByAgentSideId(
             }
             else
             {
-                retVal = eecPropertyNotFound;
+                // It may be kept outside the pool by its device handler
+                EnsoProperty_t externalProperty;
+                if (LSD_GetExternalPropertyDirectly(deviceId, agentSidePropertyId, &externalProperty))
+                {
+                    *pRxValue = (DESIRED_GROUP == propertyGroup) ?
+                            externalProperty.desiredValue : externalProperty.reportedValue;
+                    retVal = eecNoError;
+                }
+                else
+                {
+                    retVal = eecPropertyNotFound;
+                }
             }
         }
         else
@@ -1284,6 +1527,138 @@ EnsoErrorCode_e LSD_GetPropertyValueByAgentSideId(
     return retVal;
 }
 
+/**
+ * \name LSD_SetExternalPropertyFunction
+ *
+ * \brief   Set the function which supplies the properties a device handler
+ *          keeps outside the property pool. They are looked up through it
+ *          when they are read by agent side ID or when their deltas are
+ *          notified with LSD_NotifyExternalProperties().
+ *
+ * \param   externalProperty    The function, or NULL for none
+ */
+void LSD_SetExternalPropertyFunction(LSD_ExternalPropertyFunction_t externalProperty)
+{
+    OSAL_LockMutex(&lsdMutex);
+    LSD_SetExternalPropertyFunctionDirectly(externalProperty);
+    OSAL_UnLockMutex(&lsdMutex);
+}
+
+/**
+ * \name LSD_GetExternalProperty
+ *
+ * \brief   Retrieves a copy of a property kept outside the property pool
+ *
+ * \param   deviceId            The thing that owns the property in
+ *                              question.
+ *
+ * \param   agentSidePropertyId The property ID as supplied by the agent side
+ *
+ * \param   property            Filled in with a copy of the property
+ *
+ * \return                      eecNoError on success or the error code
+ *                              (negative value) on failure.
+ */
+EnsoErrorCode_e LSD_GetExternalProperty(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSidePropertyId,
+        EnsoProperty_t* property)
+{
+    if (!deviceId || !property)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    OSAL_LockMutex(&lsdMutex);
+    bool found = LSD_GetExternalPropertyDirectly(deviceId, agentSidePropertyId, property);
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return found ? eecNoError : eecPropertyNotFound;
+}
+
+/**
+ * \name LSD_SetExternalResyncFunction
+ *
+ * \brief   Set the function which sends the properties a device handler keeps
+ *          outside the property pool again. A sync pass of the reported group
+ *          calls it for each device marked with
+ *          LSD_SetExternalPropertiesOutOfSync().
+ *
+ * \param   externalResync      The function, or NULL for none
+ */
+void LSD_SetExternalResyncFunction(LSD_ExternalResyncFunction_t externalResync)
+{
+    OSAL_LockMutex(&lsdMutex);
+    LSD_SetExternalResyncFunctionDirectly(externalResync);
+    OSAL_UnLockMutex(&lsdMutex);
+}
+
+/**
+ * \name LSD_SetExternalPropertiesOutOfSync
+ *
+ * \brief   Mark the properties a device keeps outside the property pool as
+ *          out of sync with the cloud, so the next sync pass sends them
+ *          again.
+ *
+ * \param   deviceId            The device
+ *
+ * \return                      eecNoError on success or the error code
+ *                              (negative value) on failure.
+ */
+EnsoErrorCode_e LSD_SetExternalPropertiesOutOfSync(const EnsoDeviceId_t* deviceId)
+{
+    if (!deviceId)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    EnsoErrorCode_e retVal = eecEnsoObjectNotFound;
+
+    OSAL_LockMutex(&lsdMutex);
+    EnsoObject_t* owner = LSD_FindEnsoObjectByDeviceIdDirectly(deviceId);
+    if (owner)
+    {
+        LSD_SetExternalOutOfSyncDirectly(owner, true);
+        retVal = eecNoError;
+    }
+    OSAL_UnLockMutex(&lsdMutex);
+
+    return retVal;
+}
+
+/**
+ * \name LSD_SetCoalesceKindFunction
+ *
+ * \brief   Set the function which says how changes to each property may be
+ *          merged into a delta still waiting to be sent to the cloud. Until
+ *          it is set nothing is merged.
+ *
+ * \param   coalesceKind        The function, or NULL for none
+ */
+void LSD_SetCoalesceKindFunction(LSD_CoalesceKindFunction_t coalesceKind)
+{
+    // Read by the cloud handler with its own buffers locked, so the local
+    // shadow mutex is not taken, a pointer is written in one go
+    lsdCoalesceKind = coalesceKind;
+}
+
+/**
+ * \name LSD_GetCoalesceKind
+ *
+ * \brief   How changes to a property may be merged while they wait to be
+ *          sent to the cloud
+ *
+ * \param   agentSidePropertyId The property ID as supplied by the agent side
+ *
+ * \return                      LSD_COALESCE_NEVER unless the device handler
+ *                              says otherwise
+ */
+LSD_Coalesce_e LSD_GetCoalesceKind(const EnsoAgentSidePropertyId_t agentSidePropertyId)
+{
+    LSD_CoalesceKindFunction_t coalesceKind = lsdCoalesceKind;
+    return coalesceKind ? coalesceKind(agentSidePropertyId) : LSD_COALESCE_NEVER;
+}
+
 /**
  * \name LSD_GetPropertyBufferByCloudName
  *
@@ -1923,6 +2298,56 @@ EnsoErrorCode_e LSD_SetPropertiesOfDevice(
     return retVal;
 }
 
+/**
+ * \name    LSD_NotifyExternalProperties
+ *
+ * \brief   Notify the subscribers to a device of changes to properties its
+ *          device handler keeps outside the property pool. The new values
+ *          must already be readable through the external property function.
+ *
+ * \param   source          The id of the publisher (handler id)
+ *
+ * \param   deviceId        The object which properties have changed
+ *
+ * \param   propertyGroup   The group of the property in the local shadow
+ *
+ * \param   propertyDelta   The block of property agent side identifiers and
+ *                          their new values.
+ *
+ * \param   numProperties   The number of properties in propertyDelta.
+ *
+ * \return                  ensoError
+ */
+EnsoErrorCode_e LSD_NotifyExternalProperties(
+        const HandlerId_e source,
+        const EnsoDeviceId_t* deviceId,
+        const PropertyGroup_e propertyGroup,
+        const EnsoPropertyDelta_t* propertyDelta,
+        const uint16_t numProperties)
+{
+    /* Sanity checks */
+    if (!deviceId || !propertyDelta)
+    {
+        return eecNullPointerSupplied;
+    }
+
+    if (propertyGroup < 0 || propertyGroup >= PROPERTY_GROUP_MAX)
+    {
+        return eecPropertyGroupNotSupported;
+    }
+
+    OSAL_LockMutex(&lsdMutex);
+    EnsoObject_t* destination = LSD_FindEnsoObjectByDeviceIdDirectly(deviceId);
+    OSAL_UnLockMutex(&lsdMutex);
+
+    if (!destination)
+    {
+        return eecEnsoObjectNotFound;
+    }
+
+    return LSD_NotifyDirectly(source, destination, propertyGroup, propertyDelta, numProperties);
+}
+
 
 
 /**
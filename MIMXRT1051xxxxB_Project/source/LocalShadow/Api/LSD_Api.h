@@ -43,6 +43,18 @@ EnsoErrorCode_e LSD_GetDevicesId(
         const uint16_t  bufferElems,
         uint16_t* numDevices);
 
+EnsoErrorCode_e LSD_GetAllDevicesId(
+        EnsoDeviceId_t* buffer,
+        const uint16_t  bufferElems,
+        uint16_t* numDevices);
+
+EnsoErrorCode_e LSD_GetPropertiesByFilter(
+        const EnsoDeviceId_t* deviceId,
+        const PropertyFilter_e filter,
+        EnsoProperty_t* buffer,
+        const uint16_t bufferElems,
+        uint16_t* numProperties);
+
 int LSD_DeviceIdCompare(const EnsoDeviceId_t* leftThing, const EnsoDeviceId_t* rightThing);
 
 bool LSD_IsPropertyNested(
@@ -98,6 +110,13 @@ EnsoErrorCode_e LSD_RestoreProperty(
         EnsoPropertyType_t propType,
         const EnsoPropertyValue_u* groupValues);
 
+EnsoErrorCode_e LSD_RestorePropertyValues(
+        EnsoObject_t* owner,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        const char* cloudSideId,
+        EnsoPropertyType_t propType,
+        const EnsoPropertyValue_u* groupValues);
+
 EnsoErrorCode_e LSD_RemovePropertyByAgentSideId(
         const EnsoDeviceId_t* deviceId,
         const EnsoAgentSidePropertyId_t agentSideId);
@@ -106,11 +125,24 @@ EnsoErrorCode_e LSD_RemovePropertyByCloudSideId(
         const EnsoDeviceId_t* deviceId,
         const char* cloudName);
 
+EnsoErrorCode_e LSD_ForgetPropertyByAgentSideId(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSideId);
+
 EnsoErrorCode_e LSD_SetPropertyOutOfSync(
         const EnsoDeviceId_t* deviceId,
         const char* propName,
         const PropertyGroup_e propertyGroup);
 
+EnsoErrorCode_e LSD_SetPropertyOutOfSyncState(
+        const EnsoDeviceId_t* deviceId,
+        const char* propName,
+        const PropertyGroup_e propertyGroup,
+        const bool outOfSync);
+
+uint32_t LSD_GetNumberOfOutOfSyncProperties(
+        const PropertyGroup_e propertyGroup);
+
 /*****************************************************************************/
 /*                                                                           */
 /* Subscribe functions                                                       */
@@ -180,6 +212,21 @@ EnsoErrorCode_e LSD_GetPropertyValueByAgentSideId(
         const EnsoAgentSidePropertyId_t agentSidePropertyId,
         EnsoPropertyValue_u* pRxValue);
 
+void LSD_SetExternalPropertyFunction(LSD_ExternalPropertyFunction_t externalProperty);
+
+EnsoErrorCode_e LSD_GetExternalProperty(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSidePropertyId,
+        EnsoProperty_t* property);
+
+void LSD_SetExternalResyncFunction(LSD_ExternalResyncFunction_t externalResync);
+
+EnsoErrorCode_e LSD_SetExternalPropertiesOutOfSync(const EnsoDeviceId_t* deviceId);
+
+void LSD_SetCoalesceKindFunction(LSD_CoalesceKindFunction_t coalesceKind);
+
+LSD_Coalesce_e LSD_GetCoalesceKind(const EnsoAgentSidePropertyId_t agentSidePropertyId);
+
 EnsoErrorCode_e LSD_GetPropertyBufferByCloudName(
         const EnsoDeviceId_t* deviceId,
         const PropertyGroup_e propertyGroup,
@@ -257,6 +304,13 @@ EnsoErrorCode_e LSD_SetPropertiesOfDevice(
         const EnsoPropertyDelta_t* propertyDelta,
         const uint16_t numProperties);
 
+EnsoErrorCode_e LSD_NotifyExternalProperties(
+        const HandlerId_e source,
+        const EnsoDeviceId_t* deviceId,
+        const PropertyGroup_e propertyGroup,
+        const EnsoPropertyDelta_t* propertyDelta,
+        const uint16_t numProperties);
+
 void LSD_DumpObjectStore(void);
 
 #endif
@@ -12,6 +12,8 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_LSD
+
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
@@ -76,13 +78,13 @@ EnsoErrorCode_e LSD_ConvertTypedDataToJsonValue(
     {
     case evInt32:
         ////////*bufferUsed  = snprintf(destBuffer, destBufferSize, "%d", propVal.int32Value);	//////// [RE:format]
-        *bufferUsed  = snprintf(destBuffer, destBufferSize, "%ld", propVal.int32Value);
+        *bufferUsed  = snprintf(destBuffer, destBufferSize, "%" PRId32, propVal.int32Value);
         break;
 
     case evUnsignedInt32:
     case evTimestamp:
         ////////*bufferUsed  = snprintf(destBuffer, destBufferSize, "%u", propVal.uint32Value);	//////// [RE:format]
-        *bufferUsed  = snprintf(destBuffer, destBufferSize, "%lu", propVal.uint32Value);
+        *bufferUsed  = snprintf(destBuffer, destBufferSize, "%" PRIu32, propVal.uint32Value);
         break;
 
     case evBoolean:
@@ -506,11 +508,11 @@ char * LSD_Value2s(char * buf, int size, EnsoValueType_e type, EnsoPropertyValue
     {
     case evInt32:
         ////////snprintf(buf, size, "%d", pval->int32Value);	//////// [RE:format]
-        snprintf(buf, size, "%ld", pval->int32Value);
+        snprintf(buf, size, "%" PRId32, pval->int32Value);
         break;
     case evUnsignedInt32:
         ////////snprintf(buf, size, "%u", pval->uint32Value);	//////// [RE:format]
-        snprintf(buf, size, "%lu", pval->uint32Value);
+        snprintf(buf, size, "%" PRIu32, pval->uint32Value);
         break;
     case evFloat32:
         snprintf(buf, size, "%f", pval->float32Value);
@@ -526,7 +528,7 @@ char * LSD_Value2s(char * buf, int size, EnsoValueType_e type, EnsoPropertyValue
         break;
     case evTimestamp:
         ////////snprintf(buf, size, "%u", pval->timestamp.seconds);	//////// [RE:format]
-        snprintf(buf, size, "%lu", pval->timestamp.seconds);
+        snprintf(buf, size, "%" PRIu32, pval->timestamp.seconds);
         break;
     default:
         bp = "Unknown";
@@ -350,7 +350,11 @@ typedef struct EnsoObject_tag
     // Flags to indicate whether object has out-of-sync properties with AWS Shadow
     bool                      reportedOutOfSync;
     bool                      desiredOutOfSync;
+    // Properties kept outside the property pool must be sent to the cloud again
+    bool                      externalOutOfSync;
     EnsoIndex_t               propertyListStart;
+    // First property of the out-of-sync list of each group, -1 if empty
+    EnsoIndex_t               outOfSyncListStart[PROPERTY_GROUP_MAX];
     int32_t                   unsubscriptionRetryCount;
     SubscriptionBitmap_t      subscriptionBitmap[PROPERTY_GROUP_MAX];
 } EnsoObject_t;
@@ -375,6 +379,43 @@ typedef enum
     PROPERTY_FILTER_ALL
 } PropertyFilter_e;
 
+/**
+ * Supplied by a device handler which keeps some of its properties outside
+ * the property pool. It fills in the property and returns true if it owns
+ * the agent side ID, it is called with the local shadow locked.
+ */
+typedef bool (*LSD_ExternalPropertyFunction_t)(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        EnsoProperty_t* property);
+
+/**
+ * Supplied by the same device handler. It notifies all the reported
+ * properties the device keeps outside the property pool again, with
+ * LSD_NotifyExternalProperties(), and returns the number of notifications
+ * sent. It is called with the local shadow unlocked.
+ */
+typedef uint16_t (*LSD_ExternalResyncFunction_t)(const EnsoDeviceId_t* deviceId);
+
+/**
+ * How a property changed again before its last change was sent to the cloud
+ * may be merged into the delta still waiting to go, rather than queued as a
+ * new one
+ */
+typedef enum
+{
+    LSD_COALESCE_NEVER = 0,     // Every change is sent, the default
+    LSD_COALESCE_LATEST,        // Measurements, only the latest value matters
+    LSD_COALESCE_SAME_STATE     // States, a repeat of the waiting value is merged
+                                // but nothing is merged across a change of state
+} LSD_Coalesce_e;
+
+/**
+ * Supplied by a device handler to say how each of its properties coalesces
+ */
+typedef LSD_Coalesce_e (*LSD_CoalesceKindFunction_t)(
+        const EnsoAgentSidePropertyId_t agentSideId);
+
 /*!****************************************************************************
  * Public Functions
  *****************************************************************************/
@@ -11,6 +11,8 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_LSD
+
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
@@ -32,6 +34,8 @@
  * Constants
  *****************************************************************************/
 
+#define INDEX_SLOT_EMPTY    (-1)
+
 
 /*!****************************************************************************
  * Private Variables
@@ -40,9 +44,44 @@
 /**
  * \name prv_ObjectStore
  *
- * \brief Simple array structure to store the object pointers
+ * \brief Array of objects, allocated once by LSD_EnsoObjectStoreInit() so
+ * object pointers stay valid for the life of the store.
+ */
+static EnsoObject_t* prv_ObjectStore = NULL;
+
+/**
+ * \name prv_ObjectStoreSize
+ *
+ * \brief Number of entries in prv_ObjectStore
+ */
+static int prv_ObjectStoreSize = 0;
+
+/**
+ * \name prv_DeviceIndex
+ *
+ * \brief Open addressing (linear probing) index from device ID to position
+ * in prv_ObjectStore. It has prv_DeviceIndexMask + 1 slots, at least twice
+ * prv_ObjectStoreSize. Empty slots hold -1.
+ */
+static EnsoIndex_t* prv_DeviceIndex = NULL;
+static uint32_t prv_DeviceIndexMask = 0;
+
+/**
+ * \name prv_ExternalProperty
+ *
+ * \brief Supplies the properties a device handler keeps outside the property
+ * pool, or NULL if there are none.
  */
-static EnsoObject_t prv_ObjectStore[LSD_MAX_THING + 1];
+static LSD_ExternalPropertyFunction_t prv_ExternalProperty = NULL;
+
+/**
+ * \name prv_ExternalResync
+ *
+ * \brief Sends the properties a device handler keeps outside the property
+ * pool again when a sync pass finds them out of sync, or NULL if there are
+ * none.
+ */
+static LSD_ExternalResyncFunction_t prv_ExternalResync = NULL;
 
 
 /*!****************************************************************************
@@ -91,6 +130,89 @@ static void prv_SetDeviceStatus(
     }
 }
 
+/**
+ * \name prv_DeviceIdHome
+ *
+ * \brief Returns the slot in prv_DeviceIndex where probing for a device ID
+ * starts. Hashes the same fields LSD_DeviceIdCompare() compares.
+ *
+ * \param deviceId         The device ID
+ *
+ * \return                 Slot number
+ */
+static uint32_t prv_DeviceIdHome(const EnsoDeviceId_t* deviceId)
+{
+    uint64_t key = deviceId->deviceAddress ^
+                   ((uint64_t)deviceId->technology << 48) ^
+                   ((uint64_t)deviceId->childDeviceId << 40);
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (uint32_t)key & prv_DeviceIndexMask;
+}
+
+/**
+ * \name prv_IndexObject
+ *
+ * \brief Adds an object to the device index.
+ *
+ * \param objectIndex      Position of the object in prv_ObjectStore
+ */
+static void prv_IndexObject(const EnsoIndex_t objectIndex)
+{
+    uint32_t slot = prv_DeviceIdHome(&prv_ObjectStore[objectIndex].deviceId);
+
+    /* The index is at least twice the store size so there is always an
+     * empty slot */
+    while (INDEX_SLOT_EMPTY != prv_DeviceIndex[slot])
+    {
+        slot = (slot + 1) & prv_DeviceIndexMask;
+    }
+    prv_DeviceIndex[slot] = objectIndex;
+}
+
+/**
+ * \name prv_UnindexObject
+ *
+ * \brief Removes an object from the device index, shifting later entries in
+ * the probe sequence back so no tombstones are needed. Must be called while
+ * the object still holds its device ID.
+ *
+ * \param objectIndex      Position of the object in prv_ObjectStore
+ */
+static void prv_UnindexObject(const EnsoIndex_t objectIndex)
+{
+    uint32_t hole = prv_DeviceIdHome(&prv_ObjectStore[objectIndex].deviceId);
+
+    while (prv_DeviceIndex[hole] != objectIndex)
+    {
+        if (INDEX_SLOT_EMPTY == prv_DeviceIndex[hole])
+        {
+            return;
+        }
+        hole = (hole + 1) & prv_DeviceIndexMask;
+    }
+
+    uint32_t slot = hole;
+    for (;;)
+    {
+        slot = (slot + 1) & prv_DeviceIndexMask;
+        if (INDEX_SLOT_EMPTY == prv_DeviceIndex[slot])
+        {
+            break;
+        }
+        /* Move the entry into the hole unless its home lies cyclically
+         * between the hole and its current slot. */
+        uint32_t home = prv_DeviceIdHome(&prv_ObjectStore[prv_DeviceIndex[slot]].deviceId);
+        if (((slot - home) & prv_DeviceIndexMask) >= ((slot - hole) & prv_DeviceIndexMask))
+        {
+            prv_DeviceIndex[hole] = prv_DeviceIndex[slot];
+            hole = slot;
+        }
+    }
+    prv_DeviceIndex[hole] = INDEX_SLOT_EMPTY;
+}
+
 /*!****************************************************************************
  * Public Functions
  *****************************************************************************/
@@ -211,6 +333,11 @@ EnsoErrorCode_e LSD_CopyDeviceId(EnsoDeviceId_t* dest, const EnsoDeviceId_t* sou
  *
  * \brief Used to set up the enso object store.
  *
+ * The number of objects is chosen from the free heap at start up: the store
+ * may use LSD_OBJECT_STORE_HEAP_PERCENT of it, allowing for
+ * LSD_PROPERTIES_PER_THING properties per object, but always holds at least
+ * LSD_MAX_THING things plus the gateway and at most LSD_MAX_THING_LIMIT.
+ *
  * \return ensoError        Most likely to be out of space...
  *
  */
@@ -218,7 +345,49 @@ EnsoErrorCode_e LSD_EnsoObjectStoreInit(void)
 {
     EnsoErrorCode_e retVal = eecNoError;
 
-    memset(prv_ObjectStore, 0, sizeof(prv_ObjectStore));
+    OSAL_Free(prv_ObjectStore);
+    OSAL_Free(prv_DeviceIndex);
+    prv_ObjectStore = NULL;
+    prv_DeviceIndex = NULL;
+    prv_ObjectStoreSize = 0;
+
+    size_t perObject = sizeof(EnsoObject_t) + 2 * sizeof(EnsoIndex_t) +
+                       LSD_PROPERTIES_PER_THING * sizeof(EnsoPropertyContainer_t);
+    size_t budget = OSAL_GetFreeHeapSize() / 100 * LSD_OBJECT_STORE_HEAP_PERCENT;
+    int size = budget / perObject;
+    if (size < LSD_MAX_THING + 1)
+    {
+        size = LSD_MAX_THING + 1;
+    }
+    if (size > LSD_MAX_THING_LIMIT)
+    {
+        size = LSD_MAX_THING_LIMIT;
+    }
+
+    uint32_t indexSize = 1;
+    while (indexSize < 2 * size)
+    {
+        indexSize <<= 1;
+    }
+
+    prv_ObjectStore = OSAL_MemoryRequest(NULL, size * sizeof(EnsoObject_t));
+    prv_DeviceIndex = OSAL_MemoryRequest(NULL, indexSize * sizeof(EnsoIndex_t));
+    if (!prv_ObjectStore || !prv_DeviceIndex)
+    {
+        LOG_Error("Unable to allocate object store for %d objects", size);
+        OSAL_Free(prv_ObjectStore);
+        OSAL_Free(prv_DeviceIndex);
+        prv_ObjectStore = NULL;
+        prv_DeviceIndex = NULL;
+        return eecPoolFull;
+    }
+
+    memset(prv_ObjectStore, 0, size * sizeof(EnsoObject_t));
+    /* INDEX_SLOT_EMPTY is all ones */
+    memset(prv_DeviceIndex, 0xFF, indexSize * sizeof(EnsoIndex_t));
+    prv_ObjectStoreSize = size;
+    prv_DeviceIndexMask = indexSize - 1;
+    LOG_Info("Object store sized for %d objects", size);
 
     return retVal;
 }
@@ -258,7 +427,7 @@ EnsoObject_t* LSD_CreateEnsoObjectDirectly(
     int i = 0;
     bool stored = false;
 
-    while ((i <= LSD_MAX_THING) && (!stored))
+    while ((i < prv_ObjectStoreSize) && (!stored))
     {
         if (!LSD_IsEnsoDeviceIdValid(prv_ObjectStore[i].deviceId))
         {
@@ -278,6 +447,7 @@ EnsoObject_t* LSD_CreateEnsoObjectDirectly(
         // Initialise the new object.
         newObject->deviceId = newId;
         newObject->propertyListStart = -1;
+        prv_IndexObject(i);
 
         // Not announced yet to cloud
         newObject->announceAccepted = false;
@@ -287,6 +457,11 @@ EnsoObject_t* LSD_CreateEnsoObjectDirectly(
         // No properties yet, can't be out of sync
         newObject->reportedOutOfSync = false;
         newObject->desiredOutOfSync = false;
+        newObject->externalOutOfSync = false;
+        for (int group = 0; group < PROPERTY_GROUP_MAX; group++)
+        {
+            newObject->outOfSyncListStart[group] = -1;
+        }
     }
 
     return newObject;
@@ -307,6 +482,8 @@ EnsoErrorCode_e LSD_DestroyEnsoDeviceDirectly(const EnsoDeviceId_t deviceId)
     EnsoObject_t* object = LSD_FindEnsoObjectByDeviceIdDirectly(&deviceId);
     if (object)
     {
+        prv_UnindexObject(object - prv_ObjectStore);
+
         // Invalidate the object (an invalid device ID is used to indicate the
         // object isn't valid)
         memset(object, 0, sizeof(EnsoObject_t));
@@ -345,7 +522,8 @@ EnsoErrorCode_e LSD_RegisterEnsoObjectDirectly(EnsoObject_t* newObject)
  *
  * \brief Find an ensoObject by its physical identifier.
  *
- * This function is used to find an ensoObject by its physical identifier.
+ * This function is used to find an ensoObject by its physical identifier,
+ * looking it up in the device index.
  *
  * \param  deviceId          The thing ID of the device to look for,
  *                          probably based on a MAC address or ZigBee
@@ -369,16 +547,21 @@ EnsoObject_t* LSD_FindEnsoObjectByDeviceIdDirectly(const EnsoDeviceId_t* deviceI
         return NULL;
     }
 
-    for (int i = 0; i <= LSD_MAX_THING ; ++i)
+    if (!prv_DeviceIndex)
     {
-        if ( LSD_IsEnsoDeviceIdValid( prv_ObjectStore[i].deviceId ))
+        return NULL;
+    }
+
+    uint32_t slot = prv_DeviceIdHome(deviceId);
+    int i;
+    while ((i = prv_DeviceIndex[slot]) != INDEX_SLOT_EMPTY)
+    {
+        if (0 == LSD_DeviceIdCompare(deviceId, &(prv_ObjectStore[i].deviceId)))
         {
-            if (0 == LSD_DeviceIdCompare(deviceId, &(prv_ObjectStore[i].deviceId)))
-            {
-                theObject = &prv_ObjectStore[i];
-                break;
-            }
+            theObject = &prv_ObjectStore[i];
+            break;
         }
+        slot = (slot + 1) & prv_DeviceIndexMask;
     }
 
     return theObject;
@@ -398,7 +581,7 @@ EnsoObject_t* LSD_FindEnsoObjectNeedingAnnounceDirectly()
 {
     EnsoObject_t* theObject = NULL;
 
-    for (int i = 0; i <= LSD_MAX_THING ; ++i)
+    for (int i = 0; i < prv_ObjectStoreSize ; ++i)
     {
         if ( LSD_IsEnsoDeviceIdValid( prv_ObjectStore[i].deviceId ))
         {
@@ -430,9 +613,9 @@ EnsoObject_t* LSD_GetNotUnsubcribedEnsoObjects(void)
     /* Start from previous objects */
     static int32_t lastObjectId = 0;
 
-    for (int i = 0; i < LSD_MAX_THING; i++)
+    for (int i = 0; i < prv_ObjectStoreSize; i++)
     {
-        lastObjectId = (lastObjectId + 1) % LSD_MAX_THING;
+        lastObjectId = (lastObjectId + 1) % prv_ObjectStoreSize;
 
         if (prv_ObjectStore[lastObjectId].unsubscriptionRetryCount > 0)
         {
@@ -455,7 +638,7 @@ int LSD_CountEnsoObjectsDirectly( void )
 {
     int count=0;
 
-    for (int i = 0; i <= LSD_MAX_THING; ++i)
+    for (int i = 0; i < prv_ObjectStoreSize; ++i)
     {
         if ( LSD_IsEnsoDeviceIdValid ( prv_ObjectStore[i].deviceId ))
         {
@@ -494,32 +677,74 @@ EnsoErrorCode_e LSD_NotifyDirectly(
     {
         return eecBufferTooBig;
     }
+    if (numProperties == 0)
+    {
+        return eecNoError;
+    }
 
     EnsoErrorCode_e retVal = eecNoError;
 
     /*
-     * First, created a new delta array that only contains public properties as we will not want to send updates
-     * on private properties to public subscribers
+     * First, look up each delta's property once and work out which deltas
+     * each subscriber gets: public subscribers to the object only get public
+     * properties, property subscribers only get the properties they
+     * subscribed to.
      */
-    EnsoPropertyDelta_t adjustedDeltas[ECOM_MAX_DELTAS];
-    uint16_t numAdjustedProperties = 0;
+    const uint8_t allDeltas = (uint8_t)((1u << numProperties) - 1);
+    uint8_t publicDeltas = 0;
+    uint8_t privateDeltas = 0;
+    uint8_t subscriberDeltas[LSD_SUBSCRIBER_BITMAP_SIZE] = { 0 };
 
     for (unsigned int i = 0; i < numProperties; i++)
     {
-        // Find the property and check if it is private
-        EnsoProperty_t* theProperty;
-        theProperty = LSD_FindPropertyByAgentSideIdDirectly(destObject, deltas[i].agentSidePropertyID);
+        EnsoProperty_t* theProperty = LSD_FindPropertyByAgentSideIdDirectly(destObject, deltas[i].agentSidePropertyID);
         if (theProperty)
         {
             if (PROPERTY_PRIVATE != theProperty->type.kind)
             {
-                // Add property to the adjusted delta array.
-                memcpy(&adjustedDeltas[numAdjustedProperties], &deltas[i], sizeof(EnsoPropertyDelta_t));
-                ++numAdjustedProperties;
+                publicDeltas |= 1u << i;
+            }
+            else
+            {
+                privateDeltas |= 1u << i;
+            }
+
+            SubscriptionBitmap_t bitmap = theProperty->subscriptionBitmap[propertyGroup];
+            for (unsigned int subscriberBit = 0; bitmap; subscriberBit++, bitmap >>= 1)
+            {
+                if (bitmap & 1)
+                {
+                    subscriberDeltas[subscriberBit] |= 1u << i;
+                }
+            }
+        }
+        else
+        {
+            // Properties kept outside the pool are public and have no
+            // property subscribers, only the object subscribers get them.
+            EnsoProperty_t externalProperty;
+            if (LSD_GetExternalPropertyDirectly(&destObject->deviceId, deltas[i].agentSidePropertyID, &externalProperty))
+            {
+                publicDeltas |= 1u << i;
+            }
+            else
+            {
+                LOG_Error("LSD_FindPropertyByAgentSideIdDirectly failed for property %d", deltas[i].agentSidePropertyID);
             }
         }
     }
 
+    /*
+     * The deltas are copied once into a shared block; each subscriber is sent
+     * a reference to it with a mask of the deltas meant for it.
+     */
+    ECOM_DeltaBlock_t* block = ECOM_NewDeltaBlock(destObject->deviceId, propertyGroup, numProperties, deltas);
+    if (!block)
+    {
+        LOG_Error("ECOM_NewDeltaBlock failed");
+        return eecPoolFull;
+    }
+
     /*
      * Second, find the subscribers for the entire object and notify them
      */
@@ -535,30 +760,16 @@ EnsoErrorCode_e LSD_NotifyDirectly(
                 /* Don't send back the deltas to the publishing object */
                 if (eecNoError == retVal && theSubscriberId != source)
                 {
-                    if (isSubscriberPrivate)
-                    {
-                        // Send the original deltas to the private subscriber.
-                        retVal = ECOM_SendUpdateToSubscriber(
-                            theSubscriberId,
-                            destObject->deviceId,
-                            propertyGroup,
-                            numProperties,
-                            deltas);
-                    }
-                    else
-                    {
-                        // Send the adjusted deltas to the public subscriber.
-                        retVal = ECOM_SendUpdateToSubscriber(
-                            theSubscriberId,
-                            destObject->deviceId,
-                            propertyGroup,
-                            numAdjustedProperties,
-                            adjustedDeltas);
-                    }
+                    // Private subscribers get all the deltas, public ones only
+                    // those of public properties.
+                    retVal = ECOM_SendDeltaBlockToSubscriber(
+                        theSubscriberId,
+                        block,
+                        isSubscriberPrivate ? allDeltas : publicDeltas);
 
                     if (eecNoError != retVal)
                     {
-                        LOG_Error("ECOM_SendUpdateToSubscriber failed %s", LSD_EnsoErrorCode_eToString(retVal));
+                        LOG_Error("ECOM_SendDeltaBlockToSubscriber failed %s", LSD_EnsoErrorCode_eToString(retVal));
                     }
                 }
             }
@@ -572,81 +783,96 @@ EnsoErrorCode_e LSD_NotifyDirectly(
      */
     for (unsigned int subscriberBit = 0; subscriberBit < LSD_SUBSCRIBER_BITMAP_SIZE; subscriberBit += 1)
     {
+        if (!subscriberDeltas[subscriberBit])
+        {
+            continue;
+        }
+
         HandlerId_e theSubscriberId;
         bool isSubscriberPrivate;
         EnsoErrorCode_e lsdRetVal = LSD_GetSubscriberIdDirectly(&theSubscriberId, &isSubscriberPrivate, propertyGroup, subscriberBit);
-        if (lsdRetVal == eecNoError)
+        /* Only of interest if we didn't originate it. */
+        if (lsdRetVal == eecNoError && theSubscriberId != source)
         {
-            /* See if this subscriber is interested in any of the property deltas. */
-            bool isInterested = false;
-            for (unsigned int propIdx = 0; propIdx < numProperties; propIdx += 1)
+            if (subscriberDeltas[subscriberBit] & privateDeltas)
             {
-                EnsoProperty_t* theProperty = LSD_FindPropertyByAgentSideIdDirectly(destObject, deltas[propIdx].agentSidePropertyID);
-                if (theProperty)
-                {
-                    /* Only of interest if we're subscribed, and we didn't originate it. */
-                    if (IS_BIT_SET(theProperty->subscriptionBitmap[propertyGroup], subscriberBit) && (theSubscriberId != source))
-                    {
-                        if (PROPERTY_PRIVATE == theProperty->type.kind)
-                        {
-                            assert(isSubscriberPrivate);
-                        }
-                        isInterested = true;
-                        break;
-                    }
-                }
-                else
-                {
-                    LOG_Error("LSD_FindPropertyByAgentSideIdDirectly failed for property %d", deltas[propIdx].agentSidePropertyID);
-                }
+                assert(isSubscriberPrivate);
             }
 
-            /* If they are interested, make a single delta message containing only the properties of interest to this subscriber. */
-            if (isInterested)
-            {
-                /* Build a filtered list of the ones of interest to this subscriber. */
-                EnsoPropertyDelta_t filteredDeltas[ECOM_MAX_DELTAS];
-                uint16_t numFilteredProperties = 0;
-                for (unsigned int propIdx = 0; propIdx < numProperties; propIdx += 1)
-                {
-                    // Find the property and check if it is of interest
-                    EnsoProperty_t* theProperty = LSD_FindPropertyByAgentSideIdDirectly(destObject, deltas[propIdx].agentSidePropertyID);
-                    if (theProperty)
-                    {
-                        /* Is this of interest to the subscriber? */
-                        if (IS_BIT_SET(theProperty->subscriptionBitmap[propertyGroup], subscriberBit) && (theSubscriberId != source))
-                        {
-                            if (PROPERTY_PRIVATE == theProperty->type.kind)
-                            {
-                                assert(isSubscriberPrivate);
-                            }
-
-                            memcpy(&filteredDeltas[numFilteredProperties], &deltas[propIdx], sizeof(EnsoPropertyDelta_t));
-                            ++numFilteredProperties;
-                        }
-                    }
-                }
+            /* Send to the subscriber. */
+            retVal = ECOM_SendDeltaBlockToSubscriber(
+                theSubscriberId,
+                block,
+                subscriberDeltas[subscriberBit]);
 
-                /* Send to the subscriber. */
-                retVal = ECOM_SendUpdateToSubscriber(
-                    theSubscriberId,
-                    destObject->deviceId,
-                    propertyGroup,
-                    numFilteredProperties,
-                    filteredDeltas);
-
-                if (eecNoError != retVal)
-                {
-                    LOG_Error("ECOM_SendUpdateToSubscriber failed %s", LSD_EnsoErrorCode_eToString(retVal));
-                }
+            if (eecNoError != retVal)
+            {
+                LOG_Error("ECOM_SendDeltaBlockToSubscriber failed %s", LSD_EnsoErrorCode_eToString(retVal));
             }
         }
     }
 
+    ECOM_ReleaseDeltaBlock(block);
+
     return retVal;
 }
 
 
+/**
+ * \name LSD_SetExternalPropertyFunctionDirectly
+ *
+ * \brief Set the function which supplies the properties kept outside the
+ * property pool. There is only one, the last one set wins.
+ *
+ * \param externalProperty  The function, or NULL for none
+ */
+void LSD_SetExternalPropertyFunctionDirectly(LSD_ExternalPropertyFunction_t externalProperty)
+{
+    prv_ExternalProperty = externalProperty;
+}
+
+
+/**
+ * \name LSD_GetExternalPropertyDirectly
+ *
+ * \brief Look up a property kept outside the property pool.
+ *
+ * \param deviceId          The device that owns the property
+ *
+ * \param agentSideId       The agent side ID of the property
+ *
+ * \param property          Filled in with a copy of the property
+ *
+ * \return                  true if the property was found
+ */
+bool LSD_GetExternalPropertyDirectly(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        EnsoProperty_t* property)
+{
+    if (!prv_ExternalProperty || !deviceId || !property)
+    {
+        return false;
+    }
+
+    return prv_ExternalProperty(deviceId, agentSideId, property);
+}
+
+
+/**
+ * \name LSD_SetExternalResyncFunctionDirectly
+ *
+ * \brief Set the function which sends the properties kept outside the
+ * property pool again. There is only one, the last one set wins.
+ *
+ * \param externalResync    The function, or NULL for none
+ */
+void LSD_SetExternalResyncFunctionDirectly(LSD_ExternalResyncFunction_t externalResync)
+{
+    prv_ExternalResync = externalResync;
+}
+
+
 /**
  * \name LSD_SetDeviceStatusDirectly
  *
@@ -709,8 +935,16 @@ EnsoErrorCode_e LSD_SyncLocalShadow(
     uint16_t numMessages = 0;
 
     *sentMessages = 0;
+
+    // Nothing is out of sync anywhere, don't visit the objects. The count is
+    // a single word so it can be read without taking the lock.
+    if (0 == LSD_GetNumberOfOutOfSyncPropertiesDirectly(propertyGroup))
+    {
+        return eecNoError;
+    }
+
     int i = 0;
-    while (maxNumMessages && i <= LSD_MAX_THING)
+    while (maxNumMessages && i < prv_ObjectStoreSize)
     {
         retVal = LSD_SendPropertiesByFilter_Safe(
                 PROPERTY_FILTER_OUT_OF_SYNC,
@@ -727,16 +961,25 @@ EnsoErrorCode_e LSD_SyncLocalShadow(
             LOG_Info("Sent out-of-sync deltas using %d messages", numMessages);
         }
 
+        // Properties kept outside the pool are sent by their device handler
+        EnsoDeviceId_t deviceId;
+        if (REPORTED_GROUP == propertyGroup && maxNumMessages &&
+            LSD_TakeExternalOutOfSync_Safe(&prv_ObjectStore[i], &deviceId) &&
+            prv_ExternalResync)
+        {
+            numMessages = prv_ExternalResync(&deviceId);
+            numMessages = (numMessages < maxNumMessages) ? numMessages : maxNumMessages;
+            maxNumMessages -= numMessages;
+            *sentMessages += numMessages;
+            LOG_Info("Sent external deltas using %d messages", numMessages);
+        }
+
         ++i;
     }
 
-    if (i == LSD_MAX_THING)
+    if (0 == LSD_GetNumberOfOutOfSyncPropertiesDirectly(propertyGroup))
     {
-        if ((DESIRED_GROUP == propertyGroup && !prv_ObjectStore[i].desiredOutOfSync) ||
-            (REPORTED_GROUP == propertyGroup && !prv_ObjectStore[i].reportedOutOfSync))
-        {
-            LOG_Info("Local Shadow sync completed for %s group", LSD_Group2s(propertyGroup));
-        }
+        LOG_Info("Local Shadow sync completed for %s group", LSD_Group2s(propertyGroup));
     }
 
     return retVal;
@@ -778,7 +1021,7 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter(
 
     *sentDeltas = 0;
     int i = 0;
-    while (i <= LSD_MAX_THING)
+    while (i < prv_ObjectStoreSize)
     {
         if ((filter == PROPERTY_FILTER_PERSISTENT) &&
             (destination == STORAGE_HANDLER))
@@ -860,7 +1103,7 @@ EnsoErrorCode_e LSD_GetDevicesIdDirectly(
 
     EnsoErrorCode_e  retVal = eecNoError;
     *numDevices = 0;
-    for (unsigned int i = 0; i <= LSD_MAX_THING; ++i)
+    for (int i = 0; i < prv_ObjectStoreSize; ++i)
     {
         if (LSD_IsEnsoDeviceIdValid(prv_ObjectStore[i].deviceId))
         {
@@ -885,12 +1128,56 @@ EnsoErrorCode_e LSD_GetDevicesIdDirectly(
     return retVal;
 }
 
+/**
+ * \brief   Get the identifiers of all the devices in the object store
+ *
+ * NOT THREAD SAFE
+ *
+ * \param[out] buffer       Buffer where the list of device identifiers is written
+
+ * \param   bufferElems     Maximum number of elements of the buffer array
+ *
+ * \param[out] numDevices   Number of device identifiers that have been written
+ *
+ * \return                  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_GetAllDevicesIdDirectly(
+        EnsoDeviceId_t* buffer,
+        const uint16_t  bufferElems,
+        uint16_t* numDevices)
+{
+    // Sanity check
+    if (!buffer || !numDevices)
+    {
+        LOG_Error("null pointer input param");
+        return eecNullPointerSupplied;
+    }
+
+    EnsoErrorCode_e  retVal = eecNoError;
+    *numDevices = 0;
+    for (int i = 0; i < prv_ObjectStoreSize; ++i)
+    {
+        if (LSD_IsEnsoDeviceIdValid(prv_ObjectStore[i].deviceId))
+        {
+            if (*numDevices >= bufferElems)
+            {
+                retVal = eecBufferTooSmall;
+                break; // Early exit
+            }
+            buffer[*numDevices] = prv_ObjectStore[i].deviceId;
+            (*numDevices)++;
+        }
+    }
+
+    return retVal;
+}
+
 /**
  * \brief    Dumps the Object Store hierarchy
  */
 void LSD_DumpObjectStore(void)
 {
-    for (unsigned int i = 0; i <= LSD_MAX_THING; i++)
+    for (int i = 0; i < prv_ObjectStoreSize; i++)
     {
         EnsoObject_t   * p = &prv_ObjectStore[i];
         if (LSD_IsEnsoDeviceIdValid(p->deviceId))
@@ -45,6 +45,15 @@ EnsoErrorCode_e LSD_NotifyDirectly(
         const EnsoPropertyDelta_t* deltas,
         const uint16_t numProperties);
 
+void LSD_SetExternalPropertyFunctionDirectly(LSD_ExternalPropertyFunction_t externalProperty);
+
+bool LSD_GetExternalPropertyDirectly(
+        const EnsoDeviceId_t* deviceId,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        EnsoProperty_t* property);
+
+void LSD_SetExternalResyncFunctionDirectly(LSD_ExternalResyncFunction_t externalResync);
+
 EnsoErrorCode_e LSD_SetDeviceStatusDirectly(
         const EnsoDeviceId_t theDevice,
         const EnsoDeviceStatus_e deviceStatus);
@@ -59,4 +68,9 @@ EnsoErrorCode_e LSD_GetDevicesIdDirectly(
         const uint16_t  bufferElems,
         uint16_t* numDevices);
 
+EnsoErrorCode_e LSD_GetAllDevicesIdDirectly(
+        EnsoDeviceId_t* buffer,
+        const uint16_t  bufferElems,
+        uint16_t* numDevices);
+
 #endif
@@ -11,7 +11,10 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_LSD
+
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 
@@ -23,6 +26,21 @@
 #include "ECOM_Api.h"
 
 
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+#define INDEX_SLOT_EMPTY    (-1)
+
+/**
+ * \name PROPERTY_CONTAINER
+ *
+ * \brief Address of the container with the given pool index
+ */
+#define PROPERTY_CONTAINER(store, i) \
+    (&(store)->propertyChunks[(i) / LSD_PROPERTY_CHUNK_SIZE][(i) % LSD_PROPERTY_CHUNK_SIZE])
+
+
 /*!****************************************************************************
  * Private Variables
  *****************************************************************************/
@@ -46,13 +64,294 @@ static Mutex_t * pLSD_Mutex = NULL;
  * Functions
  *****************************************************************************/
 
+/**
+ * \name prv_MixHash
+ *
+ * \brief Combines an owner object with a 32 bit key and scrambles the result
+ * so that consecutive keys spread across the index.
+ *
+ * \param   owner               The ensoObject the key belongs to
+ *
+ * \param   key                 The key to combine with the owner
+ *
+ * \return                      The hash value
+ */
+static uint32_t prv_MixHash(const EnsoObject_t* owner, uint32_t key)
+{
+    uint32_t hash = (uint32_t)(uintptr_t)owner ^ (key * 2654435761u);
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/**
+ * \name prv_HashCloudName
+ *
+ * \brief FNV-1a hash of a property cloud name. This is stored alongside the
+ * property so that only a hash match needs a string compare.
+ *
+ * \param   cloudName           The null terminated cloud name
+ *
+ * \return                      The hash value
+ */
+static uint32_t prv_HashCloudName(const char* cloudName)
+{
+    uint32_t hash = 2166136261u;
+    while (*cloudName)
+    {
+        hash ^= (uint8_t)*cloudName++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * \name prv_AgentSideIdHome
+ *
+ * \brief Returns the slot in agentSideIdIndex where probing for the given
+ * property container starts.
+ */
+static uint32_t prv_AgentSideIdHome(
+        const EnsoPropertyStore_t* propertyStore,
+        const EnsoIndex_t propertyIndex)
+{
+    const EnsoPropertyContainer_t* container = PROPERTY_CONTAINER(propertyStore, propertyIndex);
+    return prv_MixHash(container->owner, container->property.agentSidePropertyID) & propertyStore->indexMask;
+}
+
+/**
+ * \name prv_CloudNameHome
+ *
+ * \brief Returns the slot in cloudNameIndex where probing for the given
+ * property container starts.
+ */
+static uint32_t prv_CloudNameHome(
+        const EnsoPropertyStore_t* propertyStore,
+        const EnsoIndex_t propertyIndex)
+{
+    const EnsoPropertyContainer_t* container = PROPERTY_CONTAINER(propertyStore, propertyIndex);
+    return prv_MixHash(container->owner, container->cloudNameHash) & propertyStore->indexMask;
+}
+
+/**
+ * \name prv_IndexInsert
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief Adds a property to one of the lookup indices.
+ *
+ * \param   propertyStore       The property store owning the index
+ *
+ * \param   index               The index table to add to
+ *
+ * \param   home                Slot at which probing starts
+ *
+ * \param   propertyIndex       The pool index of the property
+ */
+static void prv_IndexInsert(
+        const EnsoPropertyStore_t* propertyStore,
+        EnsoIndex_t* index,
+        uint32_t home,
+        const EnsoIndex_t propertyIndex)
+{
+    uint32_t slot = home;
+
+    /* The index is at least twice the pool size so there is always an
+     * empty slot */
+    while (INDEX_SLOT_EMPTY != index[slot])
+    {
+        slot = (slot + 1) & propertyStore->indexMask;
+    }
+    index[slot] = propertyIndex;
+}
+
+/**
+ * \name prv_IndexDelete
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief Removes a property from one of the lookup indices. Later entries in
+ * the same probe sequence are shifted back so no tombstones are needed.
+ *
+ * \param   propertyStore       The property store owning the index
+ *
+ * \param   index               The index table to remove from
+ *
+ * \param   getHome             Returns the home slot of a pool entry
+ *
+ * \param   propertyIndex       The pool index of the property
+ */
+static void prv_IndexDelete(
+        const EnsoPropertyStore_t* propertyStore,
+        EnsoIndex_t* index,
+        uint32_t (*getHome)(const EnsoPropertyStore_t*, const EnsoIndex_t),
+        const EnsoIndex_t propertyIndex)
+{
+    uint32_t hole = getHome(propertyStore, propertyIndex);
+
+    while (index[hole] != propertyIndex)
+    {
+        if (INDEX_SLOT_EMPTY == index[hole])
+        {
+            /* Not indexed, e.g. a property without a cloud name */
+            return;
+        }
+        hole = (hole + 1) & propertyStore->indexMask;
+    }
+
+    uint32_t slot = hole;
+    for (;;)
+    {
+        slot = (slot + 1) & propertyStore->indexMask;
+        if (INDEX_SLOT_EMPTY == index[slot])
+        {
+            break;
+        }
+        /* Move the entry into the hole unless its home lies cyclically
+         * between the hole and its current slot. */
+        uint32_t home = getHome(propertyStore, index[slot]);
+        if (((slot - home) & propertyStore->indexMask) >= ((slot - hole) & propertyStore->indexMask))
+        {
+            index[hole] = index[slot];
+            hole = slot;
+        }
+    }
+    index[hole] = INDEX_SLOT_EMPTY;
+}
+
+/**
+ * \name prv_IndexCloudName
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief Hashes the cloud name of a property and adds it to the cloud name
+ * index. Properties without a cloud name yet are left out.
+ *
+ * \param   propertyStore       The property store
+ *
+ * \param   propertyIndex       The pool index of the property
+ */
+static void prv_IndexCloudName(
+        EnsoPropertyStore_t* propertyStore,
+        const EnsoIndex_t propertyIndex)
+{
+    EnsoPropertyContainer_t* container = PROPERTY_CONTAINER(propertyStore, propertyIndex);
+    if (container->property.cloudName[0])
+    {
+        container->cloudNameHash = prv_HashCloudName(container->property.cloudName);
+        prv_IndexInsert(propertyStore, propertyStore->cloudNameIndex,
+                        prv_CloudNameHome(propertyStore, propertyIndex),
+                        propertyIndex);
+    }
+}
+
+/**
+ * \name prv_UnindexProperty
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief Removes a property from both lookup indices. Must be called before
+ * the property contents are cleared.
+ *
+ * \param   propertyStore       The property store
+ *
+ * \param   propertyIndex       The pool index of the property
+ */
+static void prv_UnindexProperty(
+        EnsoPropertyStore_t* propertyStore,
+        const EnsoIndex_t propertyIndex)
+{
+    prv_IndexDelete(propertyStore, propertyStore->agentSideIdIndex,
+                    prv_AgentSideIdHome, propertyIndex);
+    if (PROPERTY_CONTAINER(propertyStore, propertyIndex)->property.cloudName[0])
+    {
+        prv_IndexDelete(propertyStore, propertyStore->cloudNameIndex,
+                        prv_CloudNameHome, propertyIndex);
+    }
+    PROPERTY_CONTAINER(propertyStore, propertyIndex)->owner = NULL;
+    PROPERTY_CONTAINER(propertyStore, propertyIndex)->cloudNameHash = 0;
+}
+
+/**
+ * \name prv_SetOutOfSync
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief Set or clear the out-of-sync flag of one group of a property. The
+ * property is linked into or out of the owner's out-of-sync list for that
+ * group and the owner flag and store count follow. This is the only place
+ * the flags change once a property has been created.
+ *
+ * \param   propertyStore       The property store
+ *
+ * \param   owner               The ensoObject the property belongs to
+ *
+ * \param   propertyIndex       The pool index of the property
+ *
+ * \param   propertyGroup       REPORTED_GROUP or DESIRED_GROUP
+ *
+ * \param   outOfSync           The new state of the flag
+ */
+static void prv_SetOutOfSync(
+        EnsoPropertyStore_t* propertyStore,
+        EnsoObject_t* owner,
+        const EnsoIndex_t propertyIndex,
+        const PropertyGroup_e propertyGroup,
+        const bool outOfSync)
+{
+    EnsoPropertyContainer_t* container = PROPERTY_CONTAINER(propertyStore, propertyIndex);
+    bool wasOutOfSync = (REPORTED_GROUP == propertyGroup) ?
+            container->property.type.reportedOutOfSync :
+            container->property.type.desiredOutOfSync;
+
+    if (wasOutOfSync == outOfSync)
+    {
+        return;
+    }
+
+    if (outOfSync)
+    {
+        container->nextOutOfSyncIndex[propertyGroup] = owner->outOfSyncListStart[propertyGroup];
+        owner->outOfSyncListStart[propertyGroup] = propertyIndex;
+        propertyStore->numOutOfSync[propertyGroup]++;
+    }
+    else
+    {
+        // The list normally only holds a few entries, the current one is
+        // usually first when a sync pass clears them
+        EnsoIndex_t* link = &owner->outOfSyncListStart[propertyGroup];
+        while ((*link >= 0) && (*link != propertyIndex))
+        {
+            link = &PROPERTY_CONTAINER(propertyStore, *link)->nextOutOfSyncIndex[propertyGroup];
+        }
+        if (*link == propertyIndex)
+        {
+            *link = container->nextOutOfSyncIndex[propertyGroup];
+        }
+        container->nextOutOfSyncIndex[propertyGroup] = -1;
+        propertyStore->numOutOfSync[propertyGroup]--;
+    }
+
+    if (REPORTED_GROUP == propertyGroup)
+    {
+        container->property.type.reportedOutOfSync = outOfSync;
+        owner->reportedOutOfSync = (owner->outOfSyncListStart[propertyGroup] >= 0);
+    }
+    else
+    {
+        container->property.type.desiredOutOfSync = outOfSync;
+        owner->desiredOutOfSync = (owner->outOfSyncListStart[propertyGroup] >= 0);
+    }
+}
+
 /**
  * \name prv_GetPropertyIndexByClientSideId
  *
  * NOT THREAD SAFE
  *
- * \brief This function searches the property list for the ensoObject to find
- * the property that matches the supplied client side ID.
+ * \brief This function looks up the property of the ensoObject that matches
+ * the supplied client side ID in the agent side ID index.
  *
  * \param   propertyStore       Pointer to the property store containing the
  *                              property lists.
@@ -80,19 +379,22 @@ LSD_STATIC EnsoErrorCode_e prv_GetPropertyIndexByClientSideId(
         return eecNullPointerSupplied;
     }
 
-    int i = ownerObject->propertyListStart;
+    uint32_t slot = prv_MixHash(ownerObject, clientSideId) & propertyStore->indexMask;
+    int i;
     *propertyIndex = -1;
     EnsoErrorCode_e retVal = eecPropertyNotFound;
 
-    while ((i >= 0) && (retVal < 0))
+    while ((i = propertyStore->agentSideIdIndex[slot]) != INDEX_SLOT_EMPTY)
     {
-        if (clientSideId == propertyStore->propertyPool[i].property.agentSidePropertyID)
+        if ((ownerObject == PROPERTY_CONTAINER(propertyStore, i)->owner) &&
+            (clientSideId == PROPERTY_CONTAINER(propertyStore, i)->property.agentSidePropertyID))
         {
             /* Found it */
             *propertyIndex = i;
             retVal = eecNoError;
+            break;
         }
-        i = propertyStore->propertyPool[i].nextContainerIndex;
+        slot = (slot + 1) & propertyStore->indexMask;
     }
 
     return retVal;
@@ -103,8 +405,9 @@ LSD_STATIC EnsoErrorCode_e prv_GetPropertyIndexByClientSideId(
  *
  * NOT THREAD SAFE
  *
- * \brief This function searches the property list for the ensoObject to find
- * the property that matches the supplied cloud side ID
+ * \brief This function looks up the property of the ensoObject that matches
+ * the supplied cloud side ID in the cloud name index. The stored name hash is
+ * compared first so normally only the matching entry needs a strcmp.
  *
  * \param   propertyStore       Pointer to the property store containing the
  *                              property lists.
@@ -149,23 +452,147 @@ LSD_STATIC EnsoErrorCode_e prv_GetPropertyIndexByCloudName(
         LOG_Error("null pointer input param");
     }
 
-    i = ownerObject->propertyListStart;
+    uint32_t nameHash = prv_HashCloudName(cloudName);
+    uint32_t slot = prv_MixHash(ownerObject, nameHash) & propertyStore->indexMask;
     *propertyIndex = -1;
 
-    while ((i >= 0) && (retVal < 0))
+    while ((i = propertyStore->cloudNameIndex[slot]) != INDEX_SLOT_EMPTY)
     {
-        if (0 == strcmp(propertyStore->propertyPool[i].property.cloudName, cloudName))
+        const EnsoPropertyContainer_t* container = PROPERTY_CONTAINER(propertyStore, i);
+        if ((ownerObject == container->owner) &&
+            (nameHash == container->cloudNameHash) &&
+            (0 == strcmp(container->property.cloudName, cloudName)))
         {
             /* Found it */
             *propertyIndex = i;
             retVal =eecNoError;
+            break;
         }
-        i = propertyStore->propertyPool[i].nextContainerIndex;
+        slot = (slot + 1) & propertyStore->indexMask;
     }
 
     return retVal;
 }
 
+/**
+ * \name    prv_ResizeIndices
+ *
+ * \brief   Replaces both lookup indices with empty ones of the given size and
+ *          re-inserts every property in the pool.
+ *
+ * NOT THREAD SAFE
+ *
+ * \param   propertyStore       The property store
+ *
+ * \param   indexSize           New number of slots, a power of two
+ *
+ * \return  ErrorCode
+ */
+static EnsoErrorCode_e prv_ResizeIndices(
+        EnsoPropertyStore_t* propertyStore,
+        const uint32_t indexSize)
+{
+    EnsoIndex_t* agentSideIdIndex = OSAL_MemoryRequest(NULL, indexSize * sizeof(EnsoIndex_t));
+    EnsoIndex_t* cloudNameIndex = OSAL_MemoryRequest(NULL, indexSize * sizeof(EnsoIndex_t));
+    if (!agentSideIdIndex || !cloudNameIndex)
+    {
+        LOG_Error("Unable to allocate property index of %u slots", indexSize);
+        OSAL_Free(agentSideIdIndex);
+        OSAL_Free(cloudNameIndex);
+        return eecPoolFull;
+    }
+
+    /* INDEX_SLOT_EMPTY is all ones */
+    memset(agentSideIdIndex, 0xFF, indexSize * sizeof(EnsoIndex_t));
+    memset(cloudNameIndex, 0xFF, indexSize * sizeof(EnsoIndex_t));
+
+    OSAL_Free(propertyStore->agentSideIdIndex);
+    OSAL_Free(propertyStore->cloudNameIndex);
+    propertyStore->agentSideIdIndex = agentSideIdIndex;
+    propertyStore->cloudNameIndex = cloudNameIndex;
+    propertyStore->indexMask = indexSize - 1;
+
+    int capacity = propertyStore->numChunks * LSD_PROPERTY_CHUNK_SIZE;
+    for (EnsoIndex_t i = 0; i < capacity; i++)
+    {
+        EnsoPropertyContainer_t* container = PROPERTY_CONTAINER(propertyStore, i);
+        if (container->owner)
+        {
+            prv_IndexInsert(propertyStore, propertyStore->agentSideIdIndex,
+                            prv_AgentSideIdHome(propertyStore, i), i);
+            if (container->property.cloudName[0])
+            {
+                prv_IndexInsert(propertyStore, propertyStore->cloudNameIndex,
+                                prv_CloudNameHome(propertyStore, i), i);
+            }
+        }
+    }
+
+    return eecNoError;
+}
+
+/**
+ * \name    prv_GrowPropertyPool
+ *
+ * \brief   Adds a chunk of free containers to the property pool, enlarging
+ *          the lookup indices first if they would become too full.
+ *
+ * NOT THREAD SAFE
+ *
+ * \param   propertyStore       The property store
+ *
+ * \return  eecPoolFull if the pool is at its maximum size or out of memory
+ */
+static EnsoErrorCode_e prv_GrowPropertyPool(EnsoPropertyStore_t* propertyStore)
+{
+    if (propertyStore->numChunks >= LSD_PROPERTY_MAX_CHUNKS)
+    {
+        return eecPoolFull;
+    }
+
+    int base = propertyStore->numChunks * LSD_PROPERTY_CHUNK_SIZE;
+    uint32_t indexSize = propertyStore->indexMask + 1;
+    if (!propertyStore->agentSideIdIndex)
+    {
+        indexSize = 1;
+    }
+    if (indexSize < 2 * (base + LSD_PROPERTY_CHUNK_SIZE))
+    {
+        while (indexSize < 2 * (base + LSD_PROPERTY_CHUNK_SIZE))
+        {
+            indexSize <<= 1;
+        }
+        EnsoErrorCode_e retVal = prv_ResizeIndices(propertyStore, indexSize);
+        if (eecNoError != retVal)
+        {
+            return retVal;
+        }
+    }
+
+    EnsoPropertyContainer_t* chunk = OSAL_MemoryRequest(NULL, LSD_PROPERTY_CHUNK_SIZE * sizeof(EnsoPropertyContainer_t));
+    if (!chunk)
+    {
+        LOG_Error("Unable to allocate property chunk");
+        return eecPoolFull;
+    }
+    memset(chunk, 0, LSD_PROPERTY_CHUNK_SIZE * sizeof(EnsoPropertyContainer_t));
+
+    /* Thread the new containers onto the front of the free list */
+    for (int i = 0; i < LSD_PROPERTY_CHUNK_SIZE - 1; i++)
+    {
+        chunk[i].nextContainerIndex = base + i + 1;
+    }
+    chunk[LSD_PROPERTY_CHUNK_SIZE - 1].nextContainerIndex = propertyStore->firstFreeProperty;
+    propertyStore->propertyChunks[propertyStore->numChunks++] = chunk;
+    propertyStore->firstFreeProperty = base;
+
+    if (base)
+    {
+        LOG_Info("Property pool grown to %d", base + LSD_PROPERTY_CHUNK_SIZE);
+    }
+    return eecNoError;
+}
+
 /**
  * \name    prv_InitialisePropertyStore
  *
@@ -180,44 +607,34 @@ LSD_STATIC EnsoErrorCode_e prv_GetPropertyIndexByCloudName(
  *  */
 LSD_STATIC EnsoErrorCode_e prv_InitialisePropertyStore(EnsoPropertyStore_t* propertyStore)
 {
-    int i, propertyGroup;
+    int i;
 
     if (NULL == propertyStore)
     {
         LOG_Error("null pointer input param");
+        return eecNullPointerSupplied;
+    }
+
+    /* Release anything left from a previous initialisation */
+    for (i = 0; i < propertyStore->numChunks; i++)
+    {
+        OSAL_Free(propertyStore->propertyChunks[i]);
     }
+    OSAL_Free(propertyStore->agentSideIdIndex);
+    OSAL_Free(propertyStore->cloudNameIndex);
 
     memset(propertyStore, 0, sizeof(EnsoPropertyStore_t));
 
-    propertyStore->firstFreeProperty = 0;
+    propertyStore->firstFreeProperty = -1;
 
-    for (i = 0; i < LSD_PROPERTY_POOL_SIZE; i++)
+    EnsoErrorCode_e retVal = eecNoError;
+    while ((eecNoError == retVal) &&
+           (propertyStore->numChunks * LSD_PROPERTY_CHUNK_SIZE < LSD_PROPERTY_POOL_SIZE))
     {
-        propertyStore->propertyPool[i].property.agentSidePropertyID = 0;
-        propertyStore->propertyPool[i].property.cloudName[0] = 0;
-        propertyStore->propertyPool[i].property.desiredValue.int32Value = 0;
-        propertyStore->propertyPool[i].property.reportedValue.int32Value = 0;
-        for (propertyGroup = 0; propertyGroup < PROPERTY_GROUP_MAX; propertyGroup++)
-        {
-            propertyStore->propertyPool[i].property.subscriptionBitmap[propertyGroup] = 0;
-        }
-        /* Now undefine freed element and put back into the free list */
-        switch (propertyStore->propertyPool[i].property.type.valueType)
-        {
-        case evBlobHandle:
-            propertyStore->propertyPool[i].property.desiredValue.memoryHandle = NULL;
-            propertyStore->propertyPool[i].property.reportedValue.memoryHandle = NULL;
-            break;
-
-        default:
-            break;
-        }
-        propertyStore->propertyPool[i].nextContainerIndex = i + 1;
+        retVal = prv_GrowPropertyPool(propertyStore);
     }
 
-    propertyStore->propertyPool[LSD_PROPERTY_POOL_SIZE - 1].nextContainerIndex = -1;
-
-    return eecNoError;
+    return retVal;
 }
 
 /**
@@ -324,13 +741,14 @@ LSD_STATIC EnsoErrorCode_e prv_CreateProperty(
         // Is a cloud name provided ?
         if (strlen(cloudSideId))
         {
-            EnsoProperty_t * theProperty = &(propertyStore->propertyPool[index].property);
+            EnsoProperty_t * theProperty = &(PROPERTY_CONTAINER(propertyStore, index)->property);
             if (strlen(theProperty->cloudName) == 0)
             {
                 LOG_Info(LOG_GREEN "Setting cloudName %s for prop id %x", cloudSideId, agentSideId);
                 // The cloud name is empty so this property must have been populated from persistent
                 // storage at startup. Set the cloud name.
                 strncpy(theProperty->cloudName, cloudSideId, LSD_PROPERTY_NAME_BUFFER_SIZE);
+                prv_IndexCloudName(propertyStore, index);
             }
         }
         return eecPropertyNotCreatedDuplicateClientId;
@@ -341,6 +759,10 @@ LSD_STATIC EnsoErrorCode_e prv_CreateProperty(
     }
 
     EnsoErrorCode_e retVal = eecNoError;
+    if (propertyStore->firstFreeProperty < 0)
+    {
+        prv_GrowPropertyPool(propertyStore);
+    }
     int new_prop_index = propertyStore->firstFreeProperty;
     int old_first_index = owner->propertyListStart;
 
@@ -349,9 +771,9 @@ LSD_STATIC EnsoErrorCode_e prv_CreateProperty(
         /* Move firstFreeProperty onto the next item in the property list
          * it doesn't matter if it's an end of list as that will still
          * count as a valid value. */
-        propertyStore->firstFreeProperty = propertyStore->propertyPool[new_prop_index].nextContainerIndex;
+        propertyStore->firstFreeProperty = PROPERTY_CONTAINER(propertyStore, new_prop_index)->nextContainerIndex;
 
-        EnsoProperty_t * theProperty = &(propertyStore->propertyPool[new_prop_index].property);
+        EnsoProperty_t * theProperty = &(PROPERTY_CONTAINER(propertyStore, new_prop_index)->property);
         memset(theProperty, 0, sizeof(EnsoProperty_t));
 
         theProperty->type.kind = kind;
@@ -370,20 +792,17 @@ LSD_STATIC EnsoErrorCode_e prv_CreateProperty(
             theProperty->reportedValue = groupValues[REPORTED_GROUP];
         }
         strncpy(theProperty->cloudName, cloudSideId, LSD_PROPERTY_NAME_BUFFER_SIZE);
-        propertyStore->propertyPool[new_prop_index].nextContainerIndex = old_first_index;
+        PROPERTY_CONTAINER(propertyStore, new_prop_index)->nextContainerIndex = old_first_index;
+        PROPERTY_CONTAINER(propertyStore, new_prop_index)->owner = owner;
         owner->propertyListStart = new_prop_index;
+        prv_IndexInsert(propertyStore, propertyStore->agentSideIdIndex,
+                        prv_AgentSideIdHome(propertyStore, new_prop_index),
+                        new_prop_index);
+        prv_IndexCloudName(propertyStore, new_prop_index);
         if (kind == PROPERTY_PUBLIC)
         {
             // By definition they will be out of sync when created and public
-            theProperty->type.desiredOutOfSync = false;
-            theProperty->type.reportedOutOfSync = true;
-            owner->desiredOutOfSync = false;
-            owner->reportedOutOfSync = true;
-        }
-        else
-        {
-            theProperty->type.desiredOutOfSync = false;
-            theProperty->type.reportedOutOfSync = false;
+            prv_SetOutOfSync(propertyStore, owner, new_prop_index, REPORTED_GROUP, true);
         }
 
         retVal = eecNoError;
@@ -440,7 +859,7 @@ EnsoErrorCode_e LSD_RemoveProperty_Safe(
         int prevIndex = -1 ;
         while ( (i >= 0) &&  (eecPropertyNotFound == retVal) )
         {
-            EnsoProperty_t * property = &prv_PropertyStore.propertyPool[i].property;
+            EnsoProperty_t * property = &PROPERTY_CONTAINER(&prv_PropertyStore, i)->property;
             if ( removeFirstProperty ||
                  ((cloudName   && (0 == strcmp(property->cloudName, cloudName))) ||
                   (agentSideId && (agentSideId == property->agentSidePropertyID))) )
@@ -456,15 +875,19 @@ EnsoErrorCode_e LSD_RemoveProperty_Safe(
 
                 isPublic = (property->type.kind == PROPERTY_PUBLIC);
 
-                if (prevIndex > 0)
+                // Drop it from the out-of-sync lists before it is unlinked
+                prv_SetOutOfSync(&prv_PropertyStore, owner, i, REPORTED_GROUP, false);
+                prv_SetOutOfSync(&prv_PropertyStore, owner, i, DESIRED_GROUP, false);
+
+                if (prevIndex >= 0)
                 {
                     // Unlink element
-                    prv_PropertyStore.propertyPool[prevIndex].nextContainerIndex = prv_PropertyStore.propertyPool[i].nextContainerIndex;
+                    PROPERTY_CONTAINER(&prv_PropertyStore, prevIndex)->nextContainerIndex = PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex;
                 }
                 else
                 {
                     // It was the first item in the list
-                    owner->propertyListStart = prv_PropertyStore.propertyPool[i].nextContainerIndex;
+                    owner->propertyListStart = PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex;
                 }
                 /* Now free element and put back into the free list */
                 switch (property->type.valueType)
@@ -486,15 +909,16 @@ EnsoErrorCode_e LSD_RemoveProperty_Safe(
                     default:
                         break;
                 }
+                prv_UnindexProperty(&prv_PropertyStore, i);
                 memset(property, 0, sizeof(EnsoProperty_t));
-                prv_PropertyStore.propertyPool[i].nextContainerIndex = prv_PropertyStore.firstFreeProperty;
+                PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex = prv_PropertyStore.firstFreeProperty;
                 prv_PropertyStore.firstFreeProperty = i;
                 retVal = eecNoError;
                 break; // Exit while loop
             }
 
             prevIndex = i;
-            i = prv_PropertyStore.propertyPool[i].nextContainerIndex;
+            i = PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex;
         }
     }
 
@@ -564,6 +988,15 @@ EnsoErrorCode_e  LSD_RemoveAllPropertiesOfObject_Safe(
         retVal = eecNoError;
     }
 
+    // Nothing the device keeps outside the pool is left to send either
+    OSAL_LockMutex(pLSD_Mutex);
+    EnsoObject_t* owner = LSD_FindEnsoObjectByDeviceIdDirectly(deviceId);
+    if (owner)
+    {
+        LSD_SetExternalOutOfSyncDirectly(owner, false);
+    }
+    OSAL_UnLockMutex(pLSD_Mutex);
+
     return retVal;
 }
 
@@ -599,14 +1032,18 @@ LSD_STATIC EnsoErrorCode_e prv_SetProperty(
     {
         return eecPropertyGroupNotSupported;
     }
+#if VERBOSE_PROPERTY_STORE_DEBUG
     const char * name = property->cloudName;
+#endif
     EnsoPropertyValue_u* ptrValue = LSD_GetPropertyValuePtrFromGroupDirectly(property, group);
     if (!ptrValue)
     {
         return eecInternalError;
     }
     bool changed = true;
+#if VERBOSE_PROPERTY_STORE_DEBUG
     char * gstr = LSD_Group2s(group);
+#endif
     switch (property->type.valueType)
     {
     case evInt32:
@@ -782,12 +1219,44 @@ EnsoErrorCode_e LSD_SetPropertyOutOfSyncDirectly(
         const EnsoDeviceId_t* deviceId,
         const char* propName,
         const PropertyGroup_e propertyGroup)
+{
+    return LSD_SetPropertyOutOfSyncStateDirectly(deviceId, propName, propertyGroup, true);
+}
+
+/**
+ * \name    LSD_SetPropertyOutOfSyncStateDirectly
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief   Set or clear the out-of-sync flag for a property group of a
+ *          property. Only public properties can be set out of sync.
+ *
+ * \param   deviceId        The owner that the property belongs to
+ *
+ * \param   propName        The property to modify
+ *
+ * \param   propertyGroup   The property group
+ *
+ * \param   outOfSync       The new state of the flag
+ *
+ * \return                  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_SetPropertyOutOfSyncStateDirectly(
+        const EnsoDeviceId_t* deviceId,
+        const char* propName,
+        const PropertyGroup_e propertyGroup,
+        const bool outOfSync)
 {
     if (!propName || !deviceId)
     {
         LOG_Error("null pointer input param");
         return eecNullPointerSupplied;
     }
+    if ((DESIRED_GROUP != propertyGroup) && (REPORTED_GROUP != propertyGroup))
+    {
+        assert(0);
+        return eecPropertyGroupNotSupported;
+    }
 
     EnsoObject_t* owner = LSD_FindEnsoObjectByDeviceIdDirectly(deviceId);
     if (!owner)
@@ -795,40 +1264,111 @@ EnsoErrorCode_e LSD_SetPropertyOutOfSyncDirectly(
         return eecEnsoObjectNotFound;
     }
 
-    EnsoProperty_t* property;
-    property = LSD_FindPropertyByCloudSideIdDirectly(owner, propName );
-    if (!property)
+    int propertyIndex;
+    if (eecNoError != prv_GetPropertyIndexByCloudName(&prv_PropertyStore, owner, propName, &propertyIndex))
     {
         return eecPropertyNotFound;
     }
 
-    if (PROPERTY_PRIVATE == property->type.kind)
+    if (outOfSync &&
+        (PROPERTY_PRIVATE == PROPERTY_CONTAINER(&prv_PropertyStore, propertyIndex)->property.type.kind))
     {
         return eecPropertyWrongType;
     }
 
-    EnsoErrorCode_e retVal = eecNoError;
-    switch (propertyGroup)
+    prv_SetOutOfSync(&prv_PropertyStore, owner, propertyIndex, propertyGroup, outOfSync);
+
+    return eecNoError;
+}
+
+/**
+ * \name    LSD_GetNumberOfOutOfSyncPropertiesDirectly
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief   Number of properties of all objects that are out of sync for a
+ *          property group, periodic sync passes can stop early on zero
+ *
+ * \param   propertyGroup   The property group
+ *
+ * \return                  The number of out-of-sync properties
+ */
+uint32_t LSD_GetNumberOfOutOfSyncPropertiesDirectly(
+        const PropertyGroup_e propertyGroup)
+{
+    if ((propertyGroup < 0) || (propertyGroup >= PROPERTY_GROUP_MAX))
     {
-        case DESIRED_GROUP:
-            property->type.desiredOutOfSync = true;
-            // Set the owner as out-of-sync as well.
-            owner->desiredOutOfSync = true;
-            break;
+        return 0;
+    }
+    return prv_PropertyStore.numOutOfSync[propertyGroup];
+}
 
-        case REPORTED_GROUP:
-            property->type.reportedOutOfSync = true;
-            // Set the owner as out-of-sync as well.
-            owner->reportedOutOfSync = true;
-            break;
 
-        default:
-            assert(0);
-            retVal = eecPropertyGroupNotSupported;
-            break;
+/**
+ * \name    LSD_SetExternalOutOfSyncDirectly
+ *
+ * NOT THREAD SAFE
+ *
+ * \brief   Mark the properties an object keeps outside the property pool as
+ *          out of sync with the cloud, or not. A marked object counts as one
+ *          out-of-sync reported property so sync passes don't stop early.
+ *
+ * \param   owner           The object
+ *
+ * \param   outOfSync       true to mark it
+ */
+void LSD_SetExternalOutOfSyncDirectly(
+        EnsoObject_t* owner,
+        const bool outOfSync)
+{
+    if (!owner || owner->externalOutOfSync == outOfSync)
+    {
+        return;
     }
 
-    return retVal;
+    owner->externalOutOfSync = outOfSync;
+    if (outOfSync)
+    {
+        prv_PropertyStore.numOutOfSync[REPORTED_GROUP]++;
+    }
+    else
+    {
+        prv_PropertyStore.numOutOfSync[REPORTED_GROUP]--;
+    }
+}
+
+
+/**
+ * \name    LSD_TakeExternalOutOfSync_Safe
+ *
+ * \brief   Clear the out-of-sync mark of the properties an object keeps
+ *          outside the property pool, the caller is then going to send them.
+ *
+ * \param   owner           The object
+ *
+ * \param[out] deviceId     The device ID of the object, if it was marked
+ *
+ * \return                  true if the object was marked
+ */
+bool LSD_TakeExternalOutOfSync_Safe(
+        EnsoObject_t* owner,
+        EnsoDeviceId_t* deviceId)
+{
+    if (!owner || !deviceId)
+    {
+        return false;
+    }
+
+    OSAL_LockMutex(pLSD_Mutex);
+    bool outOfSync = owner->externalOutOfSync;
+    if (outOfSync)
+    {
+        *deviceId = owner->deviceId;
+        LSD_SetExternalOutOfSyncDirectly(owner, false);
+    }
+    OSAL_UnLockMutex(pLSD_Mutex);
+
+    return outOfSync;
 }
 
 
@@ -885,6 +1425,90 @@ EnsoErrorCode_e LSD_CreatePropertyDirectly(
 }
 
 
+/**
+ * \name LSD_RestorePropertyDirectly
+ *
+ * \brief Restore a property read back from storage at start-up: both group
+ * values and the out-of-sync flags are set in one go, the property is
+ * created first if the owner does not have it. Blobs are handed over to the
+ * property rather than copied, unless an existing property has another
+ * value type.
+ *
+ * NOT THREAD SAFE
+ *
+ * \param   owner                       The ensoObject the property belongs to
+ *
+ * \param   agentSideId                 The property ID as seen on the agent side
+ *
+ * \param   cloudSideId                 The cloud name, used if it is created
+ *
+ * \param   propType                    The property type and out-of-sync flags
+ *
+ * \param   groupValues                 The desired and reported values
+ *
+ * \param[out] property                 The property restored
+ *
+ * \return                              A negative number denotes an error
+ *                                      code.
+ */
+EnsoErrorCode_e LSD_RestorePropertyDirectly(
+        EnsoObject_t* owner,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        const char* cloudSideId,
+        const EnsoPropertyType_t propType,
+        const EnsoPropertyValue_u* groupValues,
+        EnsoProperty_t** property)
+{
+    if (!owner || !cloudSideId || !groupValues || !property)
+    {
+        LOG_Error("null pointer input param");
+        return eecNullPointerSupplied;
+    }
+
+    int propertyIndex;
+    if (eecNoError != prv_GetPropertyIndexByClientSideId(&prv_PropertyStore, owner, agentSideId, &propertyIndex))
+    {
+        // Created empty, the values are set below as for an existing one
+        EnsoPropertyValue_u emptyValues[PROPERTY_GROUP_MAX];
+        memset(emptyValues, 0, sizeof(emptyValues));
+        EnsoErrorCode_e retVal = prv_CreateProperty(&prv_PropertyStore, owner, agentSideId, cloudSideId,
+                propType.valueType, propType.kind, propType.buffered, propType.persistent, emptyValues);
+        if (retVal < 0)
+        {
+            return retVal;
+        }
+        // A new property heads the owner's list
+        propertyIndex = owner->propertyListStart;
+    }
+
+    EnsoProperty_t* theProperty = &PROPERTY_CONTAINER(&prv_PropertyStore, propertyIndex)->property;
+    if (theProperty->type.valueType != propType.valueType)
+    {
+        // The values are not handed over
+        LOG_Error("Property %x is not of type %d", agentSideId, propType.valueType);
+        return eecParameterOutOfRange;
+    }
+    for (int group = 0; group < PROPERTY_GROUP_MAX; group++)
+    {
+        EnsoErrorCode_e retVal = prv_SetProperty(theProperty, group, groupValues[group]);
+        if ((retVal < 0) && (eecNoChange != retVal))
+        {
+            return retVal;
+        }
+    }
+
+    // Only public properties can be out of sync
+    bool isPublic = (PROPERTY_PUBLIC == theProperty->type.kind);
+    prv_SetOutOfSync(&prv_PropertyStore, owner, propertyIndex, REPORTED_GROUP,
+            isPublic && propType.reportedOutOfSync);
+    prv_SetOutOfSync(&prv_PropertyStore, owner, propertyIndex, DESIRED_GROUP,
+            isPublic && propType.desiredOutOfSync);
+
+    *property = theProperty;
+    return eecNoError;
+}
+
+
 /**
  * \name LSD_FindPropertyByAgentSideIdDirectly
  *
@@ -929,9 +1553,9 @@ EnsoProperty_t* LSD_FindPropertyByAgentSideIdDirectly(
 
     if ((eecNoError == retVal) &&
         (propertyIndex >= 0) &&
-        (propertyIndex < LSD_PROPERTY_POOL_SIZE))
+        (propertyIndex < prv_PropertyStore.numChunks * LSD_PROPERTY_CHUNK_SIZE))
     {
-        theProperty = &(prv_PropertyStore.propertyPool[propertyIndex].property);
+        theProperty = &(PROPERTY_CONTAINER(&prv_PropertyStore, propertyIndex)->property);
     }
 
     return theProperty;
@@ -974,11 +1598,12 @@ EnsoErrorCode_e LSD_SetPropertyValueByAgentSideIdDirectly(
         return eecNullPointerSupplied;
     }
 
-    EnsoProperty_t* theProperty = LSD_FindPropertyByAgentSideIdDirectly(owner, agentSideId);
-    if (!theProperty)
+    int propertyIndex;
+    if (eecNoError != prv_GetPropertyIndexByClientSideId(&prv_PropertyStore, owner, agentSideId, &propertyIndex))
     {
         return eecPropertyNotFound;
     }
+    EnsoProperty_t* theProperty = &PROPERTY_CONTAINER(&prv_PropertyStore, propertyIndex)->property;
 
     EnsoErrorCode_e retVal = prv_SetProperty(theProperty, propertyGroup, newValue);
 
@@ -987,19 +1612,10 @@ EnsoErrorCode_e LSD_SetPropertyValueByAgentSideIdDirectly(
         // Only public properties must be synced.
         if (PROPERTY_PUBLIC == theProperty->type.kind)
         {
-            if (propertyGroup == DESIRED_GROUP)
-            {
-                theProperty->type.desiredOutOfSync = true;
-                owner->desiredOutOfSync = true;
-            }
-            else
-            {
 #if VERBOSE_PROPERTY_STORE_DEBUG
-                LOG_Trace("Setting reported Out of Sync");
+            LOG_Trace("Setting %s Out of Sync", LSD_Group2s(propertyGroup));
 #endif
-                theProperty->type.reportedOutOfSync = true;
-                owner->reportedOutOfSync = true;
-            }
+            prv_SetOutOfSync(&prv_PropertyStore, owner, propertyIndex, propertyGroup, true);
         }
     }
 
@@ -1125,29 +1741,29 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
 
     if (LSD_IsEnsoDeviceIdValid(owner->deviceId))
     {
-        int i = owner->propertyListStart;
+        // Out-of-sync properties have a list of their own
+        int i = (PROPERTY_FILTER_OUT_OF_SYNC == filter) ?
+                owner->outOfSyncListStart[propertyGroup] : owner->propertyListStart;
 
         while ((*numMessages < maxMessages) && (i >= 0))
         {
+            // Step first, clearing the flag below unlinks the property
+            int next = (PROPERTY_FILTER_OUT_OF_SYNC == filter) ?
+                    PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextOutOfSyncIndex[propertyGroup] :
+                    PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex;
+
             // Set the property condition based on the filter
             bool propCond = false;
             switch (filter)
             {
                 case PROPERTY_FILTER_OUT_OF_SYNC:
-                    if (REPORTED_GROUP == propertyGroup)
-                    {
-                        propCond = prv_PropertyStore.propertyPool[i].property.type.reportedOutOfSync;
-                    }
-                    else
-                    {
-                        propCond = prv_PropertyStore.propertyPool[i].property.type.desiredOutOfSync;
-                    }
+                    propCond = true;
                     break;
                 case PROPERTY_FILTER_PERSISTENT:
-                    propCond = prv_PropertyStore.propertyPool[i].property.type.persistent;
+                    propCond = PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.type.persistent;
                     break;
                 case PROPERTY_FILTER_TIMESTAMPS:
-                    propCond = prv_PropertyStore.propertyPool[i].property.type.valueType == evTimestamp;
+                    propCond = PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.type.valueType == evTimestamp;
                     break;
                 case PROPERTY_FILTER_ALL:
                     propCond = true;
@@ -1162,12 +1778,12 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
                 case REPORTED_GROUP:
                     if (propCond)
                     {
-                        propertyDelta[currentDelta].agentSidePropertyID = prv_PropertyStore.propertyPool[i].property.agentSidePropertyID;
-                        propertyDelta[currentDelta].propertyValue = prv_PropertyStore.propertyPool[i].property.reportedValue;
+                        propertyDelta[currentDelta].agentSidePropertyID = PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.agentSidePropertyID;
+                        propertyDelta[currentDelta].propertyValue = PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.reportedValue;
                         if (PROPERTY_FILTER_OUT_OF_SYNC == filter)
                         {
                             // Only feedback from cloud can clear this flag
-                            //prv_PropertyStore.propertyPool[i].property.type.reportedOutOfSync = false;
+                            //PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.type.reportedOutOfSync = false;
                         }
                         currentDelta++;
                     }
@@ -1176,14 +1792,14 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
                 case DESIRED_GROUP:
                     if (propCond)
                     {
-                        propertyDelta[currentDelta].agentSidePropertyID = prv_PropertyStore.propertyPool[i].property.agentSidePropertyID;
-                        propertyDelta[currentDelta].propertyValue = prv_PropertyStore.propertyPool[i].property.desiredValue;
+                        propertyDelta[currentDelta].agentSidePropertyID = PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.agentSidePropertyID;
+                        propertyDelta[currentDelta].propertyValue = PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.desiredValue;
                         if (PROPERTY_FILTER_OUT_OF_SYNC == filter)
                         {
                             // We can send desired at start up if we have them marked as out of sync
                             // but desired properties are not our responsibility. As soon as they
                             // are returned to us we will set the shadow to whatever we receive
-                            prv_PropertyStore.propertyPool[i].property.type.desiredOutOfSync = false;
+                            prv_SetOutOfSync(&prv_PropertyStore, owner, i, DESIRED_GROUP, false);
                         }
                         currentDelta++;
                     }
@@ -1192,7 +1808,7 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
                 default:
                     break;
             }
-            i = prv_PropertyStore.propertyPool[i].nextContainerIndex;
+            i = next;
 
             // Send an update message to the destination handler
             if (currentDelta >= ECOM_MAX_DELTAS)
@@ -1214,45 +1830,6 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
             }
         }
 
-        // Go through list of properties to see if owner is in sync now
-        int j = owner->propertyListStart;
-        if (PROPERTY_FILTER_OUT_OF_SYNC == filter)
-        {
-            // Check if the object is now in sync
-            switch (propertyGroup)
-            {
-                case REPORTED_GROUP:
-                    owner->reportedOutOfSync = false;
-
-                    while (j >= 0)
-                    {
-                        if (prv_PropertyStore.propertyPool[j].property.type.reportedOutOfSync)
-                        {
-                            owner->reportedOutOfSync = true;
-                            break;
-                        }
-                        j = prv_PropertyStore.propertyPool[j].nextContainerIndex;
-                    }
-                    break;
-
-                case DESIRED_GROUP:
-                    owner->desiredOutOfSync = false;
-                    // Start i where we left of
-                    while (j >= 0)
-                    {
-                        if (prv_PropertyStore.propertyPool[j].property.type.desiredOutOfSync)
-                        {
-                            owner->desiredOutOfSync = true;
-                            break;
-                        }
-                        j = prv_PropertyStore.propertyPool[j].nextContainerIndex;
-                    }
-                    break;
-
-                default:
-                    break;
-            }
-        }
     } // End of LSD_IsEnsoDeviceIdValid
 
     // Unlock local shadow
@@ -1278,6 +1855,105 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
     return retVal;
 }
 
+/**
+ * \brief   Copy the properties of an object which meet the filter condition,
+ *          in list order. Blob values are copied too, the copies belong to
+ *          the caller and are released with OSAL_Free().
+ *
+ * NOT THREAD SAFE
+ *
+ * \param   owner           Object to filter
+ *
+ * \param   filter          Persistent only or all properties
+ *
+ * \param[out] buffer       Buffer receiving the properties
+ *
+ * \param   bufferElems     Maximum number of elements of the buffer array
+ *
+ * \param[out] numProperties Number of properties copied. When the buffer is
+ *                          too small nothing is copied and this is the
+ *                          number of elements needed.
+ *
+ * \return                  EnsoErrorCode_e
+ */
+EnsoErrorCode_e LSD_GetPropertiesByFilterDirectly(
+        const EnsoObject_t* owner,
+        const PropertyFilter_e filter,
+        EnsoProperty_t* buffer,
+        const uint16_t bufferElems,
+        uint16_t* numProperties)
+{
+    /* Sanity checks */
+    if (!owner || !buffer || !numProperties)
+    {
+        LOG_Error("null pointer input param");
+        return eecNullPointerSupplied;
+    }
+    if (filter != PROPERTY_FILTER_PERSISTENT && filter != PROPERTY_FILTER_ALL)
+    {
+        return eecParameterOutOfRange;
+    }
+
+    *numProperties = 0;
+    for (int i = owner->propertyListStart; i >= 0; i = PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex)
+    {
+        if (filter == PROPERTY_FILTER_ALL || PROPERTY_CONTAINER(&prv_PropertyStore, i)->property.type.persistent)
+        {
+            (*numProperties)++;
+        }
+    }
+    if (*numProperties > bufferElems)
+    {
+        return eecBufferTooSmall;
+    }
+
+    uint16_t n = 0;
+    for (int i = owner->propertyListStart; i >= 0; i = PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex)
+    {
+        const EnsoProperty_t* property = &PROPERTY_CONTAINER(&prv_PropertyStore, i)->property;
+        if (filter != PROPERTY_FILTER_ALL && !property->type.persistent)
+        {
+            continue;
+        }
+        buffer[n] = *property;
+        if (property->type.valueType == evBlobHandle)
+        {
+            EnsoPropertyValue_u* values[PROPERTY_GROUP_MAX] = { &buffer[n].desiredValue, &buffer[n].reportedValue };
+            for (int group = 0; group < PROPERTY_GROUP_MAX; group++)
+            {
+                MemoryHandle_t blob = values[group]->memoryHandle;
+                if (blob)
+                {
+                    size_t size = OSAL_GetBlockSize(blob);
+                    values[group]->memoryHandle = OSAL_MemoryRequest(NULL, size);
+                    if (!values[group]->memoryHandle)
+                    {
+                        // Release the copies made so far
+                        if (group == REPORTED_GROUP && buffer[n].desiredValue.memoryHandle)
+                        {
+                            OSAL_Free(buffer[n].desiredValue.memoryHandle);
+                        }
+                        while (n--)
+                        {
+                            if (buffer[n].type.valueType == evBlobHandle)
+                            {
+                                OSAL_Free(buffer[n].desiredValue.memoryHandle);
+                                OSAL_Free(buffer[n].reportedValue.memoryHandle);
+                            }
+                        }
+                        *numProperties = 0;
+                        return eecPoolFull;
+                    }
+                    memcpy(values[group]->memoryHandle, blob, size);
+                }
+            }
+        }
+        n++;
+    }
+
+    return eecNoError;
+}
+
 /**
  * \name LSD_FindPropertyByCloudSideIdDirectly
  *
@@ -1318,9 +1994,9 @@ EnsoProperty_t* LSD_FindPropertyByCloudSideIdDirectly(
 
     if ((eecNoError == retVal) &&
         (propertyIndex >= 0) &&
-        (propertyIndex < LSD_PROPERTY_POOL_SIZE))
+        (propertyIndex < prv_PropertyStore.numChunks * LSD_PROPERTY_CHUNK_SIZE))
     {
-        theProperty = &(prv_PropertyStore.propertyPool[propertyIndex].property);
+        theProperty = &(PROPERTY_CONTAINER(&prv_PropertyStore, propertyIndex)->property);
     }
 
     return theProperty;
@@ -1879,7 +2555,7 @@ void LSD_DumpProperty(EnsoProperty_t * p)
     int repooffs = 0;
     for (int i = 0; i < 32; i++)
     {
-        uint32_t bit = 1 << i;
+        uint32_t bit = 1u << i;
         if (p->subscriptionBitmap[DESIRED_GROUP] & bit)
         {
             HandlerId_e id = LSD_SubscriberArray[DESIRED_GROUP][i].handlerId;
@@ -1913,14 +2589,14 @@ void LSD_DumpProperty(EnsoProperty_t * p)
 
 /**
  * \brief            Dumps the property list staring at index
- * \param index      index in propertyPool of first property.
+ * \param index      pool index of first property.
  */
 void LSD_DumpProperties(int index)
 {
     OSAL_LockMutex(pLSD_Mutex);
-    for (int i = index; i >= 0; i = prv_PropertyStore.propertyPool[i].nextContainerIndex)
+    for (int i = index; i >= 0; i = PROPERTY_CONTAINER(&prv_PropertyStore, i)->nextContainerIndex)
     {
-        LSD_DumpProperty(&prv_PropertyStore.propertyPool[i].property);
+        LSD_DumpProperty(&PROPERTY_CONTAINER(&prv_PropertyStore, i)->property);
     }
     OSAL_UnLockMutex(pLSD_Mutex);
 }
@@ -24,6 +24,17 @@
 
 #define LSD_MAX_TRANSFER_DELTAS (32)
 
+#define LSD_PROPERTY_MAX_CHUNKS (LSD_PROPERTY_POOL_MAX_SIZE / LSD_PROPERTY_CHUNK_SIZE)
+
+#if (LSD_PROPERTY_POOL_SIZE % LSD_PROPERTY_CHUNK_SIZE) != 0 || \
+    (LSD_PROPERTY_POOL_MAX_SIZE % LSD_PROPERTY_CHUNK_SIZE) != 0
+#error "Property pool sizes must be a multiple of LSD_PROPERTY_CHUNK_SIZE"
+#endif
+
+#if LSD_PROPERTY_POOL_MAX_SIZE > INT16_MAX
+#error "LSD_PROPERTY_POOL_MAX_SIZE must fit in an EnsoIndex_t"
+#endif
+
 /*!****************************************************************************
  * Type Definitions
  *****************************************************************************/
@@ -43,6 +54,9 @@ typedef struct EnsoPropertyContainer_tag
 {
     EnsoProperty_t property;
     EnsoIndex_t nextContainerIndex;
+    const EnsoObject_t* owner;          // Object the property belongs to
+    uint32_t cloudNameHash;             // Hash of property.cloudName
+    EnsoIndex_t nextOutOfSyncIndex[PROPERTY_GROUP_MAX]; // Owner's out-of-sync list per group
 } EnsoPropertyContainer_t;
 
 /**
@@ -50,13 +64,34 @@ typedef struct EnsoPropertyContainer_tag
  *
  * \brief This contains the property pool.
  *
+ * The pool is allocated in chunks of LSD_PROPERTY_CHUNK_SIZE containers and
+ * grows a chunk at a time when it runs out. A pool index addresses
+ * propertyChunks[index / LSD_PROPERTY_CHUNK_SIZE].
+ *
+ * The pool is threaded into a linked list per object. Two open addressing
+ * (linear probing) indices map (owner, agentSidePropertyID) and
+ * (owner, cloudName) directly to a pool index so lookups don't have to walk
+ * the list. They hold indexMask + 1 slots, always at least twice the pool
+ * capacity, and are rebuilt when the pool grows. Empty slots hold -1.
+ *
+ * Properties whose reported or desired value is out of sync with the cloud
+ * are also threaded into a list per object and group, so a sync pass only
+ * visits those. numOutOfSync counts them over all objects, and counts each
+ * object whose properties kept outside the pool are out of sync as one more
+ * reported property.
+ *
  * NOT THREAD SAFE
  */
 
 typedef struct EnsoPropertyStore_tag
 {
     EnsoIndex_t firstFreeProperty;
-    EnsoPropertyContainer_t propertyPool[LSD_PROPERTY_POOL_SIZE];
+    uint16_t numChunks;
+    uint32_t indexMask;
+    EnsoPropertyContainer_t* propertyChunks[LSD_PROPERTY_MAX_CHUNKS];
+    EnsoIndex_t* agentSideIdIndex;
+    EnsoIndex_t* cloudNameIndex;
+    uint32_t numOutOfSync[PROPERTY_GROUP_MAX];
 } EnsoPropertyStore_t;
 
 /*!****************************************************************************
@@ -70,6 +105,23 @@ EnsoErrorCode_e LSD_SetPropertyOutOfSyncDirectly(
         const char* propName,
         const PropertyGroup_e propertyGroup);
 
+EnsoErrorCode_e LSD_SetPropertyOutOfSyncStateDirectly(
+        const EnsoDeviceId_t* deviceId,
+        const char* propName,
+        const PropertyGroup_e propertyGroup,
+        const bool outOfSync);
+
+uint32_t LSD_GetNumberOfOutOfSyncPropertiesDirectly(
+        const PropertyGroup_e propertyGroup);
+
+void LSD_SetExternalOutOfSyncDirectly(
+        EnsoObject_t* owner,
+        const bool outOfSync);
+
+bool LSD_TakeExternalOutOfSync_Safe(
+        EnsoObject_t* owner,
+        EnsoDeviceId_t* deviceId);
+
 EnsoErrorCode_e LSD_CreatePropertyDirectly(
         EnsoObject_t* owner,
         const EnsoAgentSidePropertyId_t agentSideId,
@@ -80,6 +132,14 @@ EnsoErrorCode_e LSD_CreatePropertyDirectly(
         const bool persistent,
         const EnsoPropertyValue_u* groupValues);
 
+EnsoErrorCode_e LSD_RestorePropertyDirectly(
+        EnsoObject_t* owner,
+        const EnsoAgentSidePropertyId_t agentSideId,
+        const char* cloudSideId,
+        const EnsoPropertyType_t propType,
+        const EnsoPropertyValue_u* groupValues,
+        EnsoProperty_t** property);
+
 EnsoErrorCode_e LSD_RemoveProperty_Safe(
         const EnsoDeviceId_t* deviceId,
         const bool removeFirstProperty,
@@ -160,6 +220,13 @@ EnsoErrorCode_e LSD_SendPropertiesByFilter_Safe(
         const uint16_t maxDeltas,
         uint16_t* numDeltas);
 
+EnsoErrorCode_e LSD_GetPropertiesByFilterDirectly(
+        const EnsoObject_t* owner,
+        const PropertyFilter_e filter,
+        EnsoProperty_t* buffer,
+        const uint16_t bufferElems,
+        uint16_t* numProperties);
+
 void LSD_DumpProperties(int index);
 
 #endif
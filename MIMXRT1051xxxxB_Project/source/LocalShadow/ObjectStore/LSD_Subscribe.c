@@ -13,6 +13,8 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_LSD
+
 #include <stdio.h>
 #include <string.h>
 
@@ -181,17 +183,7 @@ EnsoErrorCode_e LSD_SubscribeToDevicePropertyByAgentSideIdDirectly(
         EnsoProperty_t* property = LSD_FindPropertyByAgentSideIdDirectly(subjectObject, subjectAgentPropId);
         if (property)
         {
-            if (PROPERTY_PRIVATE == property->type.kind && !isSubscriberPrivate)
-            {
-                LOG_Error("Public subscriber not allowed for private property %x", subjectAgentPropId);
-                retVal = eecPropertyWrongType;
-            }
-            else
-            {
-                SubscriptionBitmap_t* subscriptionBitmap;
-                subscriptionBitmap = &property->subscriptionBitmap[subjectPropertyGroup];
-                retVal = _AddSubscriber(subjectPropertyGroup, subscriptionBitmap, subscriberId, isSubscriberPrivate);
-            }
+            retVal = LSD_SubscribeToPropertyDirectly(property, subjectPropertyGroup, subscriberId, isSubscriberPrivate);
         }
         else
         {
@@ -208,6 +200,47 @@ EnsoErrorCode_e LSD_SubscribeToDevicePropertyByAgentSideIdDirectly(
     return retVal;
 }
 
+/**
+ * \name LSD_SubscribeToPropertyDirectly
+ *
+ * \brief This function is used to subscribe to a property already found, in
+ * a property group.
+ *
+ * \param   property                The property to subscribe to
+ *
+ * \param   subjectPropertyGroup    The group to which the property belongs
+ *
+ * \param   subscriberId            The identifier of the subscriber
+ *
+ * \param   isSubscriberPrivate     Whether the subscriber is private
+ *
+ * \return                          EnsoErrorCode_e
+ *
+ */
+EnsoErrorCode_e LSD_SubscribeToPropertyDirectly(
+        EnsoProperty_t* property,
+        PropertyGroup_e subjectPropertyGroup,
+        const HandlerId_e subscriberId,
+        const bool isSubscriberPrivate)
+{
+    if (!property)
+    {
+        return eecNullPointerSupplied;
+    }
+    if (subjectPropertyGroup >= PROPERTY_GROUP_MAX)
+    {
+        return eecParameterOutOfRange;
+    }
+    if (PROPERTY_PRIVATE == property->type.kind && !isSubscriberPrivate)
+    {
+        LOG_Error("Public subscriber not allowed for private property %x", property->agentSidePropertyID);
+        return eecPropertyWrongType;
+    }
+
+    return _AddSubscriber(subjectPropertyGroup, &property->subscriptionBitmap[subjectPropertyGroup],
+            subscriberId, isSubscriberPrivate);
+}
+
 /**
  * \name LSD_GetSubscriberIdDirectly
  *
@@ -317,7 +350,7 @@ static EnsoErrorCode_e _AddSubscriber(
          * Add the subscriber to the bitmask
          * As it's an OR it doesn't matter if it's already allocated
          */
-        *subscriptionBitmap |= (1 << subscriberBit);
+        *subscriptionBitmap |= (1u << subscriberBit);
     }
     else
     {
@@ -21,9 +21,9 @@
  * Macro Definitions
  *****************************************************************************/
 
-#define IS_BIT_SET(var, pos) ((var) & (1<<(pos)))
-#define SET_BIT(var, pos)    ((var) |= (1 << (pos)))
-#define CLR_BIT(var, pos)    ((var) &= ~((1) << (pos)))
+#define IS_BIT_SET(var, pos) ((var) & (1u << (pos)))
+#define SET_BIT(var, pos)    ((var) |= (1u << (pos)))
+#define CLR_BIT(var, pos)    ((var) &= ~(1u << (pos)))
 
 /*!****************************************************************************
  * Public Functions
@@ -56,6 +56,12 @@ EnsoErrorCode_e LSD_SubscribeToDevicePropertyByAgentSideIdDirectly(
         const HandlerId_e subscriberId,
         const bool isSubscriberPrivate);
 
+EnsoErrorCode_e LSD_SubscribeToPropertyDirectly(
+        EnsoProperty_t* property,
+        PropertyGroup_e subjectPropertyGroup,
+        const HandlerId_e subscriberId,
+        const bool isSubscriberPrivate);
+
 EnsoErrorCode_e LSD_GetSubscriberIdDirectly(
         HandlerId_e* theId,
         bool* isSubscriberPrivate,
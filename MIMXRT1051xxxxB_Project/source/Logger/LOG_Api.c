@@ -30,6 +30,7 @@ LOG_Control_t LOG_Control =
     ////////.mem = false, ///< LOG_MAlloc disabled by default
     .trc = true, ///< LOG_Trace disabled by default
     .mem = false, ///< LOG_MAlloc disabled by default
+    .modules = (1u << LOG_MODULE_MAX) - 1, ///< All modules enabled by default
 };
 
 
@@ -137,3 +138,29 @@ bool LOG_EnableMalloc(bool enable)
     return mem;
 }
 
+/**
+ * \brief   Enable/Disable output from one module
+ *
+ * \param   module - the module
+ * \param   enable - true enables output from the module
+ *
+ * \return  bool - true if output from the module was enabled
+ *
+ */
+bool LOG_EnableModule(LOG_Module_e module, bool enable)
+{
+    if (module >= LOG_MODULE_MAX)
+    {
+        return false;
+    }
+    bool enabled = (LOG_Control.modules & (1u << module)) != 0;
+    if (enable)
+    {
+        LOG_Control.modules |= 1u << module;
+    }
+    else
+    {
+        LOG_Control.modules &= ~(1u << module);
+    }
+    return enabled;
+}
@@ -17,6 +17,37 @@
 #include <stdbool.h>
 #include "OSAL_Api.h"
 
+// Deferred logging: call sites only record the address of the format string
+// and the raw arguments, the text is rebuilt off target by LOG_Decode.py
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 0
+#endif
+
+typedef enum
+{
+    LOG_LEVEL_ERR,
+    LOG_LEVEL_WAR,
+    LOG_LEVEL_INF,
+    LOG_LEVEL_TRC,
+    LOG_LEVEL_MEM,
+} LOG_Level_e;
+
+typedef enum
+{
+    LOG_MODULE_GENERAL,
+    LOG_MODULE_AWS,
+    LOG_MODULE_LSD,
+    LOG_MODULE_WISAFE,
+    LOG_MODULE_STO,
+    LOG_MODULE_ECOM,
+    LOG_MODULE_MAX
+} LOG_Module_e;
+
+// Source files that belong to a module define LOG_MODULE before any include
+#ifndef LOG_MODULE
+#define LOG_MODULE LOG_MODULE_GENERAL
+#endif
+
 typedef struct
 {
     bool err;
@@ -24,6 +55,7 @@ typedef struct
     bool inf;
     bool trc;
     bool mem;
+    uint32_t modules;   // Bit n set if LOG_Module_e n is enabled
 } LOG_Control_t;
 
 extern LOG_Control_t LOG_Control;
@@ -36,10 +68,19 @@ bool LOG_EnableWarning(bool enable);
 bool LOG_EnableInfo(bool enable);
 bool LOG_EnableTrace(bool enable);
 bool LOG_EnableMalloc(bool enable);
+bool LOG_EnableModule(LOG_Module_e module, bool enable);
+
+#define LOG_ENABLED(level) (LOG_Control.level && (LOG_Control.modules & (1u << (LOG_MODULE))))
 
-#define LOG_(type, fmt, ...) do { uint32_t ms = OSAL_time_ms(); \
-                                  OSAL_Log("%5d.%03d " type " %s: " fmt "\n", ms / 1000, ms % 1000, __func__ , ## __VA_ARGS__); \
-                             } while (0);
+#if LOG_DEFERRED
+#define LOG_(level, type, fmt, ...) do { static const char _logFormat[] __attribute__((section(".log_fmt"), used)) = fmt; \
+                                         OSAL_LogDeferred(level, __func__, _logFormat, ## __VA_ARGS__); \
+                                    } while (0);
+#else
+#define LOG_(level, type, fmt, ...) do { uint32_t ms = OSAL_time_ms(); \
+                                         OSAL_Log("%5d.%03d " type " %s: " fmt "\n", ms / 1000, ms % 1000, __func__ , ## __VA_ARGS__); \
+                                    } while (0);
+#endif
 
 #define LOG_NONE     "\033[00m"
 #define LOG_RED      "\033[22;31m"
@@ -51,24 +92,24 @@ bool LOG_EnableMalloc(bool enable);
 #define LOG_CYAN     "\033[01;36m"
 
 // Warning logging
-#define LOG_Warning(fmt, ...) /*if (LOG_Control.war)*/ if (true) LOG_("WAR", LOG_LIGHTRED fmt LOG_NONE, ## __VA_ARGS__)
-#define LOG_WarningC(fmt, ...) /*if (LOG_Control.war)*/ if (true) LOG_("WAR", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_Warning(fmt, ...) if (LOG_ENABLED(war)) LOG_(LOG_LEVEL_WAR, "WAR", LOG_LIGHTRED fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_WarningC(fmt, ...) if (LOG_ENABLED(war)) LOG_(LOG_LEVEL_WAR, "WAR", fmt LOG_NONE, ## __VA_ARGS__)
 
 // Error logging
-#define LOG_Error(fmt, ...) /*if (LOG_Control.err)*/ if (true) LOG_("ERR", LOG_RED fmt LOG_NONE, ## __VA_ARGS__)
-#define LOG_ErrorC(fmt, ...) /*if (LOG_Control.err)*/ if (true) LOG_("ERR", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_Error(fmt, ...) if (LOG_ENABLED(err)) LOG_(LOG_LEVEL_ERR, "ERR", LOG_RED fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_ErrorC(fmt, ...) if (LOG_ENABLED(err)) LOG_(LOG_LEVEL_ERR, "ERR", fmt LOG_NONE, ## __VA_ARGS__)
 
 // Info logging
-#define LOG_Info(fmt, ...) /*if (LOG_Control.inf)*/ if (true) LOG_("INF", fmt LOG_NONE, ## __VA_ARGS__)
-#define LOG_InfoC(fmt, ...) /*if (LOG_Control.inf)*/ if (true) LOG_("INF", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_Info(fmt, ...) if (LOG_ENABLED(inf)) LOG_(LOG_LEVEL_INF, "INF", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_InfoC(fmt, ...) if (LOG_ENABLED(inf)) LOG_(LOG_LEVEL_INF, "INF", fmt LOG_NONE, ## __VA_ARGS__)
 
 // Trace logging
-#define LOG_Trace(fmt, ...) /*if (LOG_Control.trc)*/ if (true) LOG_("TRC", fmt LOG_NONE, ## __VA_ARGS__)
-#define LOG_TraceC(fmt, ...) /*if (LOG_Control.trc)*/ if (true) LOG_("TRC", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_Trace(fmt, ...) if (LOG_ENABLED(trc)) LOG_(LOG_LEVEL_TRC, "TRC", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_TraceC(fmt, ...) if (LOG_ENABLED(trc)) LOG_(LOG_LEVEL_TRC, "TRC", fmt LOG_NONE, ## __VA_ARGS__)
 
 // Malloc/free logging
-#define LOG_Malloc(fmt, ...) /*if (LOG_Control.mem)*/ if (false) LOG_("MEM", fmt LOG_NONE, ## __VA_ARGS__)
-#define LOG_MallocC(fmt, ...) /*if (LOG_Control.mem)*/ if (false) LOG_("MEM", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_Malloc(fmt, ...) /*if (LOG_Control.mem)*/ if (false) LOG_(LOG_LEVEL_MEM, "MEM", fmt LOG_NONE, ## __VA_ARGS__)
+#define LOG_MallocC(fmt, ...) /*if (LOG_Control.mem)*/ if (false) LOG_(LOG_LEVEL_MEM, "MEM", fmt LOG_NONE, ## __VA_ARGS__)
 
 
 
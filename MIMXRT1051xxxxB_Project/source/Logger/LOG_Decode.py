@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+#
+# LOG_Decode.py
+#
+# Rebuilds the text of a deferred log (firmware built with LOG_DEFERRED=1).
+#
+# The firmware writes each log call as a binary record framed by 0xFE 0xED,
+# see OSAL_LogDeferred.c. The record only holds the addresses of the format
+# string and of the function name, both are looked up in the ELF image the
+# firmware was built from. Bytes outside records (output of OSAL_printf and
+# friends) are passed through unchanged.
+#
+# Usage: LOG_Decode.py <firmware.axf> [capture | serial device]
+#        reads standard input when no capture is given
+#
+# Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+# Unauthorized copying of this file, via any medium is strictly prohibited
+#
+
+import re
+import struct
+import sys
+
+MAGIC = b'\xfe\xed'
+HEADER = struct.Struct('<HBBIII')   # length, level, flags, time, format, function
+MAX_RECORD = 128                    # LOG_DEFERRED_MAX_RECORD
+
+FLAG_TRUNCATED = 0x01
+FLAG_ISR = 0x02
+
+LEVELS = ['ERR', 'WAR', 'INF', 'TRC', 'MEM']
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+# %[flags][width][.precision][length]conversion
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d*)(?:\.(\*|\d*))?(hh|h|ll|l|q|j|z|t|L)?([diuxXocpfFeEgGaAs%])')
+
+
+class Image(object):
+    """Allocated sections of an ELF file, enough to read strings by address"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        if data[:4] != b'\x7fELF':
+            raise ValueError('%s is not an ELF file' % path)
+        is64 = data[4] == 2
+        endian = '<' if data[5] == 1 else '>'
+        if is64:
+            shoff, = struct.unpack_from(endian + 'Q', data, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from(endian + 'HHH', data, 0x3a)
+            section = struct.Struct(endian + 'IIQQQQIIQQ')
+        else:
+            shoff, = struct.unpack_from(endian + 'I', data, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from(endian + 'HHH', data, 0x2e)
+            section = struct.Struct(endian + 'IIIIIIIIII')
+
+        headers = [section.unpack_from(data, shoff + i * shentsize) for i in range(shnum)]
+        names = headers[shstrndx]
+        self.sections = []
+        self.formats = None
+        for name, stype, flags, addr, offset, size in (h[:6] for h in headers):
+            end = data.index(b'\0', names[4] + name)
+            name = data[names[4] + name:end].decode('ascii')
+            if not (flags & SHF_ALLOC) or stype == SHT_NOBITS or size == 0:
+                continue
+            entry = (addr, data[offset:offset + size])
+            self.sections.append(entry)
+            if name == '.log_fmt':
+                self.formats = entry
+        if self.formats is None:
+            raise ValueError('%s has no .log_fmt section, was it built with LOG_DEFERRED=1?' % path)
+
+    def is_format(self, address):
+        addr, content = self.formats
+        return addr <= address < addr + len(content)
+
+    def string(self, address):
+        for addr, content in self.sections:
+            if addr <= address < addr + len(content):
+                start = address - addr
+                end = content.find(b'\0', start)
+                if end < 0:
+                    end = len(content)
+                return content[start:end].decode('latin-1')
+        return '<0x%08x>' % address
+
+
+def format_record(image, record):
+    """Return the text of one record, formatted as the text logger would"""
+    length, level, flags, time_ms, fmt_addr, func_addr = HEADER.unpack_from(record)
+    fmt = image.string(fmt_addr)
+    args = record[HEADER.size:length]
+    pos = 0
+    out = []
+    last = 0
+
+    def take(size, code):
+        nonlocal pos
+        if pos + size > len(args):
+            raise IndexError
+        value, = struct.unpack_from('<' + code, args, pos)
+        pos += size
+        return value
+
+    try:
+        for match in CONVERSION.finditer(fmt):
+            out.append(fmt[last:match.start()])
+            last = match.end()
+            flag, width, precision, modifier, conv = match.groups()
+            if conv == '%':
+                out.append('%')
+                continue
+
+            # Sizes on the target (32 bit ARM)
+            wide = modifier in ('ll', 'q', 'j')
+            values = []
+            spec = '%' + flag
+            if width == '*':
+                values.append(take(4, 'i'))
+            spec += width
+            if precision is not None:
+                spec += '.'
+                if precision == '*':
+                    values.append(take(4, 'i'))
+                spec += precision
+
+            if conv in 'di':
+                values.append(take(8, 'q') if wide else take(4, 'i'))
+                spec += 'd'
+            elif conv in 'uxXo':
+                values.append(take(8, 'Q') if wide else take(4, 'I'))
+                spec += 'd' if conv == 'u' else conv
+            elif conv == 'c':
+                values.append(chr(take(4, 'I') & 0xff))
+                spec += 'c'
+            elif conv == 'p':
+                values.append(take(4, 'I'))
+                spec = '0x%08x'
+            elif conv in 'fFeEgGaA':
+                value = take(8, 'd')
+                if conv in 'aA':
+                    values = [value.hex()]
+                    spec = '%s'
+                else:
+                    values.append(value)
+                    spec += conv.lower() if conv == 'F' else conv
+            elif conv == 's':
+                if pos >= len(args):
+                    raise IndexError
+                size = args[pos]
+                values.append(args[pos + 1:pos + 1 + size].decode('latin-1'))
+                pos += 1 + size
+                spec += 's'
+            out.append(spec % tuple(values))
+        out.append(fmt[last:])
+    except IndexError:
+        out.append('...')
+
+    if flags & FLAG_TRUNCATED:
+        out.append(' ...')
+    level_name = LEVELS[level] if level < len(LEVELS) else '???'
+    if flags & FLAG_ISR:
+        level_name += '*'
+    return '%5d.%03d %s %s: %s' % (time_ms // 1000, time_ms % 1000, level_name,
+                                   image.string(func_addr), ''.join(out))
+
+
+def decode(image, stream, output):
+    """Copy stream to output, replacing framed records by their text"""
+    pending = b''
+    while True:
+        chunk = stream.read(1) if stream.isatty() else stream.read(4096)
+        if not chunk:
+            break
+        pending += chunk
+        while True:
+            start = pending.find(MAGIC)
+            if start < 0:
+                # Keep a trailing 0xFE, it may be the start of the next frame
+                keep = 1 if pending.endswith(MAGIC[:1]) else 0
+                output.write(pending[:len(pending) - keep].decode('latin-1'))
+                pending = pending[len(pending) - keep:]
+                break
+            output.write(pending[:start].decode('latin-1'))
+            pending = pending[start:]
+            if len(pending) < len(MAGIC) + HEADER.size:
+                break
+            length, _, _, _, fmt_addr, _ = HEADER.unpack_from(pending, len(MAGIC))
+            if length < HEADER.size or length > MAX_RECORD or not image.is_format(fmt_addr):
+                # Not a record after all, let the marker through as text
+                output.write(pending[:1].decode('latin-1'))
+                pending = pending[1:]
+                continue
+            if len(pending) < len(MAGIC) + length:
+                break
+            record = pending[len(MAGIC):len(MAGIC) + length]
+            pending = pending[len(MAGIC) + length:]
+            output.write(format_record(image, record) + '\n')
+        output.flush()
+    output.write(pending.decode('latin-1'))
+
+
+def main(argv):
+    if len(argv) not in (2, 3):
+        sys.stderr.write('Usage: %s <firmware.axf> [capture]\n' % argv[0])
+        return 2
+    image = Image(argv[1])
+    if len(argv) == 3:
+        with open(argv[2], 'rb', buffering=0) as stream:
+            decode(image, stream, sys.stdout)
+    else:
+        decode(image, sys.stdin.buffer, sys.stdout)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
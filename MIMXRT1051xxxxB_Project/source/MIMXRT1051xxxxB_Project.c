@@ -249,7 +249,7 @@ const char _PKeyValue[] =
 "AdG086mcJRYubofivnBVsUcnEDANb8OvRwJsyf+xKwt2KwZOf2hYqA==\n"
 "-----END RSA PRIVATE KEY-----\n";
 
-extern int https_update_ota(char* host, char* port, char* resource);  //////// [nchatzi] I'd be nicer if the OTA functions were abstracted into the HAL/OSAL API...
+extern int https_update_ota(char* host, char* port, char* resource, char* key, char* hash, bool signedImage);  //////// [nchatzi] I'd be nicer if the OTA functions were abstracted into the HAL/OSAL API...
 void initLoggingProcess(void);
 
 
@@ -580,7 +580,8 @@ if(xTaskCreate(EndofLineTest, ((const char*)"EndofLineTest"), ENSO_AGENT_STACK_S
 #if OTA_OVER_HTTPS_TEST
 if (https_update_ota(ensoAgentSettings.otaURL,
                      ensoAgentSettings.otaPort,
-                     ensoAgentSettings.otaResourceName) == 0)
+                     ensoAgentSettings.otaResourceName,
+                     NULL, NULL, false) == 0)
 {
     HAL_Reboot();
 }
@@ -749,6 +750,8 @@ int main(void) {
 
 #define LOG_OUTPUT_QUEUE_LENGTH      1000
 #define LOG_OUTPUT_QUEUE_ITEM_SIZE   sizeof(char *)
+// How often deferred log records are written out
+#define LOG_OUTPUT_DRAIN_PERIOD_MS   10
 
 QueueHandle_t debugQueue = NULL;
 
@@ -767,7 +770,12 @@ void LogOutputTask(void *params)
             maxQueuedMsgCount = msgQueueCount;
         }
 
+#if LOG_DEFERRED
+        OSAL_LogDrain();
+        if( xQueueReceive( debugQueue, &debugMessage, pdMS_TO_TICKS(LOG_OUTPUT_DRAIN_PERIOD_MS) ) == pdPASS )
+#else
         if( xQueueReceive( debugQueue, &debugMessage, portMAX_DELAY ) == pdPASS )
+#endif
         {
             OSAL_printf("%s\r",debugMessage);
             vPortFree(debugMessage);
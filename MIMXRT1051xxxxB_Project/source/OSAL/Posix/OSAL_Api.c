@@ -0,0 +1,1207 @@
+/*!****************************************************************************
+* \file OSAL_Api.c
+*
+* \brief OSAL external interface implementation for POSIX hosts.
+*
+* Provides the OSAL on top of pthreads and the C library so that the portable
+* parts of the agent (Local Shadow, EnsoComms, Storage and the handlers) can
+* run as an ordinary Linux process. Behaviour follows the RT1050 version:
+* timer callbacks all run on one timer thread, message queues hand out slots
+* from a slab allocated up front, and stores are files in a directory.
+*
+* Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+
+
+/*
+ * Directory holding the stores, set by OSAL_STORE_DIR
+ */
+#define OSAL_STORE_DIR_DEFAULT  "./store"
+
+/*
+ * Heap reported by OSAL_GetFreeHeapSize(), set by OSAL_HEAP_SIZE. The Local
+ * Shadow sizes its object store from this.
+ */
+#define OSAL_HEAP_SIZE_DEFAULT  "1048576"
+
+/*
+ * Offset from the host clock, set by OSAL_SetTime()
+ */
+static time_t OSAL_seconds;
+
+bool test_OK = true;
+
+/**
+ * \brief Check_all_is_OK
+ *
+ * \return OK
+ */
+bool Check_all_is_OK(void)
+{
+    return test_OK;
+}
+
+
+/*
+ * Output is shared by all threads, lines from OSAL_Log are kept whole
+ */
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void OSAL_printf(char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    vprintf(fmt, va);
+    va_end(va);
+}
+
+int OSAL_sprintf(char *str, const char *format, ...)
+{
+    va_list ap;
+    int retval;
+
+    va_start(ap, format);
+    retval = vsprintf(str, format, ap);
+    va_end(ap);
+    return retval;
+}
+
+int OSAL_snprintf(char *str, size_t size, const char *format, ...)
+{
+    va_list ap;
+    int retval;
+
+    va_start(ap, format);
+    retval = vsnprintf(str, size, format, ap);
+    va_end(ap);
+    return retval;
+}
+
+char * OSAL_fgets(char * buffer, int size, void * f)
+{
+    if (size < 2 || buffer == NULL || f != stdin)
+    {
+        return NULL;
+    }
+    return fgets(buffer, size, stdin);
+}
+
+void OSAL_sleep_ms(uint32_t milliseconds)
+{
+    struct timespec ts =
+    {
+        .tv_sec = milliseconds / 1000,
+        .tv_nsec = (milliseconds % 1000) * 1000000L,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+time_t OSAL_time()
+{
+    return time(NULL) + OSAL_seconds;
+}
+
+void OSAL_SetTime(time_t newSystemTimeInSec)
+{
+    OSAL_seconds = newSystemTimeInSec - time(NULL);
+}
+
+uint32_t OSAL_GetTimeInSecondsSinceEpoch()
+{
+    return OSAL_time();
+}
+
+static uint64_t MonotonicMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t OSAL_time_ms()
+{
+    static uint64_t start = 0;
+    uint64_t now = MonotonicMs();
+    if (start == 0)
+    {
+        start = now;
+    }
+    return (uint32_t)(now - start);
+}
+
+
+/*
+ * Timers
+ *
+ * As with FreeRTOS software timers every callback runs on a single timer
+ * thread, so callbacks never run concurrently with each other. A timer being
+ * destroyed while its callback runs is freed once the callback returns.
+ */
+typedef struct OSAL_Timer_tag
+{
+    struct OSAL_Timer_tag * next;   // Next armed timer, soonest first
+    void (*callback)(void *);
+    Handle_t value;
+    uint32_t period;
+    uint64_t expiry;
+    bool repeat;
+    bool armed;
+    bool destroyed;
+} OSAL_Timer_t;
+
+static pthread_mutex_t timerMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timerCond;
+static pthread_once_t timerOnce = PTHREAD_ONCE_INIT;
+static OSAL_Timer_t * armedTimers;
+static OSAL_Timer_t * runningTimer;
+
+// Must be called with timerMutex held
+static void TimerArm(OSAL_Timer_t * timer, uint64_t now)
+{
+    timer->expiry = now + timer->period;
+    timer->armed = true;
+
+    OSAL_Timer_t ** p = &armedTimers;
+    while (*p != NULL && (*p)->expiry <= timer->expiry)
+    {
+        p = &(*p)->next;
+    }
+    timer->next = *p;
+    *p = timer;
+}
+
+// Must be called with timerMutex held
+static void TimerDisarm(OSAL_Timer_t * timer)
+{
+    for (OSAL_Timer_t ** p = &armedTimers; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == timer)
+        {
+            *p = timer->next;
+            break;
+        }
+    }
+    timer->armed = false;
+    timer->next = NULL;
+}
+
+static void * TimerThread(void * unused)
+{
+    (void)unused;
+    pthread_mutex_lock(&timerMutex);
+    for (;;)
+    {
+        uint64_t now = MonotonicMs();
+        OSAL_Timer_t * timer = armedTimers;
+        if (timer == NULL)
+        {
+            pthread_cond_wait(&timerCond, &timerMutex);
+            continue;
+        }
+        if (timer->expiry > now)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            uint64_t wait = timer->expiry - now;
+            ts.tv_sec += wait / 1000;
+            ts.tv_nsec += (wait % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L)
+            {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&timerCond, &timerMutex, &ts);
+            continue;
+        }
+
+        TimerDisarm(timer);
+        if (timer->repeat)
+        {
+            TimerArm(timer, timer->expiry);
+        }
+        runningTimer = timer;
+        pthread_mutex_unlock(&timerMutex);
+
+        timer->callback(timer);
+
+        pthread_mutex_lock(&timerMutex);
+        runningTimer = NULL;
+        if (timer->destroyed)
+        {
+            free(timer);
+        }
+    }
+    return NULL;
+}
+
+static void TimerStart(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timerCond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, TimerThread, NULL) != 0)
+    {
+        LOG_Error("Failed to create the timer thread");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+Timer_t OSAL_NewTimer(void (*callback)(void *), uint32_t milliseconds, bool repeat, Handle_t handle)
+{
+    if (callback == NULL || (repeat && milliseconds == 0))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    pthread_once(&timerOnce, TimerStart);
+
+    OSAL_Timer_t * timer = calloc(1, sizeof *timer);
+    if (timer == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    timer->callback = callback;
+    timer->value = handle;
+    timer->period = milliseconds;
+    timer->repeat = repeat;
+
+    pthread_mutex_lock(&timerMutex);
+    TimerArm(timer, MonotonicMs());
+    pthread_cond_signal(&timerCond);
+    pthread_mutex_unlock(&timerMutex);
+    return timer;
+}
+
+void * OSAL_GetTimerParam(void * p)
+{
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    return ((OSAL_Timer_t *)p)->value;
+}
+
+int OSAL_DestroyTimer(Timer_t timer)
+{
+    OSAL_Timer_t * t = timer;
+    if (t == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    pthread_mutex_lock(&timerMutex);
+    if (t->armed)
+    {
+        TimerDisarm(t);
+    }
+    if (t == runningTimer)
+    {
+        t->destroyed = true;
+    }
+    else
+    {
+        free(t);
+    }
+    pthread_cond_signal(&timerCond);
+    pthread_mutex_unlock(&timerMutex);
+    return 0;
+}
+
+
+/*
+ * Message queues
+ *
+ * The queue holds descriptors in a ring so that high priority messages can
+ * go to the front. Message storage is one slab allocated when the queue is
+ * created, with one slot per queue entry, so sending and receiving never
+ * touch the heap and a sender holding a slot always has room on the queue.
+ */
+typedef struct
+{
+    MessagePriority_e priority;
+    unsigned int size;
+    void * buffer;
+} MessageDesc_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t slotFree;
+    MessageDesc_t * ring;           // maximumNumberOfMessages descriptors
+    unsigned int head;              // Oldest message in the ring
+    unsigned int count;             // Messages in the ring
+    void ** freeSlots;              // Pointers to unused slots in slab
+    unsigned int numFreeSlots;
+    uint8_t * slab;                 // maximumNumberOfMessages * maximumMessageSize
+    unsigned int maximumNumberOfMessages;
+    unsigned int maximumMessageSize;
+    unsigned int highWaterMark;     // Most slots ever in use at once
+    unsigned int allocationFailures;// Sends refused because no slot was free
+    bool block;
+} MessageQueueDesc_t;
+
+MessageQueue_t OSAL_NewMessageQueue(const char * name, unsigned int maximumNumberOfMessages, unsigned int maximumMessageSize)
+{
+    if (maximumNumberOfMessages == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    MessageQueueDesc_t * messageQueueDescriptor = calloc(1, sizeof *messageQueueDescriptor);
+    if (messageQueueDescriptor == NULL)
+    {
+        LOG_Error("(calloc(%zu) failed", sizeof *messageQueueDescriptor);
+        errno = ENOMEM;
+        return NULL;
+    }
+    messageQueueDescriptor->ring = calloc(maximumNumberOfMessages, sizeof(MessageDesc_t));
+    messageQueueDescriptor->freeSlots = calloc(maximumNumberOfMessages, sizeof(void *));
+    messageQueueDescriptor->slab = malloc((size_t)maximumNumberOfMessages * maximumMessageSize);
+    if (messageQueueDescriptor->ring == NULL || messageQueueDescriptor->freeSlots == NULL ||
+        messageQueueDescriptor->slab == NULL)
+    {
+        LOG_Error("slab allocation (%u x %u) failed for %s", maximumNumberOfMessages, maximumMessageSize, name);
+        free(messageQueueDescriptor->ring);
+        free(messageQueueDescriptor->freeSlots);
+        free(messageQueueDescriptor->slab);
+        free(messageQueueDescriptor);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (unsigned int i = 0; i < maximumNumberOfMessages; i++)
+    {
+        messageQueueDescriptor->freeSlots[i] = messageQueueDescriptor->slab + (i * maximumMessageSize);
+    }
+    messageQueueDescriptor->numFreeSlots = maximumNumberOfMessages;
+
+    pthread_mutex_init(&messageQueueDescriptor->mutex, NULL);
+    pthread_cond_init(&messageQueueDescriptor->notEmpty, NULL);
+    pthread_cond_init(&messageQueueDescriptor->slotFree, NULL);
+    messageQueueDescriptor->maximumNumberOfMessages = maximumNumberOfMessages;
+    messageQueueDescriptor->maximumMessageSize = maximumMessageSize;
+    messageQueueDescriptor->block = true;
+    return messageQueueDescriptor;
+}
+
+int OSAL_IsMessageQueueNonBlocking(MessageQueue_t messageQueue)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    return messageQueueDescriptor == NULL ? -1 : messageQueueDescriptor->block;
+}
+
+int OSAL_SetMessageQueueNonBlock(MessageQueue_t messageQueue, bool nonBlock)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    if (messageQueueDescriptor == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    pthread_mutex_lock(&messageQueueDescriptor->mutex);
+    messageQueueDescriptor->block = !nonBlock;
+    pthread_mutex_unlock(&messageQueueDescriptor->mutex);
+    return 0;
+}
+
+// Reads one unsigned field of a queue under its lock, -1 for a bad queue
+static int QueueField(MessageQueue_t messageQueue, size_t offset)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    if (messageQueueDescriptor == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    pthread_mutex_lock(&messageQueueDescriptor->mutex);
+    int ret = *(unsigned int *)((uint8_t *)messageQueueDescriptor + offset);
+    pthread_mutex_unlock(&messageQueueDescriptor->mutex);
+    return ret;
+}
+
+int OSAL_GetMessageQueueSize(MessageQueue_t messageQueue)
+{
+    return QueueField(messageQueue, offsetof(MessageQueueDesc_t, maximumNumberOfMessages));
+}
+
+int OSAL_GetMessageQueueNumCurrentMessages(MessageQueue_t messageQueue)
+{
+    return QueueField(messageQueue, offsetof(MessageQueueDesc_t, count));
+}
+
+int OSAL_GetMessageQueueMaxMessageSize(MessageQueue_t messageQueue)
+{
+    return QueueField(messageQueue, offsetof(MessageQueueDesc_t, maximumMessageSize));
+}
+
+int OSAL_GetMessageQueueHighWaterMark(MessageQueue_t messageQueue)
+{
+    return QueueField(messageQueue, offsetof(MessageQueueDesc_t, highWaterMark));
+}
+
+int OSAL_GetMessageQueueAllocationFailures(MessageQueue_t messageQueue)
+{
+    return QueueField(messageQueue, offsetof(MessageQueueDesc_t, allocationFailures));
+}
+
+int OSAL_DestroyMessageQueue(MessageQueue_t messageQueue, const char * name)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    if (messageQueueDescriptor == NULL || name == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    pthread_mutex_destroy(&messageQueueDescriptor->mutex);
+    pthread_cond_destroy(&messageQueueDescriptor->notEmpty);
+    pthread_cond_destroy(&messageQueueDescriptor->slotFree);
+    free(messageQueueDescriptor->ring);
+    free(messageQueueDescriptor->freeSlots);
+    free(messageQueueDescriptor->slab);
+    free(messageQueueDescriptor);
+    return 0;
+}
+
+int OSAL_SendMessage(MessageQueue_t messageQueue, const void * buffer, size_t size, MessagePriority_e priority)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    if (messageQueueDescriptor == NULL)
+    {
+        LOG_Error("null messageDescriptor");
+        errno = EBADR;
+        return -1;
+    }
+    else if (buffer == NULL)
+    {
+        LOG_Error("null buffer");
+        errno = EBADR;
+        return -1;
+    }
+    int messageSize = size > messageQueueDescriptor->maximumMessageSize ? messageQueueDescriptor->maximumMessageSize : size;
+
+    pthread_mutex_lock(&messageQueueDescriptor->mutex);
+    // A blocking queue waits here for the receiver to hand back a slot
+    while (messageQueueDescriptor->numFreeSlots == 0 && messageQueueDescriptor->block)
+    {
+        pthread_cond_wait(&messageQueueDescriptor->slotFree, &messageQueueDescriptor->mutex);
+    }
+    if (messageQueueDescriptor->numFreeSlots == 0)
+    {
+        messageQueueDescriptor->allocationFailures++;
+        pthread_mutex_unlock(&messageQueueDescriptor->mutex);
+        LOG_Error("no free message slot");
+        errno = ENOMEM;
+        return -1;
+    }
+    MessageDesc_t md =
+    {
+        .priority = priority,
+        .size = messageSize,
+        .buffer = messageQueueDescriptor->freeSlots[--messageQueueDescriptor->numFreeSlots],
+    };
+    unsigned int inUse = messageQueueDescriptor->maximumNumberOfMessages - messageQueueDescriptor->numFreeSlots;
+    if (inUse > messageQueueDescriptor->highWaterMark)
+    {
+        messageQueueDescriptor->highWaterMark = inUse;
+    }
+    memcpy(md.buffer, buffer, messageSize);
+
+    unsigned int n = messageQueueDescriptor->maximumNumberOfMessages;
+    if (priority == MessagePriority_high)
+    {
+        messageQueueDescriptor->head = (messageQueueDescriptor->head + n - 1) % n;
+        messageQueueDescriptor->ring[messageQueueDescriptor->head] = md;
+    }
+    else
+    {
+        messageQueueDescriptor->ring[(messageQueueDescriptor->head + messageQueueDescriptor->count) % n] = md;
+    }
+    messageQueueDescriptor->count++;
+    pthread_cond_signal(&messageQueueDescriptor->notEmpty);
+    pthread_mutex_unlock(&messageQueueDescriptor->mutex);
+    return messageSize;
+}
+
+int OSAL_ReceiveMessage(MessageQueue_t messageQueue, void * buffer, size_t size, MessagePriority_e * priority)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    if (messageQueueDescriptor == NULL)
+    {
+        LOG_Error("null messageDescriptor");
+        errno = EBADR;
+        return -1;
+    }
+    else if (buffer == NULL)
+    {
+        LOG_Error("null buffer");
+        errno = EBADR;
+        return -1;
+    }
+    else if (priority == NULL)
+    {
+        LOG_Error("null priority");
+        errno = EBADR;
+        return -1;
+    }
+
+    pthread_mutex_lock(&messageQueueDescriptor->mutex);
+    while (messageQueueDescriptor->count == 0 && messageQueueDescriptor->block)
+    {
+        pthread_cond_wait(&messageQueueDescriptor->notEmpty, &messageQueueDescriptor->mutex);
+    }
+    if (messageQueueDescriptor->count == 0)
+    {
+        pthread_mutex_unlock(&messageQueueDescriptor->mutex);
+        errno = EAGAIN;
+        return -1;
+    }
+    MessageDesc_t md = messageQueueDescriptor->ring[messageQueueDescriptor->head];
+    messageQueueDescriptor->head = (messageQueueDescriptor->head + 1) % messageQueueDescriptor->maximumNumberOfMessages;
+    messageQueueDescriptor->count--;
+
+    *priority = md.priority;
+    int messageSize = size > md.size ? md.size : size;
+    memcpy(buffer, md.buffer, messageSize);
+    messageQueueDescriptor->freeSlots[messageQueueDescriptor->numFreeSlots++] = md.buffer;
+    pthread_cond_signal(&messageQueueDescriptor->slotFree);
+    pthread_mutex_unlock(&messageQueueDescriptor->mutex);
+    return messageSize;
+}
+
+
+/*
+ * Threads
+ */
+typedef struct
+{
+    void (*function)(Handle_t);
+    Handle_t arg;
+} ThreadStart_t;
+
+static void * ThreadEntry(void * p)
+{
+    ThreadStart_t start = *(ThreadStart_t *)p;
+    free(p);
+    start.function(start.arg);
+    return NULL;
+}
+
+Thread_t OSAL_NewThread(void (*function) (Handle_t), Handle_t arg)
+{
+    LOG_Trace("(%p, %p)", function, arg);
+    _Static_assert(sizeof(pthread_t) <= sizeof(Thread_t), "pthread_t must fit in a Thread_t");
+    if (function == NULL)
+    {
+        errno = EBADR;
+        return NULL;
+    }
+    ThreadStart_t * start = malloc(sizeof *start);
+    if (start == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    start->function = function;
+    start->arg = arg;
+
+    pthread_t thread;
+    int rc = pthread_create(&thread, NULL, ThreadEntry, start);
+    if (rc != 0)
+    {
+        free(start);
+        errno = rc;
+        return NULL;
+    }
+    pthread_detach(thread);
+
+    Thread_t threadHandle = NULL;
+    memcpy(&threadHandle, &thread, sizeof thread);
+    return threadHandle;
+}
+
+void OSAL_KillThread(Thread_t threadHandle)
+{
+    LOG_Trace("(%p)", threadHandle);
+
+    if (threadHandle == NULL)
+    {
+        errno = EBADR;
+        LOG_Error("Invalid Thread Handler %p", threadHandle);
+        return;
+    }
+
+    pthread_t thread;
+    memcpy(&thread, &threadHandle, sizeof thread);
+    pthread_cancel(thread);
+}
+
+
+/*
+ * Mutexes are recursive, as on FreeRTOS
+ */
+int OSAL_InitMutex(Mutex_t * mutex, const MutexAttr_t * attr)
+{
+    if (mutex == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    pthread_mutexattr_t recursive;
+    pthread_mutexattr_init(&recursive);
+    pthread_mutexattr_settype(&recursive, PTHREAD_MUTEX_RECURSIVE);
+    int rc = pthread_mutex_init(mutex, attr ? attr : &recursive);
+    pthread_mutexattr_destroy(&recursive);
+    return rc == 0 ? 0 : -1;
+}
+
+int OSAL_LockMutex(Mutex_t * mutex)
+{
+    if (mutex == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    return pthread_mutex_lock(mutex);
+}
+
+int OSAL_TryLockMutex(Mutex_t * mutex)
+{
+    if (mutex == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    return pthread_mutex_trylock(mutex) == 0 ? 0 : MUTEX_BUSY;
+}
+
+int OSAL_UnLockMutex(Mutex_t * mutex)
+{
+    if (mutex == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    return pthread_mutex_unlock(mutex);
+}
+
+int OSAL_DestroyMutex(Mutex_t * mutex)
+{
+    if (mutex == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    return pthread_mutex_destroy(mutex);
+}
+
+
+/*
+ * Logging
+ */
+void OSAL_Log(const char *format, ...)
+{
+    va_list varArgList;
+    va_start(varArgList, format);
+    pthread_mutex_lock(&log_mutex);
+    vprintf(format, varArgList);
+    fflush(stdout);
+    pthread_mutex_unlock(&log_mutex);
+    va_end(varArgList);
+}
+
+// There is no ELF to decode against on the host, so deferred records are
+// formatted straight away
+void OSAL_LogDeferred(uint8_t level, const char * function, const char * format, ...)
+{
+    static const char * const type[] = { "ERR", "WAR", "INF", "TRC", "MEM" };
+    uint32_t ms = OSAL_time_ms();
+    va_list varArgList;
+    va_start(varArgList, format);
+    pthread_mutex_lock(&log_mutex);
+    printf("%5d.%03d %s %s: ", ms / 1000, ms % 1000,
+           level < sizeof type / sizeof type[0] ? type[level] : "???", function);
+    vprintf(format, varArgList);
+    printf("\n");
+    fflush(stdout);
+    pthread_mutex_unlock(&log_mutex);
+    va_end(varArgList);
+}
+
+void OSAL_LogDrain(void)
+{
+}
+
+
+/*
+ * Memory
+ *
+ * malloc and friends are the C library's own. OSAL_MemoryRequest keeps the
+ * same block header as the RT1050 version and counts the bytes handed out,
+ * so OSAL_GetFreeHeapSize() behaves like a fixed size heap.
+ */
+typedef struct MemoryDescriptor_tag
+{
+    size_t blockSize;
+    size_t amountStored;
+} MemoryDescriptor_t;
+
+static size_t heapInUse;
+static pthread_mutex_t heapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+MemoryHandle_t OSAL_MemoryRequest(MemoryPoolHandle_t pool, size_t size)
+{
+    MemoryHandle_t handle;
+    handle = malloc(size + sizeof(MemoryDescriptor_t));
+    if ( handle )
+    {
+        ((MemoryDescriptor_t *) handle)->blockSize = size;
+        ((MemoryDescriptor_t *) handle)->amountStored = size;
+        handle =  (((MemoryDescriptor_t *) handle) + 1) ;
+
+        pthread_mutex_lock(&heapMutex);
+        heapInUse += size + sizeof(MemoryDescriptor_t);
+        pthread_mutex_unlock(&heapMutex);
+    }
+
+    return handle;
+}
+
+void OSAL_Free(MemoryHandle_t handle)
+{
+    if (NULL != handle)
+    {
+        pthread_mutex_lock(&heapMutex);
+        heapInUse -= (((MemoryDescriptor_t *) handle) -1)->blockSize + sizeof(MemoryDescriptor_t);
+        pthread_mutex_unlock(&heapMutex);
+
+        (((MemoryDescriptor_t *) handle) -1)->blockSize = 0;
+        (((MemoryDescriptor_t *) handle) -1)->amountStored = 0;
+        free ((MemoryDescriptor_t*)handle - 1);
+    }
+}
+
+size_t OSAL_GetBlockSize( MemoryHandle_t handle )
+{
+    size_t size = 0;
+    if ( NULL != handle )
+    {
+        size = (((MemoryDescriptor_t *) handle) -1)->blockSize ;
+    }
+    return size;
+}
+
+size_t OSAL_GetAmountStored( MemoryHandle_t handle )
+{
+    size_t size = 0;
+    if ( NULL != handle )
+    {
+        size = (((MemoryDescriptor_t *) handle) -1)->amountStored ;
+    }
+    return size;
+}
+
+size_t OSAL_SetAmountStored( MemoryHandle_t handle, size_t newAmount )
+{
+    size_t size = 0;
+    if ( NULL != handle )
+    {
+        if ( newAmount <= (((MemoryDescriptor_t *) handle) -1)->blockSize )
+        {
+            size = (((MemoryDescriptor_t *) handle) -1)->amountStored = newAmount ;
+        }
+    }
+    return size;
+}
+
+void* OSAL_GetMemoryPointer(MemoryHandle_t handle)
+{
+    return handle;
+}
+
+size_t OSAL_GetFreeHeapSize(void)
+{
+    size_t heapSize = strtoul(getenvDefault("OSAL_HEAP_SIZE", OSAL_HEAP_SIZE_DEFAULT), NULL, 0);
+    pthread_mutex_lock(&heapMutex);
+    size_t inUse = heapInUse;
+    pthread_mutex_unlock(&heapMutex);
+    return inUse < heapSize ? heapSize - inUse : 0;
+}
+
+
+/*
+ * There is no watchdog on the host
+ */
+int OSAL_watchdog_init(uint32_t timeout_ms)
+{
+    LOG_Trace("(%d)", timeout_ms);
+    return 0;
+}
+
+void OSAL_watchdog_start(void)
+{
+}
+
+void OSAL_watchdog_stop(void)
+{
+}
+
+void OSAL_watchdog_refresh(void)
+{
+}
+
+void OSAL_watchdog_suspend_refresh(void)
+{
+    test_OK = false;
+}
+
+
+/*
+ * Stores are files in the directory named by OSAL_STORE_DIR, with the
+ * semantics of the flash file system: a store must exist to be read, the
+ * first write to a store opened for writing replaces its content, and a
+ * rename fails if the new name is taken.
+ */
+typedef struct
+{
+    int fd;
+    bool truncatePending;   // First write replaces the content
+} StoreFile_t;
+
+static void StorePath(char * path, size_t size, const char * storeName)
+{
+    const char * dir = getenvDefault("OSAL_STORE_DIR", OSAL_STORE_DIR_DEFAULT);
+    mkdir(dir, 0755);
+    snprintf(path, size, "%s/%s", dir, storeName);
+}
+
+Handle_t OSAL_StoreOpen(const char * storeName, OSAL_AccessMode_e accessMode)
+{
+    if (storeName == NULL)
+    {
+        errno = EBADR;
+        return NULL;
+    }
+    char path[PATH_MAX];
+    StorePath(path, sizeof path, storeName);
+
+    int flags;
+    switch (accessMode)
+    {
+        case READ_ONLY:    flags = O_RDONLY;                     break;
+        case WRITE_ONLY:   flags = O_WRONLY | O_CREAT;           break;
+        case READ_WRITE:   flags = O_RDWR | O_CREAT;             break;
+        case WRITE_APPEND: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+        default:
+            errno = EINVAL;
+            return NULL;
+    }
+    int fd = open(path, flags, 0644);
+    if (fd < 0)
+    {
+        if (accessMode == READ_ONLY)
+        {
+            LOG_Error("File %s does not exist to read!", storeName);
+        }
+        return NULL;
+    }
+    StoreFile_t * file = malloc(sizeof *file);
+    if (file == NULL)
+    {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    file->fd = fd;
+    file->truncatePending = (accessMode == WRITE_ONLY) || (accessMode == READ_WRITE);
+    return file;
+}
+
+int OSAL_StoreWrite(Handle_t handle, const void * buffer, size_t nBytes)
+{
+    StoreFile_t * file = handle;
+    if (file == NULL || buffer == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    if (file->truncatePending)
+    {
+        if (ftruncate(file->fd, 0) != 0 || lseek(file->fd, 0, SEEK_SET) != 0)
+        {
+            return -1;
+        }
+        file->truncatePending = false;
+    }
+    size_t written = 0;
+    while (written < nBytes)
+    {
+        ssize_t n = write(file->fd, (const uint8_t *)buffer + written, nBytes - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        written += n;
+    }
+    return written;
+}
+
+int OSAL_StoreRead(Handle_t handle, void* buffer, size_t nBytes)
+{
+    StoreFile_t * file = handle;
+    if (file == NULL || buffer == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    size_t done = 0;
+    while (done < nBytes)
+    {
+        ssize_t n = read(file->fd, (uint8_t *)buffer + done, nBytes - done);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+int OSAL_StoreClose(Handle_t handle)
+{
+    StoreFile_t * file = handle;
+    if (file == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    int rc = close(file->fd);
+    free(file);
+    return rc == 0 ? 0 : -1;
+}
+
+int OSAL_StoreAtomicRename(const char * oldName, const char * newName)
+{
+    char oldPath[PATH_MAX];
+    char newPath[PATH_MAX];
+    StorePath(oldPath, sizeof oldPath, oldName);
+    StorePath(newPath, sizeof newPath, newName);
+    if (access(newPath, F_OK) == 0)
+    {
+        LOG_Error("Filename already exists!");
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(oldPath, newPath) == 0 ? 0 : -1;
+}
+
+int OSAL_StoreRemove(const char * storeName)
+{
+    char path[PATH_MAX];
+    StorePath(path, sizeof path, storeName);
+    return unlink(path) == 0 ? 0 : -1;
+}
+
+int OSAL_StoreSize(const char* storeName)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    StorePath(path, sizeof path, storeName);
+    if (stat(path, &st) != 0)
+    {
+        LOG_Error("File %s does not exist!", storeName);
+        return -1;
+    }
+    return st.st_size;
+}
+
+bool OSAL_StoreExist(const char* storeName)
+{
+    char path[PATH_MAX];
+    StorePath(path, sizeof path, storeName);
+    return access(path, F_OK) == 0;
+}
+
+char * getenvDefault(char * name, char * defaultValue)
+{
+    char * value = getenv(name);
+    return value ? value : defaultValue;
+}
+
+
+/*
+ * Semaphores
+ */
+static int SemaphoreInit(Semaphore_t * semaphore, uint32_t maxCount, uint32_t initialCount)
+{
+    if (semaphore == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    semaphore->maxCount = maxCount;
+    semaphore->count = initialCount;
+    return 0;
+}
+
+static int SemaphoreGive(Semaphore_t * semaphore)
+{
+    if (semaphore == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    int rc = -1;
+    pthread_mutex_lock(&semaphore->mutex);
+    if (semaphore->count < semaphore->maxCount)
+    {
+        semaphore->count++;
+        pthread_cond_signal(&semaphore->cond);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&semaphore->mutex);
+    return rc;
+}
+
+// Waits for ever when timeoutMs is UINT32_MAX
+static int SemaphoreTake(Semaphore_t * semaphore, uint32_t timeoutMs)
+{
+    if (semaphore == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int rc = 0;
+    pthread_mutex_lock(&semaphore->mutex);
+    while (semaphore->count == 0 && rc == 0)
+    {
+        if (timeoutMs == UINT32_MAX)
+        {
+            pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+        }
+        else
+        {
+            rc = pthread_cond_timedwait(&semaphore->cond, &semaphore->mutex, &deadline);
+        }
+    }
+    if (semaphore->count == 0)
+    {
+        pthread_mutex_unlock(&semaphore->mutex);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    semaphore->count--;
+    pthread_mutex_unlock(&semaphore->mutex);
+    return 0;
+}
+
+int OSAL_InitBinarySemaphore(Semaphore_t * semaphore)
+{
+    return SemaphoreInit(semaphore, 1, 0);
+}
+
+int OSAL_GiveBinarySemaphore(Semaphore_t *semaphore)
+{
+    return SemaphoreGive(semaphore);
+}
+
+int OSAL_TakeBinarySemaphore(Semaphore_t *semaphore)
+{
+    return SemaphoreTake(semaphore, UINT32_MAX);
+}
+
+int OSAL_InitCountingSemaphore(Semaphore_t * semaphore, uint32_t maxCount, uint32_t initialCount)
+{
+    return SemaphoreInit(semaphore, maxCount, initialCount);
+}
+
+int OSAL_GiveCountingSemaphore(Semaphore_t * semaphore)
+{
+    return SemaphoreGive(semaphore);
+}
+
+int OSAL_TakeCountingSemaphore(Semaphore_t * semaphore, uint32_t timeoutMs)
+{
+    return SemaphoreTake(semaphore, timeoutMs);
+}
+
+
+/*
+ * Power events, there is no power monitor on a host so they only come
+ * from OSAL_NotifyPowerEvent()
+ */
+static OSAL_PowerEventCallback_t powerEventCallback = NULL;
+static volatile OSAL_PowerEvent_e lastPowerEvent = OSAL_POWER_MAINS_RESTORED;
+
+void OSAL_RegisterPowerEventCallback(OSAL_PowerEventCallback_t callback)
+{
+    powerEventCallback = callback;
+    OSAL_PowerEvent_e event = lastPowerEvent;
+    if ((callback != NULL) && (event != OSAL_POWER_MAINS_RESTORED))
+    {
+        callback(event);
+    }
+}
+
+void OSAL_NotifyPowerEvent(OSAL_PowerEvent_e event)
+{
+    lastPowerEvent = event;
+    OSAL_PowerEventCallback_t callback = powerEventCallback;
+    if (callback != NULL)
+    {
+        callback(event);
+    }
+}
@@ -0,0 +1,41 @@
+/*!****************************************************************************
+* \file Platform.h
+*
+* \brief Implementation dependant definitions for POSIX hosts
+*
+* Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+
+#ifndef Platform_h
+#define Platform_h
+
+#include <stdint.h>
+#include <inttypes.h>  /* PRIx64 and friends, which newlib brings in on target */
+#include <errno.h>
+#include <pthread.h>
+
+typedef pthread_mutex_t Platform_Mutex_t;
+typedef pthread_mutexattr_t Platform_MutexAttr_t;
+
+/* Binary and counting semaphores, FreeRTOS semaphores have a maximum count
+ * which POSIX semaphores do not. */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint32_t        count;
+    uint32_t        maxCount;
+} Platform_Semaphore_t;
+
+#define MUTEX_BUSY EBUSY
+
+typedef void * Platform_Handle_t;       /**< Generic opaque handle */
+
+/* Not every C library has the Linux error codes used by the OSAL. */
+#ifndef EBADR
+#define EBADR EINVAL
+#endif
+
+#endif
@@ -219,8 +219,12 @@ int OSAL_DestroyTimer(Timer_t timer)
 typedef struct
 {
     QueueHandle_t messageQueue;
+    QueueHandle_t freeSlots;        // Pointers to unused slots in slab
+    uint8_t * slab;                 // maximumNumberOfMessages * maximumMessageSize
     unsigned int maximumNumberOfMessages;
     unsigned int maximumMessageSize;
+    unsigned int highWaterMark;     // Most slots ever in use at once
+    unsigned int allocationFailures;// Sends refused because no slot was free
     bool block;
 } MessageQueueDesc_t;
 
@@ -250,8 +254,35 @@ MessageQueue_t OSAL_NewMessageQueue(const char * name, unsigned int maximumNumbe
         errno = ENOMEM;
         return messageQueue;
     }
+
+    // All message storage is allocated here, once, so that sending and
+    // receiving never touch the heap. There is one slot per queue entry, so
+    // a sender holding a slot is always guaranteed room on the queue.
+    messageQueueDescriptor->freeSlots = xQueueCreate(maximumNumberOfMessages, sizeof(void *));
+    messageQueueDescriptor->slab = pvPortMalloc(maximumNumberOfMessages * maximumMessageSize);
+    if (messageQueueDescriptor->freeSlots == NULL || messageQueueDescriptor->slab == NULL)
+    {
+        LOG_Error("slab allocation (%d x %d) failed", maximumNumberOfMessages, maximumMessageSize);
+        if (messageQueueDescriptor->freeSlots != NULL)
+        {
+            vQueueDelete(messageQueueDescriptor->freeSlots);
+        }
+        vPortFree(messageQueueDescriptor->slab);
+        vQueueDelete(messageQueueDescriptor->messageQueue);
+        vPortFree(messageQueueDescriptor);
+        errno = ENOMEM;
+        return messageQueue;
+    }
+    for (unsigned int i = 0; i < maximumNumberOfMessages; i++)
+    {
+        void * slot = messageQueueDescriptor->slab + (i * maximumMessageSize);
+        xQueueSendToBack(messageQueueDescriptor->freeSlots, &slot, 0);
+    }
+
     messageQueueDescriptor->maximumNumberOfMessages = maximumNumberOfMessages;
     messageQueueDescriptor->maximumMessageSize = maximumMessageSize;
+    messageQueueDescriptor->highWaterMark = 0;
+    messageQueueDescriptor->allocationFailures = 0;
     messageQueueDescriptor->block = true;
     vQueueAddToRegistry(messageQueueDescriptor->messageQueue, name);
     return messageQueueDescriptor;
@@ -326,6 +357,38 @@ int OSAL_GetMessageQueueMaxMessageSize(MessageQueue_t messageQueue)
     return ret;
 }
 
+int OSAL_GetMessageQueueHighWaterMark(MessageQueue_t messageQueue)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    int ret = -1;
+    if (messageQueueDescriptor == NULL)
+    {
+        errno = EBADR;
+    }
+    else
+    {
+        ret = messageQueueDescriptor->highWaterMark;
+    }
+    //LOG_Trace("(%p):%d", messageQueue, ret);
+    return ret;
+}
+
+int OSAL_GetMessageQueueAllocationFailures(MessageQueue_t messageQueue)
+{
+    MessageQueueDesc_t * messageQueueDescriptor = messageQueue;
+    int ret = -1;
+    if (messageQueueDescriptor == NULL)
+    {
+        errno = EBADR;
+    }
+    else
+    {
+        ret = messageQueueDescriptor->allocationFailures;
+    }
+    //LOG_Trace("(%p):%d", messageQueue, ret);
+    return ret;
+}
+
 //////// [RE:workaround] Function missing return. Commented out as not needed.
 /*
 int OSAL_DestroyMessageQueue(MessageQueue_t messageQueue, const char * name)
@@ -353,6 +416,8 @@ int OSAL_DestroyMessageQueue(MessageQueue_t messageQueue, const char * name)
     }
     vQueueUnregisterQueue(queueHandle);
     vQueueDelete(queueHandle);
+    vQueueDelete(messageQueueDescriptor->freeSlots);
+    vPortFree(messageQueueDescriptor->slab);
     vPortFree(messageQueueDescriptor);
 }
 */
@@ -374,25 +439,42 @@ int OSAL_SendMessage(MessageQueue_t messageQueue, const void * buffer, size_t si
         return -1;
     }
     int messageSize = size > messageQueueDescriptor->maximumMessageSize ? messageQueueDescriptor->maximumMessageSize : size;
+    int timeoutTicks = messageQueueDescriptor->block ? portMAX_DELAY : 0;
     MessageDesc_t md =
     {
         .priority = priority,
         .size = messageSize,
-        .buffer = pvPortMalloc(messageSize),
+        .buffer = NULL,
     };
-    if (md.buffer == NULL)
-    {
-        LOG_Error("malloc failed");
+    // A blocking queue waits here for the receiver to hand back a slot,
+    // exactly as it would otherwise wait for room on the queue itself.
+    if (xQueueReceive(messageQueueDescriptor->freeSlots, &md.buffer, timeoutTicks) != pdTRUE)
+    {
+        taskENTER_CRITICAL();
+        messageQueueDescriptor->allocationFailures++;
+        taskEXIT_CRITICAL();
+        LOG_Error("no free message slot");
         errno = ENOMEM;
         return -1;
     }
+    taskENTER_CRITICAL();
+    unsigned int inUse = messageQueueDescriptor->maximumNumberOfMessages -
+                         uxQueueMessagesWaiting(messageQueueDescriptor->freeSlots);
+    if (inUse > messageQueueDescriptor->highWaterMark)
+    {
+        messageQueueDescriptor->highWaterMark = inUse;
+    }
+    taskEXIT_CRITICAL();
 
     memcpy(md.buffer, buffer, messageSize);
     QueueHandle_t queueHandle = messageQueueDescriptor->messageQueue;
-    int timeoutTicks = messageQueueDescriptor->block ? portMAX_DELAY : 0;
     BaseType_t rc = priority == MessagePriority_high ?
                     xQueueSendToFront(queueHandle, &md, timeoutTicks) :
                     xQueueSendToBack(queueHandle, &md, timeoutTicks);
+    if (rc != pdTRUE)
+    {
+        xQueueSendToBack(messageQueueDescriptor->freeSlots, &md.buffer, 0);
+    }
     //LOG_Trace("(%p, %p, %d, %d):%d", queueHandle, buffer, size, priority, rc);
 #if ENHANCED_DEBUG
     LOG_Warning("Queue count = %d",uxQueueMessagesWaiting(messageQueueDescriptor->messageQueue));
@@ -433,8 +515,11 @@ int OSAL_ReceiveMessage(MessageQueue_t messageQueue, void * buffer, size_t size,
     *priority = md.priority;
     int messageSize = size > messageQueueDescriptor->maximumMessageSize ? messageQueueDescriptor->maximumMessageSize : size;
     messageSize = size > md.size ? md.size : size;
-    memcpy(buffer, md.buffer, messageSize);
-    vPortFree(md.buffer);
+    if (md.buffer != NULL)
+    {
+        memcpy(buffer, md.buffer, messageSize);
+        xQueueSendToBack(messageQueueDescriptor->freeSlots, &md.buffer, 0);
+    }
     //LOG_Trace("(%p, %p, %d, %p):%d", queueHandle, buffer, size, priority, rc);
     return rc == pdTRUE ? messageSize : messageQueueDescriptor->block ? 0 : -1;
 }
@@ -725,6 +810,11 @@ void* OSAL_GetMemoryPointer(MemoryHandle_t handle)
     return handle;
 }
 
+size_t OSAL_GetFreeHeapSize(void)
+{
+    return xPortGetFreeHeapSize();
+}
+
 int OSAL_watchdog_init(uint32_t timeout_ms)
 {
     LOG_Trace("(%d)", timeout_ms);
@@ -854,3 +944,62 @@ int OSAL_TakeBinarySemaphore(Semaphore_t *semaphore)
     }
     return xSemaphoreTake(*semaphore, portMAX_DELAY );
 }
+
+int OSAL_InitCountingSemaphore(Semaphore_t * semaphore, uint32_t maxCount, uint32_t initialCount)
+{
+    if (semaphore == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    *semaphore = xSemaphoreCreateCounting(maxCount, initialCount);
+    return *semaphore ? 0 : -1;
+}
+
+int OSAL_GiveCountingSemaphore(Semaphore_t * semaphore)
+{
+    if (semaphore == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    return xSemaphoreGive(*semaphore) == pdTRUE ? 0 : -1;
+}
+
+int OSAL_TakeCountingSemaphore(Semaphore_t * semaphore, uint32_t timeoutMs)
+{
+    if (semaphore == NULL)
+    {
+        errno = EBADR;
+        return -1;
+    }
+    if (xSemaphoreTake(*semaphore, pdMS_TO_TICKS(timeoutMs)) != pdTRUE)
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+static OSAL_PowerEventCallback_t powerEventCallback = NULL;
+static volatile OSAL_PowerEvent_e lastPowerEvent = OSAL_POWER_MAINS_RESTORED;
+
+void OSAL_RegisterPowerEventCallback(OSAL_PowerEventCallback_t callback)
+{
+    powerEventCallback = callback;
+    OSAL_PowerEvent_e event = lastPowerEvent;
+    if ((callback != NULL) && (event != OSAL_POWER_MAINS_RESTORED))
+    {
+        callback(event);
+    }
+}
+
+void OSAL_NotifyPowerEvent(OSAL_PowerEvent_e event)
+{
+    lastPowerEvent = event;
+    OSAL_PowerEventCallback_t callback = powerEventCallback;
+    if (callback != NULL)
+    {
+        callback(event);
+    }
+}
@@ -0,0 +1,483 @@
+/*!****************************************************************************
+* \file OSAL_LogDeferred.c
+*
+* \brief Deferred (binary) logging for FreeRTOS.
+*
+* When LOG_DEFERRED is set the LOG_* macros do not format anything on the
+* calling task. The call site places its format string in the .log_fmt
+* section and OSAL_LogDeferred() only copies a small binary record - level,
+* timestamp, format and function addresses, raw argument values - into a
+* ring buffer owned by the calling task. The log output task drains the rings
+* and writes the records to the debug UART, framed so that LOG_Decode.py can
+* rebuild the text on the host from the same ELF image.
+*
+* Each task has its own single producer / single consumer ring so that the
+* hot path takes no lock. When a ring is full the record is dropped and
+* counted, the drain reports the count so a gap in the log is never silent.
+*
+* Copyright (C) 2016 Intamac Ltd - All Rights Reserved.
+* Unauthorized copying of this file, via any medium is strictly prohibited
+*
+*****************************************************************************/
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "OSAL_Api.h"
+#include "LOG_Api.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "fsl_debug_console.h"
+#include "tinyprintf.h"
+
+
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+// Ring size for each task, must be a power of 2
+#define LOG_DEFERRED_RING_SIZE      1024
+// Ring shared by all interrupt handlers, must be a power of 2
+#define LOG_DEFERRED_ISR_RING_SIZE  512
+// Largest record, header included
+#define LOG_DEFERRED_MAX_RECORD     128
+// Longest string argument copied into a record
+#define LOG_DEFERRED_MAX_STRING     48
+// Thread local storage slot used for the task's ring
+#define LOG_DEFERRED_TLS_INDEX      0
+
+// Frame marker written in front of every record on the UART
+#define LOG_DEFERRED_MAGIC_0        0xFE
+#define LOG_DEFERRED_MAGIC_1        0xED
+
+// Record flags
+#define LOG_DEFERRED_FLAG_TRUNCATED 0x01   // Some arguments did not fit
+#define LOG_DEFERRED_FLAG_ISR       0x02   // Logged from an interrupt handler
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+/**
+ * Record header, followed by the arguments. All fields are little endian,
+ * the layout must match LOG_Decode.py.
+ */
+typedef struct __attribute__((packed))
+{
+    uint16_t length;        // Whole record, header included
+    uint8_t  level;         // LOG_Level_e
+    uint8_t  flags;
+    uint32_t timeMs;
+    uint32_t format;        // Address of the format string in .log_fmt
+    uint32_t function;      // Address of __func__
+} LogRecordHeader_t;
+
+/**
+ * Single producer / single consumer ring. head is only written by the
+ * producer and tail only by the log output task, both run freely and are
+ * reduced modulo the ring size on access.
+ */
+typedef struct LogRing_tag
+{
+    struct LogRing_tag * next;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;       // Written by the producer
+    uint32_t reported;      // Written by the log output task
+    uint32_t size;
+    uint8_t * data;
+} LogRing_t;
+
+/*!****************************************************************************
+ * Private Data
+ *****************************************************************************/
+
+extern QueueHandle_t debugQueue;
+extern SemaphoreHandle_t log_mutex;
+
+static const char * const _levelNames[] = { "ERR", "WAR", "INF", "TRC", "MEM" };
+
+// All task rings, new rings are pushed on the front and never removed
+static LogRing_t * _rings;
+
+static uint8_t _isrRingData[LOG_DEFERRED_ISR_RING_SIZE];
+static LogRing_t _isrRing = { .size = LOG_DEFERRED_ISR_RING_SIZE, .data = _isrRingData };
+
+/*!****************************************************************************
+ * Private Functions
+ *****************************************************************************/
+
+static void _OSAL_LogPutf(void * unused, char c)
+{
+    (void)(unused);
+    PUTCHAR(c);
+}
+
+/**
+ * \brief   Format the message immediately, used until the log output task
+ *          is running to drain the rings
+ */
+static void _OSAL_LogText(uint8_t level, const char * function, const char * format, va_list args)
+{
+    uint32_t ms = OSAL_time_ms();
+    bool locked = (log_mutex != NULL) && (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) && !xPortIsInsideInterrupt();
+
+    if (locked)
+    {
+        xSemaphoreTake(log_mutex, portMAX_DELAY);
+    }
+    OSAL_printf("%5d.%03d %s %s: ", ms / 1000, ms % 1000,
+                level < (sizeof _levelNames / sizeof _levelNames[0]) ? _levelNames[level] : "???", function);
+    tfp_format(NULL, _OSAL_LogPutf, format, args);
+    OSAL_printf("\n\r");
+    if (locked)
+    {
+        xSemaphoreGive(log_mutex);
+    }
+}
+
+static bool _OSAL_LogPack(uint8_t * record, size_t * used, const void * value, size_t size)
+{
+    if (*used + size > LOG_DEFERRED_MAX_RECORD)
+    {
+        return false;
+    }
+    memcpy(record + *used, value, size);
+    *used += size;
+    return true;
+}
+
+/**
+ * \brief   Copy the arguments described by the format string into the record
+ *
+ * Integers are stored with their C size, doubles as 8 bytes and strings as
+ * a length byte followed by the characters (no terminator).
+ *
+ * \return  false if the record was truncated
+ */
+static bool _OSAL_LogPackArguments(uint8_t * record, size_t * used, const char * format, va_list * args)
+{
+    for (const char * p = format; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p++;
+        if (*p == '%')
+        {
+            continue;
+        }
+
+        // Flags
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+        {
+            p++;
+        }
+        // Width and precision, '*' takes an int argument
+        for (int field = 0; field < 2; field++)
+        {
+            if (field == 1)
+            {
+                if (*p != '.')
+                {
+                    break;
+                }
+                p++;
+            }
+            if (*p == '*')
+            {
+                int star = va_arg(*args, int);
+                if (!_OSAL_LogPack(record, used, &star, sizeof star))
+                {
+                    return false;
+                }
+                p++;
+            }
+            else
+            {
+                while (*p >= '0' && *p <= '9')
+                {
+                    p++;
+                }
+            }
+        }
+        // Length modifier
+        size_t size = sizeof(int);
+        int longs = 0;
+        for (;; p++)
+        {
+            if (*p == 'l')
+            {
+                size = (++longs > 1) ? sizeof(long long) : sizeof(long);
+            }
+            else if (*p == 'q' || *p == 'j')
+            {
+                size = sizeof(long long);
+            }
+            else if (*p == 'z' || *p == 't')
+            {
+                size = sizeof(size_t);
+            }
+            else if (*p != 'h' && *p != 'L')
+            {
+                break;
+            }
+        }
+
+        bool packed = true;
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            case 'c':
+                if (size == sizeof(long long))
+                {
+                    long long value = va_arg(*args, long long);
+                    packed = _OSAL_LogPack(record, used, &value, sizeof value);
+                }
+                else
+                {
+                    int value = va_arg(*args, int);
+                    packed = _OSAL_LogPack(record, used, &value, sizeof value);
+                }
+                break;
+
+            case 'p':
+            {
+                uint32_t value = (uint32_t)(uintptr_t)va_arg(*args, void *);
+                packed = _OSAL_LogPack(record, used, &value, sizeof value);
+                break;
+            }
+
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                double value = va_arg(*args, double);
+                packed = _OSAL_LogPack(record, used, &value, sizeof value);
+                break;
+            }
+
+            case 's':
+            {
+                const char * value = va_arg(*args, const char *);
+                if (value == NULL)
+                {
+                    value = "(null)";
+                }
+                size_t length = strnlen(value, LOG_DEFERRED_MAX_STRING);
+                if (*used + 1 + length > LOG_DEFERRED_MAX_RECORD)
+                {
+                    // Keep what fits of the string, it is often the useful part
+                    if (*used + 1 >= LOG_DEFERRED_MAX_RECORD)
+                    {
+                        return false;
+                    }
+                    length = LOG_DEFERRED_MAX_RECORD - *used - 1;
+                    packed = false;
+                }
+                record[(*used)++] = (uint8_t)length;
+                memcpy(record + *used, value, length);
+                *used += length;
+                break;
+            }
+
+            case '\0':
+                // Stray '%' at the end of the format
+                return true;
+
+            default:
+                break;
+        }
+        if (!packed)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void _OSAL_LogPut(LogRing_t * ring, const uint8_t * record, uint32_t length)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (ring->size - (head - tail) < length)
+    {
+        ring->dropped++;
+        return;
+    }
+
+    uint32_t offset = head & (ring->size - 1);
+    uint32_t first = ring->size - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(ring->data + offset, record, first);
+    memcpy(ring->data, record + first, length - first);
+
+    __atomic_store_n(&ring->head, head + length, __ATOMIC_RELEASE);
+}
+
+static void _OSAL_LogGet(const LogRing_t * ring, uint32_t position, uint8_t * out, uint32_t length)
+{
+    uint32_t offset = position & (ring->size - 1);
+    uint32_t first = ring->size - offset;
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(out, ring->data + offset, first);
+    memcpy(out + first, ring->data, length - first);
+}
+
+/**
+ * \brief   Get the calling task's ring, allocating it on first use
+ */
+static LogRing_t * _OSAL_LogTaskRing(void)
+{
+    LogRing_t * ring = pvTaskGetThreadLocalStoragePointer(NULL, LOG_DEFERRED_TLS_INDEX);
+    if (ring == NULL)
+    {
+        ring = pvPortMalloc(sizeof(LogRing_t) + LOG_DEFERRED_RING_SIZE);
+        if (ring != NULL)
+        {
+            memset(ring, 0, sizeof(LogRing_t));
+            ring->size = LOG_DEFERRED_RING_SIZE;
+            ring->data = (uint8_t *)(ring + 1);
+
+            taskENTER_CRITICAL();
+            ring->next = _rings;
+            __atomic_store_n(&_rings, ring, __ATOMIC_RELEASE);
+            taskEXIT_CRITICAL();
+
+            vTaskSetThreadLocalStoragePointer(NULL, LOG_DEFERRED_TLS_INDEX, ring);
+        }
+    }
+    return ring;
+}
+
+static void _OSAL_LogDrainRing(LogRing_t * ring)
+{
+    uint8_t record[LOG_DEFERRED_MAX_RECORD];
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while (tail != head)
+    {
+        uint16_t length;
+        _OSAL_LogGet(ring, tail, (uint8_t *)&length, sizeof length);
+        _OSAL_LogGet(ring, tail, record, length);
+        tail += length;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        PUTCHAR(LOG_DEFERRED_MAGIC_0);
+        PUTCHAR(LOG_DEFERRED_MAGIC_1);
+        for (uint32_t i = 0; i < length; i++)
+        {
+            PUTCHAR(record[i]);
+        }
+    }
+
+    uint32_t dropped = ring->dropped;
+    if (dropped != ring->reported)
+    {
+        OSAL_printf(LOG_RED "%d log records dropped" LOG_NONE "\n\r", dropped - ring->reported);
+        ring->reported = dropped;
+    }
+}
+
+/*!****************************************************************************
+ * Public Functions
+ *****************************************************************************/
+
+/**
+ * \brief   Record a log message for later formatting, normally called using
+ *          the LOG_* macros with LOG_DEFERRED set
+ *
+ * \param   level    - LOG_Level_e of the message
+ * \param   function - name of the calling function
+ * \param   format   - printf format string, must live in .log_fmt
+ * \param   ...      - varargs for printf
+ */
+void OSAL_LogDeferred(uint8_t level, const char * function, const char * format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    if ((debugQueue == NULL) || (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING))
+    {
+        // Nothing is draining the rings yet
+        _OSAL_LogText(level, function, format, args);
+        va_end(args);
+        return;
+    }
+
+    uint8_t record[LOG_DEFERRED_MAX_RECORD] __attribute__((aligned(4)));
+    LogRecordHeader_t * header = (LogRecordHeader_t *)record;
+    size_t used = sizeof(LogRecordHeader_t);
+    bool isr = xPortIsInsideInterrupt();
+
+    header->level = level;
+    header->flags = isr ? LOG_DEFERRED_FLAG_ISR : 0;
+    header->timeMs = OSAL_time_ms();
+    header->format = (uint32_t)(uintptr_t)format;
+    header->function = (uint32_t)(uintptr_t)function;
+    if (!_OSAL_LogPackArguments(record, &used, format, &args))
+    {
+        header->flags |= LOG_DEFERRED_FLAG_TRUNCATED;
+    }
+    header->length = (uint16_t)used;
+    va_end(args);
+
+    if (isr)
+    {
+        UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+        _OSAL_LogPut(&_isrRing, record, used);
+        taskEXIT_CRITICAL_FROM_ISR(mask);
+    }
+    else
+    {
+        LogRing_t * ring = _OSAL_LogTaskRing();
+        if (ring != NULL)
+        {
+            _OSAL_LogPut(ring, record, used);
+        }
+    }
+}
+
+/**
+ * \brief   Write all pending deferred records to the debug UART, called
+ *          periodically by the log output task
+ */
+void OSAL_LogDrain(void)
+{
+    if (log_mutex != NULL)
+    {
+        xSemaphoreTake(log_mutex, portMAX_DELAY);
+    }
+
+    _OSAL_LogDrainRing(&_isrRing);
+    for (LogRing_t * ring = __atomic_load_n(&_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        _OSAL_LogDrainRing(ring);
+    }
+
+    if (log_mutex != NULL)
+    {
+        xSemaphoreGive(log_mutex);
+    }
+}
@@ -2,8 +2,11 @@
  * Includes
  ******************************************************************************/
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 
 #include "lwip/opt.h"
 #include "lwip/debug.h"
@@ -14,6 +17,7 @@
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/md5.h"
+#include "mbedtls/sha256.h"
 #include "fsl_debug_console.h"
 #include "mbedtls/net_sockets.h"
 #include "LOG_Api.h"
@@ -22,10 +26,18 @@
 //#include "imx_CRC_ea3_wsgw.h"
 #include <SPI_Flash.issi_32mbit.h>
 #include "ota.h"
+#include "UPG_Delta.h"
+#include "UPG_Verify.h"
+#include "UPG_SigningKey.h"
 #include "imx_fcb.h"
 
 #include "SPI_Flash.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+
 
 
 /*******************************************************************************
@@ -35,7 +47,96 @@
 /* This is the value used for ssl read timeout */
 #define IOT_SSL_READ_TIMEOUT	10
 
+/* Sector buffers between the network and the flash writer */
+#define OTA_RING_SLOTS          4
+
+/* Number of sectors the writer erases ahead of the data it programs */
+#define OTA_ERASE_AHEAD         4
+
+#define OTA_WRITER_STACK_SIZE   (configMINIMAL_STACK_SIZE * 8)
+
+#define OTA_HASH_SIZE           32
+
+/* Attempts in a row without progress before a download is given up */
+#define OTA_MAX_ATTEMPTS        8
+
+/* Pause before another attempt, times the number of attempts so far */
+#ifndef OTA_RETRY_DELAY_MS
+#define OTA_RETRY_DELAY_MS      2000
+#endif
+
+/* Programmed bytes between progress records */
+#define OTA_CHECKPOINT_BYTES    (16 * FLASH_SECTOR_SIZE)
+
+#define OTA_RESUME_MAGIC        0x5241544F      // "OTAR"
+#define OTA_RESUME_VERSION      1
+#define OTA_RESUME_SECTORS      (FLASHMAP_IMAGE_SIZE / FLASH_SECTOR_SIZE)
+
+#define OTA_ETAG_SIZE           64
+
+
+
+/*******************************************************************************
+* Types
+******************************************************************************/
+
+/* One sector of image data on its way to flash */
+typedef struct
+{
+    uint8_t data[FLASH_SECTOR_SIZE];
+    uint32_t length;
+} OtaSlot_t;
+
+/*
+ * Progress of a download, kept at FLASHMAP_OTA_RESUME_SECTOR so that it can
+ * carry on after a reboot. Hash state cannot be saved, so each programmed
+ * sector has a CRC and the state is rebuilt from what survived in flash.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint8_t request[OTA_HASH_SIZE];     // Identifies the download, see otaRequestId
+    char etag[OTA_ETAG_SIZE];           // Entity tag of the file, empty if none
+    uint32_t imageOffset;               // Partition being written
+    uint32_t contentLength;             // Bytes of the whole file
+    uint32_t programmed;                // Bytes of the partition programmed
+    uint32_t sectorCrc[OTA_RESUME_SECTORS];
+    uint32_t crc;                       // CRC32 of the record up to here
+} OtaResume_t;
 
+/*
+ * Download stream. The receiver fills slots as TLS records arrive and hands
+ * them to the writer task, which erases ahead of its cursor and programs and
+ * verifies each sector while the next ones are being received.
+ */
+typedef struct
+{
+    uint32_t imageOffset;           // Start of the target partition
+    uint32_t eraseCursor;           // Bytes of the partition erased so far
+    uint32_t writeCursor;           // Bytes of the image programmed so far
+    uint32_t imageLength;           // Bytes of the image, once known
+    OtaSlot_t* slots;
+    OtaSlot_t* filling;             // Slot the receiver is filling
+    QueueHandle_t freeSlots;        // Slots ready to be filled
+    QueueHandle_t fullSlots;        // Slots ready to be programmed, NULL ends the stream
+    SemaphoreHandle_t writerDone;
+    bool writerRunning;
+    volatile int writerStatus;      // First flash error, 0 if none
+    mbedtls_sha256_context sha;
+    UPG_Verify_t* verify;           // SJHF verifier, NULL for a raw image
+    UPG_Delta_t* delta;             // Patch applier, once a DLTA segment arrives
+    uint32_t operationalBytes;      // Bytes of the OPER part passed to the writer
+    uint32_t fileOffset;            // Bytes of the file received
+    uint32_t contentLength;         // Bytes of the whole file, once known
+    char etag[OTA_ETAG_SIZE];       // Entity tag of the file, empty if none
+    uint8_t request[OTA_HASH_SIZE]; // Identifies the download, see otaRequestId
+    OtaResume_t* resume;            // Progress record, NULL if it could not be allocated
+    bool resumable;                 // Flash holds nothing but the file, in order
+    bool replay;                    // Header to fetch again before replaying the flash
+    bool recorded;                  // A record may be in flash
+    uint32_t checkpoint;            // Programmed bytes at the last record
+} OtaStream_t;
 
 
 /*******************************************************************************
@@ -52,15 +153,18 @@
 TLSDataParams tlsDataParams;
 char* md5Resource = NULL;
 unsigned char* httpsBuffer = NULL;
-unsigned char* imageBuffer = NULL;
 int imageSize = 0;
 
-const char MARKER_OK[] = "HTTP/1.1 200 OK";
+const char MARKER_HTTP[] = "HTTP/1.";
 const char MARKER_HEADER_END[] = "\r\n\r\n";
-const char MARKER_CONTENT_LENGTH[] = "Content-Length: ";
+const char MARKER_CONTENT_LENGTH[] = "Content-Length:";
+const char MARKER_CONTENT_RANGE[] = "Content-Range:";
+const char MARKER_ETAG[] = "ETag:";
 const char BIN_EXTENSION[] = ".imx";
 const char HASH_EXTENSION[] = ".md5";
 
+static const uint8_t signingKey[UPG_VERIFY_PUBLIC_KEY_BYTES] = UPG_SIGNING_KEY;
+
 uint32_t erase_image( uint32_t imageOffset ,uint32_t image_size);
 
 /*******************************************************************************
@@ -339,19 +443,8 @@ int initOTA()
         LOG_Error("malloc failed");
         return -1;
     }
-    memset(httpsBuffer, 0x00, sizeof(httpsBuffer));
+    memset(httpsBuffer, 0x00, MBEDTLS_SSL_MAX_CONTENT_LEN);
 
-////Nishi
-    #if 1
-    imageBuffer = malloc(FLASHMAP_IMAGE_SIZE);
-    LOG_Trace("imageBuffer = %p", imageBuffer);
-    if (imageBuffer == NULL)
-    {
-        LOG_Error("malloc failed");
-        return -1;
-    }
-    memset(imageBuffer, 0xFF, sizeof(imageBuffer));
-#endif 
     return 0;
 }
 
@@ -359,64 +452,771 @@ int initOTA()
 
 void releaseOTA()
 {
-    if (imageBuffer)
-        free(imageBuffer);
     if (httpsBuffer)
         free(httpsBuffer);
+    httpsBuffer = NULL;
     if (md5Resource)
         free(md5Resource);
+    md5Resource = NULL;
+}
+
+
+
+/* Erase the next sector ahead of the writer */
+static int otaEraseNext(OtaStream_t* stream)
+{
+    uint32_t eraseAddress = stream->imageOffset + stream->eraseCursor;
+    if (SPI_Flash_Erase(eraseAddress) != kStatus_Success)
+    {
+        LOG_Error("Erase sector failure @ 0x%08x", eraseAddress);
+        return -1;
+    }
+    stream->eraseCursor += FLASH_SECTOR_SIZE;
+    return 0;
+}
+
+
+
+/* Program one slot at the write cursor and read it back */
+static int otaProgramSlot(OtaStream_t* stream, OtaSlot_t* slot)
+{
+    if (stream->writeCursor + slot->length > FLASHMAP_IMAGE_SIZE)
+    {
+        LOG_Error("Image does not fit in partition");
+        return -1;
+    }
+
+    while (stream->eraseCursor < stream->writeCursor + slot->length)
+    {
+        if (otaEraseNext(stream) < 0)
+        {
+            return -1;
+        }
+    }
+
+    uint32_t address = stream->imageOffset + stream->writeCursor;
+    if (SPI_Flash_Write(address, slot->data, slot->length) != 0)
+    {
+        return -1;
+    }
+
+    uint8_t flashData[FLASH_PAGE_SIZE];
+    for (uint32_t done = 0; done < slot->length; done += sizeof(flashData))
+    {
+        uint32_t len = slot->length - done;
+        if (len > sizeof(flashData))
+        {
+            len = sizeof(flashData);
+        }
+        SPI_Flash_Read(address + done, flashData, len);
+        if (memcmp(&slot->data[done], flashData, len) != 0)
+        {
+            LOG_Error("Verification failed @ 0x%08x", address + done);
+            return -1;
+        }
+    }
+
+    if (stream->resume && slot->length == FLASH_SECTOR_SIZE)
+    {
+        stream->resume->sectorCrc[stream->writeCursor / FLASH_SECTOR_SIZE] =
+            OSAL_Crc32(0, slot->data, FLASH_SECTOR_SIZE);
+    }
+    stream->writeCursor += slot->length;
+    return 0;
+}
+
+
+
+/* Record progress so that the download can carry on after a reboot */
+static void otaCheckpoint(OtaStream_t* stream)
+{
+    OtaResume_t* resume = stream->resume;
+
+    resume->magic = OTA_RESUME_MAGIC;
+    resume->version = OTA_RESUME_VERSION;
+    memcpy(resume->request, stream->request, OTA_HASH_SIZE);
+    memcpy(resume->etag, stream->etag, OTA_ETAG_SIZE);
+    resume->imageOffset = stream->imageOffset;
+    resume->contentLength = stream->contentLength;
+    resume->programmed = stream->writeCursor;
+    resume->crc = OSAL_Crc32(0, resume, offsetof(OtaResume_t, crc));
+
+    stream->recorded = true;
+    if (SPI_Flash_Erase(FLASHMAP_OTA_RESUME_SECTOR) != kStatus_Success ||
+        SPI_Flash_Write(FLASHMAP_OTA_RESUME_SECTOR, (uint8_t*)resume, sizeof(*resume)) != 0)
+    {
+        LOG_Warning("Could not record download progress");
+    }
+    stream->checkpoint = stream->writeCursor;
+}
+
+
+
+/* Forget any download in progress */
+static void otaResumeClear(void)
+{
+    SPI_Flash_Erase(FLASHMAP_OTA_RESUME_SECTOR);
+}
+
+
+
+/*
+ * Pick up a download interrupted by a reboot. Only sectors that still match
+ * their CRC are kept. A raw image's hash is rebuilt as they are read; a
+ * signed image needs its header again before the rest can be replayed
+ * through the verifier, see otaResumeReplay.
+ */
+static void otaResumeLoad(OtaStream_t* stream, bool signedImage)
+{
+    OtaResume_t* saved = malloc(sizeof(OtaResume_t));
+    uint8_t* sector = stream->slots[0].data;
+
+    if (saved == NULL)
+    {
+        return;
+    }
+    SPI_Flash_Read(FLASHMAP_OTA_RESUME_SECTOR, (uint8_t*)saved, sizeof(*saved));
+    if (saved->magic != OTA_RESUME_MAGIC || saved->version != OTA_RESUME_VERSION ||
+        saved->crc != OSAL_Crc32(0, saved, offsetof(OtaResume_t, crc)))
+    {
+        free(saved);
+        return;
+    }
+    stream->recorded = true;
+
+    if (memcmp(saved->request, stream->request, OTA_HASH_SIZE) != 0 ||
+        saved->imageOffset != stream->imageOffset ||
+        saved->programmed % FLASH_SECTOR_SIZE != 0 ||
+        saved->programmed > FLASHMAP_IMAGE_SIZE ||
+        saved->programmed >= saved->contentLength)
+    {
+        LOG_Info("Not resuming: the saved download is for another image");
+        free(saved);
+        return;
+    }
+
+    uint32_t programmed = 0;
+    while (programmed < saved->programmed)
+    {
+        SPI_Flash_Read(stream->imageOffset + programmed, sector, FLASH_SECTOR_SIZE);
+        if (OSAL_Crc32(0, sector, FLASH_SECTOR_SIZE) != saved->sectorCrc[programmed / FLASH_SECTOR_SIZE])
+        {
+            LOG_Warning("Sector @ 0x%08x does not match its record", (unsigned)(stream->imageOffset + programmed));
+            break;
+        }
+        if (!signedImage)
+        {
+            mbedtls_sha256_update(&stream->sha, sector, FLASH_SECTOR_SIZE);
+        }
+        programmed += FLASH_SECTOR_SIZE;
+    }
+
+    if (programmed > 0)
+    {
+        memcpy(stream->resume->sectorCrc, saved->sectorCrc, sizeof(saved->sectorCrc));
+        memcpy(stream->etag, saved->etag, OTA_ETAG_SIZE);
+        stream->etag[OTA_ETAG_SIZE - 1] = '\0';
+        stream->contentLength = saved->contentLength;
+        stream->writeCursor = programmed;
+        stream->eraseCursor = programmed;
+        stream->checkpoint = programmed;
+        if (signedImage)
+        {
+            stream->operationalBytes = programmed;
+            stream->replay = true;
+        }
+        else
+        {
+            stream->imageLength = saved->contentLength;
+            stream->fileOffset = programmed;
+        }
+        LOG_Info("Resuming download with %u of %u bytes in flash", (unsigned)programmed, (unsigned)saved->contentLength);
+    }
+    free(saved);
+}
+
+
+
+/*
+ * Flash writer task. Programs slots in order; while there is nothing to
+ * program it erases up to OTA_ERASE_AHEAD sectors ahead of the write cursor.
+ * After an error it keeps returning slots so that the receiver never blocks.
+ */
+static void otaWriterTask(void* arg)
+{
+    OtaStream_t* stream = arg;
+
+    for (;;)
+    {
+        uint32_t eraseLimit = stream->writeCursor + OTA_ERASE_AHEAD * FLASH_SECTOR_SIZE;
+        if (stream->imageLength && eraseLimit > stream->imageLength)
+        {
+            eraseLimit = stream->imageLength;
+        }
+        if (eraseLimit > FLASHMAP_IMAGE_SIZE)
+        {
+            eraseLimit = FLASHMAP_IMAGE_SIZE;
+        }
+        bool eraseAhead = stream->writerStatus == 0 && stream->eraseCursor < eraseLimit;
+
+        OtaSlot_t* slot;
+        if (xQueueReceive(stream->fullSlots, &slot, eraseAhead ? 0 : portMAX_DELAY) != pdTRUE)
+        {
+            if (otaEraseNext(stream) < 0)
+            {
+                stream->writerStatus = -1;
+            }
+            continue;
+        }
+
+        if (slot == NULL)
+        {
+            break;
+        }
+
+        if (stream->writerStatus == 0 && otaProgramSlot(stream, slot) < 0)
+        {
+            stream->writerStatus = -1;
+        }
+        else if (stream->writerStatus == 0 && stream->resume && stream->resumable &&
+                 stream->writeCursor % FLASH_SECTOR_SIZE == 0 &&
+                 stream->writeCursor - stream->checkpoint >= OTA_CHECKPOINT_BYTES)
+        {
+            otaCheckpoint(stream);
+        }
+        xQueueSend(stream->freeSlots, &slot, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(stream->writerDone);
+    vTaskDelete(NULL);
+}
+
+
+
+/* Set up the slots, pick up any interrupted download and start the writer */
+static int otaStreamBegin(OtaStream_t* stream, uint32_t imageOffset,
+                          const uint8_t request[OTA_HASH_SIZE], bool signedImage)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->imageOffset = imageOffset;
+    memcpy(stream->request, request, OTA_HASH_SIZE);
+    stream->resumable = !signedImage;
+    mbedtls_sha256_init(&stream->sha);
+    mbedtls_sha256_starts(&stream->sha, 0);
+
+    stream->resume = malloc(sizeof(OtaResume_t));
+    if (stream->resume)
+    {
+        memset(stream->resume, 0, sizeof(OtaResume_t));
+    }
+    else
+    {
+        LOG_Warning("No memory to record download progress");
+    }
+
+    stream->slots = malloc(OTA_RING_SLOTS * sizeof(OtaSlot_t));
+    stream->freeSlots = xQueueCreate(OTA_RING_SLOTS, sizeof(OtaSlot_t*));
+    stream->fullSlots = xQueueCreate(OTA_RING_SLOTS + 1, sizeof(OtaSlot_t*));
+    stream->writerDone = xSemaphoreCreateBinary();
+    if (!stream->slots || !stream->freeSlots || !stream->fullSlots || !stream->writerDone)
+    {
+        LOG_Error("OTA stream allocation failed");
+        return -1;
+    }
+
+    for (int i = 0; i < OTA_RING_SLOTS; i++)
+    {
+        OtaSlot_t* slot = &stream->slots[i];
+        xQueueSend(stream->freeSlots, &slot, 0);
+    }
+
+    if (stream->resume)
+    {
+        otaResumeLoad(stream, signedImage);
+    }
+
+    if (xTaskCreate(otaWriterTask, "ota_writer", OTA_WRITER_STACK_SIZE, stream,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS)
+    {
+        LOG_Error("OTA writer task creation failed");
+        return -1;
+    }
+    stream->writerRunning = true;
+
+    return 0;
+}
+
+
+
+/* Hand the slot being filled to the writer */
+static int otaStreamFlush(OtaStream_t* stream)
+{
+    if (stream->filling && stream->filling->length)
+    {
+        xQueueSend(stream->fullSlots, &stream->filling, portMAX_DELAY);
+        stream->filling = NULL;
+    }
+    return stream->writerStatus;
+}
+
+
+
+/* Pass image data to the writer */
+static int otaStreamProgram(OtaStream_t* stream, const uint8_t* data, size_t len)
+{
+    while (len > 0)
+    {
+        if (stream->filling == NULL)
+        {
+            if (stream->writerStatus != 0)
+            {
+                return stream->writerStatus;
+            }
+            xQueueReceive(stream->freeSlots, &stream->filling, portMAX_DELAY);
+            stream->filling->length = 0;
+        }
+
+        size_t space = FLASH_SECTOR_SIZE - stream->filling->length;
+        size_t chunk = len < space ? len : space;
+        memcpy(&stream->filling->data[stream->filling->length], data, chunk);
+        stream->filling->length += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if (stream->filling->length == FLASH_SECTOR_SIZE && otaStreamFlush(stream) != 0)
+        {
+            return stream->writerStatus;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/* Pass operational image data to the writer */
+static int otaProgramOperational(OtaStream_t* stream, const uint8_t* data, size_t len)
+{
+    if (stream->operationalBytes + len > FLASHMAP_IMAGE_SIZE)
+    {
+        LOG_Error("Image does not fit in partition");
+        return -1;
+    }
+    stream->operationalBytes += len;
+    return otaStreamProgram(stream, data, len);
+}
+
+
+
+/* Patch source: the active partition, the one not being written */
+static int otaReadActive(void* context, uint32_t offset, uint8_t* data, size_t len)
+{
+    OtaStream_t* stream = context;
+    uint32_t activeOffset = stream->imageOffset == FLASHMAP_IMAGE_A_OFFSET ?
+                            FLASHMAP_IMAGE_B_OFFSET : FLASHMAP_IMAGE_A_OFFSET;
+
+    if (offset + len > FLASHMAP_IMAGE_SIZE)
+    {
+        return -1;
+    }
+    return SPI_Flash_Read(activeOffset + offset, data, len);
+}
+
+
+
+/* Patch sink: the rebuilt image */
+static int otaDeltaSink(void* context, const uint8_t* data, size_t len)
+{
+    OtaStream_t* stream = context;
+
+    stream->imageLength = stream->delta->targetBytes;
+    return otaProgramOperational(stream, data, len);
+}
+
+
+
+/*
+ * Verifier sink: only the operational part goes to the partition. It is
+ * either the image itself or a single DLTA segment patching the active
+ * image, which is applied as it arrives.
+ */
+static int otaVerifySink(void* context, const firmware_part_t* part, const firmware_segment_t* segment,
+                         const uint8_t* data, size_t len)
+{
+    OtaStream_t* stream = context;
+
+    if (memcmp(part->fourcc, FIRMWARE_FOURCC_OPERATIONAL, 4) != 0)
+    {
+        return 0;
+    }
+
+    if (memcmp(segment->fourcc, FIRMWARE_FOURCC_DELTA, 4) == 0)
+    {
+        if (stream->delta == NULL)
+        {
+            if (stream->operationalBytes != 0)
+            {
+                LOG_Error("Image mixes a patch with image data");
+                return -1;
+            }
+            stream->delta = malloc(sizeof(UPG_Delta_t));
+            if (stream->delta == NULL)
+            {
+                LOG_Error("No memory for the patch");
+                return -1;
+            }
+            UPG_DeltaInit(stream->delta, otaReadActive, otaDeltaSink, stream);
+            LOG_Info("Applying patch to the active image");
+        }
+        return UPG_DeltaWrite(stream->delta, data, len) == UPGRADE_ERR_NONE ? 0 : -1;
+    }
+
+    if (stream->delta != NULL)
+    {
+        LOG_Error("Image mixes a patch with image data");
+        return -1;
+    }
+    stream->imageLength = part->bytes;
+    return otaProgramOperational(stream, data, len);
+}
+
+
+
+static uint32_t otaPadded(uint32_t bytes)
+{
+    return (bytes + FIRMWARE_ENC_BLK_BYTES - 1) & ~(uint32_t)(FIRMWARE_ENC_BLK_BYTES - 1);
+}
+
+
+
+/*
+ * A signed download can only be picked up from flash when the partition
+ * holds the start of the first part as it is in the file, not a patched
+ * image or data from further on.
+ */
+static bool otaSignedResumable(const UPG_Verify_t* verify)
+{
+    if (verify->partIndex != 0 || memcmp(verify->part.fourcc, FIRMWARE_FOURCC_OPERATIONAL, 4) != 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < FIRMWARE_NR_SEGS; i++)
+    {
+        if (memcmp(verify->part.segs[i].fourcc, FIRMWARE_FOURCC_DELTA, 4) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+/*
+ * Bring the verifier up to what is already in flash, once it has the
+ * header again. Segment padding is not in flash and is put back, so the
+ * download carries on from the file offset the flash accounts for.
+ */
+static int otaResumeReplay(OtaStream_t* stream)
+{
+    UPG_Verify_t* verify = stream->verify;
+    uint32_t flashOffset = 0;
+
+    stream->replay = false;
+    stream->imageLength = verify->part.bytes;
+    if (verify->state != UPG_VERIFY_DATA || !otaSignedResumable(verify))
+    {
+        LOG_Error("Image does not match the saved download");
+        return -1;
+    }
+
+    for (int i = 0; i < FIRMWARE_NR_SEGS && flashOffset < stream->writeCursor; i++)
+    {
+        uint32_t bytes = verify->part.segs[i].bytes;
+        uint32_t padded = otaPadded(bytes);
+        if (bytes > stream->writeCursor - flashOffset)
+        {
+            bytes = stream->writeCursor - flashOffset;
+            padded = bytes;
+        }
+
+        for (uint32_t done = 0; done < padded; )
+        {
+            uint32_t chunk = padded - done;
+            if (chunk > MBEDTLS_SSL_MAX_CONTENT_LEN)
+            {
+                chunk = MBEDTLS_SSL_MAX_CONTENT_LEN;
+            }
+            memset(httpsBuffer, 0xFF, chunk);
+            if (done < bytes)
+            {
+                SPI_Flash_Read(stream->imageOffset + flashOffset + done, httpsBuffer,
+                               bytes - done < chunk ? bytes - done : chunk);
+            }
+            if (UPG_VerifyReplay(verify, httpsBuffer, chunk) != UPGRADE_ERR_NONE)
+            {
+                LOG_Error("Image in flash rejected: %s", verify->reason);
+                return -1;
+            }
+            done += chunk;
+        }
+        flashOffset += bytes;
+        stream->fileOffset += padded;
+    }
+
+    if (flashOffset != stream->writeCursor)
+    {
+        LOG_Error("Image does not match the saved download");
+        return -1;
+    }
+    LOG_Info("Resuming download at %u of %u bytes", (unsigned)stream->fileOffset, (unsigned)stream->contentLength);
+    return 0;
 }
 
 
 
-int sendRequest(char* resource,char *host)
+/* Add received file data to the stream */
+static int otaStreamWrite(OtaStream_t* stream, const uint8_t* data, size_t len)
+{
+    if (stream->verify)
+    {
+        bool header = stream->verify->state == UPG_VERIFY_HEADER;
+        if (UPG_VerifyWrite(stream->verify, data, len) != UPGRADE_ERR_NONE)
+        {
+            return -1;
+        }
+        if (header && stream->verify->state == UPG_VERIFY_DATA)
+        {
+            stream->resumable = otaSignedResumable(stream->verify);
+        }
+        return 0;
+    }
+
+    mbedtls_sha256_update(&stream->sha, data, len);
+    return otaStreamProgram(stream, data, len);
+}
+
+
+
+/* Drain the writer, release the stream and return the image hash */
+static int otaStreamEnd(OtaStream_t* stream, uint8_t hash[OTA_HASH_SIZE])
+{
+    if (stream->writerRunning)
+    {
+        OtaSlot_t* end = NULL;
+        otaStreamFlush(stream);
+        xQueueSend(stream->fullSlots, &end, portMAX_DELAY);
+        xSemaphoreTake(stream->writerDone, portMAX_DELAY);
+    }
+    else
+    {
+        stream->writerStatus = -1;
+    }
+
+    mbedtls_sha256_finish(&stream->sha, hash);
+    mbedtls_sha256_free(&stream->sha);
+
+    if (stream->writerDone)
+        vSemaphoreDelete(stream->writerDone);
+    if (stream->fullSlots)
+        vQueueDelete(stream->fullSlots);
+    if (stream->freeSlots)
+        vQueueDelete(stream->freeSlots);
+    if (stream->slots)
+        free(stream->slots);
+    if (stream->resume)
+        free(stream->resume);
+    stream->resume = NULL;
+
+    return stream->writerStatus;
+}
+
+
+
+/*
+ * Ask for the file, or for the rest of it from stream->fileOffset. rangeEnd,
+ * if not 0, is the end of the bytes wanted. If-Range makes the server send
+ * the whole file instead if it has changed since the entity tag.
+ */
+int sendRequest(char* resource, char *host, OtaStream_t* stream, uint32_t rangeEnd)
 {
     //https://stg-upgrade.wi-safeconnect.com/op-1.52_0.13_fireangel_hub_ea3_ameba_stag.imx
-    char *request;
-    LOG_Info(" Gateway Sending HTTP request for :\r\n%s\r\n", resource);
-   //send http request
-   // resource= "op-1.52_0.13_fireangel_hub_ea3_ameba_stag.imx\r\n";
-    request = (unsigned char *) malloc(strlen("GET /") +
-                                              strlen(resource) +
-                                              strlen(" HTTP/1.1\r\nHost: ") +
-                                              strlen(host) + strlen("\r\n\r\n") + 1);
-
-    sprintf(request, "GET /%s HTTP/1.1\r\nHost: %s\r\n\r\n",resource, host);
+    int size = strlen(resource) + strlen(host) + OTA_ETAG_SIZE + 96;
+    char *request = malloc(size);
+    if (request == NULL)
+    {
+        LOG_Error("No memory for the HTTP request");
+        return -1;
+    }
+
+    int len = snprintf(request, size, "GET /%s HTTP/1.1\r\nHost: %s\r\n", resource, host);
+    if (rangeEnd)
+    {
+        len += snprintf(request + len, size - len, "Range: bytes=%u-%u\r\n",
+                        (unsigned)stream->fileOffset, (unsigned)(rangeEnd - 1));
+    }
+    else if (stream->fileOffset)
+    {
+        len += snprintf(request + len, size - len, "Range: bytes=%u-\r\n", (unsigned)stream->fileOffset);
+    }
+    if ((rangeEnd || stream->fileOffset) && stream->etag[0])
+    {
+        len += snprintf(request + len, size - len, "If-Range: %s\r\n", stream->etag);
+    }
+    len += snprintf(request + len, size - len, "\r\n");
     LOG_Info(" Gateway Sending HTTP request:\r\n%s\r\n", request);
 
     int ret = 0;
-    int len = strlen(request);
-    while( ( ret = mbedtls_ssl_write( &(tlsDataParams.ssl), request, len ) ) <= 0 )
+    while( ( ret = mbedtls_ssl_write( &(tlsDataParams.ssl), (unsigned char *)request, len ) ) <= 0 )
     {
         if(ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
         {
             LOG_Error(" failed\n  ! mbedtls_ssl_write returned %d", ret);
-            return ret;
+            break;
         }
     }
-    len = ret;
+    free(request);
     return ret;
 }
 
 
 
-int receiveResponse(unsigned char* contentBuffer, int* receivedContentSize, int maxContentBufferSize)
+/* Value of a field in a NUL terminated HTTP header, NULL if it is not there */
+static const char* otaHeaderField(const char* header, const char* name)
 {
-    int ret = 0;
-    int len = 0;
-    bool headerReceived = false;
-    int expectedContentSize = 0;
-    *receivedContentSize = 0;
+    size_t nameLen = strlen(name);
+    for (const char* line = strstr(header, "\r\n"); line; line = strstr(line + 2, "\r\n"))
+    {
+        if (strncasecmp(line + 2, name, nameLen) == 0)
+        {
+            const char* value = line + 2 + nameLen;
+            while (*value == ' ' || *value == '\t')
+                value++;
+            return value;
+        }
+    }
+    return NULL;
+}
 
-    do
+
+
+/*
+ * Check the status line and the fields that say which bytes of which file
+ * the body holds. A 206 must start at stream->fileOffset; a 200 is the
+ * whole file, and *skip is set to the bytes already received. Returns the
+ * offset of the body in the buffer, 0 if the header is not all there yet,
+ * or -1.
+ */
+static int otaParseResponse(OtaStream_t* stream, char* buffer, int len, uint32_t* skip, uint32_t maxContentBufferSize)
+{
+    int bodyStart = -1;
+    for (int i = 0; i + (int)strlen(MARKER_HEADER_END) <= len; i++)
+    {
+        if (strncmp(&buffer[i], MARKER_HEADER_END, strlen(MARKER_HEADER_END)) == 0)
+        {
+            bodyStart = i + strlen(MARKER_HEADER_END);
+            break;
+        }
+    }
+    if (bodyStart < 0)
+    {
+        return 0;
+    }
+    buffer[bodyStart - 2] = '\0';
+    LOG_Info("Received HTTP header:\r\n%s", buffer);
+
+    int status = 0;
+    if (strncmp(buffer, MARKER_HTTP, strlen(MARKER_HTTP)) == 0 && strchr(buffer, ' '))
+    {
+        status = atoi(strchr(buffer, ' '));
+    }
+
+    char etag[OTA_ETAG_SIZE] = "";
+    const char* field = otaHeaderField(buffer, MARKER_ETAG);
+    for (int i = 0; field && i < OTA_ETAG_SIZE - 1 && field[i] != '\r'; i++)
+    {
+        etag[i] = field[i];
+        etag[i + 1] = '\0';
+    }
+
+    uint32_t total = 0;
+    *skip = 0;
+    if (status == 206)
+    {
+        unsigned long first, last, length;
+        field = otaHeaderField(buffer, MARKER_CONTENT_RANGE);
+        if (!field || sscanf(field, "bytes %lu-%lu/%lu", &first, &last, &length) != 3 ||
+            first != stream->fileOffset)
+        {
+            LOG_Error("FAILED: Bad content range");
+            return -1;
+        }
+        total = length;
+    }
+    else if (status == 200)
     {
-        if(*receivedContentSize > maxContentBufferSize)
+        field = otaHeaderField(buffer, MARKER_CONTENT_LENGTH);
+        if (field)
+        {
+            total = strtoul(field, NULL, 10);
+        }
+        if (total == 0)
         {
-            LOG_Error("FAILED: Content will not fit in buffer");
+            LOG_Error("FAILED: Content length not found in header");
             return -1;
         }
+        *skip = stream->fileOffset;
+    }
+    else
+    {
+        LOG_Error("FAILED: Bad HTTP response");
+        return -1;
+    }
+
+    if ((stream->etag[0] && etag[0] && strcmp(stream->etag, etag) != 0) ||
+        (stream->contentLength && stream->contentLength != total))
+    {
+        LOG_Error("FAILED: Image changed on the server");
+        return -1;
+    }
+    if (total > maxContentBufferSize)
+    {
+        LOG_Error("FAILED: Content will not fit in partition");
+        return -1;
+    }
+
+    stream->contentLength = total;
+    if (stream->etag[0] == '\0')
+    {
+        strcpy(stream->etag, etag);
+    }
+    if (stream->verify == NULL)
+    {
+        stream->imageLength = total;
+    }
+    return bodyStart;
+}
+
+
+
+/*
+ * Receive the body into the stream, up to rangeEnd if not 0. Returns the
+ * bytes received, NETWORK_DISCONNECTED_ERROR if the connection broke first,
+ * which is worth another attempt, or -1.
+ */
+int receiveResponse(OtaStream_t* stream, uint32_t rangeEnd, uint32_t maxContentBufferSize)
+{
+    int ret = 0;
+    int len = 0;
+    bool headerReceived = false;
+    uint32_t start = stream->fileOffset;
+    uint32_t end = 0;
+    uint32_t skip = 0;
+    int headerBytes = 0;
 
-        ret = mbedtls_ssl_read( &(tlsDataParams.ssl), httpsBuffer, MBEDTLS_SSL_MAX_CONTENT_LEN );
+    do
+    {
+        ret = mbedtls_ssl_read( &(tlsDataParams.ssl), httpsBuffer + headerBytes, MBEDTLS_SSL_MAX_CONTENT_LEN - headerBytes );
 
         if(ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
             continue;
@@ -427,7 +1227,7 @@ int receiveResponse(unsigned char* contentBuffer, int* receivedContentSize, int
         if(ret < 0)
         {
             LOG_Error("failed\n  ! mbedtls_ssl_read returned %d", ret);
-            return ret;
+            break;
         }
 
         if(ret == 0)
@@ -437,108 +1237,75 @@ int receiveResponse(unsigned char* contentBuffer, int* receivedContentSize, int
         }
 
         len = ret;
+        unsigned char* data = httpsBuffer;
 
-        // Receive HTTP header
+        // Receive HTTP header, which may take more than one record
         if (!headerReceived)
         {
-            LOG_Info("Received HTTP header:\r\n%s", httpsBuffer);
-
-            LOG_Info("Parsing HTTP header...");
-
-            // Look for 200
-            if(strncmp((char *)httpsBuffer, MARKER_OK, strlen(MARKER_OK)) != 0)
+            len += headerBytes;
+            int bodyStart = otaParseResponse(stream, (char *)httpsBuffer, len, &skip, maxContentBufferSize);
+            if (bodyStart == 0 && len < MBEDTLS_SSL_MAX_CONTENT_LEN)
             {
-                LOG_Error("FAILED: Bad HTTP response");
-                return -1;
+                headerBytes = len;
+                continue;
             }
-
-            // Look for content length
-            int parseIndex = 0;
-            for (; (parseIndex < len - strlen(MARKER_CONTENT_LENGTH) + 1) && (expectedContentSize == 0); parseIndex++)
+            if (bodyStart == 0)
             {
-                if(strncmp((char *)(httpsBuffer + parseIndex), MARKER_CONTENT_LENGTH, strlen(MARKER_CONTENT_LENGTH)) == 0)
-                {
-                    parseIndex += strlen(MARKER_CONTENT_LENGTH);
-                    char expectedContentLengthString[32];
-                    for (int i = 0; (i < 32) && (parseIndex < len) && (httpsBuffer[parseIndex] != '\r') && (httpsBuffer[parseIndex] != '\n'); i++)
-                        expectedContentLengthString[i] = httpsBuffer[parseIndex++];
-                    expectedContentSize = atoi(expectedContentLengthString);
-                }
+                LOG_Error("FAILED: HTTP header not found");
+                return -1;
             }
-
-            // Content length not found in first frame
-            if (expectedContentSize == 0)
+            if (bodyStart < 0)
             {
-                LOG_Error("FAILED: Content length not found in header");
                 return -1;
             }
+            headerReceived = true;
+            headerBytes = 0;
+            data += bodyStart;
+            len -= bodyStart;
 
-            LOG_Info("Expecting %d bytes", expectedContentSize);
-
-            // Look for header end
-            for (; (parseIndex < len - strlen(MARKER_HEADER_END) + 1) && !headerReceived; parseIndex++)
+            end = stream->contentLength;
+            if (rangeEnd && rangeEnd < end)
             {
-                if(strncmp((char *)(httpsBuffer + parseIndex), MARKER_HEADER_END, strlen(MARKER_HEADER_END)) == 0)
-                {
-                    LOG_Trace("HEADER END FOUND @ index: %d", parseIndex);
-
-                    headerReceived = true;
-
-                    LOG_Info("Receiving image data...");
-
-                    // Copy remainder to image
-                    int remainder = len - 1 - parseIndex - 3;
-                    if (remainder > expectedContentSize)
-                        remainder = expectedContentSize;
-                     LOG_Trace("HEADER REMAINDER = %d", remainder);
-                    if (remainder > 0)
-                    {
-                        memcpy(contentBuffer, &httpsBuffer[parseIndex+4], remainder);
-                        *receivedContentSize += remainder;
-                    }
-                }
+                end = rangeEnd;
             }
+            LOG_Info("Receiving image data from %u of %u bytes...", (unsigned)stream->fileOffset, (unsigned)stream->contentLength);
+        }
 
-           
-            // Header not found in first frame
-            if (!headerReceived)
-            {
-                LOG_Error("FAILED: HTTP header not found");
-                return -1;
-            }
+        // Data the server sent again because it ignored the range
+        if (skip)
+        {
+            uint32_t n = (uint32_t)len < skip ? (uint32_t)len : skip;
+            data += n;
+            len -= n;
+            skip -= n;
         }
 
         // Receive image data
-        else
+        if ((uint32_t)len > end - stream->fileOffset)
+            len = end - stream->fileOffset;
+        if (len > 0 && otaStreamWrite(stream, data, len) != 0)
         {
-            if (*receivedContentSize + len > expectedContentSize)
-                len = expectedContentSize - *receivedContentSize;
-            memcpy(contentBuffer + *receivedContentSize, httpsBuffer, len);
-            *receivedContentSize += len;
+            LOG_Error("FAILED: Flash write");
+            return -1;
         }
-
-              //  for (int i=0;i<1000;i++)
-                //{
-                //  LOG_Info(" Image data..%x and buffer %x",httpsBuffer[i],contentBuffer[i]);
-                //}
+        stream->fileOffset += len;
 
         // Check if done
-        if (*receivedContentSize == expectedContentSize)
+        if (stream->fileOffset == end)
         {
-            LOG_Info("Received %d bytes", *receivedContentSize);
-            // dumpHex(contentBuffer, *receivedContentSize);
-            return *receivedContentSize;
+            LOG_Info("Received %u bytes", (unsigned)(stream->fileOffset - start));
+            return stream->fileOffset - start;
         }
     }
     while(1);
 
-    // Should never reach this
-    return -1;
+    LOG_Warning("Connection closed at %u of %u bytes", (unsigned)stream->fileOffset, (unsigned)stream->contentLength);
+    return NETWORK_DISCONNECTED_ERROR;
 }
 
 
 
-int downloadResource(char* host, char* port, char* resource, unsigned char* contentBuffer, int* receivedContentSize, int maxContentBufferSize)
+int downloadResource(char* host, char* port, char* resource, OtaStream_t* stream, uint32_t rangeEnd, uint32_t maxContentBufferSize)
 {
     LOG_Info("Downloading resource: %s", resource);
      LOG_Info("Downloading host: %s", host);
@@ -549,22 +1316,18 @@ int downloadResource(char* host, char* port, char* resource, unsigned char* cont
     if ((ret = https_client_tls_init(host, port)) < 0)
     {
         https_client_tls_release();
-        return ret;
+        return NETWORK_DISCONNECTED_ERROR;
     }
 
     // Send HTTP request
-    if ((ret = sendRequest(resource,host)) < 0)
+    if ((ret = sendRequest(resource, host, stream, rangeEnd)) < 0)
     {
         https_client_tls_release();
-        return ret;
+        return NETWORK_DISCONNECTED_ERROR;
     }
 
     // Receive HTTP response
-    if ((ret = receiveResponse(contentBuffer, receivedContentSize, maxContentBufferSize)) < 0)
-    {
-        https_client_tls_release();
-        return ret;
-    }
+    ret = receiveResponse(stream, rangeEnd, maxContentBufferSize);
 
     // Done
     https_client_tls_release();
@@ -608,19 +1371,6 @@ void asciiToBytes(char* str, uint8_t* bytes, int len)
 
 
 
-void prepareImage()
-{
-    LOG_Info("Preparing image..%d",imageSize);
-
-    for (int i=0;i<16;i++)
-    {
-        LOG_Info(" image Header %x...",imageBuffer[i]);
-    }
-    //memcpy(imageBuffer, imx_fcb, sizeof(imx_fcb));
-}
-
-
-
 uint8_t checkActiveImageFlag()
 {
     uint8_t activeImage;
@@ -666,51 +1416,11 @@ int swapActiveImage()
 
 
 
-int flashErase()
-{
-    int ret;
-    uint8_t activeImage = checkActiveImageFlag();
-    uint32_t targetImageOffset = (activeImage == 0x0a ? FLASHMAP_IMAGE_B_OFFSET : FLASHMAP_IMAGE_A_OFFSET);
-    LOG_Info(" Erasing FLASH...Image offset %x Image Size%x\r\n",targetImageOffset,imageSize);
-     
-    erase_image(targetImageOffset,FLASHMAP_IMAGE_SIZE);
-    SPI_Flash_Write(targetImageOffset, imageBuffer,imageSize); 
-
-     if (activeImage==0x0a)     
-     {  
-    LOG_Info(" Erasing FLASH... B Partition\r\n");    
-}
-else
-{
-      LOG_Info(" Erasing FLASH... A Partition\r\n");   
-}
-    #if 0
-    if (activeImage==0x0a)     
-     {                         
-        erase_image(FLASHMAP_IMAGE_B_OFFSET,FLASHMAP_IMAGE_SIZE);
-        // Program  Partition A
-       ret = SPI_Flash_Write(FLASHMAP_IMAGE_B_OFFSET, imageBuffer,imageSize);  
-       LOG_Info(" Erasing FLASH... B Partition\r\n");    
-    }else
-    {
-        erase_image(FLASHMAP_IMAGE_A_OFFSET,FLASHMAP_IMAGE_SIZE);
-        ret = SPI_Flash_Write(FLASHMAP_IMAGE_A_OFFSET, imageBuffer, imageSize);  
-        LOG_Info(" Erasing FLASH... A Partition\r\n");         
-    }
-#endif 
-
-    return 1;
-}
  uint32_t erase_image( uint32_t imageOffset ,uint32_t image_size)
 {
     if (image_size!=0)
     {
       LOG_Info(" Erasing FLASH...Image offset %x Image Size%x\r\n",imageOffset,image_size);
-        int ret = 0;
-
-        int sectorNum = 0;
-        uint32_t flashDataLen;
-        uint8_t flashData[FLASH_SECTOR_SIZE];
         int nSectors = image_size / FLASH_SECTOR_SIZE;
         for (int idxErase = 0; idxErase <nSectors; idxErase++)
         {
@@ -730,60 +1440,52 @@ else
 }
 
 
-int verifyImage()
+/* Identify a download, so that a saved record is only used for the same one */
+static void otaRequestId(uint8_t id[OTA_HASH_SIZE], char* host, char* port, char* resource,
+                         char* key, char* hash, bool signedImage)
 {
-    int ret;
-    int sectorNum = 0;
-    static uint8_t flashData[FLASH_SECTOR_SIZE];
-    uint32_t flashDataLen;
-    int32_t imageLength = imageSize;
-    uint8_t activeImage = checkActiveImageFlag();
-    uint32_t imageOffset = (activeImage == 0x0a ? FLASHMAP_IMAGE_B_OFFSET : FLASHMAP_IMAGE_A_OFFSET);
-  
+    const char* fields[] = { host, port, resource, key, hash, signedImage ? "signed" : "raw" };
+    mbedtls_sha256_context sha;
 
-    LOG_Info("Verifying %d bytes. image offset%x..", imageLength,imageOffset);
-
-    while (imageLength > 0)
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
     {
-        if (imageLength >= FLASH_SECTOR_SIZE)
-        {
-            flashDataLen = FLASH_SECTOR_SIZE;
-        }
-        else
-        {
-            flashDataLen = imageLength;
-        }
-
-        if ((ret = SPI_Flash_Read(imageOffset, flashData, flashDataLen)) == 0)
-        {
-            if (memcmp(&imageBuffer[sectorNum * FLASH_SECTOR_SIZE], (void *)flashData, flashDataLen) != 0)
-            {
-                LOG_Error("Verification failed");
-                return -1;
-            }
-        }
-        else
-        {
-            LOG_Error("Verification flash read failed %d",ret);
-            return -1;
-        }
-        sectorNum++;
-        imageOffset += flashDataLen;
-        imageLength -= flashDataLen;
+        const char* field = fields[i] ? fields[i] : "";
+        mbedtls_sha256_update(&sha, (const unsigned char*)field, strlen(field) + 1);
     }
-
-    LOG_Error("Verification OK");
-    return 0;
+    mbedtls_sha256_finish(&sha, id);
+    mbedtls_sha256_free(&sha);
 }
 
 
 
-
-
-
-int https_update_ota(char* host, char* port, char* resource)
+/*
+ * Download an image into the inactive partition and make it active.
+ *
+ * With signedImage (SIGNED_OTA in UPG_Upgrader.c) the file is an SJHF
+ * image: the verifier checks its header against the install hash and
+ * signing key, decrypts it with the install key and checks every segment,
+ * and only the operational part is written to flash. That part may be a
+ * patch against the active image, in which case the rebuilt image is
+ * written and its hash checked. Otherwise the file is the raw image and
+ * hash is the SHA-256 of the whole file.
+ *
+ * A dropped connection is picked up where it stopped with a range request,
+ * for as long as attempts keep making progress. Progress is also recorded
+ * in flash, so that after a reboot the same download carries on from the
+ * sectors already written; patches only resume within one call.
+ */
+int https_update_ota(char* host, char* port, char* resource, char* key, char* hash, bool signedImage)
 {
     int ret = 0;
+    OtaStream_t stream;
+    UPG_Verify_t verify;
+    uint8_t imageHash[OTA_HASH_SIZE];
+    uint8_t request[OTA_HASH_SIZE];
+    bool interrupted = false;
+    uint32_t startTime = OSAL_time_ms();
+    size_t freeHeapBefore = OSAL_GetFreeHeapSize();
 
     // Initialise OTA buffers
     if ((ret = initOTA()) < 0)
@@ -795,33 +1497,135 @@ int https_update_ota(char* host, char* port, char* resource)
     // Initialise filesystem
     EFS_Init();
 
-    // Download image
-  #if 1  //Nishi
-    if ((ret = downloadResource(host, port, resource, imageBuffer, &imageSize, FLASHMAP_IMAGE_SIZE)) < 0)
+    // Stream the image into the inactive partition as it downloads
+    uint32_t targetImageOffset = determineTargetImageOffset();
+    LOG_Info("Streaming image to partition @ 0x%08x", targetImageOffset);
+
+    otaRequestId(request, host, port, resource, key, hash, signedImage);
+    if ((ret = otaStreamBegin(&stream, targetImageOffset, request, signedImage)) == 0 && signedImage)
     {
-        releaseOTA();
-        return ret;
+        if (UPG_VerifyInit(&verify, signingKey, key, hash, otaVerifySink, &stream) == UPGRADE_ERR_NONE)
+        {
+            stream.verify = &verify;
+        }
+        else
+        {
+            LOG_Error("Image verifier: %s", verify.reason);
+            UPG_setError(verify.error);
+            UPG_VerifyFree(&verify);
+            ret = -1;
+        }
     }
-    #endif 
-
-    // Manipulate image
-   prepareImage();
-
-#if 1 //Nishi
-    // Erase existing image from flash
-    if ((ret = flashErase()) < 0)
+    int attempts = 0;
+    while (ret == 0)
+    {
+        uint32_t progress = stream.fileOffset;
+        ret = downloadResource(host, port, resource, &stream, stream.replay ? FIRMWARE_HEADER_BYTES : 0,
+                               signedImage ? UPG_VERIFY_MAX_IMAGE_BYTES : FLASHMAP_IMAGE_SIZE);
+        if (ret >= 0 && stream.replay)
+        {
+            // Header fetched again, now the rest of the file
+            ret = otaResumeReplay(&stream);
+            continue;
+        }
+        if (ret != NETWORK_DISCONNECTED_ERROR)
+        {
+            break;
+        }
+        if (stream.fileOffset != progress)
+        {
+            attempts = 0;
+        }
+        if (++attempts == OTA_MAX_ATTEMPTS)
+        {
+            LOG_Error("Download failed %d times at %u bytes", attempts, (unsigned)stream.fileOffset);
+            interrupted = true;
+            break;
+        }
+        LOG_Warning("Download interrupted at %u bytes, retrying", (unsigned)stream.fileOffset);
+        OSAL_sleep_ms(OTA_RETRY_DELAY_MS * attempts);
+        ret = 0;
+    }
+    imageSize = stream.contentLength;
+    size_t freeHeapDuring = OSAL_GetFreeHeapSize();
+    if (otaStreamEnd(&stream, imageHash) != 0 && ret >= 0)
+    {
+        LOG_Error("Writing image to flash failed");
+        ret = -1;
+    }
+    if (stream.verify)
+    {
+        // A broken connection is a download failure, not a truncated image
+        bool verifierFailed = verify.state == UPG_VERIFY_FAILED;
+        UPG_Error_t error = UPG_VerifyFinish(&verify);
+        if (ret < 0 && !verifierFailed)
+        {
+            error = UPGRADE_ERR_DOWNLOAD_FAILED;
+        }
+        if (error != UPGRADE_ERR_NONE)
+        {
+            LOG_Error("Image rejected: %s", verify.reason);
+            UPG_setError(error);
+            ret = -1;
+        }
+        else if (stream.operationalBytes == 0)
+        {
+            LOG_Error("Image rejected: no operational part");
+            UPG_setError(UPGRADE_ERR_FILE_CONTENTS_ERROR);
+            ret = -1;
+        }
+        UPG_VerifyFree(&verify);
+    }
+    if (stream.delta)
+    {
+        // A patch error stops the verifier with a write failure, so it is
+        // reported here with its own reason. Finish checks the target hash.
+        bool patchFailed = stream.delta->state == UPG_DELTA_FAILED;
+        UPG_Error_t error = UPG_DeltaFinish(stream.delta);
+        if (error != UPGRADE_ERR_NONE && (patchFailed || ret >= 0))
+        {
+            LOG_Error("Patch rejected: %s", stream.delta->reason);
+            UPG_setError(error);
+        }
+        if (error != UPGRADE_ERR_NONE)
+        {
+            ret = -1;
+        }
+        UPG_DeltaFree(stream.delta);
+        free(stream.delta);
+    }
+    // Keep the record only while the download may yet be picked up
+    if (stream.recorded && !interrupted)
+    {
+        otaResumeClear();
+    }
+    if (ret < 0)
     {
         releaseOTA();
         return ret;
     }
 
-   
+    LOG_Info("OTA: %d bytes in %u ms, %u bytes of heap in use",
+             imageSize, (unsigned)(OSAL_time_ms() - startTime), (unsigned)(freeHeapBefore - freeHeapDuring));
 
-    // Verify written image
-    if ((ret = verifyImage()) < 0)
+    // Check a raw image against the expected SHA-256
+    if (!signedImage && hash && *hash)
     {
-        releaseOTA();
-        return ret;
+        uint8_t expectedHash[OTA_HASH_SIZE];
+        if (strlen(hash) != 2 * OTA_HASH_SIZE)
+        {
+            LOG_Error("Bad image hash %s", hash);
+            releaseOTA();
+            return -1;
+        }
+        asciiToBytes(hash, expectedHash, OTA_HASH_SIZE);
+        if (memcmp(expectedHash, imageHash, OTA_HASH_SIZE) != 0)
+        {
+            LOG_Error("Image hash mismatch");
+            releaseOTA();
+            return -1;
+        }
+        LOG_Info("Image hash OK");
     }
 
     // Flag new image as active
@@ -830,12 +1634,10 @@ int https_update_ota(char* host, char* port, char* resource)
         releaseOTA();
         return ret;
     }
-#endif 
+
     // Cleanup
     releaseOTA();
 
-
-
     // Done
     return 0;
 }
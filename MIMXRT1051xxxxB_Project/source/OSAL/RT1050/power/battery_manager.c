@@ -48,6 +48,7 @@
 
 static bool chargingEnabled = false;
 static bool batterySwitchOpen = false;
+static bool batteryLowReported = false;
 
 
 
@@ -254,6 +255,19 @@ static void battery_manager(void *arg)
         {
             LOG_Warning("Mains Disconnected");
             chargeTimeEnd = 0;
+
+            // report once per discharge that the battery will not last much longer
+            if ((actualBatteryMilliVoltage <= BATTERY_CHARGE_DISCHARGE_THRESHOLD_MV) && !batteryLowReported)
+            {
+                LOG_Warning("Battery low");
+                OSAL_NotifyPowerEvent(OSAL_POWER_BATTERY_LOW);
+                batteryLowReported = true;
+            }
+        }
+
+        if (mainsConnected)
+        {
+            batteryLowReported = false;
         }
 
         LOG_Info("Battery voltage = %d.%03dV", actualBatteryMilliVoltage/1000 , actualBatteryMilliVoltage % 1000);
@@ -168,6 +168,7 @@ static void power_monitor(void *arg)
                     seqNum = (seqNum +1) & 0x0F;
                     LOG_Info("Sending Mains Connected event message to cloud");
                     writeWGqueue(mainsConnectedEventMsg);
+                    OSAL_NotifyPowerEvent(OSAL_POWER_MAINS_RESTORED);
 
                     toggleTabletUsbIdPin();
                     lastMainsConnected = mainsConnected;
@@ -175,6 +176,8 @@ static void power_monitor(void *arg)
             }
             else
             {
+                OSAL_NotifyPowerEvent(OSAL_POWER_MAINS_LOST);
+
                 // disable wired Ethernet
                 enable_wired_ethernet(false);
 
@@ -14,6 +14,7 @@
 // Flash map
 #define FLASHMAP_IMAGE_RESET_HANDLER    0x800040E1
 #define FLASHMAP_IMAGE_FLAG_SECTOR      0x34B000
+#define FLASHMAP_OTA_RESUME_SECTOR      0x34A000    // Progress of an interrupted download
 #define FLASHMAP_RECOVERY_SIZE          0x0E0000
 #define FLASHMAP_RECOVERY_OFFSET        0x020000
 #define FLASHMAP_IMAGE_SIZE             0x100000
@@ -4,7 +4,27 @@
  *
  * \author Murat Cakmak
  *
- * \brief Ultra Primitive File System for Ameba Internal Flash.
+ * \brief Log-structured, wear-levelled File System for the STO flash region.
+ *
+ * The STO region is managed as a pool of sectors. Every sector starts with a
+ * sector header naming the file it belongs to and its position (sequence) in
+ * that file. File content follows the header as a list of chunks, each one
+ * with a small chunk header holding its length and a commit marker.
+ *
+ * - Appends only ever program new bytes. The chunk is written with its commit
+ *   marker erased and the marker is programmed once the data is in flash, so
+ *   an append interrupted by a power failure is ignored on the next mount.
+ *   A write which straddles sectors is committed last chunk first and is
+ *   either seen in full or not at all.
+ * - File sizes are rebuilt at mount by walking the committed chunks and are
+ *   then kept in RAM, so no header ever needs to be rewritten.
+ * - Removing or truncating a file only programs the obsolete marker of its
+ *   sectors. Sectors are erased when they are allocated again, choosing the
+ *   free sector with the lowest erase count, which spreads wear over the
+ *   whole region. The erase count is kept in the sector header.
+ * - A rename programs the next free name slot of the file's first sector.
+ * - Files left by releases using the old contiguous layout are moved into
+ *   the pool by the first mount, see migrateLegacyFiles.
  *
  * \Copyright (C) 2017 Intamac Ltd - All Rights Reserved.
  *  Unauthorized copying of this file, via any medium is strictly prohibited
@@ -12,6 +32,8 @@
  ******************************************************************************/
 
 /****************************** INCLUDES **************************************/
+#include <stddef.h>
+#include <string.h>
 #include "LOG_Api.h"
 #include "OSAL_Api.h"
 #include "SPI_Flash.h"
@@ -21,52 +43,132 @@
 
 /******************************** CONSTANTS ***********************************/
 
-#define STO_FILE_BLOCK_SIZE                  FLASH_SECTOR_SIZE
+#define STO_SECTOR_COUNT                     (STO_FLASH_SIZE / FLASH_SECTOR_SIZE)
+
+// Max file count and name length: the current log, the snapshot and its
+// replacement being written, the archive log of older releases, the AWS
+// fault spill queue and its replacement being written, and the WiSafe fault
+// table and its replacement being written
+#define STO_MAX_FILE_COUNT                   8
+#define STO_MAX_FILE_NAME_LEN                32
+
+// Number of times a file can be renamed without being rewritten
+#define STO_NAME_SLOTS                       4
+
+// Allowed open max file count at same time, the spill queue is copied
+// while the storage handler may have a log open
+#define STO_ALLOWED_MAX_OPEN_FILE_COUNT      3
+
+// Largest number of sectors a single write may span
+#define STO_MAX_CHUNKS_PER_WRITE             8
+
+#define STO_SECTOR_MAGIC                     0x4C4F5453  // "STOL"
+#define STO_FREE_FILE_ID                     0xFFFFFFFF
+#define STO_SECTOR_LIVE                      0xFFFF
+#define STO_SECTOR_OBSOLETE                  0x0000
+#define STO_INVALID_SECTOR                   0xFFFF
 
+#define STO_CHUNK_ERASED_LENGTH              0xFFFF
+#define STO_CHUNK_UNCOMMITTED                0xFF
+#define STO_CHUNK_COMMITTED                  0x00
 
-// Max file name length
-#define STO_MAX_FILE_COUNT                   2
-#define STO_MAX_FILE_NAME_LEN                64
+// Chunk flags
+#define STO_CHUNK_MORE                       0x01    // Next chunk belongs to the same write
+#define STO_CHUNK_CONTINUATION               0x02    // Chunk continues the previous one
 
-#define STO_MAX_FILE_SIZE                    STO_FLASH_SIZE / STO_MAX_FILE_COUNT
+#define STO_SECTOR_DATA_START                sizeof(STOSectorHeader)
+#define STO_SECTOR_DATA_SIZE                 (FLASH_SECTOR_SIZE - STO_SECTOR_DATA_START)
 
-#define STO_FILE_HEADER_LEN                  96
-#define STO_MAX_FILE_CONTENT_LEN             STO_MAX_FILE_SIZE - STO_FILE_HEADER_LEN
+// Old layout: each file at the start of its half of the region, a header
+// then the content in one contiguous extent
+#define STO_LEGACY_FILE_COUNT                2
+#define STO_LEGACY_FILE_SIZE                 (STO_FLASH_SIZE / STO_LEGACY_FILE_COUNT)
+#define STO_LEGACY_NAME_LEN                  64
+#define STO_LEGACY_EMPTY_SIZE                0xFFFFFFFF
 
-// Allowed open max file count at same time
-#define STO_ALLOWED_MAX_OPEN_FILE_COUNT      2
+// Owner of old layout sectors, kept out of allocation until moved
+#define STO_LEGACY_FILE_ID                   0xFFFFFFFE
 
-#define INVALID_BLOCK_ADDRESS                0xFFFFFFFF
+// An old file is copied under this name, then renamed
+#define STO_MIGRATION_FILE_NAME              "~migrating"
+#define STO_MIGRATION_COPY_SIZE              1024
 
 
 
 /*************************** TYPE DEFINITIONS *********************************/
 
-/* File Header */
+/* Sector header, at the start of every sector in use */
 typedef struct
 {
-    /* File Name */
-    uint8_t name[STO_MAX_FILE_NAME_LEN];
-    /* File Size */
+    /* STO_SECTOR_MAGIC once the sector has been formatted */
+    uint32_t magic;
+    /* Number of times the sector has been erased */
+    uint32_t eraseCount;
+    /* Owning file, STO_FREE_FILE_ID when blank */
+    uint32_t fileId;
+    /* Position of the sector in the owning file */
+    uint16_t sequence;
+    /* Programmed to STO_SECTOR_OBSOLETE when the file is removed */
+    uint16_t obsolete;
+    /* File name history, only used in the first sector of a file */
+    char name[STO_NAME_SLOTS][STO_MAX_FILE_NAME_LEN];
+} STOSectorHeader;
+
+/* Chunk header, in front of each piece of appended data */
+typedef struct
+{
+    uint16_t length;
+    uint8_t flags;
+    uint8_t commit;
+} STOChunkHeader;
+
+/* File header of the old layout */
+typedef struct
+{
+    char name[STO_LEGACY_NAME_LEN];
+    /* STO_LEGACY_EMPTY_SIZE when no file */
     uint32_t fileSize;
-    /* Keep reserved to compliant header size with 96 bytes*/
-    uint8_t __reserved[28];
-} STOFileHeader;
+    uint8_t reserved[28];
+} STOLegacyHeader;
 
-/* All file information including content */
+/* RAM view of a sector */
+typedef struct
+{
+    uint32_t fileId;
+    uint32_t eraseCount;
+    uint16_t sequence;
+    /* First unprogrammed byte in the sector */
+    uint16_t writeOffset;
+    /* Erased apart from a blank header, no erase needed before use */
+    bool blank;
+} STOSector;
+
+/* RAM view of a file */
 typedef struct
 {
-    STOFileHeader fileHeader;
-    uint8_t content[STO_MAX_FILE_CONTENT_LEN];
+    bool inUse;
+    uint32_t fileId;
+    char name[STO_MAX_FILE_NAME_LEN];
+    uint8_t nameSlot;
+    uint16_t firstSector;
+    uint16_t lastSector;
+    uint16_t sectorCount;
+    uint32_t fileSize;
 } STOFile;
 
 /* Open file attributes */
 typedef struct
 {
     bool inUse;
-    uint32_t fileOffset;
-    uint32_t readOffset;
+    STOFile* file;
+    uint32_t fileId;
     OSAL_AccessMode_e accessMode;
+    /* Sequential read cursor */
+    uint32_t readOffset;
+    uint16_t readSequence;
+    uint16_t readChunkOffset;
+    uint16_t readChunkConsumed;
+    bool readSkipping;
 } OpenSTOFile;
 
 
@@ -74,99 +176,801 @@ typedef struct
 /******************************** VARIABLES ***********************************/
 
 static OpenSTOFile openFiles[STO_ALLOWED_MAX_OPEN_FILE_COUNT];
-static Mutex_t STO_LOCK = NULL;
+static STOFile files[STO_MAX_FILE_COUNT];
+static STOSector sectors[STO_SECTOR_COUNT];
+static uint32_t nextFileId;
+static uint16_t nextAllocation;
+static Mutex_t STO_LOCK;
+static bool STO_Initialised = false;
 
 
 
 /***************************** PRIVATE METHODS *******************************/
 
 
-/* Updates the first block of the file */
-static int32_t updateFile(uint32_t fileAddress, STOFile* newContent)
+/* Returns flash address of a sector */
+static uint32_t sectorAddr(uint16_t sector)
 {
-    int32_t status = -1;
+    return STO_FLASH_START + (sector * FLASH_SECTOR_SIZE);
+}
+
 
-    /* We need to delete block first to apply changes */
-    if ((status = SPI_Flash_Erase(fileAddress)) == 0)
+
+/* Returns empty slot number in OpenFile container */
+static int32_t getEmptySlot(void)
+{
+    for (int i = 0; i < STO_ALLOWED_MAX_OPEN_FILE_COUNT; i++)
     {
-        /* Write new content to flash */
-        status = SPI_Flash_Write(fileAddress, (uint8_t*)newContent, STO_FILE_BLOCK_SIZE);
+        if (openFiles[i].inUse == false)
+        {
+            return i;
+        }
     }
-    else
+
+    return -1;
+}
+
+
+
+/* Returns file entry for a file name */
+static STOFile* getFile(const char* fileName)
+{
+    for (int i = 0; i < STO_MAX_FILE_COUNT; i++)
     {
-        LOG_Info("%s: Failed to erase flash at address 0x%08x", __func__, fileAddress);
+        if (files[i].inUse && strcmp(files[i].name, fileName) == 0)
+        {
+            return &files[i];
+        }
     }
 
-    return status;
+    return NULL;
 }
 
 
 
-/* Returns empty slot number in OpenFile container */
-static int32_t getEmptySlot(void)
+/* Returns the sector holding a given part of a file */
+static uint16_t findSector(uint32_t fileId, uint16_t sequence)
 {
-    for (int i = 0; i < STO_ALLOWED_MAX_OPEN_FILE_COUNT; i++)
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
     {
-        if (openFiles[i].inUse == false)
+        if (sectors[i].fileId == fileId && sectors[i].sequence == sequence)
         {
             return i;
         }
     }
 
-    return -1;
+    return STO_INVALID_SECTOR;
 }
 
 
 
-/* Returns file address in flash */
-static uint32_t getFileAddr(const char* fileName)
+/* Returns number of free sectors */
+static uint16_t freeSectorCount(void)
 {
-    STOFileHeader fileHeader;
-    uint32_t fileAddr;
+    uint16_t count = 0;
 
-    for (int i = 0; i < STO_MAX_FILE_COUNT; i++)
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
+    {
+        if (sectors[i].fileId == STO_FREE_FILE_ID)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+
+/* Takes the least worn free sector and assigns it to a file */
+static uint16_t allocateSector(uint32_t fileId, uint16_t sequence, const char* fileName)
+{
+    uint16_t best = STO_INVALID_SECTOR;
+
+    /* Scan from the last allocation so equally worn sectors are used in turn */
+    for (uint16_t n = 0; n < STO_SECTOR_COUNT; n++)
+    {
+        uint16_t i = (nextAllocation + n) % STO_SECTOR_COUNT;
+
+        if (sectors[i].fileId == STO_FREE_FILE_ID &&
+            (best == STO_INVALID_SECTOR || sectors[i].eraseCount < sectors[best].eraseCount))
+        {
+            best = i;
+        }
+    }
+
+    if (best == STO_INVALID_SECTOR)
     {
-        /* Test next file */
-        fileAddr = STO_FLASH_START + (i * STO_MAX_FILE_SIZE);
+        LOG_Error("No free sector left in STO region");
+        return STO_INVALID_SECTOR;
+    }
 
-        /* Read just file header */
-        SPI_Flash_Read(fileAddr, (uint8_t*)&fileHeader, sizeof(fileHeader));
+    STOSector* sector = &sectors[best];
 
-        if (strcmp(fileHeader.name, fileName) == 0)
+    if (!sector->blank)
+    {
+        if (SPI_Flash_Erase(sectorAddr(best)) != 0)
         {
-            /* We found the file */
-            return fileAddr;
+            LOG_Error("%s: Failed to erase flash at address 0x%08x", __func__, sectorAddr(best));
+            return STO_INVALID_SECTOR;
         }
+        sector->eraseCount++;
+    }
+
+    STOSectorHeader header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = STO_SECTOR_MAGIC;
+    header.eraseCount = sector->eraseCount;
+    header.fileId = fileId;
+    header.sequence = sequence;
+    if (fileName != NULL)
+    {
+        strcpy(header.name[0], fileName);
+    }
+
+    if (SPI_Flash_Write(sectorAddr(best), (uint8_t*)&header, sizeof(header)) != 0)
+    {
+        LOG_Error("%s: Failed to write sector header at address 0x%08x", __func__, sectorAddr(best));
+        sector->blank = false;
+        return STO_INVALID_SECTOR;
     }
 
-    /* We could not find file in flash */
-    return INVALID_BLOCK_ADDRESS;
+    sector->fileId = fileId;
+    sector->sequence = sequence;
+    sector->writeOffset = STO_SECTOR_DATA_START;
+    sector->blank = false;
+
+    nextAllocation = (best + 1) % STO_SECTOR_COUNT;
+
+    return best;
 }
 
 
 
-/* Returns empty block in Flash for a new file */
-static uint32_t findEmptyBlock(void)
+/* Erases a sector and leaves a blank header behind, so it can be used without erasing */
+static int32_t formatSector(uint16_t i)
 {
-    STOFileHeader fileHeader;
-    uint32_t fileAddr;
+    if (SPI_Flash_Erase(sectorAddr(i)) != 0)
+    {
+        LOG_Error("Failed to erase 0x%08x", sectorAddr(i));
+        return -1;
+    }
+
+    STOSectorHeader header;
+    memset(&header, 0xFF, sizeof(header));
+    header.magic = STO_SECTOR_MAGIC;
+    header.eraseCount = ++sectors[i].eraseCount;
+    sectors[i].fileId = STO_FREE_FILE_ID;
+    sectors[i].blank = (SPI_Flash_Write(sectorAddr(i), (uint8_t*)&header, sizeof(header)) == 0);
+
+    return 0;
+}
+
+
+
+/* Marks all sectors of a file as obsolete, first sector first */
+static void discardFile(STOFile* file)
+{
+    uint16_t obsolete = STO_SECTOR_OBSOLETE;
+
+    for (uint16_t sequence = 0; sequence < file->sectorCount; sequence++)
+    {
+        uint16_t i = findSector(file->fileId, sequence);
+
+        if (i != STO_INVALID_SECTOR)
+        {
+            SPI_Flash_Write(sectorAddr(i) + offsetof(STOSectorHeader, obsolete),
+                            (uint8_t*)&obsolete, sizeof(obsolete));
+            sectors[i].fileId = STO_FREE_FILE_ID;
+            sectors[i].blank = false;
+        }
+    }
+
+    /* Any handle still open on the file is left pointing at nothing */
+    for (int i = 0; i < STO_ALLOWED_MAX_OPEN_FILE_COUNT; i++)
+    {
+        if (openFiles[i].inUse && openFiles[i].file == file)
+        {
+            openFiles[i].file = NULL;
+        }
+    }
+
+    memset(file, 0, sizeof(STOFile));
+}
+
+
+
+/* Creates a new, empty file with its first sector */
+static STOFile* createFile(const char* fileName)
+{
+    STOFile* file = NULL;
 
     for (int i = 0; i < STO_MAX_FILE_COUNT; i++)
     {
-        /* Test next block */
-        fileAddr = STO_FLASH_START + (i * STO_MAX_FILE_SIZE);
-        /* Read just file header */
-        SPI_Flash_Read(fileAddr, (uint8_t *)&fileHeader, sizeof(fileHeader));
+        if (!files[i].inUse)
+        {
+            file = &files[i];
+            break;
+        }
+    }
 
-        /* If file size is not set before it is an empty block */
-        if (fileHeader.fileSize == 0xFFFFFFFF)
+    if (file == NULL)
+    {
+        LOG_Error("Not enough place to create a new file");
+        return NULL;
+    }
+
+    uint16_t first = allocateSector(nextFileId, 0, fileName);
+    if (first == STO_INVALID_SECTOR)
+    {
+        return NULL;
+    }
+
+    memset(file, 0, sizeof(STOFile));
+    file->inUse = true;
+    file->fileId = nextFileId++;
+    strcpy(file->name, fileName);
+    file->nameSlot = 0;
+    file->firstSector = first;
+    file->lastSector = first;
+    file->sectorCount = 1;
+    file->fileSize = 0;
+
+    return file;
+}
+
+
+
+/*
+ * Appends data to a file as one write, which is either seen in full after a
+ * power failure or not at all. Returns 0 in success, -1 in case of fail.
+ */
+static int32_t appendFile(STOFile* file, const uint8_t* data, uint32_t nBytes)
+{
+    /* Make sure the whole write fits before programming anything */
+    uint32_t tailSpace = 0;
+    uint16_t tailOffset = sectors[file->lastSector].writeOffset;
+    if (tailOffset + sizeof(STOChunkHeader) < FLASH_SECTOR_SIZE)
+    {
+        tailSpace = FLASH_SECTOR_SIZE - tailOffset - sizeof(STOChunkHeader);
+    }
+    uint32_t newSectors = 0;
+    if (nBytes > tailSpace)
+    {
+        uint32_t perSector = STO_SECTOR_DATA_SIZE - sizeof(STOChunkHeader);
+        newSectors = (nBytes - tailSpace + perSector - 1) / perSector;
+    }
+
+    if (newSectors + (tailSpace ? 1 : 0) > STO_MAX_CHUNKS_PER_WRITE ||
+        newSectors > freeSectorCount())
+    {
+        LOG_Error("Not enough space in STO region to write %d bytes", nBytes);
+        return -1;
+    }
+
+    uint32_t commitAddr[STO_MAX_CHUNKS_PER_WRITE];
+    int chunks = 0;
+    uint32_t remaining = nBytes;
+    int32_t status = 0;
+
+    while (remaining > 0 && status == 0)
+    {
+        STOSector* sector = &sectors[file->lastSector];
+
+        if (sector->writeOffset + sizeof(STOChunkHeader) >= FLASH_SECTOR_SIZE)
         {
-            return fileAddr;
+            uint16_t next = allocateSector(file->fileId, file->sectorCount, NULL);
+            if (next == STO_INVALID_SECTOR)
+            {
+                status = -1;
+                break;
+            }
+            file->lastSector = next;
+            file->sectorCount++;
+            sector = &sectors[next];
         }
+
+        uint32_t chunkAddr = sectorAddr(file->lastSector) + sector->writeOffset;
+        uint32_t space = FLASH_SECTOR_SIZE - sector->writeOffset - sizeof(STOChunkHeader);
+        uint32_t chunkLen = remaining < space ? remaining : space;
+
+        STOChunkHeader chunk;
+        chunk.length = chunkLen;
+        chunk.flags = (chunks ? STO_CHUNK_CONTINUATION : 0) | (remaining > chunkLen ? STO_CHUNK_MORE : 0);
+        chunk.commit = STO_CHUNK_UNCOMMITTED;
+
+        /* Header, then data. The commit marker stays erased until all chunks are in */
+        status = SPI_Flash_Write(chunkAddr, (uint8_t*)&chunk, sizeof(chunk));
+        if (status == 0)
+        {
+            status = SPI_Flash_Write(chunkAddr + sizeof(chunk), (uint8_t*)data, chunkLen);
+        }
+
+        sector->writeOffset += sizeof(chunk) + chunkLen;
+        commitAddr[chunks++] = chunkAddr + offsetof(STOChunkHeader, commit);
+        data += chunkLen;
+        remaining -= chunkLen;
+    }
+
+    if (status != 0)
+    {
+        LOG_Error("Failed to write %d bytes to %s", nBytes, file->name);
+        return -1;
     }
 
-    /* We could not find an empty block in flash */
-    return INVALID_BLOCK_ADDRESS;
+    /* Commit last chunk first so a partial commit leaves the first one erased */
+    uint8_t committed = STO_CHUNK_COMMITTED;
+    while (chunks > 0)
+    {
+        SPI_Flash_Write(commitAddr[--chunks], &committed, sizeof(committed));
+    }
+
+    file->fileSize += nBytes;
+
+    return 0;
+}
+
+
+
+/* Programs the next name slot of a file, the latest slot in use is the file name */
+static int32_t renameFile(STOFile* file, const char* newName)
+{
+    if (file->nameSlot + 1 >= STO_NAME_SLOTS)
+    {
+        LOG_Error("No name slot left to rename %s to %s", file->name, newName);
+        return -1;
+    }
+
+    char name[STO_MAX_FILE_NAME_LEN];
+    memset(name, 0, sizeof(name));
+    strcpy(name, newName);
+
+    uint32_t slotAddr = sectorAddr(file->firstSector) + offsetof(STOSectorHeader, name) +
+                        ((file->nameSlot + 1) * STO_MAX_FILE_NAME_LEN);
+
+    if (SPI_Flash_Write(slotAddr, (uint8_t*)name, sizeof(name)) != 0)
+    {
+        LOG_Error("Failed to rename file %s to %s", file->name, newName);
+        return -1;
+    }
+
+    file->nameSlot++;
+    strcpy(file->name, newName);
+
+    return 0;
+}
+
+
+
+/*
+ * Walks the chunks of a file, either to rebuild its size and the write offset
+ * of its sectors at mount, or to find the next readable data for a reader.
+ *
+ * When buffer is NULL the whole file is walked and sizes are updated,
+ * otherwise up to nBytes are copied from the reader's position.
+ */
+static uint32_t walkChunks(STOFile* file, OpenSTOFile* reader, uint8_t* buffer, uint32_t nBytes)
+{
+    uint16_t sequence = reader ? reader->readSequence : 0;
+    uint16_t offset = reader ? reader->readChunkOffset : STO_SECTOR_DATA_START;
+    uint16_t consumed = reader ? reader->readChunkConsumed : 0;
+    bool skipping = reader ? reader->readSkipping : false;
+    uint32_t total = 0;
+
+    while (sequence < file->sectorCount && (buffer == NULL || total < nBytes))
+    {
+        uint16_t i = findSector(file->fileId, sequence);
+        STOChunkHeader chunk;
+
+        if (i == STO_INVALID_SECTOR)
+        {
+            break;
+        }
+
+        if (offset + sizeof(chunk) > FLASH_SECTOR_SIZE)
+        {
+            chunk.length = STO_CHUNK_ERASED_LENGTH;
+        }
+        else
+        {
+            SPI_Flash_Read(sectorAddr(i) + offset, (uint8_t*)&chunk, sizeof(chunk));
+        }
+
+        if (chunk.length == STO_CHUNK_ERASED_LENGTH ||
+            chunk.length > FLASH_SECTOR_SIZE - offset - sizeof(chunk))
+        {
+            /* End of data in this sector, a torn chunk header also ends it */
+            if (buffer == NULL)
+            {
+                sectors[i].writeOffset = (chunk.length == STO_CHUNK_ERASED_LENGTH) ? offset : FLASH_SECTOR_SIZE;
+            }
+            sequence++;
+            offset = STO_SECTOR_DATA_START;
+            consumed = 0;
+            continue;
+        }
+
+        /* A write is only valid if its first chunk has been committed */
+        if (!(chunk.flags & STO_CHUNK_CONTINUATION))
+        {
+            skipping = (chunk.commit != STO_CHUNK_COMMITTED);
+        }
+
+        if (!skipping)
+        {
+            uint16_t available = chunk.length - consumed;
+
+            if (buffer != NULL)
+            {
+                uint32_t len = nBytes - total;
+                if (len > available)
+                {
+                    len = available;
+                }
+                SPI_Flash_Read(sectorAddr(i) + offset + sizeof(chunk) + consumed, buffer + total, len);
+                consumed += len;
+                total += len;
+                if (consumed < chunk.length)
+                {
+                    /* Buffer is full, keep our place within the chunk */
+                    break;
+                }
+            }
+            else
+            {
+                total += available;
+            }
+        }
+
+        offset += sizeof(chunk) + chunk.length;
+        consumed = 0;
+    }
+
+    if (reader)
+    {
+        reader->readSequence = sequence;
+        reader->readChunkOffset = offset;
+        reader->readChunkConsumed = consumed;
+        reader->readSkipping = skipping;
+    }
+
+    return total;
+}
+
+
+
+/* Reads the header of an old layout file, false if there is no such file */
+static bool readLegacyHeader(int index, STOLegacyHeader* header)
+{
+    uint32_t magic;
+
+    SPI_Flash_Read(STO_FLASH_START + (index * STO_LEGACY_FILE_SIZE), (uint8_t*)header, sizeof(*header));
+    memcpy(&magic, header->name, sizeof(magic));
+
+    if (magic == STO_SECTOR_MAGIC ||
+        (uint8_t)header->name[0] == 0xFF || header->name[0] == '\0' ||
+        memchr(header->name, '\0', sizeof(header->name)) == NULL)
+    {
+        return false;
+    }
+
+    return header->fileSize != STO_LEGACY_EMPTY_SIZE &&
+           header->fileSize <= STO_LEGACY_FILE_SIZE - sizeof(STOLegacyHeader);
+}
+
+
+
+/*
+ * Assigns the sectors of an old layout file to an owner. Reserving fails if
+ * any of them has been formatted since, the old content is then lost.
+ */
+static bool assignLegacyExtent(int index, const STOLegacyHeader* header, uint32_t fileId)
+{
+    uint16_t first = (index * STO_LEGACY_FILE_SIZE) / FLASH_SECTOR_SIZE;
+    uint16_t last = (index * STO_LEGACY_FILE_SIZE + sizeof(STOLegacyHeader) + header->fileSize - 1) /
+                    FLASH_SECTOR_SIZE;
+
+    if (fileId == STO_LEGACY_FILE_ID)
+    {
+        for (uint16_t i = first; i <= last; i++)
+        {
+            uint32_t magic;
+            SPI_Flash_Read(sectorAddr(i), (uint8_t*)&magic, sizeof(magic));
+            if (magic == STO_SECTOR_MAGIC)
+            {
+                LOG_Error("Old file %s has been overwritten", header->name);
+                return false;
+            }
+        }
+    }
+
+    for (uint16_t i = first; i <= last; i++)
+    {
+        sectors[i].fileId = fileId;
+        sectors[i].blank = false;
+    }
+
+    return true;
+}
+
+
+
+/* Copies an old layout file into the pool under its own name */
+static int32_t migrateLegacyFile(int index, const STOLegacyHeader* header)
+{
+    static uint8_t copy[STO_MIGRATION_COPY_SIZE];
+
+    if (strlen(header->name) >= STO_MAX_FILE_NAME_LEN)
+    {
+        LOG_Error("Old file name %s is too long, dropped", header->name);
+        return 0;
+    }
+
+    if (getFile(header->name) != NULL)
+    {
+        /* Copied and renamed before a power failure, only the old header is left */
+        return 0;
+    }
+
+    STOFile* file = getFile(STO_MIGRATION_FILE_NAME);
+    if (file != NULL)
+    {
+        /* Copy cut short by a power failure */
+        discardFile(file);
+    }
+
+    file = createFile(STO_MIGRATION_FILE_NAME);
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    uint32_t contentAddr = STO_FLASH_START + (index * STO_LEGACY_FILE_SIZE) + sizeof(STOLegacyHeader);
+    for (uint32_t offset = 0; offset < header->fileSize; offset += sizeof(copy))
+    {
+        uint32_t len = header->fileSize - offset;
+        if (len > sizeof(copy))
+        {
+            len = sizeof(copy);
+        }
+
+        SPI_Flash_Read(contentAddr + offset, copy, len);
+        if (appendFile(file, copy, len) != 0)
+        {
+            discardFile(file);
+            return -1;
+        }
+    }
+
+    if (renameFile(file, header->name) != 0)
+    {
+        discardFile(file);
+        return -1;
+    }
+
+    LOG_Info("Migrated %s, %d bytes", header->name, header->fileSize);
+
+    return 0;
+}
+
+
+
+/*
+ * Moves the files of the old contiguous layout into the pool. Each file is
+ * copied under a temporary name and renamed, and only then is its old header
+ * erased, so a power failure at any point leaves either the old file or the
+ * new one for the next mount to find. The old sectors are kept out of
+ * allocation until their file has moved.
+ */
+static void migrateLegacyFiles(void)
+{
+    STOLegacyHeader headers[STO_LEGACY_FILE_COUNT];
+    bool present[STO_LEGACY_FILE_COUNT];
+
+    for (int f = 0; f < STO_LEGACY_FILE_COUNT; f++)
+    {
+        present[f] = readLegacyHeader(f, &headers[f]) &&
+                     assignLegacyExtent(f, &headers[f], STO_LEGACY_FILE_ID);
+    }
+
+    for (int f = 0; f < STO_LEGACY_FILE_COUNT; f++)
+    {
+        if (!present[f])
+        {
+            continue;
+        }
+
+        if (migrateLegacyFile(f, &headers[f]) != 0)
+        {
+            LOG_Error("Failed to migrate %s, kept for the next boot", headers[f].name);
+            continue;
+        }
+
+        /* Should the erase fail, the next mount finds the copy and erases again */
+        assignLegacyExtent(f, &headers[f], STO_FREE_FILE_ID);
+        formatSector((f * STO_LEGACY_FILE_SIZE) / FLASH_SECTOR_SIZE);
+    }
+}
+
+
+
+/* Rebuilds RAM views of sectors and files from flash */
+static void mountStore(void)
+{
+    STOSectorHeader header;
+    uint32_t maxEraseCount = 0;
+
+    memset(files, 0, sizeof(files));
+    memset(openFiles, 0, sizeof(openFiles));
+    nextFileId = 0;
+    nextAllocation = 0;
+
+    /* First pass, classify sectors */
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
+    {
+        STOSector* sector = &sectors[i];
+
+        SPI_Flash_Read(sectorAddr(i), (uint8_t*)&header, sizeof(header));
+
+        sector->fileId = STO_FREE_FILE_ID;
+        sector->sequence = 0;
+        sector->writeOffset = STO_SECTOR_DATA_START;
+        sector->blank = false;
+        sector->eraseCount = 0;
+
+        if (header.magic != STO_SECTOR_MAGIC)
+        {
+            /* Never formatted, or old layout content moved by migrateLegacyFiles */
+            continue;
+        }
+
+        sector->eraseCount = header.eraseCount;
+        if (header.eraseCount > maxEraseCount)
+        {
+            maxEraseCount = header.eraseCount;
+        }
+
+        if (header.fileId == STO_FREE_FILE_ID)
+        {
+            sector->blank = true;
+            continue;
+        }
+
+        if (header.fileId >= nextFileId)
+        {
+            nextFileId = header.fileId + 1;
+        }
+
+        if (header.obsolete != STO_SECTOR_LIVE)
+        {
+            continue;
+        }
+
+        sector->fileId = header.fileId;
+        sector->sequence = header.sequence;
+
+        if (header.sequence != 0)
+        {
+            continue;
+        }
+
+        /* First sector of a file, the latest name slot holds its name */
+        int used = STO_NAME_SLOTS - 1;
+        while (used > 0 && (uint8_t)header.name[used][0] == 0xFF)
+        {
+            used--;
+        }
+
+        /* A rename slot is zero padded, one cut short by a power failure is not */
+        int slot = used;
+        while (slot > 0 && header.name[slot][STO_MAX_FILE_NAME_LEN - 1] != '\0')
+        {
+            slot--;
+        }
+        header.name[slot][STO_MAX_FILE_NAME_LEN - 1] = '\0';
+
+        /* A file truncated during a power failure may still be around, newest wins */
+        STOFile* file = getFile(header.name[slot]);
+        if (file != NULL)
+        {
+            if (file->fileId > header.fileId)
+            {
+                sector->fileId = STO_FREE_FILE_ID;
+                continue;
+            }
+            sectors[file->firstSector].fileId = STO_FREE_FILE_ID;
+            memset(file, 0, sizeof(STOFile));
+        }
+        else
+        {
+            for (int f = 0; f < STO_MAX_FILE_COUNT; f++)
+            {
+                if (!files[f].inUse)
+                {
+                    file = &files[f];
+                    break;
+                }
+            }
+        }
+
+        if (file == NULL)
+        {
+            LOG_Error("Too many files in STO region, dropping %s", header.name[slot]);
+            sector->fileId = STO_FREE_FILE_ID;
+            continue;
+        }
+
+        file->inUse = true;
+        file->fileId = header.fileId;
+        strcpy(file->name, header.name[slot]);
+        file->nameSlot = used;
+        file->firstSector = i;
+    }
+
+    /* Second pass, chain sectors of each file and drop anything unreachable */
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
+    {
+        if (sectors[i].fileId == STO_FREE_FILE_ID)
+        {
+            continue;
+        }
+
+        STOFile* file = NULL;
+        for (int f = 0; f < STO_MAX_FILE_COUNT; f++)
+        {
+            if (files[f].inUse && files[f].fileId == sectors[i].fileId)
+            {
+                file = &files[f];
+            }
+        }
+
+        if (file == NULL)
+        {
+            /* Orphan of a removed file */
+            sectors[i].fileId = STO_FREE_FILE_ID;
+        }
+    }
+
+    for (int f = 0; f < STO_MAX_FILE_COUNT; f++)
+    {
+        STOFile* file = &files[f];
+
+        if (!file->inUse)
+        {
+            continue;
+        }
+
+        /* Sequences must be contiguous, anything past a gap is lost */
+        uint16_t count = 0;
+        uint16_t last = file->firstSector;
+        uint16_t i;
+        while ((i = findSector(file->fileId, count)) != STO_INVALID_SECTOR)
+        {
+            last = i;
+            count++;
+        }
+        for (i = 0; i < STO_SECTOR_COUNT; i++)
+        {
+            if (sectors[i].fileId == file->fileId && sectors[i].sequence >= count)
+            {
+                sectors[i].fileId = STO_FREE_FILE_ID;
+            }
+        }
+
+        file->sectorCount = count;
+        file->lastSector = last;
+        file->fileSize = walkChunks(file, NULL, NULL, 0);
+    }
+
+    /* Sectors with unknown history are assumed as worn as the most worn one */
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
+    {
+        if (sectors[i].eraseCount == 0)
+        {
+            sectors[i].eraseCount = maxEraseCount;
+        }
+    }
+    migrateLegacyFiles();
 }
 
 
@@ -180,13 +984,18 @@ static uint32_t findEmptyBlock(void)
  */
 void STO_Driver_Init(void)
 {
-    if (STO_LOCK)
+    if (STO_Initialised)
     {
          LOG_Info("STO already initialised");
          return;
     }
 
     OSAL_InitMutex(&STO_LOCK, NULL);
+    STO_Initialised = true;
+
+    OSAL_LockMutex(&STO_LOCK);
+    mountStore();
+    OSAL_UnLockMutex(&STO_LOCK);
 
     return;
 }
@@ -212,10 +1021,9 @@ Handle_t STO_Open(const char* fileName, OSAL_AccessMode_e accessMode)
 
     OSAL_LockMutex(&STO_LOCK);
 
-    /* Get file address in flash */
-    uint32_t fileAddr = getFileAddr(fileName);
+    STOFile* file = getFile(fileName);
 
-    if ((fileAddr == INVALID_BLOCK_ADDRESS) && (accessMode == READ_ONLY))
+    if ((file == NULL) && (accessMode == READ_ONLY))
     {
         LOG_Error("File %s does not exist to read!", fileName);
         OSAL_UnLockMutex(&STO_LOCK);
@@ -232,42 +1040,25 @@ Handle_t STO_Open(const char* fileName, OSAL_AccessMode_e accessMode)
         return NULL;
     }
 
-    OpenSTOFile* openFile = &openFiles[emptySlot];
-    openFile->accessMode = accessMode;
-    openFile->readOffset = 0;
-
     /* It is a new file */
-    if (fileAddr == INVALID_BLOCK_ADDRESS)
+    if (file == NULL)
     {
-        /* Find an empty block in flash for new file */
-        uint32_t emptyBlockAddr = findEmptyBlock();
+        file = createFile(fileName);
 
-        if (INVALID_BLOCK_ADDRESS == emptyBlockAddr)
+        if (file == NULL)
         {
-            LOG_Error("Not enough place to create a new file");
             OSAL_UnLockMutex(&STO_LOCK);
             return NULL;
         }
-
-        /* Prepare new file */
-        static uint8_t newFile[FLASH_SECTOR_SIZE];
-        STOFile *newfilePtr = (STOFile *)newFile;
-        memset(newFile, 0xFF, sizeof(newFile));
-        strcpy(newfilePtr->fileHeader.name, fileName);
-        newfilePtr->fileHeader.fileSize = 0;
-
-        /* Write new file to flash */
-        SPI_Flash_Write(emptyBlockAddr, newFile, STO_FILE_BLOCK_SIZE);
-
-        /* Keep File Flash Address */
-        openFile->fileOffset = emptyBlockAddr;
-    }
-    else
-    {
-        /* Keep Flash Address of existing file */
-        openFile->fileOffset = fileAddr;
     }
 
+    OpenSTOFile* openFile = &openFiles[emptySlot];
+    memset(openFile, 0, sizeof(OpenSTOFile));
+    openFile->file = file;
+    openFile->fileId = file->fileId;
+    openFile->accessMode = accessMode;
+    openFile->readChunkOffset = STO_SECTOR_DATA_START;
+
     /* Mark opened file as in use */
     openFile->inUse = true;
 
@@ -285,7 +1076,7 @@ Handle_t STO_Open(const char* fileName, OSAL_AccessMode_e accessMode)
  * \param buffer to be written data
  * \param buffer to be written data len
  *
- * \return 0 in success. -1 in case of fail.
+ * \return written length in success. -1 in case of fail.
  *
  */
 int32_t STO_Write(Handle_t handle, const void* buffer, size_t nBytes)
@@ -300,37 +1091,51 @@ int32_t STO_Write(Handle_t handle, const void* buffer, size_t nBytes)
 
     OSAL_LockMutex(&STO_LOCK);
 
-    static uint8_t updatedFile[FLASH_SECTOR_SIZE];
-    STOFile *updatedFilePtr = (STOFile *)updatedFile;
+    STOFile* file = openFile->file;
 
-    /* Read 1st block to RAM first */
-    SPI_Flash_Read(openFile->fileOffset, updatedFile, sizeof(updatedFile));
+    if (file == NULL || file->fileId != openFile->fileId)
+    {
+        LOG_Error("File has been removed while open!");
+        OSAL_UnLockMutex(&STO_LOCK);
+        return -1;
+    }
 
     if (openFile->accessMode == WRITE_ONLY ||
         openFile->accessMode == READ_WRITE)
     {
-        /* Write Modes overwrite content */
-        updatedFilePtr->fileHeader.fileSize = 0;
+        /* Write Modes overwrite content, the old sectors are simply discarded */
+        char name[STO_MAX_FILE_NAME_LEN];
+        strcpy(name, file->name);
+        discardFile(file);
+        file = createFile(name);
+        if (file == NULL)
+        {
+            openFile->inUse = false;
+            OSAL_UnLockMutex(&STO_LOCK);
+            return -1;
+        }
+        openFile->file = file;
+        openFile->fileId = file->fileId;
+
         /* For sequential writes, lets change to access mode to append after first write */
         openFile->accessMode = WRITE_APPEND;
     }
 
-    int32_t writeStart = updatedFilePtr->fileHeader.fileSize;
-    int32_t remainingLen = STO_MAX_FILE_CONTENT_LEN - writeStart;
-    int32_t writeLen = nBytes < remainingLen ? nBytes : remainingLen;
-
-    /* Increase file size */
-    updatedFilePtr->fileHeader.fileSize += writeLen;
-
-    /* Update file 1st block in flash */
-    updateFile(openFile->fileOffset, updatedFilePtr);
+    if (nBytes == 0)
+    {
+        OSAL_UnLockMutex(&STO_LOCK);
+        return 0;
+    }
 
-    /* Copy new content to file */
-    SPI_Flash_Write(openFile->fileOffset + offsetof(STOFile,content) + writeStart, (uint8_t *)buffer, writeLen);
+    if (appendFile(file, (const uint8_t*)buffer, nBytes) != 0)
+    {
+        OSAL_UnLockMutex(&STO_LOCK);
+        return -1;
+    }
 
     OSAL_UnLockMutex(&STO_LOCK);
 
-    return writeLen;
+    return nBytes;
 }
 
 
@@ -342,7 +1147,7 @@ int32_t STO_Write(Handle_t handle, const void* buffer, size_t nBytes)
  * \param buffer to be read data
  * \param buffer to be read data len
  *
- * \return 0 in success. -1 in case of fail.
+ * \return read length in success. -1 in case of fail.
  *
  */
 int32_t STO_Read(Handle_t handle, void* buffer, size_t nBytes)
@@ -357,16 +1162,16 @@ int32_t STO_Read(Handle_t handle, void* buffer, size_t nBytes)
 
     OSAL_LockMutex(&STO_LOCK);
 
-    STOFileHeader fileHeader;
-
-    /* Read header to RAM */
-    SPI_Flash_Read(openFile->fileOffset, (uint8_t *)&fileHeader, sizeof(fileHeader));
+    STOFile* file = openFile->file;
 
-    int32_t remainingLen = fileHeader.fileSize - openFile->readOffset;
-    int32_t readLen = nBytes < remainingLen ? nBytes : remainingLen;
+    if (file == NULL || file->fileId != openFile->fileId)
+    {
+        LOG_Error("File has been removed while open!");
+        OSAL_UnLockMutex(&STO_LOCK);
+        return -1;
+    }
 
-    /* Read data to user buffer */
-    SPI_Flash_Read(openFile->fileOffset + offsetof(STOFile,content) + openFile->readOffset, (uint8_t *)buffer, readLen);
+    int32_t readLen = walkChunks(file, openFile, (uint8_t*)buffer, nBytes);
 
     /* Increase Read offset for sequential reads */
     openFile->readOffset += readLen;
@@ -422,10 +1227,10 @@ int32_t STO_Rename(const char * oldName, const char * newName)
     }
 
     OSAL_LockMutex(&STO_LOCK);
-    /* Get file address in flash */
-    uint32_t fileAddr = getFileAddr(oldName);
 
-    if (fileAddr == INVALID_BLOCK_ADDRESS)
+    STOFile* file = getFile(oldName);
+
+    if (file == NULL)
     {
         LOG_Error("File %s does not exist!", oldName);
         OSAL_UnLockMutex(&STO_LOCK);
@@ -433,37 +1238,18 @@ int32_t STO_Rename(const char * oldName, const char * newName)
     }
 
     //////// [RE:added] Check if new name already exists
-    uint32_t fileAddrExists = getFileAddr(newName);
-    if (fileAddrExists != INVALID_BLOCK_ADDRESS)
+    if (getFile(newName) != NULL)
     {
         LOG_Error("Filename already exists!");
         OSAL_UnLockMutex(&STO_LOCK);
         return status;
     }
 
-    static uint8_t renamedFile[FLASH_SECTOR_SIZE];
-    STOFile *renamedFilePtr = (STOFile *)renamedFile;
-
-    /* Read flash content to RAM */
-    if ( (status = SPI_Flash_Read(fileAddr, renamedFile, sizeof(renamedFile))) == 0 )
-    {
-        /* Change file name */
-        strcpy(renamedFilePtr->fileHeader.name, newName);
-
-        /* Update file in flash  */
-        if ( (status = updateFile(fileAddr, renamedFilePtr)) != 0 )
-        {
-            LOG_Error("Failed to rename file %s to %s",oldName,newName);
-        }
-    }
-    else
-    {
-        LOG_Error("Failed to read file %s",oldName);
-    }
+    status = renameFile(file, newName);
 
     OSAL_UnLockMutex(&STO_LOCK);
 
-    return 0;
+    return status;
 }
 
 
@@ -478,33 +1264,23 @@ int32_t STO_Rename(const char * oldName, const char * newName)
  */
 int32_t STO_Remove(const char * fileName)
 {
-    int32_t status = 0;
-
     OSAL_LockMutex(&STO_LOCK);
 
-    /* Get file address in flash  */
-    uint32_t fileAddr = getFileAddr(fileName);
+    STOFile* file = getFile(fileName);
 
-    if (fileAddr == INVALID_BLOCK_ADDRESS)
+    if (file == NULL)
     {
         LOG_Error("File %s does not exist!", fileName);
         OSAL_UnLockMutex(&STO_LOCK);
         return -1;
     }
 
-    /* Erase file */
-    for (int i = 0; i < STO_MAX_FILE_SIZE / STO_FILE_BLOCK_SIZE; i++)
-    {
-        if (SPI_Flash_Erase(fileAddr + (i * STO_FILE_BLOCK_SIZE)) != 0)
-        {
-            LOG_Error("Failed to erase 0x%08x", i * STO_FILE_BLOCK_SIZE);
-            status = -1;
-        }
-    }
+    /* Sectors are only marked here, they get erased when reused */
+    discardFile(file);
 
     OSAL_UnLockMutex(&STO_LOCK);
 
-    return status;
+    return 0;
 }
 
 
@@ -519,33 +1295,24 @@ int32_t STO_Remove(const char * fileName)
  */
 int32_t STO_FileSize(const char * fileName)
 {
-    int32_t status = -1;
+    int32_t size = 0;
 
     OSAL_LockMutex(&STO_LOCK);
 
-    /* Get file address in flash */
-    uint32_t fileAddr = getFileAddr(fileName);
+    STOFile* file = getFile(fileName);
 
-    if (fileAddr == INVALID_BLOCK_ADDRESS)
+    if (file == NULL)
     {
         LOG_Error("File %s does not exist!", fileName);
-        OSAL_UnLockMutex(&STO_LOCK);
-        return 0;
     }
-
-    STOFileHeader fileHeader;
-
-    /* Just read flash header */
-    if ( (status = SPI_Flash_Read(fileAddr, (uint8_t *)&fileHeader, sizeof(STOFileHeader))) != 0 )
+    else
     {
-        LOG_Error("Failed to read file %s", fileName);
-        OSAL_UnLockMutex(&STO_LOCK);
-        return 0;
+        size = file->fileSize;
     }
 
     OSAL_UnLockMutex(&STO_LOCK);
 
-    return fileHeader.fileSize;
+    return size;
 }
 
 
@@ -564,7 +1331,7 @@ bool STO_FileExist(const char * fileName)
 
     OSAL_LockMutex(&STO_LOCK);
 
-    if (getFileAddr(fileName) != INVALID_BLOCK_ADDRESS)
+    if (getFile(fileName) != NULL)
     {
         status = true;
     }
@@ -577,7 +1344,7 @@ bool STO_FileExist(const char * fileName)
 
 
 /*
- * \brief Formats all flash storage.
+ * \brief Formats all flash storage. Erase counts are kept.
  *
  * \param none
  *
@@ -587,21 +1354,20 @@ void STO_FormatDevice(void)
 {
     OSAL_LockMutex(&STO_LOCK);
 
-    for (int i = 0; i < STO_FLASH_SIZE / FLASH_SECTOR_SIZE; i++)
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
     {
-        if (SPI_Flash_Erase(STO_FLASH_START + (i * FLASH_SECTOR_SIZE)) != 0)
-        {
-            LOG_Error("Failed to erase 0x%08x", i * FLASH_SECTOR_SIZE);
-        }
+        formatSector(i);
     }
 
+    mountStore();
+
     OSAL_UnLockMutex(&STO_LOCK);
 }
 
 
 
 /*
- * \brief Lists all files in flash storage.
+ * \brief Lists all files and sector wear in flash storage.
  *
  * \param none
  *
@@ -611,18 +1377,36 @@ void STO_List(void)
 {
     OSAL_LockMutex(&STO_LOCK);
 
-    STOFileHeader fileHeader;
-    uint32_t fileAddr;
-
     for (int i = 0; i < STO_MAX_FILE_COUNT; i++)
     {
-        /* Test next file */
-        fileAddr = STO_FLASH_START + (i * STO_MAX_FILE_SIZE);
-        /* Read just file header */
-        SPI_Flash_Read(fileAddr, (uint8_t *)(&fileHeader), sizeof(fileHeader));
+        STOFile* file = &files[i];
 
-        LOG_Info("@%p %d of %d : %s", fileAddr, (i + 1), STO_MAX_FILE_COUNT, fileHeader.name);
+        if (file->inUse)
+        {
+            LOG_Info("@%p %d of %d : %s, %d bytes in %d sectors", sectorAddr(file->firstSector),
+                     (i + 1), STO_MAX_FILE_COUNT, file->name, file->fileSize, file->sectorCount);
+        }
+        else
+        {
+            LOG_Info("%d of %d : <empty>", (i + 1), STO_MAX_FILE_COUNT);
+        }
+    }
+
+    uint32_t minErase = 0xFFFFFFFF;
+    uint32_t maxErase = 0;
+    for (uint16_t i = 0; i < STO_SECTOR_COUNT; i++)
+    {
+        if (sectors[i].eraseCount < minErase)
+        {
+            minErase = sectors[i].eraseCount;
+        }
+        if (sectors[i].eraseCount > maxErase)
+        {
+            maxErase = sectors[i].eraseCount;
+        }
     }
+    LOG_Info("%d of %d sectors free, erase count min %d max %d",
+             freeSectorCount(), STO_SECTOR_COUNT, minErase, maxErase);
 
     OSAL_UnLockMutex(&STO_LOCK);
 }
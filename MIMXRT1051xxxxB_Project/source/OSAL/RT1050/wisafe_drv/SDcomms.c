@@ -7,12 +7,15 @@
 
 #define _SDCOMMS_C_
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include "wisafe_main.h"
 #include "fsl_gpio.h"
 #include "fsl_debug_console.h"
 #include "pin_mux.h"
 #include "clock_config.h"
 #include "SDcomms.h"
+#include "SDframe.h"
 #include "fsl_lpuart.h"
 #include <timer.h> //nishi
 #include "messages.h"
@@ -21,6 +24,8 @@
 
 #include "LOG_Api.h"
 
+#include <string.h>
+
 
 /*******************************************************************************
 * Definitions
@@ -31,6 +36,13 @@
 #define DEBUG_LPUART_IRQn 		LPUART1_IRQn
 #define DEBUG_LPUART_IRQHandler LPUART1_IRQHandler
 
+/* Receive ring between the UART interrupt and the main loop, a power of 2 */
+#define SD_RX_RING_BYTES 		256
+
+#if SDFRAME_MAX_BYTES != SPIMSGSIZE
+#error SDFRAME_MAX_BYTES must match SPIMSGSIZE
+#endif
+
 /*******************************************************************
 
 	local procedures
@@ -38,33 +50,60 @@
 *******************************************************************/
 
 static void ProcessIncomingMsg(void);
-static void SaveIncomingByte(uint8_t IncomingByte);
-static void ProcessIncomingByte(void);
+static void AcceptIncomingFrame(const SDframe_t *frame);
 static void SendOutgoingRawByte(uint8_t OutgoingByte);
 static void SendOutgoingMsgByte(uint8_t OutgoingMsgByte);
 static void SendOutgoingMsgEnd(void);
 static void SendOutgoingMsgBlock (volatile uint8_t *BlockPtr, uint8_t Count);
-static void ProcessIncomingByteRaw(uint8_t data);
 
 
-static uint8_t SerialData;
+static SDframe_t QueueFrame;			// messages from the WG queue
 
 #if TEST_WISAFE_DRIVER
+static SDframe_t UartFrame;				// messages from the UART
+static uint8_t SDRxRing[SD_RX_RING_BYTES];
+static volatile uint16_t SDRxHead;		// written by the interrupt
+static volatile uint16_t SDRxTail;		// written by the main loop
+static volatile uint32_t SDRxOverruns;	// bytes lost to a full ring or FIFO
+
 /*******************************************************************************
  * \brief	LPUART interrupt handler.
  *
+ * Taken when the receive FIFO passes its watermark, or the line goes idle
+ * with bytes left below it. The FIFO is emptied into the ring in one go;
+ * unescaping and framing are left to the main loop.
+ *
  * \param   None.
  * \return	None.
  ******************************************************************************/
 
 void DEBUG_LPUART_IRQHandler(void)
 {
-    // If new data arrived.
-    if ((kLPUART_RxDataRegFullFlag)&LPUART_GetStatusFlags(DEBUG_LPUART))
-    {
-    	SerialData = DEBUG_LPUART->DATA;
-    	ProcessIncomingByte();
-    }
+	uint32_t status = LPUART_GetStatusFlags(DEBUG_LPUART);
+
+	while (DEBUG_LPUART->WATER & LPUART_WATER_RXCOUNT_MASK)
+	{
+		uint8_t data = DEBUG_LPUART->DATA;
+		uint16_t next = (SDRxHead + 1) & (SD_RX_RING_BYTES - 1);
+		if (next == SDRxTail)
+		{
+			SDRxOverruns++;
+		}
+		else
+		{
+			SDRxRing[SDRxHead] = data;
+			SDRxHead = next;
+		}
+	}
+
+	if (status & kLPUART_RxOverrunFlag)
+	{
+		SDRxOverruns++;
+	}
+	if (status & (kLPUART_IdleLineFlag | kLPUART_RxOverrunFlag))
+	{
+		LPUART_ClearStatusFlags(DEBUG_LPUART, status & (kLPUART_IdleLineFlag | kLPUART_RxOverrunFlag));
+	}
     /* Add for ARM errata 838869, affects Cortex-M4, Cortex-M4F Store immediate overlapping
       exception return operation might vector to incorrect interrupt */
 #if defined __CORTEX_M && (__CORTEX_M == 4U)
@@ -97,16 +136,60 @@ void Init_Uart(void)
 	config.baudRate_Bps = (19200U);					//BOARD_DEBUG_UART_BAUDRATE;
 	config.enableTx = true;
 	config.enableRx = true;
+	config.rxFifoWatermark = 2;						// interrupt with 3 of 4 FIFO entries used
+	config.rxIdleType = kLPUART_IdleTypeStopBit;
+	config.rxIdleConfig = kLPUART_IdleCharacter1;	// and one character time after the last byte
+
+	SDframe_Init(&UartFrame);
+	SDRxHead = 0;
+	SDRxTail = 0;
 
 	LPUART_Init(DEBUG_LPUART, &config, DEBUG_LPUART_CLK_FREQ);
 
-	// Enable RX interrupt.
-	LPUART_EnableInterrupts(DEBUG_LPUART, kLPUART_RxDataRegFullInterruptEnable);
+	// Enable RX interrupts.
+	LPUART_EnableInterrupts(DEBUG_LPUART, kLPUART_RxDataRegFullInterruptEnable | kLPUART_IdleLineInterruptEnable |
+										  kLPUART_RxOverrunInterruptEnable);
 	EnableIRQ(DEBUG_LPUART_IRQn);
 }
 
 
 
+/*******************************************************************************
+ * \brief	Decode bytes received by the UART, up to the first complete message.
+ *
+ * \note	Call only while SDMsgRcvd is SPIMSG_NULL. Any further messages are
+ *			left in the ring for the next call.
+ *
+ * \param   None.
+ * \return	None.
+ ******************************************************************************/
+
+void ProcessIncomingUart(void)
+{
+	uint16_t head = SDRxHead;
+
+	while (SDRxTail != head)
+	{
+		uint16_t end = (head > SDRxTail) ? head : SD_RX_RING_BYTES;	// contiguous bytes
+		size_t used = SDframe_Decode(&UartFrame, &SDRxRing[SDRxTail], end - SDRxTail);
+		SDRxTail = (SDRxTail + used) & (SD_RX_RING_BYTES - 1);
+
+		if (UartFrame.ready)
+		{
+			AcceptIncomingFrame(&UartFrame);
+			break;
+		}
+	}
+
+	if (SDRxOverruns)
+	{
+		LOG_Warning("SD link lost %u bytes", (unsigned)SDRxOverruns);
+		SDRxOverruns = 0;
+	}
+}
+
+
+
 /*******************************************************************************
  * \brief	Test LPUART.
  *
@@ -241,61 +324,17 @@ static void ProcessIncomingMsg(void)
 
 
 /*******************************************************************************
- * \brief	Save incoming byte.
- *
- * \param   IncomingByte. Byte to be saved.
- * \return	None.
- ******************************************************************************/
-
-static void SaveIncomingByte(uint8_t IncomingByte)
-{
-	// save incoming message byte
-	if (IncomingMsgLen<SPIMSGSIZE)
-	{
-		IncomingMsg[IncomingMsgLen++] = IncomingByte;			// append byte to message
-	}
-	else
-	{
-		// incoming message too long - maybe RM crashed and rebooted?
-		// note - could take some action in this case...
-		IncomingMsgLen = 0;										// throw away whatever is in our buffer
-	}
-}
-
-
-
-/*******************************************************************************
- * \brief	Process incoming byte.
+ * \brief	Take a decoded message and analyse it.
  *
- * \param   None.
+ * \param   *frame. Decoder holding a complete message.
  * \return	None.
  ******************************************************************************/
 
-static void ProcessIncomingByte(void)
+static void AcceptIncomingFrame(const SDframe_t *frame)
 {
-	// we received a byte in SSPBUF
-
-	if (IncomingEscapeState)
-	{
-		// we are in escape state - previous incoming byte was ESC
-		SaveIncomingByte((SerialData==1)? FLAG: ESC);					// {ESC,1} means FLAG, {ESC,2} means ESC
-		IncomingEscapeState = false;									// no longer in escape state
-	}
-	else
-	{
-		if (SerialData==ESC)
-		{
-			IncomingEscapeState = true;									// ESC received means we enter escape state
-		}
-		else if (SerialData==FLAG)
-		{
-			ProcessIncomingMsg();										// FLAG received means we have end of message
-		}
-		else
-		{
-			SaveIncomingByte(SerialData);								// here is next incoming byte
-		}
-	}
+	memcpy((uint8_t *)IncomingMsg, frame->msg, frame->length);
+	IncomingMsgLen = frame->length;
+	ProcessIncomingMsg();
 }
 
 
@@ -679,56 +718,17 @@ void SendRMProdTstResponseMsg(void)
 
 void ProcessIncomingMsgRaw(uint8_t *ptr)
 {
-	uint8_t data,index;
-
-	index = 0;
-	do
-	{
-		data = ptr[index++];
-		ProcessIncomingByteRaw(data);
-	}while( (data != 0x7E) && (index<sizeof(IncomingMsgRaw)) );
-}
-
+	// a queue item holds one message, up to and including its FLAG
+	const uint8_t *flag = memchr(ptr, FLAG, sizeof(IncomingMsgRaw));
+	size_t length = flag ? (size_t)(flag - ptr) + 1 : sizeof(IncomingMsgRaw);
+	size_t used = 0;
 
-
-/*******************************************************************************
- * \brief	Process incoming byte.
- *
- * \param   data. Byte to be processed.
- * \return	None.
- ******************************************************************************/
-
-static void ProcessIncomingByteRaw(uint8_t data)
-{
-	if (IncomingEscapeState)
+	while (used < length)
 	{
-		// we are in escape state - previous incoming byte was ESC
-		SaveIncomingByte((data==1)? FLAG: ESC);						// {ESC,1} means FLAG, {ESC,2} means ESC
-		IncomingEscapeState = false;								// no longer in escape state
-	}
-	else
-	{
-		if (data==ESC)
+		used += SDframe_Decode(&QueueFrame, &ptr[used], length - used);
+		if (QueueFrame.ready)
 		{
-			IncomingEscapeState = true;								// ESC received means we enter escape state
-		}
-		else if (data==FLAG)
-		{
-			ProcessIncomingMsg();									// FLAG received means we have end of message
-		}
-		else
-		{
-			SaveIncomingByte(data);									// here is next incoming byte
+			AcceptIncomingFrame(&QueueFrame);
 		}
 	}
 }
-
-
-
-
-
-
-
-
-
-
@@ -31,7 +31,6 @@ volatile uint16_t StatusRequestTime;		// time we last sent Status message to SD
 
 volatile uint8_t IncomingMsg[SPIMSGSIZE];	// messages from SD to RM arrive here
 volatile uint8_t IncomingMsgLen;			// index into IncomingMsg
-volatile bool IncomingEscapeState=false;	// nonzero means an escape byte just received
 volatile uint8_t OutgoingMsg[SPIMSGSIZE];	// messages from RM to SD arrive here
 uint8_t OutgoingMsgRaw[SPIMSGSIZE];
 uint8_t IncomingMsgRaw[SPIMSGSIZE];
@@ -52,6 +51,7 @@ void SendRMIdResponseMsg(void);
 void SendRMExtendedResponseMsg(void);
 void SendRMProdTstResponseMsg(void);
 void ProcessIncomingMsgRaw(uint8_t *ptr);
+void ProcessIncomingUart(void);
 
 #else
 
@@ -68,7 +68,6 @@ extern volatile uint16_t StatusRequestTime;		// time we last sent Status message
 
 extern volatile uint8_t IncomingMsg[];	// messages from SD to RM arrive here
 extern volatile uint8_t IncomingMsgLen;			// index into IncomingMsg
-extern volatile bool IncomingEscapeState;			// nonzero means an escape byte just received
 extern volatile uint8_t OutgoingMsg[];	// messages from RM to SD arrive here
 extern uint8_t OutgoingMsgRaw[];
 extern uint8_t IncomingMsgRaw[];
@@ -89,6 +88,7 @@ extern void SendRMIdResponseMsg(void);
 extern void SendRMExtendedResponseMsg(void);
 extern void SendRMProdTstResponseMsg(void);
 extern void ProcessIncomingMsgRaw(uint8_t *ptr);
+extern void ProcessIncomingUart(void);
 
 #endif // _SDCOMMS_C_
 
@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * \file	SDframe.c
+ * \brief 	Decoder for messages on the SD link.
+ * \note 	Project: 	WG2. Low cost wireless gateway
+ ******************************************************************************/
+
+#include <string.h>
+
+#include "SDframe.h"
+
+
+
+/*******************************************************************************
+ * \brief	End the message at a FLAG.
+ *
+ * \param   *frame. Decoder state.
+ * \return	true if the message is to be passed on.
+ ******************************************************************************/
+
+static bool EndMessage(SDframe_t *frame)
+{
+	if (frame->bad)
+	{
+		frame->errors++;
+	}
+	else if (frame->length > 0)
+	{
+		frame->messages++;
+		frame->ready = true;
+		return true;
+	}
+
+	// empty or dropped - start again
+	frame->length = 0;
+	frame->bad = false;
+	return false;
+}
+
+
+
+/*******************************************************************************
+ * \brief	Reset a decoder. A zeroed decoder is also ready to use.
+ *
+ * \param   *frame. Decoder state.
+ * \return	None.
+ ******************************************************************************/
+
+void SDframe_Init(SDframe_t *frame)
+{
+	memset(frame, 0, sizeof(*frame));
+}
+
+
+
+/*******************************************************************************
+ * \brief	Decode received bytes, up to the end of the first complete message.
+ *
+ * Runs of ordinary bytes are copied in one go. On return frame->ready is set
+ * if frame->msg holds a complete message; it stays there until the next
+ * call, which starts the next message.
+ *
+ * \param   *frame. Decoder state.
+ * \param   *data. Received bytes.
+ * \param   length. Number of bytes.
+ * \return	Number of bytes used.
+ ******************************************************************************/
+
+size_t SDframe_Decode(SDframe_t *frame, const uint8_t *data, size_t length)
+{
+	size_t used = 0;
+
+	if (frame->ready)
+	{
+		frame->ready = false;
+		frame->length = 0;
+	}
+
+	while (used < length)
+	{
+		uint8_t byte = data[used];
+
+		if (frame->escape)
+		{
+			frame->escape = false;
+			if (byte == SDFRAME_FLAG)
+			{
+				// message cut short after an ESC
+				frame->bad = true;
+				continue;									// FLAG handled below
+			}
+			used++;
+			if ((byte != SDFRAME_ESC_FLAG) && (byte != SDFRAME_ESC_ESC))
+			{
+				frame->bad = true;
+			}
+			else if (frame->length < SDFRAME_MAX_BYTES)
+			{
+				frame->msg[frame->length++] = (byte == SDFRAME_ESC_FLAG) ? SDFRAME_FLAG : SDFRAME_ESC;
+			}
+			else
+			{
+				frame->bad = true;							// too long
+			}
+		}
+		else if (byte == SDFRAME_ESC)
+		{
+			used++;
+			frame->escape = true;
+		}
+		else if (byte == SDFRAME_FLAG)
+		{
+			used++;
+			if (EndMessage(frame))
+			{
+				return used;
+			}
+		}
+		else
+		{
+			// copy the run of ordinary bytes
+			size_t run = 1;
+			while ((used + run < length) && (data[used + run] != SDFRAME_FLAG) && (data[used + run] != SDFRAME_ESC))
+			{
+				run++;
+			}
+			if (frame->bad || (frame->length + run > SDFRAME_MAX_BYTES))
+			{
+				frame->bad = true;							// too long
+			}
+			else
+			{
+				memcpy(&frame->msg[frame->length], &data[used], run);
+				frame->length += run;
+			}
+			used += run;
+		}
+	}
+
+	return used;
+}
@@ -0,0 +1,46 @@
+/*******************************************************************************
+ * \file	SDframe.h
+ * \brief 	Decoder for messages on the SD link.
+ * \note 	Project: 	WG2. Low cost wireless gateway
+ *
+ * Messages end with FLAG (0x7E). Inside a message FLAG is sent as {ESC,1}
+ * and ESC (0x7D) as {ESC,2}. The link has no checksum, so a message is only
+ * passed on if it is well formed: it fits in SDFRAME_MAX_BYTES, every ESC is
+ * followed by 1 or 2, and it is not empty. Anything else is dropped up to
+ * the next FLAG.
+ *
+ * The decoder has no dependencies on the board or the RTOS, so it can be
+ * built and exercised on a PC.
+ ******************************************************************************/
+
+#ifndef _SDFRAME_H_
+#define _SDFRAME_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SDFRAME_FLAG 			0x7E
+#define SDFRAME_ESC 			0x7D
+#define SDFRAME_ESC_FLAG 		0x01		// {ESC,1} means FLAG
+#define SDFRAME_ESC_ESC 		0x02		// {ESC,2} means ESC
+
+#ifndef SDFRAME_MAX_BYTES
+#define SDFRAME_MAX_BYTES 		16			// same as SPIMSGSIZE
+#endif
+
+typedef struct
+{
+	uint8_t msg[SDFRAME_MAX_BYTES];			// message being decoded
+	uint8_t length;							// bytes of it so far
+	bool escape;							// previous byte was ESC
+	bool bad;								// drop the message at its FLAG
+	bool ready;								// msg holds a complete message
+	uint32_t messages;						// messages decoded
+	uint32_t errors;						// messages dropped
+} SDframe_t;
+
+void SDframe_Init(SDframe_t *frame);
+size_t SDframe_Decode(SDframe_t *frame, const uint8_t *data, size_t length);
+
+#endif // _SDFRAME_H_
@@ -8,6 +8,8 @@
 
 #define _FILESYSTEM_C_
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdio.h>
 #include "fsl_flexspi.h"
 #include "fsl_debug_console.h"
@@ -10,6 +10,8 @@
 #define _LOGIC_C_
 
 //#include "wisafe_main.h"
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include "fsl_gpio.h"
 #include "fsl_device_registers.h"
 #include "fsl_debug_console.h"
@@ -772,6 +774,12 @@ void RM_MainLoop(void)
 		{
 			commandTimeoutCount=0;
 			checkWGtoRMqueue();
+#if TEST_WISAFE_DRIVER
+			if(SDMsgRcvd==SPIMSG_NULL)
+			{
+				ProcessIncomingUart();
+			}
+#endif
 		}
 		else
 		{
@@ -69,6 +69,7 @@ uint8_t ReverseByte(uint8_t byte);
 uint16_t GetCRC(void);
 void CRCInit(void);
 void CRCByte(uint8_t byte);
+void CRCBlock(const volatile uint8_t *dataptr, uint8_t len);
 void BuildOkMsg(uint8_t *dataptr);
 void BuildRumorAckMsg(uint8_t *dataptr);
 void BuildJoinRequestMsg(uint8_t *dataptr);
@@ -105,6 +106,7 @@ extern uint8_t ReverseByte(uint8_t byte);
 extern uint16_t GetCRC(void);
 extern void CRCInit(void);
 extern void CRCByte(uint8_t byte);
+extern void CRCBlock(const volatile uint8_t *dataptr, uint8_t len);
 extern void BuildOkMsg(uint8_t *dataptr);
 extern void BuildRumorAckMsg(uint8_t *dataptr);
 extern void BuildJoinRequestMsg(uint8_t *dataptr);
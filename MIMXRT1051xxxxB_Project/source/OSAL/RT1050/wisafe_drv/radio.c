@@ -8,6 +8,8 @@
 
 #define _RADIO_C_
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <wisafe_main.h>
 #include "fsl_gpio.h"
 #include "fsl_debug_console.h"
@@ -910,10 +912,7 @@ bool ReceiveJoinAckMessage(void)
 			{
 				CRCInit();
 				CRCByte(MSG_LEN_LONG);
-				for (uint8_t i=0; i<JOIN_ACK_MESSAGE_LEN; i++)
-				{
-					CRCByte(RxData[i]);
-				}
+				CRCBlock(RxData, JOIN_ACK_MESSAGE_LEN);
 
 				if( GetCRC()==CRC_CHECK )
 				{
@@ -1123,10 +1122,7 @@ bool ReceiveRumourAckMessage(uint8_t id)
 			DownloadMessage(RUMOUR_ACK_MESSAGE_LEN);
 			CRCInit();
 			CRCByte(MediumMsgFirstByte);
-			for (uint8_t i=0; i<RUMOUR_ACK_MESSAGE_LEN; i++)
-			{
-				CRCByte(RxData[i]);
-			}
+			CRCBlock(RxData, RUMOUR_ACK_MESSAGE_LEN);
 			if( GetCRC()==CRC_CHECK )
 			{
 				if((RxData[0]&SID_MASK)==id)
@@ -1206,10 +1202,7 @@ bool ReceivePropagateAckMessage(uint8_t id)
 			DownloadMessage(PROPAGATE_ACK_MESSAGE_LEN);
 			CRCInit();
 			CRCByte(MediumMsgFirstByte);
-			for (uint8_t i=0; i<PROPAGATE_ACK_MESSAGE_LEN; i++)
-			{
-				CRCByte(RxData[i]);
-			}
+			CRCBlock(RxData, PROPAGATE_ACK_MESSAGE_LEN);
 			if( GetCRC()==CRC_CHECK )
 			{
 				if((RxData[0]&SID_MASK)==id)
@@ -1462,10 +1455,10 @@ bool ChirpToReceive(void)
 			DownloadMessage(JOIN_ACK_MESSAGE_LEN);
 			CRCInit();
 			CRCByte(LongMsgFirstByte);
+			CRCBlock(RxData, JOIN_ACK_MESSAGE_LEN);
 			rcvbuf[0] = LongMsgFirstByte;
 			for (uint8_t i=0; i<JOIN_ACK_MESSAGE_LEN; i++)
 			{
-				CRCByte(RxData[i]);
 				rcvbuf[i+1] = RxData[i];
 			}
 
@@ -2,6 +2,8 @@
  * Includes
  ******************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
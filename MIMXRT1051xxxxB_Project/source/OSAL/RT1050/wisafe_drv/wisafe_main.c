@@ -36,6 +36,8 @@
  * \author  Abdul Ben-Rashed
  ******************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_WISAFE
+
 /* FreeRTOS kernel includes. */
 #include <timer.h>
 #include "FreeRTOS.h"
@@ -249,7 +251,10 @@ void Wisafe_Main(void)
     Init_LPSPI();
     Init_Timer();
     Init_Radio();
-    // Init_Uart();     //////// [RE:workaround] This interferes with the stack's use of the UART for debug messages
+#if TEST_WISAFE_DRIVER
+    Init_Uart();        // SD link on LPUART1, in place of the debug console
+#endif
+    //////// [RE:workaround] Otherwise the UART is left to the stack's debug messages
     Init_FileSystem();
     Init_RM();
 
@@ -198,6 +198,24 @@ int OSAL_GetMessageQueueNumCurrentMessages(MessageQueue_t messageQueue);
 */
 int OSAL_GetMessageQueueMaxMessageSize(MessageQueue_t messageQueue);
 
+/**
+ * \brief   get the largest number of message slots that have been in use at
+ *          once on this queue
+ *
+ * \param   messageQueue message queue
+ * \return  high water mark, -1 if error
+*/
+int OSAL_GetMessageQueueHighWaterMark(MessageQueue_t messageQueue);
+
+/**
+ * \brief   get the number of sends that failed because no message slot was
+ *          free (non-blocking queues only)
+ *
+ * \param   messageQueue message queue
+ * \return  number of failed allocations, -1 if error
+*/
+int OSAL_GetMessageQueueAllocationFailures(MessageQueue_t messageQueue);
+
 /**
  * \brief   Close the message queue
  *
@@ -345,6 +363,24 @@ int OSAL_DestroyMutex(Mutex_t * mutex);
  */
 void OSAL_Log(const char *format, ...);
 
+/**
+ * \brief   Deferred log implementation, called by the LOG_* macros when
+ *          LOG_DEFERRED is set. Records the format address and the raw
+ *          arguments, the text is rebuilt off target by LOG_Decode.py
+ *
+ * \param   level    - LOG_Level_e of the message
+ * \param   function - name of the calling function
+ * \param   format   - printf format string, placed in .log_fmt
+ * \param   ...      - varargs for printf
+ */
+void OSAL_LogDeferred(uint8_t level, const char * function, const char * format, ...);
+
+/**
+ * \brief   Write pending deferred log records to the debug console, called
+ *          by the log output task
+ */
+void OSAL_LogDrain(void);
+
 /**
  * \brief   Variation of malloc that will allow us to allocate from a buffer
  *          pool (if we ever need to).
@@ -411,6 +447,13 @@ size_t OSAL_GetAmountStored( MemoryHandle_t handle );
  */
 size_t OSAL_SetAmountStored( MemoryHandle_t handle, size_t newAmount );
 
+/**
+ * \brief   Get the amount of heap currently available for allocation
+ *
+ * \return  Free heap in bytes.
+ */
+size_t OSAL_GetFreeHeapSize(void);
+
 /**
  * \brief   Gets the memory block associated with a handle
  *
@@ -563,4 +606,67 @@ int OSAL_GiveBinarySemaphore(Semaphore_t *semaphore);
  * \return  0 on success, or error code
 */
 int OSAL_TakeBinarySemaphore(Semaphore_t *semaphore);
+
+/**
+ * \brief   Initialize a counting semaphore
+ *
+ * \param   semaphore pointer to semaphore
+ * \param   maxCount largest count the semaphore can reach
+ * \param   initialCount count on return
+ * \return  0 on success, -1 on failure
+*/
+int OSAL_InitCountingSemaphore(Semaphore_t * semaphore, uint32_t maxCount, uint32_t initialCount);
+
+/**
+ * \brief   Give (increment) a counting semaphore
+ *
+ * \param   semaphore pointer to semaphore
+ * \return  0 on success, -1 if the semaphore is already at its maximum count
+*/
+int OSAL_GiveCountingSemaphore(Semaphore_t * semaphore);
+
+/**
+ * \brief   Take (decrement) a counting semaphore, waiting up to a timeout
+ *
+ * \param   semaphore pointer to semaphore
+ * \param   timeoutMs time to wait in milliseconds, 0 to poll
+ * \return  0 on success, -1 with errno ETIMEDOUT if the count stayed at 0
+*/
+int OSAL_TakeCountingSemaphore(Semaphore_t * semaphore, uint32_t timeoutMs);
+
+/**
+ * \brief   Update a CRC-32 (IEEE 802.3) with more data
+ *
+ * \param   crc  CRC of the data so far, 0 to start
+ * \param   data pointer to the next data
+ * \param   size number of bytes of data
+ * \return  CRC of all the data
+*/
+uint32_t OSAL_Crc32(uint32_t crc, const void * data, size_t size);
+
+typedef enum
+{
+    OSAL_POWER_MAINS_LOST,
+    OSAL_POWER_MAINS_RESTORED,
+    OSAL_POWER_BATTERY_LOW,         // Running from a battery which is nearly flat
+} OSAL_PowerEvent_e;
+
+typedef void (*OSAL_PowerEventCallback_t)(OSAL_PowerEvent_e event);
+
+/**
+ * \brief   Register the function told about mains and battery events. If
+ *          power is failing already it is called straight away with the
+ *          last event.
+ *
+ * \param   callback function called from the thread reporting the event,
+ *                   NULL for none
+*/
+void OSAL_RegisterPowerEventCallback(OSAL_PowerEventCallback_t callback);
+
+/**
+ * \brief   Report a mains or battery event to the registered function
+ *
+ * \param   event the event
+*/
+void OSAL_NotifyPowerEvent(OSAL_PowerEvent_e event);
 #endif
@@ -14,7 +14,11 @@
 #ifndef OSAL_TYPES_H
 #define OSAL_TYPES_H
 
+#if OSAL_POSIX
+#include "../OSAL/Posix/Platform.h"
+#else
 #include "../OSAL/RT1050/Platform.h"
+#endif
 
 typedef Platform_Handle_t Handle_t;
 typedef Platform_Mutex_t Mutex_t;
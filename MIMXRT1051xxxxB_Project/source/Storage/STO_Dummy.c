@@ -34,27 +34,31 @@ EnsoErrorCode_e STO_WriteRecord(
     return eecFunctionalityNotSupported;
 }
 
-EnsoErrorCode_e STO_LoadFromStorage(void)
+EnsoErrorCode_e STO_QueueRecord(
+        EnsoTag_t* tag,
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE],
+        uint16_t length,
+        EnsoPropertyValue_u* valuep)
 {
     return eecFunctionalityNotSupported;
 }
 
-int STO_ReadRecord(
-        Handle_t handle,
-        EnsoTag_t* tag,
-        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE],
-        uint16_t* length,
-        EnsoPropertyValue_u* value)
+EnsoErrorCode_e STO_Flush(void)
 {
-    return -1;
+    return eecFunctionalityNotSupported;
 }
 
-EnsoErrorCode_e STO_CheckSizeAndConsolidate(void)
+bool STO_HasPendingRecords(void)
+{
+    return false;
+}
+
+EnsoErrorCode_e STO_LoadFromStorage(void)
 {
     return eecFunctionalityNotSupported;
 }
 
-EnsoErrorCode_e STO_LocalShadowDumpComplete(const PropertyGroup_e propertyGroup)
+EnsoErrorCode_e STO_CheckSizeAndConsolidate(void)
 {
     return eecFunctionalityNotSupported;
 }
@@ -11,7 +11,10 @@
  *
  *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_STO
+
 #include <stdio.h>
+#include <string.h>
 //#include <inttypes.h>
 #include "STO_Handler.h"
 #include "STO_Manager.h"
@@ -23,11 +26,59 @@
 #include "LSD_Api.h"
 #include "SYS_Gateway.h"
 
+/*!****************************************************************************
+ * Constants
+ *****************************************************************************/
+
+/**
+ * \name STO_GROUP_COMMIT_WINDOW_MS
+ *
+ * \brief Time records are collected for after the first one is queued, they
+ * are then written to the log in a single append. This is also the most
+ * recent history a power failure can lose, see STO_GROUP_COMMIT_BUFFER_SIZE.
+ * Zero writes the records of each delta as soon as it is handled.
+ */
+#ifndef STO_GROUP_COMMIT_WINDOW_MS
+#define STO_GROUP_COMMIT_WINDOW_MS          250
+#endif
+
+// Sent by the group commit timer to the handler queue
+#define STO_FLUSH_MSG                       ECOM_GENERAL_PURPOSE1
+
+// Sent by STO_RequestSave to the handler queue
+#define STO_SAVE_MSG                        ECOM_GENERAL_PURPOSE2
+
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint8_t messageId;                      // STO_SAVE_MSG
+    STO_SaveFunction_t save;
+} STO_SaveMessage_t;
+
+
+/*!****************************************************************************
+ * Static variables
+ *****************************************************************************/
+
+static MessageQueue_t _stoQueue = NULL;
+
+// Running while records are waiting to be written
+static Timer_t _flushTimer = NULL;
+
+
 /*!****************************************************************************
  * Private Function Prototypes
  *****************************************************************************/
 static void _STO_MessageQueueListener(MessageQueue_t mq);
 
+static void _STO_ScheduleFlush(void);
+
+static void _STO_FlushTimerCB(void* handle);
+
 static EnsoErrorCode_e _STO_OnUpdate(
         const HandlerId_e subscriberId,
         const EnsoDeviceId_t publishedDeviceId,
@@ -68,6 +119,7 @@ EnsoErrorCode_e STO_Handler_Init(void)
         return eecInternalError;
     }
 
+    _stoQueue = mq;
     ECOM_RegisterOnUpdateFunction(STORAGE_HANDLER, _STO_OnUpdate);
     ECOM_RegisterMessageQueue(STORAGE_HANDLER, mq);
 
@@ -78,6 +130,39 @@ EnsoErrorCode_e STO_Handler_Init(void)
 }
 
 
+/**
+ * \name STO_RequestSave
+ *
+ * \brief Have the handler thread call save, along with the other writes to
+ * the store, so the caller does not wait for the flash. Without the handler,
+ * as when the local shadow is tested alone, save is called here.
+ *
+ * \param save  Writes to the store
+ *
+ * \return EnsoErrorCode_e
+ */
+EnsoErrorCode_e STO_RequestSave(STO_SaveFunction_t save)
+{
+    if (save == NULL)
+    {
+        return eecNullPointerSupplied;
+    }
+    if (_stoQueue == NULL)
+    {
+        save();
+        return eecNoError;
+    }
+
+    STO_SaveMessage_t message = { .messageId = STO_SAVE_MSG, .save = save };
+    if (OSAL_SendMessage(_stoQueue, &message, sizeof(message), MessagePriority_low) < 0)
+    {
+        LOG_Error("SendMessage() failed");
+        return eecInternalError;
+    }
+    return eecNoError;
+}
+
+
 /*!****************************************************************************
  * Private Functions
  *****************************************************************************/
@@ -130,11 +215,11 @@ static EnsoErrorCode_e _STO_OnUpdate(
             tag.propId = propertyId;
             tag.propType = property->type;
             tag.propGroup = propertyGroup;
-            retVal = STO_WriteRecord(&tag, property->cloudName, sizeof(EnsoPropertyValue_u), (EnsoPropertyValue_u*)&deltasBuffer[i].propertyValue);
+            retVal = STO_QueueRecord(&tag, property->cloudName, sizeof(EnsoPropertyValue_u), (EnsoPropertyValue_u*)&deltasBuffer[i].propertyValue);
             if (eecNoError != retVal)
             {
                 // We could have a corrupted log. How shall we proceed?
-                LOG_Error("FATAL: STO_WriteRecord error %s", LSD_EnsoErrorCode_eToString(retVal));
+                LOG_Error("FATAL: STO_QueueRecord error %s", LSD_EnsoErrorCode_eToString(retVal));
                 break;
             }
         }
@@ -147,16 +232,55 @@ static EnsoErrorCode_e _STO_OnUpdate(
         }
     }
 
-    if (eecNoError == retVal)
+    // The log size is checked when the records are written
+    _STO_ScheduleFlush();
+
+    return retVal;
+}
+
+
+/**
+ * \brief   Write the queued records now or when the group commit window ends
+ */
+static void _STO_ScheduleFlush(void)
+{
+    if (!STO_HasPendingRecords())
     {
-        retVal = STO_CheckSizeAndConsolidate();
+        return;
+    }
+    if (STO_GROUP_COMMIT_WINDOW_MS == 0)
+    {
+        EnsoErrorCode_e retVal = STO_Flush();
         if (eecNoError != retVal)
         {
-            LOG_Error("STO_CheckSizeAndConsolidate error %s", LSD_EnsoErrorCode_eToString(retVal));
+            LOG_Error("STO_Flush error %s", LSD_EnsoErrorCode_eToString(retVal));
+        }
+    }
+    else if (_flushTimer == NULL)
+    {
+        // Repeating, so a flush message that cannot be sent is tried again
+        // a window later. The handler destroys it when the message arrives.
+        _flushTimer = OSAL_NewTimer(_STO_FlushTimerCB, STO_GROUP_COMMIT_WINDOW_MS, true, NULL);
+        if (_flushTimer == NULL)
+        {
+            // Without the timer the records would wait for the buffer to fill
+            LOG_Error("OSAL_NewTimer failed, writing now");
+            STO_Flush();
         }
     }
+}
 
-    return retVal;
+/**
+ * \brief   Group commit timer callback, the records are written by the
+ *          handler thread
+ */
+static void _STO_FlushTimerCB(void* handle)
+{
+    uint8_t id = STO_FLUSH_MSG;
+    if (OSAL_SendMessage(_stoQueue, &id, 1, MessagePriority_medium) < 0)
+    {
+        LOG_Error("SendMessage() failed, retrying in %d ms", STO_GROUP_COMMIT_WINDOW_MS);
+    }
 }
 
 
@@ -199,12 +323,16 @@ static void _STO_MessageQueueListener(MessageQueue_t mq)
                 else
                 {
                     ECOM_DeltaMessage_t* pDeltaMessage = (ECOM_DeltaMessage_t*)buffer;
+                    EnsoPropertyDelta_t scratch[ECOM_MAX_DELTAS];
+                    uint16_t numProperties;
+                    const EnsoPropertyDelta_t* deltas = ECOM_GetDeltas(pDeltaMessage, scratch, &numProperties);
                     _STO_OnUpdate(
                             pDeltaMessage->destinationId,
                             pDeltaMessage->deviceId,
                             pDeltaMessage->propertyGroup,
-                            pDeltaMessage->numProperties,
-                            pDeltaMessage->deltasBuffer);
+                            numProperties,
+                            deltas);
+                    ECOM_ReleaseDeltaMessage(pDeltaMessage);
                 }
                 break;
 
@@ -224,12 +352,14 @@ static void _STO_MessageQueueListener(MessageQueue_t mq)
                      tag.propId = pMessage->agentSideId;
 
                      EnsoPropertyValue_u propertyValue = { .uint32Value = 0 };
-                     EnsoErrorCode_e retVal = STO_WriteRecord(&tag, "", 0, &propertyValue);
+                     char noName[LSD_PROPERTY_NAME_BUFFER_SIZE] = { 0 };
+                     EnsoErrorCode_e retVal = STO_QueueRecord(&tag, noName, 0, &propertyValue);
                      if (eecNoError != retVal)
                      {
                          // We could have a corrupted log.
-                         LOG_Error("FATAL: STO_WriteRecord error %s deleting a property", LSD_EnsoErrorCode_eToString(retVal));
+                         LOG_Error("FATAL: STO_QueueRecord error %s deleting a property", LSD_EnsoErrorCode_eToString(retVal));
                      }
+                     _STO_ScheduleFlush();
                  }
                  break;
 
@@ -252,35 +382,40 @@ static void _STO_MessageQueueListener(MessageQueue_t mq)
                         tag.propId = 0;
 
                         EnsoPropertyValue_u propertyValue = { .uint32Value = 0 };
-                        EnsoErrorCode_e retVal = STO_WriteRecord(&tag, "", 0, &propertyValue);
+                        char noName[LSD_PROPERTY_NAME_BUFFER_SIZE] = { 0 };
+                        EnsoErrorCode_e retVal = STO_QueueRecord(&tag, noName, 0, &propertyValue);
                         if (eecNoError != retVal)
                         {
                             // We could have a corrupted log.
-                            LOG_Error("FATAL: STO_WriteRecord error %s deleting a device", LSD_EnsoErrorCode_eToString(retVal));
+                            LOG_Error("FATAL: STO_QueueRecord error %s deleting a device", LSD_EnsoErrorCode_eToString(retVal));
                         }
+                        _STO_ScheduleFlush();
                     }
                 }
                 break;
 
-            case ECOM_LOCAL_SHADOW_STATUS:
-                LOG_Trace("Shadow Status");
-                if (size != sizeof(ECOM_LocalShadowStatusMessage_t))
+            case STO_FLUSH_MSG:
+            {
+                if (_flushTimer != NULL)
                 {
-                    LOG_Error("Invalid LOCAL_SHADOW_STATUS message: size is %d, expected %d", size, sizeof(ECOM_LocalShadowStatusMessage_t));
+                    OSAL_DestroyTimer(_flushTimer);
+                    _flushTimer = NULL;
                 }
-                else
+                EnsoErrorCode_e retVal = STO_Flush();
+                if (eecNoError != retVal)
                 {
-                    ECOM_LocalShadowStatusMessage_t* pMessage = (ECOM_LocalShadowStatusMessage_t*) buffer;
-                    if (pMessage->shadowStatus == LSD_DUMP_COMPLETED)
-                    {
-                        STO_LocalShadowDumpComplete(pMessage->propertyGroup);
-                    }
-                    else
-                    {
-                        LOG_Error("Unexpected local shadow status %d", pMessage->shadowStatus);
-                    }
+                    LOG_Error("STO_Flush error %s", LSD_EnsoErrorCode_eToString(retVal));
                 }
                 break;
+            }
+
+            case STO_SAVE_MSG:
+            {
+                STO_SaveMessage_t message;
+                memcpy(&message, buffer, sizeof(message));
+                message.save();
+                break;
+            }
 
             default:
                 LOG_Error("Unknown message %d", messageId);
@@ -16,10 +16,20 @@
 #include "LSD_Types.h"
 
 
+/******************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+// Called on the storage handler thread, see STO_RequestSave()
+typedef void (*STO_SaveFunction_t)(void);
+
+
 /******************************************************************************
  * Public Functions
  *****************************************************************************/
 
 EnsoErrorCode_e STO_Handler_Init(void);
 
+EnsoErrorCode_e STO_RequestSave(STO_SaveFunction_t save);
+
 #endif /* _STO_HANLDER_H_ */
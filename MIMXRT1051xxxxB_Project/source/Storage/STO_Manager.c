@@ -11,9 +11,13 @@
 *
 *****************************************************************************/
 
+#define LOG_MODULE LOG_MODULE_STO
+
 #include <stdio.h>
 //#include <inttypes.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "APP_Types.h"
 #include "STO_Manager.h"
@@ -37,13 +41,208 @@
  * local shadow.
  *
  */
+#ifndef STO_MAX_STORE_SIZE_IN_BYTES
 #define STO_MAX_STORE_SIZE_IN_BYTES         100000
+#endif
+
+/**
+ * \name STO_GROUP_COMMIT_BUFFER_SIZE
+ *
+ * \brief Size of the buffer collecting records between two writes to the log.
+ * A record without blob takes 74 bytes.
+ *
+ * Power failure: records are only in RAM until the buffer is written, so up
+ * to the group commit window of updates (see STO_Handler.c) can be lost.
+ * The buffer is written with a single append and holds whole records in the
+ * order they were queued, so a write cut short leaves the records before
+ * the cut intact and at most one partial record at the end of the log, as
+ * with single record writes. The buffer is always written before a
+ * consolidation takes the snapshot which replaces the log.
+ */
+#ifndef STO_GROUP_COMMIT_BUFFER_SIZE
+#define STO_GROUP_COMMIT_BUFFER_SIZE        2048
+#endif
+
+/**
+ * \name STO_RECORD_MAGIC
+ *
+ * \brief Every record starts with a STO_RecordHeader_t. The CRC covers the
+ * header up to the CRC and the payload, which is the tag, cloud name,
+ * length and value, followed by the blob data for blob properties.
+ *
+ * Logs written before the header was added hold bare payloads. On the
+ * gateway the flash file system moves them out of its old layout at the
+ * first mount after the upgrade. They are recognised here by their first
+ * record and loaded, then rewritten in the current format by a
+ * consolidation.
+ *
+ * Loading stops at the first record which fails its checks, the records
+ * before it are kept. The log is then rebuilt from the local shadow, as
+ * anything appended after the bad record would not be read back.
+ *
+ * The header also holds the log generation the record was written in, see
+ * STO_SNAPSHOT_MAGIC.
+ */
+#define STO_RECORD_MAGIC                    0x5354
+#define STO_RECORD_VERSION                  1
+
+#define STO_RECORD_FIXED_SIZE   (sizeof(EnsoTag_t) + LSD_PROPERTY_NAME_BUFFER_SIZE + sizeof(uint16_t) + sizeof(EnsoPropertyValue_u))
+
+/**
+ * \name STO_READ_BUFFER_SIZE
+ *
+ * \brief The log is read in blocks of this size at boot rather than field
+ * by field, each store read costs a lookup and a flash transaction.
+ */
+#define STO_READ_BUFFER_SIZE                1024
+
+/**
+ * \name STO_SNAPSHOT_MAGIC
+ *
+ * \brief A consolidation writes the persistent properties of the local
+ * shadow to the snapshot, the current log then only holds the changes made
+ * since. At boot the snapshot is loaded first and the log replayed over it.
+ *
+ * The snapshot is a STO_SnapshotHeader_t, the devices in device id order
+ * each followed by its properties in agent side id order, then a
+ * STO_SnapshotTrailer_t whose CRC covers everything before it.
+ *
+ *   device:   address (8), technology (2), child id (1), is child (1),
+ *             number of properties (2)
+ *   property: agent side id (4), name index (1), flags (1), value type (1),
+ *             desired value, reported value
+ *
+ * A cloud name is only stored where it is first used, as its length and
+ * characters following the index of the next name table entry. Values take
+ * the size of their type: 4 bytes, 1 for booleans, 5 for timestamps, a
+ * length byte and the characters for strings, a 4 byte size and the data
+ * for blobs.
+ *
+ * The snapshot is written to a new file which then replaces the previous
+ * one, a new file with a good CRC found at boot has been written in full.
+ * It is loaded in a single pass, the CRC being worked out as it is read.
+ *
+ * The trailer holds the log generation the snapshot covers. The logs are
+ * removed once the snapshot is in place, and records written from then on
+ * are stamped with the next generation. Logs left behind by a power failure
+ * between the two hold older values than the snapshot, so at boot only the
+ * records of the next generation are replayed over it.
+ */
+#define STO_SNAPSHOT_MAGIC                  0x4E535453  // "STSN"
+#define STO_SNAPSHOT_TRAILER_MAGIC          0x45535453  // "STSE"
+#define STO_SNAPSHOT_VERSION                2
+
+// Names past the table are stored in full each time, with this index
+#define STO_SNAPSHOT_MAX_NAMES              255
+#define STO_SNAPSHOT_NAME_LITERAL           0xFF
+
+// Property flags
+#define STO_SNAPSHOT_REPORTED_OUT_OF_SYNC   0x01
+#define STO_SNAPSHOT_DESIRED_OUT_OF_SYNC    0x02
+#define STO_SNAPSHOT_BUFFERED               0x04
+#define STO_SNAPSHOT_PUBLIC                 0x08
+
+// Properties copied from the local shadow at a time, or held back while a
+// snapshot loads, grown as needed
+#define STO_SNAPSHOT_PROPERTIES             32
+
+/*!****************************************************************************
+ * Type Definitions
+ *****************************************************************************/
+
+typedef struct
+{
+    uint16_t magic;             // STO_RECORD_MAGIC
+    uint8_t  version;           // STO_RECORD_VERSION
+    uint8_t  generation;        // Log generation, see STO_SNAPSHOT_MAGIC
+    uint32_t length;            // Payload size
+    uint32_t crc;               // CRC32 of the header up to here and the payload
+} STO_RecordHeader_t;
+
+#define STO_RECORD_CRC_SPAN     offsetof(STO_RecordHeader_t, crc)
+
+/**
+ * Buffered sequential reader of a log
+ */
+typedef struct
+{
+    Handle_t handle;
+    uint8_t* buffer;            // STO_READ_BUFFER_SIZE bytes
+    uint32_t start;             // Next unread byte in buffer
+    uint32_t end;               // End of the data in buffer
+    uint32_t offset;            // Log offset of buffer[start]
+    bool     legacy;            // Records have no header
+    uint8_t  generation;        // Of the last record read
+    bool     checksum;          // Keep crc over the bytes read
+    uint32_t crc;               // CRC32 of the bytes read while checksum is set
+} STO_LogReader_t;
+
+typedef struct
+{
+    uint32_t magic;             // STO_SNAPSHOT_MAGIC
+    uint8_t  version;           // STO_SNAPSHOT_VERSION
+    uint8_t  reserved[3];
+} STO_SnapshotHeader_t;
+
+typedef struct
+{
+    uint32_t magic;             // STO_SNAPSHOT_TRAILER_MAGIC
+    uint16_t numDevices;
+    uint16_t numNames;
+    uint32_t numProperties;
+    uint8_t  logGeneration;     // Last log generation held in the snapshot
+    uint8_t  reserved[3];
+    uint32_t crc;               // CRC32 of the file up to here
+} STO_SnapshotTrailer_t;
+
+/**
+ * Buffered writer of a snapshot
+ */
+typedef struct
+{
+    Handle_t handle;
+    uint8_t* buffer;            // STO_READ_BUFFER_SIZE bytes
+    uint32_t length;            // Data in buffer
+    uint32_t crc;               // Of everything put so far
+    bool     failed;
+} STO_SnapshotWriter_t;
+
+/**
+ * Property of a device already in the local shadow, held back until the
+ * snapshot CRC is checked
+ */
+typedef struct
+{
+    EnsoDeviceId_t deviceId;
+    EnsoAgentSidePropertyId_t propId;
+    EnsoPropertyType_t propType;
+    char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+    EnsoPropertyValue_u values[PROPERTY_GROUP_MAX];
+} STO_SnapshotProperty_t;
+
+/**
+ * Cloud names met so far in a snapshot
+ */
+typedef struct
+{
+    char    (*names)[LSD_PROPERTY_NAME_BUFFER_SIZE]; // STO_SNAPSHOT_MAX_NAMES
+    uint16_t count;
+} STO_NameTable_t;
 
 /*!****************************************************************************
  * Static variables
  *****************************************************************************/
 const char STO_CurrentLog[] = STO_DIR"StoreLog_Current";
 const char STO_ArchiveLog[] = STO_DIR"StoreLog_Archive";
+const char STO_Snapshot[]    = STO_DIR"StoreSnapshot";
+const char STO_NewSnapshot[] = STO_DIR"StoreSnapshot_New";
+
+// Group commit buffer, only used from the storage handler thread
+static uint8_t  _commitBuffer[STO_GROUP_COMMIT_BUFFER_SIZE];
+static uint32_t _commitLength = 0;
+
+// Generation stamped on the records written to the current log
+static uint8_t  _logGeneration = 0;
 
 /*!****************************************************************************
  * Static functions
@@ -51,16 +250,39 @@ const char STO_ArchiveLog[] = STO_DIR"StoreLog_Archive";
 
 EnsoErrorCode_e STO_LoadFromStorage(void);
 
-int STO_ReadRecord(
-        Handle_t handle,
+static uint32_t _STO_ReaderFill(STO_LogReader_t* reader, uint32_t size);
+
+static uint32_t _STO_ReaderRead(STO_LogReader_t* reader, void* dest, uint32_t size);
+
+static int _STO_ReadRecord(
+        STO_LogReader_t* reader,
         EnsoTag_t* tag,
         char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE], // Temporary, to be removed
         uint16_t* length,
         EnsoPropertyValue_u* value);
 
-static EnsoErrorCode_e _LoadFromLog(Handle_t handle);
+static EnsoErrorCode_e _LoadFromLog(Handle_t handle, const char* name, bool covered, bool* rewrite);
+
+static EnsoErrorCode_e _STO_ApplyRecord(
+        const EnsoTag_t* tag,
+        const char* cloudName,
+        uint16_t length,
+        EnsoPropertyValue_u value);
+
+static EnsoObject_t* _STO_CreateDevice(const EnsoDeviceId_t* deviceId);
+
+static EnsoErrorCode_e _STO_Consolidate(void);
+
+static EnsoErrorCode_e _STO_WriteSnapshot(const char* name);
+
+static EnsoErrorCode_e _STO_CheckSnapshot(const char* name, uint8_t* logGeneration);
+
+static EnsoErrorCode_e _STO_LoadSnapshot(const char* name, uint8_t* logGeneration);
+
+static EnsoErrorCode_e _STO_Append(const void * buffer, uint32_t size);
+
+static EnsoErrorCode_e _STO_WritePending(void);
 
-static EnsoErrorCode_e _DumpLocalShadow(void);
 
 /*!****************************************************************************
  * Public Functions
@@ -87,11 +309,11 @@ char * EnsoPropertyValue_u2s(char * buf, const size_t size, const EnsoPropertyTy
     {
     case evInt32:
         ////////snprintf(buf, size, "I32  %d", value->int32Value);	//////// [RE:format]
-        snprintf(buf, size, "I32  %ld", value->int32Value);
+        snprintf(buf, size, "I32  %" PRId32, value->int32Value);
     break;
     case evUnsignedInt32:
         ////////snprintf(buf, size, "U32  %u", value->uint32Value);	//////// [RE:format
-        snprintf(buf, size, "U32  %lu", value->uint32Value);
+        snprintf(buf, size, "U32  %" PRIu32, value->uint32Value);
     break;
     case evFloat32:
         snprintf(buf, size, "F32  %f", value->float32Value);
@@ -107,7 +329,7 @@ char * EnsoPropertyValue_u2s(char * buf, const size_t size, const EnsoPropertyTy
     break;
     case evTimestamp:
         ////////snprintf(buf, size, "Time %d", value->timestamp.seconds);	//////// [RE:format
-        snprintf(buf, size, "Time %ld", value->timestamp.seconds);
+        snprintf(buf, size, "Time %" PRIu32, value->timestamp.seconds);
     break;
     default:
         snprintf(buf, size, "Bad Tag");
@@ -138,7 +360,8 @@ EnsoErrorCode_e STO_Init(void)
 /**
  * \name    STO_WriteRecord
  *
- * \brief   Write a TLV record to the current log
+ * \brief   Write a TLV record to the current log, together with any queued
+ *          records so the log order is kept
  *
  * \param   tag     Pointer to Record tag
  *
@@ -153,6 +376,35 @@ EnsoErrorCode_e STO_WriteRecord(
         char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE], // Temporary, to be removed
         uint16_t length,
         EnsoPropertyValue_u* valuep)
+{
+    EnsoErrorCode_e retVal = STO_QueueRecord(tag, cloudName, length, valuep);
+    if (eecNoError == retVal)
+    {
+        retVal = _STO_WritePending();
+    }
+    return retVal;
+}
+
+/**
+ * \name    STO_QueueRecord
+ *
+ * \brief   Add a TLV record to the group commit buffer. The buffer is
+ *          written when it is full or on STO_Flush(), records which do not
+ *          fit in it on their own (large blobs) are written straight away.
+ *
+ * \param   tag     Pointer to Record tag
+ *
+ * \param   length  Record length
+ *
+ * \param   value   Pointer to Record value
+ *
+ * \return  EnsoErrorCode_e
+ */
+EnsoErrorCode_e STO_QueueRecord(
+        EnsoTag_t* tag,
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE], // Temporary, to be removed
+        uint16_t length,
+        EnsoPropertyValue_u* valuep)
 {
     // Sanity checks
     if (!tag || !valuep)
@@ -179,40 +431,134 @@ EnsoErrorCode_e STO_WriteRecord(
         }
         value.uint32Value = blobsize;
     }
-    uint32_t buffSize = sizeof *tag + LSD_PROPERTY_NAME_BUFFER_SIZE + sizeof length + sizeof value + blobsize;
-    char * buff = OSAL_MemoryRequest(NULL, buffSize);
-    if (buff == NULL)
+    STO_RecordHeader_t header = { .magic = STO_RECORD_MAGIC, .version = STO_RECORD_VERSION, .generation = _logGeneration };
+    header.length = STO_RECORD_FIXED_SIZE + blobsize;
+    uint32_t buffSize = sizeof header + header.length;
+
+    // Make room, records are never split across writes
+    if (_commitLength + buffSize > sizeof _commitBuffer)
+    {
+        retVal = _STO_WritePending();
+        if (eecNoError != retVal)
+        {
+            return retVal;
+        }
+    }
+
+    char * buff;
+    if (buffSize <= sizeof _commitBuffer)
     {
-       LOG_Error("malloc %d failed", buffSize);
-       retVal = eecWriteFailed;
+        buff = (char *)_commitBuffer + _commitLength;
     }
     else
     {
-        char * p = buff;
-        memcpy(p, tag, sizeof *tag);
-        p += sizeof *tag;
-        memcpy(p, cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE);
-        p += LSD_PROPERTY_NAME_BUFFER_SIZE;
-        memcpy(p, &length, sizeof length);
-        p += sizeof length;
-        memcpy(p, &value, sizeof value);
-        p += sizeof value;
-        if (blobsize != 0)
+        buff = OSAL_MemoryRequest(NULL, buffSize);
+        if (buff == NULL)
         {
-            memcpy(p, blob, blobsize);
+           LOG_Error("malloc %d failed", buffSize);
+           return eecWriteFailed;
         }
-        Handle_t handle = OSAL_StoreOpen(STO_CurrentLog, WRITE_APPEND);     //////// [RE:fixme] What happens when the log gets full?
-        if (handle != NULL)
+    }
+
+    char * p = buff + sizeof header;
+    memcpy(p, tag, sizeof *tag);
+    p += sizeof *tag;
+    memcpy(p, cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE);
+    p += LSD_PROPERTY_NAME_BUFFER_SIZE;
+    memcpy(p, &length, sizeof length);
+    p += sizeof length;
+    memcpy(p, &value, sizeof value);
+    p += sizeof value;
+    if (blobsize != 0)
+    {
+        memcpy(p, blob, blobsize);
+    }
+    header.crc = OSAL_Crc32(OSAL_Crc32(0, &header, STO_RECORD_CRC_SPAN), buff + sizeof header, header.length);
+    memcpy(buff, &header, sizeof header);
+
+    if (buffSize <= sizeof _commitBuffer)
+    {
+        _commitLength += buffSize;
+    }
+    else
+    {
+        retVal = _STO_Append(buff, buffSize);
+        OSAL_Free(buff);
+    }
+    return retVal;
+}
+
+/**
+ * \name    STO_Flush
+ *
+ * \brief   Write the queued records in a single append, then consolidate
+ *          the log if it has grown too large
+ *
+ * \return  EnsoErrorCode_e
+ */
+EnsoErrorCode_e STO_Flush(void)
+{
+    if (_commitLength == 0)
+    {
+        return eecNoError;
+    }
+    EnsoErrorCode_e retVal = _STO_WritePending();
+    if (eecNoError == retVal)
+    {
+        retVal = STO_CheckSizeAndConsolidate();
+    }
+    return retVal;
+}
+
+/**
+ * \name    STO_HasPendingRecords
+ *
+ * \return  true if records are waiting in the group commit buffer
+ */
+bool STO_HasPendingRecords(void)
+{
+    return _commitLength != 0;
+}
+
+/**
+ * \name    _STO_Append
+ *
+ * \brief   Append a buffer of whole records to the current log
+ *
+ * \return  EnsoErrorCode_e
+ */
+static EnsoErrorCode_e _STO_Append(const void * buffer, uint32_t size)
+{
+    EnsoErrorCode_e retVal = eecNoError;
+    Handle_t handle = OSAL_StoreOpen(STO_CurrentLog, WRITE_APPEND);     //////// [RE:fixme] What happens when the log gets full?
+    if (handle != NULL)
+    {
+        int written = OSAL_StoreWrite(handle, buffer, size);
+        if (written != size)
         {
-            int size = OSAL_StoreWrite(handle, buff, buffSize);
-            if (size != buffSize)
-            {
-                LOG_Error("Failed to write record");
-                retVal = eecWriteFailed;
-            }
-            OSAL_StoreClose(handle);
+            LOG_Error("Failed to write record");
+            retVal = eecWriteFailed;
         }
-        OSAL_Free(buff);
+        OSAL_StoreClose(handle);
+    }
+    return retVal;
+}
+
+/**
+ * \name    _STO_WritePending
+ *
+ * \brief   Write the group commit buffer. It is emptied even when the write
+ *          fails, as a single record used to be lost before.
+ *
+ * \return  EnsoErrorCode_e
+ */
+static EnsoErrorCode_e _STO_WritePending(void)
+{
+    EnsoErrorCode_e retVal = eecNoError;
+    if (_commitLength != 0)
+    {
+        retVal = _STO_Append(_commitBuffer, _commitLength);
+        _commitLength = 0;
     }
     return retVal;
 }
@@ -220,10 +566,11 @@ EnsoErrorCode_e STO_WriteRecord(
 /**
  * \name    STO_LoadFromStorage
  *
- * \brief   At startup, read the log sequentially. If power has been lost during startup
- *          there will be an archive log and the current log. The archive shall be loaded
- *          first then the current log. When the properties have been loaded, the storage
- *          manager shall go through the consolidation process.
+ * \brief   At startup, load the snapshot then read the current log sequentially.
+ *          An archive log is only left by an older release when power was lost
+ *          during its consolidation, it is loaded between the two. Logs the
+ *          snapshot already covers are skipped. The store is consolidated when
+ *          the snapshot or the logs need to be rewritten.
  *
  * \return  EnsoErrorCode_e
  */
@@ -234,8 +581,55 @@ EnsoErrorCode_e STO_LoadFromStorage(void)
     // Whether logs consolidation should be performed
     bool consolidate = false;
 
-    // Check if an archive log exists
-    if (OSAL_StoreExist(STO_ArchiveLog))
+    // Whether a snapshot holds the logs of generations before _logGeneration
+    bool covered = false;
+
+    // A new snapshot which was written in full replaces the previous one
+    if (OSAL_StoreExist(STO_NewSnapshot))
+    {
+        if (eecNoError == _STO_CheckSnapshot(STO_NewSnapshot, NULL))
+        {
+            LOG_Info("Completing the replacement of %s", STO_Snapshot);
+            if (OSAL_StoreExist(STO_Snapshot))
+            {
+                OSAL_StoreRemove(STO_Snapshot);
+            }
+            if (0 != OSAL_StoreAtomicRename(STO_NewSnapshot, STO_Snapshot))
+            {
+                LOG_Error("OSAL_StoreAtomicRename failed");
+            }
+        }
+        else
+        {
+            LOG_Warning("Removing incomplete %s", STO_NewSnapshot);
+            OSAL_StoreRemove(STO_NewSnapshot);
+        }
+    }
+
+    if (OSAL_StoreExist(STO_Snapshot))
+    {
+        uint8_t logGeneration;
+        retVal = _STO_LoadSnapshot(STO_Snapshot, &logGeneration);
+        if (eecNoError != retVal)
+        {
+            LOG_Error("Error reading from %s %s, rebuilding it", STO_Snapshot, LSD_EnsoErrorCode_eToString(retVal));
+            consolidate = true;
+        }
+        else
+        {
+            LOG_Info("Finished loading from %s, log generation %d", STO_Snapshot, logGeneration);
+            _logGeneration = logGeneration + 1;
+            covered = true;
+        }
+    }
+
+    // Check if an archive log exists, a snapshot is always written after it
+    if (OSAL_StoreExist(STO_ArchiveLog) && covered)
+    {
+        LOG_Warning("%s is held in %s, skipping it", STO_ArchiveLog, STO_Snapshot);
+        consolidate = true;
+    }
+    else if (OSAL_StoreExist(STO_ArchiveLog))
     {
         LOG_Info("%s exist", STO_ArchiveLog);
 
@@ -248,24 +642,20 @@ EnsoErrorCode_e STO_LoadFromStorage(void)
         }
         else
         {
-            retVal = _LoadFromLog(archiveHandle);
+            bool truncated = false; // Consolidated below in any case
+            retVal = _LoadFromLog(archiveHandle, STO_ArchiveLog, covered, &truncated);
             if (eecNoError != retVal)
             {
-                LOG_Error("Error reading from archive log %s, deleting archive", LSD_EnsoErrorCode_eToString(retVal));
-
-                // Let's remove the archive and start from fresh.
-                OSAL_StoreRemove(STO_ArchiveLog);
-                consolidate = false;
+                LOG_Error("Error reading from archive log %s", LSD_EnsoErrorCode_eToString(retVal));
             }
             else
             {
                 LOG_Info("Finished loading from %s", STO_ArchiveLog);
-
-                if (0 != OSAL_StoreClose(archiveHandle))
-                {
-                    LOG_Error("Failed to close %s", STO_ArchiveLog);
-                    retVal = eecCloseFailed;
-                }
+            }
+            if (0 != OSAL_StoreClose(archiveHandle))
+            {
+                LOG_Error("Failed to close %s", STO_ArchiveLog);
+                retVal = eecCloseFailed;
             }
         }
     }
@@ -273,6 +663,7 @@ EnsoErrorCode_e STO_LoadFromStorage(void)
     // Now read from the current log
     if (OSAL_StoreExist(STO_CurrentLog))
     {
+        bool rewrite = false;
         Handle_t currentHandle = OSAL_StoreOpen(STO_CurrentLog, READ_ONLY);
         if (currentHandle == NULL)
         {
@@ -280,13 +671,14 @@ EnsoErrorCode_e STO_LoadFromStorage(void)
         }
         else
         {
-            retVal = _LoadFromLog(currentHandle);
+            retVal = _LoadFromLog(currentHandle, STO_CurrentLog, covered, &rewrite);
             if (eecNoError != retVal)
             {
                 // We have a corrupted log.
                 LOG_Error("Error reading from current log %s, deleting current", LSD_EnsoErrorCode_eToString(retVal));
 
                 // Let's remove the log and start from fresh.
+                OSAL_StoreClose(currentHandle);
                 OSAL_StoreRemove(STO_CurrentLog);
             }
             else
@@ -301,15 +693,20 @@ EnsoErrorCode_e STO_LoadFromStorage(void)
             }
         }
 
-        // And consolidate
-        if (consolidate)
+        // Appends would land behind a bad record or in the old format,
+        // rebuild the store from the local shadow.
+        if (rewrite)
         {
-            LOG_Info("Consolidating stores");
-
-            // Dump local shadow
-            retVal = _DumpLocalShadow();
+            consolidate = true;
         }
     }
+
+    // And consolidate
+    if (consolidate)
+    {
+        LOG_Info("Consolidating stores");
+        retVal = _STO_Consolidate();
+    }
     LSD_DumpObjectStore();
     return retVal;
 }
@@ -318,15 +715,57 @@ EnsoErrorCode_e STO_LoadFromStorage(void)
  * \name    _LoadFromLog
  *
  * \brief   Sequentially read the log identified by handle and populate Local Shadow.
+ *          Loading stops without error at the first corrupted record.
  *
  * \param   handle    Store log handle
  *
+ * \param   name      Store log name
+ *
+ * \param   covered   Set when a snapshot was loaded, only the records of
+ *                    _logGeneration are newer than it and replayed.
+ *                    Otherwise every record is replayed and _logGeneration
+ *                    follows them.
+ *
+ * \param[out] rewrite Set when the log must be rewritten, because it is
+ *                     corrupted, in the old format or partly covered by the
+ *                     snapshot
+ *
  * \return  EnsoErrorCode_e
  */
-static EnsoErrorCode_e _LoadFromLog(Handle_t handle)
+static EnsoErrorCode_e _LoadFromLog(Handle_t handle, const char* name, bool covered, bool* rewrite)
 {
     EnsoErrorCode_e retVal = eecNoError;
 
+    STO_LogReader_t reader = { .handle = handle, .start = 0, .end = 0, .offset = 0 };
+    reader.buffer = OSAL_MemoryRequest(NULL, STO_READ_BUFFER_SIZE);
+    if (reader.buffer == NULL)
+    {
+        LOG_Error("malloc %d failed", STO_READ_BUFFER_SIZE);
+        return eecReadFailed;
+    }
+
+    // The first record tells the format
+    STO_RecordHeader_t header;
+    if (_STO_ReaderFill(&reader, sizeof header) >= sizeof header)
+    {
+        memcpy(&header, reader.buffer, sizeof header);
+        reader.legacy = (header.magic != STO_RECORD_MAGIC) || (header.version != STO_RECORD_VERSION);
+        if (reader.legacy)
+        {
+            LOG_Warning("%s is in the old format", name);
+            *rewrite = true;
+        }
+    }
+
+    // Records without a header were all written before the snapshot
+    if (reader.legacy && covered)
+    {
+        LOG_Warning("%s is held in %s, skipping it", name, STO_Snapshot);
+        OSAL_Free(reader.buffer);
+        return eecNoError;
+    }
+    uint32_t skipped = 0;
+
     bool readFromLog = true;
     while (readFromLog)
     {
@@ -335,194 +774,350 @@ static EnsoErrorCode_e _LoadFromLog(Handle_t handle)
         EnsoPropertyValue_u value;
         char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE]; // Temporary, to be removed
 
-        int size = STO_ReadRecord(handle, &tag, cloudName, &length, &value);
-        if (size > 0)
+        uint32_t offset = reader.offset;
+        int size = _STO_ReadRecord(&reader, &tag, cloudName, &length, &value);
+        if (size > 0 && covered && !reader.legacy && (reader.generation != _logGeneration))
         {
-            // Was the device deleted? A deleted device is indicated with a property Id of zero (invalid property).
-            if (0 == tag.propId)
-            {
-
-                LOG_Info("Deleting device %016"PRIx64"_%04x_%02x", tag.deviceId.deviceAddress, tag.deviceId.technology, tag.deviceId.childDeviceId);
-
-                // We are calling an internal Local Shadow functions because we don't want to
-                // send notifications to the handlers.
-                retVal = LSD_RemoveAllPropertiesOfObject_Safe(&tag.deviceId);
-                if (eecNoError == retVal)
-                {
-                    retVal = LSD_DestroyEnsoDeviceDirectly(tag.deviceId);
-                }
-
-                if (retVal < 0)
-                {
-                    LOG_Error("Failed to delete device %s", LSD_EnsoErrorCode_eToString(retVal));
-                    readFromLog = false;
-                    break; //Early exit
-                }
-                continue; // Next record
-            }
-
-            // Does the device exist?
-            EnsoObject_t* device = LSD_FindEnsoObjectByDeviceId(&tag.deviceId);
-            if (!device)
+            // Left by a power failure before the log was removed, the
+            // snapshot holds newer values
+            if ((tag.propType.valueType == evBlobHandle) && (value.memoryHandle != NULL))
             {
-                // Create the device
-                device = LSD_CreateEnsoObject(tag.deviceId);
-                if (device)
-                {
-                    // Create the device status private property.
-                    EnsoPropertyValue_u deviceStatusValue[PROPERTY_GROUP_MAX];
-                    deviceStatusValue[DESIRED_GROUP].uint32Value = THING_CREATED;
-                    EnsoErrorCode_e result = LSD_CreateProperty(device, PROP_DEVICE_STATUS_ID, PROP_DEVICE_STATUS_CLOUD_NAME, evUnsignedInt32, PROPERTY_PRIVATE, false, false, deviceStatusValue);
-                    if (result < 0)
-                    {
-                        LOG_Error("Failed to create device status property %s", LSD_EnsoErrorCode_eToString(result));
-                    }
-            
-                    // Create the connection (private) property.
-                    EnsoPropertyValue_u connValue[PROPERTY_GROUP_MAX];
-                    connValue[DESIRED_GROUP].int32Value = -1;
-                    connValue[REPORTED_GROUP].int32Value = -1;
-                    result = LSD_CreateProperty( device, PROP_CONNECTION_ID, PROP_CONNECTION_ID_CLOUD_NAME, evInt32, PROPERTY_PRIVATE, false, false, connValue);
-                    if (result < 0)
-                    {
-                        LOG_Error("Failed to create connection property %s", LSD_EnsoErrorCode_eToString(result));
-                    }
-                    LSD_RegisterEnsoObject(device);
-                }
-                else
-                {
-                    LOG_Error("LSD_CreateEnsoObject failed");
-                    readFromLog = false;
-                    break; //Early exit
-                }
+                OSAL_Free(value.memoryHandle);
             }
-
-            // Was the property deleted?
-            if (0 == length)
+            skipped++;
+        }
+        else if (size > 0)
+        {
+            if (!covered && !reader.legacy)
             {
-                LOG_Info("Deleting property %x", tag.propId);
-                // We are calling an internal Local Shadow function because we don't want to
-                // send notifications to the handlers.
-                EnsoErrorCode_e retValDel = LSD_RemoveProperty_Safe(&tag.deviceId, false, tag.propId, 0, false);
-                if (retValDel < 0)
-                {
-                    LOG_Warning("Failed to remove property %x %s", tag.propId, LSD_EnsoErrorCode_eToString(retValDel));
-                }
-                continue; // Next record
+                _logGeneration = reader.generation;
             }
-            else if (length != sizeof(EnsoPropertyValue_u))
+            retVal = _STO_ApplyRecord(&tag, cloudName, length, value);
+            if (retVal < 0)
             {
-                LOG_Error("Corrupted record: length %d instead of %d", length, sizeof(EnsoPropertyValue_u));
                 readFromLog = false;
-                break; // Early exit
             }
-            // The property value
-            EnsoPropertyValue_u nullblob = { .memoryHandle = NULL };
-            EnsoPropertyValue_u propValue[PROPERTY_GROUP_MAX];
-            propValue[DESIRED_GROUP]  = tag.propType.valueType == evBlobHandle ? nullblob : value;
-            propValue[REPORTED_GROUP] = tag.propType.valueType == evBlobHandle ? nullblob : value;
-#if VERBOSE_STORAGE_MANAGER_DEBUG
-            LOG_Info("Cloud name in log %s", cloudName);
-#endif
-            // Does the property exist?
-            EnsoProperty_t* property = LSD_GetPropertyByAgentSideId(&tag.deviceId, tag.propId);
-            if (!property)
-            {
-                // Restore the property
-                retVal = LSD_RestoreProperty(device, tag.propId, cloudName, tag.propType, propValue);
-                if (retVal < 0)
-                {
-                    LOG_Error("Failed to restore property %11.11s %x %s", cloudName, tag.propId,
-                        LSD_EnsoErrorCode_eToString(retVal));
-                    readFromLog = false;
-                    break; //Early exit
-                }
-                else
-                {
-                    if (tag.propType.valueType == evString)
-                    {
-                        LOG_Info("Restored property %s (%x) d=%s r=%s", cloudName, tag.propId,
-                                propValue[0].stringValue, propValue[1].stringValue);
-                    }
-                    else
-                    {
-                        LOG_Info("Restored property %s (%x)", cloudName, tag.propId);
+        }
+        else if (size == 0)
+        {
+            LOG_Info("End of log file");
+            readFromLog = false;
+        }
+        else
+        {
+            // Keep what was read so far rather than the whole log
+            LOG_Error("Corrupted record at offset %lu of %s, ignoring the rest", (unsigned long)offset, name);
+            readFromLog = false;
+            *rewrite = true;
+        }
+    }
 
-                    }
+    if (skipped != 0)
+    {
+        LOG_Warning("Skipped %lu records of %s held in %s", (unsigned long)skipped, name, STO_Snapshot);
+        *rewrite = true;
+    }
+    OSAL_Free(reader.buffer);
+    return retVal;
+}
 
-                    LOG_Info("   Property %s was out of sync d=%i, r=%i", cloudName,
-                            tag.propType.desiredOutOfSync, tag.propType.reportedOutOfSync);
-                }
-            }
+/**
+ * \name    _STO_ApplyRecord
+ *
+ * \brief   Apply a record read back from storage to the Local Shadow,
+ *          without notifying the handlers
+ *
+ * \param   tag       Record tag
+ *
+ * \param   cloudName Property cloud name
+ *
+ * \param   length    Record length, 0 for a deleted property or device
+ *
+ * \param   value     Record value, a blob is handed over to the Local Shadow
+ *
+ * \return  EnsoErrorCode_e, negative if loading should stop
+ */
+static EnsoErrorCode_e _STO_ApplyRecord(
+        const EnsoTag_t* tag,
+        const char* cloudName,
+        uint16_t length,
+        EnsoPropertyValue_u value)
+{
+    EnsoErrorCode_e retVal = eecNoError;
 
-            EnsoPropertyDelta_t delta;
-            int deltaCounter = 0;
+    // Was the device deleted? A deleted device is indicated with a property Id of zero (invalid property).
+    if (0 == tag->propId)
+    {
 
-            /*
-             * Set the value of the property.
-             *
-             * No need to send notifications to subscribers if we read previous
-             * values from database.
-             */
+        LOG_Info("Deleting device %016"PRIx64"_%04x_%02x", tag->deviceId.deviceAddress, tag->deviceId.technology, tag->deviceId.childDeviceId);
 
-#if VERBOSE_STORAGE_MANAGER_DEBUG
-            LOG_Info("   Setting property %s with out of sync d=%i, r=%i", cloudName,
-                    tag.propType.desiredOutOfSync, tag.propType.reportedOutOfSync);
-#endif
+        // We are calling an internal Local Shadow functions because we don't want to
+        // send notifications to the handlers.
+        retVal = LSD_RemoveAllPropertiesOfObject_Safe(&tag->deviceId);
+        if (eecNoError == retVal)
+        {
+            retVal = LSD_DestroyEnsoDeviceDirectly(tag->deviceId);
+        }
 
+        // The snapshot can be taken after the device went and before its
+        // record was written
+        if (eecEnsoObjectNotFound == retVal)
+        {
+            retVal = eecNoError;
+        }
+        else if (retVal < 0)
+        {
+            LOG_Error("Failed to delete device %s", LSD_EnsoErrorCode_eToString(retVal));
+        }
+        return retVal;
+    }
 
-            retVal = LSD_SetPropertyValueByCloudNameWithoutNotification(
-                        STORAGE_HANDLER,
-                        &tag.deviceId,
-                        tag.propGroup,
-                        cloudName,
-                        value,
-                        &delta, &deltaCounter);
+    // Does the device exist?
+    EnsoObject_t* device = LSD_FindEnsoObjectByDeviceId(&tag->deviceId);
+    if (!device)
+    {
+        device = _STO_CreateDevice(&tag->deviceId);
+        if (!device)
+        {
+            return eecEnsoObjectNotCreated;
+        }
+    }
 
-            if (retVal == eecNoChange)
+    // Was the property deleted?
+    if (0 == length)
+    {
+        LOG_Info("Deleting property %x", tag->propId);
+        // We are calling an internal Local Shadow function because we don't want to
+        // send notifications to the handlers.
+        EnsoErrorCode_e retValDel = LSD_RemoveProperty_Safe(&tag->deviceId, false, tag->propId, 0, false);
+        if (retValDel < 0)
+        {
+            LOG_Warning("Failed to remove property %x %s", tag->propId, LSD_EnsoErrorCode_eToString(retValDel));
+        }
+        return eecNoError;
+    }
+    else if (length != sizeof(EnsoPropertyValue_u))
+    {
+        LOG_Error("Corrupted record: length %d instead of %d", length, sizeof(EnsoPropertyValue_u));
+        return eecReadFailed;
+    }
+    // The property value
+    EnsoPropertyValue_u nullblob = { .memoryHandle = NULL };
+    EnsoPropertyValue_u propValue[PROPERTY_GROUP_MAX];
+    propValue[DESIRED_GROUP]  = tag->propType.valueType == evBlobHandle ? nullblob : value;
+    propValue[REPORTED_GROUP] = tag->propType.valueType == evBlobHandle ? nullblob : value;
+#if VERBOSE_STORAGE_MANAGER_DEBUG
+    LOG_Info("Cloud name in log %s", cloudName);
+#endif
+    // Does the property exist?
+    EnsoProperty_t* property = LSD_GetPropertyByAgentSideId(&tag->deviceId, tag->propId);
+    if (!property)
+    {
+        // Restore the property
+        retVal = LSD_RestoreProperty(device, tag->propId, cloudName, tag->propType, propValue);
+        if (retVal < 0)
+        {
+            LOG_Error("Failed to restore property %11.11s %x %s", cloudName, tag->propId,
+                LSD_EnsoErrorCode_eToString(retVal));
+            return retVal;
+        }
+        else
+        {
+            if (tag->propType.valueType == evString)
             {
-                retVal = eecNoError; // no change is not an error
+                LOG_Info("Restored property %s (%x) d=%s r=%s", cloudName, tag->propId,
+                        propValue[0].stringValue, propValue[1].stringValue);
             }
-
-            // Set sync state as last action
-            if (!property)
+            else
             {
-                property = LSD_GetPropertyByAgentSideId(&tag.deviceId, tag.propId);
+                LOG_Info("Restored property %s (%x)", cloudName, tag->propId);
+
             }
 
-            if (property)
+            LOG_Info("   Property %s was out of sync d=%i, r=%i", cloudName,
+                    tag->propType.desiredOutOfSync, tag->propType.reportedOutOfSync);
+        }
+    }
+
+    EnsoPropertyDelta_t delta;
+    int deltaCounter = 0;
+
+    /*
+     * Set the value of the property.
+     *
+     * No need to send notifications to subscribers if we read previous
+     * values from database.
+     */
+
+#if VERBOSE_STORAGE_MANAGER_DEBUG
+    LOG_Info("   Setting property %s with out of sync d=%i, r=%i", cloudName,
+            tag->propType.desiredOutOfSync, tag->propType.reportedOutOfSync);
+#endif
+
+
+    retVal = LSD_SetPropertyValueByCloudNameWithoutNotification(
+                STORAGE_HANDLER,
+                &tag->deviceId,
+                tag->propGroup,
+                cloudName,
+                value,
+                &delta, &deltaCounter);
+
+    if (retVal == eecNoChange)
+    {
+        retVal = eecNoError; // no change is not an error
+    }
+    else if (retVal < 0)
+    {
+        // The other records are still worth loading
+        LOG_Warning("Failed to set property %s %s", cloudName, LSD_EnsoErrorCode_eToString(retVal));
+        retVal = eecNoError;
+    }
+
+    // Set sync state as last action
+    if (!property)
+    {
+        property = LSD_GetPropertyByAgentSideId(&tag->deviceId, tag->propId);
+    }
+
+    if (property)
+    {
+        // Only public properties can be out of sync, the rest are refused
+        LSD_SetPropertyOutOfSyncState(&tag->deviceId, property->cloudName, REPORTED_GROUP,
+                tag->propType.reportedOutOfSync);
+        LSD_SetPropertyOutOfSyncState(&tag->deviceId, property->cloudName, DESIRED_GROUP,
+                tag->propType.desiredOutOfSync);
+    }
+    else
+    {
+        LOG_Error("Failed to find %s property that we have just restored?", cloudName);
+    }
+    return retVal;
+}
+
+/**
+ * \name    _STO_CreateDevice
+ *
+ * \brief   Create a device read back from storage, with the private
+ *          properties every device has
+ *
+ * \param   deviceId  The device id
+ *
+ * \return  The device, NULL if it could not be created
+ */
+static EnsoObject_t* _STO_CreateDevice(const EnsoDeviceId_t* deviceId)
+{
+    EnsoObject_t* device = LSD_CreateEnsoObject(*deviceId);
+    if (!device)
+    {
+        LOG_Error("LSD_CreateEnsoObject failed");
+        return NULL;
+    }
+
+    // Create the device status private property.
+    EnsoPropertyValue_u deviceStatusValue[PROPERTY_GROUP_MAX];
+    deviceStatusValue[DESIRED_GROUP].uint32Value = THING_CREATED;
+    EnsoErrorCode_e result = LSD_CreateProperty(device, PROP_DEVICE_STATUS_ID, PROP_DEVICE_STATUS_CLOUD_NAME, evUnsignedInt32, PROPERTY_PRIVATE, false, false, deviceStatusValue);
+    if (result < 0)
+    {
+        LOG_Error("Failed to create device status property %s", LSD_EnsoErrorCode_eToString(result));
+    }
+
+    // Create the connection (private) property.
+    EnsoPropertyValue_u connValue[PROPERTY_GROUP_MAX];
+    connValue[DESIRED_GROUP].int32Value = -1;
+    connValue[REPORTED_GROUP].int32Value = -1;
+    result = LSD_CreateProperty( device, PROP_CONNECTION_ID, PROP_CONNECTION_ID_CLOUD_NAME, evInt32, PROPERTY_PRIVATE, false, false, connValue);
+    if (result < 0)
+    {
+        LOG_Error("Failed to create connection property %s", LSD_EnsoErrorCode_eToString(result));
+    }
+    LSD_RegisterEnsoObject(device);
+    return device;
+}
+
+
+/**
+ * \name    _STO_ReaderFill
+ *
+ * \brief   Read ahead until size bytes are buffered or the log ends
+ *
+ * \return  Number of bytes buffered
+ */
+static uint32_t _STO_ReaderFill(STO_LogReader_t* reader, uint32_t size)
+{
+    if (reader->end - reader->start >= size)
+    {
+        return reader->end - reader->start;
+    }
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    while (reader->end < size)
+    {
+        int n = OSAL_StoreRead(reader->handle, reader->buffer + reader->end, STO_READ_BUFFER_SIZE - reader->end);
+        if (n <= 0)
+        {
+            break;
+        }
+        reader->end += n;
+    }
+    return reader->end;
+}
+
+/**
+ * \name    _STO_ReaderRead
+ *
+ * \brief   Copy the next size bytes of the log, large reads bypass the buffer
+ *
+ * \return  Number of bytes copied, less than size at the end of the log
+ */
+static uint32_t _STO_ReaderRead(STO_LogReader_t* reader, void* dest, uint32_t size)
+{
+    uint8_t* p = dest;
+    uint32_t copied = 0;
+    while (copied < size)
+    {
+        uint32_t wanted = size - copied;
+        if (reader->end == reader->start && wanted >= STO_READ_BUFFER_SIZE)
+        {
+            int n = OSAL_StoreRead(reader->handle, p + copied, wanted);
+            if (n <= 0)
             {
-                property->type.reportedOutOfSync = tag.propType.reportedOutOfSync;
-                property->type.desiredOutOfSync = tag.propType.desiredOutOfSync;
+                break;
             }
-            else
+            if (reader->checksum)
             {
-                LOG_Error("Failed to find %s property that we have just restored?", cloudName);
+                reader->crc = OSAL_Crc32(reader->crc, p + copied, n);
             }
+            copied += n;
+            reader->offset += n;
+            continue;
         }
-        else if (size == 0)
+        uint32_t available = _STO_ReaderFill(reader, 1);
+        if (available == 0)
         {
-            LOG_Info("End of log file");
-            readFromLog = false;
+            break;
         }
-        else
+        uint32_t n = (wanted < available) ? wanted : available;
+        memcpy(p + copied, reader->buffer + reader->start, n);
+        if (reader->checksum)
         {
-            LOG_Error("STO_ReadRecord failed");
-            readFromLog = false;
-            retVal = eecReadFailed;
+            reader->crc = OSAL_Crc32(reader->crc, p + copied, n);
         }
+        reader->start += n;
+        reader->offset += n;
+        copied += n;
     }
-
-    return retVal;
+    return copied;
 }
 
-
 /**
- * \name    STO_ReadRecord
+ * \name    _STO_ReadRecord
  *
- * \brief   Read the next record from the store log identified by handle.
+ * \brief   Read and check the next record of a log.
  *
- * \param        handle    Store handle to read the record from
+ * \param        reader    Log reader
  *
  * \param[out]   tag       Record tag
  *
@@ -530,94 +1125,112 @@ static EnsoErrorCode_e _LoadFromLog(Handle_t handle)
  *
  * \param[out]   value     Record value
  *
- * \return  EnsoErrorCode_e
+ * \return  Record size, 0 at the end of the log or eecReadFailed if the
+ *          record is corrupted
  */
-int STO_ReadRecord(
-        Handle_t handle,
+static int _STO_ReadRecord(
+        STO_LogReader_t* reader,
         EnsoTag_t* tag,
         char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE], // Temporary, to be removed
         uint16_t* length,
         EnsoPropertyValue_u* value)
 {
-    // Sanity checks
-    if (!tag || !value)
+    STO_RecordHeader_t header;
+    uint32_t crc = 0;
+    uint32_t size = 0;
+
+    if (!reader->legacy)
     {
-        return eecNullPointerSupplied;
+        size = _STO_ReaderRead(reader, &header, sizeof header);
+        if (size == 0)
+        {
+            return 0;
+        }
+        if ((size != sizeof header) ||
+            (header.magic != STO_RECORD_MAGIC) ||
+            (header.version != STO_RECORD_VERSION) ||
+            (header.length < STO_RECORD_FIXED_SIZE))
+        {
+            LOG_Error("Bad record header");
+            return eecReadFailed;
+        }
+        crc = OSAL_Crc32(0, &header, STO_RECORD_CRC_SPAN);
+        reader->generation = header.generation;
     }
-    int size = OSAL_StoreRead(handle, tag, sizeof(EnsoTag_t));
-    if (size == 0)
+
+    // Tag, property name (to be removed), length and value
+    uint8_t fixed[STO_RECORD_FIXED_SIZE];
+    uint32_t n = _STO_ReaderRead(reader, fixed, sizeof fixed);
+    if (n == 0 && reader->legacy)
     {
         return 0;
     }
-    if (size != sizeof(EnsoTag_t))
+    if (n != sizeof fixed)
     {
-        LOG_Error("Failed to read tag, file could be corrupted");
+        LOG_Error("Unexpected end of file, %lu bytes of record", (unsigned long)n);
         return eecReadFailed;
     }
-    // Property name - to be removed
-    size = OSAL_StoreRead(handle, cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE);
-    if (size == 0)
+    size += n;
+    crc = OSAL_Crc32(crc, fixed, sizeof fixed);
+
+    const uint8_t* p = fixed;
+    memcpy(tag, p, sizeof *tag);
+    p += sizeof *tag;
+    memcpy(cloudName, p, LSD_PROPERTY_NAME_BUFFER_SIZE);
+    p += LSD_PROPERTY_NAME_BUFFER_SIZE;
+    memcpy(length, p, sizeof *length);
+    p += sizeof *length;
+    memcpy(value, p, sizeof *value);
+
+    if (*length != 0 && *length != sizeof(EnsoPropertyValue_u))
     {
-        LOG_Error("Unexpected end of file reading property name");
+        LOG_Error("Bad length %d", *length);
         return eecReadFailed;
     }
-    if (size != LSD_PROPERTY_NAME_BUFFER_SIZE)
-    {
-        LOG_Error("Wrong size %d, file could be corrupted", size);
-        return eecReadFailed;
-    }
-    // Length
-    size = OSAL_StoreRead(handle, length, sizeof(uint16_t));
-    if (size == 0)
-    {
-        LOG_Error("Unexpected end of file reading length");
-        return eecReadFailed;
-    }
-    if (size != sizeof(uint16_t))
-    {
-        LOG_Error("Wrong size %d, file could be corrupted", size);
-        return eecReadFailed;
-    }
-    // Value
-    size = OSAL_StoreRead(handle, value, sizeof(EnsoPropertyValue_u));
-    if (size == 0)
+
+    // Blob is stored as size, data
+    uint32_t blobsize = 0;
+    if (tag->propType.valueType == evBlobHandle)
     {
-        LOG_Error("Unexpected end of file reading value");
-        return eecReadFailed;
+        blobsize = value->uint32Value;
+        value->memoryHandle = NULL;
     }
-    if (size != sizeof(EnsoPropertyValue_u))
+    if (!reader->legacy && (header.length != STO_RECORD_FIXED_SIZE + blobsize))
     {
-        LOG_Error("Failed to read property value, file could be corrupted");
+        LOG_Error("Bad record length %lu", (unsigned long)header.length);
         return eecReadFailed;
     }
-    if (tag->propType.valueType == evBlobHandle)
+    if (blobsize != 0)
     {
-        uint32_t blobsize = value->uint32Value;
-        // blob is stored as size, data
-        if (blobsize != 0)
+        value->memoryHandle = OSAL_MemoryRequest(NULL, blobsize);
+        if (value->memoryHandle == NULL)
         {
-            value->memoryHandle = OSAL_MemoryRequest(NULL, blobsize);
-            if (value->memoryHandle != NULL)
-            {
-                size = OSAL_StoreRead(handle, value->memoryHandle, blobsize);
-                if (blobsize != size)
-                {
-                    LOG_Error("blobsize %d size %d", blobsize, size);
-                    OSAL_Free(value->memoryHandle);
-                    value->memoryHandle = NULL;
-                    return eecReadFailed;
-                }
-            }
-            else
-            {
-                LOG_Error("OSAL_MemoryRequest failed");
-            }
+            LOG_Error("OSAL_MemoryRequest failed");
+            return eecReadFailed;
         }
-        else
+        n = _STO_ReaderRead(reader, value->memoryHandle, blobsize);
+        if (n != blobsize)
         {
+            LOG_Error("blobsize %lu size %lu", (unsigned long)blobsize, (unsigned long)n);
+            OSAL_Free(value->memoryHandle);
             value->memoryHandle = NULL;
+            return eecReadFailed;
         }
+        size += n;
+        crc = OSAL_Crc32(crc, value->memoryHandle, blobsize);
+    }
+
+    if (!reader->legacy && (crc != header.crc))
+    {
+        LOG_Error("Bad record CRC %08lx, expected %08lx", (unsigned long)crc, (unsigned long)header.crc);
+        if (value->memoryHandle != NULL && blobsize != 0)
+        {
+            OSAL_Free(value->memoryHandle);
+            value->memoryHandle = NULL;
+        }
+        return eecReadFailed;
     }
+
 #if VERBOSE_STORAGE_MANAGER_DEBUG
     char buf[20];
     LOG_Trace("Tag:%016"PRIx64"_%04x_%02x %08x %08x %02x %s Name:%-11.11s Len:%d Val:%s",
@@ -640,105 +1253,780 @@ int STO_ReadRecord(
  */
 EnsoErrorCode_e STO_CheckSizeAndConsolidate(void)
 {
-    EnsoErrorCode_e retVal = eecNoError;
+    EnsoErrorCode_e retVal = _STO_WritePending();
+    if (eecNoError != retVal)
+    {
+        return retVal;
+    }
     int size = OSAL_StoreSize(STO_CurrentLog);
     LOG_Trace("Store size : %d", size);
     if (size >= STO_MAX_STORE_SIZE_IN_BYTES)
     {
         LOG_Info("-----> Store size is %d, consolidating ...", size);
-        // Check that we don't already have an archive log.
-        if (OSAL_StoreExist(STO_ArchiveLog))
+        retVal = _STO_Consolidate();
+    }
+    return retVal;
+}
+
+
+/**
+ * \name    _STO_Consolidate
+ *
+ * \brief   Write a new snapshot of the local shadow, then drop the logs it
+ *          replaces. The local shadow holds at least what the logs do once
+ *          the queued records are written. Deltas still waiting in the
+ *          handler queue are older than the snapshot and are appended to the
+ *          new log, replaying them at boot ends in the same values.
+ *
+ * \return  EnsoErrorCode_e
+ */
+static EnsoErrorCode_e _STO_Consolidate(void)
+{
+    EnsoErrorCode_e retVal = _STO_WritePending();
+    if (eecNoError == retVal)
+    {
+        retVal = _STO_WriteSnapshot(STO_NewSnapshot);
+    }
+    if (eecNoError != retVal)
+    {
+        LOG_Error("Failed to write %s %s, keeping the logs", STO_NewSnapshot, LSD_EnsoErrorCode_eToString(retVal));
+        OSAL_StoreRemove(STO_NewSnapshot);
+        return retVal;
+    }
+
+    // From here a power failure is completed at boot, see STO_LoadFromStorage()
+    if (OSAL_StoreExist(STO_Snapshot) && (0 != OSAL_StoreRemove(STO_Snapshot)))
+    {
+        LOG_Error("OSAL_StoreRemove of %s failed", STO_Snapshot);
+        return eecRemoveFailed;
+    }
+    if (0 != OSAL_StoreAtomicRename(STO_NewSnapshot, STO_Snapshot))
+    {
+        LOG_Error("OSAL_StoreAtomicRename failed");
+        return eecRenameFailed;
+    }
+
+    // The logs are covered by the snapshot whether or not they are removed
+    _logGeneration++;
+    if (OSAL_StoreExist(STO_CurrentLog) && (0 != OSAL_StoreRemove(STO_CurrentLog)))
+    {
+        LOG_Error("OSAL_StoreRemove of %s failed", STO_CurrentLog);
+        retVal = eecRemoveFailed;
+    }
+    if (OSAL_StoreExist(STO_ArchiveLog) && (0 != OSAL_StoreRemove(STO_ArchiveLog)))
+    {
+        LOG_Error("OSAL_StoreRemove of %s failed", STO_ArchiveLog);
+        retVal = eecRemoveFailed;
+    }
+    LOG_Info("***** Consolidation Complete *****");
+    return retVal;
+}
+
+
+/**
+ * \name    _STO_SnapshotPut
+ *
+ * \brief   Add bytes to a snapshot, the buffer is written when full
+ */
+static void _STO_SnapshotPut(STO_SnapshotWriter_t* writer, const void* data, uint32_t size)
+{
+    const uint8_t* p = data;
+    writer->crc = OSAL_Crc32(writer->crc, data, size);
+    while (size > 0 && !writer->failed)
+    {
+        uint32_t n = STO_READ_BUFFER_SIZE - writer->length;
+        if (n > size)
         {
-            LOG_Warning("Archive log already exists, archive will be lost");
+            n = size;
         }
-        // Rename the current store the archive
-        int success = OSAL_StoreAtomicRename(STO_CurrentLog, STO_ArchiveLog);
-        if (0 != success)
+        memcpy(writer->buffer + writer->length, p, n);
+        writer->length += n;
+        p += n;
+        size -= n;
+        if (writer->length == STO_READ_BUFFER_SIZE)
         {
-            LOG_Error("OSAL_StoreAtomicRename failed");
-            retVal = eecRenameFailed;
+            writer->failed = (OSAL_StoreWrite(writer->handle, writer->buffer, writer->length) != writer->length);
+            writer->length = 0;
         }
-        else
+    }
+}
+
+/**
+ * \name    _STO_SnapshotPutValue
+ *
+ * \brief   Add a property value in its snapshot encoding
+ */
+static void _STO_SnapshotPutValue(STO_SnapshotWriter_t* writer, EnsoValueType_e type, const EnsoPropertyValue_u* value)
+{
+    switch (type)
+    {
+    case evBoolean:
+    {
+        uint8_t b = value->booleanValue;
+        _STO_SnapshotPut(writer, &b, sizeof b);
+        break;
+    }
+    case evString:
+    {
+        uint8_t length = strnlen(value->stringValue, LSD_STRING_PROPERTY_MAX_LENGTH);
+        _STO_SnapshotPut(writer, &length, sizeof length);
+        _STO_SnapshotPut(writer, value->stringValue, length);
+        break;
+    }
+    case evBlobHandle:
+    {
+        uint32_t size = value->memoryHandle ? OSAL_GetBlockSize(value->memoryHandle) : 0;
+        _STO_SnapshotPut(writer, &size, sizeof size);
+        _STO_SnapshotPut(writer, value->memoryHandle, size);
+        break;
+    }
+    case evTimestamp:
+    {
+        uint8_t isValid = value->timestamp.isValid;
+        _STO_SnapshotPut(writer, &value->timestamp.seconds, sizeof value->timestamp.seconds);
+        _STO_SnapshotPut(writer, &isValid, sizeof isValid);
+        break;
+    }
+    default:
+        _STO_SnapshotPut(writer, &value->uint32Value, sizeof value->uint32Value);
+        break;
+    }
+}
+
+/**
+ * \name    _STO_CompareDevices
+ *
+ * \brief   qsort() comparison of device ids
+ */
+static int _STO_CompareDevices(const void* left, const void* right)
+{
+    return LSD_DeviceIdCompare(left, right);
+}
+
+/**
+ * \name    _STO_CompareProperties
+ *
+ * \brief   qsort() comparison of properties by agent side id
+ */
+static int _STO_CompareProperties(const void* left, const void* right)
+{
+    EnsoAgentSidePropertyId_t l = ((const EnsoProperty_t*)left)->agentSidePropertyID;
+    EnsoAgentSidePropertyId_t r = ((const EnsoProperty_t*)right)->agentSidePropertyID;
+    return (l > r) - (l < r);
+}
+
+/**
+ * \name    _STO_WriteSnapshot
+ *
+ * \brief   Write the persistent properties of the local shadow to a snapshot
+ *          in a single pass. Each device is copied from the local shadow in
+ *          turn, the local shadow is only locked for the copy.
+ *
+ * \param   name    Snapshot name, the file is overwritten
+ *
+ * \return  EnsoErrorCode_e
+ */
+static EnsoErrorCode_e _STO_WriteSnapshot(const char* name)
+{
+    EnsoErrorCode_e retVal = eecNoError;
+    STO_SnapshotWriter_t writer = { .length = 0, .crc = 0, .failed = false };
+    STO_NameTable_t table = { .count = 0 };
+    STO_SnapshotTrailer_t trailer = { .magic = STO_SNAPSHOT_TRAILER_MAGIC, .numDevices = 0, .numNames = 0, .numProperties = 0,
+                                      .logGeneration = _logGeneration };
+    uint16_t numDevices = 0;
+    uint16_t capacity = STO_SNAPSHOT_PROPERTIES;
+
+    EnsoDeviceId_t* devices = OSAL_MemoryRequest(NULL, LSD_MAX_THING_LIMIT * sizeof *devices);
+    EnsoProperty_t* properties = OSAL_MemoryRequest(NULL, capacity * sizeof *properties);
+    writer.buffer = OSAL_MemoryRequest(NULL, STO_READ_BUFFER_SIZE);
+    table.names = OSAL_MemoryRequest(NULL, STO_SNAPSHOT_MAX_NAMES * sizeof *table.names);
+    if (!devices || !properties || !writer.buffer || !table.names)
+    {
+        LOG_Error("malloc failed");
+        retVal = eecPoolFull;
+        goto done;
+    }
+
+    retVal = LSD_GetAllDevicesId(devices, LSD_MAX_THING_LIMIT, &numDevices);
+    if (eecNoError != retVal)
+    {
+        goto done;
+    }
+    qsort(devices, numDevices, sizeof *devices, _STO_CompareDevices);
+
+    writer.handle = OSAL_StoreOpen(name, WRITE_ONLY);
+    if (writer.handle == NULL)
+    {
+        LOG_Error("Failed to open %s", name);
+        retVal = eecOpenFailed;
+        goto done;
+    }
+
+    STO_SnapshotHeader_t header = { .magic = STO_SNAPSHOT_MAGIC, .version = STO_SNAPSHOT_VERSION };
+    _STO_SnapshotPut(&writer, &header, sizeof header);
+
+    for (int d = 0; (d < numDevices) && !writer.failed; d++)
+    {
+        uint16_t numProperties = 0;
+        retVal = LSD_GetPropertiesByFilter(&devices[d], PROPERTY_FILTER_PERSISTENT, properties, capacity, &numProperties);
+        if (eecBufferTooSmall == retVal)
         {
-            // Create a new empty store
-            Handle_t handle = OSAL_StoreOpen(STO_CurrentLog, WRITE_ONLY);
-            if (handle == NULL)
+            // Grow and try again, the device may gain properties meanwhile
+            OSAL_Free(properties);
+            capacity = numProperties + STO_SNAPSHOT_PROPERTIES;
+            properties = OSAL_MemoryRequest(NULL, capacity * sizeof *properties);
+            if (!properties)
             {
-                LOG_Error("Failed to open %s", STO_CurrentLog);
-                retVal = eecOpenFailed;
+                LOG_Error("malloc failed");
+                retVal = eecPoolFull;
+                break;
             }
-            else
+            d--;
+            continue;
+        }
+        if (eecEnsoObjectNotFound == retVal)
+        {
+            // Deleted since the list was made
+            retVal = eecNoError;
+            continue;
+        }
+        if (eecNoError != retVal)
+        {
+            break;
+        }
+        if (numProperties == 0)
+        {
+            continue;
+        }
+        qsort(properties, numProperties, sizeof *properties, _STO_CompareProperties);
+
+        uint8_t childDeviceId = devices[d].childDeviceId;
+        uint8_t isChild = devices[d].isChild;
+        _STO_SnapshotPut(&writer, &devices[d].deviceAddress, sizeof devices[d].deviceAddress);
+        _STO_SnapshotPut(&writer, &devices[d].technology, sizeof devices[d].technology);
+        _STO_SnapshotPut(&writer, &childDeviceId, sizeof childDeviceId);
+        _STO_SnapshotPut(&writer, &isChild, sizeof isChild);
+        _STO_SnapshotPut(&writer, &numProperties, sizeof numProperties);
+
+        for (int i = 0; i < numProperties; i++)
+        {
+            EnsoProperty_t* property = &properties[i];
+            _STO_SnapshotPut(&writer, &property->agentSidePropertyID, sizeof property->agentSidePropertyID);
+
+            // Interned name, a linear search is enough for the few names in use
+            uint8_t index = 0;
+            while ((index < table.count) && (0 != strncmp(table.names[index], property->cloudName, LSD_PROPERTY_NAME_BUFFER_SIZE)))
+            {
+                index++;
+            }
+            bool literal = (index == table.count);
+            if (literal && (table.count == STO_SNAPSHOT_MAX_NAMES))
             {
-                if (0 != OSAL_StoreClose(handle))
+                index = STO_SNAPSHOT_NAME_LITERAL;
+            }
+            _STO_SnapshotPut(&writer, &index, sizeof index);
+            if (literal)
+            {
+                uint8_t length = strnlen(property->cloudName, LSD_PROPERTY_NAME_MAX_LENGTH);
+                _STO_SnapshotPut(&writer, &length, sizeof length);
+                _STO_SnapshotPut(&writer, property->cloudName, length);
+                if (index != STO_SNAPSHOT_NAME_LITERAL)
                 {
-                    LOG_Error("Failed to close %s", STO_CurrentLog);
-                    retVal = eecCloseFailed;
+                    memcpy(table.names[table.count], property->cloudName, length);
+                    table.names[table.count][length] = '\0';
+                    table.count++;
                 }
-                // Dump local shadow in the current log
-                retVal = _DumpLocalShadow();
             }
+
+            uint8_t flags = (property->type.reportedOutOfSync ? STO_SNAPSHOT_REPORTED_OUT_OF_SYNC : 0) |
+                            (property->type.desiredOutOfSync  ? STO_SNAPSHOT_DESIRED_OUT_OF_SYNC  : 0) |
+                            (property->type.buffered          ? STO_SNAPSHOT_BUFFERED             : 0) |
+                            (property->type.kind == PROPERTY_PUBLIC ? STO_SNAPSHOT_PUBLIC     : 0);
+            uint8_t valueType = property->type.valueType;
+            _STO_SnapshotPut(&writer, &flags, sizeof flags);
+            _STO_SnapshotPut(&writer, &valueType, sizeof valueType);
+            _STO_SnapshotPutValue(&writer, property->type.valueType, &property->desiredValue);
+            _STO_SnapshotPutValue(&writer, property->type.valueType, &property->reportedValue);
+            if (property->type.valueType == evBlobHandle)
+            {
+                OSAL_Free(property->desiredValue.memoryHandle);
+                OSAL_Free(property->reportedValue.memoryHandle);
+            }
+        }
+        trailer.numDevices++;
+        trailer.numProperties += numProperties;
+    }
+
+    if (eecNoError == retVal)
+    {
+        trailer.numNames = table.count;
+        trailer.crc = OSAL_Crc32(writer.crc, &trailer, offsetof(STO_SnapshotTrailer_t, crc));
+        writer.crc = 0;
+        _STO_SnapshotPut(&writer, &trailer, sizeof trailer);
+        if (!writer.failed && writer.length != 0)
+        {
+            writer.failed = (OSAL_StoreWrite(writer.handle, writer.buffer, writer.length) != writer.length);
+        }
+        if (writer.failed)
+        {
+            LOG_Error("Failed to write %s", name);
+            retVal = eecWriteFailed;
+        }
+        else
+        {
+            LOG_Info("%s: %d devices, %lu properties, %d names", name, trailer.numDevices,
+                    (unsigned long)trailer.numProperties, trailer.numNames);
         }
     }
+    if (0 != OSAL_StoreClose(writer.handle))
+    {
+        LOG_Error("Failed to close %s", name);
+        retVal = eecCloseFailed;
+    }
+
+done:
+    OSAL_Free(table.names);
+    OSAL_Free(writer.buffer);
+    OSAL_Free(properties);
+    OSAL_Free(devices);
     return retVal;
 }
 
-
 /**
-* \name    _DumpLocalShadow
-*
-* \brief   Dump local shadow in the log.
-*
-* \return  EnsoErrorCode_e
-*/
-static EnsoErrorCode_e _DumpLocalShadow(void)
+ * \name    _STO_CheckSnapshot
+ *
+ * \brief   Check the trailer and CRC of a snapshot
+ *
+ * \param   name    Snapshot name
+ *
+ * \param[out] logGeneration Set to the last log generation the snapshot
+ *                           holds, unless NULL
+ *
+ * \return  eecNoError if the snapshot was written in full
+ */
+static EnsoErrorCode_e _STO_CheckSnapshot(const char* name, uint8_t* logGeneration)
 {
-    EnsoErrorCode_e retVal = eecNoError;
-
-    MessageQueue_t destQueue = ECOM_GetMessageQueue(LSD_HANDLER);
-    uint8_t id = ECOM_DUMP_LOCAL_SHADOW;
+    STO_SnapshotTrailer_t trailer;
+    int size = OSAL_StoreSize(name);
+    if (size < (int)(sizeof(STO_SnapshotHeader_t) + sizeof trailer))
+    {
+        LOG_Error("%s is too short, %d bytes", name, size);
+        return eecReadFailed;
+    }
 
-    if (OSAL_SendMessage(destQueue, &id, 1, MessagePriority_medium) < 0)
+    Handle_t handle = OSAL_StoreOpen(name, READ_ONLY);
+    if (handle == NULL)
     {
-        LOG_Error("OSAL_SendMessage failed %s", strerror(errno));
-        retVal = eecInternalError;
+        LOG_Error("Failed to open %s", name);
+        return eecOpenFailed;
+    }
+    uint8_t* buffer = OSAL_MemoryRequest(NULL, STO_READ_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        LOG_Error("malloc %d failed", STO_READ_BUFFER_SIZE);
+        OSAL_StoreClose(handle);
+        return eecReadFailed;
     }
 
+    EnsoErrorCode_e retVal = eecNoError;
+    uint32_t crc = 0;
+    uint32_t remaining = size - sizeof trailer;
+    while (remaining > 0)
+    {
+        int n = OSAL_StoreRead(handle, buffer, (remaining < STO_READ_BUFFER_SIZE) ? remaining : STO_READ_BUFFER_SIZE);
+        if (n <= 0)
+        {
+            break;
+        }
+        crc = OSAL_Crc32(crc, buffer, n);
+        remaining -= n;
+    }
+    if ((remaining != 0) || (OSAL_StoreRead(handle, &trailer, sizeof trailer) != sizeof trailer))
+    {
+        LOG_Error("Failed to read %s", name);
+        retVal = eecReadFailed;
+    }
+    else
+    {
+        crc = OSAL_Crc32(crc, &trailer, offsetof(STO_SnapshotTrailer_t, crc));
+        if ((trailer.magic != STO_SNAPSHOT_TRAILER_MAGIC) || (trailer.crc != crc))
+        {
+            LOG_Error("Bad %s CRC %08lx, expected %08lx", name, (unsigned long)crc, (unsigned long)trailer.crc);
+            retVal = eecReadFailed;
+        }
+        else if (logGeneration != NULL)
+        {
+            *logGeneration = trailer.logGeneration;
+        }
+    }
+    OSAL_Free(buffer);
+    OSAL_StoreClose(handle);
     return retVal;
 }
 
+/**
+ * \name    _STO_SnapshotGetValue
+ *
+ * \brief   Read a property value in its snapshot encoding, blobs are
+ *          allocated
+ *
+ * \return  true if the value was read in full
+ */
+static bool _STO_SnapshotGetValue(STO_LogReader_t* reader, EnsoValueType_e type, EnsoPropertyValue_u* value)
+{
+    memset(value, 0, sizeof *value);
+    switch (type)
+    {
+    case evBoolean:
+    {
+        uint8_t b;
+        if (_STO_ReaderRead(reader, &b, sizeof b) != sizeof b)
+        {
+            return false;
+        }
+        value->booleanValue = b;
+        return true;
+    }
+    case evString:
+    {
+        uint8_t length;
+        return (_STO_ReaderRead(reader, &length, sizeof length) == sizeof length) &&
+               (length <= LSD_STRING_PROPERTY_MAX_LENGTH) &&
+               (_STO_ReaderRead(reader, value->stringValue, length) == length);
+    }
+    case evBlobHandle:
+    {
+        uint32_t size;
+        if (_STO_ReaderRead(reader, &size, sizeof size) != sizeof size)
+        {
+            return false;
+        }
+        if (size == 0)
+        {
+            return true;
+        }
+        value->memoryHandle = OSAL_MemoryRequest(NULL, size);
+        if (value->memoryHandle == NULL)
+        {
+            LOG_Error("OSAL_MemoryRequest failed");
+            return false;
+        }
+        // The local shadow holds blobs as null terminated strings
+        if ((_STO_ReaderRead(reader, value->memoryHandle, size) != size) ||
+            (memchr(value->memoryHandle, '\0', size) == NULL))
+        {
+            OSAL_Free(value->memoryHandle);
+            value->memoryHandle = NULL;
+            return false;
+        }
+        return true;
+    }
+    case evTimestamp:
+    {
+        uint8_t isValid;
+        if ((_STO_ReaderRead(reader, &value->timestamp.seconds, sizeof value->timestamp.seconds) != sizeof value->timestamp.seconds) ||
+            (_STO_ReaderRead(reader, &isValid, sizeof isValid) != sizeof isValid))
+        {
+            return false;
+        }
+        value->timestamp.isValid = isValid;
+        return true;
+    }
+    default:
+        return _STO_ReaderRead(reader, &value->uint32Value, sizeof value->uint32Value) == sizeof value->uint32Value;
+    }
+}
+
+/**
+ * \name    _STO_FreeValues
+ *
+ * \brief   Free the blobs of values read from a snapshot and not handed to
+ *          the Local Shadow
+ */
+static void _STO_FreeValues(EnsoValueType_e type, EnsoPropertyValue_u* values)
+{
+    if (evBlobHandle == type)
+    {
+        for (int group = 0; group < PROPERTY_GROUP_MAX; group++)
+        {
+            OSAL_Free(values[group].memoryHandle);
+            values[group].memoryHandle = NULL;
+        }
+    }
+}
 
 /**
- * \name    STO_LocalShadowDumpComplete
+ * \name    _STO_LoadSnapshot
+ *
+ * \brief   Load a snapshot into the Local Shadow in a single pass, checking
+ *          its CRC as it is read. Each property is set once with both its
+ *          values.
+ *
+ *          Nothing is left behind by a bad snapshot: the devices it created
+ *          are destroyed again, and the properties of devices already in
+ *          the Local Shadow are only set once the CRC is checked.
  *
- * \brief   Called when the Local Shadow has been dumped into storage.
- *          This function completes the consolidation process by
- *          removing the archive log.
+ * \param   name    Snapshot name
  *
- * \param   propertyGroup     Property group for which the dump is complete
+ * \param[out] logGeneration Set to the last log generation the snapshot holds
  *
  * \return  EnsoErrorCode_e
  */
-EnsoErrorCode_e STO_LocalShadowDumpComplete(const PropertyGroup_e propertyGroup)
+static EnsoErrorCode_e _STO_LoadSnapshot(const char* name, uint8_t* logGeneration)
 {
-    static unsigned int count = 0;
+    STO_SnapshotTrailer_t trailer;
+    int size = OSAL_StoreSize(name);
+    if (size < (int)(sizeof(STO_SnapshotHeader_t) + sizeof trailer))
+    {
+        LOG_Error("%s is too short, %d bytes", name, size);
+        return eecReadFailed;
+    }
+
+    Handle_t handle = OSAL_StoreOpen(name, READ_ONLY);
+    if (handle == NULL)
+    {
+        LOG_Error("Failed to open %s", name);
+        return eecOpenFailed;
+    }
+    STO_LogReader_t reader = { .handle = handle, .start = 0, .end = 0, .offset = 0, .legacy = false, .checksum = true, .crc = 0 };
+    STO_NameTable_t table = { .count = 0 };
+    EnsoDeviceId_t* created = NULL;
+    uint16_t numCreated = 0;
+    STO_SnapshotProperty_t* held = NULL;
+    uint32_t numHeld = 0;
+    uint32_t maxHeld = 0;
     EnsoErrorCode_e retVal = eecNoError;
+    reader.buffer = OSAL_MemoryRequest(NULL, STO_READ_BUFFER_SIZE);
+    table.names = OSAL_MemoryRequest(NULL, STO_SNAPSHOT_MAX_NAMES * sizeof *table.names);
+    created = OSAL_MemoryRequest(NULL, LSD_MAX_THING_LIMIT * sizeof *created);
+    if (!reader.buffer || !table.names || !created)
+    {
+        LOG_Error("malloc failed");
+        retVal = eecReadFailed;
+        goto done;
+    }
 
-    ++count;
-    if (count == 2) // We wait for a dump of reported and desired
+    STO_SnapshotHeader_t header;
+    if ((_STO_ReaderRead(&reader, &header, sizeof header) != sizeof header) ||
+        (header.magic != STO_SNAPSHOT_MAGIC) ||
+        (header.version != STO_SNAPSHOT_VERSION))
     {
-        LOG_Info("***** Dump LOCAL SHADOW Complete *****");
+        LOG_Error("Bad %s header", name);
+        retVal = eecReadFailed;
+        goto done;
+    }
 
-        // Delete the archive
-        int success = OSAL_StoreRemove(STO_ArchiveLog);
-        if (0 != success)
+    // Devices follow each other up to the trailer
+    uint32_t end = size - sizeof trailer;
+    uint32_t numProperties = 0;
+    while ((eecNoError == retVal) && (reader.offset < end))
+    {
+        EnsoDeviceId_t deviceId;
+        uint8_t childDeviceId;
+        uint8_t isChild;
+        uint16_t count;
+        memset(&deviceId, 0, sizeof deviceId);
+        if ((_STO_ReaderRead(&reader, &deviceId.deviceAddress, sizeof deviceId.deviceAddress) != sizeof deviceId.deviceAddress) ||
+            (_STO_ReaderRead(&reader, &deviceId.technology, sizeof deviceId.technology) != sizeof deviceId.technology) ||
+            (_STO_ReaderRead(&reader, &childDeviceId, sizeof childDeviceId) != sizeof childDeviceId) ||
+            (_STO_ReaderRead(&reader, &isChild, sizeof isChild) != sizeof isChild) ||
+            (_STO_ReaderRead(&reader, &count, sizeof count) != sizeof count))
         {
-            LOG_Error("OSAL_StoreRemove of %s failed", STO_ArchiveLog);
-            retVal = eecRemoveFailed;
+            retVal = eecReadFailed;
+            break;
+        }
+        deviceId.childDeviceId = childDeviceId;
+        deviceId.isChild = isChild;
+
+        // A device created here can be destroyed again if the CRC is bad,
+        // the properties of one already there are held back until then
+        EnsoObject_t* device = LSD_FindEnsoObjectByDeviceId(&deviceId);
+        bool hold = (device != NULL);
+        if (!device)
+        {
+            if (numCreated < LSD_MAX_THING_LIMIT)
+            {
+                device = _STO_CreateDevice(&deviceId);
+            }
+            if (!device)
+            {
+                retVal = eecEnsoObjectNotCreated;
+                break;
+            }
+            created[numCreated++] = deviceId;
         }
 
-        // Reset count
-        count = 0;
+        for (int i = 0; (i < count) && (eecNoError == retVal); i++)
+        {
+            char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE];
+            EnsoAgentSidePropertyId_t propId;
+            uint8_t index;
+            uint8_t flags;
+            uint8_t valueType;
+            if ((_STO_ReaderRead(&reader, &propId, sizeof propId) != sizeof propId) ||
+                (_STO_ReaderRead(&reader, &index, sizeof index) != sizeof index))
+            {
+                retVal = eecReadFailed;
+                break;
+            }
+            if ((index == table.count) || (index == STO_SNAPSHOT_NAME_LITERAL))
+            {
+                uint8_t length;
+                if ((_STO_ReaderRead(&reader, &length, sizeof length) != sizeof length) ||
+                    (length > LSD_PROPERTY_NAME_MAX_LENGTH) ||
+                    (_STO_ReaderRead(&reader, cloudName, length) != length))
+                {
+                    retVal = eecReadFailed;
+                    break;
+                }
+                cloudName[length] = '\0';
+                if (index != STO_SNAPSHOT_NAME_LITERAL)
+                {
+                    memcpy(table.names[table.count++], cloudName, length + 1);
+                }
+            }
+            else if (index < table.count)
+            {
+                memcpy(cloudName, table.names[index], sizeof cloudName);
+            }
+            else
+            {
+                retVal = eecReadFailed;
+                break;
+            }
+
+            if ((_STO_ReaderRead(&reader, &flags, sizeof flags) != sizeof flags) ||
+                (_STO_ReaderRead(&reader, &valueType, sizeof valueType) != sizeof valueType) ||
+                (valueType >= evNumObjectTypes))
+            {
+                retVal = eecReadFailed;
+                break;
+            }
+            EnsoPropertyType_t propType;
+            memset(&propType, 0, sizeof propType);
+            propType.reportedOutOfSync = (flags & STO_SNAPSHOT_REPORTED_OUT_OF_SYNC) != 0;
+            propType.desiredOutOfSync = (flags & STO_SNAPSHOT_DESIRED_OUT_OF_SYNC) != 0;
+            propType.buffered = (flags & STO_SNAPSHOT_BUFFERED) != 0;
+            propType.persistent = true;
+            propType.kind = (flags & STO_SNAPSHOT_PUBLIC) ? PROPERTY_PUBLIC : PROPERTY_PRIVATE;
+            propType.valueType = valueType;
+
+            // Desired then reported, the order they are stored in
+            EnsoPropertyValue_u values[PROPERTY_GROUP_MAX];
+            memset(values, 0, sizeof values);
+            if (!_STO_SnapshotGetValue(&reader, valueType, &values[DESIRED_GROUP]) ||
+                !_STO_SnapshotGetValue(&reader, valueType, &values[REPORTED_GROUP]))
+            {
+                _STO_FreeValues(valueType, values);
+                retVal = eecReadFailed;
+                break;
+            }
+
+            if (hold)
+            {
+                if (numHeld == maxHeld)
+                {
+                    uint32_t grown = maxHeld ? 2 * maxHeld : STO_SNAPSHOT_PROPERTIES;
+                    STO_SnapshotProperty_t* larger = OSAL_MemoryRequest(NULL, grown * sizeof *larger);
+                    if (!larger)
+                    {
+                        LOG_Error("malloc failed");
+                        _STO_FreeValues(valueType, values);
+                        retVal = eecReadFailed;
+                        break;
+                    }
+                    if (held)
+                    {
+                        memcpy(larger, held, numHeld * sizeof *held);
+                        OSAL_Free(held);
+                    }
+                    held = larger;
+                    maxHeld = grown;
+                }
+                STO_SnapshotProperty_t* entry = &held[numHeld++];
+                entry->deviceId = deviceId;
+                entry->propId = propId;
+                entry->propType = propType;
+                memcpy(entry->cloudName, cloudName, sizeof entry->cloudName);
+                memcpy(entry->values, values, sizeof entry->values);
+            }
+            else
+            {
+                retVal = LSD_RestorePropertyValues(device, propId, cloudName, propType, values);
+                if (retVal < 0)
+                {
+                    // The values are only handed over once the property exists
+                    LOG_Error("Failed to restore property %s %x %s", cloudName, propId,
+                        LSD_EnsoErrorCode_eToString(retVal));
+                    _STO_FreeValues(valueType, values);
+                    break;
+                }
+            }
+            numProperties++;
+        }
     }
+
+    if (eecNoError == retVal)
+    {
+        reader.checksum = false;
+        if ((reader.offset != end) ||
+            (_STO_ReaderRead(&reader, &trailer, sizeof trailer) != sizeof trailer))
+        {
+            retVal = eecReadFailed;
+        }
+        else
+        {
+            uint32_t crc = OSAL_Crc32(reader.crc, &trailer, offsetof(STO_SnapshotTrailer_t, crc));
+            if ((trailer.magic != STO_SNAPSHOT_TRAILER_MAGIC) || (trailer.crc != crc))
+            {
+                LOG_Error("Bad %s CRC %08lx, expected %08lx", name, (unsigned long)crc, (unsigned long)trailer.crc);
+                retVal = eecReadFailed;
+            }
+        }
+    }
+
+    if (eecNoError == retVal)
+    {
+        for (uint32_t i = 0; i < numHeld; i++)
+        {
+            EnsoObject_t* device = LSD_FindEnsoObjectByDeviceId(&held[i].deviceId);
+            EnsoErrorCode_e result = device ?
+                    LSD_RestorePropertyValues(device, held[i].propId, held[i].cloudName, held[i].propType, held[i].values) :
+                    eecEnsoObjectNotFound;
+            if (result < 0)
+            {
+                // The other properties are still worth loading
+                LOG_Warning("Failed to restore property %s %x %s", held[i].cloudName, held[i].propId,
+                    LSD_EnsoErrorCode_eToString(result));
+                _STO_FreeValues(held[i].propType.valueType, held[i].values);
+            }
+        }
+        numHeld = 0;
+        *logGeneration = trailer.logGeneration;
+        LOG_Info("%s: %lu properties", name, (unsigned long)numProperties);
+    }
+    else
+    {
+        LOG_Error("Corrupted %s at offset %lu", name, (unsigned long)reader.offset);
+        for (uint16_t i = 0; i < numCreated; i++)
+        {
+            if (eecNoError == LSD_RemoveAllPropertiesOfObject_Safe(&created[i]))
+            {
+                LSD_DestroyEnsoDeviceDirectly(created[i]);
+            }
+        }
+    }
+
+done:
+    for (uint32_t i = 0; i < numHeld; i++)
+    {
+        _STO_FreeValues(held[i].propType.valueType, held[i].values);
+    }
+    OSAL_Free(held);
+    OSAL_Free(created);
+    OSAL_Free(table.names);
+    OSAL_Free(reader.buffer);
+    OSAL_StoreClose(handle);
     return retVal;
 }
 
@@ -746,10 +2034,18 @@ EnsoErrorCode_e STO_LocalShadowDumpComplete(const PropertyGroup_e propertyGroup)
 /**
  * \name    STO_RemoveLogs
  *
- * \brief   Removes Archive and Current Logs
+ * \brief   Removes the snapshot, Archive and Current Logs
  */
 void STO_RemoveLogs(void)
 {
+    if (OSAL_StoreExist(STO_NewSnapshot))
+    {
+        OSAL_StoreRemove(STO_NewSnapshot);
+    }
+    if (OSAL_StoreExist(STO_Snapshot))
+    {
+        OSAL_StoreRemove(STO_Snapshot);
+    }
     if (OSAL_StoreExist(STO_ArchiveLog))
     {
         OSAL_StoreRemove(STO_ArchiveLog);
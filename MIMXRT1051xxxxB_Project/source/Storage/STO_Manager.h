@@ -47,9 +47,17 @@ EnsoErrorCode_e STO_WriteRecord(
         uint16_t length,
         EnsoPropertyValue_u* valuep);
 
-EnsoErrorCode_e STO_CheckSizeAndConsolidate(void);
+EnsoErrorCode_e STO_QueueRecord(
+        EnsoTag_t* tag,
+        char cloudName[LSD_PROPERTY_NAME_BUFFER_SIZE], // Temporary, to be removed
+        uint16_t length,
+        EnsoPropertyValue_u* valuep);
+
+EnsoErrorCode_e STO_Flush(void);
 
-EnsoErrorCode_e STO_LocalShadowDumpComplete(const PropertyGroup_e propertyGroup);
+bool STO_HasPendingRecords(void);
+
+EnsoErrorCode_e STO_CheckSizeAndConsolidate(void);
 
 void STO_RemoveLogs(void);
 